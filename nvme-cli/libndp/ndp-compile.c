@@ -0,0 +1,1317 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Compilers of the filter, aggregate, top-K and sample programs and of the
+ * regex DFA, run on the host so that the target only interprets tables.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ndp-private.h"
+
+/*
+ * Filter program of NDP_OPC_FILTER: a 16 byte header (magic, delimiter,
+ * number of selected columns and of instructions), the selected columns as
+ * 16 bit words padded to 8 bytes, then the predicate as postfix instructions
+ * of 8 bytes (op, type, column, constant length), each followed by its
+ * constant padded to 8 bytes.  All fields are little endian.
+ */
+#define NDP_FILTER_MAGIC	0x4650444e	/* "NDPF" */
+#define NDP_FILTER_HDR_LEN	16
+#define NDP_FILTER_INSN_LEN	8
+#define NDP_FILTER_MAX_COLUMNS	64
+#define NDP_FILTER_MAX_COLUMN	1023
+#define NDP_FILTER_MAX_INSNS	256
+#define NDP_FILTER_MAX_NESTING	32
+
+enum ndp_filter_op {
+	NDP_FILTER_OP_EQ = 1,
+	NDP_FILTER_OP_NE,
+	NDP_FILTER_OP_LT,
+	NDP_FILTER_OP_LE,
+	NDP_FILTER_OP_GT,
+	NDP_FILTER_OP_GE,
+	NDP_FILTER_OP_CONTAINS,
+	NDP_FILTER_OP_AND,
+	NDP_FILTER_OP_OR,
+	NDP_FILTER_OP_NOT,
+};
+
+struct ndp_filter_parser {
+	const char *p;
+	__u8 *buf;
+	__u32 len;
+	__u32 size;
+	__u16 num_insns;
+};
+
+static void ndp_filter_skip(struct ndp_filter_parser *ps)
+{
+	for (;;) {
+		while (isspace((unsigned char)*ps->p))
+			ps->p++;
+		if (*ps->p != '#')
+			return;
+		while (*ps->p && *ps->p != '\n')
+			ps->p++;
+	}
+}
+
+/* Consume kw if it is the next word, or the next token when punct is set */
+static bool ndp_filter_accept(struct ndp_filter_parser *ps, const char *kw, bool punct)
+{
+	size_t n = strlen(kw);
+
+	ndp_filter_skip(ps);
+	if (strncmp(ps->p, kw, n))
+		return false;
+	if (!punct && (isalnum((unsigned char)ps->p[n]) || ps->p[n] == '_'))
+		return false;
+	ps->p += n;
+	return true;
+}
+
+static int ndp_filter_error(struct ndp_filter_parser *ps, const char *what)
+{
+	ndp_error("filter: %s at '%.20s'", what, ps->p);
+	return -EINVAL;
+}
+
+static int ndp_filter_emit(struct ndp_filter_parser *ps, __u8 op, __u8 type, __u16 column,
+			   const void *value, __u32 len)
+{
+	__u32 padded = (len + 7) & ~7U;
+	__u8 *insn = ps->buf + ps->len;
+	__le16 column_le = cpu_to_le16(column);
+	__le32 len_le = cpu_to_le32(len);
+
+	if (ps->num_insns == NDP_FILTER_MAX_INSNS ||
+	    ps->size - ps->len < NDP_FILTER_INSN_LEN + padded) {
+		ndp_error("filter: program does not fit in the data buffer");
+		return -E2BIG;
+	}
+
+	insn[0] = op;
+	insn[1] = type;
+	memcpy(insn + 2, &column_le, sizeof(column_le));
+	memcpy(insn + 4, &len_le, sizeof(len_le));
+	memset(insn + NDP_FILTER_INSN_LEN, 0, padded);
+	if (len)
+		memcpy(insn + NDP_FILTER_INSN_LEN, value, len);
+
+	ps->len += NDP_FILTER_INSN_LEN + padded;
+	ps->num_insns++;
+	return 0;
+}
+
+/* $column op value */
+static int ndp_filter_compare(struct ndp_filter_parser *ps)
+{
+	static const struct {
+		const char *str;
+		__u8 op;
+	} ops[] = {
+		{ "==", NDP_FILTER_OP_EQ }, { "!=", NDP_FILTER_OP_NE },
+		{ "<=", NDP_FILTER_OP_LE }, { ">=", NDP_FILTER_OP_GE },
+		{ "<", NDP_FILTER_OP_LT }, { ">", NDP_FILTER_OP_GT },
+		{ "~", NDP_FILTER_OP_CONTAINS }, { "=", NDP_FILTER_OP_EQ },
+	};
+	unsigned long column;
+	const char *start;
+	char num[64], *end;
+	__u64 bits;
+	__le64 le;
+	double d;
+	size_t n;
+	__u8 op;
+	int i;
+
+	ndp_filter_skip(ps);
+	if (*ps->p != '$')
+		return ndp_filter_error(ps, "expected a column like $3");
+	column = strtoul(ps->p + 1, &end, 10);
+	if (end == ps->p + 1 || column > NDP_FILTER_MAX_COLUMN)
+		return ndp_filter_error(ps, "invalid column");
+	ps->p = end;
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++)
+		if (ndp_filter_accept(ps, ops[i].str, true))
+			break;
+	if (i == ARRAY_SIZE(ops))
+		return ndp_filter_error(ps, "expected a comparison");
+	op = ops[i].op;
+
+	ndp_filter_skip(ps);
+	if (*ps->p == '"' || *ps->p == '\'') {
+		start = ps->p + 1;
+		end = strchr(start, *ps->p);
+		if (!end)
+			return ndp_filter_error(ps, "unterminated string");
+		ps->p = end + 1;
+		if (op == NDP_FILTER_OP_CONTAINS && end == start)
+			return ndp_filter_error(ps, "empty substring");
+		return ndp_filter_emit(ps, op, NDP_FILTER_TYPE_STRING, column, start, end - start);
+	}
+
+	start = ps->p;
+	while (*ps->p && !isspace((unsigned char)*ps->p) && *ps->p != ')')
+		ps->p++;
+	n = ps->p - start;
+	if (!n)
+		return ndp_filter_error(ps, "expected a value");
+
+	/* Unquoted numbers compare numerically */
+	if (op != NDP_FILTER_OP_CONTAINS && n < sizeof(num)) {
+		memcpy(num, start, n);
+		num[n] = '\0';
+
+		errno = 0;
+		le = cpu_to_le64((__u64)strtoll(num, &end, 10));
+		if (!errno && end == num + n)
+			return ndp_filter_emit(ps, op, NDP_FILTER_TYPE_INT, column, &le, sizeof(le));
+
+		errno = 0;
+		d = strtod(num, &end);
+		if (!errno && end == num + n && !isnan(d)) {
+			memcpy(&bits, &d, sizeof(bits));
+			le = cpu_to_le64(bits);
+			return ndp_filter_emit(ps, op, NDP_FILTER_TYPE_FLOAT, column, &le, sizeof(le));
+		}
+	}
+
+	return ndp_filter_emit(ps, op, NDP_FILTER_TYPE_STRING, column, start, n);
+}
+
+static int ndp_filter_or(struct ndp_filter_parser *ps, int nesting);
+
+static int ndp_filter_not(struct ndp_filter_parser *ps, int nesting)
+{
+	int err;
+
+	if (nesting > NDP_FILTER_MAX_NESTING)
+		return ndp_filter_error(ps, "expression nested too deep");
+
+	ndp_filter_skip(ps);
+	if (ndp_filter_accept(ps, "not", false) || (ps->p[0] == '!' && ps->p[1] != '=' &&
+						    ndp_filter_accept(ps, "!", true))) {
+		err = ndp_filter_not(ps, nesting + 1);
+		return err ? err : ndp_filter_emit(ps, NDP_FILTER_OP_NOT, 0, 0, NULL, 0);
+	}
+
+	if (ndp_filter_accept(ps, "(", true)) {
+		err = ndp_filter_or(ps, nesting + 1);
+		if (err)
+			return err;
+		if (!ndp_filter_accept(ps, ")", true))
+			return ndp_filter_error(ps, "expected ')'");
+		return 0;
+	}
+
+	return ndp_filter_compare(ps);
+}
+
+static int ndp_filter_and(struct ndp_filter_parser *ps, int nesting)
+{
+	int err;
+
+	err = ndp_filter_not(ps, nesting);
+	while (!err && (ndp_filter_accept(ps, "and", false) || ndp_filter_accept(ps, "&&", true))) {
+		err = ndp_filter_not(ps, nesting);
+		if (!err)
+			err = ndp_filter_emit(ps, NDP_FILTER_OP_AND, 0, 0, NULL, 0);
+	}
+	return err;
+}
+
+static int ndp_filter_or(struct ndp_filter_parser *ps, int nesting)
+{
+	int err;
+
+	err = ndp_filter_and(ps, nesting);
+	while (!err && (ndp_filter_accept(ps, "or", false) || ndp_filter_accept(ps, "||", true))) {
+		err = ndp_filter_and(ps, nesting);
+		if (!err)
+			err = ndp_filter_emit(ps, NDP_FILTER_OP_OR, 0, 0, NULL, 0);
+	}
+	return err;
+}
+
+static int ndp_filter_delimiter(struct ndp_filter_parser *ps, __u8 *delimiter)
+{
+	static const struct {
+		const char *name;
+		char c;
+	} names[] = {
+		{ "tab", '\t' }, { "\\t", '\t' }, { "comma", ',' }, { "space", ' ' },
+		{ "pipe", '|' }, { "semicolon", ';' },
+	};
+	const char *start;
+	size_t n;
+	int i;
+
+	while (*ps->p == ' ' || *ps->p == '\t')
+		ps->p++;
+	start = ps->p;
+	while (*ps->p && *ps->p != '\n')
+		ps->p++;
+	n = ps->p - start;
+	while (n > 1 && isspace((unsigned char)start[n - 1]))
+		n--;
+
+	if (n == 1 && *start != '\n') {
+		*delimiter = *start;
+		return 0;
+	}
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (n == strlen(names[i].name) && !strncmp(start, names[i].name, n)) {
+			*delimiter = names[i].c;
+			return 0;
+		}
+	}
+	ps->p = start;
+	return ndp_filter_error(ps, "invalid delimiter");
+}
+
+static int ndp_filter_select(struct ndp_filter_parser *ps, __u16 *columns, __u16 *num_columns)
+{
+	unsigned long column;
+	char *end;
+
+	for (;;) {
+		while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == ',' || *ps->p == '$')
+			ps->p++;
+		if (!*ps->p || *ps->p == '\n' || *ps->p == '#')
+			return 0;
+
+		column = strtoul(ps->p, &end, 10);
+		if (end == ps->p || column > NDP_FILTER_MAX_COLUMN)
+			return ndp_filter_error(ps, "invalid column");
+		if (*num_columns == NDP_FILTER_MAX_COLUMNS)
+			return ndp_filter_error(ps, "too many columns selected");
+		columns[(*num_columns)++] = column;
+		ps->p = end;
+	}
+}
+
+static int ndp_filter_word(struct ndp_filter_parser *ps, const char *const *words, int num)
+{
+	int i;
+
+	while (*ps->p == ' ' || *ps->p == '\t')
+		ps->p++;
+	for (i = 0; i < num; i++)
+		if (ndp_filter_accept(ps, words[i], false))
+			return i;
+	return ndp_filter_error(ps, "unexpected word");
+}
+/* Top-K header of NDP_OPC_TOPK and NDP_OPC_SAMPLE, followed by a filter program */
+#define NDP_TOPK_MAGIC		0x4b50444e	/* "NDPK" */
+#define NDP_TOPK_HDR_LEN	16
+#define NDP_TOPK_MAX_K		4096
+#define NDP_TOPK_FLAG_ASCENDING	(1U << 0)
+
+static int ndp_filter_count(struct ndp_filter_parser *ps, __u32 *k)
+{
+	unsigned long val;
+	char *end;
+
+	val = strtoul(ps->p, &end, 10);
+	if (end == ps->p || !val || val > NDP_TOPK_MAX_K)
+		return ndp_filter_error(ps, "invalid number of records");
+	ps->p = end;
+	*k = val;
+	return 0;
+}
+
+/* "top <k> by <column> [int|float] [asc|desc]", the largest integers by default */
+static int ndp_filter_topk(struct ndp_filter_parser *ps, __u32 *k, __u16 *column, __u8 *type,
+			   __u8 *flags)
+{
+	unsigned long val;
+	char *end;
+	int err;
+
+	err = ndp_filter_count(ps, k);
+	if (err)
+		return err;
+	if (!ndp_filter_accept(ps, "by", false))
+		return ndp_filter_error(ps, "expected by");
+
+	while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '$')
+		ps->p++;
+	val = strtoul(ps->p, &end, 10);
+	if (end == ps->p || val > NDP_FILTER_MAX_COLUMN)
+		return ndp_filter_error(ps, "invalid column");
+	ps->p = end;
+	*column = val;
+
+	if (ndp_filter_accept(ps, "float", false))
+		*type = NDP_FILTER_TYPE_FLOAT;
+	else if (ndp_filter_accept(ps, "int", false))
+		*type = NDP_FILTER_TYPE_INT;
+	if (ndp_filter_accept(ps, "asc", false))
+		*flags |= NDP_TOPK_FLAG_ASCENDING;
+	else if (ndp_filter_accept(ps, "desc", false))
+		*flags &= ~NDP_TOPK_FLAG_ASCENDING;
+	return 0;
+}
+
+/*
+ * Compile the text description of a filter into the program run by the
+ * target, e.g.
+ *
+ *	delimiter ,
+ *	select 0 2
+ *	where $3 >= 400 and ($1 == "GET" or not $2 ~ login)
+ *
+ * Columns count from 0 and default to comma separated; without select the
+ * whole record is returned, without where every record matches.  Unquoted
+ * integers and floats compare numerically, anything else as a string, and ~
+ * tests for a substring.  The where clause runs to the end of the text.
+ * Quotes inside the records are not interpreted by the target.
+ *
+ * For NDP_OPC_AGGREGATE, the program is prefixed by the aggregate header and
+ * the text may also hold "aggregate int|float" and "histogram <shift>" lines;
+ * select then names the single column aggregated.
+ *
+ * For NDP_OPC_TOPK and NDP_OPC_SAMPLE, it is prefixed by the top-K header and
+ * the text must hold a "top <k> by <column> [int|float] [asc|desc]" line,
+ * respectively "sample <k> [seed <seed>]".  The key column counts in the
+ * record, not in select.  Without a seed, one is drawn from the clock; it is
+ * left in the header, see ndp_topk_seed(), so that the sample can be repeated.
+ */
+int ndp_compile_filter(const char *text, void *buf, __u32 size, __u32 *prog_len,
+		       __u8 opcode)
+{
+	static const char *const types[] = { "int", "float" };
+	bool aggregate = opcode == NDP_OPC_AGGREGATE;
+	bool topk = opcode == NDP_OPC_TOPK, sample = opcode == NDP_OPC_SAMPLE;
+	__u32 hdr_len = aggregate ? NDP_AGG_HDR_LEN : topk || sample ? NDP_TOPK_HDR_LEN : 0;
+	struct ndp_filter_parser ps = { .p = text };
+	__u16 columns[NDP_FILTER_MAX_COLUMNS];
+	__u8 agg_type = NDP_FILTER_TYPE_INT, agg_flags = 0;
+	unsigned long bucket_shift = 0, seed;
+	__u32 k = 0, seed_val = 0;
+	bool has_seed = false;
+	struct timeval tv;
+	__u16 key_column = 0;
+	__u16 num_columns = 0;
+	__u8 delimiter = ',';
+	bool where = false;
+	__le32 magic_le, le32;
+	__le16 le16;
+	char *end;
+	int err, i;
+
+	if (size < hdr_len)
+		return -E2BIG;
+	ps.buf = (__u8 *)buf + hdr_len;
+	ps.size = size - hdr_len;
+
+	for (err = 0; !err; ) {
+		ndp_filter_skip(&ps);
+		if (!*ps.p)
+			break;
+		if (ndp_filter_accept(&ps, "delimiter", false)) {
+			err = ndp_filter_delimiter(&ps, &delimiter);
+		} else if (ndp_filter_accept(&ps, "select", false)) {
+			err = ndp_filter_select(&ps, columns, &num_columns);
+		} else if (aggregate && ndp_filter_accept(&ps, "aggregate", false)) {
+			i = ndp_filter_word(&ps, types, ARRAY_SIZE(types));
+			if (i < 0)
+				err = i;
+			else
+				agg_type = NDP_FILTER_TYPE_INT + i;
+		} else if (aggregate && ndp_filter_accept(&ps, "histogram", false)) {
+			bucket_shift = strtoul(ps.p, &end, 10);
+			if (end == ps.p || bucket_shift > NDP_AGG_MAX_BUCKET_SHIFT)
+				err = ndp_filter_error(&ps, "invalid histogram bucket shift");
+			ps.p = end;
+			agg_flags |= NDP_AGG_FLAG_HISTOGRAM;
+		} else if (topk && ndp_filter_accept(&ps, "top", false)) {
+			err = ndp_filter_topk(&ps, &k, &key_column, &agg_type, &agg_flags);
+		} else if (sample && ndp_filter_accept(&ps, "sample", false)) {
+			err = ndp_filter_count(&ps, &k);
+			if (!err && ndp_filter_accept(&ps, "seed", false)) {
+				seed = strtoul(ps.p, &end, 0);
+				if (end == ps.p || seed > UINT32_MAX)
+					err = ndp_filter_error(&ps, "invalid seed");
+				ps.p = end;
+				seed_val = seed;
+				has_seed = true;
+			}
+		} else if (ndp_filter_accept(&ps, "where", false)) {
+			where = true;
+			break;
+		} else {
+			err = ndp_filter_error(&ps, "unknown keyword");
+		}
+	}
+	if (err)
+		return err;
+	if (aggregate && num_columns != 1) {
+		ndp_error("filter: select exactly one column to aggregate");
+		return -EINVAL;
+	}
+	if ((topk || sample) && !k) {
+		ndp_error("filter: missing the %s line", topk ? "top <k> by <column>" :
+				"sample <k>");
+		return -EINVAL;
+	}
+	if (sample && !has_seed) {
+		gettimeofday(&tv, NULL);
+		seed_val = (__u32)(tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+
+	ps.len = NDP_FILTER_HDR_LEN + ((num_columns * sizeof(le16) + 7) & ~7U);
+	if (ps.len > ps.size) {
+		ndp_error("filter: program does not fit in the data buffer");
+		return -E2BIG;
+	}
+	memset(buf, 0, hdr_len + ps.len);
+	for (i = 0; i < num_columns; i++) {
+		le16 = cpu_to_le16(columns[i]);
+		memcpy(ps.buf + NDP_FILTER_HDR_LEN + i * sizeof(le16), &le16, sizeof(le16));
+	}
+
+	if (where) {
+		err = ndp_filter_or(&ps, 0);
+		if (err)
+			return err;
+		ndp_filter_skip(&ps);
+		if (*ps.p)
+			return ndp_filter_error(&ps, "unexpected text");
+	}
+
+	magic_le = cpu_to_le32(NDP_FILTER_MAGIC);
+	memcpy(ps.buf, &magic_le, sizeof(magic_le));
+	ps.buf[4] = delimiter;
+	le16 = cpu_to_le16(num_columns);
+	memcpy(ps.buf + 6, &le16, sizeof(le16));
+	le16 = cpu_to_le16(ps.num_insns);
+	memcpy(ps.buf + 8, &le16, sizeof(le16));
+
+	if (aggregate) {
+		magic_le = cpu_to_le32(NDP_AGG_MAGIC);
+		memcpy(buf, &magic_le, sizeof(magic_le));
+		((__u8 *)buf)[4] = agg_type;
+		((__u8 *)buf)[5] = agg_flags;
+		((__u8 *)buf)[6] = bucket_shift;
+	} else if (topk || sample) {
+		memset(buf, 0, hdr_len);
+		magic_le = cpu_to_le32(NDP_TOPK_MAGIC);
+		memcpy(buf, &magic_le, sizeof(magic_le));
+		if (topk) {
+			((__u8 *)buf)[4] = agg_type;
+			((__u8 *)buf)[5] = agg_flags;
+			le16 = cpu_to_le16(key_column);
+			memcpy((__u8 *)buf + 6, &le16, sizeof(le16));
+		}
+		le32 = cpu_to_le32(k);
+		memcpy((__u8 *)buf + 8, &le32, sizeof(le32));
+		le32 = cpu_to_le32(seed_val);
+		memcpy((__u8 *)buf + 12, &le32, sizeof(le32));
+	}
+
+	*prog_len = hdr_len + ps.len;
+	return 0;
+}
+
+__u32 ndp_topk_seed(const void *prog)
+{
+	__le32 le32;
+
+	memcpy(&le32, (const __u8 *)prog + 12, sizeof(le32));
+	return le32toh(le32);
+}
+/*
+ * DFA of NDP_OPC_REGEX: a 16 byte header (magic, number of states and of
+ * classes, start state), the class of each of the 256 byte values, then the
+ * next state of every state and class as 16 bit words.  The last class is
+ * the end of the line.  State 0 rejects the line and state 1 accepts it.
+ * All fields are little endian.
+ */
+#define NDP_REGEX_MAGIC		0x5250444e	/* "NDPR" */
+#define NDP_REGEX_HDR_LEN	16
+#define NDP_REGEX_MAX_STATES	4096
+#define NDP_REGEX_MAX_NODES	4096
+#define NDP_REGEX_MAX_NESTING	32
+#define NDP_REGEX_MAX_REPEAT	255
+#define NDP_REGEX_DEAD		0
+#define NDP_REGEX_MATCH		1
+#define NDP_REGEX_HASH_SIZE	(2 * NDP_REGEX_MAX_STATES)
+
+enum ndp_regex_node_type {
+	NDP_REGEX_EPS,		/* out[0] and out[1], if set */
+	NDP_REGEX_SET,		/* a byte of set, then out[0] */
+	NDP_REGEX_BOL,		/* the start of the line, then out[0] */
+	NDP_REGEX_EOL,		/* the end of the line, then out[0] */
+	NDP_REGEX_ACCEPT,
+};
+
+struct ndp_regex_node {
+	__u8 type;
+	__u8 set[32];
+	int out[2];
+};
+
+/* Part of the NFA entered at start and left through end, an EPS node without out[0] */
+struct ndp_regex_frag {
+	int start;
+	int end;
+};
+
+struct ndp_regex_parser {
+	const char *p;
+	const char *end;
+	struct ndp_regex_node *nodes;
+	int num_nodes;
+};
+
+static int ndp_regex_error(struct ndp_regex_parser *ps, const char *what)
+{
+	ndp_error("regex: %s at '%.*s'", what, (int)min(ps->end - ps->p, 20L), ps->p);
+	return -EINVAL;
+}
+
+static void ndp_regex_set_add(__u8 *set, int c)
+{
+	set[c >> 3] |= 1 << (c & 7);
+}
+
+static bool ndp_regex_set_has(const __u8 *set, int c)
+{
+	return set[c >> 3] & (1 << (c & 7));
+}
+
+static int ndp_regex_node(struct ndp_regex_parser *ps, __u8 type, const __u8 *set)
+{
+	struct ndp_regex_node *node;
+
+	if (ps->num_nodes == NDP_REGEX_MAX_NODES) {
+		ndp_error("regex: expression too large");
+		return -E2BIG;
+	}
+
+	node = &ps->nodes[ps->num_nodes];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->out[0] = -1;
+	node->out[1] = -1;
+	if (set)
+		memcpy(node->set, set, sizeof(node->set));
+	return ps->num_nodes++;
+}
+
+/* A fragment of a single node of type, or an empty one for NDP_REGEX_EPS */
+static int ndp_regex_frag(struct ndp_regex_parser *ps, __u8 type, const __u8 *set,
+			  struct ndp_regex_frag *f)
+{
+	int node, end;
+
+	end = ndp_regex_node(ps, NDP_REGEX_EPS, NULL);
+	if (end < 0)
+		return end;
+	f->start = f->end = end;
+	if (type == NDP_REGEX_EPS)
+		return 0;
+
+	node = ndp_regex_node(ps, type, set);
+	if (node < 0)
+		return node;
+	ps->nodes[node].out[0] = end;
+	f->start = node;
+	return 0;
+}
+
+static void ndp_regex_cat(struct ndp_regex_parser *ps, struct ndp_regex_frag *f,
+			  const struct ndp_regex_frag *next)
+{
+	ps->nodes[f->end].out[0] = next->start;
+	f->end = next->end;
+}
+
+static int ndp_regex_either(struct ndp_regex_parser *ps, struct ndp_regex_frag *f,
+			    const struct ndp_regex_frag *other)
+{
+	int split, end;
+
+	split = ndp_regex_node(ps, NDP_REGEX_EPS, NULL);
+	end = ndp_regex_node(ps, NDP_REGEX_EPS, NULL);
+	if (split < 0 || end < 0)
+		return -E2BIG;
+
+	ps->nodes[split].out[0] = f->start;
+	ps->nodes[split].out[1] = other->start;
+	ps->nodes[f->end].out[0] = end;
+	ps->nodes[other->end].out[0] = end;
+	f->start = split;
+	f->end = end;
+	return 0;
+}
+
+/* f?, f* and f+ */
+static int ndp_regex_loop(struct ndp_regex_parser *ps, struct ndp_regex_frag *f, bool skip,
+			  bool loop)
+{
+	int split, end;
+
+	split = ndp_regex_node(ps, NDP_REGEX_EPS, NULL);
+	end = ndp_regex_node(ps, NDP_REGEX_EPS, NULL);
+	if (split < 0 || end < 0)
+		return -E2BIG;
+
+	ps->nodes[split].out[0] = f->start;
+	ps->nodes[split].out[1] = end;
+	ps->nodes[f->end].out[0] = loop ? split : end;
+	if (skip)
+		f->start = split;
+	f->end = end;
+	return 0;
+}
+
+/* [:name:] */
+static int ndp_regex_named_class(const char *name, size_t len, __u8 *set)
+{
+	static const struct {
+		const char *name;
+		int (*fn)(int);
+	} names[] = {
+		{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+		{ "upper", isupper }, { "lower", islower }, { "space", isspace },
+		{ "blank", isblank }, { "punct", ispunct }, { "print", isprint },
+		{ "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit },
+	};
+	int i, c;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (len != strlen(names[i].name) || strncmp(name, names[i].name, len))
+			continue;
+		for (c = 0; c < 128; c++)
+			if (names[i].fn(c))
+				ndp_regex_set_add(set, c);
+		return 0;
+	}
+	return -EINVAL;
+}
+
+/*
+ * The escape after a backslash: returns the byte it stands for, or 256 when
+ * it is a class like \d, added to set.
+ */
+static int ndp_regex_escape(struct ndp_regex_parser *ps, __u8 *set)
+{
+	__u8 class[32] = {};
+	char c, hex[3] = {};
+	bool negate;
+	int i;
+
+	if (ps->p == ps->end)
+		return ndp_regex_error(ps, "trailing backslash");
+	c = *ps->p++;
+
+	switch (c) {
+	case 't':
+		return '\t';
+	case 'r':
+		return '\r';
+	case 'n':
+		return '\n';
+	case 'x':
+		if (ps->end - ps->p < 2 || !isxdigit((unsigned char)ps->p[0]) ||
+		    !isxdigit((unsigned char)ps->p[1]))
+			return ndp_regex_error(ps, "expected two hex digits");
+		memcpy(hex, ps->p, 2);
+		ps->p += 2;
+		return strtoul(hex, NULL, 16);
+	case 'd': case 'D':
+		ndp_regex_named_class("digit", 5, class);
+		break;
+	case 'w': case 'W':
+		ndp_regex_named_class("alnum", 5, class);
+		ndp_regex_set_add(class, '_');
+		break;
+	case 's': case 'S':
+		ndp_regex_named_class("space", 5, class);
+		break;
+	default:
+		return (unsigned char)c;
+	}
+
+	negate = isupper((unsigned char)c);
+	for (i = 0; i < sizeof(class); i++)
+		set[i] |= negate ? ~class[i] : class[i];
+	return 256;
+}
+
+/* [...], after the '[' */
+static int ndp_regex_bracket(struct ndp_regex_parser *ps, __u8 *set)
+{
+	const char *start = ps->p, *name;
+	bool negate = false;
+	int lo, hi, i;
+
+	if (ps->p < ps->end && *ps->p == '^') {
+		negate = true;
+		ps->p++;
+		start = ps->p;
+	}
+
+	for (;;) {
+		if (ps->p == ps->end)
+			return ndp_regex_error(ps, "unterminated '['");
+		if (*ps->p == ']' && ps->p != start) {
+			ps->p++;
+			break;
+		}
+
+		if (ps->end - ps->p > 1 && !strncmp(ps->p, "[:", 2)) {
+			name = ps->p + 2;
+			ps->p = name;
+			while (ps->p < ps->end && *ps->p != ':')
+				ps->p++;
+			if (ps->end - ps->p < 2 || ps->p[1] != ']' ||
+			    ndp_regex_named_class(name, ps->p - name, set))
+				return ndp_regex_error(ps, "invalid character class");
+			ps->p += 2;
+			continue;
+		}
+
+		if (*ps->p == '\\') {
+			ps->p++;
+			lo = ndp_regex_escape(ps, set);
+			if (lo < 0)
+				return lo;
+			if (lo == 256)
+				continue;
+		} else {
+			lo = (unsigned char)*ps->p++;
+		}
+
+		hi = lo;
+		if (ps->end - ps->p > 1 && ps->p[0] == '-' && ps->p[1] != ']') {
+			ps->p++;
+			if (*ps->p == '\\') {
+				ps->p++;
+				hi = ndp_regex_escape(ps, set);
+				if (hi < 0)
+					return hi;
+			} else {
+				hi = (unsigned char)*ps->p++;
+			}
+			if (hi == 256 || hi < lo)
+				return ndp_regex_error(ps, "invalid range");
+		}
+		for (i = lo; i <= hi; i++)
+			ndp_regex_set_add(set, i);
+	}
+
+	if (negate)
+		for (i = 0; i < 32; i++)
+			set[i] = ~set[i];
+	return 0;
+}
+
+static int ndp_regex_alt(struct ndp_regex_parser *ps, int nesting, struct ndp_regex_frag *f);
+
+static int ndp_regex_atom(struct ndp_regex_parser *ps, int nesting, struct ndp_regex_frag *f)
+{
+	__u8 set[32] = {};
+	int c, err;
+
+	switch (*ps->p) {
+	case '(':
+		ps->p++;
+		err = ndp_regex_alt(ps, nesting + 1, f);
+		if (err)
+			return err;
+		if (ps->p == ps->end || *ps->p != ')')
+			return ndp_regex_error(ps, "expected ')'");
+		ps->p++;
+		return 0;
+	case '^':
+		ps->p++;
+		return ndp_regex_frag(ps, NDP_REGEX_BOL, NULL, f);
+	case '$':
+		ps->p++;
+		return ndp_regex_frag(ps, NDP_REGEX_EOL, NULL, f);
+	case '.':
+		ps->p++;
+		memset(set, 0xff, sizeof(set));
+		break;
+	case '[':
+		ps->p++;
+		err = ndp_regex_bracket(ps, set);
+		if (err)
+			return err;
+		break;
+	case '\\':
+		ps->p++;
+		c = ndp_regex_escape(ps, set);
+		if (c < 0)
+			return c;
+		if (c < 256)
+			ndp_regex_set_add(set, c);
+		break;
+	case '*': case '+': case '?': case '{':
+		return ndp_regex_error(ps, "nothing to repeat");
+	default:
+		ndp_regex_set_add(set, (unsigned char)*ps->p++);
+		break;
+	}
+
+	return ndp_regex_frag(ps, NDP_REGEX_SET, set, f);
+}
+
+/* *, +, ?, {m}, {m,} or {m,n} after an atom, max is -1 for no limit */
+static int ndp_regex_count(struct ndp_regex_parser *ps, long *min, long *max)
+{
+	char *end;
+
+	switch (*ps->p) {
+	case '*':
+		*min = 0;
+		*max = -1;
+		break;
+	case '+':
+		*min = 1;
+		*max = -1;
+		break;
+	case '?':
+		*min = 0;
+		*max = 1;
+		break;
+	case '{':
+		if (!isdigit((unsigned char)ps->p[1]))
+			return ndp_regex_error(ps, "invalid repetition");
+		*min = strtol(ps->p + 1, &end, 10);
+		*max = *min;
+		if (*end == ',') {
+			end++;
+			*max = isdigit((unsigned char)*end) ? strtol(end, &end, 10) : -1;
+		}
+		if (*end != '}' || *min > NDP_REGEX_MAX_REPEAT || *max > NDP_REGEX_MAX_REPEAT ||
+		    (*max >= 0 && *max < *min))
+			return ndp_regex_error(ps, "invalid repetition");
+		ps->p = end;
+		break;
+	default:
+		return 1;
+	}
+
+	ps->p++;
+	return 0;
+}
+
+/*
+ * An atom and its repetition.  Counted repetitions are built from copies of
+ * the atom, parsed again from its text.
+ */
+static int ndp_regex_repeat(struct ndp_regex_parser *ps, int nesting, struct ndp_regex_frag *f)
+{
+	const char *atom = ps->p, *after;
+	struct ndp_regex_frag copy;
+	long min, max, i, n;
+	int err;
+
+	err = ndp_regex_atom(ps, nesting, f);
+	if (err || ps->p == ps->end)
+		return err;
+
+	err = ndp_regex_count(ps, &min, &max);
+	if (err)
+		return err > 0 ? 0 : err;
+	if (ps->p < ps->end && strchr("*+?{", *ps->p))
+		return ndp_regex_error(ps, "nested repetition");
+	if (!max)
+		return ndp_regex_frag(ps, NDP_REGEX_EPS, NULL, f);
+
+	/* min copies, the last one looping without a maximum, then the optional ones */
+	after = ps->p;
+	n = max < 0 ? (min ? min : 1) : max;
+	for (i = 0; i < n; i++) {
+		if (i == 0) {
+			copy = *f;
+		} else {
+			ps->p = atom;
+			err = ndp_regex_atom(ps, nesting, &copy);
+			if (err)
+				return err;
+		}
+
+		if (max < 0 && i == n - 1)
+			err = ndp_regex_loop(ps, &copy, !min, true);
+		else if (i >= min)
+			err = ndp_regex_loop(ps, &copy, true, false);
+		if (err)
+			return err;
+
+		if (i == 0)
+			*f = copy;
+		else
+			ndp_regex_cat(ps, f, &copy);
+	}
+	ps->p = after;
+	return 0;
+}
+
+static int ndp_regex_alt(struct ndp_regex_parser *ps, int nesting, struct ndp_regex_frag *f)
+{
+	struct ndp_regex_frag next, atom;
+	bool first = true;
+	int err;
+
+	if (nesting > NDP_REGEX_MAX_NESTING)
+		return ndp_regex_error(ps, "expression nested too deep");
+
+	for (;;) {
+		err = ndp_regex_frag(ps, NDP_REGEX_EPS, NULL, &next);
+		while (!err && ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+			err = ndp_regex_repeat(ps, nesting, &atom);
+			if (!err)
+				ndp_regex_cat(ps, &next, &atom);
+		}
+		if (err)
+			return err;
+
+		if (first)
+			*f = next;
+		else if ((err = ndp_regex_either(ps, f, &next)))
+			return err;
+		first = false;
+
+		if (ps->p == ps->end || *ps->p != '|')
+			return 0;
+		ps->p++;
+	}
+}
+
+struct ndp_regex_dfa {
+	const struct ndp_regex_node *nodes;
+	int accept;
+	int words;
+
+	/* Nodes on a path to accept, and the closure of the start after the first byte */
+	__u64 *live;
+	__u64 *restart;
+
+	__u8 classes[256];
+	int reps[256];
+	int num_classes;
+
+	/* NFA nodes of each state, and the next states */
+	__u64 *sets;
+	__u16 *next;
+	int num_states;
+
+	int *hash;
+	int *stack;
+	__u64 *tmp;
+};
+
+static bool ndp_regex_has(const __u64 *set, int node)
+{
+	return set[node / 64] & (1ULL << (node % 64));
+}
+
+static void ndp_regex_closure(struct ndp_regex_dfa *dfa, __u64 *set, int node, bool bol,
+			      bool eol)
+{
+	const struct ndp_regex_node *nd;
+	int n = 0;
+
+	dfa->stack[n++] = node;
+	while (n) {
+		node = dfa->stack[--n];
+		if (node < 0 || ndp_regex_has(set, node))
+			continue;
+		set[node / 64] |= 1ULL << (node % 64);
+
+		nd = &dfa->nodes[node];
+		if (nd->type == NDP_REGEX_EPS) {
+			dfa->stack[n++] = nd->out[0];
+			dfa->stack[n++] = nd->out[1];
+		} else if ((nd->type == NDP_REGEX_BOL && bol) || (nd->type == NDP_REGEX_EOL && eol)) {
+			dfa->stack[n++] = nd->out[0];
+		}
+	}
+}
+
+/* Split the bytes into classes no NFA node tells apart */
+static int ndp_regex_classes(struct ndp_regex_dfa *dfa, int num_nodes)
+{
+	int remap[512], n = 1, b, i, k;
+
+	memset(dfa->classes, 0, sizeof(dfa->classes));
+	for (i = 0; i < num_nodes; i++) {
+		if (dfa->nodes[i].type != NDP_REGEX_SET)
+			continue;
+
+		memset(remap, -1, sizeof(remap));
+		n = 0;
+		for (b = 0; b < 256; b++) {
+			k = dfa->classes[b] * 2 + ndp_regex_set_has(dfa->nodes[i].set, b);
+			if (remap[k] < 0)
+				remap[k] = n++;
+			dfa->classes[b] = remap[k];
+		}
+	}
+
+	/* Every byte in its own class leaves no room for the end of the line */
+	if (n == 256) {
+		ndp_error("regex: too many distinct byte classes");
+		return -E2BIG;
+	}
+
+	for (b = 255; b >= 0; b--)
+		dfa->reps[dfa->classes[b]] = b;
+	dfa->num_classes = n + 1;
+	return 0;
+}
+
+/* The DFA state of the NFA nodes in dfa->tmp, added if new */
+static int ndp_regex_state(struct ndp_regex_dfa *dfa)
+{
+	__u64 h = 14695981039346656037ULL, any = 0;
+	__u64 *set = dfa->tmp;
+	int i, slot, s;
+
+	if (ndp_regex_has(set, dfa->accept))
+		return NDP_REGEX_MATCH;
+
+	/* Nodes that can't lead to a match don't make a difference */
+	for (i = 0; i < dfa->words; i++) {
+		set[i] &= dfa->live[i];
+		any |= set[i];
+		h = (h ^ set[i]) * 1099511628211ULL;
+	}
+	if (!any)
+		return NDP_REGEX_DEAD;
+
+	for (slot = h % NDP_REGEX_HASH_SIZE; (s = dfa->hash[slot]);
+	     slot = (slot + 1) % NDP_REGEX_HASH_SIZE) {
+		if (!memcmp(&dfa->sets[s * dfa->words], set, dfa->words * sizeof(*set)))
+			return s;
+	}
+
+	if (dfa->num_states == NDP_REGEX_MAX_STATES) {
+		ndp_error("regex: more than %d DFA states", NDP_REGEX_MAX_STATES);
+		return -E2BIG;
+	}
+	s = dfa->num_states++;
+	memcpy(&dfa->sets[s * dfa->words], set, dfa->words * sizeof(*set));
+	dfa->hash[slot] = s;
+	return s;
+}
+
+/* Next state of s on class c, or on the end of the line */
+static int ndp_regex_step(struct ndp_regex_dfa *dfa, int s, int c)
+{
+	const __u64 *set = &dfa->sets[s * dfa->words];
+	bool eol = c == dfa->num_classes - 1;
+	const struct ndp_regex_node *nd;
+	int node;
+
+	memset(dfa->tmp, 0, dfa->words * sizeof(*dfa->tmp));
+	for (node = 0; node < dfa->words * 64; node++) {
+		if (!ndp_regex_has(set, node))
+			continue;
+		nd = &dfa->nodes[node];
+		if (eol && nd->type == NDP_REGEX_EOL)
+			ndp_regex_closure(dfa, dfa->tmp, nd->out[0], false, true);
+		else if (!eol && nd->type == NDP_REGEX_SET && ndp_regex_set_has(nd->set, dfa->reps[c]))
+			ndp_regex_closure(dfa, dfa->tmp, nd->out[0], false, false);
+	}
+
+	if (eol)
+		return ndp_regex_has(dfa->tmp, dfa->accept) ? NDP_REGEX_MATCH : NDP_REGEX_DEAD;
+
+	/* Unanchored: a match may start at every byte */
+	for (node = 0; node < dfa->words; node++)
+		dfa->tmp[node] |= dfa->restart[node];
+	return ndp_regex_state(dfa);
+}
+
+/* Nodes from which accept can be reached, without a start of the line */
+static void ndp_regex_live(struct ndp_regex_dfa *dfa, int num_nodes)
+{
+	const struct ndp_regex_node *nd;
+	bool changed = true, live;
+	int i;
+
+	dfa->live[dfa->accept / 64] |= 1ULL << (dfa->accept % 64);
+	while (changed) {
+		changed = false;
+		for (i = num_nodes - 1; i >= 0; i--) {
+			if (ndp_regex_has(dfa->live, i))
+				continue;
+			nd = &dfa->nodes[i];
+			live = false;
+			if (nd->type != NDP_REGEX_BOL && nd->type != NDP_REGEX_ACCEPT &&
+			    nd->out[0] >= 0)
+				live = ndp_regex_has(dfa->live, nd->out[0]);
+			if (nd->type == NDP_REGEX_EPS && nd->out[1] >= 0)
+				live |= ndp_regex_has(dfa->live, nd->out[1]);
+			if (live) {
+				dfa->live[i / 64] |= 1ULL << (i % 64);
+				changed = true;
+			}
+		}
+	}
+}
+
+/* Subset construction, the states found are expanded in the order they are found */
+static int ndp_regex_build(struct ndp_regex_dfa *dfa, int start, int num_nodes)
+{
+	int s, c, next, err;
+
+	err = ndp_regex_classes(dfa, num_nodes);
+	if (err)
+		return err;
+	ndp_regex_live(dfa, num_nodes);
+	ndp_regex_closure(dfa, dfa->restart, start, false, false);
+
+	/* Only the first byte of a line may follow a start of the line */
+	dfa->num_states = NDP_REGEX_MATCH + 1;
+	memset(dfa->tmp, 0, dfa->words * sizeof(*dfa->tmp));
+	ndp_regex_closure(dfa, dfa->tmp, start, true, false);
+	err = ndp_regex_state(dfa);
+	if (err < 0)
+		return err;
+
+	for (s = NDP_REGEX_MATCH + 1; s < dfa->num_states; s++) {
+		for (c = 0; c < dfa->num_classes; c++) {
+			next = ndp_regex_step(dfa, s, c);
+			if (next < 0)
+				return next;
+			dfa->next[s * dfa->num_classes + c] = next;
+		}
+	}
+
+	/* The start state, the first one found unless the line is decided right away */
+	return err;
+}
+
+/*
+ * Compile regular expressions, one per line, into the DFA run by the target.
+ * A line matches if any of the expressions matches part of it.  This is the
+ * POSIX extended syntax without back references: . [] [^] [:class:] * + ?
+ * {m,n} | () ^ $, plus \d \w \s, their negations \D \W \S, \t \r and \xHH.
+ * Escapes also work inside brackets.
+ */
+int ndp_compile_regex(const char *text, void *buf, __u32 size, __u32 *prog_len)
+{
+	_ndp_cleanup_free_ struct ndp_regex_node *nodes = NULL;
+	_ndp_cleanup_free_ __u64 *live = NULL;
+	_ndp_cleanup_free_ __u64 *restart = NULL;
+	_ndp_cleanup_free_ __u64 *sets = NULL;
+	_ndp_cleanup_free_ __u64 *tmp = NULL;
+	_ndp_cleanup_free_ __u16 *next = NULL;
+	_ndp_cleanup_free_ int *hash = NULL;
+	_ndp_cleanup_free_ int *stack = NULL;
+	struct ndp_regex_parser ps = {};
+	struct ndp_regex_dfa dfa = {};
+	struct ndp_regex_frag f, line;
+	const char *nl;
+	__le16 le16;
+	__le32 le32;
+	__u32 len;
+	int start, err, s, c;
+
+	nodes = calloc(NDP_REGEX_MAX_NODES, sizeof(*nodes));
+	if (!nodes)
+		return -ENOMEM;
+	ps.nodes = nodes;
+
+	/* Each line is an alternative */
+	f.start = -1;
+	for (; *text; text = nl + 1) {
+		nl = strchrnul(text, '\n');
+		ps.p = text;
+		ps.end = nl;
+		if (ps.end > ps.p && ps.end[-1] == '\r')
+			ps.end--;
+		if (ps.end > ps.p) {
+			err = ndp_regex_alt(&ps, 0, &line);
+			if (!err && ps.p != ps.end)
+				err = ndp_regex_error(&ps, "unmatched ')'");
+			if (!err && f.start >= 0)
+				err = ndp_regex_either(&ps, &f, &line);
+			else if (!err)
+				f = line;
+			if (err)
+				return err;
+		}
+		if (!*nl)
+			break;
+	}
+	if (f.start < 0) {
+		ndp_error("regex: no expression");
+		return -EINVAL;
+	}
+
+	dfa.accept = ndp_regex_node(&ps, NDP_REGEX_ACCEPT, NULL);
+	if (dfa.accept < 0)
+		return dfa.accept;
+	nodes[f.end].out[0] = dfa.accept;
+
+	dfa.nodes = nodes;
+	dfa.words = (ps.num_nodes + 63) / 64;
+	live = calloc(dfa.words, sizeof(*live));
+	restart = calloc(dfa.words, sizeof(*restart));
+	tmp = calloc(dfa.words, sizeof(*tmp));
+	sets = calloc((size_t)NDP_REGEX_MAX_STATES * dfa.words, sizeof(*sets));
+	next = calloc((size_t)NDP_REGEX_MAX_STATES * 256, sizeof(*next));
+	hash = calloc(NDP_REGEX_HASH_SIZE, sizeof(*hash));
+	stack = calloc(2 * ps.num_nodes + 1, sizeof(*stack));
+	if (!live || !restart || !tmp || !sets || !next || !hash || !stack)
+		return -ENOMEM;
+	dfa.live = live;
+	dfa.restart = restart;
+	dfa.tmp = tmp;
+	dfa.sets = sets;
+	dfa.next = next;
+	dfa.hash = hash;
+	dfa.stack = stack;
+
+	start = ndp_regex_build(&dfa, f.start, ps.num_nodes);
+	if (start < 0)
+		return start;
+
+	len = NDP_REGEX_HDR_LEN + sizeof(dfa.classes) +
+	      dfa.num_states * dfa.num_classes * sizeof(le16);
+	if (len > size) {
+		ndp_error("regex: DFA of %d states does not fit in the data buffer",
+				dfa.num_states);
+		return -E2BIG;
+	}
+
+	/* The dead and accepting states are never left */
+	for (s = NDP_REGEX_DEAD; s <= NDP_REGEX_MATCH; s++)
+		for (c = 0; c < dfa.num_classes; c++)
+			next[s * dfa.num_classes + c] = s;
+
+	memset(buf, 0, NDP_REGEX_HDR_LEN);
+	le32 = cpu_to_le32(NDP_REGEX_MAGIC);
+	memcpy(buf, &le32, sizeof(le32));
+	le16 = cpu_to_le16(dfa.num_states);
+	memcpy((__u8 *)buf + 4, &le16, sizeof(le16));
+	le16 = cpu_to_le16(dfa.num_classes);
+	memcpy((__u8 *)buf + 6, &le16, sizeof(le16));
+	le16 = cpu_to_le16(start);
+	memcpy((__u8 *)buf + 8, &le16, sizeof(le16));
+	memcpy((__u8 *)buf + NDP_REGEX_HDR_LEN, dfa.classes, sizeof(dfa.classes));
+	for (s = 0; s < dfa.num_states * dfa.num_classes; s++) {
+		le16 = cpu_to_le16(next[s]);
+		memcpy((__u8 *)buf + NDP_REGEX_HDR_LEN + sizeof(dfa.classes) + s * sizeof(le16),
+		       &le16, sizeof(le16));
+	}
+
+	*prog_len = len;
+	return 0;
+}
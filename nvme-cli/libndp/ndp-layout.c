@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * File layouts, and the cache keeping them across commands.
+ *
+ * A layout is looked up by (device, inode) and reused as long as the size,
+ * mtime, ctime and, where statx() reports it, the change cookie (i_version)
+ * of the file are those seen before FIEMAP ran.  Anything moving the
+ * extents of a file, a write or fallocate() or truncate(), updates ctime.
+ * Timestamps only have the granularity of the kernel tick, so a layout is
+ * only kept if the file was last changed before the tick it was mapped in;
+ * otherwise a change in the same tick could go unnoticed.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+
+#include "ndp-private.h"
+
+/* Extents asked of each FIEMAP call */
+#define NDP_FIEMAP_BATCH	256
+
+#define NDP_LAYOUT_CACHE_DEFAULT	1024
+
+/* Extents FIEMAP gives no usable physical location for */
+#define NDP_FIEMAP_UNMAPPABLE	(FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |	\
+				 FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_INLINE |	\
+				 FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_NOT_ALIGNED)
+
+struct ndp_layout_stamp {
+	__u64 dev;
+	__u64 ino;
+	__u64 size;
+	struct statx_timestamp mtime;
+	struct statx_timestamp ctime;
+	__u64 cookie;
+};
+
+struct ndp_layout_entry {
+	struct ndp_layout_stamp stamp;
+	struct ndp_layout *layout;
+
+	/* Hash chain and LRU list, most recent first */
+	struct ndp_layout_entry *hash_next;
+	struct ndp_layout_entry *prev;
+	struct ndp_layout_entry *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned int capacity;
+	unsigned int count;
+	unsigned int num_buckets;
+	struct ndp_layout_entry **buckets;
+	struct ndp_layout_entry *head;
+	struct ndp_layout_entry *tail;
+	__u64 hits;
+	__u64 misses;
+} g_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.capacity = NDP_LAYOUT_CACHE_DEFAULT,
+};
+
+static int ndp_layout_stat(int fd, struct ndp_layout_stamp *stamp)
+{
+	unsigned int mask = STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME;
+	struct statx stx;
+
+#ifdef STATX_CHANGE_COOKIE
+	mask |= STATX_CHANGE_COOKIE;
+#endif
+	memset(stamp, 0, sizeof(*stamp));
+	if (statx(fd, "", AT_EMPTY_PATH, mask, &stx) < 0)
+		return -errno;
+
+	stamp->dev = ((__u64)stx.stx_dev_major << 32) | stx.stx_dev_minor;
+	stamp->ino = stx.stx_ino;
+	stamp->size = stx.stx_size;
+	stamp->mtime = stx.stx_mtime;
+	stamp->ctime = stx.stx_ctime;
+#ifdef STATX_CHANGE_COOKIE
+	if (stx.stx_mask & STATX_CHANGE_COOKIE)
+		stamp->cookie = stx.stx_change_cookie;
+#endif
+	return 0;
+}
+
+static bool ndp_layout_stamp_equal(const struct ndp_layout_stamp *a,
+				   const struct ndp_layout_stamp *b)
+{
+	return a->size == b->size && a->cookie == b->cookie &&
+	       a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec &&
+	       a->ctime.tv_sec == b->ctime.tv_sec && a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+/* Whether ctime is earlier than the tick of now */
+static bool ndp_layout_stamp_settled(const struct ndp_layout_stamp *stamp,
+				     const struct timespec *now)
+{
+	if (stamp->cookie)
+		return true;
+	return stamp->ctime.tv_sec < now->tv_sec ||
+	       (stamp->ctime.tv_sec == now->tv_sec && stamp->ctime.tv_nsec < now->tv_nsec);
+}
+
+static void ndp_layout_get_ref(struct ndp_layout *layout)
+{
+	__atomic_add_fetch(&layout->refs, 1, __ATOMIC_RELAXED);
+}
+
+void ndp_layout_free(struct ndp_layout *layout)
+{
+	if (!layout || __atomic_sub_fetch(&layout->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+	free(layout->extents);
+	free(layout);
+}
+
+/* Append the extents of one FIEMAP call, merging those contiguous on both sides */
+static int ndp_layout_add(struct ndp_layout *layout, __u32 *capacity, __u64 *end,
+			  const struct fiemap_extent *fe)
+{
+	struct ndp_extent *ext, *extents;
+
+	if (fe->fe_flags & NDP_FIEMAP_UNMAPPABLE)
+		return -EOPNOTSUPP;
+
+	/* The descriptor has no room for holes, the target would read the data shifted */
+	if (fe->fe_logical != *end)
+		return -EOPNOTSUPP;
+	*end = fe->fe_logical + fe->fe_length;
+
+	if (layout->num_extents) {
+		ext = &layout->extents[layout->num_extents - 1];
+		if (ext->physical + ext->length == fe->fe_physical) {
+			ext->length += fe->fe_length;
+			return 0;
+		}
+	}
+
+	if (layout->num_extents == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : NDP_FIEMAP_BATCH;
+		extents = realloc(layout->extents, *capacity * sizeof(*extents));
+		if (!extents)
+			return -ENOMEM;
+		layout->extents = extents;
+	}
+
+	ext = &layout->extents[layout->num_extents++];
+	ext->physical = fe->fe_physical;
+	ext->length = fe->fe_length;
+	return 0;
+}
+
+/* Map all of the extents, FIEMAP_EXTENT_LAST telling when they are over */
+static int ndp_layout_map(int fd, const char *path, __u64 size, struct ndp_layout **layoutp)
+{
+	_ndp_cleanup_free_ struct fiemap *fiemap = NULL;
+	struct ndp_layout *layout;
+	const struct fiemap_extent *fe;
+	__u64 start = 0, end = 0;
+	__u32 capacity = 0, flags = FIEMAP_FLAG_SYNC, i;
+	bool last = false;
+	int err = 0;
+
+	fiemap = malloc(sizeof(*fiemap) + NDP_FIEMAP_BATCH * sizeof(struct fiemap_extent));
+	layout = calloc(1, sizeof(*layout));
+	if (!fiemap || !layout) {
+		free(layout);
+		return -ENOMEM;
+	}
+	layout->size = size;
+	layout->refs = 1;
+
+	while (!last) {
+		memset(fiemap, 0, sizeof(*fiemap));
+		fiemap->fm_start = start;
+		fiemap->fm_length = FIEMAP_MAX_OFFSET - start;
+		fiemap->fm_flags = flags;
+		fiemap->fm_extent_count = NDP_FIEMAP_BATCH;
+		if (ioctl(fd, FS_IOC_FIEMAP, fiemap) < 0) {
+			err = -errno;
+			ndp_error("%s: failed to map the extents: %s", path, strerror(errno));
+			goto err;
+		}
+		if (!fiemap->fm_mapped_extents)
+			break;
+
+		/* The target reads the media, the first call flushes the page cache */
+		flags = 0;
+
+		for (i = 0; i < fiemap->fm_mapped_extents; i++) {
+			fe = &fiemap->fm_extents[i];
+			err = ndp_layout_add(layout, &capacity, &end, fe);
+			if (err) {
+				ndp_error("%s: %s at offset %llu", path,
+					  err == -ENOMEM ? "out of memory" :
+					  fe->fe_logical != end ? "hole" : "extent not on the media",
+					  (unsigned long long)fe->fe_logical);
+				goto err;
+			}
+			last = fe->fe_flags & FIEMAP_EXTENT_LAST;
+		}
+		start = end;
+	}
+
+	if (!layout->num_extents || end < size) {
+		err = -ENODATA;
+		ndp_error("%s: %s", path, layout->num_extents ? "hole at the end" : "no extents");
+		goto err;
+	}
+
+	*layoutp = layout;
+	return 0;
+
+err:
+	ndp_layout_free(layout);
+	return err;
+}
+
+static unsigned int ndp_layout_hash(const struct ndp_layout_stamp *stamp)
+{
+	__u64 h = (stamp->ino ^ (stamp->dev << 17)) * 0x9e3779b97f4a7c15ULL;
+
+	return (unsigned int)(h >> 32) & (g_cache.num_buckets - 1);
+}
+
+static struct ndp_layout_entry **ndp_layout_slot(const struct ndp_layout_stamp *stamp)
+{
+	struct ndp_layout_entry **slot = &g_cache.buckets[ndp_layout_hash(stamp)];
+
+	while (*slot && ((*slot)->stamp.dev != stamp->dev || (*slot)->stamp.ino != stamp->ino))
+		slot = &(*slot)->hash_next;
+	return slot;
+}
+
+static void ndp_layout_lru_unlink(struct ndp_layout_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		g_cache.head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		g_cache.tail = entry->prev;
+}
+
+static void ndp_layout_lru_push(struct ndp_layout_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = g_cache.head;
+	if (g_cache.head)
+		g_cache.head->prev = entry;
+	else
+		g_cache.tail = entry;
+	g_cache.head = entry;
+}
+
+static void ndp_layout_evict(struct ndp_layout_entry *entry)
+{
+	struct ndp_layout_entry **slot = ndp_layout_slot(&entry->stamp);
+
+	*slot = entry->hash_next;
+	ndp_layout_lru_unlink(entry);
+	ndp_layout_free(entry->layout);
+	free(entry);
+	g_cache.count--;
+}
+
+/* With the lock held: the cached layout of the file if it is still valid */
+static struct ndp_layout *ndp_layout_lookup(const struct ndp_layout_stamp *stamp)
+{
+	struct ndp_layout_entry *entry;
+
+	if (!g_cache.buckets)
+		return NULL;
+
+	entry = *ndp_layout_slot(stamp);
+	if (!entry)
+		return NULL;
+	if (!ndp_layout_stamp_equal(&entry->stamp, stamp)) {
+		ndp_layout_evict(entry);
+		return NULL;
+	}
+
+	ndp_layout_lru_unlink(entry);
+	ndp_layout_lru_push(entry);
+	ndp_layout_get_ref(entry->layout);
+	return entry->layout;
+}
+
+/* With the lock held */
+static void ndp_layout_insert(const struct ndp_layout_stamp *stamp, struct ndp_layout *layout)
+{
+	struct ndp_layout_entry *entry, **slot;
+
+	if (!g_cache.capacity)
+		return;
+
+	if (!g_cache.buckets) {
+		g_cache.num_buckets = 1;
+		while (g_cache.num_buckets < g_cache.capacity)
+			g_cache.num_buckets <<= 1;
+		g_cache.buckets = calloc(g_cache.num_buckets, sizeof(*g_cache.buckets));
+		if (!g_cache.buckets)
+			return;
+	}
+
+	/* Another thread may have mapped the same file meanwhile */
+	slot = ndp_layout_slot(stamp);
+	if (*slot)
+		ndp_layout_evict(*slot);
+	if (g_cache.count == g_cache.capacity)
+		ndp_layout_evict(g_cache.tail);
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return;
+	entry->stamp = *stamp;
+	entry->layout = layout;
+	ndp_layout_get_ref(layout);
+
+	slot = ndp_layout_slot(stamp);
+	*slot = entry;
+	ndp_layout_lru_push(entry);
+	g_cache.count++;
+}
+
+int ndp_layout_get(const char *path, struct ndp_layout **layoutp)
+{
+	struct ndp_layout_stamp stamp;
+	struct ndp_layout *layout;
+	struct timespec now;
+	int fd, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		err = -errno;
+		ndp_error("%s: %s", path, strerror(errno));
+		return err;
+	}
+
+	err = ndp_layout_stat(fd, &stamp);
+	if (err) {
+		ndp_error("%s: %s", path, strerror(-err));
+		goto out;
+	}
+
+	pthread_mutex_lock(&g_cache.lock);
+	layout = ndp_layout_lookup(&stamp);
+	if (layout)
+		g_cache.hits++;
+	else
+		g_cache.misses++;
+	pthread_mutex_unlock(&g_cache.lock);
+	if (layout) {
+		*layoutp = layout;
+		goto out;
+	}
+
+	/* Taken before mapping, a change made while FIEMAP runs shows at the next lookup */
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	err = ndp_layout_map(fd, path, stamp.size, &layout);
+	if (err)
+		goto out;
+
+	if (ndp_layout_stamp_settled(&stamp, &now)) {
+		pthread_mutex_lock(&g_cache.lock);
+		ndp_layout_insert(&stamp, layout);
+		pthread_mutex_unlock(&g_cache.lock);
+	}
+	*layoutp = layout;
+
+out:
+	close(fd);
+	return err;
+}
+
+void ndp_layout_cache_set_size(unsigned int entries)
+{
+	pthread_mutex_lock(&g_cache.lock);
+	while (g_cache.tail)
+		ndp_layout_evict(g_cache.tail);
+	free(g_cache.buckets);
+	g_cache.buckets = NULL;
+	g_cache.capacity = entries;
+	pthread_mutex_unlock(&g_cache.lock);
+}
+
+void ndp_layout_cache_flush(void)
+{
+	pthread_mutex_lock(&g_cache.lock);
+	while (g_cache.tail)
+		ndp_layout_evict(g_cache.tail);
+	pthread_mutex_unlock(&g_cache.lock);
+}
+
+void ndp_layout_cache_stats(__u64 *hits, __u64 *misses)
+{
+	pthread_mutex_lock(&g_cache.lock);
+	*hits = g_cache.hits;
+	*misses = g_cache.misses;
+	pthread_mutex_unlock(&g_cache.lock);
+}
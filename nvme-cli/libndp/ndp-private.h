@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#ifndef _LIBNDP_PRIVATE_H
+#define _LIBNDP_PRIVATE_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <linux/nvme_ioctl.h>
+
+#include "ndp.h"
+
+struct ndp_dev {
+	int fd;
+	bool owns_fd;
+	__u32 nsid;
+	__u32 lba_size;
+	__u32 timeout_ms;
+	__u32 he_log_key_q;
+};
+
+#define cpu_to_le16(x)	((__le16)htole16(x))
+#define cpu_to_le32(x)	((__le32)htole32(x))
+#define cpu_to_le64(x)	((__le64)htole64(x))
+#define le16_to_cpu(x)	le16toh((__u16)(x))
+#define le32_to_cpu(x)	le32toh((__u32)(x))
+#define le64_to_cpu(x)	le64toh((__u64)(x))
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#endif
+
+#ifndef min
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#endif
+
+static inline void ndp_freep(void *p)
+{
+	free(*(void **)p);
+}
+#define _ndp_cleanup_free_ __attribute__((cleanup(ndp_freep)))
+
+enum ndp_cmd {
+	NDP_CMD_NONE,
+	NDP_CMD_JOB,
+	NDP_CMD_FETCH,
+	NDP_CMD_RELEASE,
+};
+
+/* Command of a job, or the fetch continuing or dropping the rest of its result */
+void ndp_job_cmd(struct ndp_dev *dev, struct ndp_job *job, enum ndp_cmd type,
+		 struct nvme_passthru_cmd64 *cmd);
+
+/*
+ * Hand the result of the last command to data_fn and set the status of the
+ * job.  Returns the command to send next, NDP_CMD_NONE once the job is over.
+ */
+enum ndp_cmd ndp_job_complete(struct ndp_job *job, int status);
+
+/* Errors of the compilers and of the layout lookup go to stderr */
+void ndp_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* _LIBNDP_PRIVATE_H */
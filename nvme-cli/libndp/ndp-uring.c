@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Asynchronous NDP commands over io_uring NVMe passthrough.
+ *
+ * The ring is set up with 128 byte SQEs and 32 byte CQEs, the former to
+ * carry the command as IORING_OP_URING_CMD and the latter to return the 64
+ * bit result, DW1 being the cursor of the fetch continuing the result.  The
+ * system calls are made directly, which is all the ring needs and keeps the
+ * library free of dependencies.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#include "ndp-private.h"
+
+#define NDP_SQE_SIZE	128
+#define NDP_CQE_SIZE	32
+
+struct ndp_queue {
+	struct ndp_dev *dev;
+	int ring_fd;
+	unsigned int depth;
+	unsigned int inflight;
+
+	/* Filled in but not handed to the kernel yet */
+	unsigned int pending;
+
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	__u8 *sqes;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	__u8 *cqes;
+
+	void *ring;
+	size_t ring_size;
+	size_t sqes_size;
+};
+
+static int ndp_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ndp_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+			   unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int ndp_queue_init(struct ndp_dev *dev, unsigned int depth, struct ndp_queue **qp)
+{
+	struct io_uring_params p;
+	struct ndp_queue *q;
+	size_t sq_size, cq_size;
+	__u8 *ring;
+	int err;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return -ENOMEM;
+	q->dev = dev;
+	q->ring_fd = -1;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
+	q->ring_fd = ndp_uring_setup(depth, &p);
+	if (q->ring_fd < 0) {
+		err = -errno;
+		goto err;
+	}
+
+	/* Both rings share one mapping since 5.4, well before uring_cmd came in 5.19 */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		err = -EOPNOTSUPP;
+		goto err;
+	}
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	cq_size = p.cq_off.cqes + p.cq_entries * NDP_CQE_SIZE;
+	q->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	q->ring = mmap(NULL, q->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       q->ring_fd, IORING_OFF_SQ_RING);
+	if (q->ring == MAP_FAILED) {
+		q->ring = NULL;
+		err = -errno;
+		goto err;
+	}
+
+	q->sqes_size = p.sq_entries * NDP_SQE_SIZE;
+	q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       q->ring_fd, IORING_OFF_SQES);
+	if (q->sqes == MAP_FAILED) {
+		q->sqes = NULL;
+		err = -errno;
+		goto err;
+	}
+
+	ring = q->ring;
+	q->sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+	q->sq_mask = (unsigned int *)(ring + p.sq_off.ring_mask);
+	q->sq_array = (unsigned int *)(ring + p.sq_off.array);
+	q->cq_head = (unsigned int *)(ring + p.cq_off.head);
+	q->cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+	q->cq_mask = (unsigned int *)(ring + p.cq_off.ring_mask);
+	q->cqes = ring + p.cq_off.cqes;
+
+	/* The CQ ring is at least twice the SQ ring, a full SQ never overflows it */
+	q->depth = p.sq_entries;
+	*qp = q;
+	return 0;
+
+err:
+	ndp_queue_free(q);
+	return err;
+}
+
+void ndp_queue_free(struct ndp_queue *q)
+{
+	if (!q)
+		return;
+	if (q->sqes)
+		munmap(q->sqes, q->sqes_size);
+	if (q->ring)
+		munmap(q->ring, q->ring_size);
+	if (q->ring_fd >= 0)
+		close(q->ring_fd);
+	free(q);
+}
+
+static void ndp_queue_prep(struct ndp_queue *q, struct ndp_job *job, enum ndp_cmd type)
+{
+	unsigned int tail = *q->sq_tail, index = tail & *q->sq_mask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)(q->sqes + index * NDP_SQE_SIZE);
+	struct nvme_passthru_cmd64 cmd;
+
+	ndp_job_cmd(q->dev, job, type, &cmd);
+
+	memset(sqe, 0, NDP_SQE_SIZE);
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = q->dev->fd;
+	sqe->cmd_op = NVME_URING_CMD_IO;
+	sqe->user_data = (__u64)(uintptr_t)job;
+
+	/* struct nvme_uring_cmd is struct nvme_passthru_cmd64 without the result */
+	memcpy(sqe->cmd, &cmd, sizeof(struct nvme_uring_cmd));
+
+	q->sq_array[index] = index;
+	__atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	q->pending++;
+}
+
+int ndp_queue_submit(struct ndp_queue *q, struct ndp_job *job)
+{
+	if (q->inflight == q->depth)
+		return -EAGAIN;
+
+	job->result = 0;
+	job->status = 0;
+	job->releasing = false;
+	ndp_queue_prep(q, job, NDP_CMD_JOB);
+	q->inflight++;
+	return 0;
+}
+
+/* Complete the jobs of the CQEs posted so far, returns how many are over */
+static unsigned int ndp_queue_drain(struct ndp_queue *q)
+{
+	unsigned int head = *q->cq_head, done = 0;
+	struct io_uring_cqe *cqe;
+	struct ndp_job *job;
+	enum ndp_cmd next;
+
+	while (head != __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = (struct io_uring_cqe *)(q->cqes + (head & *q->cq_mask) * NDP_CQE_SIZE);
+		job = (struct ndp_job *)(uintptr_t)cqe->user_data;
+		head++;
+
+		/* res is a negative errno or the NVMe status */
+		if (!cqe->res)
+			job->result = cqe->big_cqe[0];
+		next = ndp_job_complete(job, cqe->res);
+		if (next != NDP_CMD_NONE) {
+			/* The SQE of this job was consumed, its slot is free for the fetch */
+			ndp_queue_prep(q, job, next);
+			continue;
+		}
+
+		q->inflight--;
+		done++;
+		if (job->done_fn)
+			job->done_fn(job->cb_arg, job->status);
+	}
+	__atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+
+	return done;
+}
+
+int ndp_queue_reap(struct ndp_queue *q, unsigned int min_jobs)
+{
+	unsigned int done = 0, wait;
+	int ret;
+
+	for (;;) {
+		done += ndp_queue_drain(q);
+
+		wait = done < min_jobs && q->inflight ? 1 : 0;
+		if (!q->pending && !wait)
+			break;
+
+		ret = ndp_uring_enter(q->ring_fd, q->pending, wait,
+				      wait ? IORING_ENTER_GETEVENTS : 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!ret && !wait)
+			break;
+		q->pending -= ret;
+	}
+
+	return done;
+}
+
+unsigned int ndp_queue_inflight(struct ndp_queue *q)
+{
+	return q->inflight;
+}
@@ -0,0 +1,965 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Devices, file layouts, descriptors and the synchronous path of libndp.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/nvme_ioctl.h>
+
+#include "ndp-private.h"
+
+#define NDP_BUF_ALIGN		4096
+
+#define NVME_ADMIN_IDENTIFY	0x06
+#define NVME_IDENTIFY_DATA_LEN	4096
+
+/* Offsets in the identify namespace data */
+#define NVME_ID_NS_FLBAS	26
+#define NVME_ID_NS_LBAF		128
+
+void ndp_error(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+static int ndp_get_lba_size(struct ndp_dev *dev)
+{
+	struct nvme_admin_cmd cmd = {
+		.opcode		= NVME_ADMIN_IDENTIFY,
+		.nsid		= dev->nsid,
+		.data_len	= NVME_IDENTIFY_DATA_LEN,
+	};
+	_ndp_cleanup_free_ __u8 *id = NULL;
+	__u8 flbas, lbaf;
+	int err;
+
+	if (posix_memalign((void **)&id, NDP_BUF_ALIGN, NVME_IDENTIFY_DATA_LEN))
+		return -ENOMEM;
+	memset(id, 0, NVME_IDENTIFY_DATA_LEN);
+	cmd.addr = (__u64)(uintptr_t)id;
+
+	err = ioctl(dev->fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+	if (err)
+		return err < 0 ? -errno : -EIO;
+
+	/* Bits 3:0 and 6:5 of FLBAS are the low and high bits of the format in use */
+	flbas = id[NVME_ID_NS_FLBAS];
+	lbaf = (flbas & 0xf) | ((flbas & 0x60) >> 1);
+	dev->lba_size = 1U << id[NVME_ID_NS_LBAF + 4 * lbaf + 2];
+	return 0;
+}
+
+int ndp_dev_from_fd(int fd, __u32 nsid, struct ndp_dev **devp)
+{
+	struct ndp_dev *dev;
+	int err;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return -ENOMEM;
+	dev->fd = fd;
+	dev->nsid = nsid;
+	dev->he_log_key_q = NDP_HE_DEFAULT_LOG_KEY_Q;
+
+	if (!dev->nsid) {
+		err = ioctl(fd, NVME_IOCTL_ID);
+		if (err <= 0) {
+			err = err < 0 ? -errno : -ENOTTY;
+			goto err;
+		}
+		dev->nsid = err;
+	}
+
+	err = ndp_get_lba_size(dev);
+	if (err)
+		goto err;
+
+	*devp = dev;
+	return 0;
+
+err:
+	free(dev);
+	return err;
+}
+
+int ndp_dev_open(const char *path, struct ndp_dev **devp)
+{
+	int fd, err;
+
+	/* The kernel only lets commands writing to the media through a writable file */
+	fd = open(path, O_RDWR);
+	if (fd < 0 && errno == EACCES)
+		fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	err = ndp_dev_from_fd(fd, 0, devp);
+	if (err) {
+		close(fd);
+		return err;
+	}
+	(*devp)->owns_fd = true;
+	return 0;
+}
+
+void ndp_dev_close(struct ndp_dev *dev)
+{
+	if (!dev)
+		return;
+	if (dev->owns_fd)
+		close(dev->fd);
+	free(dev);
+}
+
+int ndp_dev_fd(struct ndp_dev *dev)
+{
+	return dev->fd;
+}
+
+__u32 ndp_dev_nsid(struct ndp_dev *dev)
+{
+	return dev->nsid;
+}
+
+__u32 ndp_dev_lba_size(struct ndp_dev *dev)
+{
+	return dev->lba_size;
+}
+
+void ndp_dev_set_timeout(struct ndp_dev *dev, __u32 timeout_ms)
+{
+	dev->timeout_ms = timeout_ms;
+}
+
+void ndp_dev_set_he_log_key_q(struct ndp_dev *dev, __u32 log_key_q)
+{
+	dev->he_log_key_q = log_key_q ? log_key_q : NDP_HE_DEFAULT_LOG_KEY_Q;
+}
+
+static __u32 ndp_desc_len(const struct ndp_layout *layout)
+{
+	return (1 + 2 * layout->num_extents) * sizeof(__le64);
+}
+
+static int ndp_desc_check(const char *path, const struct ndp_layout *layout)
+{
+	if (layout->num_extents > NDP_DESC_MAX_EXTENTS) {
+		ndp_error("%s: %u extents, the target takes up to %d", path,
+			  layout->num_extents, NDP_DESC_MAX_EXTENTS);
+		return -E2BIG;
+	}
+	return 0;
+}
+
+/* The (start LBA, number of blocks) pairs of the extents */
+static int ndp_desc_write_extents(struct ndp_dev *dev, const char *path,
+				  const struct ndp_layout *layout, __le64 *words)
+{
+	__u32 lba_size = dev->lba_size;
+	__u32 i;
+
+	for (i = 0; i < layout->num_extents; i++) {
+		const struct ndp_extent *ext = &layout->extents[i];
+
+		/* FIEMAP reports bytes, file systems keep their blocks aligned to LBAs */
+		if (ext->physical % lba_size) {
+			ndp_error("%s: extent at byte %llu is not aligned to the %u bytes LBA",
+				  path, (unsigned long long)ext->physical, lba_size);
+			return -EINVAL;
+		}
+		words[2 * i] = cpu_to_le64(ext->physical / lba_size);
+		words[2 * i + 1] = cpu_to_le64((ext->length + lba_size - 1) / lba_size);
+	}
+	return 0;
+}
+
+static int ndp_desc_write(struct ndp_dev *dev, const char *path,
+			  const struct ndp_layout *layout, void *buf, __u32 size)
+{
+	__le64 *words = buf;
+	int err;
+
+	err = ndp_desc_check(path, layout);
+	if (err)
+		return err;
+	if (ndp_desc_len(layout) > size) {
+		ndp_error("%s: %u extents do not fit in a %u bytes data buffer",
+			  path, layout->num_extents, size);
+		return -E2BIG;
+	}
+
+	words[0] = cpu_to_le64(layout->size);
+	return ndp_desc_write_extents(dev, path, layout, &words[1]);
+}
+
+int ndp_desc_fill(struct ndp_dev *dev, const char *path, void *buf, __u32 size,
+		  __u32 *num_extents, __u32 *desc_len)
+{
+	struct ndp_layout *layout;
+	int err;
+
+	if (!path || !strlen(path)) {
+		ndp_error("target file not given");
+		return -EINVAL;
+	}
+
+	err = ndp_layout_get(path, &layout);
+	if (err)
+		return err;
+
+	err = ndp_desc_write(dev, path, layout, buf, size);
+	if (!err) {
+		*num_extents = layout->num_extents;
+		*desc_len = ndp_desc_len(layout);
+	}
+	ndp_layout_free(layout);
+	return err;
+}
+
+static __u32 ndp_default_data_len(__u8 opcode)
+{
+	/* The result is returned in the same buffer, a histogram takes up to 58KiB */
+	switch (opcode) {
+	case NDP_OPC_AGGREGATE:
+		return NDP_AGG_DATA_LEN;
+	case NDP_OPC_REGEX:
+		return NDP_REGEX_DATA_LEN;
+	case NDP_OPC_HE_ADD:
+		return NDP_HE_DATA_LEN;
+	default:
+		return NDP_DEFAULT_DATA_LEN;
+	}
+}
+
+static int ndp_job_alloc(struct ndp_job *job, __u8 opcode, __u32 data_len)
+{
+	memset(job, 0, sizeof(*job));
+	job->opcode = opcode;
+	job->data_len = data_len ? data_len : ndp_default_data_len(opcode);
+
+	if (posix_memalign(&job->data, NDP_BUF_ALIGN, job->data_len))
+		return -ENOMEM;
+	memset(job->data, 0, job->data_len);
+	job->owns_data = true;
+	return 0;
+}
+
+int ndp_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode, const char *path,
+		 __u32 data_len)
+{
+	struct ndp_layout *layout;
+	int err;
+
+	if (!path || !strlen(path)) {
+		ndp_error("target file not given");
+		return -EINVAL;
+	}
+
+	err = ndp_layout_get(path, &layout);
+	if (err)
+		return err;
+
+	/* Keep the usual room for the arguments and the result after a large descriptor */
+	if (!data_len)
+		data_len = ndp_default_data_len(opcode) +
+			   ((ndp_desc_len(layout) + NDP_BUF_ALIGN - 1) & ~(NDP_BUF_ALIGN - 1));
+
+	err = ndp_job_alloc(job, opcode, data_len);
+	if (!err) {
+		err = ndp_desc_write(dev, path, layout, job->data, job->data_len);
+		if (err) {
+			ndp_job_fini(job);
+		} else {
+			job->cdw11 = layout->num_extents;
+			job->desc_len = ndp_desc_len(layout);
+		}
+	}
+
+	ndp_layout_free(layout);
+	return err;
+}
+
+/*
+ * Batch descriptor: for every file its id, size and number of extents, then
+ * the (start LBA, number of blocks) pair of each extent.  The operator is in
+ * bits 23:16 of CDW10, the number of files in CDW11 and of extents in CDW12.
+ */
+int ndp_batch_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode,
+		       const char *const *paths, __u32 num_paths, __u32 data_len)
+{
+	_ndp_cleanup_free_ struct ndp_layout **layouts = NULL;
+	__u32 num_extents = 0, i, w = 0;
+	__le64 *words;
+	__u64 len;
+	int err = 0;
+
+	if (!num_paths || num_paths > NDP_BATCH_MAX_FILES) {
+		ndp_error("batch of %u files, the target takes 1 to %d", num_paths,
+			  NDP_BATCH_MAX_FILES);
+		return -EINVAL;
+	}
+
+	layouts = calloc(num_paths, sizeof(*layouts));
+	if (!layouts)
+		return -ENOMEM;
+
+	for (i = 0; i < num_paths; i++) {
+		err = ndp_layout_get(paths[i], &layouts[i]);
+		if (!err)
+			err = ndp_desc_check(paths[i], layouts[i]);
+		if (err)
+			goto out;
+		num_extents += layouts[i]->num_extents;
+	}
+
+	if (num_extents > NDP_BATCH_MAX_EXTENTS) {
+		ndp_error("batch of %u extents, the target takes up to %d", num_extents,
+			  NDP_BATCH_MAX_EXTENTS);
+		err = -E2BIG;
+		goto out;
+	}
+
+	len = (3 * (__u64)num_paths + 2 * (__u64)num_extents) * sizeof(__le64);
+	if (!data_len)
+		data_len = ndp_default_data_len(opcode) +
+			   ((len + NDP_BUF_ALIGN - 1) & ~(NDP_BUF_ALIGN - 1));
+	if (len > data_len) {
+		ndp_error("batch descriptor of %llu bytes does not fit in a %u bytes data buffer",
+			  (unsigned long long)len, data_len);
+		err = -E2BIG;
+		goto out;
+	}
+
+	err = ndp_job_alloc(job, NDP_OPC_BATCH, data_len);
+	if (err)
+		goto out;
+
+	words = job->data;
+	for (i = 0; i < num_paths; i++) {
+		words[w++] = cpu_to_le64(i);
+		words[w++] = cpu_to_le64(layouts[i]->size);
+		words[w++] = cpu_to_le64(layouts[i]->num_extents);
+		err = ndp_desc_write_extents(dev, paths[i], layouts[i], &words[w]);
+		if (err) {
+			ndp_job_fini(job);
+			goto out;
+		}
+		w += 2 * layouts[i]->num_extents;
+	}
+
+	job->cdw10 = (__u32)opcode << 16;
+	job->cdw11 = num_paths;
+	job->cdw12 = num_extents;
+	job->desc_len = len;
+
+out:
+	for (i = 0; i < num_paths; i++)
+		ndp_layout_free(layouts[i]);
+	return err;
+}
+
+const struct ndp_batch_entry *ndp_batch_next(const void *data, __u32 len, __u32 *pos)
+{
+	const struct ndp_batch_entry *entry;
+	__u32 entry_len;
+
+	if (*pos >= len || len - *pos < sizeof(*entry))
+		return NULL;
+
+	entry = (const struct ndp_batch_entry *)((const __u8 *)data + *pos);
+	entry_len = le32toh((__u32)entry->len);
+	if (entry_len > len - *pos - sizeof(*entry))
+		return NULL;
+
+	*pos += sizeof(*entry) + ((entry_len + 7) & ~7U);
+	return entry;
+}
+
+/* The operator a job runs, that of the files for a batch */
+static __u8 ndp_job_operator(const struct ndp_job *job)
+{
+	return job->opcode == NDP_OPC_BATCH ? (job->cdw10 >> 16) & 0xff : job->opcode;
+}
+
+int ndp_job_set_args(struct ndp_job *job, const void *args, __u32 len)
+{
+	if (len > job->data_len - job->desc_len || len > 0xffff) {
+		ndp_error("arguments of %u bytes do not fit in the data buffer", len);
+		return -E2BIG;
+	}
+
+	memcpy((__u8 *)job->data + job->desc_len, args, len);
+	job->args_len = len;
+	job->cdw10 = (job->cdw10 & ~0xffffU) | len;
+	return 0;
+}
+
+int ndp_job_compile(struct ndp_job *job, const char *text, __u32 len)
+{
+	__u8 opcode = ndp_job_operator(job);
+	bool regex = opcode == NDP_OPC_REGEX;
+	_ndp_cleanup_free_ char *str = NULL;
+	void *prog = (__u8 *)job->data + job->desc_len;
+	__u32 size = job->data_len - job->desc_len;
+	const char *magic;
+	__u32 prog_len;
+	int err;
+
+	switch (opcode) {
+	case NDP_OPC_FILTER:
+		magic = "NDPF";
+		break;
+	case NDP_OPC_AGGREGATE:
+		magic = "NDPA";
+		break;
+	case NDP_OPC_TOPK:
+	case NDP_OPC_SAMPLE:
+		magic = "NDPK";
+		break;
+	case NDP_OPC_REGEX:
+		magic = "NDPR";
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (len >= 4 && !memcmp(text, magic, 4)) {
+		if (len > size) {
+			ndp_error("program does not fit in the data buffer");
+			return -E2BIG;
+		}
+		memcpy(prog, text, len);
+		prog_len = len;
+	} else {
+		/* The text need not be terminated */
+		str = strndup(text, len);
+		if (!str)
+			return -ENOMEM;
+		if (regex)
+			err = ndp_compile_regex(str, prog, size, &prog_len);
+		else
+			err = ndp_compile_filter(str, prog, size, &prog_len, opcode);
+		if (err)
+			return err;
+	}
+
+	if (prog_len > 0xffff && !regex) {
+		ndp_error("filter: program longer than 64KiB");
+		return -E2BIG;
+	}
+
+	/* A larger DFA takes the rest of the buffer, which CDW10 of 0 stands for */
+	job->args_len = prog_len;
+	job->cdw10 = (job->cdw10 & ~0xffffU) | (prog_len > 0xffff ? 0 : prog_len);
+	return 0;
+}
+
+/*
+ * The descriptor of NDP_OPC_HE_ADD differs from that of the other commands:
+ * for each of the two inputs and the output, the offset of the ciphertext in
+ * the file, then the (byte offset, byte length) pair of every extent.  The
+ * number of extents of each file is in CDW11 to CDW13.
+ */
+/*
+ * The library serializes a ciphertext as its number of slots, logp and
+ * logq, then the coefficients of a and b, 2^log_n of (logq + 1) / 8 bytes
+ * rounded up each.
+ */
+struct ndp_he_ser_hdr {
+	__le64 n;
+	__le64 logp;
+	__le64 logq;
+};
+
+static __u64 ndp_he_ser_coeff_len(__u64 logq)
+{
+	return (logq + 1 + 7) / 8;
+}
+
+/*
+ * Size of a bootstrapped ciphertext: its modulus is raised to log_key_q,
+ * and ring dimension that of the input of size bytes in fd.
+ */
+static __u64 ndp_he_btsrp_size(int fd, __u64 size, __u32 log_key_q)
+{
+	struct ndp_he_ser_hdr hdr;
+	__u64 logq, coeffs;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return size;
+	logq = le64_to_cpu(hdr.logq);
+	if (!logq || logq >= log_key_q || size <= sizeof(hdr))
+		return size;
+
+	coeffs = (size - sizeof(hdr)) / ndp_he_ser_coeff_len(logq);
+	return sizeof(hdr) + coeffs * ndp_he_ser_coeff_len(log_key_q);
+}
+
+/*
+ * Size of the output of an HEaaN operation: that of the first input, but
+ * for the product of RNS packed ciphertexts, which has a third polynomial,
+ * and for a bootstrapped ciphertext, at a larger modulus.
+ */
+static __u64 ndp_he_out_size(struct ndp_dev *dev, const char *in, __u8 opcode, __u64 size)
+{
+	struct ndp_he_ct ct;
+	__u64 len;
+	int fd;
+
+	if (opcode == NDP_OPC_HE_BTSRP) {
+		fd = open(in, O_RDONLY);
+		if (fd < 0)
+			return size;
+		len = ndp_he_btsrp_size(fd, size, dev->he_log_key_q);
+		close(fd);
+		return len;
+	}
+
+	if (opcode != NDP_OPC_HE_MUL)
+		return size;
+
+	fd = open(in, O_RDONLY);
+	if (fd < 0)
+		return size;
+	if (pread(fd, &ct, sizeof(ct), 0) != sizeof(ct) ||
+	    !(le16_to_cpu(ct.flags) & NDP_HE_CT_F_RNS)) {
+		close(fd);
+		return size;
+	}
+	close(fd);
+
+	ct.num_polys = 3;
+	len = ndp_he_ct_len(&ct);
+	return len > size ? len : size;
+}
+
+/*
+ * Layouts of the inputs then of the output of an HEaaN operation, the output
+ * being given the size of the result (see ndp_he_out_size()).
+ */
+static int ndp_he_layouts(struct ndp_dev *dev, const char *const *paths, __u8 opcode,
+			  __u32 num_inputs, struct ndp_layout **layouts)
+{
+	const char *out = paths[num_inputs];
+	__u32 i;
+	int fd, err;
+
+	for (i = 0; i < num_inputs; i++) {
+		err = ndp_layout_get(paths[i], &layouts[i]);
+		if (err)
+			return err;
+	}
+
+	/* Give the output its blocks, the target writes them in place */
+	fd = open(out, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 ||
+	    fallocate(fd, 0, 0, ndp_he_out_size(dev, paths[0], opcode, layouts[0]->size)) < 0) {
+		err = -errno;
+		ndp_error("%s: %s", out, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return err;
+	}
+	close(fd);
+
+	err = ndp_layout_get(out, &layouts[num_inputs]);
+	if (err)
+		return err;
+
+	for (i = 0; i <= num_inputs; i++) {
+		err = ndp_desc_check(paths[i], layouts[i]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/* The (byte offset, byte length) pairs of the extents of an HEaaN file */
+static __u32 ndp_he_write_extents(const struct ndp_layout *layout, __le64 *words)
+{
+	__u32 j, w = 0;
+
+	for (j = 0; j < layout->num_extents; j++) {
+		words[w++] = cpu_to_le64(layout->extents[j].physical);
+		words[w++] = cpu_to_le64(layout->extents[j].length);
+	}
+	return w;
+}
+
+__u64 ndp_he_ct_init(struct ndp_he_ct *ct, __u32 log_n, __u32 log_q, __u32 log_p,
+		     __u32 log_slots)
+{
+	__u32 num_words = (log_q + 63) / 64;
+
+	if (!log_n || log_n > NDP_HE_CT_MAX_LOG_N || !log_q || log_q > NDP_HE_CT_MAX_LOG_Q ||
+	    log_slots >= log_n)
+		return 0;
+
+	memset(ct, 0, sizeof(*ct));
+	ct->magic = cpu_to_le32(NDP_HE_CT_MAGIC);
+	ct->version = cpu_to_le16(NDP_HE_CT_VERSION);
+	ct->log_n = log_n;
+	ct->log_q = cpu_to_le32(log_q);
+	ct->log_p = cpu_to_le32(log_p);
+	ct->log_slots = cpu_to_le32(log_slots);
+	ct->num_words = cpu_to_le32(num_words);
+
+	/* a and b */
+	return sizeof(*ct) + (2ULL << log_n) * num_words * sizeof(__u64);
+}
+
+__u64 ndp_he_ct_init_rns(struct ndp_he_ct *ct, __u32 log_n, const __u64 *primes,
+			 __u32 num_primes, __u32 log_p, __u32 log_slots)
+{
+	__le64 *words = (__le64 *)(ct + 1);
+	__u32 i, log_q = 0;
+
+	if (!log_n || log_n > NDP_HE_CT_MAX_LOG_N || !num_primes ||
+	    num_primes > NDP_HE_CT_MAX_PRIMES || log_slots >= log_n)
+		return 0;
+
+	for (i = 0; i < num_primes; i++) {
+		if (primes[i] >> NDP_HE_CT_MAX_PRIME_BITS || primes[i] % (2ULL << log_n) != 1)
+			return 0;
+		/* Informative only: the bits of the modulus */
+		log_q += 64 - __builtin_clzll(primes[i]);
+	}
+
+	memset(ct, 0, sizeof(*ct));
+	ct->magic = cpu_to_le32(NDP_HE_CT_MAGIC);
+	ct->version = cpu_to_le16(NDP_HE_CT_VERSION);
+	ct->flags = cpu_to_le16(NDP_HE_CT_F_RNS);
+	ct->log_n = log_n;
+	ct->log_q = cpu_to_le32(log_q);
+	ct->log_p = cpu_to_le32(log_p);
+	ct->log_slots = cpu_to_le32(log_slots);
+	ct->num_words = cpu_to_le32(num_primes);
+
+	memset(words, 0, (num_primes + 7) / 8 * sizeof(*ct));
+	for (i = 0; i < num_primes; i++)
+		words[i] = cpu_to_le64(primes[i]);
+
+	return ndp_he_ct_len(ct);
+}
+
+__u64 ndp_he_ct_len(const struct ndp_he_ct *ct)
+{
+	__u32 num_words = le32_to_cpu(ct->num_words);
+	__u32 num_polys = ct->num_polys ? ct->num_polys : 2;
+	__u64 len = sizeof(*ct);
+
+	if (le32_to_cpu(ct->magic) != NDP_HE_CT_MAGIC || ct->log_n > NDP_HE_CT_MAX_LOG_N)
+		return 0;
+
+	/* The primes are padded to the size of the header */
+	if (le16_to_cpu(ct->flags) & NDP_HE_CT_F_RNS)
+		len += (num_words + 7) / 8 * sizeof(*ct);
+
+	return len + ((__u64)num_polys << ct->log_n) * num_words * sizeof(__u64);
+}
+
+/* Number of input ciphertexts of an HEaaN operation, 0 if it isn't one */
+__u32 ndp_he_num_inputs(__u8 opcode)
+{
+	switch (opcode) {
+	case NDP_OPC_HE_ADD:
+	case NDP_OPC_HE_SUB:
+	case NDP_OPC_HE_MUL:
+		return 2;
+	case NDP_OPC_HE_DEC:
+	case NDP_OPC_HE_BTSRP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+int ndp_he_op_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode,
+		       const char *const *paths)
+{
+	__u32 num_inputs = ndp_he_num_inputs(opcode), num_files = num_inputs + 1;
+	struct ndp_layout *layouts[NDP_HE_MAX_INPUTS + 1] = { NULL, };
+	__u32 *counts[] = { &job->cdw11, &job->cdw12, &job->cdw13 };
+	__le64 *words;
+	__u32 len = 0, i, w = 0;
+	int err;
+
+	if (!num_inputs) {
+		ndp_error("opcode 0x%02x is not an HEaaN operation", opcode);
+		return -EINVAL;
+	}
+
+	err = ndp_he_layouts(dev, paths, opcode, num_inputs, layouts);
+	if (err)
+		goto out;
+
+	for (i = 0; i < num_files; i++)
+		len += ndp_desc_len(layouts[i]);
+
+	err = ndp_job_alloc(job, opcode, len > NDP_HE_DATA_LEN ?
+			    (len + NDP_BUF_ALIGN - 1) & ~(NDP_BUF_ALIGN - 1) : 0);
+	if (err)
+		goto out;
+
+	words = job->data;
+	for (i = 0; i < num_files; i++) {
+		words[w++] = 0;
+		w += ndp_he_write_extents(layouts[i], &words[w]);
+		*counts[i] = layouts[i]->num_extents;
+	}
+	job->desc_len = len;
+
+out:
+	for (i = 0; i < num_files; i++)
+		ndp_layout_free(layouts[i]);
+	return err;
+}
+
+int ndp_he_job_init(struct ndp_dev *dev, struct ndp_job *job, const char *in0,
+		    const char *in1, const char *out)
+{
+	const char *paths[] = { in0, in1, out };
+
+	return ndp_he_op_job_init(dev, job, NDP_OPC_HE_ADD, paths);
+}
+
+/*
+ * HEaaN batch descriptor: for every file of every operation its offset, its
+ * number of extents and the (byte offset, byte length) pair of each extent.
+ * The operation is in bits 23:16 of CDW10, the number of operations in CDW11
+ * and of extents in CDW12.
+ */
+int ndp_he_batch_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode,
+			  const char *const *paths, __u32 num_ops)
+{
+	__u32 num_inputs = ndp_he_num_inputs(opcode), num_files = num_inputs + 1;
+	_ndp_cleanup_free_ struct ndp_layout **layouts = NULL;
+	__u32 num_extents = 0, i, w = 0;
+	__le64 *words;
+	__u64 len;
+	int err = 0;
+
+	if (!num_inputs) {
+		ndp_error("opcode 0x%02x is not an HEaaN operation", opcode);
+		return -EINVAL;
+	}
+	if (!num_ops || num_ops > NDP_HE_BATCH_MAX_OPS) {
+		ndp_error("batch of %u operations, the target takes 1 to %d", num_ops,
+			  NDP_HE_BATCH_MAX_OPS);
+		return -EINVAL;
+	}
+
+	layouts = calloc(num_ops * num_files, sizeof(*layouts));
+	if (!layouts)
+		return -ENOMEM;
+
+	for (i = 0; i < num_ops; i++) {
+		err = ndp_he_layouts(dev, &paths[i * num_files], opcode, num_inputs,
+				     &layouts[i * num_files]);
+		if (err)
+			goto out;
+	}
+
+	for (i = 0; i < num_ops * num_files; i++)
+		num_extents += layouts[i]->num_extents;
+	if (num_extents > NDP_HE_BATCH_MAX_EXTENTS) {
+		ndp_error("batch of %u extents, the target takes up to %d", num_extents,
+			  NDP_HE_BATCH_MAX_EXTENTS);
+		err = -E2BIG;
+		goto out;
+	}
+
+	len = (2 * (__u64)num_ops * num_files + 2 * (__u64)num_extents) * sizeof(__le64);
+	err = ndp_job_alloc(job, NDP_OPC_HE_BATCH, len > NDP_HE_DATA_LEN ?
+			    (len + NDP_BUF_ALIGN - 1) & ~(NDP_BUF_ALIGN - 1) : 0);
+	if (err)
+		goto out;
+
+	words = job->data;
+	for (i = 0; i < num_ops * num_files; i++) {
+		words[w++] = 0;
+		words[w++] = cpu_to_le64(layouts[i]->num_extents);
+		w += ndp_he_write_extents(layouts[i], &words[w]);
+	}
+
+	job->cdw10 = (__u32)opcode << 16;
+	job->cdw11 = num_ops;
+	job->cdw12 = num_extents;
+	job->desc_len = len;
+
+out:
+	for (i = 0; i < num_ops * num_files; i++)
+		ndp_layout_free(layouts[i]);
+	return err;
+}
+
+void ndp_job_fini(struct ndp_job *job)
+{
+	if (job->owns_data)
+		free(job->data);
+	job->data = NULL;
+	job->owns_data = false;
+}
+
+void ndp_job_cmd(struct ndp_dev *dev, struct ndp_job *job, enum ndp_cmd type,
+		 struct nvme_passthru_cmd64 *cmd)
+{
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->nsid = dev->nsid;
+	cmd->timeout_ms = dev->timeout_ms;
+
+	if (type == NDP_CMD_RELEASE) {
+		cmd->opcode = NDP_OPC_FETCH;
+		cmd->cdw10 = (__u32)(job->result >> 32);
+		cmd->cdw11 = NDP_FETCH_RELEASE;
+		return;
+	}
+
+	cmd->addr = (__u64)(uintptr_t)job->data;
+	cmd->data_len = job->data_len;
+	if (type == NDP_CMD_FETCH) {
+		cmd->opcode = NDP_OPC_FETCH;
+		cmd->cdw10 = (__u32)(job->result >> 32);
+		return;
+	}
+
+	cmd->opcode = job->opcode;
+	cmd->cdw10 = job->cdw10;
+	cmd->cdw11 = job->cdw11;
+	cmd->cdw12 = job->cdw12;
+	cmd->cdw13 = job->cdw13;
+	cmd->cdw14 = job->cdw14;
+	cmd->cdw15 = job->cdw15;
+}
+
+enum ndp_cmd ndp_job_complete(struct ndp_job *job, int status)
+{
+	__u32 dw0 = (__u32)job->result;
+	int err;
+
+	/* The job was stopped by data_fn, whatever became of the release */
+	if (job->releasing)
+		return NDP_CMD_NONE;
+
+	job->status = status;
+	if (status)
+		return NDP_CMD_NONE;
+
+	if (job->data_fn) {
+		err = job->data_fn(job->cb_arg, job->data,
+				   min(dw0 & NDP_RESULT_LEN_MASK, job->data_len));
+		if (err) {
+			job->status = err;
+			if (!(dw0 & NDP_RESULT_MORE))
+				return NDP_CMD_NONE;
+			job->releasing = true;
+			return NDP_CMD_RELEASE;
+		}
+	}
+
+	return dw0 & NDP_RESULT_MORE ? NDP_CMD_FETCH : NDP_CMD_NONE;
+}
+
+int ndp_run(struct ndp_dev *dev, struct ndp_job *job)
+{
+	struct nvme_passthru_cmd64 cmd;
+	enum ndp_cmd type = NDP_CMD_JOB;
+	int err;
+
+	job->result = 0;
+	job->releasing = false;
+	do {
+		ndp_job_cmd(dev, job, type, &cmd);
+		err = ioctl(dev->fd, NVME_IOCTL_IO64_CMD, &cmd);
+		if (err)
+			err = err < 0 ? -errno : err;
+		else
+			job->result = cmd.result;
+		type = ndp_job_complete(job, err);
+	} while (type != NDP_CMD_NONE);
+
+	return job->status;
+}
+
+int ndp_grep(int fd, const char *path, const char *keywords, ndp_data_fn cb, void *arg)
+{
+	struct ndp_job job;
+	struct ndp_dev *dev;
+	int err;
+
+	err = ndp_dev_from_fd(fd, 0, &dev);
+	if (err)
+		return err;
+
+	err = ndp_job_init(dev, &job, NDP_OPC_GREP, path, 0);
+	if (!err) {
+		err = ndp_job_set_args(&job, keywords, strlen(keywords));
+		if (!err) {
+			job.data_fn = cb;
+			job.cb_arg = arg;
+			err = ndp_run(dev, &job);
+		}
+		ndp_job_fini(&job);
+	}
+
+	ndp_dev_close(dev);
+	return err;
+}
+
+int ndp_exec(int fd, __u8 opcode, const char *path, const char *text, ndp_data_fn cb,
+	     void *arg)
+{
+	struct ndp_job job;
+	struct ndp_dev *dev;
+	int err;
+
+	err = ndp_dev_from_fd(fd, 0, &dev);
+	if (err)
+		return err;
+
+	err = ndp_job_init(dev, &job, opcode, path, 0);
+	if (!err) {
+		err = ndp_job_compile(&job, text, strlen(text));
+		if (!err) {
+			job.data_fn = cb;
+			job.cb_arg = arg;
+			err = ndp_run(dev, &job);
+		}
+		ndp_job_fini(&job);
+	}
+
+	ndp_dev_close(dev);
+	return err;
+}
+
+int ndp_he_add(int fd, const char *in0, const char *in1, const char *out)
+{
+	struct ndp_job job;
+	struct ndp_dev *dev;
+	int err;
+
+	err = ndp_dev_from_fd(fd, 0, &dev);
+	if (err)
+		return err;
+
+	err = ndp_he_job_init(dev, &job, in0, in1, out);
+	if (!err) {
+		err = ndp_run(dev, &job);
+		ndp_job_fini(&job);
+	}
+
+	ndp_dev_close(dev);
+	return err;
+}
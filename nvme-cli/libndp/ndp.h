@@ -0,0 +1,395 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * libndp: host side of the near data processing (NDP) commands of the
+ * NDP_HEaaN NVMe-oF target.
+ *
+ * An NDP command carries in its data buffer a descriptor of the file it
+ * works on, the LBA extents the file system placed it at, followed by the
+ * arguments of the operator (grep keywords, a compiled filter or DFA).  The
+ * target writes the result back into the same buffer and returns its length
+ * in CQE DW0.  Results larger than the buffer are continued with
+ * NDP_OPC_FETCH, CQE DW1 being the cursor to pass it.
+ *
+ * Commands are either run synchronously with ndp_run() or queued on an
+ * io_uring of the NVMe generic character device (/dev/ngXnY) with
+ * ndp_queue_submit(), which keeps many of them in flight from one thread.
+ */
+#ifndef _LIBNDP_H
+#define _LIBNDP_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NDP_OPC_ECHO		0xd5
+#define NDP_OPC_GREP		0xd1
+#define NDP_OPC_FETCH		0xd2
+#define NDP_OPC_FILTER		0xd9
+#define NDP_OPC_AGGREGATE	0xdd
+#define NDP_OPC_REGEX		0xc1
+#define NDP_OPC_TOPK		0xc5
+#define NDP_OPC_SAMPLE		0xc9
+#define NDP_OPC_BATCH		0xcd
+#define NDP_OPC_HE_ADD		0xe0
+#define NDP_OPC_HE_SUB		0xe1
+#define NDP_OPC_HE_MUL		0xe2
+#define NDP_OPC_HE_DEC		0xe4
+#define NDP_OPC_HE_BTSRP	0xe5
+#define NDP_OPC_HE_BATCH	0xe9
+
+#define NDP_DEFAULT_DATA_LEN	8192
+#define NDP_AGG_DATA_LEN	65536
+#define NDP_REGEX_DATA_LEN	65536
+#define NDP_HE_DATA_LEN		4096
+
+/* CQE DW0 of echo, grep, filter, regex, top-K and fetch; DW1 holds the cursor if more is set */
+#define NDP_RESULT_MORE		(1U << 31)
+#define NDP_RESULT_LEN_MASK	(NDP_RESULT_MORE - 1)
+
+/* CDW11 of NDP_OPC_FETCH: drop the rest of the result */
+#define NDP_FETCH_RELEASE	(1U << 0)
+
+enum ndp_filter_type {
+	NDP_FILTER_TYPE_STRING,
+	NDP_FILTER_TYPE_INT,
+	NDP_FILTER_TYPE_FLOAT,
+};
+
+/* Aggregate header of NDP_OPC_AGGREGATE, followed by a filter program */
+#define NDP_AGG_MAGIC		0x4150444e	/* "NDPA" */
+#define NDP_AGG_HDR_LEN		16
+#define NDP_AGG_MAX_BUCKET_SHIFT	7
+#define NDP_AGG_FLAG_HISTOGRAM	(1U << 0)
+#define NDP_AGG_FLAG_OVERFLOW	(1U << 1)
+
+/* Fixed part of the aggregate result, then the histogram counters */
+struct ndp_agg_result {
+	__le64 records;
+	__le64 count;
+	__le64 sum;
+	__le64 min;
+	__le64 max;
+	__le64 negative;
+	__u8 type;
+	__u8 flags;
+	__u8 bucket_shift;
+	__u8 rsvd;
+	__le32 num_buckets;
+	__u8 rsvd2[8];
+};
+
+/*
+ * Device
+ */
+struct ndp_dev;
+
+/* Open a namespace, its block device or preferably its generic character device */
+int ndp_dev_open(const char *path, struct ndp_dev **devp);
+
+/* Wrap an already open namespace, nsid of 0 asks the driver which one it is */
+int ndp_dev_from_fd(int fd, __u32 nsid, struct ndp_dev **devp);
+
+/* Closes the file descriptor only if ndp_dev_open() opened it */
+void ndp_dev_close(struct ndp_dev *dev);
+
+int ndp_dev_fd(struct ndp_dev *dev);
+__u32 ndp_dev_nsid(struct ndp_dev *dev);
+__u32 ndp_dev_lba_size(struct ndp_dev *dev);
+
+/* Command timeout in milliseconds, 0 for the driver's default */
+void ndp_dev_set_timeout(struct ndp_dev *dev, __u32 timeout_ms);
+
+/*
+ * log_key_q the HEaaN context of the target was created with, the modulus a
+ * bootstrapped ciphertext is raised to, which sizes the output of
+ * NDP_OPC_HE_BTSRP.  NDP_HE_DEFAULT_LOG_KEY_Q, that of the target, if unset.
+ */
+#define NDP_HE_DEFAULT_LOG_KEY_Q	1024
+
+void ndp_dev_set_he_log_key_q(struct ndp_dev *dev, __u32 log_key_q);
+
+/*
+ * File layout, as reported by FIEMAP in bytes, physically contiguous extents
+ * merged.  Layouts are cached by device and inode until the file changes.
+ */
+struct ndp_extent {
+	__u64 physical;
+	__u64 length;
+};
+
+struct ndp_layout {
+	__u64 size;
+	__u32 num_extents;
+	struct ndp_extent *extents;
+
+	/* Private to the library */
+	int refs;
+};
+
+int ndp_layout_get(const char *path, struct ndp_layout **layoutp);
+
+/* Drop a layout returned by ndp_layout_get() */
+void ndp_layout_free(struct ndp_layout *layout);
+
+/* Number of files whose layout is kept, 1024 by default, 0 to disable the cache */
+void ndp_layout_cache_set_size(unsigned int entries);
+
+/* Forget all layouts, e.g. after moving extents behind the file system's back */
+void ndp_layout_cache_flush(void);
+
+void ndp_layout_cache_stats(__u64 *hits, __u64 *misses);
+
+/* Most extents a descriptor may hold */
+#define NDP_DESC_MAX_EXTENTS	1024
+
+/*
+ * Write the target descriptor of a file at the start of buf: the file size
+ * followed by the (start LBA, number of blocks) pair of every extent, all
+ * little endian 64 bit words.
+ */
+int ndp_desc_fill(struct ndp_dev *dev, const char *path, void *buf, __u32 size,
+		  __u32 *num_extents, __u32 *desc_len);
+
+/*
+ * Batches
+ *
+ * NDP_OPC_BATCH runs echo, grep, filter, aggregate, regex, top-K or sample
+ * over many files in one command.  Its result is a run of entries in file
+ * order, each a struct ndp_batch_entry followed by the len bytes of result
+ * of the file, padded to 8 bytes.  The result of a file is cut at the size
+ * of the data buffer, NDP_BATCH_F_TRUNCATED then being set.
+ */
+#define NDP_BATCH_MAX_FILES	16384
+#define NDP_BATCH_MAX_EXTENTS	65536
+
+#define NDP_BATCH_F_TRUNCATED	(1U << 0)
+
+struct ndp_batch_entry {
+	__le64 id;
+	__le32 len;
+	/* Positive errno of the file, 0 if the operator succeeded on it */
+	__le16 status;
+	__le16 flags;
+};
+
+/* Walk a part of a batch result: the entry at *pos, moving past it, NULL at the end */
+const struct ndp_batch_entry *ndp_batch_next(const void *data, __u32 len, __u32 *pos);
+
+/*
+ * Jobs
+ */
+
+/*
+ * Called with each part of the result.  A non zero return stops the job with
+ * that status, the target then drops the rest of the result.
+ */
+typedef int (*ndp_data_fn)(void *arg, const void *data, __u32 len);
+
+/* Called once a queued job is over, status as returned by ndp_run() */
+typedef void (*ndp_done_fn)(void *arg, int status);
+
+struct ndp_job {
+	__u8 opcode;
+	__u32 cdw10;
+	__u32 cdw11;
+	__u32 cdw12;
+	__u32 cdw13;
+	__u32 cdw14;
+	__u32 cdw15;
+
+	/* Descriptor then arguments, replaced by the result */
+	void *data;
+	__u32 data_len;
+	__u32 desc_len;
+	__u32 args_len;
+
+	ndp_data_fn data_fn;
+	ndp_done_fn done_fn;
+	void *cb_arg;
+
+	/* CQE DW0 and DW1 of the last completion */
+	__u64 result;
+
+	/* 0, a negative errno or an NVMe status */
+	int status;
+
+	/* Private to the library */
+	bool owns_data;
+	bool releasing;
+	struct ndp_job *next;
+};
+
+/*
+ * Allocate the data buffer of a job and write the descriptor of path into
+ * it.  A data_len of 0 picks the default of the opcode, grown by the size of
+ * the descriptor.
+ */
+int ndp_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode, const char *path,
+		 __u32 data_len);
+
+/* Copy arguments after the descriptor, for grep the keywords one per line */
+int ndp_job_set_args(struct ndp_job *job, const void *args, __u32 len);
+
+/*
+ * Compile a filter, aggregate, top-K, sample or regex expression after the
+ * descriptor.  Text starting with the magic of the opcode is taken as an
+ * already compiled program.
+ */
+int ndp_job_compile(struct ndp_job *job, const char *text, __u32 len);
+
+/*
+ * HEaaN operations: add, subtract and multiply take two input ciphertexts,
+ * decrypt and bootstrap one.  The output file is given at least the size of
+ * the first input; that of a bootstrap the size of a ciphertext at the
+ * log_key_q of the device, larger than that of its input.  The target
+ * fails an operation whose result doesn't fit.  Decryption writes the
+ * message.
+ */
+#define NDP_HE_MAX_INPUTS	2
+
+/* cdw14 of NDP_OPC_HE_MUL: rescale the product */
+#define NDP_HE_F_RESCALE	(1U << 0)
+
+/*
+ * Packed ciphertexts, which the target adds and subtracts in place instead
+ * of going through the serialization of the library.  The header is
+ * followed by the polynomials a and b, 2^log_n coefficients each, a
+ * coefficient being its value modulo 2^log_q in num_words little endian 64
+ * bit words, the least significant first.  Inputs of one operation are
+ * either all packed or all serialized; the output is packed like them.
+ *
+ * With NDP_HE_CT_F_RNS the modulus is the product of num_words primes below
+ * 2^62 and 1 modulo 2^(log_n + 1), listed after the header and padded to 64
+ * bytes; every polynomial is then its residues modulo each prime in turn,
+ * 2^log_n words each, in evaluation form with NDP_HE_CT_F_NTT.  Those are
+ * also multiplied, into the num_polys = 3 polynomials (a1 a2, a1 b2 + a2 b1,
+ * b1 b2) left for the host to relinearize, at the scale log_p1 + log_p2.
+ * Decryption and bootstrapping take serialized ciphertexts only.
+ */
+#define NDP_HE_CT_MAGIC		0x4350444e	/* "NDPC" */
+#define NDP_HE_CT_VERSION	1
+#define NDP_HE_CT_MAX_LOG_N	17
+#define NDP_HE_CT_MAX_LOG_Q	4096
+#define NDP_HE_CT_MAX_PRIMES	64
+#define NDP_HE_CT_MAX_PRIME_BITS	62
+
+#define NDP_HE_CT_F_RNS		(1U << 0)
+#define NDP_HE_CT_F_NTT		(1U << 1)
+
+struct ndp_he_ct {
+	__le32 magic;
+	__le16 version;
+	__le16 flags;
+	__u8 log_n;
+	__u8 num_polys;		/* 2, or 3 for a product; 0 is taken as 2 */
+	__u8 rsvd[2];
+	__le32 log_q;
+	__le32 log_p;
+	__le32 log_slots;
+	__le32 num_words;
+	__u8 rsvd2[36];
+};
+
+/*
+ * Write the header of a packed ciphertext, returning the length of the
+ * ciphertext with its coefficients, 0 if the parameters are out of range.
+ */
+__u64 ndp_he_ct_init(struct ndp_he_ct *ct, __u32 log_n, __u32 log_q, __u32 log_p,
+		     __u32 log_slots);
+
+/*
+ * Write the header and the primes of an RNS packed ciphertext, ct having
+ * room for 64 bytes more per 8 primes, returning the length of the
+ * ciphertext with its residues, 0 if the parameters are out of range.
+ */
+__u64 ndp_he_ct_init_rns(struct ndp_he_ct *ct, __u32 log_n, const __u64 *primes,
+			 __u32 num_primes, __u32 log_p, __u32 log_slots);
+
+/* Length of the packed ciphertext whose header is ct, 0 if it isn't one */
+__u64 ndp_he_ct_len(const struct ndp_he_ct *ct);
+
+/* Number of inputs of an HEaaN operation, 0 if opcode isn't one */
+__u32 ndp_he_num_inputs(__u8 opcode);
+
+/* Prepare an HEaaN operation, paths holding its inputs then its output */
+int ndp_he_op_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode,
+		       const char *const *paths);
+
+/* Prepare NDP_OPC_HE_ADD: out = in0 + in1 */
+int ndp_he_job_init(struct ndp_dev *dev, struct ndp_job *job, const char *in0,
+		    const char *in1, const char *out);
+
+/*
+ * Prepare NDP_OPC_HE_BATCH running the HEaaN operation opcode num_ops times,
+ * paths holding the inputs then the output of each in turn.  The target
+ * works on 8 operations at once, bits 7:0 of cdw13 may ask for up to 32.
+ * CQE DW0 is the number of operations done before the first failure.
+ */
+#define NDP_HE_BATCH_MAX_OPS		4096
+#define NDP_HE_BATCH_MAX_EXTENTS	65536
+
+int ndp_he_batch_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode,
+			  const char *const *paths, __u32 num_ops);
+
+/*
+ * Prepare NDP_OPC_BATCH running opcode over paths, the id of a file being
+ * its index.  The arguments are then set as for the operator on its own.
+ * The target runs 4 files at once, bits 7:0 of cdw13 may ask for up to 16.
+ */
+int ndp_batch_job_init(struct ndp_dev *dev, struct ndp_job *job, __u8 opcode,
+		       const char *const *paths, __u32 num_paths, __u32 data_len);
+
+void ndp_job_fini(struct ndp_job *job);
+
+/* Run a job and fetch the rest of its result until the target has no more */
+int ndp_run(struct ndp_dev *dev, struct ndp_job *job);
+
+/*
+ * Asynchronous submission over io_uring NVMe passthrough
+ */
+struct ndp_queue;
+
+/* Needs the generic character device of the namespace */
+int ndp_queue_init(struct ndp_dev *dev, unsigned int depth, struct ndp_queue **qp);
+void ndp_queue_free(struct ndp_queue *q);
+
+/*
+ * Queue a job, handed to the kernel by the next ndp_queue_reap().  Returns
+ * -EAGAIN if depth jobs are already in flight.
+ */
+int ndp_queue_submit(struct ndp_queue *q, struct ndp_job *job);
+
+/* Wait for at least min_jobs jobs to be over, returns how many were */
+int ndp_queue_reap(struct ndp_queue *q, unsigned int min_jobs);
+
+unsigned int ndp_queue_inflight(struct ndp_queue *q);
+
+/*
+ * Compilers, also used by ndp_job_compile()
+ */
+int ndp_compile_filter(const char *text, void *buf, __u32 size, __u32 *prog_len,
+		       __u8 opcode);
+int ndp_compile_regex(const char *text, void *buf, __u32 size, __u32 *prog_len);
+
+/* Seed of a compiled NDP_OPC_SAMPLE program, drawn from the clock if the text had none */
+__u32 ndp_topk_seed(const void *prog);
+
+/*
+ * One shot calls on an open namespace
+ */
+int ndp_grep(int fd, const char *path, const char *keywords, ndp_data_fn cb, void *arg);
+
+/* Filter, aggregate, regex, top-K or sample, text as for ndp_job_compile() */
+int ndp_exec(int fd, __u8 opcode, const char *path, const char *text, ndp_data_fn cb,
+	     void *arg);
+
+int ndp_he_add(int fd, const char *in0, const char *in1, const char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBNDP_H */
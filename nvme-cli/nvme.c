@@ -43,9 +43,6 @@
 #include <libgen.h>
 #include <signal.h>
 
-#include <linux/fs.h>
-#include <linux/fiemap.h>
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -77,6 +74,7 @@
 #include "util/suffix.h"
 #include "util/logging.h"
 #include "fabrics.h"
+#include "ndp.h"
 #define CREATE_CMD
 #include "nvme-builtin.h"
 #include "malloc.h"
@@ -8687,156 +8685,261 @@ static void passthru_print_read_output(struct passthru_config cfg, void *data, i
 	}
 }
 
-#define DEVICE_BLOCK_SIZE 4096  // 또는 4096
-#define MAX_EXTENTS 1024 // 최대 extent 수 설정
-
-// 하나의 extent 정보를 담는 구조체
-typedef struct {
-    uint64_t logical_offset;  // 파일 내 논리적 오프셋
-    uint64_t physical_offset; // 물리적 디스크 오프셋
-    uint64_t length;         // extent 길이
-    uint64_t lba_start;      // 시작 LBA
-    uint64_t lba_count;      // LBA 개수
-} extent_info_t;
-
-// 파일의 전체 extent 정보를 관리하는 구조체
-typedef struct {
-    char *filename;           // 파일 이름
-    int extent_count;        // extent 개수
-	uint64_t start_offset; 	 // The offset of the start of a file within the first block
-    uint64_t total_length;   // 전체 파일 크기
-    extent_info_t *extents;  // extent 배열
-} file_layout_t;
-
-// 파일 레이아웃 정보를 얻는 함수
-file_layout_t* get_file_layout(const char *filename) {
-    int fd;
-    struct fiemap *fiemap;
-    file_layout_t *layout;
-
-    // file_layout 구조체 할당
-    layout = (file_layout_t*)malloc(sizeof(file_layout_t));
-    layout->filename = strdup(filename);
-    layout->extents = (extent_info_t*)malloc(MAX_EXTENTS * sizeof(extent_info_t));
-
-    // fiemap 구조체 할당
-    fiemap = malloc(sizeof(struct fiemap) + MAX_EXTENTS * sizeof(struct fiemap_extent));
-    memset(fiemap, 0, sizeof(struct fiemap) + MAX_EXTENTS * sizeof(struct fiemap_extent));
-
-    fiemap->fm_length = FIEMAP_MAX_OFFSET;
-    fiemap->fm_flags = 0;
-    fiemap->fm_extent_count = MAX_EXTENTS;
-
-    fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        perror("open failed");
-        free(layout->extents);
-        free(layout);
-        free(fiemap);
-        return NULL;
-    }
-	fsync(fd);
-
-    if (ioctl(fd, FS_IOC_FIEMAP, fiemap) < 0) {
-        perror("ioctl failed");
-        close(fd);
-        free(layout->extents);
-        free(layout);
-        free(fiemap);
-        return NULL;
-    }
-
-    // extent 정보 복사
-	layout->start_offset = fiemap->fm_start;
-    layout->extent_count = fiemap->fm_mapped_extents;
-    layout->total_length = 0;
-
-    for (int i = 0; i < layout->extent_count; i++) {
-        layout->extents[i].logical_offset = fiemap->fm_extents[i].fe_logical;
-        layout->extents[i].physical_offset = fiemap->fm_extents[i].fe_physical;
-        layout->extents[i].length = fiemap->fm_extents[i].fe_length;
-        //layout->extents[i].lba_start = fiemap->fm_extents[i].fe_physical / DEVICE_BLOCK_SIZE;
-        //layout->extents[i].lba_count = fiemap->fm_extents[i].fe_length / DEVICE_BLOCK_SIZE;
-        layout->extents[i].lba_start = fiemap->fm_extents[i].fe_physical;
-        layout->extents[i].lba_count = fiemap->fm_extents[i].fe_length;
-        layout->total_length += fiemap->fm_extents[i].fe_length;
-    }
-
-    close(fd);
-    free(fiemap);
-    return layout;
-}
-
-// 메모리 해제 함수
-void free_file_layout(file_layout_t *layout) {
-    if (layout) {
-        free(layout->filename);
-        free(layout->extents);
-        free(layout);
-    }
-}
-
-void dump_hex(const char *label, const void *data, size_t len)
-{
-    const unsigned char *p = (const unsigned char *)data;
-    size_t i, j;
-
-    fprintf(stdout, "%s:\n", label);
-    for (i = 0; i < len; i += 16) {
-        fprintf(stdout, "%08zx ", i);
-        for (j = 0; j < 16 && i + j < len; j++) {
-            fprintf(stdout, "%02x ", p[i + j]);
-        }
-        while (j < 16) {
-            fprintf(stdout, "   ");
-            j++;
-        }
-        fprintf(stdout, " ");
-        for (j = 0; j < 16 && i + j < len; j++) {
-            int c = p[i + j];
-            fprintf(stdout, "%c", (c >= 32 && c <= 126) ? c : '.');
-        }
-        fprintf(stdout, "\n");
-    }
-}
-
-void split_path(const char* full_path, char** path_out, char** filename_out) {
-    // 1. Find the last occurrence of the directory separator '/'
-    const char* last_slash = strrchr(full_path, '/');
-
-    if (last_slash == NULL) {
-        //No separator("filename")
-        *path_out = strdup("./"); 
-        *filename_out = strdup(full_path);
-        
-    } else {
-        //Separator found(path/filename)
-        
-        // Calculate the length of the path component (up to and including the slash)
-        size_t path_len = last_slash - full_path + 1;
-        
-        // Allocate and copy the path component
-        *path_out = (char*)malloc(path_len + 1);
-        if (*path_out != NULL) {
-            // Copy everything up to and including the last '/'
-            memcpy(*path_out, full_path, path_len);
-            // Null terminate the path string
-            (*path_out)[path_len] = '\0';
-        }
-        
-        // Calculate the length of the filename component
-        const char* filename_start = last_slash + 1;
-        size_t filename_len = strlen(filename_start);
-        
-        // Allocate and copy the filename component
-        *filename_out = (char*)malloc(filename_len + 1);
-        if (*filename_out != NULL) {
-            // Copy everything AFTER the last '/'
-            memcpy(*filename_out, filename_start, filename_len);
-            // Null terminate the filename string
-            (*filename_out)[filename_len] = '\0';
-        }
-    }
+/* Start of the histogram bucket following (range, index), as spdk_histogram_data */
+static __u64 ndp_agg_bucket_end(__u32 shift, __u32 range, __u32 index)
+{
+	index += 1;
+	if (!range)
+		return index;
+	return (1ULL << (range + shift - 1)) + ((__u64)index << (range - 1));
+}
+
+static void ndp_print_aggregate(const void *data, __u32 len)
+{
+	const struct ndp_agg_result *res = data;
+	const __le64 *buckets = (const __le64 *)(res + 1);
+	__u64 sum, min, max, count, start = 0, end, n;
+	__u32 num_buckets, range, index, i;
+	double dsum, dmin, dmax;
+
+	if (len < sizeof(*res)) {
+		nvme_show_error("aggregate: short result of %u bytes", len);
+		return;
+	}
+
+	count = le64_to_cpu(res->count);
+	sum = le64_to_cpu(res->sum);
+	min = le64_to_cpu(res->min);
+	max = le64_to_cpu(res->max);
+	printf("records  : %" PRIu64 "\n", (uint64_t)le64_to_cpu(res->records));
+	printf("count    : %" PRIu64 "\n", (uint64_t)count);
+	if (res->type == NDP_FILTER_TYPE_FLOAT) {
+		memcpy(&dsum, &sum, sizeof(dsum));
+		memcpy(&dmin, &min, sizeof(dmin));
+		memcpy(&dmax, &max, sizeof(dmax));
+		printf("sum      : %.17g\n", dsum);
+		if (count) {
+			printf("avg      : %.17g\n", dsum / count);
+			printf("min      : %.17g\n", dmin);
+			printf("max      : %.17g\n", dmax);
+		}
+	} else {
+		printf("sum      : %" PRId64 "%s\n", (int64_t)sum,
+		       res->flags & NDP_AGG_FLAG_OVERFLOW ? " (overflow)" : "");
+		if (count) {
+			printf("avg      : %.17g\n", (double)(int64_t)sum / count);
+			printf("min      : %" PRId64 "\n", (int64_t)min);
+			printf("max      : %" PRId64 "\n", (int64_t)max);
+		}
+	}
+
+	if (!(res->flags & NDP_AGG_FLAG_HISTOGRAM))
+		return;
+
+	num_buckets = le32_to_cpu(res->num_buckets);
+	if (len < sizeof(*res) + num_buckets * sizeof(*buckets)) {
+		nvme_show_error("aggregate: histogram truncated");
+		return;
+	}
+	printf("negative : %" PRIu64 "\n", (uint64_t)le64_to_cpu(res->negative));
+	printf("histogram:\n");
+	for (i = 0; i < num_buckets; i++) {
+		range = i >> res->bucket_shift;
+		index = i & ((1U << res->bucket_shift) - 1);
+		end = ndp_agg_bucket_end(res->bucket_shift, range, index);
+		n = le64_to_cpu(buckets[i]);
+		if (n)
+			printf("  [%" PRIu64 ", %" PRIu64 ") : %" PRIu64 "\n",
+			       (uint64_t)start, (uint64_t)end, (uint64_t)n);
+		start = end;
+	}
+}
+
+static void passthru_show_command(struct passthru_config *cfg, void *data, void *mdata)
+{
+	printf("opcode       : %02x\n", cfg->opcode);
+	printf("flags        : %02x\n", cfg->flags);
+	printf("rsvd1        : %04x\n", cfg->rsvd);
+	printf("nsid         : %08x\n", cfg->namespace_id);
+	printf("cdw2         : %08x\n", cfg->cdw2);
+	printf("cdw3         : %08x\n", cfg->cdw3);
+	printf("data_len     : %08x\n", cfg->data_len);
+	printf("metadata_len : %08x\n", cfg->metadata_len);
+	printf("addr         : %"PRIx64"\n", (uint64_t)(uintptr_t)data);
+	printf("metadata     : %"PRIx64"\n", (uint64_t)(uintptr_t)mdata);
+	printf("cdw10        : %08x\n", cfg->cdw10);
+	printf("cdw11        : %08x\n", cfg->cdw11);
+	printf("cdw12        : %08x\n", cfg->cdw12);
+	printf("cdw13        : %08x\n", cfg->cdw13);
+	printf("cdw14        : %08x\n", cfg->cdw14);
+	printf("cdw15        : %08x\n", cfg->cdw15);
+	printf("timeout_ms   : %08x\n", nvme_cfg.timeout);
+}
+
+static bool ndp_passthru_opcode(__u8 opcode)
+{
+	switch (opcode) {
+	case NDP_OPC_ECHO:
+	case NDP_OPC_GREP:
+	case NDP_OPC_FILTER:
+	case NDP_OPC_AGGREGATE:
+	case NDP_OPC_REGEX:
+	case NDP_OPC_TOPK:
+	case NDP_OPC_SAMPLE:
+	case NDP_OPC_HE_ADD:
+	case NDP_OPC_HE_SUB:
+	case NDP_OPC_HE_MUL:
+	case NDP_OPC_HE_DEC:
+	case NDP_OPC_HE_BTSRP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int ndp_print_data(void *arg, const void *data, __u32 len)
+{
+	d_raw((unsigned char *)data, len);
+	return 0;
+}
+
+static int ndp_print_agg(void *arg, const void *data, __u32 len)
+{
+	ndp_print_aggregate(data, len);
+	return 0;
+}
+
+/* Read the grep keywords or the filter or regex text, up to size bytes */
+static ssize_t ndp_read_args(int fd, char *buf, size_t size)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	while (len < size) {
+		n = read(fd, buf + len, size - len);
+		if (n < 0)
+			return -errno;
+		if (!n)
+			break;
+		len += n;
+	}
+	return len;
+}
+
+/*
+ * The NDP commands go through libndp: the target file is given with
+ * --target-file, the keywords, filter or regex come from --input-file or
+ * stdin.  For the HEaaN operations, --input-file and, if the operation has
+ * two inputs, --metadata are the input ciphertexts and --target-file the
+ * output; --cdw14 holds the parameters of the operation.
+ */
+static int ndp_passthru(struct nvme_dev *dev, struct passthru_config *cfg)
+{
+	bool compile = cfg->opcode != NDP_OPC_ECHO && cfg->opcode != NDP_OPC_GREP;
+	_cleanup_free_ char *args = NULL;
+	_cleanup_fd_ int fd = -1;
+	struct timeval start_time, end_time;
+	struct ndp_dev *ndev;
+	struct ndp_job job;
+	ssize_t len;
+	int err;
+
+	err = ndp_dev_from_fd(dev_fd(dev), cfg->namespace_id, &ndev);
+	if (err) {
+		nvme_show_error("%s: %s", dev->name, nvme_strerror(-err));
+		return err;
+	}
+	ndp_dev_set_timeout(ndev, nvme_cfg.timeout);
+
+	if (ndp_he_num_inputs(cfg->opcode)) {
+		const char *paths[] = { cfg->input_file, cfg->metadata, cfg->target_file };
+
+		if (ndp_he_num_inputs(cfg->opcode) == 1)
+			paths[1] = cfg->target_file;
+		err = ndp_he_op_job_init(ndev, &job, cfg->opcode, paths);
+		if (err)
+			goto out_dev;
+		job.cdw14 = cfg->cdw14;
+		goto show;
+	}
+
+	err = ndp_job_init(ndev, &job, cfg->opcode, cfg->target_file, cfg->data_len);
+	if (err)
+		goto out_dev;
+	job.cdw12 = cfg->cdw12;
+	job.cdw13 = cfg->cdw13;
+	job.cdw14 = cfg->cdw14;
+	job.cdw15 = cfg->cdw15;
+	job.data_fn = cfg->opcode == NDP_OPC_AGGREGATE ? ndp_print_agg : ndp_print_data;
+
+	if (cfg->opcode == NDP_OPC_ECHO) {
+		job.cdw10 = cfg->cdw10;
+		goto show;
+	}
+
+	fd = strlen(cfg->input_file) ? open(cfg->input_file, O_RDONLY) : dup(STDIN_FILENO);
+	args = malloc(job.data_len);
+	if (fd < 0 || !args) {
+		err = fd < 0 ? -errno : -ENOMEM;
+		nvme_show_perror(strlen(cfg->input_file) ? cfg->input_file : "stdin");
+		goto out_job;
+	}
+	len = ndp_read_args(fd, args, job.data_len);
+	if (len <= 0) {
+		nvme_show_error("failed to read the %s", !compile ? "grep keywords" :
+				cfg->opcode == NDP_OPC_REGEX ? "regex" : "filter");
+		err = len < 0 ? len : -EINVAL;
+		goto out_job;
+	}
+
+	if (compile)
+		err = ndp_job_compile(&job, args, len);
+	else
+		err = ndp_job_set_args(&job, args, len);
+	if (err)
+		goto out_job;
+
+	/* Without a seed in the text, one was drawn; show it so that the sample can be repeated */
+	if (cfg->opcode == NDP_OPC_SAMPLE)
+		fprintf(stderr, "sample seed: %u\n",
+			ndp_topk_seed((__u8 *)job.data + job.desc_len));
+
+show:
+	if (cfg->show_command || cfg->dry_run) {
+		cfg->namespace_id = ndp_dev_nsid(ndev);
+		cfg->data_len = job.data_len;
+		cfg->metadata_len = 0;
+		cfg->cdw10 = job.cdw10;
+		cfg->cdw11 = job.cdw11;
+		cfg->cdw12 = job.cdw12;
+		cfg->cdw13 = job.cdw13;
+		cfg->cdw14 = job.cdw14;
+		cfg->cdw15 = job.cdw15;
+		passthru_show_command(cfg, job.data, NULL);
+	}
+	if (cfg->dry_run)
+		goto out_job;
+
+	gettimeofday(&start_time, NULL);
+	err = ndp_run(ndev, &job);
+	gettimeofday(&end_time, NULL);
+	if (cfg->latency)
+		printf("IO Command Vendor Specific latency: %llu us\n",
+		       elapsed_utime(start_time, end_time));
+
+	if (err < 0)
+		nvme_show_error("%s: %s", __func__, nvme_strerror(-err));
+	else if (err)
+		nvme_show_status(err);
+	else
+		fprintf(stderr, "IO Command Vendor Specific is Success and result: 0x%08x\n",
+			(__u32)job.result);
+
+out_job:
+	ndp_job_fini(&job);
+out_dev:
+	ndp_dev_close(ndev);
+	return err;
 }
 
 static int passthru(int argc, char **argv, bool admin,
@@ -8932,6 +9035,9 @@ static int passthru(int argc, char **argv, bool admin,
 	if (err)
 		return err;
 
+	if (!admin && ndp_passthru_opcode(cfg.opcode))
+		return ndp_passthru(dev, &cfg);
+
 	if (cfg.opcode & 0x01) {
 		cfg.write = true;
 		flags = O_RDONLY;
@@ -8943,9 +9049,7 @@ static int passthru(int argc, char **argv, bool admin,
 		flags = O_WRONLY | O_CREAT;
 		dfd = mfd = STDOUT_FILENO;
 	}
-	
-	if(cfg.opcode == 0xe0)
-		goto skip_input_file_open;
+
 	if (strlen(cfg.input_file)) {
 		dfd = open(cfg.input_file, flags, mode);
 		if (dfd < 0) {
@@ -8953,7 +9057,6 @@ static int passthru(int argc, char **argv, bool admin,
 			return -EINVAL;
 		}
 	}
-	skip_input_file_open:
 
 	if (cfg.metadata && strlen(cfg.metadata)) {
 		mfd = open(cfg.metadata, flags, mode);
@@ -8963,148 +9066,6 @@ static int passthru(int argc, char **argv, bool admin,
 		}
 	}
 
-
-	if (cfg.opcode == 0xd1) {
-                    char *filename = cfg.target_file;
-                    printf("filename: %s\n", filename);
-                    file_layout_t *layout = get_file_layout(filename);
-                    if (!layout) {
-                            fprintf(stderr, "Failed to get file layout\n");
-                            return 1;
-                    }
-                    printf("extent_counts=%d\n", layout->extent_count);
-
-                    for (int i = 0; i < layout->extent_count; i++) {
-                            extent_info_t *ext = &layout->extents[i];
-                            cfg.cdw11 = (__u32)ext->lba_start; // 시작 LBA
-                            printf("lba_start: %lu\n", ext->lba_start);
-                            cfg.cdw12 = (__u32)ext->lba_count; // 블록 개수
-                            printf("num_of_blocks: %lu\n", ext->lba_count);
-                    }
-
-		    // cfg.data_len = DEVICE_BLOCK_SIZE * cfg.cdw12;
-                    cfg.data_len = 8192;
-		    printf("data-size: %d\n", cfg.data_len);
-
-                    free_file_layout(layout);
-    }
-	
-	if (cfg.opcode == 0xe0) { //HEaaN Ciphertext Add custom OPC
-		cfg.write = true;
-		char* input_0_name = cfg.input_file;
-		char* input_1_name = cfg.metadata;
-		char* target_name = cfg.target_file;
-		
-		/*
-		if(!input_0_name) {
-			fprintf(stderr, "Failed to get input file 0 name.\n");
-			return -EINVAL;
-		}
-		char* input_0_path = NULL;
-		char* input_0_filename = NULL;
-		split_path(input_0_name, &input_0_path, &input_0_filename);
-		fprintf(stdout, "input 0 path: %s\ninput 0 file: %s\n", input_0_path, input_0_filename);
-
-		cfg.metadata = NULL;
-		cfg.metadata_len = 0;
-		char* input_1_path = NULL;
-		char* input_1_filename = NULL;
-		split_path(input_1_name, &input_1_path, &input_1_filename);
-		fprintf(stdout, "input 1 path: %s\ninput 1 file: %s\n", input_1_path, input_1_filename);
-		
-		char* target_path = NULL;
-		char* target_filename = NULL;
-		split_path(target_name, &target_path, &target_filename);
-		fprintf(stdout, "target path: %s\ntarget file: %s\n", target_path, target_filename);
-		
-		size_t full_string_len = strlen(input_0_path) + strlen(input_0_filename) +
-									strlen(input_1_path) + strlen(input_1_filename) +
-									strlen(target_path) + strlen(target_filename) + 5;
-		cfg.cdw13 = (__u32)full_string_len;
-		*/
-		
-		file_layout_t *input_0_layout = get_file_layout(input_0_name);
-		if(!input_0_layout) {
-			fprintf(stderr, "Failed to get file layout\n");
-			return 1;
-		}
-		cfg.cdw11 = (__u32)input_0_layout->extent_count;
-		uint64_t cip_size = input_0_layout->total_length;
-		
-		fprintf(stdout, "CipSize: %ld\n", cip_size);
-
-		file_layout_t *input_1_layout = get_file_layout(input_1_name);
-		if(!input_1_layout) {
-			fprintf(stderr, "Failed to get file layout\n");
-			return 1;
-		}
-		cfg.cdw12 = (__u32)input_1_layout->extent_count;
-
-		int target_fd = open(target_name, O_RDWR | O_CREAT, 0644);
-
-		if (fallocate(target_fd, 0, 0, cip_size) != 0) {
-			perror("fallocate failed");
-			return 1;
-		}
-		file_layout_t *target_layout = get_file_layout(target_name);
-		if(!target_layout) {
-			fprintf(stderr, "Failed to get file layout\n");
-			return 1;
-		}
-		cfg.cdw13 = (__u32)target_layout->extent_count;
-		
-		
-		cfg.data_len = 4096;
-		data = nvme_alloc_huge(cfg.data_len, &mh);
-		if (!data)
-			return -ENOMEM;
-		memset(data, cfg.prefill, cfg.data_len);
-		/*
-		char* chardata = (char*)data;
-		sprintf(chardata, "%s|%s|%s|%s|%s|%s",
-				input_0_path, input_0_filename,
-				input_1_path, input_1_filename,
-				target_path, target_filename);
-		*/
-
-		uint64_t* u64data = (uint64_t*)data;
-		uint32_t i = 0;
-		uint32_t bufnum = 0;
-		printf("INPUT0 name: %s\n", input_0_name);
-		u64data[bufnum++] = input_0_layout->start_offset;
-		for(; i < input_0_layout->extent_count; i++) {
-			extent_info_t *ext = &input_0_layout->extents[i];
-			u64data[bufnum++] = (uint64_t)ext->lba_start;
-			u64data[bufnum++] = (uint64_t)ext->lba_count;
-			printf("INPUT0 - lba : %ld\t count : %ld\n", u64data[bufnum-2], u64data[bufnum-1]);
-		}
-		i = 0;
-		u64data[bufnum++] = input_1_layout->start_offset;
-		printf("INPUT1 name: %s\n", input_1_name);
-		for(; i < input_1_layout->extent_count; i++) {
-			extent_info_t *ext = &input_1_layout->extents[i];
-			u64data[bufnum++] = (uint64_t)ext->lba_start;
-			u64data[bufnum++] = (uint64_t)ext->lba_count;
-			printf("INPUT1 - lba : %ld\t count : %ld\n", u64data[bufnum-2], u64data[bufnum-1]);
-		}
-		i = 0;
-		u64data[bufnum++] = target_layout->start_offset;
-		printf("TARGET name: %s\n", target_name);
-		for(; i < target_layout->extent_count; i++) {
-			extent_info_t *ext = &target_layout->extents[i];
-			u64data[bufnum++] = (uint64_t)ext->lba_start;
-			u64data[bufnum++] = (uint64_t)ext->lba_count;
-			printf("TARGET - lba : %ld\t count : %ld\n", u64data[bufnum-2], u64data[bufnum-1]);
-		}
-		dump_hex("Buffer Content (Host)", data, 64);
-
-		free_file_layout(input_0_layout);
-		free_file_layout(input_1_layout);
-		free_file_layout(target_layout);
-		goto skip_data_fill;
-	}
-
-
 	if (cfg.data_len) {
 		data = nvme_alloc_huge(cfg.data_len, &mh);
 		if (!data)
@@ -9138,35 +9099,11 @@ static int passthru(int argc, char **argv, bool admin,
 			memset(mdata, cfg.prefill, cfg.metadata_len);
 		}
 	}
-	skip_data_fill:
-
-
-	if (cfg.show_command || cfg.dry_run) {
-		printf("opcode       : %02x\n", cfg.opcode);
-		printf("flags        : %02x\n", cfg.flags);
-		printf("rsvd1        : %04x\n", cfg.rsvd);
-		printf("nsid         : %08x\n", cfg.namespace_id);
-		printf("cdw2         : %08x\n", cfg.cdw2);
-		printf("cdw3         : %08x\n", cfg.cdw3);
-		printf("data_len     : %08x\n", cfg.data_len);
-		printf("metadata_len : %08x\n", cfg.metadata_len);
-		printf("addr         : %"PRIx64"\n", (uint64_t)(uintptr_t)data);
-		printf("metadata     : %"PRIx64"\n", (uint64_t)(uintptr_t)mdata);
-		printf("cdw10        : %08x\n", cfg.cdw10);
-		printf("cdw11        : %08x\n", cfg.cdw11);
-		printf("cdw12        : %08x\n", cfg.cdw12);
-		printf("cdw13        : %08x\n", cfg.cdw13);
-		printf("cdw14        : %08x\n", cfg.cdw14);
-		printf("cdw15        : %08x\n", cfg.cdw15);
-		printf("timeout_ms   : %08x\n", nvme_cfg.timeout);
-	}
+
+	if (cfg.show_command || cfg.dry_run)
+		passthru_show_command(&cfg, data, mdata);
 	if (cfg.dry_run)
 		return 0;
-	
-	fprintf(stdout, "Host: About to send command 0x%02x\n", cfg.opcode);
-	fprintf(stdout, "Host: Data buffer pointer: %p\n", data);
-	fprintf(stdout, "Host: Data buffer length: %u\n", cfg.data_len);
-	fprintf(stdout, "Host: Write flag is set: %s\n", cfg.write ? "true" : "false");
 
 	gettimeofday(&start_time, NULL);
 
@@ -9190,8 +9127,6 @@ static int passthru(int argc, char **argv, bool admin,
 				       cfg.cdw15, cfg.data_len, data,
 				       cfg.metadata_len,
 				       mdata, nvme_cfg.timeout, &result);
-	
-	printf("nvme_io_passthru complete. err = %d\n", err);
 	gettimeofday(&end_time, NULL);
 	cmd_name = nvme_cmd_to_string(admin, cfg.opcode);
 	if (cfg.latency)
@@ -9206,14 +9141,6 @@ static int passthru(int argc, char **argv, bool admin,
 	} else  {
 		fprintf(stderr, "%s Command %s is Success and result: 0x%08x\n", admin ? "Admin" : "IO",
 			strcmp(cmd_name, "Unknown") ? cmd_name : "Vendor Specific", result);
-			if (cfg.opcode == 0xD0){ // 커스텀 Echo 명령일때
-				d_raw((unsigned char *)data, cfg.data_len); // raw binary 그대로 출력
-			}
-
-			if(cfg.opcode == 0xD1){ // 커스텀 Grep 명령일때
-			     d_raw((unsigned char *)data, cfg.data_len); // raw binary 그대로 출력
-			     printf("\n");
-			}
 		if (cfg.read)	passthru_print_read_output(cfg, data, dfd, mdata, mfd, err);
 	
 	}
@@ -0,0 +1,1430 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Load generator for the NDP (near-data processing) opcodes of the NVMe-oF
+ * target, modeled on spdk_nvme_perf.  Every command runs the operator over a
+ * synthetic file layout (a number of extents separated by gaps) and its
+ * result is fetched until complete, so the latency of one operation covers
+ * the command and all the fetches that follow it.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk/env.h"
+#include "spdk/nvme.h"
+#include "spdk/queue.h"
+#include "spdk/string.h"
+#include "spdk/histogram_data.h"
+#include "spdk/endian.h"
+#include "spdk/util.h"
+#include "spdk/log.h"
+#include "spdk/likely.h"
+#include "spdk/nvmf_spec.h"
+
+#define HELP_RETURN_CODE UINT16_MAX
+
+/* Only defined by nvme_spec.h in builds with the HEaaN library */
+#define NDP_OPC_HEAAN_ADD	0xe0
+
+/* CQE DW0 of echo, grep and fetch; DW1 holds the cursor if more is set */
+#define NDP_RESULT_MORE		(1U << 31)
+#define NDP_RESULT_LEN_MASK	(NDP_RESULT_MORE - 1)
+
+/* Fetch CDW11: drop the rest of the result */
+#define NDP_FETCH_RELEASE	(1U << 0)
+
+/* Input ciphertexts and target of a HEaaN add */
+#define NDP_HEAAN_NUM_FILES	3
+
+enum ndp_workload {
+	NDP_WORKLOAD_ECHO,
+	NDP_WORKLOAD_GREP,
+	NDP_WORKLOAD_HEAAN_ADD,
+};
+
+static const struct {
+	const char	*name;
+	uint8_t		opc;
+	uint32_t	num_files;
+} g_workloads[] = {
+	[NDP_WORKLOAD_ECHO]		= { "echo", SPDK_NVME_OPC_CUSTOM_ECHO, 1 },
+	[NDP_WORKLOAD_GREP]		= { "grep", SPDK_NVME_OPC_CUSTOM_GREP, 1 },
+	[NDP_WORKLOAD_HEAAN_ADD]	= { "heaan_add", NDP_OPC_HEAAN_ADD, NDP_HEAAN_NUM_FILES },
+};
+
+struct ctrlr_entry {
+	struct spdk_nvme_ctrlr			*ctrlr;
+	enum spdk_nvme_transport_type		trtype;
+
+	TAILQ_ENTRY(ctrlr_entry)		link;
+	char					name[1024];
+};
+
+struct ns_entry {
+	struct spdk_nvme_ctrlr	*ctrlr;
+	struct spdk_nvme_ns	*ns;
+
+	TAILQ_ENTRY(ns_entry)	link;
+	uint32_t		block_size;
+
+	/* Blocks covered by the layout of one command and number of such regions */
+	uint64_t		region_blocks;
+	uint64_t		num_regions;
+
+	/* Bytes read (and for heaan_add written) by one command */
+	uint64_t		scan_bytes;
+	char			name[1024];
+};
+
+static const double g_latency_cutoffs[] = {
+	0.01,
+	0.10,
+	0.25,
+	0.50,
+	0.75,
+	0.90,
+	0.95,
+	0.98,
+	0.99,
+	0.995,
+	0.999,
+	0.9999,
+	0.99999,
+	0.999999,
+	0.9999999,
+	-1,
+};
+
+struct ns_worker_stats {
+	uint64_t		io_completed;
+	uint64_t		fetches;
+	uint64_t		result_bytes;
+	uint64_t		total_tsc;
+	uint64_t		min_tsc;
+	uint64_t		max_tsc;
+};
+
+struct ns_worker_ctx {
+	struct ns_entry		*entry;
+	struct ns_worker_stats	stats;
+	uint64_t		current_queue_depth;
+	uint64_t		next_region;
+	bool			is_draining;
+
+	struct spdk_nvme_qpair	*qpair;
+
+	TAILQ_ENTRY(ns_worker_ctx)	link;
+
+	struct spdk_histogram_data	*histogram;
+	int				status;
+};
+
+struct perf_task {
+	struct ns_worker_ctx	*ns_ctx;
+	void			*buf;
+	uint64_t		submit_tsc;
+	struct spdk_nvme_cmd	cmd;
+};
+
+struct worker_thread {
+	TAILQ_HEAD(, ns_worker_ctx)	ns_ctx;
+	TAILQ_ENTRY(worker_thread)	link;
+	unsigned			lcore;
+};
+
+struct trid_entry {
+	struct spdk_nvme_transport_id	trid;
+	uint16_t			nsid;
+	char				hostnqn[SPDK_NVMF_NQN_MAX_LEN + 1];
+	TAILQ_ENTRY(trid_entry)		tailq;
+};
+
+static TAILQ_HEAD(, ctrlr_entry) g_controllers = TAILQ_HEAD_INITIALIZER(g_controllers);
+static TAILQ_HEAD(, ns_entry) g_namespaces = TAILQ_HEAD_INITIALIZER(g_namespaces);
+static uint32_t g_num_namespaces;
+static TAILQ_HEAD(, worker_thread) g_workers = TAILQ_HEAD_INITIALIZER(g_workers);
+static uint32_t g_num_workers;
+static uint32_t g_main_core;
+static pthread_barrier_t g_worker_sync_barrier;
+static TAILQ_HEAD(, trid_entry) g_trid_list = TAILQ_HEAD_INITIALIZER(g_trid_list);
+
+static uint64_t g_tsc_rate;
+static uint64_t g_elapsed_time_in_usec;
+static int g_latency_sw_tracking_level;
+static bool g_warn;
+static bool g_exit;
+
+static enum ndp_workload g_workload = NDP_WORKLOAD_ECHO;
+static uint32_t g_queue_depth = 8;
+static int g_time_in_sec = 10;
+static uint32_t g_data_size = 128 * 1024;
+static uint32_t g_num_extents = 4;
+static uint32_t g_extent_blocks = 8;
+static uint32_t g_gap_blocks;
+static bool g_same_region;
+static char *g_keywords;
+static uint32_t g_keywords_len;
+static uint32_t g_keep_alive_timeout_in_ms = 10000;
+
+static void io_complete(void *ctx, const struct spdk_nvme_cpl *cpl);
+
+/* Size of the descriptor written at the start of the data buffer */
+static uint64_t
+ndp_desc_size(void)
+{
+	uint64_t words;
+
+	if (g_workload == NDP_WORKLOAD_HEAAN_ADD) {
+		/* Start offset of each file plus two words per extent */
+		words = NDP_HEAAN_NUM_FILES * (1 + 2 * (uint64_t)g_num_extents);
+	} else {
+		/* File length plus two words per extent */
+		words = 1 + 2 * (uint64_t)g_num_extents;
+	}
+
+	return words * sizeof(uint64_t) + g_keywords_len;
+}
+
+/*
+ * Describe the extents of the files of one command, starting at the first
+ * block of the region.  The extents of every file are g_extent_blocks long
+ * and g_gap_blocks apart; the files of a HEaaN add follow each other.
+ */
+static void
+ndp_build_cmd(struct perf_task *task, uint64_t region)
+{
+	struct ns_entry *entry = task->ns_ctx->entry;
+	struct spdk_nvme_cmd *cmd = &task->cmd;
+	uint64_t *words = task->buf;
+	uint64_t lba = region * entry->region_blocks;
+	uint64_t stride = g_extent_blocks + g_gap_blocks;
+	uint32_t i, f, w = 0;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->opc = g_workloads[g_workload].opc;
+	cmd->nsid = spdk_nvme_ns_get_id(entry->ns);
+
+	if (g_workload == NDP_WORKLOAD_HEAAN_ADD) {
+		for (f = 0; f < NDP_HEAAN_NUM_FILES; f++) {
+			to_le64(&words[w++], 0);
+			for (i = 0; i < g_num_extents; i++, lba += stride) {
+				to_le64(&words[w++], lba * entry->block_size);
+				to_le64(&words[w++], (uint64_t)g_extent_blocks * entry->block_size);
+			}
+		}
+		cmd->cdw11 = g_num_extents;
+		cmd->cdw12 = g_num_extents;
+		cmd->cdw13 = g_num_extents;
+		return;
+	}
+
+	to_le64(&words[w++], entry->scan_bytes);
+	for (i = 0; i < g_num_extents; i++, lba += stride) {
+		to_le64(&words[w++], lba);
+		to_le64(&words[w++], g_extent_blocks);
+	}
+	cmd->cdw11 = g_num_extents;
+
+	if (g_workload == NDP_WORKLOAD_GREP) {
+		memcpy(&words[w], g_keywords, g_keywords_len);
+		cmd->cdw10 = g_keywords_len;
+	}
+}
+
+static int
+ndp_submit_fetch(struct perf_task *task, uint32_t cursor, bool release)
+{
+	struct ns_worker_ctx *ns_ctx = task->ns_ctx;
+	struct spdk_nvme_cmd *cmd = &task->cmd;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->opc = SPDK_NVME_OPC_CUSTOM_FETCH;
+	cmd->nsid = spdk_nvme_ns_get_id(ns_ctx->entry->ns);
+	cmd->cdw10 = cursor;
+	cmd->cdw11 = release ? NDP_FETCH_RELEASE : 0;
+
+	return spdk_nvme_ctrlr_cmd_io_raw(ns_ctx->entry->ctrlr, ns_ctx->qpair, cmd,
+					  task->buf, g_data_size, io_complete, task);
+}
+
+static void
+free_task(struct perf_task *task)
+{
+	spdk_dma_free(task->buf);
+	free(task);
+}
+
+static void
+submit_single_io(struct perf_task *task)
+{
+	struct ns_worker_ctx	*ns_ctx = task->ns_ctx;
+	struct ns_entry		*entry = ns_ctx->entry;
+	uint64_t		region = 0;
+	int			rc;
+
+	assert(!ns_ctx->is_draining);
+
+	/* Move on to other blocks for every command, unless the result cache is measured */
+	if (!g_same_region) {
+		region = ns_ctx->next_region++;
+		if (ns_ctx->next_region == entry->num_regions) {
+			ns_ctx->next_region = 0;
+		}
+	}
+
+	ndp_build_cmd(task, region);
+	task->submit_tsc = spdk_get_ticks();
+
+	rc = spdk_nvme_ctrlr_cmd_io_raw(entry->ctrlr, ns_ctx->qpair, &task->cmd, task->buf,
+					g_data_size, io_complete, task);
+	if (spdk_unlikely(rc != 0)) {
+		fprintf(stderr, "starting %s failed: %d\n", g_workloads[g_workload].name, rc);
+		ns_ctx->status = 1;
+		free_task(task);
+		return;
+	}
+
+	ns_ctx->current_queue_depth++;
+}
+
+static void
+task_complete(struct perf_task *task)
+{
+	struct ns_worker_ctx	*ns_ctx = task->ns_ctx;
+	uint64_t		tsc_diff;
+
+	ns_ctx->current_queue_depth--;
+	ns_ctx->stats.io_completed++;
+	tsc_diff = spdk_get_ticks() - task->submit_tsc;
+	ns_ctx->stats.total_tsc += tsc_diff;
+	if (spdk_unlikely(ns_ctx->stats.min_tsc > tsc_diff)) {
+		ns_ctx->stats.min_tsc = tsc_diff;
+	}
+	if (spdk_unlikely(ns_ctx->stats.max_tsc < tsc_diff)) {
+		ns_ctx->stats.max_tsc = tsc_diff;
+	}
+	if (spdk_unlikely(g_latency_sw_tracking_level > 0)) {
+		spdk_histogram_data_tally(ns_ctx->histogram, tsc_diff);
+	}
+
+	/*
+	 * is_draining indicates that time has expired and we are just waiting
+	 * for the previously submitted commands to complete.  In this case, do
+	 * not submit a new command to replace the one just completed.
+	 */
+	if (spdk_unlikely(ns_ctx->is_draining)) {
+		free_task(task);
+	} else {
+		submit_single_io(task);
+	}
+}
+
+static void
+io_complete(void *ctx, const struct spdk_nvme_cpl *cpl)
+{
+	struct perf_task	*task = ctx;
+	struct ns_worker_ctx	*ns_ctx = task->ns_ctx;
+	bool			fetch = task->cmd.opc == SPDK_NVME_OPC_CUSTOM_FETCH;
+	int			rc;
+
+	if (spdk_unlikely(spdk_nvme_cpl_is_error(cpl))) {
+		fprintf(stderr, "%s completed with error (sct=%d, sc=%d)\n",
+			fetch ? "fetch" : g_workloads[g_workload].name,
+			cpl->status.sct, cpl->status.sc);
+		ns_ctx->status = 1;
+		ns_ctx->is_draining = true;
+		task_complete(task);
+		return;
+	}
+
+	if (fetch) {
+		ns_ctx->stats.fetches++;
+	}
+
+	/* HEaaN add writes its result to the namespace, the completion carries no length */
+	if (g_workload == NDP_WORKLOAD_HEAAN_ADD) {
+		task_complete(task);
+		return;
+	}
+
+	ns_ctx->stats.result_bytes += cpl->cdw0 & NDP_RESULT_LEN_MASK;
+	if (!(cpl->cdw0 & NDP_RESULT_MORE) || (fetch && (task->cmd.cdw11 & NDP_FETCH_RELEASE))) {
+		task_complete(task);
+		return;
+	}
+
+	/* Don't leave the cursor behind on the target when the run is over */
+	rc = ndp_submit_fetch(task, cpl->cdw1, ns_ctx->is_draining);
+	if (spdk_unlikely(rc != 0)) {
+		fprintf(stderr, "starting fetch failed: %d\n", rc);
+		ns_ctx->status = 1;
+		ns_ctx->is_draining = true;
+		task_complete(task);
+	}
+}
+
+static struct perf_task *
+allocate_task(struct ns_worker_ctx *ns_ctx)
+{
+	struct perf_task *task;
+
+	task = calloc(1, sizeof(*task));
+	if (task == NULL) {
+		fprintf(stderr, "Out of memory allocating tasks\n");
+		exit(1);
+	}
+
+	task->buf = spdk_dma_zmalloc(g_data_size, 0x1000, NULL);
+	if (task->buf == NULL) {
+		fprintf(stderr, "task->buf spdk_dma_zmalloc failed\n");
+		exit(1);
+	}
+
+	task->ns_ctx = ns_ctx;
+
+	return task;
+}
+
+static void
+submit_io(struct ns_worker_ctx *ns_ctx, int queue_depth)
+{
+	while (queue_depth-- > 0 && !ns_ctx->is_draining) {
+		submit_single_io(allocate_task(ns_ctx));
+	}
+}
+
+static int
+init_ns_worker_ctx(struct ns_worker_ctx *ns_ctx)
+{
+	struct spdk_nvme_io_qpair_opts opts;
+	struct ns_entry *entry = ns_ctx->entry;
+
+	spdk_nvme_ctrlr_get_default_io_qpair_opts(entry->ctrlr, &opts, sizeof(opts));
+	/* Every operation holds one request at a time, either the command or a fetch */
+	if (opts.io_queue_requests < g_queue_depth) {
+		opts.io_queue_requests = g_queue_depth;
+	}
+	opts.delay_cmd_submit = true;
+
+	ns_ctx->qpair = spdk_nvme_ctrlr_alloc_io_qpair(entry->ctrlr, &opts, sizeof(opts));
+	if (ns_ctx->qpair == NULL) {
+		printf("ERROR: spdk_nvme_ctrlr_alloc_io_qpair failed\n");
+		return -1;
+	}
+
+	/* Spread the workers sharing a namespace over it */
+	ns_ctx->next_region = rand() % entry->num_regions;
+
+	return 0;
+}
+
+static void
+cleanup_ns_worker_ctx(struct ns_worker_ctx *ns_ctx)
+{
+	spdk_nvme_ctrlr_free_io_qpair(ns_ctx->qpair);
+}
+
+static int
+work_fn(void *arg)
+{
+	uint64_t tsc_start, tsc_end, tsc_current;
+	struct worker_thread *worker = (struct worker_thread *) arg;
+	struct ns_worker_ctx *ns_ctx = NULL;
+	uint32_t unfinished_ns_ctx;
+	int rc;
+
+	/* Allocate a queue pair for each namespace. */
+	TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+		if (init_ns_worker_ctx(ns_ctx) != 0) {
+			printf("ERROR: init_ns_worker_ctx() failed\n");
+			/* Wait on barrier to avoid blocking of successful workers */
+			pthread_barrier_wait(&g_worker_sync_barrier);
+			ns_ctx->status = 1;
+			return 1;
+		}
+	}
+
+	rc = pthread_barrier_wait(&g_worker_sync_barrier);
+	if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD) {
+		printf("ERROR: failed to wait on thread sync barrier\n");
+		ns_ctx->status = 1;
+		return 1;
+	}
+
+	tsc_start = spdk_get_ticks();
+	tsc_current = tsc_start;
+	tsc_end = tsc_start + g_time_in_sec * g_tsc_rate;
+
+	/* Submit initial commands for each namespace. */
+	TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+		submit_io(ns_ctx, g_queue_depth);
+	}
+
+	while (spdk_likely(!g_exit)) {
+		bool all_draining = true;
+
+		/*
+		 * Check for completed commands for each namespace.  A new
+		 * command is submitted in the completion callback to replace
+		 * each operation that is completed.
+		 */
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			spdk_nvme_qpair_process_completions(ns_ctx->qpair, 0);
+			if (!ns_ctx->is_draining) {
+				all_draining = false;
+			}
+		}
+
+		if (spdk_unlikely(all_draining)) {
+			break;
+		}
+
+		tsc_current = spdk_get_ticks();
+		if (tsc_current > tsc_end) {
+			break;
+		}
+	}
+
+	/* Capture the actual elapsed time when we break out of the main loop. This will account
+	 * for cases where we exit prematurely due to a signal. We only need to capture it on
+	 * one core, so use the main core.
+	 */
+	if (worker->lcore == g_main_core) {
+		g_elapsed_time_in_usec = (tsc_current - tsc_start) * SPDK_SEC_TO_USEC / g_tsc_rate;
+	}
+
+	/* Drain the commands of each ns_ctx in round robin to make the fairness */
+	do {
+		unfinished_ns_ctx = 0;
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			ns_ctx->is_draining = true;
+
+			if (ns_ctx->current_queue_depth > 0) {
+				spdk_nvme_qpair_process_completions(ns_ctx->qpair, 0);
+				if (ns_ctx->current_queue_depth > 0) {
+					unfinished_ns_ctx++;
+				}
+			}
+		}
+	} while (unfinished_ns_ctx > 0);
+
+	TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+		cleanup_ns_worker_ctx(ns_ctx);
+	}
+
+	return 0;
+}
+
+static void
+usage(char *program_name)
+{
+	printf("%s options\n", program_name);
+	printf("\n");
+	printf("\t-h, --help                show this usage\n");
+	printf("\t-r, --transport <fmt>     transport ID for the target (may be given more than once)\n");
+	printf("\t Format: 'key:value [key:value] ...'\n");
+	printf("\t Keys:\n");
+	printf("\t  trtype      Transport type (e.g. TCP)\n");
+	printf("\t  adrfam      Address family (e.g. IPv4, IPv6)\n");
+	printf("\t  traddr      Transport address (e.g. 192.168.100.8)\n");
+	printf("\t  trsvcid     Transport service identifier (e.g. 4420)\n");
+	printf("\t  subnqn      Subsystem NQN (default: %s)\n", SPDK_NVMF_DISCOVERY_NQN);
+	printf("\t  ns          NVMe namespace ID (all active namespaces are used by default)\n");
+	printf("\t  hostnqn     Host NQN\n");
+	printf("\t Example: -r 'trtype:TCP adrfam:IPv4 traddr:192.168.100.8 trsvcid:4420'\n");
+	printf("\t-c, --core-mask <mask>    core mask for I/O submission/completion\n");
+	printf("\t-q, --io-depth <val>      number of outstanding operations per namespace and core\n");
+	printf("\t-t, --time <sec>          time in seconds\n");
+	printf("\t-w, --workload <type>     operator to run: echo, grep or heaan_add\n");
+	printf("\t-o, --data-size <bytes>   size of the data buffer of every command (default %u)\n",
+	       g_data_size);
+	printf("\t-n, --extents <val>       number of extents per file (default %u)\n",
+	       g_num_extents);
+	printf("\t-b, --extent-blocks <val> length of every extent in blocks (default %u)\n",
+	       g_extent_blocks);
+	printf("\t-g, --gap-blocks <val>    blocks skipped between two extents (default %u)\n",
+	       g_gap_blocks);
+	printf("\t-k, --keywords <list>     comma separated grep keywords (default NDP)\n");
+	printf("\t-S, --same-region         run every command over the same blocks, to measure\n");
+	printf("\t                          the target's result cache\n");
+	printf("\t-L, --enable-sw-latency-tracking enable latency tracking via sw, default: disabled\n");
+	printf("\t\t-L for latency summary, -LL for detailed histogram\n");
+	printf("\t-A, --keep-alive <ms>     keep alive timeout period in milliseconds\n");
+}
+
+static void
+check_cutoff(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+	     uint64_t total, uint64_t so_far)
+{
+	double so_far_pct;
+	double **cutoff = ctx;
+
+	if (count == 0) {
+		return;
+	}
+
+	so_far_pct = (double)so_far / total;
+	while (so_far_pct >= **cutoff && **cutoff > 0) {
+		printf("%9.5f%% : %9.3fus\n", **cutoff * 100, (double)end * 1000 * 1000 / g_tsc_rate);
+		(*cutoff)++;
+	}
+}
+
+static void
+print_bucket(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+	     uint64_t total, uint64_t so_far)
+{
+	double so_far_pct;
+
+	if (count == 0) {
+		return;
+	}
+
+	so_far_pct = (double)so_far * 100 / total;
+	printf("%9.3f - %9.3f: %9.4f%%  (%9ju)\n",
+	       (double)start * 1000 * 1000 / g_tsc_rate,
+	       (double)end * 1000 * 1000 / g_tsc_rate,
+	       so_far_pct, count);
+}
+
+static void
+print_performance(void)
+{
+	uint64_t total_io_completed, total_io_tsc, total_fetches;
+	double io_per_second, scan_mb_per_second, result_mb_per_second;
+	double average_latency, min_latency, max_latency;
+	double sum_ave_latency, min_latency_so_far, max_latency_so_far;
+	double total_io_per_second, total_scan_mb_per_second, total_result_mb_per_second;
+	int ns_count;
+	struct worker_thread	*worker;
+	struct ns_worker_ctx	*ns_ctx;
+	uint32_t max_strlen;
+
+	total_io_per_second = 0;
+	total_scan_mb_per_second = 0;
+	total_result_mb_per_second = 0;
+	total_io_completed = 0;
+	total_io_tsc = 0;
+	total_fetches = 0;
+	min_latency_so_far = (double)UINT64_MAX;
+	max_latency_so_far = 0;
+	ns_count = 0;
+
+	max_strlen = 0;
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			max_strlen = spdk_max(strlen(ns_ctx->entry->name), max_strlen);
+		}
+	}
+
+	printf("========================================================\n");
+	printf("%*s\n", max_strlen + 82, "Latency(us)");
+	printf("%-*s: %10s %10s %10s %10s %10s %10s %10s\n",
+	       max_strlen + 13, "Device Information", "IOPS", "Scan MiB/s", "Res MiB/s",
+	       "Fetch/op", "Average", "min", "max");
+
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			if (ns_ctx->stats.io_completed == 0) {
+				continue;
+			}
+
+			io_per_second = (double)ns_ctx->stats.io_completed * 1000 * 1000 /
+					g_elapsed_time_in_usec;
+			scan_mb_per_second = io_per_second * ns_ctx->entry->scan_bytes / (1024 * 1024);
+			result_mb_per_second = (double)ns_ctx->stats.result_bytes * 1000 * 1000 /
+					       g_elapsed_time_in_usec / (1024 * 1024);
+			average_latency = ((double)ns_ctx->stats.total_tsc / ns_ctx->stats.io_completed) *
+					  1000 * 1000 / g_tsc_rate;
+			min_latency = (double)ns_ctx->stats.min_tsc * 1000 * 1000 / g_tsc_rate;
+			if (min_latency < min_latency_so_far) {
+				min_latency_so_far = min_latency;
+			}
+
+			max_latency = (double)ns_ctx->stats.max_tsc * 1000 * 1000 / g_tsc_rate;
+			if (max_latency > max_latency_so_far) {
+				max_latency_so_far = max_latency;
+			}
+
+			printf("%-*.*s from core %2u: %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+			       max_strlen, max_strlen, ns_ctx->entry->name, worker->lcore,
+			       io_per_second, scan_mb_per_second, result_mb_per_second,
+			       (double)ns_ctx->stats.fetches / ns_ctx->stats.io_completed,
+			       average_latency, min_latency, max_latency);
+			total_io_per_second += io_per_second;
+			total_scan_mb_per_second += scan_mb_per_second;
+			total_result_mb_per_second += result_mb_per_second;
+			total_io_completed += ns_ctx->stats.io_completed;
+			total_io_tsc += ns_ctx->stats.total_tsc;
+			total_fetches += ns_ctx->stats.fetches;
+			ns_count++;
+		}
+	}
+
+	if (ns_count != 0 && total_io_completed) {
+		sum_ave_latency = ((double)total_io_tsc / total_io_completed) * 1000 * 1000 / g_tsc_rate;
+		printf("========================================================\n");
+		printf("%-*s: %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+		       max_strlen + 13, "Total", total_io_per_second, total_scan_mb_per_second,
+		       total_result_mb_per_second, (double)total_fetches / total_io_completed,
+		       sum_ave_latency, min_latency_so_far, max_latency_so_far);
+		printf("\n");
+	}
+
+	if (g_latency_sw_tracking_level == 0 || total_io_completed == 0) {
+		return;
+	}
+
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			const double *cutoff = g_latency_cutoffs;
+
+			printf("Summary latency data for %-43.43s from core %u:\n", ns_ctx->entry->name,
+			       worker->lcore);
+			printf("=================================================================================\n");
+
+			spdk_histogram_data_iterate(ns_ctx->histogram, check_cutoff, &cutoff);
+
+			printf("\n");
+		}
+	}
+
+	if (g_latency_sw_tracking_level == 1) {
+		return;
+	}
+
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			printf("Latency histogram for %-43.43s from core %u:\n", ns_ctx->entry->name,
+			       worker->lcore);
+			printf("==============================================================================\n");
+			printf("       Range in us     Cumulative    IO count\n");
+
+			spdk_histogram_data_iterate(ns_ctx->histogram, print_bucket, NULL);
+			printf("\n");
+		}
+	}
+}
+
+static void
+register_ns(struct ctrlr_entry *ctrlr_entry, struct spdk_nvme_ns *ns)
+{
+	struct spdk_nvme_ctrlr *ctrlr = ctrlr_entry->ctrlr;
+	struct ns_entry *entry;
+	const struct spdk_nvme_ctrlr_data *cdata;
+	uint32_t num_files = g_workloads[g_workload].num_files;
+	uint64_t region_blocks;
+
+	cdata = spdk_nvme_ctrlr_get_data(ctrlr);
+
+	if (!spdk_nvme_ns_is_active(ns)) {
+		printf("Controller %-20.20s (%-20.20s): Skipping inactive NS %u\n",
+		       cdata->mn, cdata->sn, spdk_nvme_ns_get_id(ns));
+		g_warn = true;
+		return;
+	}
+
+	region_blocks = (uint64_t)num_files * g_num_extents * (g_extent_blocks + g_gap_blocks);
+	if (spdk_nvme_ns_get_num_sectors(ns) < region_blocks) {
+		printf("WARNING: controller %-20.20s (%-20.20s) ns %u has %" PRIu64 " blocks, "
+		       "the layout needs %" PRIu64 "\n", cdata->mn, cdata->sn, spdk_nvme_ns_get_id(ns),
+		       spdk_nvme_ns_get_num_sectors(ns), region_blocks);
+		g_warn = true;
+		return;
+	}
+
+	if (g_data_size > spdk_nvme_ns_get_max_io_xfer_size(ns)) {
+		printf("WARNING: controller %-20.20s (%-20.20s) ns %u transfers at most %u bytes, "
+		       "data size is %u\n", cdata->mn, cdata->sn, spdk_nvme_ns_get_id(ns),
+		       spdk_nvme_ns_get_max_io_xfer_size(ns), g_data_size);
+		g_warn = true;
+		return;
+	}
+
+	entry = calloc(1, sizeof(struct ns_entry));
+	if (entry == NULL) {
+		perror("ns_entry malloc");
+		exit(1);
+	}
+
+	entry->ctrlr = ctrlr;
+	entry->ns = ns;
+	entry->block_size = spdk_nvme_ns_get_sector_size(ns);
+	entry->region_blocks = region_blocks;
+	entry->num_regions = spdk_nvme_ns_get_num_sectors(ns) / region_blocks;
+	entry->scan_bytes = (uint64_t)num_files * g_num_extents * g_extent_blocks *
+			    entry->block_size;
+
+	snprintf(entry->name, sizeof(entry->name), "%s NSID %u", ctrlr_entry->name,
+		 spdk_nvme_ns_get_id(ns));
+
+	g_num_namespaces++;
+	TAILQ_INSERT_TAIL(&g_namespaces, entry, link);
+}
+
+static void
+unregister_namespaces(void)
+{
+	struct ns_entry *entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(entry, &g_namespaces, link, tmp) {
+		TAILQ_REMOVE(&g_namespaces, entry, link);
+		free(entry);
+	}
+}
+
+static void
+register_ctrlr(struct spdk_nvme_ctrlr *ctrlr, struct trid_entry *trid_entry)
+{
+	const struct spdk_nvme_transport_id *trid = spdk_nvme_ctrlr_get_transport_id(ctrlr);
+	struct spdk_nvme_ns *ns;
+	struct ctrlr_entry *entry = calloc(1, sizeof(struct ctrlr_entry));
+	uint32_t nsid;
+
+	if (entry == NULL) {
+		perror("ctrlr_entry malloc");
+		exit(1);
+	}
+
+	snprintf(entry->name, sizeof(entry->name), "%s (addr:%s subnqn:%s)",
+		 spdk_nvme_transport_id_trtype_str(trid->trtype), trid->traddr, trid->subnqn);
+
+	entry->ctrlr = ctrlr;
+	entry->trtype = trid_entry->trid.trtype;
+	TAILQ_INSERT_TAIL(&g_controllers, entry, link);
+
+	if (trid_entry->nsid == 0) {
+		for (nsid = spdk_nvme_ctrlr_get_first_active_ns(ctrlr);
+		     nsid != 0; nsid = spdk_nvme_ctrlr_get_next_active_ns(ctrlr, nsid)) {
+			ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
+			if (ns == NULL) {
+				continue;
+			}
+			register_ns(entry, ns);
+		}
+	} else {
+		ns = spdk_nvme_ctrlr_get_ns(ctrlr, trid_entry->nsid);
+		if (!ns) {
+			perror("Namespace does not exist.");
+			exit(1);
+		}
+
+		register_ns(entry, ns);
+	}
+}
+
+static void
+unregister_trids(void)
+{
+	struct trid_entry *trid_entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(trid_entry, &g_trid_list, tailq, tmp) {
+		TAILQ_REMOVE(&g_trid_list, trid_entry, tailq);
+		free(trid_entry);
+	}
+}
+
+static int
+add_trid(const char *trid_str)
+{
+	struct trid_entry *trid_entry;
+	struct spdk_nvme_transport_id *trid;
+	char *ns;
+	char *hostnqn;
+
+	trid_entry = calloc(1, sizeof(*trid_entry));
+	if (trid_entry == NULL) {
+		return -1;
+	}
+
+	trid = &trid_entry->trid;
+	trid->trtype = SPDK_NVME_TRANSPORT_TCP;
+	snprintf(trid->subnqn, sizeof(trid->subnqn), "%s", SPDK_NVMF_DISCOVERY_NQN);
+
+	if (spdk_nvme_transport_id_parse(trid, trid_str) != 0) {
+		fprintf(stderr, "Invalid transport ID format '%s'\n", trid_str);
+		free(trid_entry);
+		return 1;
+	}
+
+	if ((ns = strcasestr(trid_str, "ns:")) ||
+	    (ns = strcasestr(trid_str, "ns="))) {
+		char nsid_str[6]; /* 5 digits maximum in an nsid */
+		int len;
+		int nsid;
+
+		ns += 3;
+
+		len = strcspn(ns, " \t\n");
+		if (len > 5) {
+			fprintf(stderr, "NVMe namespace IDs must be 5 digits or less\n");
+			free(trid_entry);
+			return 1;
+		}
+
+		memcpy(nsid_str, ns, len);
+		nsid_str[len] = '\0';
+
+		nsid = spdk_strtol(nsid_str, 10);
+		if (nsid <= 0 || nsid > 65535) {
+			fprintf(stderr, "NVMe namespace IDs must be less than 65536 and greater than 0\n");
+			free(trid_entry);
+			return 1;
+		}
+
+		trid_entry->nsid = (uint16_t)nsid;
+	}
+
+	if ((hostnqn = strcasestr(trid_str, "hostnqn:")) ||
+	    (hostnqn = strcasestr(trid_str, "hostnqn="))) {
+		size_t len;
+
+		hostnqn += strlen("hostnqn:");
+
+		len = strcspn(hostnqn, " \t\n");
+		if (len > (sizeof(trid_entry->hostnqn) - 1)) {
+			fprintf(stderr, "Host NQN is too long\n");
+			free(trid_entry);
+			return 1;
+		}
+
+		memcpy(trid_entry->hostnqn, hostnqn, len);
+		trid_entry->hostnqn[len] = '\0';
+	}
+
+	TAILQ_INSERT_TAIL(&g_trid_list, trid_entry, tailq);
+	return 0;
+}
+
+/* The target expects one keyword per line */
+static int
+set_keywords(const char *list)
+{
+	char *c;
+
+	free(g_keywords);
+	g_keywords = strdup(list);
+	if (g_keywords == NULL) {
+		return -ENOMEM;
+	}
+
+	for (c = g_keywords; *c != '\0'; c++) {
+		if (*c == ',') {
+			*c = '\n';
+		}
+	}
+	g_keywords_len = strlen(g_keywords);
+
+	if (g_keywords_len == 0 || g_keywords_len > UINT16_MAX) {
+		fprintf(stderr, "Invalid keywords '%s'\n", list);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+#define PERF_GETOPT_SHORT "b:c:g:hk:n:o:q:r:t:w:A:LS"
+
+static const struct option g_perf_cmdline_opts[] = {
+#define PERF_EXTENT_BLOCKS	'b'
+	{"extent-blocks",			required_argument,	NULL, PERF_EXTENT_BLOCKS},
+#define PERF_CORE_MASK	'c'
+	{"core-mask",			required_argument,	NULL, PERF_CORE_MASK},
+#define PERF_GAP_BLOCKS	'g'
+	{"gap-blocks",			required_argument,	NULL, PERF_GAP_BLOCKS},
+#define PERF_HELP		'h'
+	{"help",				no_argument,		NULL, PERF_HELP},
+#define PERF_KEYWORDS		'k'
+	{"keywords",			required_argument,	NULL, PERF_KEYWORDS},
+#define PERF_EXTENTS		'n'
+	{"extents",			required_argument,	NULL, PERF_EXTENTS},
+#define PERF_DATA_SIZE		'o'
+	{"data-size",			required_argument,	NULL, PERF_DATA_SIZE},
+#define PERF_QUEUE_DEPTH	'q'
+	{"io-depth",			required_argument,	NULL, PERF_QUEUE_DEPTH},
+#define PERF_TRANSPORT	'r'
+	{"transport",			required_argument,	NULL, PERF_TRANSPORT},
+#define PERF_TIME		't'
+	{"time",				required_argument,	NULL, PERF_TIME},
+#define PERF_WORKLOAD		'w'
+	{"workload",			required_argument,	NULL, PERF_WORKLOAD},
+#define PERF_KEEPALIVE	'A'
+	{"keep-alive",			required_argument,	NULL, PERF_KEEPALIVE},
+#define PERF_ENABLE_SW_LATENCY_TRACING	'L'
+	{"enable-sw-latency-tracking",	no_argument,		NULL, PERF_ENABLE_SW_LATENCY_TRACING},
+#define PERF_SAME_REGION	'S'
+	{"same-region",			no_argument,		NULL, PERF_SAME_REGION},
+	/* Should be the last element */
+	{0, 0, 0, 0}
+};
+
+static int
+parse_args(int argc, char **argv, struct spdk_env_opts *env_opts)
+{
+	int op, long_idx;
+	long int val;
+	uint32_t i;
+
+	while ((op = getopt_long(argc, argv, PERF_GETOPT_SHORT, g_perf_cmdline_opts,
+				 &long_idx)) != -1) {
+		switch (op) {
+		case PERF_EXTENT_BLOCKS:
+		case PERF_GAP_BLOCKS:
+		case PERF_EXTENTS:
+		case PERF_DATA_SIZE:
+		case PERF_QUEUE_DEPTH:
+		case PERF_TIME:
+		case PERF_KEEPALIVE:
+			val = spdk_strtol(optarg, 10);
+			if (val < 0) {
+				fprintf(stderr, "Converting a string to integer failed\n");
+				return val;
+			}
+			switch (op) {
+			case PERF_EXTENT_BLOCKS:
+				g_extent_blocks = val;
+				break;
+			case PERF_GAP_BLOCKS:
+				g_gap_blocks = val;
+				break;
+			case PERF_EXTENTS:
+				g_num_extents = val;
+				break;
+			case PERF_DATA_SIZE:
+				g_data_size = val;
+				break;
+			case PERF_QUEUE_DEPTH:
+				g_queue_depth = val;
+				break;
+			case PERF_TIME:
+				g_time_in_sec = val;
+				break;
+			case PERF_KEEPALIVE:
+				g_keep_alive_timeout_in_ms = val;
+				break;
+			}
+			break;
+		case PERF_CORE_MASK:
+			env_opts->core_mask = optarg;
+			break;
+		case PERF_HELP:
+			usage(argv[0]);
+			return HELP_RETURN_CODE;
+		case PERF_KEYWORDS:
+			if (set_keywords(optarg) != 0) {
+				return 1;
+			}
+			break;
+		case PERF_TRANSPORT:
+			if (add_trid(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case PERF_WORKLOAD:
+			for (i = 0; i < SPDK_COUNTOF(g_workloads); i++) {
+				if (strcmp(optarg, g_workloads[i].name) == 0) {
+					break;
+				}
+			}
+			if (i == SPDK_COUNTOF(g_workloads)) {
+				fprintf(stderr, "Unknown workload '%s'\n", optarg);
+				usage(argv[0]);
+				return 1;
+			}
+			g_workload = i;
+			break;
+		case PERF_ENABLE_SW_LATENCY_TRACING:
+			g_latency_sw_tracking_level++;
+			break;
+		case PERF_SAME_REGION:
+			g_same_region = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (TAILQ_EMPTY(&g_trid_list)) {
+		fprintf(stderr, "missing -r, no target to run the operators on\n");
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!g_queue_depth || !g_time_in_sec || !g_num_extents || !g_extent_blocks) {
+		fprintf(stderr, "queue depth, time, extents and extent blocks must not be 0\n");
+		return 1;
+	}
+
+	if (g_workload == NDP_WORKLOAD_GREP) {
+		if (g_keywords == NULL && set_keywords("NDP") != 0) {
+			return 1;
+		}
+	} else {
+		g_keywords_len = 0;
+	}
+
+	/* The target needs room for the result after the descriptor of grep */
+	if (ndp_desc_size() >= g_data_size) {
+		fprintf(stderr, "%u extents do not fit in a %u bytes data buffer\n",
+			g_num_extents, g_data_size);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+register_workers(void)
+{
+	uint32_t i;
+	struct worker_thread *worker;
+
+	SPDK_ENV_FOREACH_CORE(i) {
+		worker = calloc(1, sizeof(*worker));
+		if (worker == NULL) {
+			fprintf(stderr, "Unable to allocate worker\n");
+			return -1;
+		}
+
+		TAILQ_INIT(&worker->ns_ctx);
+		worker->lcore = i;
+		TAILQ_INSERT_TAIL(&g_workers, worker, link);
+		g_num_workers++;
+	}
+
+	return 0;
+}
+
+static void
+unregister_workers(void)
+{
+	struct worker_thread *worker, *tmp_worker;
+	struct ns_worker_ctx *ns_ctx, *tmp_ns_ctx;
+
+	/* Free namespace context and worker thread */
+	TAILQ_FOREACH_SAFE(worker, &g_workers, link, tmp_worker) {
+		TAILQ_REMOVE(&g_workers, worker, link);
+
+		TAILQ_FOREACH_SAFE(ns_ctx, &worker->ns_ctx, link, tmp_ns_ctx) {
+			TAILQ_REMOVE(&worker->ns_ctx, ns_ctx, link);
+			spdk_histogram_data_free(ns_ctx->histogram);
+			free(ns_ctx);
+		}
+
+		free(worker);
+	}
+}
+
+static bool
+probe_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+	 struct spdk_nvme_ctrlr_opts *opts)
+{
+	struct trid_entry *trid_entry = cb_ctx;
+
+	if (trid->trtype != trid_entry->trid.trtype &&
+	    strcasecmp(trid->trstring, trid_entry->trid.trstring)) {
+		return false;
+	}
+
+	opts->keep_alive_timeout_ms = g_keep_alive_timeout_in_ms;
+	memcpy(opts->hostnqn, trid_entry->hostnqn, sizeof(opts->hostnqn));
+
+	if (opts->num_io_queues < g_num_workers) {
+		opts->num_io_queues = g_num_workers;
+	}
+
+	return true;
+}
+
+static void
+attach_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
+	  struct spdk_nvme_ctrlr *ctrlr, const struct spdk_nvme_ctrlr_opts *opts)
+{
+	printf("Attached to NVMe over Fabrics controller at %s:%s: %s\n",
+	       trid->traddr, trid->trsvcid, trid->subnqn);
+
+	register_ctrlr(ctrlr, cb_ctx);
+}
+
+static int
+register_controllers(void)
+{
+	struct trid_entry *trid_entry;
+
+	printf("Initializing NVMe Controllers\n");
+
+	TAILQ_FOREACH(trid_entry, &g_trid_list, tailq) {
+		if (spdk_nvme_probe(&trid_entry->trid, trid_entry, probe_cb, attach_cb, NULL) != 0) {
+			fprintf(stderr, "spdk_nvme_probe() failed for transport address '%s'\n",
+				trid_entry->trid.traddr);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+unregister_controllers(void)
+{
+	struct ctrlr_entry *entry, *tmp;
+	struct spdk_nvme_detach_ctx *detach_ctx = NULL;
+
+	TAILQ_FOREACH_SAFE(entry, &g_controllers, link, tmp) {
+		TAILQ_REMOVE(&g_controllers, entry, link);
+		spdk_nvme_detach_async(entry->ctrlr, &detach_ctx);
+		free(entry);
+	}
+
+	if (detach_ctx) {
+		spdk_nvme_detach_poll(detach_ctx);
+	}
+}
+
+static int
+allocate_ns_worker(struct ns_entry *entry, struct worker_thread *worker)
+{
+	struct ns_worker_ctx	*ns_ctx;
+
+	ns_ctx = calloc(1, sizeof(struct ns_worker_ctx));
+	if (!ns_ctx) {
+		return -1;
+	}
+
+	printf("Associating %s with lcore %d\n", entry->name, worker->lcore);
+	ns_ctx->stats.min_tsc = UINT64_MAX;
+	ns_ctx->entry = entry;
+	ns_ctx->histogram = spdk_histogram_data_alloc();
+	TAILQ_INSERT_TAIL(&worker->ns_ctx, ns_ctx, link);
+
+	return 0;
+}
+
+/*
+ * Each core runs a single worker.  With as many workers as namespaces, each
+ * worker drives one namespace; otherwise the smaller set is reused round
+ * robin, so every namespace is driven by one or more workers or every worker
+ * drives one or more namespaces.
+ */
+static int
+associate_workers_with_ns(void)
+{
+	struct ns_entry		*entry = TAILQ_FIRST(&g_namespaces);
+	struct worker_thread	*worker = TAILQ_FIRST(&g_workers);
+	uint32_t		i, count;
+
+	count = spdk_max(g_num_namespaces, g_num_workers);
+
+	for (i = 0; i < count; i++) {
+		if (allocate_ns_worker(entry, worker) != 0) {
+			return -1;
+		}
+
+		worker = TAILQ_NEXT(worker, link);
+		if (worker == NULL) {
+			worker = TAILQ_FIRST(&g_workers);
+		}
+
+		entry = TAILQ_NEXT(entry, link);
+		if (entry == NULL) {
+			entry = TAILQ_FIRST(&g_namespaces);
+		}
+	}
+
+	return 0;
+}
+
+static void *
+nvme_poll_ctrlrs(void *arg)
+{
+	struct ctrlr_entry *entry;
+	int oldstate;
+	int rc;
+
+	spdk_unaffinitize_thread();
+
+	while (true) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+
+		TAILQ_FOREACH(entry, &g_controllers, link) {
+			rc = spdk_nvme_ctrlr_process_admin_completions(entry->ctrlr);
+			if (spdk_unlikely(rc < 0 && !g_exit)) {
+				g_exit = true;
+			}
+		}
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+
+		/* This is a pthread cancellation point and cannot be removed. */
+		sleep(1);
+	}
+
+	return NULL;
+}
+
+static void
+sig_handler(int signo)
+{
+	g_exit = true;
+}
+
+static int
+setup_sig_handlers(void)
+{
+	struct sigaction sigact = {};
+	int rc;
+
+	sigemptyset(&sigact.sa_mask);
+	sigact.sa_handler = sig_handler;
+	rc = sigaction(SIGINT, &sigact, NULL);
+	if (rc < 0) {
+		fprintf(stderr, "sigaction(SIGINT) failed, errno %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	rc = sigaction(SIGTERM, &sigact, NULL);
+	if (rc < 0) {
+		fprintf(stderr, "sigaction(SIGTERM) failed, errno %d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int rc;
+	struct worker_thread *worker, *main_worker;
+	struct ns_worker_ctx *ns_ctx;
+	struct spdk_env_opts opts;
+	pthread_t thread_id = 0;
+
+	/* Use the runtime PID to set the random seed */
+	srand(getpid());
+
+	spdk_env_opts_init(&opts);
+	opts.name = "ndp_perf";
+	rc = parse_args(argc, argv, &opts);
+	if (rc != 0) {
+		unregister_trids();
+		free(g_keywords);
+		return rc == HELP_RETURN_CODE ? 0 : rc;
+	}
+
+	if (spdk_env_init(&opts) < 0) {
+		fprintf(stderr, "Unable to initialize SPDK env\n");
+		unregister_trids();
+		free(g_keywords);
+		return -1;
+	}
+
+	rc = setup_sig_handlers();
+	if (rc != 0) {
+		rc = -1;
+		goto cleanup;
+	}
+
+	g_tsc_rate = spdk_get_ticks_hz();
+
+	if (register_workers() != 0) {
+		rc = -1;
+		goto cleanup;
+	}
+
+	if (register_controllers() != 0) {
+		rc = -1;
+		goto cleanup;
+	}
+
+	if (g_warn) {
+		printf("WARNING: Some requested NVMe devices were skipped\n");
+	}
+
+	if (g_num_namespaces == 0) {
+		fprintf(stderr, "No valid NVMe controllers found\n");
+		rc = -1;
+		goto cleanup;
+	}
+
+	rc = pthread_create(&thread_id, NULL, &nvme_poll_ctrlrs, NULL);
+	if (rc != 0) {
+		fprintf(stderr, "Unable to spawn a thread to poll admin queues.\n");
+		goto cleanup;
+	}
+
+	if (associate_workers_with_ns() != 0) {
+		rc = -1;
+		goto cleanup;
+	}
+
+	rc = pthread_barrier_init(&g_worker_sync_barrier, NULL, g_num_workers);
+	if (rc != 0) {
+		fprintf(stderr, "Unable to initialize thread sync barrier\n");
+		goto cleanup;
+	}
+
+	printf("Initialization complete. Running %s, %u extents of %u blocks per file.\n",
+	       g_workloads[g_workload].name, g_num_extents, g_extent_blocks);
+
+	/* Launch all of the secondary workers */
+	g_main_core = spdk_env_get_current_core();
+	main_worker = NULL;
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		if (worker->lcore != g_main_core) {
+			spdk_env_thread_launch_pinned(worker->lcore, work_fn, worker);
+		} else {
+			assert(main_worker == NULL);
+			main_worker = worker;
+		}
+	}
+
+	assert(main_worker != NULL);
+	work_fn(main_worker);
+
+	spdk_env_thread_wait_all();
+
+	print_performance();
+
+	pthread_barrier_destroy(&g_worker_sync_barrier);
+
+cleanup:
+	fflush(stdout);
+
+	if (thread_id && pthread_cancel(thread_id) == 0) {
+		pthread_join(thread_id, NULL);
+	}
+
+	/* Collect errors from all workers and namespaces */
+	TAILQ_FOREACH(worker, &g_workers, link) {
+		if (rc != 0) {
+			break;
+		}
+
+		TAILQ_FOREACH(ns_ctx, &worker->ns_ctx, link) {
+			if (ns_ctx->status != 0) {
+				rc = ns_ctx->status;
+				break;
+			}
+		}
+	}
+
+	unregister_trids();
+	unregister_namespaces();
+	unregister_controllers();
+	unregister_workers();
+
+	spdk_env_fini();
+
+	free(g_keywords);
+
+	if (rc != 0) {
+		fprintf(stderr, "%s: errors occurred\n", argv[0]);
+	}
+
+	return rc;
+}
@@ -0,0 +1,134 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/** \file
+ * C interface to libHEAAN
+ *
+ * The HEaaN NDP operators (lib/nvmf/ndp_he.c) are C, libHEAAN is C++ over
+ * NTL: these functions build the one context of the process and operate on
+ * its ciphertexts, passed around as opaque pointers.  They are implemented
+ * in lib/nvmf/ndp_he_wrapper.cpp and built with HEAAN_LIB, libHEAAN and its
+ * headers being installed in lib/heaan and include/heaan.
+ *
+ * Functions returning an int return 0 on success or a negated errno.
+ * Exceptions thrown by the library are caught and returned as -EINVAL or
+ * -ENOMEM, none crosses this interface.
+ */
+
+#ifndef HEAAN_CWRAPPER_H
+#define HEAAN_CWRAPPER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The context, built once by heaan_Initialize() or heaan_Initialize_FromMem()
+ * and kept for the life of the process.
+ */
+typedef struct heaan_ndp_context {
+	/** Ring, secret key and scheme of the library (Ring, SecretKey, Scheme) */
+	void	*ring;
+	void	*secret_key;
+	void	*scheme;
+
+	/** Parameters given to heaan_Initialize() */
+	long	log_q;
+	long	log_p;
+	long	log_slots;
+	long	log_t;
+	long	log_key_q;
+} heaan_ndp_context;
+
+/**
+ * Generate the keys, the bootstrapping ones included, which takes minutes.
+ *
+ * \param log_q Modulus ciphertexts are bootstrapped from.
+ * \param log_p Scale, a rescaled product is divided by 2^log_p.
+ * \param log_slots Slots of the ciphertexts that can be bootstrapped.
+ * \param log_t Iterations of the exponential evaluated by bootstrapping.
+ * \param log_key_q Modulus of a bootstrapped ciphertext, at most that of the
+ * library (logQ).
+ *
+ * \return 0 on success, -EINVAL if the parameters are out of range, -EEXIST
+ * if the context was already built or -ENOMEM.
+ */
+int heaan_Initialize(int log_q, int log_p, int log_slots, int log_t, int log_key_q);
+
+/** Size of the serialization of the context by heaan_Serialize(). */
+unsigned long heaan_Get_SerializedSize(void);
+
+/**
+ * Serialize the parameters, the secret key and the keys of the context,
+ * 8 byte aligned words in host order, into len bytes at buf.
+ *
+ * \return 0 on success, -ENOENT if there is no context or -ENOSPC if len is
+ * less than heaan_Get_SerializedSize().
+ */
+int heaan_Serialize(void *buf, unsigned long len);
+
+/**
+ * Build the context from a serialization by heaan_Serialize() in place:
+ * the keys are used from buf, which must be 8 byte aligned and stay mapped
+ * for the life of the process.  Only the tables of the ring are computed.
+ *
+ * \return 0 on success, -EINVAL if buf is not a serialization of a context
+ * of this library, -EEXIST if the context was already built or -ENOMEM.
+ */
+int heaan_Initialize_FromMem(const void *buf, unsigned long len);
+
+/** The context, NULL until it is built. */
+heaan_ndp_context *heaan_Get_Context(void);
+
+/* Ciphertexts */
+
+void *create_Ciphertext(void);
+void free_Ciphertext(void *cipher);
+
+int getCiphertextN(void *cipher);
+int getCiphertextLogp(void *cipher);
+int getCiphertextLogq(void *cipher);
+
+/**
+ * A ciphertext is serialized as its number of slots, logp and logq, little
+ * endian 64 bit words, then the 2^logN coefficients of a and those of b,
+ * each in (logq + 8) / 8 little endian bytes.
+ */
+unsigned long getCiphertextMemSize(void *cipher);
+
+/**
+ * Deserialize the ciphertext at offset in size bytes at buf.  Returns NULL
+ * if it is malformed, doesn't fit in the buffer or on allocation failure.
+ */
+void *readCiphertextFromMem(const void *buf, unsigned long size, unsigned long offset);
+
+/** Serialize cipher at offset in buf, which getCiphertextMemSize() bytes must fit. */
+void writeCiphertextToMem(void *cipher, void *buf, unsigned long offset);
+
+/* Operations, their result overwriting res.  They return -EINVAL if the
+ * inputs are not at the same level, or have no slots or level to operate on.
+ */
+
+int ciphertextAdd(void *scheme, void *res, void *cipher1, void *cipher2);
+int ciphertextSub(void *scheme, void *res, void *cipher1, void *cipher2);
+int ciphertextMult(void *scheme, void *res, void *cipher1, void *cipher2);
+
+/** Divide cipher by 2^log_p, i.e. bring a product back to the scale of its inputs. */
+int ciphertextReScale(void *scheme, void *cipher);
+
+/** Bootstrap cipher, of 2^log_slots slots, into res at log_key_q. */
+int ciphertextBootstrap(void *scheme, void *res, void *cipher);
+
+/**
+ * Decrypt cipher into the message of its slots, pairs of little endian
+ * doubles (real and imaginary parts), at buf.  Returns -ENOSPC if the
+ * message doesn't fit in size bytes.
+ */
+int decryptCiphertextToMem(void *scheme, void *cipher, void *buf, unsigned long size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEAAN_CWRAPPER_H */
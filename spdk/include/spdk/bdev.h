@@ -704,6 +704,16 @@ uint32_t spdk_bdev_get_optimal_io_boundary(const struct spdk_bdev *bdev);
  */
 bool spdk_bdev_has_write_cache(const struct spdk_bdev *bdev);
 
+/**
+ * Query whether reads are only served without an intermediate copy if they
+ * cover whole optimal I/O boundary units.
+ *
+ * \param bdev Block device to query.
+ * eturn true if reads should be cut at the optimal I/O boundary, into buffers
+ *         aligned to it.
+ */
+bool spdk_bdev_reads_whole_units(const struct spdk_bdev *bdev);
+
 /**
  * Get a bdev's UUID.
  *
@@ -460,6 +460,15 @@ struct spdk_bdev {
 	 */
 	bool split_on_write_unit;
 
+	/**
+	 * Specifies that reads are only served directly into the data buffer
+	 * if they cover whole optimal_io_boundary units, the buffer being
+	 * aligned to the unit; the module goes through a buffer of its own
+	 * for any other read (e.g. compressed volumes).  Readers of large
+	 * ranges should then cut their reads at the boundary.
+	 */
+	bool read_whole_units;
+
 	/** Number of blocks required for write */
 	uint32_t write_unit_size;
 
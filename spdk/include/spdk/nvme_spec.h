@@ -1742,8 +1742,15 @@ enum spdk_nvme_nvm_opcode {
 	SPDK_NVME_OPC_COPY				= 0x19,
 	SPDK_NVME_OPC_IO_MANAGEMENT_SEND		= 0x1D,
 
-	SPDK_NVME_OPC_CUSTOM_ECHO = 0xd0, // opcode for custom echo,
+	SPDK_NVME_OPC_CUSTOM_ECHO = 0xd5, // opcode for custom echo,
 	SPDK_NVME_OPC_CUSTOM_GREP = 0xd1, // opcode for custom grep,
+	SPDK_NVME_OPC_CUSTOM_FETCH = 0xd2, // opcode for fetching the rest of an NDP result,
+	SPDK_NVME_OPC_CUSTOM_FILTER = 0xd9, // opcode for filtering delimited records,
+	SPDK_NVME_OPC_CUSTOM_AGGREGATE = 0xdd, // opcode for aggregating a numeric column,
+	SPDK_NVME_OPC_CUSTOM_REGEX = 0xc1, // opcode for matching lines against a compiled regex,
+	SPDK_NVME_OPC_CUSTOM_TOPK = 0xc5, // opcode for the top K records by a numeric column,
+	SPDK_NVME_OPC_CUSTOM_SAMPLE = 0xc9, // opcode for a random sample of records,
+	SPDK_NVME_OPC_CUSTOM_BATCH = 0xcd, // opcode for running an operator over a batch of files,
 	#ifdef HEAAN_LIB
 	SPDK_NVME_OPC_CUSTOM_HEAAN_ADD = 0xe0,   // opcode for HEaaN addition
 	SPDK_NVME_OPC_CUSTOM_HEAAN_SUB = 0xe1,   // opcode for HEaaN subtraction
@@ -1752,6 +1759,7 @@ enum spdk_nvme_nvm_opcode {
 	
 	SPDK_NVME_OPC_CUSTOM_HEAAN_DEC = 0xe4,   // opcode for HEaaN decryption
 	SPDK_NVME_OPC_CUSTOM_HEAAN_BTSRP = 0xe5, // opcode for HEaaN bootstrapping
+	SPDK_NVME_OPC_CUSTOM_HEAAN_BATCH = 0xe9, // opcode for a HEaaN operation over a batch of ciphertexts
 	#endif
 };
 
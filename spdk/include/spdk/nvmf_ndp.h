@@ -0,0 +1,381 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/** \file
+ * NVMe-oF Target near-data processing (NDP) operator API
+ *
+ * NDP operators are vendor specific I/O commands that run a computation
+ * (echo, grep, homomorphic encryption, ...) over data stored on a namespace
+ * and hand the result back to the host.  Each operator owns one opcode and is
+ * registered once, normally from a constructor through
+ * \ref SPDK_NVMF_NDP_OP_REGISTER, so that new operators can be linked into
+ * (or preloaded by) the target application without touching the controller
+ * or transport code.
+ */
+
+#ifndef SPDK_NVMF_NDP_H_
+#define SPDK_NVMF_NDP_H_
+
+#include "spdk/stdinc.h"
+#include "spdk/bdev.h"
+#include "spdk/cpuset.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/nvmf_cmd.h"
+#include "spdk/queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** First opcode that may be used by an NDP operator (NVM vendor specific range). */
+#define SPDK_NVMF_NDP_OPC_MIN	0x80
+
+/** The operator modifies the media (e.g. writes its result back to the namespace). */
+#define SPDK_NVMF_NDP_OP_F_WRITES_MEDIA	(1u << 0)
+
+/**
+ * Function called to execute an NDP command.
+ *
+ * It has the same contract as the built-in bdev I/O command handlers: it returns
+ * SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE if the response in req has been filled
+ * in synchronously, or SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS if it will call
+ * spdk_nvmf_request_complete() later on.
+ *
+ * \param bdev The bdev backing the namespace addressed by the command.
+ * \param desc The bdev descriptor opened by the subsystem.
+ * \param ch The I/O channel of the calling poll group.
+ * \param req The NVMe-oF request.
+ *
+ * \return \ref spdk_nvmf_request_exec_status
+ */
+typedef int (*spdk_nvmf_ndp_exec_fn)(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+				     struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
+
+/**
+ * NDP operator descriptor.
+ */
+struct spdk_nvmf_ndp_op {
+	/** Human readable name, used for logging. */
+	const char			*name;
+
+	/** NVM command set opcode handled by this operator. */
+	uint8_t				opc;
+
+	/** Direction of the data buffer described by the command's SGL. */
+	enum spdk_nvme_data_transfer	xfer;
+
+	/** Combination of SPDK_NVMF_NDP_OP_F_* flags. */
+	uint32_t			flags;
+
+	/** Command handler. */
+	spdk_nvmf_ndp_exec_fn		exec;
+
+	TAILQ_ENTRY(spdk_nvmf_ndp_op)	tailq;
+};
+
+/**
+ * Register an NDP operator.
+ *
+ * This function should be invoked through \ref SPDK_NVMF_NDP_OP_REGISTER. The
+ * operator structure must stay valid for the lifetime of the application.
+ * Operators have to be registered before the first I/O queue pair connects.
+ *
+ * \param op The operator to register.
+ *
+ * \return 0 on success, -EINVAL if the operator is malformed or uses an opcode
+ * outside of the vendor specific range, -EEXIST if the opcode is already taken.
+ */
+int spdk_nvmf_ndp_register_op(struct spdk_nvmf_ndp_op *op);
+
+/**
+ * Look up the operator registered for an opcode.
+ *
+ * \param opc NVM command set opcode.
+ *
+ * \return the operator or NULL if none is registered for opc.
+ */
+const struct spdk_nvmf_ndp_op *spdk_nvmf_ndp_get_op(uint8_t opc);
+
+/**
+ * Get the data transfer direction of a registered NDP operator.
+ *
+ * Used by the transports while parsing a command capsule.
+ *
+ * \param opc NVM command set opcode.
+ * \param xfer Filled with the operator's transfer direction.
+ *
+ * \return true if an operator is registered for opc, false otherwise.
+ */
+bool spdk_nvmf_ndp_get_xfer(uint8_t opc, enum spdk_nvme_data_transfer *xfer);
+
+/**
+ * Set the timeout of the commands of an NDP operator.
+ *
+ * A command running for longer than this stops at its next chunk (or
+ * ciphertext) and completes with SPDK_NVME_SC_ABORTED_BY_REQUEST and the DNR
+ * bit set.  Commands that are already running keep the timeout they started
+ * with.  Operators that compute their result in one go, without chunks, are
+ * never stopped.
+ *
+ * \param opc NVM command set opcode of the operator.
+ * \param timeout_ms Timeout in milliseconds, 0 for none (the default).
+ *
+ * \return 0 on success, -ENOENT if no operator is registered for opc.
+ */
+int spdk_nvmf_ndp_set_timeout(uint8_t opc, uint32_t timeout_ms);
+
+/**
+ * Get the timeout of the commands of an NDP operator.
+ *
+ * \param opc NVM command set opcode of the operator.
+ *
+ * \return the timeout in milliseconds, 0 if there is none.
+ */
+uint32_t spdk_nvmf_ndp_get_timeout(uint8_t opc);
+
+/**
+ * Function called when the NDP offload threads have exited.
+ *
+ * \param cb_arg Argument passed to spdk_nvmf_ndp_offload_stop().
+ */
+typedef void (*spdk_nvmf_ndp_offload_stop_cb)(void *cb_arg);
+
+/**
+ * Start the NDP offload threads.
+ *
+ * The computation of NDP operators (e.g. the grep scan or a ciphertext
+ * addition) is handed to these threads instead of running on the poll group
+ * thread that received the command, so that the other queue pairs of that
+ * poll group are not stalled by it.  Without offload threads, operators run
+ * on the poll group threads.
+ *
+ * Must be called from an SPDK thread before the poll groups are created.
+ *
+ * \param cpumask Cores the threads may be scheduled on, normally cores that
+ * run no poll group.  NULL for no restriction.
+ * \param num_threads Number of threads, 0 for one per core of cpumask.
+ *
+ * \return 0 on success (also if both cpumask is NULL and num_threads is 0, in
+ * which case no thread is started), -EEXIST if the threads were already
+ * started, -EINVAL for an empty cpumask, -ENOMEM if no thread can be created.
+ */
+int spdk_nvmf_ndp_offload_start(const struct spdk_cpuset *cpumask, uint32_t num_threads);
+
+/**
+ * Stop the NDP offload threads, once the jobs queued to them are done.
+ *
+ * Must be called from an SPDK thread after the poll groups have been
+ * destroyed.
+ *
+ * \param cb_fn Called on the calling thread once all threads have exited,
+ * possibly before this function returns.  May be NULL.
+ * \param cb_arg Argument passed to cb_fn.
+ */
+void spdk_nvmf_ndp_offload_stop(spdk_nvmf_ndp_offload_stop_cb cb_fn, void *cb_arg);
+
+/**
+ * Get the number of NDP offload threads.
+ *
+ * \return the number of threads, 0 if operators run on the poll group threads.
+ */
+uint32_t spdk_nvmf_ndp_offload_get_num_threads(void);
+
+/** Default size of the NDP result cache */
+#define SPDK_NVMF_NDP_CACHE_DEFAULT_SIZE	(32 * 1024 * 1024)
+
+/**
+ * NDP result cache statistics
+ */
+struct spdk_nvmf_ndp_cache_stats {
+	/** Size limit in bytes, 0 if the cache is disabled */
+	uint64_t	capacity;
+
+	/** Memory used by the cached results, in bytes */
+	uint64_t	size;
+	uint64_t	num_entries;
+
+	/** Commands answered from the cache */
+	uint64_t	hits;
+
+	/** Cacheable commands that had to scan the namespace */
+	uint64_t	misses;
+	uint64_t	insertions;
+
+	/** Results dropped to make room for new ones */
+	uint64_t	evictions;
+
+	/** Results dropped because a command modified the blocks they were computed from */
+	uint64_t	invalidations;
+};
+
+/**
+ * Set the size of the NDP result cache.
+ *
+ * Complete results of read-only NDP operators (e.g. grep) are kept, keyed by
+ * the namespace, the blocks they were computed from and the operator
+ * arguments, so that repeating a command doesn't scan the namespace again.
+ * Results are dropped when a write, write zeroes, deallocate or copy through
+ * the target modifies one of their blocks.  Writes that bypass the target
+ * (e.g. another application on the same bdev) are not seen.
+ *
+ * \param capacity Size limit in bytes.  0 disables the cache and drops all
+ * results.  Shrinking drops the least recently used results.
+ */
+void spdk_nvmf_ndp_cache_set_capacity(uint64_t capacity);
+
+/**
+ * Get the NDP result cache statistics.
+ *
+ * \param stats Filled with the current statistics.
+ */
+void spdk_nvmf_ndp_cache_get_stats(struct spdk_nvmf_ndp_cache_stats *stats);
+
+/** Default HEaaN context parameters, those of \ref spdk_nvmf_ndp_he_opts in order */
+#define SPDK_NVMF_NDP_HE_DEFAULT_LOG_Q		300
+#define SPDK_NVMF_NDP_HE_DEFAULT_LOG_P		30
+#define SPDK_NVMF_NDP_HE_DEFAULT_LOG_SLOTS	10
+#define SPDK_NVMF_NDP_HE_DEFAULT_LOG_T		8
+#define SPDK_NVMF_NDP_HE_DEFAULT_LOG_KEY_Q	1024
+
+/** Default ring dimension the buffer pool is sized for, that of libHEAAN */
+#define SPDK_NVMF_NDP_HE_DEFAULT_LOG_N		16
+/** Default number of pooled buffers, enough for 8 operations of 3 files in flight */
+#define SPDK_NVMF_NDP_HE_DEFAULT_NUM_BUFS	24
+
+/**
+ * HEaaN context parameters, passed to heaan_Initialize() in this order.
+ */
+struct spdk_nvmf_ndp_he_opts {
+	uint32_t	log_q;
+	uint32_t	log_p;
+	uint32_t	log_slots;
+	uint32_t	log_t;
+	uint32_t	log_key_q;
+
+	/**
+	 * File the generated keys and precomputed tables are saved to and
+	 * loaded from on the next start, NULL to generate them every time.
+	 */
+	char		*key_file;
+
+	/**
+	 * Ciphertext buffers taken from a pool rather than allocated for
+	 * every operation: log2 of the ring dimension they are sized for, a
+	 * ciphertext at log_q fitting in one, and how many there are.  Larger
+	 * files are still allocated.  0 buffers disables the pool.
+	 */
+	uint32_t	log_n;
+	uint32_t	num_bufs;
+
+	/**
+	 * Offload threads a multiplication of RNS packed ciphertexts is split
+	 * over, prime by prime.  0 for all of them, 1 not to split.
+	 */
+	uint32_t	eval_threads;
+};
+
+/**
+ * State of the HEaaN context.
+ */
+enum spdk_nvmf_ndp_he_state {
+	/** Not started, or the target is built without HEaaN */
+	SPDK_NVMF_NDP_HE_STATE_DISABLED,
+	/** Being loaded or generated, HEaaN commands complete with Namespace Not Ready */
+	SPDK_NVMF_NDP_HE_STATE_LOADING,
+	SPDK_NVMF_NDP_HE_STATE_READY,
+	SPDK_NVMF_NDP_HE_STATE_FAILED,
+};
+
+/**
+ * HEaaN context status
+ */
+struct spdk_nvmf_ndp_he_status {
+	enum spdk_nvmf_ndp_he_state	state;
+
+	/** The keys were loaded from the key file rather than generated */
+	bool				from_key_file;
+
+	/** Time it took to load or generate the context, 0 while loading */
+	uint64_t			init_time_ms;
+};
+
+/**
+ * HEaaN buffer pool and ciphertext object statistics
+ */
+struct spdk_nvmf_ndp_he_pool_stats {
+	/** Size of a pooled buffer, 0 if there is no pool */
+	uint64_t	buf_size;
+	uint32_t	num_bufs;
+	uint32_t	bufs_in_use;
+	/** Most buffers ever in use at once */
+	uint32_t	bufs_high_water;
+	uint64_t	buf_gets;
+	/** Buffers allocated for files larger than buf_size or with the pool exhausted */
+	uint64_t	buf_fallbacks;
+
+	/** Result ciphertext objects created, and reused from a thread's cache */
+	uint64_t	ct_created;
+	uint64_t	ct_reused;
+};
+
+/**
+ * Initialize HEaaN context options to their defaults.
+ *
+ * \param opts Options to initialize.
+ */
+void spdk_nvmf_ndp_he_opts_init(struct spdk_nvmf_ndp_he_opts *opts);
+
+/**
+ * Build the HEaaN context the HEaaN operators evaluate with.
+ *
+ * The context is loaded from opts->key_file if it holds keys generated with
+ * the same parameters, or generated and then saved to it.  Either way this
+ * runs on a thread of its own, which may take minutes with bootstrapping
+ * keys, while the target already serves the other commands.
+ *
+ * \param opts Context parameters, copied.
+ *
+ * \return 0 if the context is being built, -ENOTSUP if the target is built
+ * without HEaaN, -EALREADY if it was already started, -ENOMEM or the error of
+ * the thread creation.
+ */
+int spdk_nvmf_ndp_he_start(const struct spdk_nvmf_ndp_he_opts *opts);
+
+/**
+ * Get the status of the HEaaN context.
+ *
+ * \param status Filled with the current status.
+ */
+void spdk_nvmf_ndp_he_get_status(struct spdk_nvmf_ndp_he_status *status);
+
+/**
+ * Get the statistics of the HEaaN buffer pool.
+ *
+ * \param stats Filled with the current statistics.
+ */
+void spdk_nvmf_ndp_he_get_pool_stats(struct spdk_nvmf_ndp_he_pool_stats *stats);
+
+/**
+ * Get the name of a HEaaN context state.
+ *
+ * \param state State.
+ *
+ * \return the name of the state.
+ */
+const char *spdk_nvmf_ndp_he_state_str(enum spdk_nvmf_ndp_he_state state);
+
+/*
+ * Macro used to register new NDP operators.
+ */
+#define SPDK_NVMF_NDP_OP_REGISTER(name, op) \
+static void __attribute__((constructor)) _spdk_nvmf_ndp_op_register_##name(void) \
+{ \
+	spdk_nvmf_ndp_register_op(op); \
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,6 +15,7 @@
 #include "spdk/nvme_spec.h"
 #include "spdk/nvmf.h"
 #include "spdk/nvmf_cmd.h"
+#include "spdk/nvmf_ndp.h"
 #include "spdk/nvmf_spec.h"
 #include "spdk/memory.h"
 #include "spdk/trace.h"
@@ -663,20 +664,14 @@ spdk_nvmf_req_get_xfer(struct spdk_nvmf_request *req) {
 	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
 	struct spdk_nvme_sgl_descriptor *sgl = &cmd->dptr.sgl1;
 
-	//	fprintf(stdout, "start_lba: %u\n", req->iovcnt);
-//    fprintf(stdout, "hello, this is spdk_nvmf_req_get_xfer\n");
-//    fprintf(stdout, "xfer: %d\n", xfer);
-
-    if (cmd->opc == 0xD0) {  // 커스텀 Echo 명령 //데이터 양방향 전송
-        return SPDK_NVME_DATA_CONTROLLER_TO_HOST;
-    }
-
-	#ifdef HEAAN_LIB
-	if (cmd->opc == 0xE0) { // HEaaN Cipadd command
-        return SPDK_NVME_DATA_HOST_TO_CONTROLLER;
-        //return SPDK_NVME_DATA_CONTROLLER_TO_HOST;
+	/* Vendor specific I/O opcodes may be claimed by NDP operators, which declare
+	 * their own data direction instead of following the opcode bit encoding.
+	 */
+	if (cmd->opc >= SPDK_NVMF_NDP_OPC_MIN && req->qpair->qid != 0 &&
+	    spdk_nvmf_ndp_get_xfer(cmd->opc, &xfer))
+	{
+		return xfer;
 	}
-	#endif
 
 	/* Figure out data transfer direction */
 	if (cmd->opc == SPDK_NVME_OPC_FABRIC)
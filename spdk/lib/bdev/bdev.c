@@ -4812,6 +4812,12 @@ spdk_bdev_has_write_cache(const struct spdk_bdev *bdev)
 	return bdev->write_cache;
 }
 
+bool
+spdk_bdev_reads_whole_units(const struct spdk_bdev *bdev)
+{
+	return bdev->read_whole_units && bdev->optimal_io_boundary != 0;
+}
+
 const struct spdk_uuid *
 spdk_bdev_get_uuid(const struct spdk_bdev *bdev)
 {
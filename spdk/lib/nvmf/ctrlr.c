@@ -17,6 +17,7 @@
 #include "spdk/thread.h"
 #include "spdk/nvme_spec.h"
 #include "spdk/nvmf_cmd.h"
+#include "spdk/nvmf_ndp.h"
 #include "spdk/string.h"
 #include "spdk/util.h"
 #include "spdk/version.h"
@@ -2525,24 +2526,6 @@ static const struct spdk_nvme_cmds_and_effect_log_page g_cmds_and_effect_log_pag
 		[SPDK_NVME_OPC_ZONE_APPEND]		= {1, 1, 0, 0, 0, 0, 0, 0},
 		/* COPY */
 		[SPDK_NVME_OPC_COPY]			= {1, 1, 0, 0, 0, 0, 0, 0},
-		/* CUSTOM ECHO */
-    	[SPDK_NVME_OPC_CUSTOM_ECHO]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		/* CUSTOM GREP */
-		[SPDK_NVME_OPC_CUSTOM_GREP]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		#ifdef HEAAN_LIB
-		/* HEAAN ADD */
-		[SPDK_NVME_OPC_CUSTOM_HEAAN_ADD]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		/* HEAAN SUB */
-		[SPDK_NVME_OPC_CUSTOM_HEAAN_SUB]     = {1, 1, 0, 0, 0, 0, 0, 0}, 
-		/* HEAAN MUL */
-		[SPDK_NVME_OPC_CUSTOM_HEAAN_MUL]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		/* HEAAN DIV */
-		[SPDK_NVME_OPC_CUSTOM_HEAAN_DIV]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		/* HEAAN DEC */
-		[SPDK_NVME_OPC_CUSTOM_HEAAN_DEC]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		/* HEAAN BTSRP */
-		[SPDK_NVME_OPC_CUSTOM_HEAAN_BTSRP]     = {1, 1, 0, 0, 0, 0, 0, 0},
-		#endif
 	},
 };
 
@@ -2575,6 +2558,7 @@ nvmf_get_cmds_and_effects_log_page(struct spdk_nvmf_ctrlr *ctrlr, struct iovec *
 	if (!ctrlr->cdata.oncs.copy) {
 		cmds_and_effect_log_page.io_cmds_supported[SPDK_NVME_OPC_COPY] = zero;
 	}
+	nvmf_ndp_fill_cmds_and_effects(&cmds_and_effect_log_page);
 
 	spdk_iov_xfer_init(&ix, iovs, iovcnt);
 	if (offset < page_size) {
@@ -3461,6 +3445,15 @@ nvmf_ctrlr_abort_request(struct spdk_nvmf_request *req)
 		return g_nvmf_custom_admin_cmd_hdlrs[SPDK_NVME_OPC_ABORT].hdlr(req);
 	}
 
+	/*
+	 * NDP commands stop at their next chunk and complete as aborted by
+	 * request, unless they are past their last one and succeed.  Bit 0 of
+	 * CDW0 is left set, as for other aborts that complete asynchronously.
+	 */
+	if (nvmf_ndp_abort_request(req_to_abort)) {
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
 	rc = spdk_nvmf_request_get_bdev(req_to_abort->cmd->nvme_cmd.nsid, req_to_abort,
 					&bdev, &desc, &ch);
 	if (rc != 0) {
@@ -4375,6 +4368,7 @@ nvmf_ctrlr_process_io_cmd(struct spdk_nvmf_request *req)
 	struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
 	struct spdk_nvmf_subsystem_pg_ns_info *ns_info;
 	enum spdk_nvme_ana_state ana_state;
+	const struct spdk_nvmf_ndp_op *ndp_op;
 
 	/* pre-set response details for this command */
 	response->status.sc = SPDK_NVME_SC_SUCCESS;
@@ -4425,6 +4419,9 @@ nvmf_ctrlr_process_io_cmd(struct spdk_nvmf_request *req)
 	desc = ns->desc;
 	ch = ns_info->channel;
 
+	/* Cached NDP results of the blocks this command modifies are outdated */
+	nvmf_ndp_cache_invalidate_io(req);
+
 	if (spdk_unlikely(cmd->fuse & SPDK_NVME_CMD_FUSE_MASK)) {
 		return nvmf_ctrlr_process_io_fused_cmd(req, bdev, desc, ch);
 	} else if (spdk_unlikely(qpair->first_fused_req != NULL)) {
@@ -4452,16 +4449,6 @@ nvmf_ctrlr_process_io_cmd(struct spdk_nvmf_request *req)
 			return nvmf_bdev_ctrlr_write_cmd(bdev, desc, ch, req);
 		case SPDK_NVME_OPC_FLUSH:
 			return nvmf_bdev_ctrlr_flush_cmd(bdev, desc, ch, req);
-	    // CUSTOM COMMAND
-		case SPDK_NVME_OPC_CUSTOM_ECHO:
-            return nvmf_bdev_ctrlr_custom_echo_cmd(bdev, desc, ch, req);
-        case SPDK_NVME_OPC_CUSTOM_GREP:
-            return nvmf_bdev_ctrlr_custom_grep_cmd(bdev, desc, ch, req);
-		#ifdef HEAAN_LIB
-		case SPDK_NVME_OPC_CUSTOM_HEAAN_ADD:
-			return nvmf_bdev_ctrlr_custom_heaan_cipadd_cmd(bdev, desc, ch, req);
-		#endif
-        // END OF CUSTOM COMMAND
 		case SPDK_NVME_OPC_COMPARE:
 			if (spdk_unlikely(!ctrlr->cdata.oncs.compare)) {
 				goto invalid_opcode;
@@ -4492,6 +4479,10 @@ nvmf_ctrlr_process_io_cmd(struct spdk_nvmf_request *req)
 			}
 			return nvmf_bdev_ctrlr_copy_cmd(bdev, desc, ch, req);
 		default:
+			ndp_op = spdk_nvmf_ndp_get_op(cmd->opc);
+			if (ndp_op != NULL) {
+				return nvmf_ndp_exec(ndp_op, bdev, desc, ch, req);
+			}
 			if (spdk_unlikely(qpair->transport->opts.disable_command_passthru)) {
 				goto invalid_opcode;
 			}
@@ -4559,6 +4550,8 @@ _nvmf_request_complete(void *ctx)
 		is_aer = req->cmd->nvme_cmd.opc == SPDK_NVME_OPC_ASYNC_EVENT_REQUEST;
 		if (spdk_likely(qpair->qid != 0)) {
 			qpair->group->stat.completed_nvme_io++;
+			/* Also drop the NDP results computed while the command was outstanding */
+			nvmf_ndp_cache_invalidate_io(req);
 		}
 
 		/*
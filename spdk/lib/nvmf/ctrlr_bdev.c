@@ -7,6 +7,7 @@
 #include "spdk/stdinc.h"
 
 #include "nvmf_internal.h"
+#include "ndp_internal.h"
 
 #include "spdk/bdev.h"
 #include "spdk/endian.h"
@@ -14,6 +15,7 @@
 #include "spdk/likely.h"
 #include "spdk/nvme.h"
 #include "spdk/nvmf_cmd.h"
+#include "spdk/nvmf_ndp.h"
 #include "spdk/nvmf_spec.h"
 #include "spdk/trace.h"
 #include "spdk/scsi_spec.h"
@@ -22,43 +24,6 @@
 
 #include "spdk/log.h"
 
-#ifdef HEAAN_LIB
-#include "heaan/HEaaN_CWrapper.h"
-#endif
-
-struct custom_grep_ctx {
-    struct spdk_nvmf_request *req;
-    char *buffer;
-    size_t buffer_len;
-};
-
-
-static void nvmf_print_iov(const struct spdk_nvmf_request *req, uint32_t data_len)
-{
-    if (req->iovcnt == 0) {
-        return;
-    }
-
-    // Print first iovec info
-    fprintf(stdout, "First iovec base: %p, len: %zu\n", req->iov[0].iov_base, req->iov[0].iov_len);
-
-    // Print data content
-    fprintf(stdout, "Data content: ");
-    uint32_t total_copied = 0;
-
-    for (int i = 0; i < req->iovcnt && total_copied < data_len; i++) {
-        char *data = (char *)req->iov[i].iov_base;
-        uint32_t iov_len = req->iov[i].iov_len;
-        uint32_t copy_len = spdk_min(data_len - total_copied, iov_len);
-
-        for (uint32_t j = 0; j < copy_len; j++) {
-            fprintf(stdout, "%c", data[j]);
-        }
-        total_copied += copy_len;
-    }
-    fprintf(stdout, "\n");
-}
-
 static bool
 nvmf_subsystem_bdev_io_type_supported(struct spdk_nvmf_subsystem *subsystem,
 				      enum spdk_bdev_io_type io_type)
@@ -103,113 +68,6 @@ nvmf_ctrlr_copy_supported(struct spdk_nvmf_ctrlr *ctrlr)
 	return nvmf_subsystem_bdev_io_type_supported(ctrlr->subsys, SPDK_BDEV_IO_TYPE_COPY);
 }
 
-static void
-nvmf_bdev_ctrlr_complete_cmd_custom(struct spdk_bdev_io *bdev_io, bool success,
-                             void *cb_arg)
-{
-    struct custom_grep_ctx {
-        char *keyword;
-        uint32_t keyword_len;
-        struct spdk_nvmf_request *req;
-    };
-
-    struct custom_grep_ctx *ctx = cb_arg;
-    struct spdk_nvmf_request    *req = ctx->req;
-    struct spdk_nvme_cpl        *response = &req->rsp->nvme_cpl;
-
-    int    sc = 0, sct = 0;
-    uint32_t cdw0 = 0;
-
-    struct iovec *iovs;
-    int iovcnt = 0;
-    spdk_bdev_io_get_iovec(bdev_io, &iovs, &iovcnt);
-
-    if (iovcnt > 0) {
-        // 결과 저장을 위한 버퍼
-        char *result_buffer = NULL;
-        size_t result_size = 0;
-        size_t result_capacity = 4096;  // 초기 버퍼 크기
-        result_buffer = malloc(result_capacity);
-
-        if (!result_buffer) {
-            sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-            goto complete;
-        }
-
-        // 키워드의 개행문자 제거
-        size_t keyword_len = strlen(ctx->keyword);
-        if (keyword_len > 0 && ctx->keyword[keyword_len - 1] == '\n') {
-            ctx->keyword[keyword_len - 1] = '\0';
-            keyword_len--;
-        }
-
-        for (int i = 0; i < iovcnt; i++) {
-            char *data = iovs[i].iov_base;
-            size_t len = iovs[i].iov_len;
-            size_t start = 0;
-
-            // 각 라인 처리
-            for (size_t j = 0; j < len; j++) {
-                if (data[j] == '\n' || j == len - 1) {
-                    size_t line_len = j - start + 1;
-                    char line[line_len + 1];
-                    memcpy(line, &data[start], line_len);
-                    line[line_len] = '\0';
-
-                    // 키워드 검색
-                    if (strstr(line, ctx->keyword)) {
-                        size_t needed_size = result_size + line_len + 1;
-                        if (needed_size > result_capacity) {
-                            result_capacity *= 2;
-                            char *new_buffer = realloc(result_buffer, result_capacity);
-                            if (!new_buffer) {
-                                free(result_buffer);
-                                sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-                                goto complete;
-                            }
-                            result_buffer = new_buffer;
-                        }
-                        memcpy(result_buffer + result_size, line, line_len);
-                        result_buffer[result_size + line_len] = '\n';
-                        result_size += line_len + 1;
-                    }
-                    start = j + 1;
-                }
-            }
-        }
-
-        if (result_size > 0) {
-            // 결과가 있는 경우
-            result_buffer[result_size - 1] = '\0';  // 마지막 개행문자 제거
-            spdk_iov_memset(req->iov, req->iovcnt, 0);  // iov 초기화
-            spdk_copy_buf_to_iovs(req->iov, req->iovcnt, result_buffer, result_size);
-
-            req->xfer = SPDK_NVME_DATA_CONTROLLER_TO_HOST;
-            req->length = 4096;
-            sc = SPDK_NVME_SC_SUCCESS;
-        } else {
-            // 결과가 없는 경우
-            sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-            req->length = 0;
-        }
-
-        free(result_buffer);
-
-        } else {
-            sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        }
-
-complete:
-    response->cdw0 = cdw0;
-    response->status.sc = sc;
-    response->status.sct = sct;
-
-    free(ctx);
-
-    spdk_nvmf_request_complete(req);
-    spdk_bdev_free_io(bdev_io);
-}
-
 static void
 nvmf_bdev_ctrlr_complete_cmd(struct spdk_bdev_io *bdev_io, bool success,
 			     void *cb_arg)
@@ -620,427 +478,6 @@ nvmf_bdev_ctrlr_write_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
 	return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
 }
 
-
-int
-nvmf_bdev_ctrlr_custom_grep_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
-                                struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
-{
-    struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-
-    uint32_t data_len = cmd->cdw10 & 0xFFFF;  // 하위 16비트를 데이터 길이로 사용
-    uint64_t start_lba = cmd->cdw11;
-    uint64_t num_blocks = cmd->cdw12;
-
-//    fprintf(stdout, "Custom grep command entered\n");
-//    fprintf(stdout, "Opcode: 0x%x\n", cmd->opc);
-//    fprintf(stdout, "Data length from CDW10: %u\n", data_len);
-//    fprintf(stdout, "Start LBA from CDW11: %lu\n", start_lba);
-//    fprintf(stdout, "Block Count from CDW12: %lu\n", num_blocks);
-//    fprintf(stdout, "req->length: %u\n", req->length);
-//    fprintf(stdout, "req->iovcnt: %u\n", req->iovcnt);
-
-//	for (int i = 0; i < req->iovcnt; i++) {
-//        printf("nvmf_bdev_ctrlr_custom_grep_cmd sgl: req->iov[%d].iov_len: %zu\n", i, req->iov[i].iov_len);
-//    }
-//    fprintf(stdout, "req->xfer: %u\n", req->xfer);
-
-//     iov 내에있는 데이터 확인용 코드
-//    uint32_t tc = 0;
-//
-//    if (req->iovcnt > 0) {
-//        fprintf(stdout, "First iovec base: %p, len: %zu\n", req->iov[0].iov_base, req->iov[0].iov_len);
-//
-//        // 데이터 출력
-//        uint32_t tc = 0;
-//        fprintf(stdout, "Data content: ");
-//        for (int i = 0; i < req->iovcnt && tc < data_len; i++) {
-//            char *data = (char *)req->iov[i].iov_base;
-//            uint32_t iov_len = req->iov[i].iov_len;
-//            uint32_t copy_len = spdk_min(data_len - tc, iov_len);
-//
-//            for (uint32_t j = 0; j < copy_len; j++) {
-//                fprintf(stdout, "%c", data[j]);
-//            }
-//
-//            tc += copy_len;
-//        }
-//        fprintf(stdout, "\n");
-//    }
-
-    // 내부에 데이터가 없을때를 대비
-    if (data_len > req->length || req->iovcnt == 0) {
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INVALID_FIELD;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    // 새로운 버퍼 할당
-    char *new_buffer = NULL;
-    uint32_t total_len = 0;
-
-    // req->iov의 총 길이 계산
-    for (int i = 0; i < req->iovcnt; i++) {
-        total_len += req->iov[i].iov_len;
-    }
-
-    // 새 버퍼 할당
-    new_buffer = malloc(total_len);
-    if (new_buffer == NULL) {
-        fprintf(stderr, "Failed to allocate memory for new buffer\n");
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    // req->iov의 데이터를 새 버퍼로 복사
-    uint32_t offset = 0;
-    for (int i = 0; i < req->iovcnt; i++) {
-        memcpy(new_buffer + offset, req->iov[i].iov_base, req->iov[i].iov_len);
-        offset += req->iov[i].iov_len;
-    }
-
-    // 복사된 데이터 출력 (디버깅용)
-//    fprintf(stdout, "Copied data content: ");
-//    for (uint32_t i = 0; i < total_len; i++) {
-//        fprintf(stdout, "%c", new_buffer[i]);
-//    }
-//    fprintf(stdout, "\n");
-
-    // req->iov 초기화
-    for (int i = 0; i < req->iovcnt; i++) {
-        if (req->iov[i].iov_base) {
-            memset(req->iov[i].iov_base, 0, req->iov[i].iov_len);
-        }
-    }
-
-    struct spdk_bdev_ext_io_opts opts = {
-        .size = SPDK_SIZEOF(&opts, accel_sequence),
-        .memory_domain = req->memory_domain,
-        .memory_domain_ctx = req->memory_domain_ctx,
-        .accel_sequence = req->accel_sequence,
-    };
-    uint64_t bdev_num_blocks = spdk_bdev_get_num_blocks(bdev);
-    uint32_t block_size = spdk_bdev_get_block_size(bdev);
-    struct spdk_nvme_cpl *rsp = &req->rsp->nvme_cpl;
-
-    // 유효성 검사
-    if (spdk_unlikely(!nvmf_bdev_ctrlr_lba_in_range(bdev_num_blocks, start_lba, num_blocks))) {
-        SPDK_ERRLOG("end of media\n");
-        rsp->status.sct = SPDK_NVME_SCT_GENERIC;
-        rsp->status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    struct custom_grep_ctx {
-        char *buffer;
-        uint32_t buffer_len;
-        struct spdk_nvmf_request *req;
-    };
-
-    struct custom_grep_ctx *ctx = malloc(sizeof(struct custom_grep_ctx));
-    if (ctx == NULL) {
-        free(new_buffer);
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    ctx->buffer = new_buffer;
-    ctx->buffer_len = total_len;
-    ctx->req = req;
-
-    int rc;
-    rc = spdk_bdev_readv_blocks_ext(desc, ch, req->iov, req->iovcnt, start_lba, num_blocks,
-    					nvmf_bdev_ctrlr_complete_cmd_custom, ctx, &opts);
-//    fprintf(stdout, "rc: %d\n", rc);
-
-//    req->length = 4096;
-//    free(ctx->buffer);
-//    free(ctx);
-
-    if (spdk_unlikely(rc)) {
-        if (rc == -ENOMEM) {
-            nvmf_bdev_ctrl_queue_io(req, bdev, ch, nvmf_ctrlr_process_io_cmd_resubmit, req);
-            return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
-        }
-        rsp->status.sct = SPDK_NVME_SCT_GENERIC;
-        rsp->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
-}
-
-struct custom_ctx {
-    char *first_result;
-    uint32_t first_result_len;
-    struct spdk_nvmf_request *req;
-    struct spdk_bdev_desc *desc;
-    struct spdk_io_channel *ch;
-};
-
-// 일반 데이터 출력 함수 추가
-static void print_data_content(const char *data, uint32_t length) {
-    fprintf(stdout, "Operation Meta Data content: ");
-    for (uint32_t i = 0; i < length; i++) {
-        fprintf(stdout, "%c", data[i]);
-    }
-    fprintf(stdout, "\n");
-}
-
-// 연산 결과를 위한 구조체
-struct ndp_result {
-    char *data;
-    uint32_t length;
-};
-
-static struct ndp_result*
-ndp_calculate(const char *ndp_meta_data, uint32_t ndp_meta_data_len,
-              const char *ndp_target_data, uint32_t ndp_target_data_len)
-{
-    struct ndp_result *result;
-
-    // 결과 구조체 할당
-    result = spdk_malloc(sizeof(struct ndp_result),
-                        0x1000, NULL,
-                        SPDK_ENV_SOCKET_ID_ANY,
-                        SPDK_MALLOC_DMA);
-    if (!result) {
-        return NULL;
-    }
-
-    // 전체 결과를 담을 버퍼 할당
-    uint32_t total_length = ndp_meta_data_len + ndp_target_data_len;
-    result->data = spdk_malloc(total_length,
-                              0x1000, NULL,
-                              SPDK_ENV_SOCKET_ID_ANY,
-                              SPDK_MALLOC_DMA);
-    if (!result->data) {
-        spdk_free(result);
-        return NULL;
-    }
-
-    // 두 결과를 연결
-    memcpy(result->data, ndp_meta_data, ndp_meta_data_len);
-    memcpy(result->data + ndp_meta_data_len, ndp_target_data, ndp_target_data_len);
-    result->length = total_length;
-
-    return result;
-}
-
-static void
-nvmf_bdev_ctrlr_second_read_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
-{
-    struct custom_ctx *ctx = cb_arg;
-    struct spdk_nvmf_request *req = ctx->req;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-
-    if (success) {
-        // 두 번째 read 결과를 임시 버퍼에 복사
-        char *second_result = spdk_malloc(req->length,
-                                        0x1000, NULL,
-                                        SPDK_ENV_SOCKET_ID_ANY,
-                                        SPDK_MALLOC_DMA);
-        if (!second_result) {
-            response->status.sct = SPDK_NVME_SCT_GENERIC;
-            response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-            goto error;
-        }
-
-        // 두 번째 read 결과 복사
-        uint32_t total_copied = 0;
-        for (int i = 0; i < req->iovcnt && total_copied < req->length; i++) {
-            uint32_t to_copy = spdk_min(req->length - total_copied, req->iov[i].iov_len);
-            memcpy(second_result + total_copied, req->iov[i].iov_base, to_copy);
-            total_copied += to_copy;
-        }
-
-        // 연산 수행
-        struct ndp_result *calc_result = ndp_calculate(ctx->first_result,
-                                                     ctx->first_result_len,
-                                                     second_result,
-                                                     total_copied);
-
-        if (!calc_result) {
-            spdk_free(second_result);
-            response->status.sct = SPDK_NVME_SCT_GENERIC;
-            response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-            goto error;
-        }
-
-        // 결과 출력
-        fprintf(stdout, "Combined result (length: %u):\n", calc_result->length);
-        print_data_content(calc_result->data, calc_result->length);
-
-        spdk_iov_memset(req->iov, req->iovcnt, 0);
-
-        // 결과를 req->iov에 복사하여 반환
-        if (req->iovcnt > 0) {
-            memcpy(req->iov[0].iov_base, calc_result->data,
-                   spdk_min(calc_result->length, req->iov[0].iov_len));
-        }
-
-        // 임시 버퍼들 해제
-        spdk_free(second_result);
-        spdk_free(calc_result->data);
-        spdk_free(calc_result);
-
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_SUCCESS;
-    } else {
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-    }
-
-error:
-    spdk_free(ctx->first_result);
-    spdk_free(ctx);
-    spdk_bdev_free_io(bdev_io);
-    spdk_nvmf_request_complete(req);
-}
-
-// 첫 번째 read의 콜백 함수 - 두 번째 read 실행
-static void
-nvmf_bdev_ctrlr_first_read_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
-{
-    struct custom_ctx *ctx = cb_arg;
-    struct spdk_nvmf_request *req = ctx->req;
-    struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-
-    uint32_t target_start_lba = cmd->cdw12;
-    uint32_t target_block_count = cmd->cdw13;
-    int rc;
-
-    if (!success) {
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        spdk_free(ctx->first_result);
-        spdk_free(ctx);
-        spdk_bdev_free_io(bdev_io);
-        spdk_nvmf_request_complete(req);
-        return;
-    }
-
-    // 첫 번째 read 결과 복사
-    ctx->first_result_len = req->length;
-    ctx->first_result = spdk_zmalloc(req->length,
-                                    0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY,
-                                    SPDK_MALLOC_DMA);
-    if (!ctx->first_result) {
-        fprintf(stdout, "!ctx->first_result?\n");
-        spdk_free(ctx);
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        spdk_bdev_free_io(bdev_io);
-        spdk_nvmf_request_complete(req);
-        return;
-    }
-
-    // iov에서 데이터 복사
-    uint32_t total_copied = 0;
-    for (int i = 0; i < req->iovcnt && total_copied < req->length; i++) {
-        uint32_t to_copy = spdk_min(req->length - total_copied, req->iov[i].iov_len);
-        memcpy(ctx->first_result + total_copied, req->iov[i].iov_base, to_copy);
-        total_copied += to_copy;
-    }
-
-    // 두 번째 read 실행
-    struct spdk_bdev_ext_io_opts opts = {
-        .size = SPDK_SIZEOF(&opts, accel_sequence),
-        .memory_domain = req->memory_domain,
-        .memory_domain_ctx = req->memory_domain_ctx,
-        .accel_sequence = req->accel_sequence,
-    };
-
-    rc = spdk_bdev_readv_blocks_ext(ctx->desc, ctx->ch, req->iov, req->iovcnt,
-                                   target_start_lba, target_block_count,
-                                   nvmf_bdev_ctrlr_second_read_complete, ctx, &opts);
-    fprintf(stdout, "rc complete\n");
-    if (rc) {
-        fprintf(stdout, "First Here?\n");
-        spdk_free(ctx->first_result);
-        spdk_free(ctx);
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        spdk_bdev_free_io(bdev_io);
-//        spdk_nvmf_request_complete(req);
-        return;
-    }
-
-    spdk_bdev_free_io(bdev_io);
-}
-
-int
-nvmf_bdev_ctrlr_custom_echo_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
-                                struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
-{
-    struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-
-    /* 연산 메타데이터 파일의 주소 범위, 연산 대상파일의 주소 범위를 받아 연산하는 드라이버 기능*/
-
-    uint32_t meta_start_lba = cmd->cdw10; // 연산 메타데이터 파일의 LBA 시작 주소
-    uint32_t meta_block_count = cmd->cdw11; // 연산 메타데이터 파일의 블록 갯수
-
-    uint32_t target_start_lba = cmd->cdw12; // 연산 대상 파일의 LBA 시작 주소
-    uint32_t target_block_count = cmd->cdw13; // 연산 대상 파일의 블록 갯수
-
-    fprintf(stdout, "Custom read callback command entered\n");
-    fprintf(stdout, "Opcode: 0x%x\n", cmd->opc);
-    fprintf(stdout, "req->length: %u\n", req->length);
-    fprintf(stdout, "req->iovcnt: %u\n", req->iovcnt);
-    fprintf(stdout, "req->xfer: %u\n", req->xfer);
-
-    fprintf(stdout, "meta_start_lba from CDW10: %u\n", meta_start_lba);
-    fprintf(stdout, "meta_block_count from CDW11: %u\n", meta_block_count);
-    fprintf(stdout, "target_start_lba from CDW12: %u\n", target_start_lba);
-    fprintf(stdout, "target_block_count from CDW13: %u\n", target_block_count);
-
-    // read 두번을 실행하는 초입부...
-    // 첫 번째 read 실행
-    // ctx 생성 및 초기화
-    int rc;
-    struct custom_ctx *ctx = spdk_zmalloc(sizeof(struct custom_ctx),
-                                         0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY,
-                                         SPDK_MALLOC_DMA);
-    if (!ctx) {
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    ctx->req = req;
-    ctx->desc = desc;
-    ctx->ch = ch;
-    ctx->first_result = NULL;
-    ctx->first_result_len = 0;
-
-    // 첫 번째 read 실행
-    struct spdk_bdev_ext_io_opts opts = {
-        .size = SPDK_SIZEOF(&opts, accel_sequence),
-        .memory_domain = req->memory_domain,
-        .memory_domain_ctx = req->memory_domain_ctx,
-        .accel_sequence = req->accel_sequence,
-    };
-
-    rc = spdk_bdev_readv_blocks_ext(desc, ch, req->iov, req->iovcnt,
-                                   meta_start_lba, meta_block_count,
-                                   nvmf_bdev_ctrlr_first_read_complete, ctx, &opts);
-
-    if (rc) {
-        spdk_free(ctx);
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-
-    response->status.sct = SPDK_NVME_SCT_GENERIC;
-    response->status.sc = SPDK_NVME_SC_SUCCESS;
-    return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
-}
-
 void dump_hex(const char *label, const void *data, size_t len)
 {
     const unsigned char *p = (const unsigned char *)data;
@@ -1065,314 +502,6 @@ void dump_hex(const char *label, const void *data, size_t len)
     }
 }
 
-#ifdef HEAAN_LIB
-typedef struct _heaan_ctx {
-    void *input_0_buffer;
-    void *input_1_buffer;
-    void *target_buffer;
-	int pending_fills;
-	size_t input_0_total_size;
-	size_t input_1_total_size;
-	uint64_t input_0_start_offset;
-	uint64_t input_1_start_offset;
-
-	uint32_t target_extents_count;	
-	uint64_t* target_ext;
-    struct spdk_nvmf_request *req;
-    struct spdk_bdev_desc *desc;
-    struct spdk_io_channel *ch;
-} heaan_ctx;
-
-static void
-nvmf_heaan_cip_write_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg) {
-	heaan_ctx* ctx = (heaan_ctx*)cb_arg;
-    struct spdk_nvmf_request *req = ctx->req;
-	struct spdk_bdev_desc* desc = ctx->desc;
-	struct spdk_io_channel* ch = ctx->ch;
-    struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-	if(!success) {
-		ctx->req->rsp->nvme_cpl.status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        ctx->pending_fills = -1; // Stop processing
-    }
-	else {
-		ctx->pending_fills--;
-	}
-
-	if(ctx->pending_fills <= 0) {
-		if(ctx->pending_fills < 0) {
-			fprintf(stderr, "HEaaN: One or more file writes failed.\n");
-			response->status.sct = SPDK_NVME_SCT_GENERIC;
-			response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-    		spdk_bdev_free_io(bdev_io);
-    		spdk_nvmf_request_complete(req);
-			spdk_dma_free(ctx->target_buffer);
-    		spdk_free(ctx);
-		}
-		else {
-			//dump_hex("TARGET - Loaded Buffer Content", ctx->target_buffer, 64);
-    		response->status.sct = SPDK_NVME_SCT_GENERIC;
-    		response->status.sc = SPDK_NVME_SC_SUCCESS;
-			spdk_dma_free(ctx->target_buffer);
-			spdk_free(ctx);
-			spdk_bdev_free_io(bdev_io);
-			spdk_nvmf_request_complete(req);
-		}
-	return ;
-	}
-}
-
-static void
-nvmf_heaan_buffer_fill_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
-{
-	heaan_ctx* ctx = (heaan_ctx*)cb_arg;
-    struct spdk_nvmf_request *req = ctx->req;
-	struct spdk_bdev_desc* desc = ctx->desc;
-	struct spdk_io_channel* ch = ctx->ch;
-    struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-	if(!success) {
-		ctx->req->rsp->nvme_cpl.status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        ctx->pending_fills = -1; // Stop processing
-    }
-	else {
-		ctx->pending_fills--;
-		fprintf(stdout, "HEaaN BFR - changing load status: %d\n", ctx->pending_fills);
-	}
-
-	if(ctx->pending_fills <= 0) {
-		if(ctx->pending_fills < 0) {
-			fprintf(stderr, "HEaaN: One or more extent reads failed.\n");
-    		spdk_bdev_free_io(bdev_io);
-    		spdk_nvmf_request_complete(req);
-			spdk_dma_free(ctx->input_0_buffer);
-			spdk_dma_free(ctx->input_1_buffer);
-			spdk_dma_free(ctx->target_buffer);
-    		spdk_free(ctx);
-			response->status.sct = SPDK_NVME_SCT_GENERIC;
-			response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-		}
-		else {
-			//dump_hex("INPUT0 - Loaded Buffer Content", ctx->input_0_buffer, 64);
-			//dump_hex("INPUT1 - Loaded Buffer Content", ctx->input_1_buffer, 64);
-
-			heaan_ndp_context* hestr = heaan_Get_Context();
-			void* input_0_ciphertext = readCiphertextFromMem(ctx->input_0_buffer, ctx->input_0_total_size, ctx->input_0_start_offset);
-			void* input_1_ciphertext = readCiphertextFromMem(ctx->input_1_buffer, ctx->input_1_total_size, ctx->input_1_start_offset);
-			void* target_ciphertext = create_Ciphertext();
-
-			if(ciphertextAdd(hestr->scheme, target_ciphertext, input_0_ciphertext, input_1_ciphertext) != 0) {
-				SPDK_ERRLOG("Ciphertext Add Error\n");
-				response->status.sct = SPDK_NVME_SCT_GENERIC;
-				response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-				spdk_dma_free(ctx->input_0_buffer);
-				spdk_dma_free(ctx->input_1_buffer);
-				spdk_dma_free(ctx->target_buffer);
-				free_Ciphertext(input_0_ciphertext);
-				free_Ciphertext(input_1_ciphertext);
-				free_Ciphertext(target_ciphertext);
-				spdk_free(ctx);
-				spdk_bdev_free_io(bdev_io);
-				spdk_nvmf_request_complete(req);
-				return ;
-			}
-			/* for DEBUGGING
-			fprintf(stdout, "Cip0 - n: %d\n", getCiphertextN(input_0_ciphertext));
-			fprintf(stdout, "Cip0 - logp: %d\n", getCiphertextLogp(input_0_ciphertext));
-			fprintf(stdout, "Cip0 - logq: %d\n", getCiphertextLogq(input_0_ciphertext));
-			
-			fprintf(stdout, "Cip1 - n: %d\n", getCiphertextN(input_1_ciphertext));
-			fprintf(stdout, "Cip1 - logp: %d\n", getCiphertextLogp(input_1_ciphertext));
-			fprintf(stdout, "Cip1 - logq: %d\n", getCiphertextLogq(input_1_ciphertext));
-
-			fprintf(stdout, "CipAdd - n: %d\n", getCiphertextN(target_ciphertext));
-			fprintf(stdout, "CipAdd - logp: %d\n", getCiphertextLogp(target_ciphertext));
-			fprintf(stdout, "CipAdd - logq: %d\n", getCiphertextLogq(target_ciphertext));
-			*/
-			writeCiphertextToMem(target_ciphertext, ctx->target_buffer, 0);
-			
-			fprintf(stdout, "Freeing Ciphertexts.\n");
-			free_Ciphertext(input_0_ciphertext);
-			free_Ciphertext(input_1_ciphertext);
-			free_Ciphertext(target_ciphertext);
-			
-			spdk_dma_free(ctx->input_0_buffer);
-			spdk_dma_free(ctx->input_1_buffer);
-
-			ctx->pending_fills = (int)(ctx->target_extents_count);
-			int load_result;
-			void* buffer_address = ctx->target_buffer;
-			for(int iter = 0; iter < ctx->target_extents_count; iter++) {
-				load_result = spdk_bdev_write(desc, ch, buffer_address, 
-										ctx->target_ext[2 * iter] , ctx->target_ext[2 * iter + 1], 
-										nvmf_heaan_cip_write_complete, ctx);
-				buffer_address += ctx->target_ext[2 * iter + 1];
-			}
-			return ;
-		}
-	}
-}
-
-int
-nvmf_bdev_ctrlr_custom_heaan_cipadd_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
-                                struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
-{
-    struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
-    struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
-	
-	uint64_t bdev_num_blocks = spdk_bdev_get_num_blocks(bdev);
-	uint32_t block_size = spdk_bdev_get_block_size(bdev);
-	
-	void* buffer_address = NULL;
-
-	uint32_t input_0_extents_count = cmd->cdw11;
-	uint32_t input_1_extents_count = cmd->cdw12;
-	uint32_t target_extents_count = cmd->cdw13;
-    heaan_ctx *ctx = spdk_zmalloc(sizeof(heaan_ctx),
-                                0x1000, NULL, SPDK_ENV_SOCKET_ID_ANY,
-                                SPDK_MALLOC_DMA);
-
-	ctx->pending_fills = input_0_extents_count
-						+ input_1_extents_count;
-    ctx->target_extents_count = target_extents_count;
-	ctx->target_ext = malloc(sizeof(uint64_t) * target_extents_count * 2);
-	ctx->req = req;
-    ctx->desc = desc;
-    ctx->ch = ch;
-
-	
-	uint32_t total_data_len = req->iov->iov_len * NVMF_REQ_MAX_BUFFERS;
-    uint32_t num_iovs = req->iovcnt;
-
-    // Data buffer validity check
-    if (total_data_len == 0 || num_iovs == 0 || req->iov[0].iov_base == NULL) {
-        SPDK_ERRLOG("Custom command 0xE0: No data buffer indicated or buffer is NULL. Cannot proceed.\n");
-		spdk_free(ctx);
-        response->status.sct = SPDK_NVME_SCT_GENERIC;
-        response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-        return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-    }
-	
-	void* data_buf_ptr = NULL;
-	data_buf_ptr = req->iov[0].iov_base;
-	//dump_hex("Received Buffer Content (Target)", data_buf_ptr, 256);
-
-	uint64_t* u64data = (uint64_t *)data_buf_ptr;
-	uint32_t bufnum = 0;
-
-	uint64_t input_0_start_offset = 0;
-	uint64_t input_0_ext[input_0_extents_count * 2];
-	uint64_t input_1_start_offset = 0;
-	uint64_t input_1_ext[input_1_extents_count * 2];
-	uint64_t target_start_offset = 0;
-	uint64_t target_ext[target_extents_count * 2];
-
-	uint64_t input_0_size = 0;
-	uint64_t input_1_size = 0;
-	uint64_t target_size = 0;
-	ctx->input_0_total_size = 0;
-	ctx->input_1_total_size = 0;
-	
-	uint32_t iter = 0;
-	input_0_start_offset = u64data[bufnum++];
-	for(iter = 0; iter < input_0_extents_count; iter++) {
-		if (spdk_unlikely(!nvmf_bdev_ctrlr_lba_in_range(bdev_num_blocks,
-														u64data[bufnum] / block_size, 
-														u64data[bufnum+1] / block_size))) {
-    		SPDK_ERRLOG("end of media\n");
-			spdk_free(ctx);
-    		response->status.sct = SPDK_NVME_SCT_GENERIC;
-    		response->status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
-    		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-		}
-		input_0_ext[2*iter] = u64data[bufnum++];
-		input_0_ext[2*iter + 1] = u64data[bufnum];
-		input_0_size += u64data[bufnum++];
-	}
-	
-	input_1_start_offset = u64data[bufnum++];
-	for(iter = 0; iter < input_1_extents_count; iter++) {
-		if (spdk_unlikely(!nvmf_bdev_ctrlr_lba_in_range(bdev_num_blocks,
-														u64data[bufnum] / block_size, 
-														u64data[bufnum+1] / block_size))) {
-    		SPDK_ERRLOG("end of media\n");
-			spdk_free(ctx);
-    		response->status.sct = SPDK_NVME_SCT_GENERIC;
-    		response->status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
-    		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-		}
-		input_1_ext[2*iter] = u64data[bufnum++];
-		input_1_ext[2*iter + 1] = u64data[bufnum];
-		input_1_size += u64data[bufnum++]; 
-	}
-	
-	target_start_offset = u64data[bufnum++];
-	for(iter = 0; iter < target_extents_count; iter++) {
-		if (spdk_unlikely(!nvmf_bdev_ctrlr_lba_in_range(bdev_num_blocks, 
-														u64data[bufnum] / block_size, 
-														u64data[bufnum+1] / block_size))) {
-    		SPDK_ERRLOG("end of media\n");
-			spdk_free(ctx);
-    		response->status.sct = SPDK_NVME_SCT_GENERIC;
-    		response->status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
-    		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-		}
-		target_ext[2*iter] = u64data[bufnum++];
-		target_ext[2*iter + 1] = u64data[bufnum];
-		ctx->target_ext[2*iter] = target_ext[2*iter];
-		ctx->target_ext[2*iter + 1] = target_ext[2*iter + 1];
-		target_size += u64data[bufnum++]; 
-	}
-	ctx->input_0_total_size = input_0_size;
-	ctx->input_1_total_size = input_1_size;
-	
-	ctx->input_0_buffer = spdk_dma_zmalloc(ctx->input_0_total_size, 0, NULL);
-	ctx->input_1_buffer = spdk_dma_zmalloc(ctx->input_1_total_size, 0, NULL);
-	ctx->target_buffer = spdk_dma_zmalloc(target_size, 0, NULL);
-	
-
-	int load_result = 0;
-
-	buffer_address = ctx->input_0_buffer;
-	for(iter = 0; iter < input_0_extents_count; iter++) {
-		load_result = spdk_bdev_read(desc, ch, buffer_address, 
-									 input_0_ext[2 * iter] , input_0_ext[2 * iter + 1], 
-									 nvmf_heaan_buffer_fill_complete, ctx);
-		buffer_address += input_0_ext[2 * iter + 1];
-		if(load_result != 0) {
-			SPDK_ERRLOG("INPUT0 - Buffer Load Error No: %d\n", load_result);
-			spdk_dma_free(ctx->input_0_buffer);
-			spdk_dma_free(ctx->input_1_buffer);
-			spdk_dma_free(ctx->target_buffer);
-			spdk_free(ctx);
-			response->status.sct = SPDK_NVME_SCT_GENERIC;
-			response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-			return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-		}
-	}
-
-	buffer_address = ctx->input_1_buffer;
-	load_result = 0;
-	for(iter = 0; iter < input_1_extents_count; iter++) {
-		load_result = spdk_bdev_read(desc, ch, buffer_address, 
-									 input_1_ext[2 * iter], input_1_ext[2 * iter + 1], 
-									 nvmf_heaan_buffer_fill_complete, ctx);
-		buffer_address += input_1_ext[2 * iter + 1];
-		if(load_result != 0) {
-			SPDK_ERRLOG("INPUT1 - Buffer Load Error No: %d\n", load_result);
-			spdk_dma_free(ctx->input_0_buffer);
-			spdk_dma_free(ctx->input_1_buffer);
-			spdk_dma_free(ctx->target_buffer);
-			spdk_free(ctx);
-			response->status.sct = SPDK_NVME_SCT_GENERIC;
-			response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
-			return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
-		}
-	}
-
-    return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
-}
-#endif
 	
 
 int
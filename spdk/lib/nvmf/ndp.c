@@ -0,0 +1,238 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/env.h"
+#include "spdk/log.h"
+#include "spdk/nvmf_ndp.h"
+
+/* Indexed by opcode. Only written from constructors, before any poll group exists. */
+static struct spdk_nvmf_ndp_op *g_nvmf_ndp_ops[SPDK_NVME_MAX_OPC + 1];
+
+/* Timeouts in milliseconds, indexed by opcode.  Set over RPC, read by the poll groups. */
+static uint32_t g_nvmf_ndp_timeouts[SPDK_NVME_MAX_OPC + 1];
+
+static TAILQ_HEAD(, spdk_nvmf_ndp_op) g_nvmf_ndp_op_list =
+	TAILQ_HEAD_INITIALIZER(g_nvmf_ndp_op_list);
+
+int
+spdk_nvmf_ndp_register_op(struct spdk_nvmf_ndp_op *op)
+{
+	if (op == NULL || op->name == NULL || op->exec == NULL) {
+		SPDK_ERRLOG("Invalid NDP operator\n");
+		return -EINVAL;
+	}
+
+	if (op->opc < SPDK_NVMF_NDP_OPC_MIN) {
+		SPDK_ERRLOG("NDP operator %s uses opcode 0x%02x outside of the vendor specific range\n",
+			    op->name, op->opc);
+		return -EINVAL;
+	}
+
+	if (op->xfer == SPDK_NVME_DATA_BIDIRECTIONAL) {
+		SPDK_ERRLOG("NDP operator %s: bidirectional transfers are not supported over fabrics\n",
+			    op->name);
+		return -EINVAL;
+	}
+
+	if (g_nvmf_ndp_ops[op->opc] != NULL) {
+		SPDK_ERRLOG("Double registering NDP opcode 0x%02x (%s, already used by %s)\n",
+			    op->opc, op->name, g_nvmf_ndp_ops[op->opc]->name);
+		return -EEXIST;
+	}
+
+	g_nvmf_ndp_ops[op->opc] = op;
+	TAILQ_INSERT_TAIL(&g_nvmf_ndp_op_list, op, tailq);
+
+	return 0;
+}
+
+const struct spdk_nvmf_ndp_op *
+spdk_nvmf_ndp_get_op(uint8_t opc)
+{
+	return g_nvmf_ndp_ops[opc];
+}
+
+bool
+spdk_nvmf_ndp_get_xfer(uint8_t opc, enum spdk_nvme_data_transfer *xfer)
+{
+	const struct spdk_nvmf_ndp_op *op = g_nvmf_ndp_ops[opc];
+
+	if (op == NULL) {
+		return false;
+	}
+
+	*xfer = op->xfer;
+	return true;
+}
+
+int
+spdk_nvmf_ndp_set_timeout(uint8_t opc, uint32_t timeout_ms)
+{
+	if (g_nvmf_ndp_ops[opc] == NULL) {
+		return -ENOENT;
+	}
+
+	__atomic_store_n(&g_nvmf_ndp_timeouts[opc], timeout_ms, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+uint32_t
+spdk_nvmf_ndp_get_timeout(uint8_t opc)
+{
+	return __atomic_load_n(&g_nvmf_ndp_timeouts[opc], __ATOMIC_RELAXED);
+}
+
+void
+nvmf_ndp_fill_cmds_and_effects(struct spdk_nvme_cmds_and_effect_log_page *log_page)
+{
+	struct spdk_nvmf_ndp_op *op;
+
+	TAILQ_FOREACH(op, &g_nvmf_ndp_op_list, tailq) {
+		log_page->io_cmds_supported[op->opc].csupp = 1;
+		log_page->io_cmds_supported[op->opc].lbcc = !!(op->flags & SPDK_NVMF_NDP_OP_F_WRITES_MEDIA);
+	}
+}
+
+int
+nvmf_ndp_exec(const struct spdk_nvmf_ndp_op *op, struct spdk_bdev *bdev,
+	      struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+	      struct spdk_nvmf_request *req)
+{
+	SPDK_DEBUGLOG(nvmf, "NDP operator %s (opc 0x%02x)\n", op->name, op->opc);
+
+	return op->exec(bdev, desc, ch, req);
+}
+
+void
+nvmf_ndp_set_status(struct spdk_nvmf_request *req, int status)
+{
+	struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
+
+	response->status.sct = SPDK_NVME_SCT_GENERIC;
+	if (status == 0) {
+		response->status.sc = SPDK_NVME_SC_SUCCESS;
+	} else if (status == -ERANGE) {
+		response->status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
+	} else if (status == -EINVAL) {
+		response->status.sc = SPDK_NVME_SC_INVALID_FIELD;
+	} else if (status == -EAGAIN) {
+		/* Not DNR, the host retries once the operator can run */
+		response->status.sc = SPDK_NVME_SC_NAMESPACE_NOT_READY;
+	} else if (status == -ECANCELED) {
+		response->status.sc = SPDK_NVME_SC_ABORTED_BY_REQUEST;
+	} else if (status == -ETIMEDOUT) {
+		/* The command would run into its timeout again */
+		response->status.sc = SPDK_NVME_SC_ABORTED_BY_REQUEST;
+		response->status.dnr = 1;
+	} else if (status == -ENOTCONN) {
+		response->status.sc = SPDK_NVME_SC_ABORTED_SQ_DELETION;
+	} else {
+		response->status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
+	}
+}
+
+/*
+ * Jobs are tracked by the poll group of their subsystem, on the thread they
+ * run on, so that aborting a command or disconnecting a queue pair finds them.
+ */
+static struct spdk_nvmf_subsystem_poll_group *
+nvmf_ndp_qpair_sgroup(struct spdk_nvmf_qpair *qpair)
+{
+	if (qpair->group == NULL || qpair->ctrlr == NULL) {
+		return NULL;
+	}
+
+	return &qpair->group->sgroups[qpair->ctrlr->subsys->id];
+}
+
+void
+nvmf_ndp_job_begin(struct nvmf_ndp_job *job, struct spdk_nvmf_request *req)
+{
+	uint32_t timeout_ms = spdk_nvmf_ndp_get_timeout(req->cmd->nvme_cmd.opc);
+
+	job->req = req;
+	job->sgroup = nvmf_ndp_qpair_sgroup(req->qpair);
+	job->status = 0;
+	job->deadline_tsc = 0;
+	if (timeout_ms != 0) {
+		job->deadline_tsc = spdk_get_ticks() + spdk_get_ticks_hz() / 1000 * timeout_ms;
+	}
+
+	TAILQ_INSERT_TAIL(&job->sgroup->ndp_jobs, job, link);
+}
+
+int
+nvmf_ndp_job_check(struct nvmf_ndp_job *job)
+{
+	struct spdk_nvme_cmd *cmd = &job->req->cmd->nvme_cmd;
+
+	if (job->status == 0 && job->deadline_tsc != 0 && spdk_get_ticks() >= job->deadline_tsc) {
+		SPDK_ERRLOG("NDP command cid %u (opc 0x%02x) on qpair %u timed out after %u ms\n",
+			    cmd->cid, cmd->opc, job->req->qpair->qid, spdk_nvmf_ndp_get_timeout(cmd->opc));
+		job->status = -ETIMEDOUT;
+	}
+
+	return job->status;
+}
+
+void
+nvmf_ndp_job_end(struct nvmf_ndp_job *job)
+{
+	TAILQ_REMOVE(&job->sgroup->ndp_jobs, job, link);
+}
+
+bool
+nvmf_ndp_abort_request(struct spdk_nvmf_request *req)
+{
+	struct spdk_nvmf_subsystem_poll_group *sgroup = nvmf_ndp_qpair_sgroup(req->qpair);
+	struct nvmf_ndp_job *job;
+
+	if (sgroup == NULL) {
+		return false;
+	}
+
+	TAILQ_FOREACH(job, &sgroup->ndp_jobs, link) {
+		if (job->req == req) {
+			break;
+		}
+	}
+
+	if (job == NULL) {
+		return false;
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP command cid %u on qpair %u aborted\n", req->cmd->nvme_cmd.cid,
+		      req->qpair->qid);
+
+	/* A job that already timed out keeps its status */
+	if (job->status == 0) {
+		job->status = -ECANCELED;
+	}
+
+	return true;
+}
+
+void
+nvmf_ndp_qpair_abort(struct spdk_nvmf_qpair *qpair)
+{
+	struct spdk_nvmf_subsystem_poll_group *sgroup = nvmf_ndp_qpair_sgroup(qpair);
+	struct nvmf_ndp_job *job;
+
+	/* A queue pair not associated with a controller yet has run no command */
+	if (sgroup == NULL) {
+		return;
+	}
+
+	TAILQ_FOREACH(job, &sgroup->ndp_jobs, link) {
+		if (job->req->qpair == qpair && job->status == 0) {
+			job->status = -ENOTCONN;
+		}
+	}
+}
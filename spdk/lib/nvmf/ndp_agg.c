@@ -0,0 +1,280 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Aggregate engine for the NDP aggregate operator.
+ *
+ * Records are selected and split by the filter engine, so an aggregate costs
+ * the same as a filter without the result traffic: only the matching records
+ * reach the aggregate, and only their selected column is parsed.  Every part
+ * of the input is folded into a partial aggregate first, merged into the
+ * total once the part is done.  Histogram buckets are additive and counted
+ * in place.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/endian.h"
+#include "spdk/histogram_data.h"
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+struct nvmf_ndp_agg_state {
+	uint64_t		records;
+	uint64_t		count;
+	uint64_t		negative;
+	bool			overflow;
+
+	int64_t			isum;
+	int64_t			imin;
+	int64_t			imax;
+
+	double			fsum;
+	double			fmin;
+	double			fmax;
+};
+
+struct nvmf_ndp_agg {
+	struct nvmf_ndp_filter		*filter;
+	uint8_t				type;
+	struct spdk_histogram_data	*histogram;
+
+	/* Part of the input being scanned, and everything before it */
+	struct nvmf_ndp_agg_state	part;
+	struct nvmf_ndp_agg_state	total;
+};
+
+static void
+agg_state_init(struct nvmf_ndp_agg_state *state)
+{
+	memset(state, 0, sizeof(*state));
+	state->imin = INT64_MAX;
+	state->imax = INT64_MIN;
+	state->fmin = INFINITY;
+	state->fmax = -INFINITY;
+}
+
+static void
+agg_state_merge(struct nvmf_ndp_agg_state *dst, const struct nvmf_ndp_agg_state *src)
+{
+	dst->records += src->records;
+	dst->count += src->count;
+	dst->negative += src->negative;
+	dst->overflow |= src->overflow;
+
+	if (__builtin_add_overflow(dst->isum, src->isum, &dst->isum)) {
+		dst->overflow = true;
+	}
+	dst->imin = spdk_min(dst->imin, src->imin);
+	dst->imax = spdk_max(dst->imax, src->imax);
+
+	dst->fsum += src->fsum;
+	dst->fmin = spdk_min(dst->fmin, src->fmin);
+	dst->fmax = spdk_max(dst->fmax, src->fmax);
+}
+
+void
+nvmf_ndp_agg_free(struct nvmf_ndp_agg *agg)
+{
+	if (agg == NULL) {
+		return;
+	}
+
+	nvmf_ndp_filter_free(agg->filter);
+	spdk_histogram_data_free(agg->histogram);
+	free(agg);
+}
+
+struct nvmf_ndp_agg *
+nvmf_ndp_agg_create(const void *args, size_t len)
+{
+	struct nvmf_ndp_agg_hdr hdr;
+	struct nvmf_ndp_agg *agg;
+
+	if (len < sizeof(hdr)) {
+		SPDK_ERRLOG("Aggregate arguments too short: %zu bytes\n", len);
+		return NULL;
+	}
+
+	memcpy(&hdr, args, sizeof(hdr));
+	if (from_le32(&hdr.magic) != NVMF_NDP_AGG_MAGIC ||
+	    (hdr.type != NVMF_NDP_FILTER_TYPE_INT && hdr.type != NVMF_NDP_FILTER_TYPE_FLOAT) ||
+	    (hdr.flags & ~NVMF_NDP_AGG_FLAG_HISTOGRAM) != 0 ||
+	    hdr.bucket_shift > NVMF_NDP_AGG_MAX_BUCKET_SHIFT) {
+		SPDK_ERRLOG("Invalid aggregate header: type %u flags 0x%x bucket shift %u\n",
+			    hdr.type, hdr.flags, hdr.bucket_shift);
+		return NULL;
+	}
+
+	agg = calloc(1, sizeof(*agg));
+	if (agg == NULL) {
+		return NULL;
+	}
+	agg->type = hdr.type;
+	agg_state_init(&agg->total);
+
+	agg->filter = nvmf_ndp_filter_create((const char *)args + sizeof(hdr), len - sizeof(hdr));
+	if (agg->filter == NULL) {
+		goto err;
+	}
+	if (nvmf_ndp_filter_num_columns(agg->filter) != 1) {
+		SPDK_ERRLOG("Aggregate over %u columns, expected 1\n",
+			    nvmf_ndp_filter_num_columns(agg->filter));
+		goto err;
+	}
+
+	if (hdr.flags & NVMF_NDP_AGG_FLAG_HISTOGRAM) {
+		agg->histogram = spdk_histogram_data_alloc_sized(hdr.bucket_shift);
+		if (agg->histogram == NULL) {
+			goto err;
+		}
+	}
+
+	return agg;
+
+err:
+	nvmf_ndp_agg_free(agg);
+	return NULL;
+}
+
+static void
+agg_tally(struct nvmf_ndp_agg *agg, double val)
+{
+	if (val < 0) {
+		agg->part.negative++;
+	} else if (val >= 0x1p64) {
+		spdk_histogram_data_tally(agg->histogram, UINT64_MAX);
+	} else {
+		spdk_histogram_data_tally(agg->histogram, (uint64_t)val);
+	}
+}
+
+static int
+agg_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_agg *agg = cb_arg;
+	struct nvmf_ndp_agg_state *part = &agg->part;
+	const char *p;
+	uint32_t len;
+	int64_t ival;
+	double fval;
+
+	part->records++;
+	p = nvmf_ndp_filter_column(agg->filter, 0, &len);
+	if (p == NULL) {
+		return 0;
+	}
+
+	if (agg->type == NVMF_NDP_FILTER_TYPE_INT) {
+		if (!nvmf_ndp_parse_int(p, len, &ival)) {
+			return 0;
+		}
+		if (__builtin_add_overflow(part->isum, ival, &part->isum)) {
+			part->overflow = true;
+		}
+		part->imin = spdk_min(part->imin, ival);
+		part->imax = spdk_max(part->imax, ival);
+		if (agg->histogram != NULL) {
+			if (ival < 0) {
+				part->negative++;
+			} else {
+				spdk_histogram_data_tally(agg->histogram, (uint64_t)ival);
+			}
+		}
+	} else {
+		if (!nvmf_ndp_parse_float(p, len, &fval)) {
+			return 0;
+		}
+		part->fsum += fval;
+		part->fmin = spdk_min(part->fmin, fval);
+		part->fmax = spdk_max(part->fmax, fval);
+		if (agg->histogram != NULL) {
+			agg_tally(agg, fval);
+		}
+	}
+	part->count++;
+
+	return 0;
+}
+
+void
+nvmf_ndp_agg_scan(struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt)
+{
+	agg_state_init(&agg->part);
+	nvmf_ndp_filter_scan(agg->filter, iov, iovcnt, agg_match, agg);
+	agg_state_merge(&agg->total, &agg->part);
+}
+
+size_t
+nvmf_ndp_agg_result_size(const struct nvmf_ndp_agg *agg)
+{
+	size_t size = sizeof(struct nvmf_ndp_agg_result);
+
+	if (agg->histogram != NULL) {
+		size += SPDK_HISTOGRAM_NUM_BUCKETS(agg->histogram) * sizeof(uint64_t);
+	}
+
+	return size;
+}
+
+static uint64_t
+agg_double_bits(double val)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	return bits;
+}
+
+size_t
+nvmf_ndp_agg_get_result(const struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt)
+{
+	const struct nvmf_ndp_agg_state *total = &agg->total;
+	struct nvmf_ndp_agg_result result = {};
+	uint64_t buckets[64];
+	struct spdk_iov_xfer ix;
+	uint64_t i, j, n, num_buckets = 0;
+	size_t len;
+
+	to_le64(&result.records, total->records);
+	to_le64(&result.count, total->count);
+	to_le64(&result.negative, total->negative);
+	result.type = agg->type;
+	if (total->overflow) {
+		result.flags |= NVMF_NDP_AGG_FLAG_OVERFLOW;
+	}
+
+	/* Without any number, there is no minimum or maximum: leave them 0 */
+	if (total->count > 0 && agg->type == NVMF_NDP_FILTER_TYPE_INT) {
+		to_le64(&result.sum, (uint64_t)total->isum);
+		to_le64(&result.min, (uint64_t)total->imin);
+		to_le64(&result.max, (uint64_t)total->imax);
+	} else if (total->count > 0) {
+		to_le64(&result.sum, agg_double_bits(total->fsum));
+		to_le64(&result.min, agg_double_bits(total->fmin));
+		to_le64(&result.max, agg_double_bits(total->fmax));
+	}
+
+	if (agg->histogram != NULL) {
+		num_buckets = SPDK_HISTOGRAM_NUM_BUCKETS(agg->histogram);
+		result.flags |= NVMF_NDP_AGG_FLAG_HISTOGRAM;
+		result.bucket_shift = agg->histogram->bucket_shift;
+		to_le32(&result.num_buckets, (uint32_t)num_buckets);
+	}
+
+	spdk_iov_xfer_init(&ix, iov, iovcnt);
+	len = spdk_iov_xfer_from_buf(&ix, &result, sizeof(result));
+
+	for (i = 0; i < num_buckets; i += n) {
+		n = spdk_min(num_buckets - i, SPDK_COUNTOF(buckets));
+		for (j = 0; j < n; j++) {
+			to_le64(&buckets[j], agg->histogram->bucket[i + j]);
+		}
+		len += spdk_iov_xfer_from_buf(&ix, buckets, n * sizeof(buckets[0]));
+	}
+
+	return len;
+}
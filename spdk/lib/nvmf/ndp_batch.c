@@ -0,0 +1,709 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Batch: one operator run over many files in a single command, to save a
+ * round trip, a descriptor and a cursor per file when scanning many small
+ * ones.
+ *
+ * The data buffer holds a batch descriptor (see ndp_internal.h) followed by
+ * the arguments the operator (CDW10 bits 23:16) takes on its own, their
+ * length in the low 16 bits of CDW10 (0 for the rest of the buffer).  Echo,
+ * grep, filter, aggregate, regex, top-K and sample may be run.  Up to CDW13
+ * bits 7:0 files are streamed at once, each into a result buffer of its own
+ * taken from the iobuf pool, which also bounds the result of a file.  Their
+ * results are written back into the data buffer in file order, tagged with
+ * the id of their file.  A file is only started while the data buffer still
+ * has room for its entry past those of the files before it; once an entry
+ * doesn't fit, the rest of the result is left to a cursor resuming at that
+ * file.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/endian.h"
+#include "spdk/log.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/nvmf_ndp.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+
+struct nvmf_ndp_batch;
+
+struct nvmf_ndp_batch_slot {
+	struct nvmf_ndp_batch		*batch;
+	bool				busy;
+	bool				done;
+
+	/* Index of the file in the descriptor, and the status of its operator */
+	uint32_t			file;
+	int				status;
+
+	/*
+	 * Grep, filter and regex engines are reset at the end of every file and
+	 * kept for the next one, aggregate and top-K are created per file.
+	 */
+	void				*engine;
+
+	/* Taken when the slot starts its first file and kept for the next ones */
+	char				*buf;
+	struct spdk_iobuf_entry		iobuf_entry;
+	uint32_t			len;
+	bool				truncated;
+};
+
+struct nvmf_ndp_batch {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct spdk_bdev_desc		*desc;
+	struct spdk_io_channel		*ch;
+
+	/* NULL if the transport doesn't use the iobuf pool, the buffers are allocated then */
+	struct spdk_iobuf_channel	*iobuf;
+
+	struct spdk_iov_xfer		ix;
+	uint32_t			len;
+
+	/* Size of the slot buffers, i.e. the most one file may return */
+	uint32_t			buf_size;
+
+	/* Next file to start, and the next one to write back */
+	uint32_t			next_start;
+	uint32_t			next_emit;
+
+	/* The data buffer is full, the next part of the result starts at next_emit */
+	bool				more;
+
+	/* A file may complete from within nvmf_ndp_batch_pump() */
+	bool				pumping;
+	bool				repump;
+
+	/* The streams of all files are stopped by the job of the command */
+	struct nvmf_ndp_job		job;
+	int				status;
+
+	uint32_t			inflight;
+	uint32_t			num_slots;
+	struct nvmf_ndp_batch_slot	slots[NVMF_NDP_BATCH_MAX_DEPTH];
+};
+
+static bool
+nvmf_ndp_batch_opc_supported(uint8_t opc)
+{
+	switch (opc) {
+	case SPDK_NVME_OPC_CUSTOM_ECHO:
+	case SPDK_NVME_OPC_CUSTOM_GREP:
+	case SPDK_NVME_OPC_CUSTOM_FILTER:
+	case SPDK_NVME_OPC_CUSTOM_AGGREGATE:
+	case SPDK_NVME_OPC_CUSTOM_REGEX:
+	case SPDK_NVME_OPC_CUSTOM_TOPK:
+	case SPDK_NVME_OPC_CUSTOM_SAMPLE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Append to the result of the file.  Records are only truncated if they are
+ * the first one, the others are dropped whole.
+ */
+static int
+nvmf_ndp_batch_copy(struct nvmf_ndp_batch_slot *slot, struct iovec *iov, int iovcnt,
+		    bool record)
+{
+	uint32_t buf_size = slot->batch->buf_size;
+	size_t len = 0, n;
+	int i;
+
+	if (slot->truncated) {
+		return 1;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	if (len > buf_size - slot->len) {
+		slot->truncated = true;
+		if (record && slot->len > 0) {
+			return 1;
+		}
+	}
+
+	for (i = 0; i < iovcnt && slot->len < buf_size; i++) {
+		n = spdk_min(iov[i].iov_len, buf_size - slot->len);
+		memcpy(slot->buf + slot->len, iov[i].iov_base, n);
+		slot->len += n;
+	}
+
+	return slot->truncated ? 1 : 0;
+}
+
+static int
+nvmf_ndp_batch_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	return nvmf_ndp_batch_copy(cb_arg, iov, iovcnt, true);
+}
+
+/* Grep reports the last line without the newline it may miss */
+static int
+nvmf_ndp_batch_grep_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct iovec *last = &iov[iovcnt - 1];
+	struct iovec newline = { .iov_base = "\n", .iov_len = 1 };
+	int rc;
+
+	rc = nvmf_ndp_batch_copy(cb_arg, iov, iovcnt, true);
+	if (rc == 0 && ((char *)last->iov_base)[last->iov_len - 1] != '\n') {
+		rc = nvmf_ndp_batch_copy(cb_arg, &newline, 1, false);
+	}
+
+	return rc;
+}
+
+static int
+nvmf_ndp_batch_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_batch_slot *slot = cb_arg;
+
+	switch (slot->batch->cursor->target.opc) {
+	case SPDK_NVME_OPC_CUSTOM_ECHO:
+		return nvmf_ndp_batch_copy(slot, iov, iovcnt, false);
+	case SPDK_NVME_OPC_CUSTOM_GREP:
+		return nvmf_ndp_grep_scan(slot->engine, iov, iovcnt, nvmf_ndp_batch_grep_match, slot);
+	case SPDK_NVME_OPC_CUSTOM_FILTER:
+		return nvmf_ndp_filter_scan(slot->engine, iov, iovcnt, nvmf_ndp_batch_match, slot);
+	case SPDK_NVME_OPC_CUSTOM_REGEX:
+		return nvmf_ndp_regex_scan(slot->engine, iov, iovcnt, nvmf_ndp_batch_match, slot);
+	case SPDK_NVME_OPC_CUSTOM_AGGREGATE:
+		nvmf_ndp_agg_scan(slot->engine, iov, iovcnt);
+		return 0;
+	case SPDK_NVME_OPC_CUSTOM_TOPK:
+	case SPDK_NVME_OPC_CUSTOM_SAMPLE:
+		nvmf_ndp_topk_scan(slot->engine, iov, iovcnt);
+		return 0;
+	default:
+		assert(false);
+		return -EINVAL;
+	}
+}
+
+/* Create the engine of the slot, unless it is kept from the previous file */
+static int
+nvmf_ndp_batch_engine_create(struct nvmf_ndp_batch_slot *slot)
+{
+	struct nvmf_ndp_batch *batch = slot->batch;
+	struct nvmf_ndp_desc *target = &batch->cursor->target;
+	struct nvmf_ndp_topk *topk;
+	int rc;
+
+	if (slot->engine != NULL) {
+		return 0;
+	}
+
+	switch (target->opc) {
+	case SPDK_NVME_OPC_CUSTOM_ECHO:
+		return 0;
+	case SPDK_NVME_OPC_CUSTOM_GREP:
+		slot->engine = nvmf_ndp_grep_create(target->args,
+						    strnlen(target->args, target->args_len),
+						    NVMF_NDP_STREAM_MAX_RECORD_LEN);
+		break;
+	case SPDK_NVME_OPC_CUSTOM_FILTER:
+		slot->engine = nvmf_ndp_filter_create(target->args, target->args_len);
+		break;
+	case SPDK_NVME_OPC_CUSTOM_REGEX:
+		slot->engine = nvmf_ndp_regex_create(target->args, target->args_len);
+		break;
+	case SPDK_NVME_OPC_CUSTOM_AGGREGATE:
+		slot->engine = nvmf_ndp_agg_create(target->args, target->args_len);
+		if (slot->engine != NULL && nvmf_ndp_agg_result_size(slot->engine) > batch->buf_size) {
+			SPDK_ERRLOG("Aggregate result of %zu bytes exceeds the %u bytes of a file\n",
+				    nvmf_ndp_agg_result_size(slot->engine), batch->buf_size);
+			nvmf_ndp_agg_free(slot->engine);
+			slot->engine = NULL;
+		}
+		break;
+	case SPDK_NVME_OPC_CUSTOM_TOPK:
+	case SPDK_NVME_OPC_CUSTOM_SAMPLE:
+		/* Out of heaps, the file is retried by the host rather than malformed */
+		rc = nvmf_ndp_topk_create(target->args, target->args_len,
+					  target->opc == SPDK_NVME_OPC_CUSTOM_SAMPLE,
+					  batch->buf_size, &topk);
+		if (rc != 0) {
+			return rc;
+		}
+		slot->engine = topk;
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	return slot->engine != NULL ? 0 : -EINVAL;
+}
+
+/* Drop the engine of the slot if it can't be used for another file */
+static void
+nvmf_ndp_batch_engine_put(struct nvmf_ndp_batch_slot *slot)
+{
+	switch (slot->batch->cursor->target.opc) {
+	case SPDK_NVME_OPC_CUSTOM_AGGREGATE:
+		nvmf_ndp_agg_free(slot->engine);
+		slot->engine = NULL;
+		break;
+	case SPDK_NVME_OPC_CUSTOM_TOPK:
+	case SPDK_NVME_OPC_CUSTOM_SAMPLE:
+		nvmf_ndp_topk_free(slot->engine);
+		slot->engine = NULL;
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+nvmf_ndp_batch_engine_free(struct nvmf_ndp_batch_slot *slot)
+{
+	if (slot->engine == NULL) {
+		return;
+	}
+
+	switch (slot->batch->cursor->target.opc) {
+	case SPDK_NVME_OPC_CUSTOM_GREP:
+		nvmf_ndp_grep_free(slot->engine);
+		break;
+	case SPDK_NVME_OPC_CUSTOM_FILTER:
+		nvmf_ndp_filter_free(slot->engine);
+		break;
+	case SPDK_NVME_OPC_CUSTOM_REGEX:
+		nvmf_ndp_regex_free(slot->engine);
+		break;
+	default:
+		nvmf_ndp_batch_engine_put(slot);
+		break;
+	}
+	slot->engine = NULL;
+}
+
+/* The whole file was read, collect what the engine still holds */
+static void
+nvmf_ndp_batch_engine_finish(struct nvmf_ndp_batch_slot *slot)
+{
+	struct iovec iov = {
+		.iov_base = slot->buf,
+		.iov_len = slot->batch->buf_size,
+	};
+
+	switch (slot->batch->cursor->target.opc) {
+	case SPDK_NVME_OPC_CUSTOM_AGGREGATE:
+		slot->len = nvmf_ndp_agg_get_result(slot->engine, &iov, 1);
+		break;
+	case SPDK_NVME_OPC_CUSTOM_TOPK:
+	case SPDK_NVME_OPC_CUSTOM_SAMPLE:
+		slot->len = nvmf_ndp_topk_get_result(slot->engine, &iov, 1);
+		slot->truncated = nvmf_ndp_topk_truncated(slot->engine);
+		break;
+	default:
+		break;
+	}
+}
+
+static void nvmf_ndp_batch_pump(struct nvmf_ndp_batch *batch);
+
+static void
+nvmf_ndp_batch_file_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_batch_slot *slot = cb_arg;
+	struct nvmf_ndp_batch *batch = slot->batch;
+
+	if (batch->cursor->target.opc == SPDK_NVME_OPC_CUSTOM_GREP) {
+		/* Also resets the engine for the next file */
+		nvmf_ndp_grep_finish(slot->engine, nvmf_ndp_batch_grep_match, slot);
+	}
+
+	if (status == 0) {
+		nvmf_ndp_batch_engine_finish(slot);
+	} else {
+		slot->len = 0;
+		slot->truncated = false;
+	}
+	nvmf_ndp_batch_engine_put(slot);
+
+	slot->status = status;
+	slot->done = true;
+	batch->inflight--;
+
+	nvmf_ndp_batch_pump(batch);
+}
+
+static int
+nvmf_ndp_batch_file_start(struct nvmf_ndp_batch_slot *slot)
+{
+	struct nvmf_ndp_batch *batch = slot->batch;
+	struct nvmf_ndp_desc *target = &batch->cursor->target;
+	struct nvmf_ndp_desc_file *file = &target->files[slot->file];
+	struct nvmf_ndp_stream_opts opts;
+	int rc;
+
+	slot->len = 0;
+	slot->truncated = false;
+	slot->status = 0;
+	slot->done = false;
+
+	rc = nvmf_ndp_batch_engine_create(slot);
+	if (rc != 0) {
+		return rc;
+	}
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.length = file->length;
+	opts.job = &batch->job;
+	if (target->opc != SPDK_NVME_OPC_CUSTOM_ECHO && target->opc != SPDK_NVME_OPC_CUSTOM_GREP) {
+		opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	}
+
+	rc = nvmf_ndp_stream_start(batch->req, batch->desc, batch->ch,
+				   &target->extents[file->first_extent], file->num_extents, &opts,
+				   nvmf_ndp_batch_data, nvmf_ndp_batch_file_done, slot);
+	if (rc != 0) {
+		nvmf_ndp_batch_engine_put(slot);
+	}
+
+	return rc;
+}
+
+/*
+ * Write the entry of a finished file back into the data buffer.  Returns
+ * false if it doesn't fit any more.
+ */
+static bool
+nvmf_ndp_batch_emit(struct nvmf_ndp_batch *batch, struct nvmf_ndp_batch_slot *slot)
+{
+	static const uint8_t pad[8];
+	struct nvmf_ndp_desc_file *file = &batch->cursor->target.files[slot->file];
+	struct nvmf_ndp_batch_entry entry = {};
+	uint32_t len = SPDK_ALIGN_CEIL(slot->len, sizeof(uint64_t));
+
+	if (sizeof(entry) + len > batch->req->length - batch->len) {
+		return false;
+	}
+
+	to_le64(&entry.id, file->id);
+	to_le32(&entry.len, slot->len);
+	to_le16(&entry.status, -slot->status);
+	to_le16(&entry.flags, slot->truncated ? NVMF_NDP_BATCH_F_TRUNCATED : 0);
+	if (slot->truncated) {
+		/* A larger data buffer would hold more of it */
+		nvmf_ndp_cursor_skip_cache(batch->cursor);
+	}
+
+	batch->len += spdk_iov_xfer_from_buf(&batch->ix, &entry, sizeof(entry));
+	batch->len += spdk_iov_xfer_from_buf(&batch->ix, slot->buf, slot->len);
+	batch->len += spdk_iov_xfer_from_buf(&batch->ix, pad, len - slot->len);
+
+	return true;
+}
+
+static struct nvmf_ndp_batch_slot *
+nvmf_ndp_batch_find_slot(struct nvmf_ndp_batch *batch, uint32_t file)
+{
+	uint32_t i;
+
+	for (i = 0; i < batch->num_slots; i++) {
+		if (batch->slots[i].busy && batch->slots[i].file == file) {
+			return &batch->slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct nvmf_ndp_batch_slot *
+nvmf_ndp_batch_free_slot(struct nvmf_ndp_batch *batch)
+{
+	uint32_t i;
+
+	for (i = 0; i < batch->num_slots; i++) {
+		if (!batch->slots[i].busy) {
+			return &batch->slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void
+nvmf_ndp_batch_free(struct nvmf_ndp_batch *batch)
+{
+	uint32_t i;
+
+	for (i = 0; i < batch->num_slots; i++) {
+		nvmf_ndp_batch_engine_free(&batch->slots[i]);
+		if (batch->iobuf != NULL && batch->slots[i].buf != NULL) {
+			spdk_iobuf_put(batch->iobuf, batch->slots[i].buf, batch->buf_size);
+		} else {
+			free(batch->slots[i].buf);
+		}
+	}
+	free(batch);
+}
+
+/*
+ * Whether the data buffer has room for the entry of another file, past the
+ * entries of the files before it.  The results of the files still running
+ * are unknown, only those of the finished ones are counted.
+ */
+static bool
+nvmf_ndp_batch_has_room(struct nvmf_ndp_batch *batch)
+{
+	struct nvmf_ndp_batch_slot *slot;
+	uint64_t len = batch->len + sizeof(struct nvmf_ndp_batch_entry);
+	uint32_t i;
+
+	for (i = 0; i < batch->num_slots; i++) {
+		slot = &batch->slots[i];
+		if (slot->busy) {
+			len += sizeof(struct nvmf_ndp_batch_entry);
+			if (slot->done) {
+				len += SPDK_ALIGN_CEIL(slot->len, sizeof(uint64_t));
+			}
+		}
+	}
+
+	return len <= batch->req->length;
+}
+
+static void
+nvmf_ndp_batch_slot_start(struct nvmf_ndp_batch_slot *slot)
+{
+	struct nvmf_ndp_batch *batch = slot->batch;
+	int rc;
+
+	rc = nvmf_ndp_batch_file_start(slot);
+	if (rc != 0) {
+		/* Only this file fails, it is reported in its entry */
+		batch->inflight--;
+		slot->status = rc;
+		slot->done = true;
+	}
+}
+
+static void
+nvmf_ndp_batch_iobuf_get_cb(struct spdk_iobuf_entry *entry, void *buf)
+{
+	struct nvmf_ndp_batch_slot *slot = SPDK_CONTAINEROF(entry, struct nvmf_ndp_batch_slot,
+					   iobuf_entry);
+
+	slot->buf = buf;
+	nvmf_ndp_batch_slot_start(slot);
+	nvmf_ndp_batch_pump(slot->batch);
+}
+
+static void
+nvmf_ndp_batch_pump(struct nvmf_ndp_batch *batch)
+{
+	struct nvmf_ndp_desc *target = &batch->cursor->target;
+	struct nvmf_ndp_batch_slot *slot;
+
+	if (batch->pumping) {
+		batch->repump = true;
+		return;
+	}
+
+	batch->pumping = true;
+	do {
+		batch->repump = false;
+
+		/* Files in flight stop at their next chunk, the command fails as a whole */
+		batch->status = nvmf_ndp_job_check(&batch->job);
+		if (batch->status != 0) {
+			break;
+		}
+
+		/* Results are written back in file order, a later file waits in its slot */
+		while (!batch->more) {
+			slot = nvmf_ndp_batch_find_slot(batch, batch->next_emit);
+			if (slot == NULL || !slot->done) {
+				break;
+			}
+			if (!nvmf_ndp_batch_emit(batch, slot)) {
+				batch->more = true;
+				break;
+			}
+			slot->busy = false;
+			batch->next_emit++;
+		}
+
+		while (!batch->more && batch->next_start < target->num_files) {
+			/* A file whose entry can't fit would only be dropped and run again */
+			if (!nvmf_ndp_batch_has_room(batch)) {
+				if (batch->next_emit == batch->next_start) {
+					batch->more = true;
+				}
+				break;
+			}
+			slot = nvmf_ndp_batch_free_slot(batch);
+			if (slot == NULL) {
+				break;
+			}
+			slot->busy = true;
+			slot->done = false;
+			slot->file = batch->next_start++;
+			batch->inflight++;
+
+			if (slot->buf == NULL && batch->iobuf != NULL) {
+				slot->buf = spdk_iobuf_get(batch->iobuf, batch->buf_size, &slot->iobuf_entry,
+							   nvmf_ndp_batch_iobuf_get_cb);
+				if (slot->buf == NULL) {
+					/* Queued, nvmf_ndp_batch_iobuf_get_cb() starts the file */
+					continue;
+				}
+			}
+
+			nvmf_ndp_batch_slot_start(slot);
+			if (slot->done) {
+				batch->repump = true;
+			}
+		}
+	} while (batch->repump);
+	batch->pumping = false;
+
+	if (batch->inflight > 0 ||
+	    (batch->status == 0 && !batch->more && batch->next_emit < target->num_files)) {
+		return;
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP batch returned files %" PRIu64 " to %u (%u bytes)%s, status %d\n",
+		      batch->cursor->offset, batch->next_emit, batch->len,
+		      batch->more ? ", more to come" : "", batch->status);
+
+	nvmf_ndp_job_end(&batch->job);
+	nvmf_ndp_cursor_complete(batch->cursor, batch->req, batch->status, batch->len, batch->more,
+				 batch->next_emit);
+	nvmf_ndp_batch_free(batch);
+}
+
+static int
+nvmf_ndp_batch_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		   struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		   struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_desc *target = &cursor->target;
+	struct spdk_iobuf_opts iobuf_opts = {};
+	struct nvmf_ndp_batch *batch;
+	uint32_t i;
+	int rc;
+
+	/* Room for at least an entry and 8 bytes of its result */
+	if (req->length < sizeof(struct nvmf_ndp_batch_entry) + sizeof(uint64_t)) {
+		return -EINVAL;
+	}
+
+	batch = calloc(1, sizeof(*batch));
+	if (batch == NULL) {
+		return -ENOMEM;
+	}
+	batch->req = req;
+	batch->cursor = cursor;
+	batch->desc = desc;
+	batch->ch = ch;
+	batch->iobuf = nvmf_ndp_req_get_iobuf(req);
+	batch->next_start = cursor->offset;
+	batch->next_emit = cursor->offset;
+	batch->num_slots = spdk_min(target->depth, target->num_files - cursor->offset);
+
+	/* The result of a file fits in one large iobuf buffer, and in the data buffer */
+	spdk_iobuf_get_opts(&iobuf_opts, sizeof(iobuf_opts));
+	batch->buf_size = spdk_min(req->length - sizeof(struct nvmf_ndp_batch_entry),
+				   iobuf_opts.large_bufsize);
+	batch->buf_size = SPDK_ALIGN_FLOOR(batch->buf_size, sizeof(uint64_t));
+
+	for (i = 0; i < batch->num_slots; i++) {
+		batch->slots[i].batch = batch;
+		if (batch->iobuf != NULL) {
+			continue;
+		}
+		batch->slots[i].buf = malloc(batch->buf_size);
+		if (batch->slots[i].buf == NULL) {
+			nvmf_ndp_batch_free(batch);
+			return -ENOMEM;
+		}
+	}
+
+	/* Malformed arguments fail the command rather than every file */
+	rc = nvmf_ndp_batch_engine_create(&batch->slots[0]);
+	if (rc != 0) {
+		nvmf_ndp_batch_free(batch);
+		return rc;
+	}
+	nvmf_ndp_batch_engine_put(&batch->slots[0]);
+
+	nvmf_ndp_result_init(req, &batch->ix);
+
+	nvmf_ndp_job_begin(&batch->job, req);
+	nvmf_ndp_batch_pump(batch);
+
+	return 0;
+}
+
+static int
+nvmf_ndp_batch_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		    struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	uint8_t opc = (cmd->cdw10 >> 16) & 0xFF;
+	uint32_t args_len = cmd->cdw10 & 0xFFFF;
+	uint64_t desc_size = NVMF_NDP_BATCH_DESC_SIZE(cmd->cdw11, cmd->cdw12);
+	struct nvmf_ndp_cursor *cursor;
+	struct nvmf_ndp_desc target;
+	int rc;
+
+	if (req->iovcnt == 0 || desc_size >= req->length || !nvmf_ndp_batch_opc_supported(opc)) {
+		nvmf_ndp_set_status(req, -EINVAL);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	/* Echo takes no arguments */
+	if (opc == SPDK_NVME_OPC_CUSTOM_ECHO) {
+		args_len = 0;
+	} else if (args_len == 0) {
+		args_len = req->length - desc_size;
+	}
+
+	rc = nvmf_ndp_desc_parse_batch(req, bdev, args_len, &target);
+	if (rc != 0) {
+		nvmf_ndp_set_status(req, rc);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	/* Results of batches aren't cached, the cursor only tracks the next file */
+	cursor = nvmf_ndp_cursor_create(req, &target, nvmf_ndp_batch_run);
+	if (cursor == NULL) {
+		nvmf_ndp_desc_free(&target);
+		nvmf_ndp_set_status(req, -ENOMEM);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	rc = nvmf_ndp_batch_run(cursor, bdev, desc, ch, req);
+	if (rc != 0) {
+		nvmf_ndp_cursor_free(cursor);
+		nvmf_ndp_set_status(req, rc);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_batch_op = {
+	.name = "batch",
+	.opc = SPDK_NVME_OPC_CUSTOM_BATCH,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_batch_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(batch, &g_nvmf_ndp_batch_op);
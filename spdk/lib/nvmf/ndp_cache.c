@@ -0,0 +1,613 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * NDP result cache: complete results of read-only operators, so that a
+ * command repeated over files that didn't change is answered without
+ * scanning the namespace again.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/crc32.h"
+#include "spdk/endian.h"
+#include "spdk/log.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/nvmf_ndp.h"
+#include "spdk/tree.h"
+#include "spdk/util.h"
+
+struct nvmf_ndp_cache_entry {
+	struct spdk_bdev			*bdev;
+	uint8_t					opc;
+	uint32_t				hash;
+
+	/* Key: the target descriptor and the operator arguments */
+	uint64_t				length;
+	uint32_t				num_extents;
+	struct nvmf_ndp_extent			*extents;
+	char					*args;
+	uint32_t				args_len;
+
+	/* Blocks of the extents, from the first to the last one */
+	uint64_t				lo;
+	uint64_t				hi;
+	/* Orders entries of the same first block, from 1 */
+	uint64_t				seq;
+
+	/* Result, NULL while the entry is being filled */
+	void					*data;
+	uint32_t				data_len;
+
+	/* Pending only: one of the extents was modified */
+	bool					stale;
+
+	TAILQ_ENTRY(nvmf_ndp_cache_entry)	hash_link;
+	/* In the LRU list once filled, in the pending list before */
+	TAILQ_ENTRY(nvmf_ndp_cache_entry)	link;
+	/* In the tree of its slot, filled or pending */
+	RB_ENTRY(nvmf_ndp_cache_entry)		node;
+};
+
+TAILQ_HEAD(nvmf_ndp_cache_list, nvmf_ndp_cache_entry);
+
+/* Ordered by bdev, then by first block */
+static int
+nvmf_ndp_cache_entry_cmp(struct nvmf_ndp_cache_entry *a, struct nvmf_ndp_cache_entry *b)
+{
+	if (a->bdev != b->bdev) {
+		return (uintptr_t)a->bdev < (uintptr_t)b->bdev ? -1 : 1;
+	}
+	if (a->lo != b->lo) {
+		return a->lo < b->lo ? -1 : 1;
+	}
+	if (a->seq != b->seq) {
+		return a->seq < b->seq ? -1 : 1;
+	}
+
+	return 0;
+}
+
+RB_HEAD(nvmf_ndp_cache_tree, nvmf_ndp_cache_entry);
+RB_GENERATE_STATIC(nvmf_ndp_cache_tree, nvmf_ndp_cache_entry, node, nvmf_ndp_cache_entry_cmp);
+
+/*
+ * Entries of the bdevs hashed to a slot.  Modifying commands only look at
+ * the entries of their bdev whose first block is at most max_span blocks
+ * before the end of what they modify.  num_entries, lo and hi are read
+ * without the lock: a command outside [lo, hi) of its slot, the common case
+ * of writes to data no cached result was computed from, has nothing to do.
+ */
+struct nvmf_ndp_cache_slot {
+	struct nvmf_ndp_cache_tree	tree;
+	uint64_t			max_span;
+
+	uint32_t			num_entries;
+	uint64_t			lo;
+	uint64_t			hi;
+};
+
+struct nvmf_ndp_cache {
+	pthread_mutex_t			lock;
+	struct nvmf_ndp_cache_list	buckets[NVMF_NDP_CACHE_BUCKETS];
+
+	/* Least recently used first */
+	struct nvmf_ndp_cache_list	lru;
+	struct nvmf_ndp_cache_list	pending;
+
+	struct nvmf_ndp_cache_slot	slots[NVMF_NDP_CACHE_BDEV_SLOTS];
+
+	/*
+	 * Filled and pending entries.  Read without the lock by every modifying
+	 * command, which has nothing to do while it is 0.
+	 */
+	uint32_t			num_active;
+	uint64_t			seq;
+
+	struct spdk_nvmf_ndp_cache_stats stats;
+};
+
+static struct nvmf_ndp_cache g_nvmf_ndp_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.lru = TAILQ_HEAD_INITIALIZER(g_nvmf_ndp_cache.lru),
+	.pending = TAILQ_HEAD_INITIALIZER(g_nvmf_ndp_cache.pending),
+	.stats.capacity = SPDK_NVMF_NDP_CACHE_DEFAULT_SIZE,
+};
+
+static uint32_t
+nvmf_ndp_cache_hash(struct spdk_bdev *bdev, uint8_t opc, const struct nvmf_ndp_desc *target)
+{
+	uint32_t crc;
+
+	crc = spdk_crc32c_update(&bdev, sizeof(bdev), ~0u);
+	crc = spdk_crc32c_update(&opc, sizeof(opc), crc);
+	crc = spdk_crc32c_update(&target->length, sizeof(target->length), crc);
+	crc = spdk_crc32c_update(target->extents, target->num_extents * sizeof(*target->extents),
+				 crc);
+	crc = spdk_crc32c_update(target->args, target->args_len, crc);
+
+	return crc;
+}
+
+static inline struct nvmf_ndp_cache_slot *
+nvmf_ndp_cache_slot(struct spdk_bdev *bdev)
+{
+	uint64_t hash = (uintptr_t)bdev * 0x9e3779b97f4a7c15ull;
+
+	return &g_nvmf_ndp_cache.slots[(hash >> 32) % NVMF_NDP_CACHE_BDEV_SLOTS];
+}
+
+/* Called with the lock held */
+static void
+nvmf_ndp_cache_slot_insert(struct nvmf_ndp_cache_entry *entry)
+{
+	struct nvmf_ndp_cache_slot *slot = nvmf_ndp_cache_slot(entry->bdev);
+
+	entry->seq = ++g_nvmf_ndp_cache.seq;
+	RB_INSERT(nvmf_ndp_cache_tree, &slot->tree, entry);
+	slot->max_span = spdk_max(slot->max_span, entry->hi - entry->lo);
+	__atomic_store_n(&slot->lo, spdk_min(slot->lo, entry->lo), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->hi, spdk_max(slot->hi, entry->hi), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->num_entries, slot->num_entries + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&g_nvmf_ndp_cache.num_active, 1, __ATOMIC_RELAXED);
+}
+
+/* Called with the lock held.  The bounds only shrink once the slot is empty. */
+static void
+nvmf_ndp_cache_slot_remove(struct nvmf_ndp_cache_entry *entry)
+{
+	struct nvmf_ndp_cache_slot *slot = nvmf_ndp_cache_slot(entry->bdev);
+
+	RB_REMOVE(nvmf_ndp_cache_tree, &slot->tree, entry);
+	__atomic_store_n(&slot->num_entries, slot->num_entries - 1, __ATOMIC_RELAXED);
+	if (slot->num_entries == 0) {
+		slot->max_span = 0;
+		__atomic_store_n(&slot->lo, UINT64_MAX, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->hi, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_sub(&g_nvmf_ndp_cache.num_active, 1, __ATOMIC_RELAXED);
+}
+
+static bool
+nvmf_ndp_cache_entry_matches(const struct nvmf_ndp_cache_entry *entry, struct spdk_bdev *bdev,
+			     uint8_t opc, uint32_t hash, const struct nvmf_ndp_desc *target)
+{
+	return entry->hash == hash && entry->bdev == bdev && entry->opc == opc &&
+	       entry->length == target->length &&
+	       entry->num_extents == target->num_extents &&
+	       entry->args_len == target->args_len &&
+	       memcmp(entry->extents, target->extents,
+		      target->num_extents * sizeof(*target->extents)) == 0 &&
+	       memcmp(entry->args, target->args, target->args_len) == 0;
+}
+
+static uint64_t
+nvmf_ndp_cache_entry_size(const struct nvmf_ndp_cache_entry *entry)
+{
+	return sizeof(*entry) + entry->num_extents * sizeof(*entry->extents) +
+	       entry->args_len + entry->data_len;
+}
+
+static void
+nvmf_ndp_cache_entry_free(struct nvmf_ndp_cache_entry *entry)
+{
+	free(entry->extents);
+	free(entry->args);
+	free(entry->data);
+	free(entry);
+}
+
+static bool
+nvmf_ndp_cache_entry_overlaps(const struct nvmf_ndp_cache_entry *entry, struct spdk_bdev *bdev,
+			      uint64_t offset_blocks, uint64_t end_blocks)
+{
+	const struct nvmf_ndp_extent *extent;
+	uint32_t i;
+
+	if (entry->bdev != bdev || entry->hi <= offset_blocks || end_blocks <= entry->lo) {
+		return false;
+	}
+
+	for (i = 0; i < entry->num_extents; i++) {
+		extent = &entry->extents[i];
+		if (extent->offset_blocks < end_blocks &&
+		    offset_blocks < extent->offset_blocks + extent->num_blocks) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Called with the lock held */
+static void
+nvmf_ndp_cache_remove(struct nvmf_ndp_cache_entry *entry)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+
+	TAILQ_REMOVE(&cache->buckets[entry->hash % NVMF_NDP_CACHE_BUCKETS], entry, hash_link);
+	TAILQ_REMOVE(&cache->lru, entry, link);
+	nvmf_ndp_cache_slot_remove(entry);
+	cache->stats.size -= nvmf_ndp_cache_entry_size(entry);
+	cache->stats.num_entries--;
+	nvmf_ndp_cache_entry_free(entry);
+}
+
+/* Called with the lock held */
+static void
+nvmf_ndp_cache_evict(uint64_t capacity)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+
+	while (cache->stats.size > capacity) {
+		nvmf_ndp_cache_remove(TAILQ_FIRST(&cache->lru));
+		cache->stats.evictions++;
+	}
+}
+
+/* Called with the lock held */
+static struct nvmf_ndp_cache_entry *
+nvmf_ndp_cache_find(struct spdk_bdev *bdev, uint8_t opc, uint32_t hash,
+		    const struct nvmf_ndp_desc *target)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+	struct nvmf_ndp_cache_entry *entry;
+
+	TAILQ_FOREACH(entry, &cache->buckets[hash % NVMF_NDP_CACHE_BUCKETS], hash_link) {
+		if (nvmf_ndp_cache_entry_matches(entry, bdev, opc, hash, target)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static struct nvmf_ndp_cache_entry *
+nvmf_ndp_cache_entry_alloc(struct spdk_bdev *bdev, uint8_t opc, uint32_t hash,
+			   const struct nvmf_ndp_desc *target)
+{
+	const struct nvmf_ndp_extent *extent;
+	struct nvmf_ndp_cache_entry *entry;
+	uint32_t i;
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	entry->bdev = bdev;
+	entry->opc = opc;
+	entry->hash = hash;
+	entry->length = target->length;
+	entry->num_extents = target->num_extents;
+	entry->args_len = target->args_len;
+
+	entry->extents = calloc(target->num_extents, sizeof(*entry->extents));
+	entry->args = malloc(spdk_max(target->args_len, 1));
+	if (entry->extents == NULL || entry->args == NULL) {
+		nvmf_ndp_cache_entry_free(entry);
+		return NULL;
+	}
+	memcpy(entry->extents, target->extents, target->num_extents * sizeof(*entry->extents));
+	memcpy(entry->args, target->args, target->args_len);
+
+	entry->lo = target->num_extents > 0 ? UINT64_MAX : 0;
+	for (i = 0; i < target->num_extents; i++) {
+		extent = &target->extents[i];
+		entry->lo = spdk_min(entry->lo, extent->offset_blocks);
+		entry->hi = spdk_max(entry->hi, extent->offset_blocks + extent->num_blocks);
+	}
+
+	return entry;
+}
+
+int
+nvmf_ndp_cache_lookup(struct spdk_bdev *bdev, struct spdk_nvmf_request *req,
+		      const struct nvmf_ndp_desc *target, struct nvmf_ndp_cache_entry **fill)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+	struct nvmf_ndp_cache_entry *entry;
+	uint8_t opc = req->cmd->nvme_cmd.opc;
+	uint32_t hash;
+	int rc;
+
+	*fill = NULL;
+
+	if (__atomic_load_n(&cache->stats.capacity, __ATOMIC_RELAXED) == 0) {
+		return -ENOENT;
+	}
+
+	hash = nvmf_ndp_cache_hash(bdev, opc, target);
+
+	pthread_mutex_lock(&cache->lock);
+
+	entry = nvmf_ndp_cache_find(bdev, opc, hash, target);
+	if (entry != NULL && entry->data_len <= req->length) {
+		/* Results are bounded by the capacity, copying them is cheap enough */
+		spdk_copy_buf_to_iovs(req->iov, req->iovcnt, entry->data, entry->data_len);
+		TAILQ_REMOVE(&cache->lru, entry, link);
+		TAILQ_INSERT_TAIL(&cache->lru, entry, link);
+		cache->stats.hits++;
+		rc = entry->data_len;
+		pthread_mutex_unlock(&cache->lock);
+
+		SPDK_DEBUGLOG(nvmf, "NDP result cache hit, opc 0x%02x, %d bytes\n", opc, rc);
+		return rc;
+	}
+
+	cache->stats.misses++;
+
+	/* A cached result too large for this buffer would be returned in parts anyway */
+	if (entry == NULL) {
+		*fill = nvmf_ndp_cache_entry_alloc(bdev, opc, hash, target);
+		if (*fill != NULL) {
+			TAILQ_INSERT_TAIL(&cache->pending, *fill, link);
+			nvmf_ndp_cache_slot_insert(*fill);
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return -ENOENT;
+}
+
+void
+nvmf_ndp_cache_fill(struct nvmf_ndp_cache_entry *fill, struct spdk_nvmf_request *req,
+		    uint32_t len)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+	struct nvmf_ndp_desc key;
+	uint64_t capacity;
+	void *data;
+
+	data = malloc(spdk_max(len, 1));
+	if (data != NULL) {
+		spdk_copy_iovs_to_buf(data, len, req->iov, req->iovcnt);
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	TAILQ_REMOVE(&cache->pending, fill, link);
+	fill->data = data;
+	fill->data_len = len;
+
+	/* Another command may have filled the same entry in the meantime */
+	key.length = fill->length;
+	key.num_extents = fill->num_extents;
+	key.extents = fill->extents;
+	key.args = fill->args;
+	key.args_len = fill->args_len;
+
+	capacity = cache->stats.capacity;
+	if (data == NULL || fill->stale ||
+	    nvmf_ndp_cache_entry_size(fill) > capacity >> NVMF_NDP_CACHE_ENTRY_SHIFT ||
+	    nvmf_ndp_cache_find(fill->bdev, fill->opc, fill->hash, &key) != NULL) {
+		nvmf_ndp_cache_slot_remove(fill);
+		pthread_mutex_unlock(&cache->lock);
+		nvmf_ndp_cache_entry_free(fill);
+		return;
+	}
+
+	TAILQ_INSERT_TAIL(&cache->buckets[fill->hash % NVMF_NDP_CACHE_BUCKETS], fill, hash_link);
+	TAILQ_INSERT_TAIL(&cache->lru, fill, link);
+	cache->stats.size += nvmf_ndp_cache_entry_size(fill);
+	cache->stats.num_entries++;
+	cache->stats.insertions++;
+	nvmf_ndp_cache_evict(capacity);
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void
+nvmf_ndp_cache_abort(struct nvmf_ndp_cache_entry *fill)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+
+	pthread_mutex_lock(&cache->lock);
+	TAILQ_REMOVE(&cache->pending, fill, link);
+	nvmf_ndp_cache_slot_remove(fill);
+	pthread_mutex_unlock(&cache->lock);
+
+	nvmf_ndp_cache_entry_free(fill);
+}
+
+void
+nvmf_ndp_cache_invalidate(struct spdk_bdev *bdev, uint64_t offset_blocks, uint64_t num_blocks)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+	struct nvmf_ndp_cache_slot *slot = nvmf_ndp_cache_slot(bdev);
+	struct nvmf_ndp_cache_entry *entry, *tmp, key = {};
+	uint64_t end_blocks;
+
+	if (num_blocks > UINT64_MAX - offset_blocks) {
+		end_blocks = UINT64_MAX;
+	} else {
+		end_blocks = offset_blocks + num_blocks;
+	}
+
+	if (__atomic_load_n(&slot->num_entries, __ATOMIC_ACQUIRE) == 0 ||
+	    end_blocks <= __atomic_load_n(&slot->lo, __ATOMIC_RELAXED) ||
+	    __atomic_load_n(&slot->hi, __ATOMIC_RELAXED) <= offset_blocks) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* From the first entry that may reach offset_blocks, see nvmf_ndp_cache_slot */
+	key.bdev = bdev;
+	key.lo = offset_blocks - spdk_min(offset_blocks, slot->max_span);
+	for (entry = RB_NFIND(nvmf_ndp_cache_tree, &slot->tree, &key);
+	     entry != NULL && entry->bdev == bdev && entry->lo < end_blocks; entry = tmp) {
+		tmp = RB_NEXT(nvmf_ndp_cache_tree, &slot->tree, entry);
+		if (!nvmf_ndp_cache_entry_overlaps(entry, bdev, offset_blocks, end_blocks)) {
+			continue;
+		}
+
+		if (entry->data != NULL) {
+			nvmf_ndp_cache_remove(entry);
+			cache->stats.invalidations++;
+		} else {
+			/* Results being computed may already have read the old data */
+			entry->stale = true;
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void
+nvmf_ndp_cache_invalidate_bdev(struct spdk_bdev *bdev)
+{
+	nvmf_ndp_cache_invalidate(bdev, 0, UINT64_MAX);
+}
+
+static void
+nvmf_ndp_cache_invalidate_dsm(struct spdk_bdev *bdev, struct spdk_nvmf_request *req)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	struct spdk_nvme_dsm_range range;
+	struct spdk_iov_xfer ix;
+	uint32_t i, nr;
+
+	if (!cmd->cdw11_bits.dsm.ad) {
+		/* Only deallocate changes the data */
+		return;
+	}
+
+	nr = cmd->cdw10_bits.dsm.nr + 1;
+	spdk_iov_xfer_init(&ix, req->iov, req->iovcnt);
+	for (i = 0; i < nr; i++) {
+		if (spdk_iov_xfer_to_buf(&ix, &range, sizeof(range)) != sizeof(range)) {
+			/* Malformed, the command fails anyway */
+			break;
+		}
+		nvmf_ndp_cache_invalidate(bdev, from_le64(&range.starting_lba),
+					  from_le32(&range.length));
+	}
+}
+
+static void
+nvmf_ndp_cache_invalidate_copy(struct spdk_bdev *bdev, struct spdk_nvmf_request *req)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	struct spdk_nvme_scc_source_range range;
+	struct spdk_iov_xfer ix;
+	uint64_t sdlba, num_blocks = 0;
+	uint32_t i, nr;
+
+	sdlba = ((uint64_t)cmd->cdw11 << 32) + cmd->cdw10;
+
+	if (cmd->cdw12_bits.copy.df != 0) {
+		/* Unsupported format, the command fails anyway */
+		return;
+	}
+
+	/* The destination is as long as all source ranges together */
+	nr = cmd->cdw12_bits.copy.nr + 1;
+	spdk_iov_xfer_init(&ix, req->iov, req->iovcnt);
+	for (i = 0; i < nr; i++) {
+		if (spdk_iov_xfer_to_buf(&ix, &range, sizeof(range)) != sizeof(range)) {
+			break;
+		}
+		num_blocks += (uint64_t)from_le16(&range.nlb) + 1;
+	}
+
+	nvmf_ndp_cache_invalidate(bdev, sdlba, num_blocks);
+}
+
+void
+nvmf_ndp_cache_invalidate_io(struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	const struct spdk_nvmf_ndp_op *op;
+	struct spdk_nvmf_ns *ns;
+	uint64_t start_lba, num_blocks;
+
+	switch (cmd->opc) {
+	case SPDK_NVME_OPC_WRITE:
+	case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
+	case SPDK_NVME_OPC_WRITE_ZEROES:
+	case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+	case SPDK_NVME_OPC_COPY:
+		break;
+	case SPDK_NVME_OPC_READ:
+		/* Most common, not worth the lookup below */
+		return;
+	default:
+		op = spdk_nvmf_ndp_get_op(cmd->opc);
+		if (op == NULL || !(op->flags & SPDK_NVMF_NDP_OP_F_WRITES_MEDIA)) {
+			return;
+		}
+		break;
+	}
+
+	if (__atomic_load_n(&cache->num_active, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	ns = nvmf_ctrlr_get_ns(req->qpair->ctrlr, cmd->nsid);
+	if (ns == NULL) {
+		return;
+	}
+
+	switch (cmd->opc) {
+	case SPDK_NVME_OPC_WRITE:
+	case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
+	case SPDK_NVME_OPC_WRITE_ZEROES:
+		/* SLBA: CDW10 and CDW11, NLB: CDW12 bits 15:00, 0's based */
+		start_lba = from_le64(&cmd->cdw10);
+		num_blocks = (from_le32(&cmd->cdw12) & 0xFFFFu) + 1;
+		nvmf_ndp_cache_invalidate(ns->bdev, start_lba, num_blocks);
+		break;
+	case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+		nvmf_ndp_cache_invalidate_dsm(ns->bdev, req);
+		break;
+	case SPDK_NVME_OPC_COPY:
+		nvmf_ndp_cache_invalidate_copy(ns->bdev, req);
+		break;
+	default:
+		/* NDP operators that write don't describe what they write */
+		nvmf_ndp_cache_invalidate_bdev(ns->bdev);
+		break;
+	}
+}
+
+void
+spdk_nvmf_ndp_cache_set_capacity(uint64_t capacity)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+
+	pthread_mutex_lock(&cache->lock);
+	__atomic_store_n(&cache->stats.capacity, capacity, __ATOMIC_RELAXED);
+	nvmf_ndp_cache_evict(capacity);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void
+spdk_nvmf_ndp_cache_get_stats(struct spdk_nvmf_ndp_cache_stats *stats)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static void
+__attribute__((constructor)) nvmf_ndp_cache_init(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < NVMF_NDP_CACHE_BUCKETS; i++) {
+		TAILQ_INIT(&g_nvmf_ndp_cache.buckets[i]);
+	}
+	for (i = 0; i < NVMF_NDP_CACHE_BDEV_SLOTS; i++) {
+		RB_INIT(&g_nvmf_ndp_cache.slots[i].tree);
+		g_nvmf_ndp_cache.slots[i].lo = UINT64_MAX;
+	}
+}
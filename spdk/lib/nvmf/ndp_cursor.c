@@ -0,0 +1,270 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * NDP result cursors: the rest of a result that didn't fit into the data
+ * buffer of a command, fetched with SPDK_NVME_OPC_CUSTOM_FETCH.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/env.h"
+#include "spdk/log.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/nvmf_ndp.h"
+
+/*
+ * Parked cursors, least recently used first.  A cursor being run is not in
+ * the list, so it can't be fetched twice at the same time.  Commands of a
+ * controller are spread over several poll groups, hence the lock.
+ */
+static TAILQ_HEAD(, nvmf_ndp_cursor) g_nvmf_ndp_cursors =
+	TAILQ_HEAD_INITIALIZER(g_nvmf_ndp_cursors);
+static uint32_t g_nvmf_ndp_num_cursors;
+static uint32_t g_nvmf_ndp_next_cursor_id;
+static pthread_mutex_t g_nvmf_ndp_cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct nvmf_ndp_cursor *
+nvmf_ndp_cursor_create(struct spdk_nvmf_request *req, struct nvmf_ndp_desc *target,
+		       nvmf_ndp_cursor_run_fn run_fn)
+{
+	struct spdk_nvmf_ctrlr *ctrlr = req->qpair->ctrlr;
+	struct nvmf_ndp_cursor *cursor;
+
+	cursor = calloc(1, sizeof(*cursor));
+	if (cursor == NULL) {
+		return NULL;
+	}
+
+	cursor->subsystem = ctrlr->subsys;
+	cursor->cntlid = ctrlr->cntlid;
+	cursor->nsid = req->cmd->nvme_cmd.nsid;
+	cursor->run_fn = run_fn;
+	cursor->target = *target;
+	memset(target, 0, sizeof(*target));
+
+	return cursor;
+}
+
+void
+nvmf_ndp_cursor_free(struct nvmf_ndp_cursor *cursor)
+{
+	if (cursor->cache_fill != NULL) {
+		nvmf_ndp_cache_abort(cursor->cache_fill);
+	}
+	nvmf_ndp_desc_free(&cursor->target);
+	free(cursor);
+}
+
+/* Called with the lock held */
+static void
+nvmf_ndp_cursor_expire(uint64_t now)
+{
+	struct nvmf_ndp_cursor *cursor, *tmp;
+
+	TAILQ_FOREACH_SAFE(cursor, &g_nvmf_ndp_cursors, link, tmp) {
+		if (cursor->expire_tsc > now && g_nvmf_ndp_num_cursors <= NVMF_NDP_CURSOR_MAX) {
+			/* The list is ordered by expiry */
+			break;
+		}
+
+		SPDK_DEBUGLOG(nvmf, "Dropping NDP cursor %u (%s)\n", cursor->id,
+			      cursor->expire_tsc > now ? "too many cursors" : "expired");
+		TAILQ_REMOVE(&g_nvmf_ndp_cursors, cursor, link);
+		g_nvmf_ndp_num_cursors--;
+		nvmf_ndp_cursor_free(cursor);
+	}
+}
+
+/* Park the cursor until it is fetched.  Returns its id. */
+static uint32_t
+nvmf_ndp_cursor_park(struct nvmf_ndp_cursor *cursor)
+{
+	uint64_t now = spdk_get_ticks();
+	uint32_t id;
+
+	pthread_mutex_lock(&g_nvmf_ndp_cursor_lock);
+
+	if (cursor->id == 0) {
+		/* 0 is never a valid cursor */
+		do {
+			cursor->id = ++g_nvmf_ndp_next_cursor_id;
+		} while (cursor->id == 0);
+	}
+	id = cursor->id;
+
+	/* Make room for this one */
+	g_nvmf_ndp_num_cursors++;
+	nvmf_ndp_cursor_expire(now);
+
+	cursor->expire_tsc = now + NVMF_NDP_CURSOR_TIMEOUT_SEC * spdk_get_ticks_hz();
+	TAILQ_INSERT_TAIL(&g_nvmf_ndp_cursors, cursor, link);
+
+	pthread_mutex_unlock(&g_nvmf_ndp_cursor_lock);
+
+	return id;
+}
+
+/* Take the cursor out of the list, if req may use it. */
+static struct nvmf_ndp_cursor *
+nvmf_ndp_cursor_get(struct spdk_nvmf_request *req, uint32_t id)
+{
+	struct spdk_nvmf_ctrlr *ctrlr = req->qpair->ctrlr;
+	struct nvmf_ndp_cursor *cursor;
+
+	pthread_mutex_lock(&g_nvmf_ndp_cursor_lock);
+
+	nvmf_ndp_cursor_expire(spdk_get_ticks());
+
+	TAILQ_FOREACH(cursor, &g_nvmf_ndp_cursors, link) {
+		if (cursor->id == id) {
+			break;
+		}
+	}
+
+	if (cursor != NULL) {
+		if (cursor->subsystem != ctrlr->subsys || cursor->cntlid != ctrlr->cntlid ||
+		    cursor->nsid != req->cmd->nvme_cmd.nsid) {
+			cursor = NULL;
+		} else {
+			TAILQ_REMOVE(&g_nvmf_ndp_cursors, cursor, link);
+			g_nvmf_ndp_num_cursors--;
+		}
+	}
+
+	pthread_mutex_unlock(&g_nvmf_ndp_cursor_lock);
+
+	return cursor;
+}
+
+void
+nvmf_ndp_result_init(struct spdk_nvmf_request *req, struct spdk_iov_xfer *ix)
+{
+	/* The buffer may still hold the descriptor, it is reused for the result */
+	spdk_iov_memset(req->iov, req->iovcnt, 0);
+	if (ix != NULL) {
+		spdk_iov_xfer_init(ix, req->iov, req->iovcnt);
+	}
+}
+
+void
+nvmf_ndp_set_result(struct spdk_nvmf_request *req, uint32_t len)
+{
+	assert(len <= req->length);
+	assert(len <= NVMF_NDP_RESULT_LEN_MASK);
+
+	nvmf_ndp_set_status(req, 0);
+	req->rsp->nvme_cpl.cdw0 = len;
+
+	/* Only send back what is valid */
+	if (len > 0) {
+		req->length = len;
+		req->xfer = SPDK_NVME_DATA_CONTROLLER_TO_HOST;
+	} else {
+		req->xfer = SPDK_NVME_DATA_NONE;
+	}
+}
+
+void
+nvmf_ndp_cursor_complete(struct nvmf_ndp_cursor *cursor, struct spdk_nvmf_request *req,
+			 int status, uint32_t len, bool more, uint64_t offset)
+{
+	struct spdk_nvme_cpl *response = &req->rsp->nvme_cpl;
+
+	if (status != 0) {
+		nvmf_ndp_set_status(req, status);
+		nvmf_ndp_cursor_free(cursor);
+		spdk_nvmf_request_complete(req);
+		return;
+	}
+
+	nvmf_ndp_set_result(req, len);
+	if (more) {
+		/* Only complete results are cached */
+		if (cursor->cache_fill != NULL) {
+			nvmf_ndp_cache_abort(cursor->cache_fill);
+			cursor->cache_fill = NULL;
+		}
+		cursor->offset = offset;
+		response->cdw0 |= NVMF_NDP_RESULT_MORE;
+		response->cdw1 = nvmf_ndp_cursor_park(cursor);
+	} else {
+		if (cursor->cache_fill != NULL) {
+			nvmf_ndp_cache_fill(cursor->cache_fill, req, len);
+			cursor->cache_fill = NULL;
+		}
+		nvmf_ndp_cursor_free(cursor);
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP result of %u bytes%s, cursor %u\n", len,
+		      more ? " (more)" : "", more ? response->cdw1 : 0);
+
+	spdk_nvmf_request_complete(req);
+}
+
+void
+nvmf_ndp_cursor_skip_cache(struct nvmf_ndp_cursor *cursor)
+{
+	if (cursor->cache_fill != NULL) {
+		nvmf_ndp_cache_abort(cursor->cache_fill);
+		cursor->cache_fill = NULL;
+	}
+}
+
+/*
+ * Fetch
+ *
+ * CDW10 holds the cursor returned in DW1 of the previous completion.  The
+ * next part of the result is written into the data buffer and the completion
+ * is the same as the one of the operator that created the cursor.
+ */
+
+static int
+nvmf_ndp_fetch_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		    struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	struct nvmf_ndp_cursor *cursor;
+	int rc;
+
+	cursor = nvmf_ndp_cursor_get(req, cmd->cdw10);
+	if (cursor == NULL) {
+		SPDK_ERRLOG("Unknown or expired NDP cursor %u\n", cmd->cdw10);
+		nvmf_ndp_set_status(req, -EINVAL);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	if (cmd->cdw11 & NVMF_NDP_FETCH_RELEASE) {
+		SPDK_DEBUGLOG(nvmf, "Releasing NDP cursor %u\n", cursor->id);
+		nvmf_ndp_cursor_free(cursor);
+		req->xfer = SPDK_NVME_DATA_NONE;
+		nvmf_ndp_set_status(req, 0);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	if (req->iovcnt == 0 || req->length == 0) {
+		rc = -EINVAL;
+	} else {
+		rc = cursor->run_fn(cursor, bdev, desc, ch, req);
+	}
+	if (rc != 0) {
+		/* The cursor stays usable */
+		nvmf_ndp_cursor_park(cursor);
+		nvmf_ndp_set_status(req, rc);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_fetch_op = {
+	.name = "fetch",
+	.opc = SPDK_NVME_OPC_CUSTOM_FETCH,
+	.xfer = SPDK_NVME_DATA_CONTROLLER_TO_HOST,
+	.exec = nvmf_ndp_fetch_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(fetch, &g_nvmf_ndp_fetch_op);
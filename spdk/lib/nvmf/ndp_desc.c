@@ -0,0 +1,252 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Target descriptor: the layout of a host file, or of a batch of them, sent
+ * in the data buffer of an NDP command.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/endian.h"
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+void
+nvmf_ndp_desc_free(struct nvmf_ndp_desc *desc)
+{
+	free(desc->extents);
+	free(desc->files);
+	free(desc->args);
+	memset(desc, 0, sizeof(*desc));
+}
+
+uint64_t
+nvmf_ndp_desc_get_length(const struct nvmf_ndp_desc *desc, uint32_t block_size)
+{
+	uint64_t total = 0;
+	uint32_t i;
+
+	for (i = 0; i < desc->num_extents; i++) {
+		total += desc->extents[i].num_blocks * block_size;
+	}
+
+	return desc->length != 0 ? spdk_min(desc->length, total) : total;
+}
+
+static bool
+nvmf_ndp_extent_parse(const uint64_t *words, uint64_t num_blocks, struct nvmf_ndp_extent *extent)
+{
+	extent->offset_blocks = from_le64(&words[0]);
+	extent->num_blocks = from_le64(&words[1]);
+
+	return extent->num_blocks != 0 &&
+	       extent->offset_blocks + extent->num_blocks >= extent->offset_blocks &&
+	       extent->offset_blocks + extent->num_blocks <= num_blocks;
+}
+
+/* Keep the arguments NUL terminated for operators taking a string */
+static int
+nvmf_ndp_desc_copy_args(struct nvmf_ndp_desc *desc, const char *args, uint32_t args_len)
+{
+	if (args_len == 0) {
+		return 0;
+	}
+
+	desc->args = malloc(args_len + 1);
+	if (desc->args == NULL) {
+		return -ENOMEM;
+	}
+	memcpy(desc->args, args, args_len);
+	desc->args[args_len] = '\0';
+	desc->args_len = args_len;
+
+	return 0;
+}
+
+int
+nvmf_ndp_desc_parse(struct spdk_nvmf_request *req, struct spdk_bdev *bdev,
+		    uint32_t args_len, struct nvmf_ndp_desc *desc)
+{
+	uint32_t num_extents = req->cmd->nvme_cmd.cdw11;
+	uint64_t num_blocks = spdk_bdev_get_num_blocks(bdev);
+	uint32_t block_size = spdk_bdev_get_block_size(bdev);
+	uint64_t desc_size, total_blocks = 0;
+	struct nvmf_ndp_extent *extent;
+	uint64_t *words;
+	uint32_t i;
+
+	memset(desc, 0, sizeof(*desc));
+
+	if (num_extents == 0 || num_extents > NVMF_NDP_DESC_MAX_EXTENTS) {
+		SPDK_ERRLOG("Invalid number of extents %u (max %u)\n", num_extents,
+			    NVMF_NDP_DESC_MAX_EXTENTS);
+		return -EINVAL;
+	}
+
+	desc_size = NVMF_NDP_DESC_SIZE(num_extents);
+	if (desc_size + args_len > req->length) {
+		SPDK_ERRLOG("Descriptor of %u extents and %u bytes of arguments exceeds "
+			    "the %u bytes data buffer\n", num_extents, args_len, req->length);
+		return -EINVAL;
+	}
+
+	words = malloc(desc_size + args_len);
+	desc->extents = calloc(num_extents, sizeof(*desc->extents));
+	if (words == NULL || desc->extents == NULL) {
+		free(words);
+		nvmf_ndp_desc_free(desc);
+		return -ENOMEM;
+	}
+
+	/* The buffer may be split over several iovecs */
+	spdk_copy_iovs_to_buf(words, desc_size + args_len, req->iov, req->iovcnt);
+
+	desc->length = from_le64(&words[0]);
+	desc->num_extents = num_extents;
+	for (i = 0; i < num_extents; i++) {
+		extent = &desc->extents[i];
+		if (!nvmf_ndp_extent_parse(&words[1 + 2 * i], num_blocks, extent)) {
+			SPDK_ERRLOG("Extent %u (LBA %" PRIu64 ", %" PRIu64 " blocks) is out of range\n",
+				    i, extent->offset_blocks, extent->num_blocks);
+			free(words);
+			nvmf_ndp_desc_free(desc);
+			return -ERANGE;
+		}
+		total_blocks += extent->num_blocks;
+	}
+
+	if (desc->length > total_blocks * block_size) {
+		SPDK_ERRLOG("File length %" PRIu64 " exceeds its %" PRIu64 " blocks\n",
+			    desc->length, total_blocks);
+		free(words);
+		nvmf_ndp_desc_free(desc);
+		return -EINVAL;
+	}
+
+	if (nvmf_ndp_desc_copy_args(desc, (char *)words + desc_size, args_len) != 0) {
+		free(words);
+		nvmf_ndp_desc_free(desc);
+		return -ENOMEM;
+	}
+
+	free(words);
+
+	SPDK_DEBUGLOG(nvmf, "NDP descriptor: %u extents, %" PRIu64 " blocks, length %" PRIu64 "\n",
+		      num_extents, total_blocks, desc->length);
+
+	return 0;
+}
+
+int
+nvmf_ndp_desc_parse_batch(struct spdk_nvmf_request *req, struct spdk_bdev *bdev,
+			  uint32_t args_len, struct nvmf_ndp_desc *desc)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	uint32_t num_files = cmd->cdw11, num_extents = cmd->cdw12, depth = cmd->cdw13 & 0xFF;
+	uint64_t num_blocks = spdk_bdev_get_num_blocks(bdev);
+	uint32_t block_size = spdk_bdev_get_block_size(bdev);
+	uint64_t desc_size, file_blocks, n, w = 0;
+	struct nvmf_ndp_desc_file *file;
+	struct nvmf_ndp_extent *extent;
+	uint32_t i, j, next_extent = 0;
+	uint64_t *words;
+	int rc;
+
+	memset(desc, 0, sizeof(*desc));
+
+	if (num_files == 0 || num_files > NVMF_NDP_BATCH_MAX_FILES ||
+	    num_extents < num_files || num_extents > NVMF_NDP_BATCH_MAX_EXTENTS) {
+		SPDK_ERRLOG("Invalid batch of %u files and %u extents (max %u and %u)\n", num_files,
+			    num_extents, NVMF_NDP_BATCH_MAX_FILES, NVMF_NDP_BATCH_MAX_EXTENTS);
+		return -EINVAL;
+	}
+
+	desc_size = NVMF_NDP_BATCH_DESC_SIZE(num_files, num_extents);
+	if (desc_size + args_len > req->length) {
+		SPDK_ERRLOG("Batch descriptor of %u files and %u extents and %u bytes of arguments "
+			    "exceeds the %u bytes data buffer\n", num_files, num_extents, args_len,
+			    req->length);
+		return -EINVAL;
+	}
+
+	words = malloc(desc_size + args_len);
+	desc->files = calloc(num_files, sizeof(*desc->files));
+	desc->extents = calloc(num_extents, sizeof(*desc->extents));
+	if (words == NULL || desc->files == NULL || desc->extents == NULL) {
+		free(words);
+		nvmf_ndp_desc_free(desc);
+		return -ENOMEM;
+	}
+
+	spdk_copy_iovs_to_buf(words, desc_size + args_len, req->iov, req->iovcnt);
+
+	desc->num_files = num_files;
+	desc->num_extents = num_extents;
+	for (i = 0; i < num_files; i++) {
+		file = &desc->files[i];
+		file->id = from_le64(&words[w++]);
+		file->length = from_le64(&words[w++]);
+		n = from_le64(&words[w++]);
+
+		/* Never past the extents CDW12 made room for */
+		if (n == 0 || n > NVMF_NDP_DESC_MAX_EXTENTS || n > num_extents - next_extent) {
+			SPDK_ERRLOG("File %u of the batch has %" PRIu64 " extents, %u left\n", i, n,
+				    num_extents - next_extent);
+			rc = -EINVAL;
+			goto err;
+		}
+		file->first_extent = next_extent;
+		file->num_extents = n;
+
+		file_blocks = 0;
+		for (j = 0; j < n; j++) {
+			extent = &desc->extents[next_extent++];
+			if (!nvmf_ndp_extent_parse(&words[w], num_blocks, extent)) {
+				SPDK_ERRLOG("Extent %u of file %u (LBA %" PRIu64 ", %" PRIu64 " blocks) "
+					    "is out of range\n", j, i, extent->offset_blocks,
+					    extent->num_blocks);
+				rc = -ERANGE;
+				goto err;
+			}
+			w += 2;
+			file_blocks += extent->num_blocks;
+		}
+
+		if (file->length > file_blocks * block_size) {
+			SPDK_ERRLOG("Length %" PRIu64 " of file %u exceeds its %" PRIu64 " blocks\n",
+				    file->length, i, file_blocks);
+			rc = -EINVAL;
+			goto err;
+		}
+	}
+
+	if (next_extent != num_extents) {
+		SPDK_ERRLOG("Files of the batch have %u extents, not %u\n", next_extent, num_extents);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	if (nvmf_ndp_desc_copy_args(desc, (char *)words + desc_size, args_len) != 0) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	desc->opc = (cmd->cdw10 >> 16) & 0xFF;
+	desc->depth = depth == 0 ? NVMF_NDP_BATCH_DEPTH : spdk_min(depth, NVMF_NDP_BATCH_MAX_DEPTH);
+
+	free(words);
+
+	SPDK_DEBUGLOG(nvmf, "NDP batch descriptor: %u files, %u extents, operator 0x%02x\n",
+		      num_files, num_extents, desc->opc);
+
+	return 0;
+
+err:
+	free(words);
+	nvmf_ndp_desc_free(desc);
+	return rc;
+}
@@ -0,0 +1,719 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Predicate filter engine for the NDP filter operator.
+ *
+ * Every record is split into columns only as far as the program needs: the
+ * splitter stops at the last column referenced by a comparison or selected
+ * for the output.  Delimiters are located a whole vector at a time (32 bytes
+ * with AVX2, 16 with SSE4.2) by comparing against a broadcast delimiter, so
+ * the cost of a record is one pass over its referenced prefix plus the
+ * comparisons.  The predicate itself is a postfix program evaluated on a bit
+ * stack, checked for balance once when it is compiled.  Numeric columns are
+ * converted eight digits at a time within a 64 bit word.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/endian.h"
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+#if defined(__x86_64__) && defined(__AVX2__)
+#define NVMF_NDP_FILTER_HAVE_AVX2
+#include <x86intrin.h>
+#elif defined(__x86_64__) && defined(__SSE4_2__)
+#define NVMF_NDP_FILTER_HAVE_SSE4_2
+#include <x86intrin.h>
+#endif
+
+/* Longest number that is parsed as a float */
+#define NVMF_NDP_FILTER_MAX_NUM_LEN	63
+
+struct nvmf_ndp_filter_cmp {
+	uint8_t			op;
+	uint8_t			type;
+	uint16_t		column;
+	uint32_t		len;
+	const char		*str;
+	int64_t			ival;
+	double			fval;
+};
+
+struct nvmf_ndp_filter_field {
+	const char		*base;
+	uint32_t		len;
+};
+
+struct nvmf_ndp_filter {
+	char			delimiter;
+
+	uint16_t		*columns;
+	uint16_t		num_columns;
+
+	struct nvmf_ndp_filter_cmp	*insns;
+	uint16_t		num_insns;
+
+	/* Copy of the program the string constants point into */
+	char			*prog;
+
+	/* Columns split per record: the highest column referenced, plus one */
+	uint32_t		num_fields;
+	struct nvmf_ndp_filter_field	*fields;
+
+	/* Scratch iovecs describing the output of a matching record */
+	struct iovec		*out_iov;
+
+	/* Input seen by previous calls, and the end of the record being reported */
+	uint64_t		input_off;
+	uint64_t		record_end;
+
+	/* Columns split in the record being reported */
+	uint32_t		record_fields;
+};
+
+static const char g_newline = '\n';
+
+void
+nvmf_ndp_filter_free(struct nvmf_ndp_filter *filter)
+{
+	if (filter == NULL) {
+		return;
+	}
+
+	free(filter->columns);
+	free(filter->insns);
+	free(filter->prog);
+	free(filter->fields);
+	free(filter->out_iov);
+	free(filter);
+}
+
+static int
+filter_parse_insn(struct nvmf_ndp_filter *filter, struct nvmf_ndp_filter_cmp *cmp,
+		  const char *prog, size_t len, size_t *off, uint32_t *depth, uint32_t *max_depth)
+{
+	struct nvmf_ndp_filter_insn insn;
+	size_t const_off;
+	uint64_t bits;
+
+	if (len - *off < sizeof(insn)) {
+		SPDK_ERRLOG("Filter program truncated at %zu\n", *off);
+		return -EINVAL;
+	}
+	memcpy(&insn, prog + *off, sizeof(insn));
+	cmp->op = insn.op;
+	cmp->type = insn.type;
+	cmp->column = from_le16(&insn.column);
+	cmp->len = from_le32(&insn.len);
+	const_off = *off + sizeof(insn);
+
+	switch (cmp->op) {
+	case NVMF_NDP_FILTER_OP_AND:
+	case NVMF_NDP_FILTER_OP_OR:
+		if (*depth < 2 || cmp->len != 0) {
+			goto invalid;
+		}
+		(*depth)--;
+		*off = const_off;
+		return 0;
+	case NVMF_NDP_FILTER_OP_NOT:
+		if (*depth < 1 || cmp->len != 0) {
+			goto invalid;
+		}
+		*off = const_off;
+		return 0;
+	case NVMF_NDP_FILTER_OP_EQ:
+	case NVMF_NDP_FILTER_OP_NE:
+	case NVMF_NDP_FILTER_OP_LT:
+	case NVMF_NDP_FILTER_OP_LE:
+	case NVMF_NDP_FILTER_OP_GT:
+	case NVMF_NDP_FILTER_OP_GE:
+	case NVMF_NDP_FILTER_OP_CONTAINS:
+		break;
+	default:
+		goto invalid;
+	}
+
+	if (cmp->column > NVMF_NDP_FILTER_MAX_COLUMN || cmp->len > len - const_off) {
+		goto invalid;
+	}
+
+	switch (cmp->type) {
+	case NVMF_NDP_FILTER_TYPE_STRING:
+		if (cmp->op == NVMF_NDP_FILTER_OP_CONTAINS && cmp->len == 0) {
+			goto invalid;
+		}
+		cmp->str = prog + const_off;
+		break;
+	case NVMF_NDP_FILTER_TYPE_INT:
+		if (cmp->op == NVMF_NDP_FILTER_OP_CONTAINS || cmp->len != sizeof(uint64_t)) {
+			goto invalid;
+		}
+		cmp->ival = (int64_t)from_le64(prog + const_off);
+		break;
+	case NVMF_NDP_FILTER_TYPE_FLOAT:
+		if (cmp->op == NVMF_NDP_FILTER_OP_CONTAINS || cmp->len != sizeof(uint64_t)) {
+			goto invalid;
+		}
+		/* The host sends the bit pattern of the double */
+		bits = from_le64(prog + const_off);
+		memcpy(&cmp->fval, &bits, sizeof(cmp->fval));
+		break;
+	default:
+		goto invalid;
+	}
+
+	if (++(*depth) > NVMF_NDP_FILTER_MAX_DEPTH) {
+		goto invalid;
+	}
+	*max_depth = spdk_max(*max_depth, *depth);
+	filter->num_fields = spdk_max(filter->num_fields, (uint32_t)cmp->column + 1);
+	*off = const_off + SPDK_ALIGN_CEIL((size_t)cmp->len, 8);
+	if (*off > len) {
+		/* The padding of the last constant may be missing */
+		*off = len;
+	}
+
+	return 0;
+
+invalid:
+	SPDK_ERRLOG("Invalid filter instruction at %zu: op %u type %u column %u len %u\n",
+		    *off, cmp->op, cmp->type, cmp->column, cmp->len);
+	return -EINVAL;
+}
+
+struct nvmf_ndp_filter *
+nvmf_ndp_filter_create(const void *prog, size_t len)
+{
+	struct nvmf_ndp_filter_hdr hdr;
+	struct nvmf_ndp_filter *filter;
+	uint32_t depth = 0, max_depth = 0, i;
+	size_t off;
+
+	if (len < sizeof(hdr)) {
+		SPDK_ERRLOG("Filter program too short: %zu bytes\n", len);
+		return NULL;
+	}
+
+	memcpy(&hdr, prog, sizeof(hdr));
+	hdr.num_columns = from_le16(&hdr.num_columns);
+	hdr.num_insns = from_le16(&hdr.num_insns);
+	if (from_le32(&hdr.magic) != NVMF_NDP_FILTER_MAGIC || hdr.delimiter == '\n' ||
+	    hdr.num_columns > NVMF_NDP_FILTER_MAX_COLUMNS ||
+	    hdr.num_insns > NVMF_NDP_FILTER_MAX_INSNS) {
+		SPDK_ERRLOG("Invalid filter program header\n");
+		return NULL;
+	}
+
+	filter = calloc(1, sizeof(*filter));
+	if (filter == NULL) {
+		return NULL;
+	}
+
+	filter->delimiter = hdr.delimiter;
+	filter->num_columns = hdr.num_columns;
+	filter->num_insns = hdr.num_insns;
+	filter->prog = malloc(len);
+	filter->columns = calloc(spdk_max(hdr.num_columns, 1), sizeof(*filter->columns));
+	filter->insns = calloc(spdk_max(hdr.num_insns, 1), sizeof(*filter->insns));
+	/* The columns and the delimiters between them, or the whole record, then the newline */
+	filter->out_iov = calloc(spdk_max(2 * hdr.num_columns, 2), sizeof(*filter->out_iov));
+	if (filter->prog == NULL || filter->columns == NULL || filter->insns == NULL ||
+	    filter->out_iov == NULL) {
+		goto err;
+	}
+	memcpy(filter->prog, prog, len);
+
+	off = sizeof(hdr);
+	if (len - off < SPDK_ALIGN_CEIL(hdr.num_columns * sizeof(uint16_t), 8)) {
+		SPDK_ERRLOG("Filter program truncated in the column list\n");
+		goto err;
+	}
+	for (i = 0; i < hdr.num_columns; i++) {
+		filter->columns[i] = from_le16(filter->prog + off + i * sizeof(uint16_t));
+		if (filter->columns[i] > NVMF_NDP_FILTER_MAX_COLUMN) {
+			SPDK_ERRLOG("Invalid filter column %u\n", filter->columns[i]);
+			goto err;
+		}
+		filter->num_fields = spdk_max(filter->num_fields, (uint32_t)filter->columns[i] + 1);
+	}
+	off += SPDK_ALIGN_CEIL(hdr.num_columns * sizeof(uint16_t), 8);
+
+	for (i = 0; i < hdr.num_insns; i++) {
+		if (filter_parse_insn(filter, &filter->insns[i], filter->prog, len, &off, &depth,
+				      &max_depth) != 0) {
+			goto err;
+		}
+	}
+
+	/* Without any instruction, every record matches */
+	if (depth != (hdr.num_insns > 0 ? 1u : 0u)) {
+		SPDK_ERRLOG("Filter program leaves %u values on the stack\n", depth);
+		goto err;
+	}
+
+	filter->fields = calloc(spdk_max(filter->num_fields, 1), sizeof(*filter->fields));
+	if (filter->fields == NULL) {
+		goto err;
+	}
+
+	SPDK_DEBUGLOG(nvmf, "Compiled filter with %u instructions (stack depth %u), %u columns "
+		      "split, %u selected\n", filter->num_insns, max_depth, filter->num_fields,
+		      filter->num_columns);
+
+	return filter;
+
+err:
+	nvmf_ndp_filter_free(filter);
+	return NULL;
+}
+
+/* Close the field started at start at the delimiter at pos.  Returns true once all are split. */
+static inline bool
+filter_add_field(struct nvmf_ndp_filter *filter, const char *rec, size_t *start, size_t pos,
+		 uint32_t *n)
+{
+	filter->fields[*n].base = rec + *start;
+	filter->fields[*n].len = pos - *start;
+	*start = pos + 1;
+
+	return ++(*n) == filter->num_fields;
+}
+
+/* Split rec into at most num_fields columns.  Returns the number of columns found. */
+static uint32_t
+filter_split(struct nvmf_ndp_filter *filter, const char *rec, size_t len)
+{
+	size_t i = 0, start = 0;
+	uint32_t n = 0;
+	const char *d;
+
+	if (filter->num_fields == 0) {
+		return 0;
+	}
+
+#if defined(NVMF_NDP_FILTER_HAVE_AVX2)
+	const __m256i delim = _mm256_set1_epi8(filter->delimiter);
+	uint32_t hits;
+
+	for (; i + 32 <= len; i += 32) {
+		hits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *)(rec + i)), delim));
+		while (hits != 0) {
+			if (filter_add_field(filter, rec, &start, i + __builtin_ctz(hits), &n)) {
+				return n;
+			}
+			hits &= hits - 1;
+		}
+	}
+#elif defined(NVMF_NDP_FILTER_HAVE_SSE4_2)
+	const __m128i delim = _mm_set1_epi8(filter->delimiter);
+	uint32_t hits;
+
+	for (; i + 16 <= len; i += 16) {
+		hits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *)(rec + i)), delim));
+		while (hits != 0) {
+			if (filter_add_field(filter, rec, &start, i + __builtin_ctz(hits), &n)) {
+				return n;
+			}
+			hits &= hits - 1;
+		}
+	}
+#endif
+
+	while (i < len && (d = memchr(rec + i, filter->delimiter, len - i)) != NULL) {
+		if (filter_add_field(filter, rec, &start, d - rec, &n)) {
+			return n;
+		}
+		i = d - rec + 1;
+	}
+
+	/* The rest of the record is the last column */
+	filter_add_field(filter, rec, &start, len, &n);
+
+	return n;
+}
+
+static void
+filter_trim(const char **p, uint32_t *len)
+{
+	while (*len > 0 && isspace((unsigned char)**p)) {
+		(*p)++;
+		(*len)--;
+	}
+	while (*len > 0 && isspace((unsigned char)(*p)[*len - 1])) {
+		(*len)--;
+	}
+}
+
+/* True if all 8 bytes of v, the first one in the low byte, are decimal digits */
+static inline bool
+parse_is_8_digits(uint64_t v)
+{
+	return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+		(((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+	       0x3333333333333333ULL;
+}
+
+/* Value of the 8 digits in v, combining pairs, then quads, then both halves */
+static inline uint32_t
+parse_8_digits(uint64_t v)
+{
+	v = ((v & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+	v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+	return (uint32_t)(((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+/*
+ * Append the decimal digits at p to *val, eight at a time as long as possible.
+ * Returns the number of digits consumed.  *val wraps past 19 digits.
+ */
+static uint32_t
+parse_digits(const char *p, uint32_t len, uint64_t *val)
+{
+	uint64_t v = *val, w;
+	uint32_t i = 0;
+
+	while (len - i >= 8) {
+		w = from_le64(p + i);
+		if (!parse_is_8_digits(w)) {
+			break;
+		}
+		v = v * 100000000 + parse_8_digits(w);
+		i += 8;
+	}
+	while (i < len && p[i] >= '0' && p[i] <= '9') {
+		v = v * 10 + (p[i] - '0');
+		i++;
+	}
+
+	*val = v;
+	return i;
+}
+
+static inline uint32_t
+parse_skip_zeros(const char *p, uint32_t len)
+{
+	uint32_t i = 0;
+
+	while (i < len && p[i] == '0') {
+		i++;
+	}
+
+	return i;
+}
+
+bool
+nvmf_ndp_parse_int(const char *p, uint32_t len, int64_t *val)
+{
+	uint64_t v = 0, limit = INT64_MAX;
+	bool neg = false;
+	uint32_t i = 0, n;
+
+	filter_trim(&p, &len);
+	if (len > 0 && (p[0] == '-' || p[0] == '+')) {
+		neg = p[0] == '-';
+		limit += neg;
+		i++;
+	}
+	if (i == len) {
+		return false;
+	}
+
+	i += parse_skip_zeros(p + i, len - i);
+	n = parse_digits(p + i, len - i, &v);
+	/* 19 digits can't wrap, but may be above the limit */
+	if (i + n != len || n > 19 || v > limit) {
+		return false;
+	}
+
+	*val = neg ? (int64_t)(0 - v) : (int64_t)v;
+	return true;
+}
+
+/* Powers of ten exactly representable as a double */
+static const double g_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+};
+
+bool
+nvmf_ndp_parse_float(const char *p, uint32_t len, double *val)
+{
+	char buf[NVMF_NDP_FILTER_MAX_NUM_LEN + 1];
+	uint32_t i = 0, zeros, n_int, n_frac = 0;
+	bool neg = false;
+	uint64_t v = 0;
+	char *end;
+
+	filter_trim(&p, &len);
+	if (len > 0 && (p[0] == '-' || p[0] == '+')) {
+		neg = p[0] == '-';
+		i++;
+	}
+
+	/*
+	 * Plain decimals of up to 15 significant digits are exact as an integer
+	 * divided by a power of ten, and the division is correctly rounded.
+	 */
+	zeros = parse_skip_zeros(p + i, len - i);
+	i += zeros;
+	n_int = parse_digits(p + i, len - i, &v);
+	i += n_int;
+	if (i < len && p[i] == '.') {
+		i++;
+		n_frac = parse_digits(p + i, len - i, &v);
+		i += n_frac;
+	}
+	if (i == len && zeros + n_int + n_frac > 0 && n_int + n_frac <= 15) {
+		*val = (double)v / g_pow10[n_frac];
+		*val = neg ? -*val : *val;
+		return true;
+	}
+
+	/* Exponents, long mantissas, infinities */
+	if (len == 0 || len > NVMF_NDP_FILTER_MAX_NUM_LEN) {
+		return false;
+	}
+
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	*val = strtod(buf, &end);
+
+	return end == buf + len && !isnan(*val);
+}
+
+static inline bool
+filter_cmp_result(uint8_t op, int c)
+{
+	switch (op) {
+	case NVMF_NDP_FILTER_OP_EQ:
+		return c == 0;
+	case NVMF_NDP_FILTER_OP_NE:
+		return c != 0;
+	case NVMF_NDP_FILTER_OP_LT:
+		return c < 0;
+	case NVMF_NDP_FILTER_OP_LE:
+		return c <= 0;
+	case NVMF_NDP_FILTER_OP_GT:
+		return c > 0;
+	default:
+		return c >= 0;
+	}
+}
+
+static bool
+filter_compare(const struct nvmf_ndp_filter_cmp *cmp, const struct nvmf_ndp_filter_field *field)
+{
+	int64_t ival;
+	double fval;
+	int c;
+
+	switch (cmp->type) {
+	case NVMF_NDP_FILTER_TYPE_STRING:
+		if (cmp->op == NVMF_NDP_FILTER_OP_CONTAINS) {
+			return memmem(field->base, field->len, cmp->str, cmp->len) != NULL;
+		}
+		c = memcmp(field->base, cmp->str, spdk_min(field->len, cmp->len));
+		if (c == 0) {
+			c = (field->len > cmp->len) - (field->len < cmp->len);
+		}
+		break;
+	case NVMF_NDP_FILTER_TYPE_INT:
+		if (!nvmf_ndp_parse_int(field->base, field->len, &ival)) {
+			return false;
+		}
+		c = (ival > cmp->ival) - (ival < cmp->ival);
+		break;
+	default:
+		if (!nvmf_ndp_parse_float(field->base, field->len, &fval) || isnan(cmp->fval)) {
+			return false;
+		}
+		c = (fval > cmp->fval) - (fval < cmp->fval);
+		break;
+	}
+
+	return filter_cmp_result(cmp->op, c);
+}
+
+static bool
+filter_eval(const struct nvmf_ndp_filter *filter, uint32_t num_fields)
+{
+	const struct nvmf_ndp_filter_cmp *cmp;
+	uint64_t stack = 0, top;
+	uint32_t i;
+
+	for (i = 0; i < filter->num_insns; i++) {
+		cmp = &filter->insns[i];
+		switch (cmp->op) {
+		case NVMF_NDP_FILTER_OP_AND:
+			top = stack & 1;
+			stack >>= 1;
+			stack &= ~(uint64_t)1 | top;
+			break;
+		case NVMF_NDP_FILTER_OP_OR:
+			top = stack & 1;
+			stack >>= 1;
+			stack |= top;
+			break;
+		case NVMF_NDP_FILTER_OP_NOT:
+			stack ^= 1;
+			break;
+		default:
+			stack <<= 1;
+			if (cmp->column < num_fields && filter_compare(cmp, &filter->fields[cmp->column])) {
+				stack |= 1;
+			}
+			break;
+		}
+	}
+
+	return filter->num_insns == 0 || (stack & 1);
+}
+
+/* Report the record, or its selected columns, terminated by a newline. */
+static int
+filter_report(struct nvmf_ndp_filter *filter, const char *rec, size_t len, uint32_t num_fields,
+	      nvmf_ndp_filter_match_fn match_fn, void *cb_arg)
+{
+	struct iovec *iov = filter->out_iov;
+	const struct nvmf_ndp_filter_field *field;
+	int n = 0;
+	uint32_t i;
+
+	if (filter->num_columns == 0) {
+		if (len > 0) {
+			iov[n].iov_base = (char *)rec;
+			iov[n].iov_len = len;
+			n++;
+		}
+	} else {
+		for (i = 0; i < filter->num_columns; i++) {
+			if (i > 0) {
+				iov[n].iov_base = &filter->delimiter;
+				iov[n].iov_len = 1;
+				n++;
+			}
+
+			/* A missing column is returned empty */
+			field = &filter->fields[filter->columns[i]];
+			if (filter->columns[i] < num_fields && field->len > 0) {
+				iov[n].iov_base = (char *)field->base;
+				iov[n].iov_len = field->len;
+				n++;
+			}
+		}
+	}
+
+	iov[n].iov_base = (char *)&g_newline;
+	iov[n].iov_len = 1;
+	n++;
+
+	return match_fn(cb_arg, iov, n);
+}
+
+int
+nvmf_ndp_filter_scan(struct nvmf_ndp_filter *filter, struct iovec *iov, int iovcnt,
+		     nvmf_ndp_filter_match_fn match_fn, void *cb_arg)
+{
+	const char *p, *nl;
+	size_t off, end, next, len;
+	uint32_t num_fields;
+	int i, rc;
+
+	for (i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+
+		for (off = 0; off < len; off = next) {
+			nl = memchr(p + off, '\n', len - off);
+			end = nl != NULL ? (size_t)(nl - p) : len;
+			next = nl != NULL ? end + 1 : len;
+
+			/* Records from DOS text end with "\r\n" */
+			if (end > off && p[end - 1] == '\r') {
+				end--;
+			}
+
+			num_fields = filter_split(filter, p + off, end - off);
+			if (!filter_eval(filter, num_fields)) {
+				continue;
+			}
+
+			filter->record_end = filter->input_off + next;
+			filter->record_fields = num_fields;
+			rc = filter_report(filter, p + off, end - off, num_fields, match_fn, cb_arg);
+			if (rc != 0) {
+				filter->input_off += next;
+				return rc;
+			}
+		}
+		filter->input_off += len;
+	}
+
+	return 0;
+}
+
+uint64_t
+nvmf_ndp_filter_record_end(const struct nvmf_ndp_filter *filter)
+{
+	return filter->record_end;
+}
+
+uint16_t
+nvmf_ndp_filter_num_columns(const struct nvmf_ndp_filter *filter)
+{
+	return filter->num_columns;
+}
+
+const char *
+nvmf_ndp_filter_column(const struct nvmf_ndp_filter *filter, uint16_t i, uint32_t *len)
+{
+	const struct nvmf_ndp_filter_field *field;
+
+	if (i >= filter->num_columns || filter->columns[i] >= filter->record_fields) {
+		return NULL;
+	}
+
+	field = &filter->fields[filter->columns[i]];
+	*len = field->len;
+	return field->base;
+}
+
+int
+nvmf_ndp_filter_split_column(struct nvmf_ndp_filter *filter, uint16_t column)
+{
+	struct nvmf_ndp_filter_field *fields;
+
+	if (column > NVMF_NDP_FILTER_MAX_COLUMN) {
+		return -EINVAL;
+	}
+	if (column < filter->num_fields) {
+		return 0;
+	}
+
+	fields = realloc(filter->fields, ((size_t)column + 1) * sizeof(*fields));
+	if (fields == NULL) {
+		return -ENOMEM;
+	}
+	filter->fields = fields;
+	filter->num_fields = (uint32_t)column + 1;
+
+	return 0;
+}
+
+const char *
+nvmf_ndp_filter_field(const struct nvmf_ndp_filter *filter, uint16_t column, uint32_t *len)
+{
+	if (column >= filter->record_fields) {
+		return NULL;
+	}
+
+	*len = filter->fields[column].len;
+	return filter->fields[column].base;
+}
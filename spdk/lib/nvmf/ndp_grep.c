@@ -0,0 +1,480 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Multi-keyword grep engine for the NDP grep operator.
+ *
+ * The keywords are compiled into an Aho-Corasick automaton with a full
+ * transition table, so every input byte costs a single table lookup and all
+ * keywords are matched in one pass.  Most of the input is spent in the root
+ * state, where only a byte starting a keyword (or a newline) changes anything.
+ * Such bytes are looked for with a nibble based byte set classifier (two
+ * pshufb lookups per vector, as in Teddy), so runs of uninteresting bytes are
+ * skipped a whole vector at a time.  Once a line has matched, the rest of it
+ * is skipped with memchr(), which libc vectorizes as well.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+#if defined(__x86_64__) && defined(__AVX2__)
+#define NVMF_NDP_GREP_HAVE_AVX2
+#include <x86intrin.h>
+#elif defined(__x86_64__) && defined(__SSE4_2__)
+#define NVMF_NDP_GREP_HAVE_SSE4_2
+#include <x86intrin.h>
+#endif
+
+#define NVMF_NDP_GREP_ROOT	0
+
+struct nvmf_ndp_grep {
+	/* Automaton: delta[state * 256 + byte] is the next state. */
+	uint16_t		*delta;
+	uint8_t			*accept;
+	uint32_t		num_states;
+	uint32_t		num_patterns;
+
+	/* Bytes that leave the root state, plus '\n'. */
+	bool			interesting[256];
+
+	/*
+	 * Byte set classifier: byte b may be interesting only if
+	 * nibble_lo[b & 0xf] & nibble_hi[b >> 4] is non-zero.
+	 */
+	uint8_t			nibble_lo[16];
+	uint8_t			nibble_hi[16];
+
+	/* Scan state, kept across calls */
+	uint16_t		state;
+	bool			matched;
+
+	/* Beginning of the current line, seen by previous calls */
+	char			*carry;
+	uint32_t		carry_len;
+	uint32_t		max_line_len;
+	bool			truncated;
+
+	/* Input seen by previous calls, and the end of the line being reported */
+	uint64_t		input_off;
+	uint64_t		line_end;
+
+	/* Scratch iovecs describing a matching line */
+	struct iovec		*line_iov;
+	int			line_iov_cap;
+};
+
+static int
+grep_build(struct nvmf_ndp_grep *grep, const char *patterns, size_t len)
+{
+	const char *p, *end, *nl;
+	uint32_t *queue, *fail;
+	uint32_t head, tail, s, t, f;
+	size_t max_states = len + 1;
+	uint16_t *delta;
+	int b;
+
+	grep->delta = calloc(max_states * 256, sizeof(*grep->delta));
+	grep->accept = calloc(max_states, sizeof(*grep->accept));
+	queue = calloc(max_states, sizeof(*queue));
+	fail = calloc(max_states, sizeof(*fail));
+	if (grep->delta == NULL || grep->accept == NULL || queue == NULL || fail == NULL) {
+		free(queue);
+		free(fail);
+		return -ENOMEM;
+	}
+
+	/* Build the trie.  No edge leads to the root, so 0 doubles as "no edge". */
+	grep->num_states = 1;
+	for (p = patterns, end = patterns + len; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (nl == NULL) {
+			nl = end;
+		}
+
+		s = NVMF_NDP_GREP_ROOT;
+		for (; p < nl; p++) {
+			t = grep->delta[s * 256 + (uint8_t)*p];
+			if (t == 0) {
+				t = grep->num_states++;
+				grep->delta[s * 256 + (uint8_t)*p] = t;
+			}
+			s = t;
+		}
+		if (s != NVMF_NDP_GREP_ROOT && !grep->accept[s]) {
+			grep->accept[s] = 1;
+			grep->num_patterns++;
+		}
+	}
+
+	/*
+	 * Turn the trie into a DFA, breadth first.  A missing edge takes the
+	 * edge of the failure state, which is shallower and therefore already
+	 * complete.  A state also accepts if its failure state does.  The
+	 * failure state of the depth 1 states is the root, whose missing edges
+	 * already lead back to the root.
+	 */
+	head = tail = 0;
+	for (b = 0; b < 256; b++) {
+		if (grep->delta[b] != 0) {
+			queue[tail++] = grep->delta[b];
+		}
+	}
+
+	while (head < tail) {
+		s = queue[head++];
+		for (b = 0; b < 256; b++) {
+			t = grep->delta[s * 256 + b];
+			f = grep->delta[fail[s] * 256 + b];
+			if (t == 0) {
+				grep->delta[s * 256 + b] = f;
+				continue;
+			}
+			fail[t] = f;
+			grep->accept[t] |= grep->accept[f];
+			queue[tail++] = t;
+		}
+	}
+
+	free(queue);
+	free(fail);
+
+	/* A newline ends the line, and with it any partial match. */
+	for (s = 0; s < grep->num_states; s++) {
+		grep->delta[s * 256 + '\n'] = NVMF_NDP_GREP_ROOT;
+	}
+
+	delta = realloc(grep->delta, grep->num_states * 256 * sizeof(*grep->delta));
+	if (delta != NULL) {
+		grep->delta = delta;
+	}
+
+	return 0;
+}
+
+static void
+grep_build_classifier(struct nvmf_ndp_grep *grep)
+{
+	int8_t bucket[16];
+	int next_bucket = 0;
+	uint8_t bit;
+	int b;
+
+	/*
+	 * Bytes sharing a high nibble go to the same one of the 8 buckets, so
+	 * the classifier is exact as long as the interesting bytes use no more
+	 * than 8 different high nibbles (always true for 7 bit ASCII).  Beyond
+	 * that it may report false positives, which the automaton filters out.
+	 */
+	memset(bucket, -1, sizeof(bucket));
+	for (b = 0; b < 256; b++) {
+		grep->interesting[b] = b == '\n' || grep->delta[b] != NVMF_NDP_GREP_ROOT;
+		if (!grep->interesting[b]) {
+			continue;
+		}
+
+		if (bucket[b >> 4] < 0) {
+			bucket[b >> 4] = next_bucket++ % 8;
+		}
+		bit = 1 << bucket[b >> 4];
+		grep->nibble_lo[b & 0xf] |= bit;
+		grep->nibble_hi[b >> 4] |= bit;
+	}
+}
+
+/* Return the offset of the first byte in p that may leave the root state, or len. */
+static inline size_t
+grep_skip(const struct nvmf_ndp_grep *grep, const uint8_t *p, size_t len)
+{
+	size_t i = 0;
+
+#if defined(NVMF_NDP_GREP_HAVE_AVX2)
+	const __m256i lo_tbl = _mm256_broadcastsi128_si256(
+				       _mm_loadu_si128((const __m128i *)grep->nibble_lo));
+	const __m256i hi_tbl = _mm256_broadcastsi128_si256(
+				       _mm_loadu_si128((const __m128i *)grep->nibble_hi));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, lo, hi;
+	uint32_t hits;
+
+	for (; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		lo = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(v, mask));
+		hi = _mm256_shuffle_epi8(hi_tbl, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		v = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero);
+		hits = ~(uint32_t)_mm256_movemask_epi8(v);
+		if (hits != 0) {
+			return i + __builtin_ctz(hits);
+		}
+	}
+#elif defined(NVMF_NDP_GREP_HAVE_SSE4_2)
+	const __m128i lo_tbl = _mm_loadu_si128((const __m128i *)grep->nibble_lo);
+	const __m128i hi_tbl = _mm_loadu_si128((const __m128i *)grep->nibble_hi);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, lo, hi;
+	uint32_t hits;
+
+	for (; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		lo = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(v, mask));
+		hi = _mm_shuffle_epi8(hi_tbl, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		v = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero);
+		hits = ~(uint32_t)_mm_movemask_epi8(v) & 0xffff;
+		if (hits != 0) {
+			return i + __builtin_ctz(hits);
+		}
+	}
+#endif
+
+	while (i < len && !grep->interesting[p[i]]) {
+		i++;
+	}
+
+	return i;
+}
+
+static int
+grep_reserve_iov(struct nvmf_ndp_grep *grep, int iovcnt)
+{
+	struct iovec *line_iov;
+
+	if (iovcnt <= grep->line_iov_cap) {
+		return 0;
+	}
+
+	line_iov = realloc(grep->line_iov, iovcnt * sizeof(*line_iov));
+	if (line_iov == NULL) {
+		return -ENOMEM;
+	}
+	grep->line_iov = line_iov;
+	grep->line_iov_cap = iovcnt;
+
+	return 0;
+}
+
+/* Report the line from (start_iov, start_off) up to, not including, (end_iov, end_off). */
+static int
+grep_report(struct nvmf_ndp_grep *grep, struct iovec *iov, int start_iov, size_t start_off,
+	    int end_iov, size_t end_off, nvmf_ndp_grep_match_fn match_fn, void *cb_arg)
+{
+	size_t begin, end;
+	int n = 0, i;
+
+	if (grep->carry_len > 0) {
+		grep->line_iov[n].iov_base = grep->carry;
+		grep->line_iov[n].iov_len = grep->carry_len;
+		n++;
+	}
+
+	/* Only the kept beginning of an overlong line is reported */
+	if (!grep->truncated) {
+		for (i = start_iov; i <= end_iov; i++) {
+			begin = i == start_iov ? start_off : 0;
+			end = i == end_iov ? end_off : iov[i].iov_len;
+			if (end > begin) {
+				grep->line_iov[n].iov_base = (char *)iov[i].iov_base + begin;
+				grep->line_iov[n].iov_len = end - begin;
+				n++;
+			}
+		}
+	}
+
+	return match_fn(cb_arg, grep->line_iov, n);
+}
+
+/* Save the unfinished line starting at (start_iov, start_off) for the next call. */
+static void
+grep_carry(struct nvmf_ndp_grep *grep, struct iovec *iov, int iovcnt, int start_iov,
+	   size_t start_off)
+{
+	size_t begin, len;
+	int i;
+
+	for (i = start_iov; i < iovcnt; i++) {
+		begin = i == start_iov ? start_off : 0;
+		if (begin >= iov[i].iov_len) {
+			continue;
+		}
+
+		len = iov[i].iov_len - begin;
+		if (len > grep->max_line_len - grep->carry_len) {
+			len = grep->max_line_len - grep->carry_len;
+			grep->truncated = true;
+		}
+		memcpy(grep->carry + grep->carry_len, (char *)iov[i].iov_base + begin, len);
+		grep->carry_len += len;
+	}
+}
+
+static void
+grep_reset_line(struct nvmf_ndp_grep *grep)
+{
+	grep->state = NVMF_NDP_GREP_ROOT;
+	grep->matched = false;
+	grep->carry_len = 0;
+	grep->truncated = false;
+}
+
+int
+nvmf_ndp_grep_scan(struct nvmf_ndp_grep *grep, struct iovec *iov, int iovcnt,
+		   nvmf_ndp_grep_match_fn match_fn, void *cb_arg)
+{
+	const uint16_t *delta = grep->delta;
+	uint32_t state = grep->state;
+	bool matched = grep->matched;
+	const uint8_t *p, *nl;
+	size_t off, len, start_off = 0;
+	uint64_t base = grep->input_off;
+	int i, start_iov = 0, rc;
+
+	if (grep_reserve_iov(grep, iovcnt + 1) != 0) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+		off = 0;
+
+		while (off < len) {
+			if (matched) {
+				/* The line is reported anyway, only its end matters */
+				nl = memchr(p + off, '\n', len - off);
+				if (nl == NULL) {
+					break;
+				}
+				off = nl - p;
+			} else {
+				if (state == NVMF_NDP_GREP_ROOT) {
+					off += grep_skip(grep, p + off, len - off);
+					if (off == len) {
+						break;
+					}
+				}
+
+				state = delta[state * 256 + p[off]];
+				if (grep->accept[state]) {
+					matched = true;
+				}
+				if (p[off] != '\n') {
+					off++;
+					continue;
+				}
+			}
+
+			/* End of line */
+			off++;
+			rc = 0;
+			if (matched) {
+				grep->line_end = base + off;
+				rc = grep_report(grep, iov, start_iov, start_off, i, off,
+						 match_fn, cb_arg);
+			}
+			grep_reset_line(grep);
+			state = NVMF_NDP_GREP_ROOT;
+			matched = false;
+			start_iov = i;
+			start_off = off;
+			if (rc != 0) {
+				grep->input_off = base + off;
+				return rc;
+			}
+		}
+		base += len;
+	}
+
+	grep->input_off = base;
+	grep_carry(grep, iov, iovcnt, start_iov, start_off);
+	grep->state = state;
+	grep->matched = matched;
+
+	return 0;
+}
+
+int
+nvmf_ndp_grep_finish(struct nvmf_ndp_grep *grep, nvmf_ndp_grep_match_fn match_fn,
+		     void *cb_arg)
+{
+	struct iovec iov;
+	int rc = 0;
+
+	if (grep->matched && grep->carry_len > 0) {
+		iov.iov_base = grep->carry;
+		iov.iov_len = grep->carry_len;
+		grep->line_end = grep->input_off;
+		rc = match_fn(cb_arg, &iov, 1);
+	}
+	grep_reset_line(grep);
+	grep->input_off = 0;
+
+	return rc;
+}
+
+uint64_t
+nvmf_ndp_grep_line_end(const struct nvmf_ndp_grep *grep)
+{
+	return grep->line_end;
+}
+
+uint32_t
+nvmf_ndp_grep_num_patterns(const struct nvmf_ndp_grep *grep)
+{
+	return grep->num_patterns;
+}
+
+void
+nvmf_ndp_grep_free(struct nvmf_ndp_grep *grep)
+{
+	if (grep == NULL) {
+		return;
+	}
+
+	free(grep->delta);
+	free(grep->accept);
+	free(grep->carry);
+	free(grep->line_iov);
+	free(grep);
+}
+
+struct nvmf_ndp_grep *
+nvmf_ndp_grep_create(const char *patterns, size_t len, uint32_t max_line_len)
+{
+	struct nvmf_ndp_grep *grep;
+
+	if (len > NVMF_NDP_GREP_MAX_PATTERN_LEN) {
+		SPDK_ERRLOG("Grep keywords too long: %zu > %u bytes\n", len,
+			    NVMF_NDP_GREP_MAX_PATTERN_LEN);
+		return NULL;
+	}
+
+	grep = calloc(1, sizeof(*grep));
+	if (grep == NULL) {
+		return NULL;
+	}
+
+	grep->max_line_len = max_line_len != 0 ? max_line_len : NVMF_NDP_STREAM_MAX_RECORD_LEN;
+	grep->carry = malloc(grep->max_line_len);
+	if (grep->carry == NULL || grep_build(grep, patterns, len) != 0) {
+		nvmf_ndp_grep_free(grep);
+		return NULL;
+	}
+
+	if (grep->num_patterns == 0) {
+		SPDK_ERRLOG("No grep keyword given\n");
+		nvmf_ndp_grep_free(grep);
+		return NULL;
+	}
+
+	grep_build_classifier(grep);
+
+	SPDK_DEBUGLOG(nvmf, "Compiled %u grep keywords into %u states\n",
+		      grep->num_patterns, grep->num_states);
+
+	return grep;
+}
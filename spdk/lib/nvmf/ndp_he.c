@@ -0,0 +1,1547 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * HEaaN operators: homomorphic operations on ciphertexts stored as files on
+ * the namespace, the result being written to another file in place.  Add,
+ * subtract and multiply take two inputs, decrypt and bootstrap one; all of
+ * them go through the same gather, evaluate and scatter stages, only the
+ * evaluation differing.  CDW14 holds the parameters of the operation
+ * (NVMF_HEAAN_F_*).
+ *
+ * A file is described by the offset of the ciphertext in it followed by the
+ * (byte offset, byte length) pair of every extent, all 64 bit words.  An
+ * operation reads its inputs with one gather, deserializes and evaluates
+ * them on an NDP offload thread, and scatters the serialized result to the
+ * extents of the output file.  Packed ciphertexts (see ndp_he_ct.c) skip
+ * the deserialization: add and subtract use them in place and write the
+ * result straight into the output buffer.  Multiplying RNS packed
+ * ciphertexts is split by prime over several offload threads, each
+ * transforming and multiplying its share of the residues, the result being
+ * written once all of them are done.
+ *
+ * An operation on its own (heaan_cipadd, heaan_cipsub, ...) has the
+ * descriptors of its inputs and of its output following each other, their
+ * numbers of extents being in CDW11, CDW12 and, for two inputs, CDW13.
+ *
+ * heaan_batch runs the operation of CDW10 bits 23:16 over many (inputs,
+ * output) tuples.  Each file is then described by its offset, its number of
+ * extents and the extents, tuple after tuple; CDW11 holds the number of
+ * tuples, CDW12 the total number of extents and CDW13 bits 7:0 how many
+ * tuples are processed at once (0 for NVMF_HEAAN_DEPTH).  The reads, the
+ * evaluations, spread over the offload threads, and the writes of those
+ * tuples overlap, so the throughput grows with the size of the batch rather
+ * than being bound by the latency of one operation.
+ *
+ * All complete with CQE DW0 set to the number of tuples processed before
+ * the first failure, i.e. the number of tuples on success.  An aborted or
+ * timed out command stops before the next tuple is started or evaluated;
+ * DW0 then counts the tuples written back before that.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/bdev.h"
+#include "spdk/crc32.h"
+#include "spdk/endian.h"
+#include "spdk/env.h"
+#include "spdk/log.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/nvmf_ndp.h"
+#include "spdk/string.h"
+#include "spdk/util.h"
+
+void
+spdk_nvmf_ndp_he_opts_init(struct spdk_nvmf_ndp_he_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->log_q = SPDK_NVMF_NDP_HE_DEFAULT_LOG_Q;
+	opts->log_p = SPDK_NVMF_NDP_HE_DEFAULT_LOG_P;
+	opts->log_slots = SPDK_NVMF_NDP_HE_DEFAULT_LOG_SLOTS;
+	opts->log_t = SPDK_NVMF_NDP_HE_DEFAULT_LOG_T;
+	opts->log_key_q = SPDK_NVMF_NDP_HE_DEFAULT_LOG_KEY_Q;
+	opts->log_n = SPDK_NVMF_NDP_HE_DEFAULT_LOG_N;
+	opts->num_bufs = SPDK_NVMF_NDP_HE_DEFAULT_NUM_BUFS;
+}
+
+const char *
+spdk_nvmf_ndp_he_state_str(enum spdk_nvmf_ndp_he_state state)
+{
+	switch (state) {
+	case SPDK_NVMF_NDP_HE_STATE_DISABLED:
+		return "disabled";
+	case SPDK_NVMF_NDP_HE_STATE_LOADING:
+		return "loading";
+	case SPDK_NVMF_NDP_HE_STATE_READY:
+		return "ready";
+	case SPDK_NVMF_NDP_HE_STATE_FAILED:
+		return "failed";
+	default:
+		return "unknown";
+	}
+}
+
+#ifdef HEAAN_LIB
+#include "heaan/HEaaN_CWrapper.h"
+
+/*
+ * Context
+ *
+ * Generating the keys, bootstrapping ones above all, takes minutes, so the
+ * context is built on a thread of its own and the HEaaN operators complete
+ * with Namespace Not Ready until it is.  The key file holds a header and,
+ * page aligned so that the keys are used in place from the mapping, the
+ * context as heaan_Serialize() writes it.
+ */
+
+#define NVMF_HEAAN_KEY_MAGIC		"NDPHEKEY"
+#define NVMF_HEAAN_KEY_VERSION		1
+#define NVMF_HEAAN_KEY_PAYLOAD_OFFSET	4096
+
+struct nvmf_heaan_key_hdr {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	params[5];
+	uint64_t	payload_offset;
+	uint64_t	payload_len;
+	uint32_t	payload_crc;
+	uint8_t		reserved[12];
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_heaan_key_hdr) == 64, "Incorrect size");
+
+struct nvmf_heaan_ctx {
+	struct spdk_nvmf_ndp_he_opts	opts;
+	pthread_t			thread;
+	bool				started;
+
+	/* Written by the context thread, read by the poll groups */
+	enum spdk_nvmf_ndp_he_state	state;
+	bool				from_key_file;
+	uint64_t			init_time_ms;
+
+	/* Key file mapping the library uses in place, kept while the target runs */
+	void				*map;
+	size_t				map_len;
+};
+
+static struct nvmf_heaan_ctx g_nvmf_heaan_ctx;
+
+static void
+nvmf_heaan_key_params(const struct spdk_nvmf_ndp_he_opts *opts, uint32_t *params)
+{
+	params[0] = opts->log_q;
+	params[1] = opts->log_p;
+	params[2] = opts->log_slots;
+	params[3] = opts->log_t;
+	params[4] = opts->log_key_q;
+}
+
+/* Returns 0 if the context was loaded from the key file, which stays mapped */
+static int
+nvmf_heaan_key_load(struct nvmf_heaan_ctx *ctx)
+{
+	const char *path = ctx->opts.key_file;
+	const struct nvmf_heaan_key_hdr *hdr;
+	uint32_t params[5];
+	struct stat st;
+	void *map;
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		rc = -errno;
+		if (rc != -ENOENT) {
+			SPDK_ERRLOG("HEaaN: unable to open the key file %s: %s\n", path,
+				    spdk_strerror(-rc));
+		}
+		return rc;
+	}
+
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < NVMF_HEAAN_KEY_PAYLOAD_OFFSET) {
+		SPDK_ERRLOG("HEaaN: key file %s is truncated\n", path);
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	rc = map == MAP_FAILED ? -errno : 0;
+	close(fd);
+	if (rc != 0) {
+		SPDK_ERRLOG("HEaaN: unable to map the key file %s: %s\n", path, spdk_strerror(-rc));
+		return rc;
+	}
+
+	hdr = map;
+	nvmf_heaan_key_params(&ctx->opts, params);
+	if (memcmp(hdr->magic, NVMF_HEAAN_KEY_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    from_le32(&hdr->version) != NVMF_HEAAN_KEY_VERSION) {
+		SPDK_ERRLOG("HEaaN: %s is not a key file\n", path);
+		rc = -EINVAL;
+		goto err;
+	}
+	if (memcmp(hdr->params, params, sizeof(params)) != 0) {
+		SPDK_NOTICELOG("HEaaN: key file %s was generated with other parameters\n", path);
+		rc = -ESTALE;
+		goto err;
+	}
+	if (from_le64(&hdr->payload_offset) != NVMF_HEAAN_KEY_PAYLOAD_OFFSET ||
+	    from_le64(&hdr->payload_len) > (uint64_t)st.st_size - NVMF_HEAAN_KEY_PAYLOAD_OFFSET ||
+	    spdk_crc32c_update((uint8_t *)map + NVMF_HEAAN_KEY_PAYLOAD_OFFSET,
+			       from_le64(&hdr->payload_len), ~0u) != from_le32(&hdr->payload_crc)) {
+		SPDK_ERRLOG("HEaaN: key file %s is corrupted\n", path);
+		rc = -EILSEQ;
+		goto err;
+	}
+
+	rc = heaan_Initialize_FromMem((uint8_t *)map + NVMF_HEAAN_KEY_PAYLOAD_OFFSET,
+				      from_le64(&hdr->payload_len));
+	if (rc != 0) {
+		SPDK_ERRLOG("HEaaN: unable to load the keys of %s: %d\n", path, rc);
+		rc = -EIO;
+		goto err;
+	}
+
+	ctx->map = map;
+	ctx->map_len = st.st_size;
+	return 0;
+
+err:
+	munmap(map, st.st_size);
+	return rc;
+}
+
+/*
+ * Save the context just generated, through a temporary file so a crash
+ * leaves no partial one.  The temporary file holds the secret key, it is
+ * removed whatever fails.
+ */
+static void
+nvmf_heaan_key_save(struct nvmf_heaan_ctx *ctx)
+{
+	const char *path = ctx->opts.key_file;
+	struct nvmf_heaan_key_hdr *hdr;
+	size_t payload_len, len;
+	char *tmp_path;
+	uint32_t params[5];
+	void *map;
+	int fd, rc;
+
+	payload_len = heaan_Get_SerializedSize();
+	len = NVMF_HEAAN_KEY_PAYLOAD_OFFSET + payload_len;
+
+	tmp_path = spdk_sprintf_alloc("%s.tmp", path);
+	if (tmp_path == NULL) {
+		return;
+	}
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		SPDK_ERRLOG("HEaaN: unable to create %s: %s\n", tmp_path, spdk_strerror(errno));
+		free(tmp_path);
+		return;
+	}
+
+	if (ftruncate(fd, len) != 0) {
+		rc = -errno;
+		SPDK_ERRLOG("HEaaN: unable to size %s: %s\n", tmp_path, spdk_strerror(-rc));
+		goto err;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		rc = -errno;
+		SPDK_ERRLOG("HEaaN: unable to map %s: %s\n", tmp_path, spdk_strerror(-rc));
+		goto err;
+	}
+
+	if (heaan_Serialize((uint8_t *)map + NVMF_HEAAN_KEY_PAYLOAD_OFFSET, payload_len) != 0) {
+		SPDK_ERRLOG("HEaaN: unable to serialize the keys\n");
+		munmap(map, len);
+		goto err;
+	}
+
+	hdr = map;
+	memcpy(hdr->magic, NVMF_HEAAN_KEY_MAGIC, sizeof(hdr->magic));
+	to_le32(&hdr->version, NVMF_HEAAN_KEY_VERSION);
+	nvmf_heaan_key_params(&ctx->opts, params);
+	memcpy(hdr->params, params, sizeof(params));
+	to_le64(&hdr->payload_offset, NVMF_HEAAN_KEY_PAYLOAD_OFFSET);
+	to_le64(&hdr->payload_len, payload_len);
+	to_le32(&hdr->payload_crc,
+		spdk_crc32c_update((uint8_t *)map + NVMF_HEAAN_KEY_PAYLOAD_OFFSET,
+				   payload_len, ~0u));
+
+	rc = msync(map, len, MS_SYNC) == 0 ? 0 : -errno;
+	munmap(map, len);
+	if (rc == 0 && fsync(fd) != 0) {
+		rc = -errno;
+	}
+	if (rc == 0 && rename(tmp_path, path) != 0) {
+		rc = -errno;
+	}
+	if (rc != 0) {
+		SPDK_ERRLOG("HEaaN: unable to save the keys to %s: %s\n", path, spdk_strerror(-rc));
+		goto err;
+	}
+
+	SPDK_NOTICELOG("HEaaN: keys saved to %s\n", path);
+	close(fd);
+	free(tmp_path);
+	return;
+
+err:
+	close(fd);
+	unlink(tmp_path);
+	free(tmp_path);
+}
+
+static void *
+nvmf_heaan_ctx_thread(void *arg)
+{
+	struct nvmf_heaan_ctx *ctx = arg;
+	struct spdk_nvmf_ndp_he_opts *opts = &ctx->opts;
+	uint64_t start = spdk_get_ticks();
+	enum spdk_nvmf_ndp_he_state state = SPDK_NVMF_NDP_HE_STATE_READY;
+	int rc = -ENOENT;
+
+	spdk_unaffinitize_thread();
+
+	if (opts->key_file != NULL) {
+		rc = nvmf_heaan_key_load(ctx);
+		ctx->from_key_file = rc == 0;
+	}
+
+	if (rc != 0) {
+		SPDK_NOTICELOG("HEaaN: generating the keys (logq %u, logp %u, log slots %u)\n",
+			       opts->log_q, opts->log_p, opts->log_slots);
+		rc = heaan_Initialize(opts->log_q, opts->log_p, opts->log_slots, opts->log_t,
+				      opts->log_key_q);
+		if (rc != 0) {
+			SPDK_ERRLOG("HEaaN: unable to build the context: %d\n", rc);
+			state = SPDK_NVMF_NDP_HE_STATE_FAILED;
+		} else if (opts->key_file != NULL) {
+			nvmf_heaan_key_save(ctx);
+		}
+	}
+
+	ctx->init_time_ms = (spdk_get_ticks() - start) * 1000 / spdk_get_ticks_hz();
+	__atomic_store_n(&ctx->state, state, __ATOMIC_RELEASE);
+
+	if (state == SPDK_NVMF_NDP_HE_STATE_READY) {
+		SPDK_NOTICELOG("HEaaN: context %s in %" PRIu64 " ms\n",
+			       ctx->from_key_file ? "loaded" : "generated", ctx->init_time_ms);
+	}
+
+	return NULL;
+}
+
+/*
+ * Buffers
+ *
+ * Every operation needs a buffer per file, and a ciphertext object for its
+ * result.  Allocating and freeing them on the poll group for each one puts
+ * the allocator in the latency of the other queue pairs, so the buffers
+ * come from a mempool filled once when the context is started, whose per
+ * core caches spare most gets and puts the shared ring, and result objects
+ * are kept by the thread that evaluated them for its next operation.
+ */
+
+/* Buffers kept by each core, few as they are megabytes each */
+#define NVMF_HEAAN_POOL_CACHE_SIZE	2
+/* Result ciphertexts kept by each thread evaluating operations */
+#define NVMF_HEAAN_CT_CACHE_SIZE	4
+
+struct nvmf_heaan_pool {
+	struct spdk_mempool	*bufs;
+	size_t			buf_size;
+	uint32_t		num_bufs;
+
+	/* Updated from the poll groups and the offload threads */
+	uint32_t		in_use;
+	uint32_t		high_water;
+	uint64_t		gets;
+	uint64_t		fallbacks;
+	uint64_t		ct_created;
+	uint64_t		ct_reused;
+};
+
+static struct nvmf_heaan_pool g_nvmf_heaan_pool;
+
+struct nvmf_heaan_ct_cache {
+	void		*cts[NVMF_HEAAN_CT_CACHE_SIZE];
+	uint32_t	num_cts;
+};
+
+static __thread struct nvmf_heaan_ct_cache t_nvmf_heaan_ct_cache;
+
+/* A packed ciphertext of ring dimension 2^log_n at log_q fits in a buffer */
+static int
+nvmf_heaan_pool_create(const struct spdk_nvmf_ndp_he_opts *opts)
+{
+	struct nvmf_heaan_pool *pool = &g_nvmf_heaan_pool;
+	uint32_t cache_size;
+
+	if (opts->num_bufs == 0) {
+		return 0;
+	}
+
+	if (opts->log_n == 0 || opts->log_n > NVMF_NDP_HE_CT_MAX_LOG_N) {
+		SPDK_ERRLOG("HEaaN: invalid log N %u\n", opts->log_n);
+		return -EINVAL;
+	}
+
+	pool->buf_size = sizeof(struct nvmf_ndp_he_ct) +
+			 (2ull << opts->log_n) * SPDK_CEIL_DIV(opts->log_q, 64) * sizeof(uint64_t);
+	cache_size = spdk_min(NVMF_HEAAN_POOL_CACHE_SIZE, opts->num_bufs * 2 / 3);
+	pool->bufs = spdk_mempool_create("nvmf_ndp_he_bufs", opts->num_bufs, pool->buf_size,
+					 cache_size, SPDK_ENV_SOCKET_ID_ANY);
+	if (pool->bufs == NULL) {
+		/* Operations still run, allocating their buffers */
+		SPDK_WARNLOG("HEaaN: unable to create a pool of %u buffers of %zu bytes\n",
+			     opts->num_bufs, pool->buf_size);
+		pool->buf_size = 0;
+		return 0;
+	}
+	pool->num_bufs = opts->num_bufs;
+
+	return 0;
+}
+
+void
+spdk_nvmf_ndp_he_get_pool_stats(struct spdk_nvmf_ndp_he_pool_stats *stats)
+{
+	struct nvmf_heaan_pool *pool = &g_nvmf_heaan_pool;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->buf_size = pool->buf_size;
+	stats->num_bufs = pool->num_bufs;
+	stats->bufs_in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+	stats->bufs_high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+	stats->buf_gets = __atomic_load_n(&pool->gets, __ATOMIC_RELAXED);
+	stats->buf_fallbacks = __atomic_load_n(&pool->fallbacks, __ATOMIC_RELAXED);
+	stats->ct_created = __atomic_load_n(&pool->ct_created, __ATOMIC_RELAXED);
+	stats->ct_reused = __atomic_load_n(&pool->ct_reused, __ATOMIC_RELAXED);
+}
+
+int
+spdk_nvmf_ndp_he_start(const struct spdk_nvmf_ndp_he_opts *opts)
+{
+	struct nvmf_heaan_ctx *ctx = &g_nvmf_heaan_ctx;
+	int rc;
+
+	if (ctx->started) {
+		return -EALREADY;
+	}
+
+	rc = nvmf_heaan_pool_create(opts);
+	if (rc != 0) {
+		return rc;
+	}
+
+	ctx->opts = *opts;
+	if (opts->key_file != NULL) {
+		ctx->opts.key_file = strdup(opts->key_file);
+		if (ctx->opts.key_file == NULL) {
+			rc = -ENOMEM;
+			goto err;
+		}
+	}
+
+	__atomic_store_n(&ctx->state, SPDK_NVMF_NDP_HE_STATE_LOADING, __ATOMIC_RELEASE);
+	rc = pthread_create(&ctx->thread, NULL, nvmf_heaan_ctx_thread, ctx);
+	if (rc != 0) {
+		SPDK_ERRLOG("HEaaN: unable to start the context thread: %s\n", spdk_strerror(rc));
+		__atomic_store_n(&ctx->state, SPDK_NVMF_NDP_HE_STATE_DISABLED, __ATOMIC_RELEASE);
+		free(ctx->opts.key_file);
+		ctx->opts.key_file = NULL;
+		rc = -rc;
+		goto err;
+	}
+
+	/* Nothing waits for it, the process may exit while it is still generating */
+	pthread_detach(ctx->thread);
+	ctx->started = true;
+
+	return 0;
+
+err:
+	spdk_mempool_free(g_nvmf_heaan_pool.bufs);
+	memset(&g_nvmf_heaan_pool, 0, sizeof(g_nvmf_heaan_pool));
+	return rc;
+}
+
+void
+spdk_nvmf_ndp_he_get_status(struct spdk_nvmf_ndp_he_status *status)
+{
+	struct nvmf_heaan_ctx *ctx = &g_nvmf_heaan_ctx;
+
+	memset(status, 0, sizeof(*status));
+	status->state = __atomic_load_n(&ctx->state, __ATOMIC_ACQUIRE);
+	if (status->state == SPDK_NVMF_NDP_HE_STATE_READY ||
+	    status->state == SPDK_NVMF_NDP_HE_STATE_FAILED) {
+		status->from_key_file = ctx->from_key_file;
+		status->init_time_ms = ctx->init_time_ms;
+	}
+}
+
+#define NVMF_HEAAN_MAX_INPUTS		2
+#define NVMF_HEAAN_MAX_FILES		(NVMF_HEAAN_MAX_INPUTS + 1)
+
+#define NVMF_HEAAN_BATCH_MAX_TUPLES	4096
+#define NVMF_HEAAN_BATCH_MAX_EXTENTS	65536
+
+/* Tuples in flight: enough to keep the offload threads busy, each holds its ciphertexts */
+#define NVMF_HEAAN_DEPTH		8
+#define NVMF_HEAAN_MAX_DEPTH		32
+
+/* Packed ciphertexts are used in place, align their coefficients for vector loads */
+#define NVMF_HEAAN_BUF_ALIGN		64
+
+/* Most offload jobs one packed operation is split into */
+#define NVMF_HEAAN_MAX_SLICES		16
+
+/* CDW14: per operation parameters */
+#define NVMF_HEAAN_F_RESCALE		(1u << 0)	/* multiply: rescale the product by 2^logp */
+
+struct nvmf_heaan_file {
+	uint64_t		start_offset;
+	uint64_t		size;
+	uint32_t		num_extents;
+	struct nvmf_ndp_extent	*extents;
+	void			*buf;
+	bool			pooled;
+};
+
+struct nvmf_heaan_op {
+	uint8_t		opc;
+	const char	*name;
+	uint32_t	num_inputs;
+
+	/* CDW14 bits the operation takes */
+	uint32_t	params;
+
+	/* Evaluate the deserialized inputs into the output buffer, 0 on success */
+	int		(*eval)(void *scheme, void **in, struct nvmf_heaan_file *output,
+				uint32_t params);
+
+	/*
+	 * Evaluate packed inputs in place, NULL if the operation needs the
+	 * library.  The inputs may be used as scratch.
+	 */
+	int		(*eval_packed)(struct nvmf_ndp_he_ct **in,
+				       struct nvmf_heaan_file *output, uint32_t params);
+
+	/*
+	 * Evaluate RNS packed inputs prime by prime, NULL if the operation
+	 * isn't split: prepare_primes() writes the header of the output and
+	 * returns the number of primes, then eval_primes() is called on
+	 * disjoint ranges of primes, concurrently.
+	 */
+	int		(*prepare_primes)(struct nvmf_ndp_he_ct **in,
+					  struct nvmf_heaan_file *output, uint32_t params);
+	int		(*eval_primes)(struct nvmf_ndp_he_ct **in, struct nvmf_heaan_file *output,
+				       uint32_t first, uint32_t count);
+};
+
+static void *
+nvmf_heaan_buf_get(struct nvmf_heaan_file *file, bool zero)
+{
+	struct nvmf_heaan_pool *pool = &g_nvmf_heaan_pool;
+	uint32_t in_use, high_water;
+
+	__atomic_fetch_add(&pool->gets, 1, __ATOMIC_RELAXED);
+	if (pool->bufs != NULL && file->size <= pool->buf_size) {
+		file->buf = spdk_mempool_get(pool->bufs);
+		if (file->buf != NULL) {
+			file->pooled = true;
+			in_use = __atomic_add_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+			high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+			while (in_use > high_water &&
+			       !__atomic_compare_exchange_n(&pool->high_water, &high_water, in_use, true,
+							    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			}
+			if (zero) {
+				memset(file->buf, 0, file->size);
+			}
+			return file->buf;
+		}
+	}
+
+	__atomic_fetch_add(&pool->fallbacks, 1, __ATOMIC_RELAXED);
+	file->pooled = false;
+	if (zero) {
+		file->buf = spdk_dma_zmalloc(file->size, NVMF_HEAAN_BUF_ALIGN, NULL);
+	} else {
+		file->buf = spdk_dma_malloc(file->size, NVMF_HEAAN_BUF_ALIGN, NULL);
+	}
+
+	return file->buf;
+}
+
+static void
+nvmf_heaan_buf_put(struct nvmf_heaan_file *file)
+{
+	if (file->buf == NULL) {
+		return;
+	}
+
+	if (file->pooled) {
+		spdk_mempool_put(g_nvmf_heaan_pool.bufs, file->buf);
+		__atomic_fetch_sub(&g_nvmf_heaan_pool.in_use, 1, __ATOMIC_RELAXED);
+	} else {
+		spdk_dma_free(file->buf);
+	}
+	file->buf = NULL;
+}
+
+/* Result ciphertext, every operation overwriting the one it is given */
+static void *
+nvmf_heaan_ct_get(void)
+{
+	struct nvmf_heaan_ct_cache *cache = &t_nvmf_heaan_ct_cache;
+
+	if (cache->num_cts != 0) {
+		__atomic_fetch_add(&g_nvmf_heaan_pool.ct_reused, 1, __ATOMIC_RELAXED);
+		return cache->cts[--cache->num_cts];
+	}
+
+	__atomic_fetch_add(&g_nvmf_heaan_pool.ct_created, 1, __ATOMIC_RELAXED);
+	return create_Ciphertext();
+}
+
+static void
+nvmf_heaan_ct_put(void *ct)
+{
+	struct nvmf_heaan_ct_cache *cache = &t_nvmf_heaan_ct_cache;
+
+	if (cache->num_cts < NVMF_HEAAN_CT_CACHE_SIZE) {
+		cache->cts[cache->num_cts++] = ct;
+		return;
+	}
+
+	free_Ciphertext(ct);
+}
+
+/*
+ * Serialize the ciphertext an operation evaluated to, if it succeeded and
+ * fits in the output.  The output buffer is the size of the output file,
+ * which may be shorter than the result: a bootstrapped ciphertext is larger
+ * than its input.
+ */
+static int
+nvmf_heaan_put_ciphertext(struct nvmf_heaan_file *output, void *out, int rc)
+{
+	unsigned long size;
+
+	if (rc == 0) {
+		size = getCiphertextMemSize(out);
+		if (size > output->size) {
+			SPDK_ERRLOG("HEaaN: result of %lu bytes exceeds the %" PRIu64 " bytes output\n",
+				    size, output->size);
+			rc = -ENOSPC;
+		} else {
+			writeCiphertextToMem(out, output->buf, 0);
+		}
+	}
+	nvmf_heaan_ct_put(out);
+
+	return rc;
+}
+
+static int
+nvmf_heaan_eval_add(void *scheme, void **in, struct nvmf_heaan_file *output, uint32_t params)
+{
+	void *out = nvmf_heaan_ct_get();
+
+	return nvmf_heaan_put_ciphertext(output, out, ciphertextAdd(scheme, out, in[0], in[1]));
+}
+
+static int
+nvmf_heaan_eval_sub(void *scheme, void **in, struct nvmf_heaan_file *output, uint32_t params)
+{
+	void *out = nvmf_heaan_ct_get();
+
+	return nvmf_heaan_put_ciphertext(output, out, ciphertextSub(scheme, out, in[0], in[1]));
+}
+
+static int
+nvmf_heaan_eval_mul(void *scheme, void **in, struct nvmf_heaan_file *output, uint32_t params)
+{
+	void *out = nvmf_heaan_ct_get();
+	int rc;
+
+	rc = ciphertextMult(scheme, out, in[0], in[1]);
+	if (rc == 0 && (params & NVMF_HEAAN_F_RESCALE)) {
+		/* Bring the scale of the product back to that of the inputs */
+		rc = ciphertextReScale(scheme, out);
+	}
+
+	return nvmf_heaan_put_ciphertext(output, out, rc);
+}
+
+static int
+nvmf_heaan_eval_bootstrap(void *scheme, void **in, struct nvmf_heaan_file *output,
+			  uint32_t params)
+{
+	void *out = nvmf_heaan_ct_get();
+
+	return nvmf_heaan_put_ciphertext(output, out, ciphertextBootstrap(scheme, out, in[0]));
+}
+
+static int
+nvmf_heaan_eval_add_packed(struct nvmf_ndp_he_ct **in, struct nvmf_heaan_file *output,
+			   uint32_t params)
+{
+	return nvmf_ndp_he_ct_add(in[0], in[1], output->buf, output->size);
+}
+
+static int
+nvmf_heaan_eval_sub_packed(struct nvmf_ndp_he_ct **in, struct nvmf_heaan_file *output,
+			   uint32_t params)
+{
+	return nvmf_ndp_he_ct_sub(in[0], in[1], output->buf, output->size);
+}
+
+/* The product is left unrelinearized and unrescaled, for the host to finish */
+static int
+nvmf_heaan_prepare_mul_primes(struct nvmf_ndp_he_ct **in, struct nvmf_heaan_file *output,
+			      uint32_t params)
+{
+	if (params & NVMF_HEAAN_F_RESCALE) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext products are not rescaled\n");
+		return -EINVAL;
+	}
+
+	return nvmf_ndp_he_ct_mul_prepare(in[0], in[1], output->buf, output->size);
+}
+
+static int
+nvmf_heaan_eval_mul_primes(struct nvmf_ndp_he_ct **in, struct nvmf_heaan_file *output,
+			   uint32_t first, uint32_t count)
+{
+	return nvmf_ndp_he_ct_mul_primes(in[0], in[1], output->buf, first, count);
+}
+
+static int
+nvmf_heaan_eval_mul_packed(struct nvmf_ndp_he_ct **in, struct nvmf_heaan_file *output,
+			   uint32_t params)
+{
+	int rc;
+
+	rc = nvmf_heaan_prepare_mul_primes(in, output, params);
+	if (rc < 0) {
+		return rc;
+	}
+
+	return nvmf_heaan_eval_mul_primes(in, output, 0, rc);
+}
+
+/* The output is the decoded message rather than a ciphertext */
+static int
+nvmf_heaan_eval_decrypt(void *scheme, void **in, struct nvmf_heaan_file *output,
+			uint32_t params)
+{
+	return decryptCiphertextToMem(scheme, in[0], output->buf, output->size);
+}
+
+/*
+ * Division (0xe3) has no HEaaN primitive, it is left unregistered and so not
+ * advertised in the Commands Supported and Effects log page.
+ */
+static const struct nvmf_heaan_op g_nvmf_heaan_ops[] = {
+	{ SPDK_NVME_OPC_CUSTOM_HEAAN_ADD, "add", 2, 0, nvmf_heaan_eval_add, nvmf_heaan_eval_add_packed },
+	{ SPDK_NVME_OPC_CUSTOM_HEAAN_SUB, "sub", 2, 0, nvmf_heaan_eval_sub, nvmf_heaan_eval_sub_packed },
+	{
+		SPDK_NVME_OPC_CUSTOM_HEAAN_MUL, "mul", 2, NVMF_HEAAN_F_RESCALE, nvmf_heaan_eval_mul,
+		nvmf_heaan_eval_mul_packed, nvmf_heaan_prepare_mul_primes, nvmf_heaan_eval_mul_primes
+	},
+	{ SPDK_NVME_OPC_CUSTOM_HEAAN_DEC, "dec", 1, 0, nvmf_heaan_eval_decrypt },
+	{ SPDK_NVME_OPC_CUSTOM_HEAAN_BTSRP, "btsrp", 1, 0, nvmf_heaan_eval_bootstrap },
+};
+
+struct nvmf_heaan_job;
+
+/* Inputs then output of one operation, their extents being adjacent */
+struct nvmf_heaan_tuple {
+	struct nvmf_heaan_job	*job;
+	uint32_t		idx;
+	struct nvmf_heaan_file	files[NVMF_HEAAN_MAX_FILES];
+};
+
+struct nvmf_heaan_job {
+	struct spdk_nvmf_request	*req;
+	struct spdk_bdev_desc		*desc;
+	struct spdk_io_channel		*ch;
+	const struct nvmf_heaan_op	*op;
+	uint32_t			params;
+
+	uint32_t			num_tuples;
+	uint32_t			depth;
+	uint32_t			next;
+	uint32_t			inflight;
+	bool				pumping;
+
+	/* Lowest failed tuple, num_tuples if none did, and its status */
+	uint32_t			failed;
+	int				status;
+
+	/* Checked before every tuple is started and evaluated */
+	struct nvmf_ndp_job		ndp_job;
+
+	struct nvmf_heaan_tuple		*tuples;
+
+	/* Extents of all files, back to back */
+	struct nvmf_ndp_extent		*extents;
+};
+
+static const struct nvmf_heaan_op *
+nvmf_heaan_get_op(uint8_t opc)
+{
+	size_t i;
+
+	for (i = 0; i < SPDK_COUNTOF(g_nvmf_heaan_ops); i++) {
+		if (g_nvmf_heaan_ops[i].opc == opc) {
+			return &g_nvmf_heaan_ops[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void
+nvmf_heaan_tuple_put(struct nvmf_heaan_tuple *tuple)
+{
+	uint32_t i;
+
+	for (i = 0; i < NVMF_HEAAN_MAX_FILES; i++) {
+		nvmf_heaan_buf_put(&tuple->files[i]);
+	}
+}
+
+static void
+nvmf_heaan_job_free(struct nvmf_heaan_job *job)
+{
+	uint32_t i;
+
+	if (job->tuples != NULL) {
+		for (i = 0; i < job->num_tuples; i++) {
+			nvmf_heaan_tuple_put(&job->tuples[i]);
+		}
+	}
+	free(job->tuples);
+	free(job->extents);
+	free(job);
+}
+
+static int
+nvmf_heaan_job_alloc(struct nvmf_heaan_job *job, uint32_t num_tuples, uint64_t num_extents)
+{
+	uint32_t i;
+
+	job->tuples = calloc(num_tuples, sizeof(*job->tuples));
+	job->extents = calloc(num_extents, sizeof(*job->extents));
+	if (job->tuples == NULL || job->extents == NULL) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_tuples; i++) {
+		job->tuples[i].job = job;
+		job->tuples[i].idx = i;
+	}
+	job->num_tuples = num_tuples;
+	job->failed = num_tuples;
+
+	return 0;
+}
+
+/* Copy the descriptor, len bytes of it at least, out of the data buffer */
+static int
+nvmf_heaan_desc_copy(struct spdk_nvmf_request *req, uint64_t len, uint64_t **wordsp)
+{
+	uint64_t *words;
+
+	if (len > req->length) {
+		SPDK_ERRLOG("HEaaN: descriptor of %" PRIu64 " bytes exceeds the data buffer\n", len);
+		return -EINVAL;
+	}
+
+	words = malloc(req->length);
+	if (words == NULL) {
+		return -ENOMEM;
+	}
+	spdk_copy_iovs_to_buf(words, req->length, req->iov, req->iovcnt);
+
+	*wordsp = words;
+	return 0;
+}
+
+/*
+ * Parse the (byte offset, byte length) pairs of a file.  Returns the number
+ * of words used, or -EINVAL if an extent is not block aligned or the start
+ * offset of the file is past its end.
+ */
+static int
+nvmf_heaan_parse_extents(const uint64_t *words, uint32_t block_size, uint32_t idx,
+			 struct nvmf_heaan_file *file)
+{
+	struct nvmf_ndp_extent *ext = file->extents;
+	uint64_t offset, len;
+	uint32_t j;
+
+	for (j = 0; j < file->num_extents; j++, ext++) {
+		offset = from_le64(&words[2 * j]);
+		len = from_le64(&words[2 * j + 1]);
+
+		/* File system extents are block aligned */
+		if (offset % block_size != 0 || len % block_size != 0 || len == 0) {
+			SPDK_ERRLOG("HEaaN: extent %" PRIu64 "+%" PRIu64 " of file %u is not "
+				    "block aligned\n", offset, len, idx);
+			return -EINVAL;
+		}
+		ext->offset_blocks = offset / block_size;
+		ext->num_blocks = len / block_size;
+		file->size += len;
+	}
+
+	if (file->start_offset >= file->size) {
+		SPDK_ERRLOG("HEaaN: start offset %" PRIu64 " of file %u is past its %" PRIu64
+			    " bytes\n", file->start_offset, idx, file->size);
+		return -EINVAL;
+	}
+
+	return 2 * file->num_extents;
+}
+
+static int
+nvmf_heaan_parse(struct nvmf_heaan_job *job, struct spdk_bdev *bdev)
+{
+	struct spdk_nvmf_request *req = job->req;
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	uint32_t block_size = spdk_bdev_get_block_size(bdev);
+	uint32_t counts[NVMF_HEAAN_MAX_FILES] = { cmd->cdw11, cmd->cdw12, cmd->cdw13 };
+	uint32_t num_files = job->op->num_inputs + 1;
+	struct nvmf_heaan_file *file;
+	struct nvmf_ndp_extent *ext;
+	uint64_t total = 0, *words;
+	uint32_t i, w = 0;
+	int rc;
+
+	for (i = 0; i < num_files; i++) {
+		if (counts[i] == 0 || counts[i] > NVMF_NDP_DESC_MAX_EXTENTS) {
+			SPDK_ERRLOG("HEaaN: invalid number of extents %u for file %u\n", counts[i], i);
+			return -EINVAL;
+		}
+		total += counts[i];
+	}
+
+	/* Start offset of each file plus two words per extent */
+	rc = nvmf_heaan_desc_copy(req, (num_files + 2 * total) * sizeof(uint64_t), &words);
+	if (rc != 0) {
+		return rc;
+	}
+
+	rc = nvmf_heaan_job_alloc(job, 1, total);
+	if (rc != 0) {
+		free(words);
+		return rc;
+	}
+
+	ext = job->extents;
+	for (i = 0; i < num_files; i++) {
+		file = &job->tuples[0].files[i];
+		file->start_offset = from_le64(&words[w++]);
+		file->num_extents = counts[i];
+		file->extents = ext;
+		ext += counts[i];
+
+		rc = nvmf_heaan_parse_extents(&words[w], block_size, i, file);
+		if (rc < 0) {
+			free(words);
+			return rc;
+		}
+		w += rc;
+	}
+
+	free(words);
+	return 0;
+}
+
+static int
+nvmf_heaan_parse_batch(struct nvmf_heaan_job *job, struct spdk_bdev *bdev)
+{
+	struct spdk_nvmf_request *req = job->req;
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	uint32_t block_size = spdk_bdev_get_block_size(bdev);
+	uint32_t num_tuples = cmd->cdw11, num_extents = cmd->cdw12, depth = cmd->cdw13 & 0xFF;
+	uint32_t num_files = job->op->num_inputs + 1;
+	uint64_t max_words = req->length / sizeof(uint64_t), used = 0, *words;
+	struct nvmf_heaan_file *file;
+	struct nvmf_ndp_extent *ext;
+	uint32_t i, j, n;
+	uint64_t w = 0;
+	int rc;
+
+	if (num_tuples == 0 || num_tuples > NVMF_HEAAN_BATCH_MAX_TUPLES) {
+		SPDK_ERRLOG("HEaaN: invalid batch of %u operations\n", num_tuples);
+		return -EINVAL;
+	}
+	if (num_extents < num_tuples * num_files || num_extents > NVMF_HEAAN_BATCH_MAX_EXTENTS) {
+		SPDK_ERRLOG("HEaaN: invalid batch of %u extents\n", num_extents);
+		return -EINVAL;
+	}
+
+	/* Start offset and number of extents of each file plus two words per extent */
+	rc = nvmf_heaan_desc_copy(req, (2 * (uint64_t)num_tuples * num_files +
+					2 * (uint64_t)num_extents) * sizeof(uint64_t), &words);
+	if (rc != 0) {
+		return rc;
+	}
+
+	rc = nvmf_heaan_job_alloc(job, num_tuples, num_extents);
+	if (rc != 0) {
+		free(words);
+		return rc;
+	}
+
+	ext = job->extents;
+	for (i = 0; i < num_tuples; i++) {
+		for (j = 0; j < num_files; j++) {
+			file = &job->tuples[i].files[j];
+			if (max_words - w < 2) {
+				rc = -EINVAL;
+				break;
+			}
+			file->start_offset = from_le64(&words[w++]);
+			n = from_le64(&words[w++]);
+			if (n == 0 || n > NVMF_NDP_DESC_MAX_EXTENTS || n > num_extents - used ||
+			    2 * (uint64_t)n > max_words - w) {
+				SPDK_ERRLOG("HEaaN: invalid number of extents %u for file %u of "
+					    "operation %u\n", n, j, i);
+				rc = -EINVAL;
+				break;
+			}
+			file->num_extents = n;
+			file->extents = ext;
+			ext += n;
+			used += n;
+
+			rc = nvmf_heaan_parse_extents(&words[w], block_size, j, file);
+			if (rc < 0) {
+				break;
+			}
+			w += rc;
+			rc = 0;
+		}
+		if (rc != 0) {
+			free(words);
+			return rc;
+		}
+	}
+	free(words);
+
+	if (used != num_extents) {
+		SPDK_ERRLOG("HEaaN: batch describes %" PRIu64 " extents, CDW12 says %u\n",
+			    used, num_extents);
+		return -EINVAL;
+	}
+
+	job->depth = depth == 0 ? NVMF_HEAAN_DEPTH : spdk_min(depth, NVMF_HEAAN_MAX_DEPTH);
+
+	SPDK_DEBUGLOG(nvmf, "HEaaN batch: %u %s operations, %u extents, depth %u\n",
+		      num_tuples, job->op->name, num_extents, job->depth);
+
+	return 0;
+}
+
+static void nvmf_heaan_pump(struct nvmf_heaan_job *job);
+
+static void
+nvmf_heaan_tuple_done(struct nvmf_heaan_tuple *tuple, int status)
+{
+	struct nvmf_heaan_job *job = tuple->job;
+
+	nvmf_heaan_tuple_put(tuple);
+	if (status != 0 && tuple->idx < job->failed) {
+		job->failed = tuple->idx;
+		job->status = status;
+	}
+
+	assert(job->inflight > 0);
+	job->inflight--;
+	nvmf_heaan_pump(job);
+}
+
+static void
+nvmf_heaan_output_written(void *cb_arg, int status)
+{
+	nvmf_heaan_tuple_done(cb_arg, status);
+}
+
+/*
+ * Inputs that are packed ciphertexts are used in place from the buffers they
+ * were read into.  Returns -ENOENT if they are serialized by the library.
+ */
+static int
+nvmf_heaan_packed_inputs(struct nvmf_heaan_tuple *tuple, struct nvmf_ndp_he_ct **in)
+{
+	const struct nvmf_heaan_op *op = tuple->job->op;
+	struct nvmf_heaan_file *input;
+	uint32_t i;
+	int rc;
+
+	for (i = 0; i < op->num_inputs; i++) {
+		input = &tuple->files[i];
+		rc = nvmf_ndp_he_ct_get(input->buf, input->size, input->start_offset, &in[i]);
+		if (rc == -ENOENT && i != 0) {
+			SPDK_ERRLOG("HEaaN: input %u of %s %u is not packed like the first\n",
+				    i, op->name, tuple->idx);
+			return -EINVAL;
+		}
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int
+nvmf_heaan_eval_inputs_packed(struct nvmf_heaan_tuple *tuple)
+{
+	const struct nvmf_heaan_op *op = tuple->job->op;
+	struct nvmf_ndp_he_ct *in[NVMF_HEAAN_MAX_INPUTS];
+	int rc;
+
+	rc = nvmf_heaan_packed_inputs(tuple, in);
+	if (rc != 0) {
+		return rc;
+	}
+
+	if (op->eval_packed == NULL) {
+		SPDK_ERRLOG("HEaaN: %s doesn't take packed ciphertexts\n", op->name);
+		return -EINVAL;
+	}
+
+	return op->eval_packed(in, &tuple->files[op->num_inputs], tuple->job->params);
+}
+
+/* Runs on an NDP offload thread if there are any */
+static int
+nvmf_heaan_eval(void *arg)
+{
+	struct nvmf_heaan_tuple *tuple = arg;
+	const struct nvmf_heaan_op *op = tuple->job->op;
+	struct nvmf_heaan_file *output = &tuple->files[op->num_inputs];
+	struct nvmf_heaan_file *input;
+	void *in[NVMF_HEAAN_MAX_INPUTS];
+	uint32_t i;
+	int rc;
+
+	rc = nvmf_heaan_eval_inputs_packed(tuple);
+	if (rc != -ENOENT) {
+		if (rc != 0) {
+			SPDK_ERRLOG("HEaaN: packed ciphertext %s %u failed: %d\n", op->name, tuple->idx, rc);
+			return rc == -ENOSPC ? -EINVAL : rc;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < op->num_inputs; i++) {
+		input = &tuple->files[i];
+		in[i] = readCiphertextFromMem(input->buf, input->size, input->start_offset);
+		if (in[i] == NULL) {
+			SPDK_ERRLOG("HEaaN: input %u of ciphertext %s %u is malformed\n", i, op->name,
+				    tuple->idx);
+			while (i-- > 0) {
+				free_Ciphertext(in[i]);
+			}
+			return -EINVAL;
+		}
+	}
+
+	rc = op->eval(heaan_Get_Context()->scheme, in, output, tuple->job->params);
+
+	for (i = 0; i < op->num_inputs; i++) {
+		free_Ciphertext(in[i]);
+	}
+
+	if (rc != 0) {
+		SPDK_ERRLOG("HEaaN: ciphertext %s %u failed: %d\n", op->name, tuple->idx, rc);
+		/* An output too short or inputs of other levels are the host's to fix */
+		return rc == -ENOSPC || rc == -EINVAL ? -EINVAL : -EIO;
+	}
+
+	return 0;
+}
+
+static void
+nvmf_heaan_eval_done(void *arg, int status)
+{
+	struct nvmf_heaan_tuple *tuple = arg;
+	struct nvmf_heaan_file *output = &tuple->files[tuple->job->op->num_inputs];
+	struct nvmf_heaan_job *job = tuple->job;
+	struct iovec iov;
+	int rc;
+
+	if (status != 0) {
+		nvmf_heaan_tuple_done(tuple, status);
+		return;
+	}
+
+	iov.iov_base = output->buf;
+	iov.iov_len = output->size;
+	rc = nvmf_ndp_scatter(job->desc, job->ch, output->extents, output->num_extents, &iov, 1,
+			      nvmf_heaan_output_written, tuple);
+	if (rc != 0) {
+		nvmf_heaan_tuple_done(tuple, rc);
+	}
+}
+
+/* A packed operation split by prime, each slice being one offload job */
+struct nvmf_heaan_split;
+
+struct nvmf_heaan_slice {
+	struct nvmf_heaan_split	*split;
+	uint32_t		first;
+	uint32_t		count;
+};
+
+struct nvmf_heaan_split {
+	struct nvmf_heaan_tuple	*tuple;
+	struct nvmf_ndp_he_ct	*in[NVMF_HEAAN_MAX_INPUTS];
+	uint32_t		pending;
+	int			status;
+	struct nvmf_heaan_slice	slices[];
+};
+
+static int
+nvmf_heaan_slice_eval(void *arg)
+{
+	struct nvmf_heaan_slice *slice = arg;
+	struct nvmf_heaan_tuple *tuple = slice->split->tuple;
+	const struct nvmf_heaan_op *op = tuple->job->op;
+
+	return op->eval_primes(slice->split->in, &tuple->files[op->num_inputs], slice->first,
+			       slice->count);
+}
+
+static void
+nvmf_heaan_slice_done(void *arg, int status)
+{
+	struct nvmf_heaan_slice *slice = arg;
+	struct nvmf_heaan_split *split = slice->split;
+	struct nvmf_heaan_tuple *tuple = split->tuple;
+
+	if (status != 0 && split->status == 0) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext %s %u failed on primes %u-%u: %d\n",
+			    tuple->job->op->name, tuple->idx, slice->first,
+			    slice->first + slice->count - 1, status);
+		split->status = status;
+	}
+
+	assert(split->pending > 0);
+	if (--split->pending == 0) {
+		status = split->status;
+		free(split);
+		nvmf_heaan_eval_done(tuple, status);
+	}
+}
+
+/*
+ * Split the evaluation of RNS packed inputs over the offload threads.
+ * Returns -ENOENT if the tuple is rather evaluated as a whole, by one
+ * thread, which also reports malformed inputs.
+ */
+static int
+nvmf_heaan_eval_split(struct nvmf_heaan_tuple *tuple)
+{
+	const struct nvmf_heaan_op *op = tuple->job->op;
+	struct nvmf_ndp_he_ct *in[NVMF_HEAAN_MAX_INPUTS];
+	struct nvmf_heaan_split *split;
+	struct nvmf_heaan_slice *slice;
+	uint32_t num_threads, num_primes, num_slices, i, first;
+	int rc;
+
+	if (op->prepare_primes == NULL) {
+		return -ENOENT;
+	}
+
+	num_threads = g_nvmf_heaan_ctx.opts.eval_threads;
+	if (num_threads == 0) {
+		num_threads = spdk_nvmf_ndp_offload_get_num_threads();
+	}
+	if (num_threads < 2 || nvmf_heaan_packed_inputs(tuple, in) != 0 ||
+	    !(in[0]->flags & NVMF_NDP_HE_CT_F_RNS)) {
+		return -ENOENT;
+	}
+
+	rc = op->prepare_primes(in, &tuple->files[op->num_inputs], tuple->job->params);
+	if (rc < 0) {
+		return -ENOENT;
+	}
+	num_primes = rc;
+	num_slices = spdk_min(spdk_min(num_threads, num_primes), NVMF_HEAAN_MAX_SLICES);
+	if (num_slices < 2) {
+		return -ENOENT;
+	}
+
+	split = calloc(1, sizeof(*split) + num_slices * sizeof(*slice));
+	if (split == NULL) {
+		return -ENOENT;
+	}
+	split->tuple = tuple;
+	memcpy(split->in, in, sizeof(in));
+
+	/* All slices count before any completes, failing to offload one completing it inline */
+	split->pending = num_slices;
+	for (i = 0, first = 0; i < num_slices; i++) {
+		slice = &split->slices[i];
+		slice->split = split;
+		slice->first = first;
+		slice->count = num_primes / num_slices + (i < num_primes % num_slices);
+		first += slice->count;
+	}
+	for (i = 0; i < num_slices; i++) {
+		slice = &split->slices[i];
+		if (nvmf_ndp_offload(nvmf_heaan_slice_eval, nvmf_heaan_slice_done, slice) != 0) {
+			nvmf_heaan_slice_done(slice, nvmf_heaan_slice_eval(slice));
+		}
+	}
+
+	return 0;
+}
+
+static void
+nvmf_heaan_inputs_read(void *cb_arg, int status)
+{
+	struct nvmf_heaan_tuple *tuple = cb_arg;
+
+	if (status != 0) {
+		SPDK_ERRLOG("HEaaN: failed to read the input ciphertexts of operation %u: %d\n",
+			    tuple->idx, status);
+		nvmf_heaan_tuple_done(tuple, status);
+		return;
+	}
+
+	/* The evaluation is the long part, skip it if the command is to stop meanwhile */
+	status = nvmf_ndp_job_check(&tuple->job->ndp_job);
+	if (status != 0) {
+		nvmf_heaan_tuple_done(tuple, status);
+		return;
+	}
+
+	if (nvmf_heaan_eval_split(tuple) == 0) {
+		return;
+	}
+
+	/* Keep the poll group free for other queue pairs while the result is computed */
+	if (nvmf_ndp_offload(nvmf_heaan_eval, nvmf_heaan_eval_done, tuple) != 0) {
+		nvmf_heaan_eval_done(tuple, nvmf_heaan_eval(tuple));
+	}
+}
+
+/* Buffers are only taken while a tuple is in flight, bounding the memory by the depth */
+static int
+nvmf_heaan_tuple_start(struct nvmf_heaan_tuple *tuple)
+{
+	struct nvmf_heaan_job *job = tuple->job;
+	uint32_t num_inputs = job->op->num_inputs;
+	struct iovec iov[NVMF_HEAAN_MAX_INPUTS];
+	uint32_t i, num_extents = 0;
+	int rc;
+
+	/* The reads fill the input buffers, only the tail of the output may be left as is */
+	for (i = 0; i <= num_inputs; i++) {
+		if (nvmf_heaan_buf_get(&tuple->files[i], i == num_inputs) == NULL) {
+			nvmf_heaan_tuple_put(tuple);
+			return -ENOMEM;
+		}
+	}
+
+	/* The extents of the inputs are adjacent, read them in one go */
+	for (i = 0; i < num_inputs; i++) {
+		iov[i].iov_base = tuple->files[i].buf;
+		iov[i].iov_len = tuple->files[i].size;
+		num_extents += tuple->files[i].num_extents;
+	}
+	rc = nvmf_ndp_gather(job->desc, job->ch, tuple->files[0].extents, num_extents,
+			     iov, num_inputs, nvmf_heaan_inputs_read, tuple);
+	if (rc != 0) {
+		nvmf_heaan_tuple_put(tuple);
+	}
+
+	return rc;
+}
+
+static void
+nvmf_heaan_pump(struct nvmf_heaan_job *job)
+{
+	struct spdk_nvmf_request *req = job->req;
+	struct nvmf_heaan_tuple *tuple;
+	int rc;
+
+	/* Tuples completing while others are started resume the loop below */
+	if (job->pumping) {
+		return;
+	}
+	job->pumping = true;
+
+	while (job->status == 0 && job->next < job->num_tuples && job->inflight < job->depth) {
+		rc = nvmf_ndp_job_check(&job->ndp_job);
+		if (rc != 0) {
+			job->failed = job->next;
+			job->status = rc;
+			break;
+		}
+
+		tuple = &job->tuples[job->next++];
+		job->inflight++;
+		rc = nvmf_heaan_tuple_start(tuple);
+		if (rc != 0) {
+			job->inflight--;
+			if (tuple->idx < job->failed) {
+				job->failed = tuple->idx;
+				job->status = rc;
+			}
+		}
+	}
+
+	job->pumping = false;
+
+	if (job->inflight != 0 || (job->status == 0 && job->next < job->num_tuples)) {
+		return;
+	}
+
+	nvmf_ndp_job_end(&job->ndp_job);
+	req->rsp->nvme_cpl.cdw0 = job->failed;
+	nvmf_ndp_set_status(req, job->status);
+	nvmf_heaan_job_free(job);
+	spdk_nvmf_request_complete(req);
+}
+
+static int
+nvmf_heaan_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		struct spdk_nvmf_request *req, bool batch)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	struct nvmf_heaan_job *job;
+	uint8_t opc;
+	int rc;
+
+	if (__atomic_load_n(&g_nvmf_heaan_ctx.state, __ATOMIC_ACQUIRE) !=
+	    SPDK_NVMF_NDP_HE_STATE_READY) {
+		SPDK_DEBUGLOG(nvmf, "HEaaN: context not ready, opc 0x%02x\n", cmd->opc);
+		nvmf_ndp_set_status(req, -EAGAIN);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	if (req->iovcnt == 0 || req->length == 0) {
+		SPDK_ERRLOG("HEaaN: no data buffer\n");
+		nvmf_ndp_set_status(req, -EINVAL);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	opc = batch ? (cmd->cdw10 >> 16) & 0xFF : cmd->opc;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		nvmf_ndp_set_status(req, -ENOMEM);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+	job->req = req;
+	job->desc = desc;
+	job->ch = ch;
+	job->depth = 1;
+
+	job->op = nvmf_heaan_get_op(opc);
+	if (job->op == NULL) {
+		SPDK_ERRLOG("HEaaN: unsupported operation 0x%02x\n", opc);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	job->params = cmd->cdw14;
+	if (job->params & ~job->op->params) {
+		SPDK_ERRLOG("HEaaN: invalid parameters 0x%x for %s\n", job->params, job->op->name);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	rc = batch ? nvmf_heaan_parse_batch(job, bdev) : nvmf_heaan_parse(job, bdev);
+	if (rc != 0) {
+		goto err;
+	}
+
+	nvmf_ndp_job_begin(&job->ndp_job, req);
+	nvmf_heaan_pump(job);
+	return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
+
+err:
+	nvmf_ndp_set_status(req, rc);
+	nvmf_heaan_job_free(job);
+	return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+}
+
+static int
+nvmf_heaan_op_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		   struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	return nvmf_heaan_exec(bdev, desc, ch, req, false);
+}
+
+static int
+nvmf_heaan_batch_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		      struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	return nvmf_heaan_exec(bdev, desc, ch, req, true);
+}
+
+#define NVMF_HEAAN_OP_REGISTER(_name, _opc)					\
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_heaan_ ## _name ## _op = {		\
+	.name = "heaan_" #_name,						\
+	.opc = _opc,								\
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,				\
+	.flags = SPDK_NVMF_NDP_OP_F_WRITES_MEDIA,				\
+	.exec = nvmf_heaan_op_exec,						\
+};										\
+SPDK_NVMF_NDP_OP_REGISTER(heaan_ ## _name, &g_nvmf_ndp_heaan_ ## _name ## _op)
+
+NVMF_HEAAN_OP_REGISTER(cipadd, SPDK_NVME_OPC_CUSTOM_HEAAN_ADD);
+NVMF_HEAAN_OP_REGISTER(cipsub, SPDK_NVME_OPC_CUSTOM_HEAAN_SUB);
+NVMF_HEAAN_OP_REGISTER(cipmul, SPDK_NVME_OPC_CUSTOM_HEAAN_MUL);
+NVMF_HEAAN_OP_REGISTER(decrypt, SPDK_NVME_OPC_CUSTOM_HEAAN_DEC);
+NVMF_HEAAN_OP_REGISTER(bootstrap, SPDK_NVME_OPC_CUSTOM_HEAAN_BTSRP);
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_heaan_batch_op = {
+	.name = "heaan_batch",
+	.opc = SPDK_NVME_OPC_CUSTOM_HEAAN_BATCH,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.flags = SPDK_NVMF_NDP_OP_F_WRITES_MEDIA,
+	.exec = nvmf_heaan_batch_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(heaan_batch, &g_nvmf_ndp_heaan_batch_op);
+
+#else /* HEAAN_LIB */
+
+int
+spdk_nvmf_ndp_he_start(const struct spdk_nvmf_ndp_he_opts *opts)
+{
+	return -ENOTSUP;
+}
+
+void
+spdk_nvmf_ndp_he_get_status(struct spdk_nvmf_ndp_he_status *status)
+{
+	memset(status, 0, sizeof(*status));
+}
+
+void
+spdk_nvmf_ndp_he_get_pool_stats(struct spdk_nvmf_ndp_he_pool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+#endif
@@ -0,0 +1,446 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Packed ciphertexts for the HEaaN operators.
+ *
+ * Deserializing a ciphertext into NTL integers and serializing the result
+ * back costs more than adding two of them.  Coefficients of a packed
+ * ciphertext are instead read and written as they lie in the DMA buffers of
+ * the extents: words are used in place, which assumes a little endian host
+ * like the rest of the target.  With a single word per coefficient the loops
+ * are plain masked additions the compiler vectorizes; wider moduli carry
+ * from word to word.
+ *
+ * RNS ciphertexts keep every residue below a 62 bit prime, so that sums
+ * never overflow a word, and are multiplied prime by prime in evaluation
+ * form, see ndp_he_ntt.c.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+static inline uint32_t
+nvmf_ndp_he_ct_num_polys(const struct nvmf_ndp_he_ct *ct)
+{
+	return ct->num_polys != 0 ? ct->num_polys : 2;
+}
+
+static inline uint64_t
+nvmf_ndp_he_ct_num_coeffs(const struct nvmf_ndp_he_ct *ct)
+{
+	return (uint64_t)nvmf_ndp_he_ct_num_polys(ct) << ct->log_n;
+}
+
+static inline uint64_t *
+nvmf_ndp_he_ct_primes(const struct nvmf_ndp_he_ct *ct)
+{
+	return (uint64_t *)(ct + 1);
+}
+
+/* Bytes of primes between the header and the coefficients */
+static inline size_t
+nvmf_ndp_he_ct_primes_len(const struct nvmf_ndp_he_ct *ct)
+{
+	if (!(ct->flags & NVMF_NDP_HE_CT_F_RNS)) {
+		return 0;
+	}
+
+	return SPDK_ALIGN_CEIL(ct->num_words * sizeof(uint64_t), sizeof(*ct));
+}
+
+static inline uint64_t *
+nvmf_ndp_he_ct_words(const struct nvmf_ndp_he_ct *ct)
+{
+	return (uint64_t *)((uint8_t *)(ct + 1) + nvmf_ndp_he_ct_primes_len(ct));
+}
+
+/* Residues of polynomial poly modulo prime */
+static inline uint64_t *
+nvmf_ndp_he_ct_residues(const struct nvmf_ndp_he_ct *ct, uint32_t poly, uint32_t prime)
+{
+	return nvmf_ndp_he_ct_words(ct) + (((uint64_t)poly * ct->num_words + prime) << ct->log_n);
+}
+
+/* Mask of the bits of the most significant word below 2^log_q */
+static inline uint64_t
+nvmf_ndp_he_ct_top_mask(const struct nvmf_ndp_he_ct *ct)
+{
+	uint32_t bits = ct->log_q % 64;
+
+	return bits == 0 ? UINT64_MAX : (1ull << bits) - 1;
+}
+
+size_t
+nvmf_ndp_he_ct_size(const struct nvmf_ndp_he_ct *ct)
+{
+	return sizeof(*ct) + nvmf_ndp_he_ct_primes_len(ct) +
+	       nvmf_ndp_he_ct_num_coeffs(ct) * ct->num_words * sizeof(uint64_t);
+}
+
+static int
+nvmf_ndp_he_ct_check_primes(const struct nvmf_ndp_he_ct *ct, size_t len)
+{
+	const uint64_t *primes = nvmf_ndp_he_ct_primes(ct);
+	uint64_t n2 = 2ull << ct->log_n;
+	uint32_t i;
+
+	if (ct->num_words == 0 || ct->num_words > NVMF_NDP_HE_CT_MAX_PRIMES) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext of %u primes\n", ct->num_words);
+		return -EINVAL;
+	}
+
+	if (sizeof(*ct) + nvmf_ndp_he_ct_primes_len(ct) > len) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext primes truncated\n");
+		return -EINVAL;
+	}
+
+	/* Primality is left to the NTT, only what keeps the arithmetic in range is checked */
+	for (i = 0; i < ct->num_words; i++) {
+		if (primes[i] >> NVMF_NDP_HE_NTT_MAX_PRIME_BITS != 0 || primes[i] % n2 != 1) {
+			SPDK_ERRLOG("HEaaN: invalid packed ciphertext prime %" PRIu64 "\n", primes[i]);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+int
+nvmf_ndp_he_ct_check(const void *buf, size_t len)
+{
+	const struct nvmf_ndp_he_ct *ct = buf;
+	int rc;
+
+	if (len < sizeof(*ct) || ct->magic != NVMF_NDP_HE_CT_MAGIC) {
+		return -ENOENT;
+	}
+
+	if (ct->version != NVMF_NDP_HE_CT_VERSION) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext version %u unsupported\n", ct->version);
+		return -EINVAL;
+	}
+
+	if ((uintptr_t)buf % sizeof(uint64_t) != 0) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext not 8 byte aligned\n");
+		return -EINVAL;
+	}
+
+	if (ct->log_n == 0 || ct->log_n > NVMF_NDP_HE_CT_MAX_LOG_N ||
+	    ct->log_q == 0 || ct->log_q > NVMF_NDP_HE_CT_MAX_LOG_Q || ct->log_slots >= ct->log_n ||
+	    ct->num_polys == 1 || ct->num_polys > NVMF_NDP_HE_CT_MAX_POLYS ||
+	    (ct->flags & ~(NVMF_NDP_HE_CT_F_RNS | NVMF_NDP_HE_CT_F_NTT)) != 0 ||
+	    ((ct->flags & NVMF_NDP_HE_CT_F_NTT) && !(ct->flags & NVMF_NDP_HE_CT_F_RNS))) {
+		SPDK_ERRLOG("HEaaN: invalid packed ciphertext, log N %u, log q %u, flags 0x%x\n",
+			    ct->log_n, ct->log_q, ct->flags);
+		return -EINVAL;
+	}
+
+	if (ct->flags & NVMF_NDP_HE_CT_F_RNS) {
+		rc = nvmf_ndp_he_ct_check_primes(ct, len);
+		if (rc != 0) {
+			return rc;
+		}
+	} else if (ct->num_words != SPDK_CEIL_DIV(ct->log_q, 64)) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext of log q %u in %u words\n",
+			    ct->log_q, ct->num_words);
+		return -EINVAL;
+	}
+
+	if (nvmf_ndp_he_ct_size(ct) > len) {
+		SPDK_ERRLOG("HEaaN: packed ciphertext of %zu bytes truncated to %zu\n",
+			    nvmf_ndp_he_ct_size(ct), len);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int
+nvmf_ndp_he_ct_get(void *buf, uint64_t size, uint64_t offset, struct nvmf_ndp_he_ct **ct)
+{
+	int rc;
+
+	/* Host supplied, the length left would wrap around */
+	if (offset >= size) {
+		SPDK_ERRLOG("HEaaN: ciphertext offset %" PRIu64 " past the %" PRIu64 " bytes file\n",
+			    offset, size);
+		return -EINVAL;
+	}
+
+	rc = nvmf_ndp_he_ct_check((uint8_t *)buf + offset, size - offset);
+	if (rc != 0) {
+		return rc;
+	}
+
+	*ct = (struct nvmf_ndp_he_ct *)((uint8_t *)buf + offset);
+	return 0;
+}
+
+/* Same ring and modulus, scales aside */
+static bool
+nvmf_ndp_he_ct_compatible(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b)
+{
+	return a->log_n == b->log_n && a->log_q == b->log_q && a->log_slots == b->log_slots &&
+	       a->flags == b->flags && a->num_words == b->num_words &&
+	       nvmf_ndp_he_ct_num_polys(a) == nvmf_ndp_he_ct_num_polys(b) &&
+	       memcmp(nvmf_ndp_he_ct_primes(a), nvmf_ndp_he_ct_primes(b),
+		      nvmf_ndp_he_ct_primes_len(a)) == 0;
+}
+
+static int
+nvmf_ndp_he_ct_prepare(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		       void *out, size_t out_len)
+{
+	if (!nvmf_ndp_he_ct_compatible(a, b) || a->log_p != b->log_p) {
+		SPDK_ERRLOG("HEaaN: packed ciphertexts of different parameters\n");
+		return -EINVAL;
+	}
+
+	if (nvmf_ndp_he_ct_size(a) > out_len) {
+		return -ENOSPC;
+	}
+
+	if (out != a) {
+		memcpy(out, a, sizeof(*a) + nvmf_ndp_he_ct_primes_len(a));
+	}
+
+	return 0;
+}
+
+static void
+nvmf_ndp_he_ct_add_rns(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		       struct nvmf_ndp_he_ct *out)
+{
+	const uint64_t *primes = nvmf_ndp_he_ct_primes(a);
+	const uint64_t *x, *y;
+	uint64_t *z, i, n = 1ull << a->log_n, q, s;
+	uint32_t poly, prime;
+
+	for (poly = 0; poly < nvmf_ndp_he_ct_num_polys(a); poly++) {
+		for (prime = 0; prime < a->num_words; prime++) {
+			q = primes[prime];
+			x = nvmf_ndp_he_ct_residues(a, poly, prime);
+			y = nvmf_ndp_he_ct_residues(b, poly, prime);
+			z = nvmf_ndp_he_ct_residues(out, poly, prime);
+			for (i = 0; i < n; i++) {
+				s = x[i] + y[i];
+				z[i] = s - (s >= q ? q : 0);
+			}
+		}
+	}
+}
+
+static void
+nvmf_ndp_he_ct_sub_rns(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		       struct nvmf_ndp_he_ct *out)
+{
+	const uint64_t *primes = nvmf_ndp_he_ct_primes(a);
+	const uint64_t *x, *y;
+	uint64_t *z, i, n = 1ull << a->log_n, q, d;
+	uint32_t poly, prime;
+
+	for (poly = 0; poly < nvmf_ndp_he_ct_num_polys(a); poly++) {
+		for (prime = 0; prime < a->num_words; prime++) {
+			q = primes[prime];
+			x = nvmf_ndp_he_ct_residues(a, poly, prime);
+			y = nvmf_ndp_he_ct_residues(b, poly, prime);
+			z = nvmf_ndp_he_ct_residues(out, poly, prime);
+			for (i = 0; i < n; i++) {
+				d = x[i] - y[i];
+				z[i] = d + (x[i] < y[i] ? q : 0);
+			}
+		}
+	}
+}
+
+int
+nvmf_ndp_he_ct_add(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		   void *out, size_t out_len)
+{
+	const uint64_t *x = nvmf_ndp_he_ct_words(a), *y = nvmf_ndp_he_ct_words(b);
+	uint64_t *z;
+	uint64_t i, num_coeffs = nvmf_ndp_he_ct_num_coeffs(a), mask = nvmf_ndp_he_ct_top_mask(a);
+	uint32_t w, num_words = a->num_words;
+	uint64_t s, carry;
+	int rc;
+
+	rc = nvmf_ndp_he_ct_prepare(a, b, out, out_len);
+	if (rc != 0) {
+		return rc;
+	}
+	/* Only laid out once the header is written */
+	z = nvmf_ndp_he_ct_words(out);
+
+	if (a->flags & NVMF_NDP_HE_CT_F_RNS) {
+		nvmf_ndp_he_ct_add_rns(a, b, out);
+		return 0;
+	}
+
+	if (num_words == 1) {
+		for (i = 0; i < num_coeffs; i++) {
+			z[i] = (x[i] + y[i]) & mask;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < num_coeffs; i++) {
+		carry = 0;
+		for (w = 0; w < num_words; w++) {
+			s = x[w] + carry;
+			carry = s < carry;
+			z[w] = s + y[w];
+			carry += z[w] < s;
+		}
+		z[num_words - 1] &= mask;
+		x += num_words;
+		y += num_words;
+		z += num_words;
+	}
+
+	return 0;
+}
+
+int
+nvmf_ndp_he_ct_sub(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		   void *out, size_t out_len)
+{
+	const uint64_t *x = nvmf_ndp_he_ct_words(a), *y = nvmf_ndp_he_ct_words(b);
+	uint64_t *z;
+	uint64_t i, num_coeffs = nvmf_ndp_he_ct_num_coeffs(a), mask = nvmf_ndp_he_ct_top_mask(a);
+	uint32_t w, num_words = a->num_words;
+	uint64_t d, borrow;
+	int rc;
+
+	rc = nvmf_ndp_he_ct_prepare(a, b, out, out_len);
+	if (rc != 0) {
+		return rc;
+	}
+	/* Only laid out once the header is written */
+	z = nvmf_ndp_he_ct_words(out);
+
+	if (a->flags & NVMF_NDP_HE_CT_F_RNS) {
+		nvmf_ndp_he_ct_sub_rns(a, b, out);
+		return 0;
+	}
+
+	if (num_words == 1) {
+		for (i = 0; i < num_coeffs; i++) {
+			z[i] = (x[i] - y[i]) & mask;
+		}
+		return 0;
+	}
+
+	/* The borrow out of the top word is the wrap around 2^log_q, dropped by the mask */
+	for (i = 0; i < num_coeffs; i++) {
+		borrow = 0;
+		for (w = 0; w < num_words; w++) {
+			d = x[w] - borrow;
+			borrow = d > x[w];
+			z[w] = d - y[w];
+			borrow += z[w] > d;
+		}
+		z[num_words - 1] &= mask;
+		x += num_words;
+		y += num_words;
+		z += num_words;
+	}
+
+	return 0;
+}
+
+int
+nvmf_ndp_he_ct_mul_prepare(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+			   void *out, size_t out_len)
+{
+	struct nvmf_ndp_he_ct *ct = out;
+
+	if (!(a->flags & NVMF_NDP_HE_CT_F_RNS) || nvmf_ndp_he_ct_num_polys(a) != 2) {
+		SPDK_ERRLOG("HEaaN: only RNS packed ciphertexts of 2 polynomials are multiplied\n");
+		return -EINVAL;
+	}
+
+	if (a == b || out == a || out == b) {
+		return -EINVAL;
+	}
+
+	if (!nvmf_ndp_he_ct_compatible(a, b)) {
+		SPDK_ERRLOG("HEaaN: packed ciphertexts of different parameters\n");
+		return -EINVAL;
+	}
+
+	/* The product has the parameters of a, a third polynomial and the scales multiplied */
+	memcpy(out, a, sizeof(*a) + nvmf_ndp_he_ct_primes_len(a));
+	ct->num_polys = 3;
+	ct->log_p = a->log_p + b->log_p;
+
+	if (nvmf_ndp_he_ct_size(ct) > out_len) {
+		return -ENOSPC;
+	}
+
+	return ct->num_words;
+}
+
+int
+nvmf_ndp_he_ct_mul_primes(struct nvmf_ndp_he_ct *a, struct nvmf_ndp_he_ct *b, void *out,
+			  uint32_t first, uint32_t count)
+{
+	const uint64_t *primes = nvmf_ndp_he_ct_primes(a);
+	const struct nvmf_ndp_he_ntt *ntt;
+	uint64_t *a1, *b1, *a2, *b2, *c[3];
+	bool ntt_form = a->flags & NVMF_NDP_HE_CT_F_NTT;
+	uint32_t prime, poly;
+
+	assert(first + count <= a->num_words);
+
+	for (prime = first; prime < first + count; prime++) {
+		ntt = nvmf_ndp_he_ntt_get(primes[prime], a->log_n);
+		if (ntt == NULL) {
+			return -EINVAL;
+		}
+
+		a1 = nvmf_ndp_he_ct_residues(a, 0, prime);
+		b1 = nvmf_ndp_he_ct_residues(a, 1, prime);
+		a2 = nvmf_ndp_he_ct_residues(b, 0, prime);
+		b2 = nvmf_ndp_he_ct_residues(b, 1, prime);
+		for (poly = 0; poly < 3; poly++) {
+			c[poly] = nvmf_ndp_he_ct_residues(out, poly, prime);
+		}
+
+		if (!ntt_form) {
+			nvmf_ndp_he_ntt_forward(ntt, a1);
+			nvmf_ndp_he_ntt_forward(ntt, b1);
+			nvmf_ndp_he_ntt_forward(ntt, a2);
+			nvmf_ndp_he_ntt_forward(ntt, b2);
+		}
+
+		nvmf_ndp_he_ntt_tensor(ntt, a1, b1, a2, b2, c[0], c[1], c[2]);
+
+		if (!ntt_form) {
+			for (poly = 0; poly < 3; poly++) {
+				nvmf_ndp_he_ntt_inverse(ntt, c[poly]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int
+nvmf_ndp_he_ct_mul(struct nvmf_ndp_he_ct *a, struct nvmf_ndp_he_ct *b, void *out,
+		   size_t out_len)
+{
+	int rc;
+
+	rc = nvmf_ndp_he_ct_mul_prepare(a, b, out, out_len);
+	if (rc < 0) {
+		return rc;
+	}
+
+	return nvmf_ndp_he_ct_mul_primes(a, b, out, 0, rc);
+}
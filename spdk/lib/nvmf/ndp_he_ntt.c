@@ -0,0 +1,379 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Number theoretic transform for RNS packed ciphertexts.
+ *
+ * Polynomials are multiplied modulo X^N + 1 and an NTT friendly prime q by
+ * transforming them into evaluation form, where the product is pointwise.
+ * The transforms follow Longa and Naehrig (2016): a Cooley-Tukey forward
+ * transform and a Gentleman-Sande inverse one over the powers of a
+ * primitive 2N-th root of unity psi in bit reversed order, which folds the
+ * negacyclic twist into the butterflies and leaves the evaluation form in
+ * bit reversed order.  Butterflies multiply by a constant twiddle factor,
+ * using its precomputed Shoup quotient (Harvey, 2014) and letting values
+ * grow up to 4q between stages.  Pointwise products multiply two variables
+ * and reduce the 128 bit product with Barrett's method.
+ *
+ * psi is the smallest primitive 2N-th root of unity modulo q, so that the
+ * evaluation form of a polynomial only depends on q and N.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+struct nvmf_ndp_he_ntt {
+	uint64_t		q;
+	uint32_t		log_n;
+
+	/* floor(2^128 / q), least significant word first */
+	uint64_t		ratio[2];
+
+	/* psi^bitrev(i) and psi^-bitrev(i), with their Shoup quotients */
+	uint64_t		*roots;
+	uint64_t		*roots_shoup;
+	uint64_t		*inv_roots;
+	uint64_t		*inv_roots_shoup;
+
+	/* N^-1 */
+	uint64_t		inv_n;
+	uint64_t		inv_n_shoup;
+
+	struct nvmf_ndp_he_ntt	*next;
+};
+
+/* Tables are only added, under the lock, and published to lockless readers */
+static struct nvmf_ndp_he_ntt *g_nvmf_ndp_he_ntts;
+static pthread_mutex_t g_nvmf_ndp_he_ntt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t
+ntt_mulhi(uint64_t x, uint64_t y)
+{
+	return (uint64_t)(((unsigned __int128)x * y) >> 64);
+}
+
+/* x * w mod q in [0, 2q), for any 64 bit x, w below q and w_shoup = floor(w 2^64 / q) */
+static inline uint64_t
+ntt_mul_shoup_lazy(uint64_t x, uint64_t w, uint64_t w_shoup, uint64_t q)
+{
+	return x * w - ntt_mulhi(x, w_shoup) * q;
+}
+
+static inline uint64_t
+ntt_shoup(uint64_t w, uint64_t q)
+{
+	return (uint64_t)(((unsigned __int128)w << 64) / q);
+}
+
+/* z mod q for z below 2^125 */
+static inline uint64_t
+ntt_barrett(const struct nvmf_ndp_he_ntt *ntt, unsigned __int128 z)
+{
+	uint64_t lo = (uint64_t)z, hi = (uint64_t)(z >> 64);
+	unsigned __int128 p1 = (unsigned __int128)lo * ntt->ratio[1];
+	unsigned __int128 p2 = (unsigned __int128)hi * ntt->ratio[0];
+	unsigned __int128 mid;
+	uint64_t quot, r;
+
+	/* floor(z ratio / 2^128), short of at most 2 for the dropped low product */
+	mid = (unsigned __int128)ntt_mulhi(lo, ntt->ratio[0]) + (uint64_t)p1 + (uint64_t)p2;
+	quot = (uint64_t)(p1 >> 64) + (uint64_t)(p2 >> 64) + (uint64_t)(mid >> 64) +
+	       hi * ntt->ratio[1];
+
+	r = lo - quot * ntt->q;
+	while (r >= ntt->q) {
+		r -= ntt->q;
+	}
+
+	return r;
+}
+
+uint64_t
+nvmf_ndp_he_ntt_mulmod(const struct nvmf_ndp_he_ntt *ntt, uint64_t x, uint64_t y)
+{
+	return ntt_barrett(ntt, (unsigned __int128)x * y);
+}
+
+/* Only used to build the tables */
+static uint64_t
+ntt_powmod(uint64_t x, uint64_t e, uint64_t q)
+{
+	unsigned __int128 r = 1, b = x % q;
+
+	while (e != 0) {
+		if (e & 1) {
+			r = r * b % q;
+		}
+		b = b * b % q;
+		e >>= 1;
+	}
+
+	return (uint64_t)r;
+}
+
+/* Deterministic Miller-Rabin, these bases being enough below 2^64 */
+static bool
+ntt_is_prime(uint64_t q)
+{
+	static const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+	uint64_t d = q - 1, x;
+	uint32_t s = 0, i, j;
+
+	if (q < 2) {
+		return false;
+	}
+	for (i = 0; i < SPDK_COUNTOF(bases); i++) {
+		if (q % bases[i] == 0) {
+			return q == bases[i];
+		}
+	}
+
+	while ((d & 1) == 0) {
+		d >>= 1;
+		s++;
+	}
+
+	for (i = 0; i < SPDK_COUNTOF(bases); i++) {
+		x = ntt_powmod(bases[i], d, q);
+		if (x == 1 || x == q - 1) {
+			continue;
+		}
+		for (j = 1; j < s; j++) {
+			x = (uint64_t)((unsigned __int128)x * x % q);
+			if (x == q - 1) {
+				break;
+			}
+		}
+		if (j == s) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static uint32_t
+ntt_bitrev(uint32_t i, uint32_t bits)
+{
+	uint32_t r = 0, b;
+
+	for (b = 0; b < bits; b++) {
+		r = (r << 1) | ((i >> b) & 1);
+	}
+
+	return r;
+}
+
+/* Smallest primitive 2N-th root of unity, 0 if there is none */
+static uint64_t
+ntt_find_psi(uint64_t q, uint32_t log_n)
+{
+	uint64_t n2 = 2ull << log_n, g, psi, psi2, cur, best;
+	uint64_t i;
+
+	/* A quadratic non residue raised to (q - 1) / 2N has order 2N exactly */
+	for (g = 2; g < 1000; g++) {
+		psi = ntt_powmod(g, (q - 1) / n2, q);
+		if (ntt_powmod(psi, n2 / 2, q) == q - 1) {
+			break;
+		}
+	}
+	if (g == 1000) {
+		return 0;
+	}
+
+	/* The primitive roots are its odd powers */
+	psi2 = (uint64_t)((unsigned __int128)psi * psi % q);
+	best = cur = psi;
+	for (i = 1; i < n2 / 2; i++) {
+		cur = (uint64_t)((unsigned __int128)cur * psi2 % q);
+		best = spdk_min(best, cur);
+	}
+
+	return best;
+}
+
+static void
+ntt_free(struct nvmf_ndp_he_ntt *ntt)
+{
+	free(ntt->roots);
+	free(ntt->roots_shoup);
+	free(ntt->inv_roots);
+	free(ntt->inv_roots_shoup);
+	free(ntt);
+}
+
+static struct nvmf_ndp_he_ntt *
+ntt_create(uint64_t q, uint32_t log_n)
+{
+	struct nvmf_ndp_he_ntt *ntt;
+	uint64_t n = 1ull << log_n, psi, inv_psi, pow, inv_pow;
+	unsigned __int128 ratio;
+	uint64_t i;
+	uint32_t r;
+
+	if (log_n == 0 || log_n > NVMF_NDP_HE_CT_MAX_LOG_N ||
+	    q >> NVMF_NDP_HE_NTT_MAX_PRIME_BITS != 0 || q % (2 * n) != 1 || !ntt_is_prime(q)) {
+		SPDK_ERRLOG("HEaaN: %" PRIu64 " is not an NTT prime for N = 2^%u\n", q, log_n);
+		return NULL;
+	}
+
+	psi = ntt_find_psi(q, log_n);
+	if (psi == 0) {
+		SPDK_ERRLOG("HEaaN: no 2^%u-th root of unity modulo %" PRIu64 "\n", log_n + 1, q);
+		return NULL;
+	}
+
+	ntt = calloc(1, sizeof(*ntt));
+	if (ntt == NULL) {
+		return NULL;
+	}
+	ntt->q = q;
+	ntt->log_n = log_n;
+	ratio = ~(unsigned __int128)0 / q;
+	ntt->ratio[0] = (uint64_t)ratio;
+	ntt->ratio[1] = (uint64_t)(ratio >> 64);
+
+	ntt->roots = calloc(n, sizeof(uint64_t));
+	ntt->roots_shoup = calloc(n, sizeof(uint64_t));
+	ntt->inv_roots = calloc(n, sizeof(uint64_t));
+	ntt->inv_roots_shoup = calloc(n, sizeof(uint64_t));
+	if (ntt->roots == NULL || ntt->roots_shoup == NULL || ntt->inv_roots == NULL ||
+	    ntt->inv_roots_shoup == NULL) {
+		ntt_free(ntt);
+		return NULL;
+	}
+
+	inv_psi = ntt_powmod(psi, q - 2, q);
+	pow = inv_pow = 1;
+	for (i = 0; i < n; i++) {
+		r = ntt_bitrev(i, log_n);
+		ntt->roots[r] = pow;
+		ntt->inv_roots[r] = inv_pow;
+		pow = (uint64_t)((unsigned __int128)pow * psi % q);
+		inv_pow = (uint64_t)((unsigned __int128)inv_pow * inv_psi % q);
+	}
+	for (i = 0; i < n; i++) {
+		ntt->roots_shoup[i] = ntt_shoup(ntt->roots[i], q);
+		ntt->inv_roots_shoup[i] = ntt_shoup(ntt->inv_roots[i], q);
+	}
+
+	ntt->inv_n = ntt_powmod(n, q - 2, q);
+	ntt->inv_n_shoup = ntt_shoup(ntt->inv_n, q);
+
+	return ntt;
+}
+
+const struct nvmf_ndp_he_ntt *
+nvmf_ndp_he_ntt_get(uint64_t q, uint32_t log_n)
+{
+	struct nvmf_ndp_he_ntt *ntt;
+
+	for (ntt = __atomic_load_n(&g_nvmf_ndp_he_ntts, __ATOMIC_ACQUIRE); ntt != NULL;
+	     ntt = ntt->next) {
+		if (ntt->q == q && ntt->log_n == log_n) {
+			return ntt;
+		}
+	}
+
+	pthread_mutex_lock(&g_nvmf_ndp_he_ntt_lock);
+	/* Another thread may have built it meanwhile */
+	for (ntt = g_nvmf_ndp_he_ntts; ntt != NULL; ntt = ntt->next) {
+		if (ntt->q == q && ntt->log_n == log_n) {
+			break;
+		}
+	}
+	if (ntt == NULL) {
+		ntt = ntt_create(q, log_n);
+		if (ntt != NULL) {
+			ntt->next = g_nvmf_ndp_he_ntts;
+			__atomic_store_n(&g_nvmf_ndp_he_ntts, ntt, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&g_nvmf_ndp_he_ntt_lock);
+
+	return ntt;
+}
+
+void
+nvmf_ndp_he_ntt_forward(const struct nvmf_ndp_he_ntt *ntt, uint64_t *a)
+{
+	uint64_t n = 1ull << ntt->log_n, q = ntt->q, two_q = 2 * q;
+	uint64_t m, t, i, j, w, w_shoup, x, y;
+	uint64_t *p, *end;
+
+	/* Values stay below 4q */
+	for (m = 1, t = n >> 1; m < n; m <<= 1, t >>= 1) {
+		for (i = 0; i < m; i++) {
+			w = ntt->roots[m + i];
+			w_shoup = ntt->roots_shoup[m + i];
+			p = a + 2 * i * t;
+			end = p + t;
+			for (; p < end; p++) {
+				x = p[0];
+				x -= x >= two_q ? two_q : 0;
+				y = ntt_mul_shoup_lazy(p[t], w, w_shoup, q);
+				p[0] = x + y;
+				p[t] = x - y + two_q;
+			}
+		}
+	}
+
+	for (j = 0; j < n; j++) {
+		x = a[j];
+		x -= x >= two_q ? two_q : 0;
+		a[j] = x - (x >= q ? q : 0);
+	}
+}
+
+void
+nvmf_ndp_he_ntt_inverse(const struct nvmf_ndp_he_ntt *ntt, uint64_t *a)
+{
+	uint64_t n = 1ull << ntt->log_n, q = ntt->q, two_q = 2 * q;
+	uint64_t m, h, t, i, j, w, w_shoup, x, y, u;
+	uint64_t *p, *end;
+
+	/* Values stay below 2q */
+	for (m = n, t = 1; m > 1; m >>= 1, t <<= 1) {
+		h = m >> 1;
+		for (i = 0; i < h; i++) {
+			w = ntt->inv_roots[h + i];
+			w_shoup = ntt->inv_roots_shoup[h + i];
+			p = a + 2 * i * t;
+			end = p + t;
+			for (; p < end; p++) {
+				x = p[0];
+				y = p[t];
+				u = x + y;
+				p[0] = u - (u >= two_q ? two_q : 0);
+				p[t] = ntt_mul_shoup_lazy(x - y + two_q, w, w_shoup, q);
+			}
+		}
+	}
+
+	for (j = 0; j < n; j++) {
+		x = ntt_mul_shoup_lazy(a[j], ntt->inv_n, ntt->inv_n_shoup, q);
+		a[j] = x - (x >= q ? q : 0);
+	}
+}
+
+void
+nvmf_ndp_he_ntt_tensor(const struct nvmf_ndp_he_ntt *ntt, const uint64_t *a1,
+		       const uint64_t *b1, const uint64_t *a2, const uint64_t *b2,
+		       uint64_t *c0, uint64_t *c1, uint64_t *c2)
+{
+	uint64_t n = 1ull << ntt->log_n, i;
+
+	for (i = 0; i < n; i++) {
+		c0[i] = ntt_barrett(ntt, (unsigned __int128)a1[i] * a2[i]);
+		/* Sum of two products below 2^125, reduced once */
+		c1[i] = ntt_barrett(ntt, (unsigned __int128)a1[i] * b2[i] +
+				    (unsigned __int128)a2[i] * b1[i]);
+		c2[i] = ntt_barrett(ntt, (unsigned __int128)b1[i] * b2[i]);
+	}
+}
@@ -0,0 +1,578 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * C interface to libHEAAN for the HEaaN NDP operators, see
+ * include/heaan/HEaaN_CWrapper.h.
+ *
+ * The library is built for one ring (logN and logQ of Params.h), its
+ * ciphertexts hold 2^logN coefficients whatever their number of slots.  The
+ * context is built once and never destroyed: the operators use it from
+ * offload threads until the process exits.  Operations only read the ring
+ * and the keys, so any number of threads run them at once.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "heaan/HEaaN_CWrapper.h"
+#include "HEAAN.h"
+
+#include <complex>
+#include <map>
+#include <new>
+
+/* Bootstrapping first raises the modulus by 2^logI, the default of the library */
+#define HEAAN_LOG_I	4
+
+static heaan_ndp_context g_heaan_ctx;
+static heaan_ndp_context *g_heaan_ctx_ready;
+
+/* Coefficients at logq, which are in [0, 2^logq), are serialized in whole bytes */
+static inline unsigned long
+heaan_coeff_len(long logq)
+{
+	return (logq + 8) / 8;
+}
+
+struct heaan_ser_hdr {
+	uint64_t	n;
+	uint64_t	logp;
+	uint64_t	logq;
+};
+
+static inline Ciphertext *
+heaan_ct(void *cipher)
+{
+	return static_cast<Ciphertext *>(cipher);
+}
+
+static int
+heaan_exception_errno(void)
+{
+	try {
+		throw;
+	} catch (const std::bad_alloc &) {
+		return -ENOMEM;
+	} catch (...) {
+		return -EINVAL;
+	}
+}
+
+extern "C" heaan_ndp_context *
+heaan_Get_Context(void)
+{
+	return __atomic_load_n(&g_heaan_ctx_ready, __ATOMIC_ACQUIRE);
+}
+
+static int
+heaan_check_params(int log_q, int log_p, int log_slots, int log_t, int log_key_q)
+{
+	if (log_p <= 0 || log_q <= log_p || log_key_q <= log_q || log_key_q > logQ ||
+	    log_slots <= 0 || log_slots >= logNh || log_t <= 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void
+heaan_ctx_set_params(int log_q, int log_p, int log_slots, int log_t, int log_key_q)
+{
+	g_heaan_ctx.log_q = log_q;
+	g_heaan_ctx.log_p = log_p;
+	g_heaan_ctx.log_slots = log_slots;
+	g_heaan_ctx.log_t = log_t;
+	g_heaan_ctx.log_key_q = log_key_q;
+}
+
+extern "C" int
+heaan_Initialize(int log_q, int log_p, int log_slots, int log_t, int log_key_q)
+{
+	Ring *ring = NULL;
+	SecretKey *secret_key = NULL;
+	Scheme *scheme = NULL;
+	int rc;
+
+	if (heaan_Get_Context() != NULL) {
+		return -EEXIST;
+	}
+
+	rc = heaan_check_params(log_q, log_p, log_slots, log_t, log_key_q);
+	if (rc != 0) {
+		return rc;
+	}
+
+	try {
+		ring = new Ring();
+		secret_key = new SecretKey(*ring);
+		scheme = new Scheme(*secret_key, *ring);
+		scheme->addBootKey(*secret_key, log_slots, log_q + HEAAN_LOG_I);
+	} catch (...) {
+		rc = heaan_exception_errno();
+		delete scheme;
+		delete secret_key;
+		delete ring;
+		return rc;
+	}
+
+	g_heaan_ctx.ring = ring;
+	g_heaan_ctx.secret_key = secret_key;
+	g_heaan_ctx.scheme = scheme;
+	heaan_ctx_set_params(log_q, log_p, log_slots, log_t, log_key_q);
+	__atomic_store_n(&g_heaan_ctx_ready, &g_heaan_ctx, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Serialization of the context: the header, the secret key, one signed byte
+ * per coefficient, then every key, its id followed by its two polynomials
+ * in RNS form.  Everything is 8 byte aligned so that the keys are used in
+ * place.  The tables of the ring, boot context included, are computed again
+ * when loading: it takes seconds where generating the keys takes minutes.
+ */
+
+#define HEAAN_SER_MAGIC		0x314e414145484e44ull	/* "DNHEAAN1" */
+
+struct heaan_key_ser_hdr {
+	uint64_t	magic;
+	/* The library the keys are for */
+	uint64_t	log_n;
+	uint64_t	log_big_q;
+	uint64_t	nnprimes;
+	/* heaan_Initialize() parameters */
+	uint64_t	params[5];
+	uint64_t	num_keys;
+	uint64_t	num_rot_keys;
+};
+
+static inline unsigned long
+heaan_key_ser_len(void)
+{
+	return sizeof(uint64_t) + 2 * Nnprimes * sizeof(uint64_t);
+}
+
+extern "C" unsigned long
+heaan_Get_SerializedSize(void)
+{
+	Scheme *scheme;
+
+	if (heaan_Get_Context() == NULL) {
+		return 0;
+	}
+
+	scheme = static_cast<Scheme *>(g_heaan_ctx.scheme);
+	return sizeof(struct heaan_key_ser_hdr) + N +
+	       (scheme->keyMap.size() + scheme->leftRotKeyMap.size()) * heaan_key_ser_len();
+}
+
+static uint8_t *
+heaan_keys_write(const std::map<long, Key *> &keys, uint8_t *p)
+{
+	uint64_t id;
+
+	for (auto &it : keys) {
+		id = it.first;
+		memcpy(p, &id, sizeof(id));
+		p += sizeof(id);
+		memcpy(p, it.second->rax, Nnprimes * sizeof(uint64_t));
+		p += Nnprimes * sizeof(uint64_t);
+		memcpy(p, it.second->rbx, Nnprimes * sizeof(uint64_t));
+		p += Nnprimes * sizeof(uint64_t);
+	}
+
+	return p;
+}
+
+extern "C" int
+heaan_Serialize(void *buf, unsigned long len)
+{
+	struct heaan_key_ser_hdr *hdr = static_cast<struct heaan_key_ser_hdr *>(buf);
+	uint8_t *p = static_cast<uint8_t *>(buf) + sizeof(*hdr);
+	SecretKey *secret_key;
+	Scheme *scheme;
+	long i;
+
+	if (heaan_Get_Context() == NULL) {
+		return -ENOENT;
+	}
+	if (len < heaan_Get_SerializedSize()) {
+		return -ENOSPC;
+	}
+
+	secret_key = static_cast<SecretKey *>(g_heaan_ctx.secret_key);
+	scheme = static_cast<Scheme *>(g_heaan_ctx.scheme);
+
+	hdr->magic = HEAAN_SER_MAGIC;
+	hdr->log_n = logN;
+	hdr->log_big_q = logQ;
+	hdr->nnprimes = Nnprimes;
+	hdr->params[0] = g_heaan_ctx.log_q;
+	hdr->params[1] = g_heaan_ctx.log_p;
+	hdr->params[2] = g_heaan_ctx.log_slots;
+	hdr->params[3] = g_heaan_ctx.log_t;
+	hdr->params[4] = g_heaan_ctx.log_key_q;
+	hdr->num_keys = scheme->keyMap.size();
+	hdr->num_rot_keys = scheme->leftRotKeyMap.size();
+
+	/* The secret key has its coefficients in {-1, 0, 1} */
+	for (i = 0; i < N; i++) {
+		p[i] = (uint8_t)(int8_t)conv<long>(secret_key->sx[i]);
+	}
+	p += N;
+
+	p = heaan_keys_write(scheme->keyMap, p);
+	heaan_keys_write(scheme->leftRotKeyMap, p);
+
+	return 0;
+}
+
+/* Keys point into the serialization, which the caller keeps mapped */
+static const uint8_t *
+heaan_keys_read(std::map<long, Key *> &keys, uint64_t num_keys, const uint8_t *p)
+{
+	uint64_t *rx, i, id;
+
+	for (i = 0; i < num_keys; i++) {
+		memcpy(&id, p, sizeof(id));
+		rx = reinterpret_cast<uint64_t *>(const_cast<uint8_t *>(p + sizeof(id)));
+		keys[id] = new Key(rx, rx + Nnprimes);
+		p += heaan_key_ser_len();
+	}
+
+	return p;
+}
+
+extern "C" int
+heaan_Initialize_FromMem(const void *buf, unsigned long len)
+{
+	const struct heaan_key_ser_hdr *hdr = static_cast<const struct heaan_key_ser_hdr *>(buf);
+	const uint8_t *p = static_cast<const uint8_t *>(buf) + sizeof(*hdr);
+	Ring *ring = NULL;
+	SecretKey *secret_key = NULL;
+	Scheme *scheme = NULL;
+	long params[5];
+	int i, rc;
+
+	if (heaan_Get_Context() != NULL) {
+		return -EEXIST;
+	}
+
+	if ((uintptr_t)buf % sizeof(uint64_t) != 0 || len < sizeof(*hdr) + N ||
+	    hdr->magic != HEAAN_SER_MAGIC || hdr->log_n != logN || hdr->log_big_q != logQ ||
+	    hdr->nnprimes != Nnprimes) {
+		return -EINVAL;
+	}
+	if (hdr->num_keys > (len - sizeof(*hdr) - N) / heaan_key_ser_len() ||
+	    hdr->num_rot_keys > (len - sizeof(*hdr) - N) / heaan_key_ser_len() - hdr->num_keys) {
+		return -EINVAL;
+	}
+	for (i = 0; i < 5; i++) {
+		if (hdr->params[i] > INT_MAX) {
+			return -EINVAL;
+		}
+		params[i] = hdr->params[i];
+	}
+	rc = heaan_check_params(params[0], params[1], params[2], params[3], params[4]);
+	if (rc != 0) {
+		return rc;
+	}
+
+	try {
+		ring = new Ring();
+		/* Generated, then replaced by the one serialized */
+		secret_key = new SecretKey(*ring);
+		for (i = 0; i < N; i++) {
+			secret_key->sx[i] = (int8_t)p[i];
+		}
+		p += N;
+
+		scheme = new Scheme(*ring);
+		p = heaan_keys_read(scheme->keyMap, hdr->num_keys, p);
+		heaan_keys_read(scheme->leftRotKeyMap, hdr->num_rot_keys, p);
+
+		ring->addBootContext(params[2], params[0] + HEAAN_LOG_I);
+	} catch (...) {
+		rc = heaan_exception_errno();
+		/* The scheme would free keys pointing into buf, it is left behind */
+		delete secret_key;
+		delete ring;
+		return rc;
+	}
+
+	g_heaan_ctx.ring = ring;
+	g_heaan_ctx.secret_key = secret_key;
+	g_heaan_ctx.scheme = scheme;
+	heaan_ctx_set_params(params[0], params[1], params[2], params[3], params[4]);
+	__atomic_store_n(&g_heaan_ctx_ready, &g_heaan_ctx, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+extern "C" void *
+create_Ciphertext(void)
+{
+	try {
+		return new Ciphertext();
+	} catch (...) {
+		return NULL;
+	}
+}
+
+extern "C" void
+free_Ciphertext(void *cipher)
+{
+	delete heaan_ct(cipher);
+}
+
+extern "C" int
+getCiphertextN(void *cipher)
+{
+	return heaan_ct(cipher)->n;
+}
+
+extern "C" int
+getCiphertextLogp(void *cipher)
+{
+	return heaan_ct(cipher)->logp;
+}
+
+extern "C" int
+getCiphertextLogq(void *cipher)
+{
+	return heaan_ct(cipher)->logq;
+}
+
+extern "C" unsigned long
+getCiphertextMemSize(void *cipher)
+{
+	return sizeof(struct heaan_ser_hdr) + 2 * N * heaan_coeff_len(heaan_ct(cipher)->logq);
+}
+
+static void
+heaan_coeffs_write(const ZZ *coeffs, const ZZ &q, uint8_t *buf, unsigned long len)
+{
+	ZZ c;
+	long i;
+
+	for (i = 0; i < N; i++) {
+		/* Bootstrapping leaves coefficients centered, bring them to [0, q) */
+		rem(c, coeffs[i], q);
+		BytesFromZZ(buf + i * len, c, len);
+	}
+}
+
+static bool
+heaan_coeffs_read(ZZ *coeffs, long logq, const uint8_t *buf, unsigned long len)
+{
+	long i;
+
+	for (i = 0; i < N; i++) {
+		ZZFromBytes(coeffs[i], buf + i * len, len);
+		if (NumBits(coeffs[i]) > logq) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+extern "C" void *
+readCiphertextFromMem(const void *buf, unsigned long size, unsigned long offset)
+{
+	const uint8_t *p = static_cast<const uint8_t *>(buf);
+	struct heaan_ser_hdr hdr;
+	Ciphertext *cipher = NULL;
+	unsigned long len;
+	uint64_t n, logp, logq;
+
+	if (offset > size || size - offset < sizeof(hdr)) {
+		return NULL;
+	}
+
+	memcpy(&hdr, p + offset, sizeof(hdr));
+	n = le64toh(hdr.n);
+	logp = le64toh(hdr.logp);
+	logq = le64toh(hdr.logq);
+	if (n == 0 || n > (uint64_t)Nh || (n & (n - 1)) != 0 || logq == 0 ||
+	    logq > (uint64_t)logQ || logp > logq) {
+		return NULL;
+	}
+
+	len = heaan_coeff_len(logq);
+	if (size - offset - sizeof(hdr) < 2 * N * len) {
+		return NULL;
+	}
+	p += offset + sizeof(hdr);
+
+	try {
+		cipher = new Ciphertext(logp, logq, n);
+		if (!heaan_coeffs_read(cipher->ax, logq, p, len) ||
+		    !heaan_coeffs_read(cipher->bx, logq, p + N * len, len)) {
+			delete cipher;
+			return NULL;
+		}
+	} catch (...) {
+		delete cipher;
+		return NULL;
+	}
+
+	return cipher;
+}
+
+extern "C" void
+writeCiphertextToMem(void *cipher, void *buf, unsigned long offset)
+{
+	Ciphertext *c = heaan_ct(cipher);
+	uint8_t *p = static_cast<uint8_t *>(buf) + offset;
+	unsigned long len = heaan_coeff_len(c->logq);
+	struct heaan_ser_hdr hdr;
+	ZZ q;
+
+	hdr.n = htole64(c->n);
+	hdr.logp = htole64(c->logp);
+	hdr.logq = htole64(c->logq);
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+
+	power2(q, c->logq);
+	heaan_coeffs_write(c->ax, q, p, len);
+	heaan_coeffs_write(c->bx, q, p + N * len, len);
+}
+
+/* Operands of an addition or a multiplication must have the same slots and level */
+static bool
+heaan_ct_match(const Ciphertext *cipher1, const Ciphertext *cipher2, bool same_logp)
+{
+	return cipher1->n == cipher2->n && cipher1->logq == cipher2->logq &&
+	       (!same_logp || cipher1->logp == cipher2->logp);
+}
+
+extern "C" int
+ciphertextAdd(void *scheme, void *res, void *cipher1, void *cipher2)
+{
+	if (!heaan_ct_match(heaan_ct(cipher1), heaan_ct(cipher2), true)) {
+		return -EINVAL;
+	}
+
+	try {
+		static_cast<Scheme *>(scheme)->add(*heaan_ct(res), *heaan_ct(cipher1),
+						   *heaan_ct(cipher2));
+	} catch (...) {
+		return heaan_exception_errno();
+	}
+
+	return 0;
+}
+
+extern "C" int
+ciphertextSub(void *scheme, void *res, void *cipher1, void *cipher2)
+{
+	if (!heaan_ct_match(heaan_ct(cipher1), heaan_ct(cipher2), true)) {
+		return -EINVAL;
+	}
+
+	try {
+		static_cast<Scheme *>(scheme)->sub(*heaan_ct(res), *heaan_ct(cipher1),
+						   *heaan_ct(cipher2));
+	} catch (...) {
+		return heaan_exception_errno();
+	}
+
+	return 0;
+}
+
+extern "C" int
+ciphertextMult(void *scheme, void *res, void *cipher1, void *cipher2)
+{
+	if (!heaan_ct_match(heaan_ct(cipher1), heaan_ct(cipher2), false)) {
+		return -EINVAL;
+	}
+
+	try {
+		static_cast<Scheme *>(scheme)->mult(*heaan_ct(res), *heaan_ct(cipher1),
+						    *heaan_ct(cipher2));
+	} catch (...) {
+		return heaan_exception_errno();
+	}
+
+	return 0;
+}
+
+extern "C" int
+ciphertextReScale(void *scheme, void *cipher)
+{
+	Ciphertext *c = heaan_ct(cipher);
+	long log_p = g_heaan_ctx.log_p;
+
+	/* Nothing would be left of the message */
+	if (c->logq <= log_p || c->logp <= log_p) {
+		return -EINVAL;
+	}
+
+	try {
+		static_cast<Scheme *>(scheme)->reScaleByAndEqual(*c, log_p);
+	} catch (...) {
+		return heaan_exception_errno();
+	}
+
+	return 0;
+}
+
+extern "C" int
+ciphertextBootstrap(void *scheme, void *res, void *cipher)
+{
+	Ciphertext *out = heaan_ct(res), *in = heaan_ct(cipher);
+
+	/* Only ciphertexts of the slots of the bootstrapping keys */
+	if (in->n != (1L << g_heaan_ctx.log_slots) || in->logq < g_heaan_ctx.log_q) {
+		return -EINVAL;
+	}
+
+	try {
+		if (out != in) {
+			out->copy(*in);
+		}
+		static_cast<Scheme *>(scheme)->bootstrapAndEqual(*out, g_heaan_ctx.log_q,
+				g_heaan_ctx.log_key_q, g_heaan_ctx.log_t);
+	} catch (...) {
+		return heaan_exception_errno();
+	}
+
+	return 0;
+}
+
+extern "C" int
+decryptCiphertextToMem(void *scheme, void *cipher, void *buf, unsigned long size)
+{
+	Ciphertext *c = heaan_ct(cipher);
+	uint8_t *p = static_cast<uint8_t *>(buf);
+	std::complex<double> *msg;
+	uint64_t word[2];
+	double d[2];
+	long i;
+
+	if (size / (2 * sizeof(double)) < (unsigned long)c->n) {
+		return -ENOSPC;
+	}
+
+	try {
+		msg = static_cast<Scheme *>(scheme)->decrypt(
+			      *static_cast<SecretKey *>(g_heaan_ctx.secret_key), *c);
+	} catch (...) {
+		return heaan_exception_errno();
+	}
+
+	for (i = 0; i < c->n; i++) {
+		d[0] = msg[i].real();
+		d[1] = msg[i].imag();
+		memcpy(word, d, sizeof(word));
+		word[0] = htole64(word[0]);
+		word[1] = htole64(word[1]);
+		memcpy(p + i * sizeof(word), word, sizeof(word));
+	}
+	delete[] msg;
+
+	return 0;
+}
@@ -0,0 +1,1017 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#ifndef SPDK_NVMF_NDP_INTERNAL_H
+#define SPDK_NVMF_NDP_INTERNAL_H
+
+#include "spdk/stdinc.h"
+
+#include "spdk/assert.h"
+#include "spdk/bdev.h"
+#include "spdk/nvmf_ndp.h"
+#include "spdk/nvmf_transport.h"
+
+/* A contiguous range of blocks on the namespace that an NDP operator reads. */
+struct nvmf_ndp_extent {
+	uint64_t	offset_blocks;
+	uint64_t	num_blocks;
+};
+
+/*
+ * Target descriptor
+ *
+ * Operators that work on host files take the layout of the file from the
+ * data buffer of the command, in the same way as the HEaaN operators do.  All
+ * fields are little endian 64 bit words:
+ *
+ *   word 0           length of the file in bytes (0: all of the extents)
+ *   word 1 + 2 * i   start LBA of extent i
+ *   word 2 + 2 * i   number of blocks of extent i
+ *
+ * The number of extents is given by CDW11.  Operator specific arguments (e.g.
+ * the grep keywords) follow the last extent.
+ */
+
+#define NVMF_NDP_DESC_MAX_EXTENTS	1024
+
+/* Size of a descriptor with n extents, i.e. the offset of the operator arguments */
+#define NVMF_NDP_DESC_SIZE(n)		((1 + 2 * (uint64_t)(n)) * sizeof(uint64_t))
+
+/*
+ * Batch descriptor
+ *
+ * SPDK_NVME_OPC_CUSTOM_BATCH runs one operator over many files in a single
+ * command.  Its data buffer holds, for every file, little endian 64 bit
+ * words:
+ *
+ *   word 0           file id, returned with the result of the file
+ *   word 1           length of the file in bytes (0: all of its extents)
+ *   word 2           number of extents n of the file
+ *   word 3 + 2 * i   start LBA of extent i, for i < n
+ *   word 4 + 2 * i   number of blocks of extent i
+ *
+ * followed by the arguments of the operator.  CDW11 gives the number of
+ * files, CDW12 the number of extents of all of them.
+ */
+
+#define NVMF_NDP_BATCH_MAX_FILES	16384
+#define NVMF_NDP_BATCH_MAX_EXTENTS	65536
+
+#define NVMF_NDP_BATCH_DESC_SIZE(files, extents) \
+	((3 * (uint64_t)(files) + 2 * (uint64_t)(extents)) * sizeof(uint64_t))
+
+struct nvmf_ndp_desc_file {
+	uint64_t	id;
+	uint64_t	length;
+
+	/* The extents of the file in those of the descriptor */
+	uint32_t	first_extent;
+	uint32_t	num_extents;
+};
+
+struct nvmf_ndp_desc {
+	uint64_t		length;
+	uint32_t		num_extents;
+	struct nvmf_ndp_extent	*extents;
+
+	/* Operator arguments, copied out of the data buffer */
+	char			*args;
+	uint32_t		args_len;
+
+	/* Batch descriptor only: the files, the operator and how many files run at once */
+	uint32_t			num_files;
+	struct nvmf_ndp_desc_file	*files;
+	uint8_t				opc;
+	uint8_t				depth;
+};
+
+/*
+ * Parse the target descriptor in the data buffer of req, followed by args_len
+ * bytes of operator arguments, into desc.
+ *
+ * Returns 0 on success, -EINVAL for a malformed descriptor, -ERANGE if an
+ * extent lies outside of bdev, or -ENOMEM.
+ */
+int nvmf_ndp_desc_parse(struct spdk_nvmf_request *req, struct spdk_bdev *bdev,
+			uint32_t args_len, struct nvmf_ndp_desc *desc);
+void nvmf_ndp_desc_free(struct nvmf_ndp_desc *desc);
+
+/*
+ * Parse the batch descriptor in the data buffer of req, followed by args_len
+ * bytes of operator arguments, into desc.  The operator is taken from CDW10
+ * bits 23:16, the number of files run at once from CDW13 bits 7:0 (0 for
+ * NVMF_NDP_BATCH_DEPTH, at most NVMF_NDP_BATCH_MAX_DEPTH).
+ *
+ * Returns as nvmf_ndp_desc_parse().
+ */
+int nvmf_ndp_desc_parse_batch(struct spdk_nvmf_request *req, struct spdk_bdev *bdev,
+			      uint32_t args_len, struct nvmf_ndp_desc *desc);
+
+/* Number of valid bytes described by desc. */
+uint64_t nvmf_ndp_desc_get_length(const struct nvmf_ndp_desc *desc, uint32_t block_size);
+
+/* Set the NVMe status of req from an errno style status (0 for success). */
+void nvmf_ndp_set_status(struct spdk_nvmf_request *req, int status);
+
+/*
+ * Jobs
+ *
+ * An operator that runs over several chunks or ciphertexts tracks the
+ * command as a job, kept by the poll group of its subsystem, from the time it
+ * starts until right before it completes the command.  Aborting the command (NVMe Abort),
+ * disconnecting the queue pair, or running past the timeout set for the
+ * opcode (see spdk_nvmf_ndp_set_timeout()) only marks the job: the operator
+ * checks it between chunks, stops there and completes the command with the
+ * status nvmf_ndp_job_check() returned.  A job is only touched on the poll
+ * group thread of its queue pair.
+ */
+
+struct nvmf_ndp_job {
+	struct spdk_nvmf_request	*req;
+
+	/* Poll group of the subsystem tracking the job */
+	struct spdk_nvmf_subsystem_poll_group	*sgroup;
+
+	/* Tick count the command times out at, 0 for none */
+	uint64_t			deadline_tsc;
+
+	/* 0, or -ECANCELED, -ENOTCONN or -ETIMEDOUT once the command is to stop */
+	int				status;
+
+	TAILQ_ENTRY(nvmf_ndp_job)	link;
+};
+
+/* Start tracking req as job, its deadline taken from the timeout of its opcode. */
+void nvmf_ndp_job_begin(struct nvmf_ndp_job *job, struct spdk_nvmf_request *req);
+
+/*
+ * Returns 0 if the job is to go on, or the negated errno to complete its
+ * command with: -ECANCELED if it was aborted, -ENOTCONN if its queue pair is
+ * being disconnected, -ETIMEDOUT if it ran past its deadline.
+ */
+int nvmf_ndp_job_check(struct nvmf_ndp_job *job);
+
+/* Stop tracking the job, before its command is completed. */
+void nvmf_ndp_job_end(struct nvmf_ndp_job *job);
+
+/*
+ * Result cursors
+ *
+ * Operators with variable length output (echo, grep) fill the data buffer
+ * of the command and complete with
+ *
+ *   CQE DW0 bits 30:0   number of valid bytes in the data buffer
+ *   CQE DW0 bit 31      NVMF_NDP_RESULT_MORE: the result didn't fit
+ *   CQE DW1             cursor, if NVMF_NDP_RESULT_MORE is set
+ *
+ * Only the valid bytes are transferred.  The rest of the result is fetched
+ * with SPDK_NVME_OPC_CUSTOM_FETCH (CDW10: cursor, CDW11 bit 0: release the
+ * cursor without fetching), which resumes the operator where the previous
+ * command stopped instead of scanning the file again.  Cursors are kept for
+ * NVMF_NDP_CURSOR_TIMEOUT_SEC after their last use and can only be used by
+ * the controller and namespace that created them.
+ */
+
+#define NVMF_NDP_RESULT_MORE		(1u << 31)
+#define NVMF_NDP_RESULT_LEN_MASK	(NVMF_NDP_RESULT_MORE - 1)
+
+#define NVMF_NDP_FETCH_RELEASE		(1u << 0)
+
+#define NVMF_NDP_CURSOR_MAX		64
+#define NVMF_NDP_CURSOR_TIMEOUT_SEC	30
+
+/*
+ * Batch results
+ *
+ * The result of a batch is a run of entries in file order: a struct
+ * nvmf_ndp_batch_entry, then the len bytes the operator returned for the
+ * file, padded to 8 bytes.  Entries are never split between two parts of
+ * the result.  The result of one file is limited to what fits in the data
+ * buffer along with its entry; the rest is dropped and the entry flagged
+ * NVMF_NDP_BATCH_F_TRUNCATED.
+ */
+
+#define NVMF_NDP_BATCH_DEPTH		4
+#define NVMF_NDP_BATCH_MAX_DEPTH	16
+
+#define NVMF_NDP_BATCH_F_TRUNCATED	(1u << 0)
+
+struct nvmf_ndp_batch_entry {
+	uint64_t	id;
+	uint32_t	len;
+	/* Positive errno of the file, 0 if the operator succeeded on it */
+	uint16_t	status;
+	uint16_t	flags;
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_batch_entry) == 16, "Incorrect size");
+
+struct nvmf_ndp_cursor;
+struct nvmf_ndp_cache_entry;
+
+/*
+ * Continue the operator into the data buffer of req, from cursor->offset.
+ * Returns 0 if started, in which case nvmf_ndp_cursor_complete() will be
+ * called for req, or a negated errno.
+ */
+typedef int (*nvmf_ndp_cursor_run_fn)(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+				      struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+				      struct spdk_nvmf_request *req);
+
+struct nvmf_ndp_cursor {
+	uint32_t			id;
+
+	/* Owner */
+	struct spdk_nvmf_subsystem	*subsystem;
+	uint16_t			cntlid;
+	uint32_t			nsid;
+
+	nvmf_ndp_cursor_run_fn		run_fn;
+
+	/* Input of the operator, and the offset in it the next command starts at */
+	struct nvmf_ndp_desc		target;
+	uint64_t			offset;
+
+	/* Result cache entry to fill if the whole result fits into the first command */
+	struct nvmf_ndp_cache_entry	*cache_fill;
+
+	uint64_t			expire_tsc;
+	TAILQ_ENTRY(nvmf_ndp_cursor)	link;
+};
+
+/*
+ * Create a cursor owned by the controller and namespace of req.  It takes
+ * over the content of target.  Returns NULL on allocation failure, target is
+ * left untouched then.
+ */
+struct nvmf_ndp_cursor *nvmf_ndp_cursor_create(struct spdk_nvmf_request *req,
+		struct nvmf_ndp_desc *target, nvmf_ndp_cursor_run_fn run_fn);
+void nvmf_ndp_cursor_free(struct nvmf_ndp_cursor *cursor);
+
+/*
+ * Clear the data buffer of req for the result of an operator and, unless ix
+ * is NULL, start ix at its beginning to write it.
+ */
+void nvmf_ndp_result_init(struct spdk_nvmf_request *req, struct spdk_iov_xfer *ix);
+
+/* Set a successful completion of req with len valid bytes in its data buffer. */
+void nvmf_ndp_set_result(struct spdk_nvmf_request *req, uint32_t len);
+
+/*
+ * Complete req with len valid bytes.  If more is set, the cursor is kept to
+ * continue at offset, otherwise (or on error) it is freed.
+ */
+void nvmf_ndp_cursor_complete(struct nvmf_ndp_cursor *cursor, struct spdk_nvmf_request *req,
+			      int status, uint32_t len, bool more, uint64_t offset);
+
+/*
+ * Don't cache the result of the cursor, which depends on the size of the
+ * data buffer: a larger one would have returned more.
+ */
+void nvmf_ndp_cursor_skip_cache(struct nvmf_ndp_cursor *cursor);
+
+/*
+ * Result cache
+ *
+ * Results of read-only operators that fit into the data buffer of the first
+ * command are cached, keyed by the bdev, the opcode, the target descriptor
+ * and the operator arguments.  A lookup that misses returns an entry that is
+ * filled when the operator completes, unless a command modifying one of its
+ * extents is seen in the meantime.  Modifying commands are checked both when
+ * they are submitted and when they complete, so a result read while a write
+ * is outstanding is never cached.  Entries are also indexed by bdev and
+ * first block, and a modifying command takes the lock only if its blocks
+ * are within those of the results cached for its bdev.  A single result may
+ * use up to 1/8 of the capacity.
+ */
+
+#define NVMF_NDP_CACHE_BUCKETS		256
+#define NVMF_NDP_CACHE_BDEV_SLOTS	64
+#define NVMF_NDP_CACHE_ENTRY_SHIFT	3
+
+/*
+ * Look up the result of req for target on bdev.  On a hit the result is
+ * copied into the data buffer of req and its length is returned.  Otherwise
+ * -ENOENT is returned and *fill is set to the entry to pass to
+ * nvmf_ndp_cache_fill() or nvmf_ndp_cache_abort(), or NULL if the result
+ * can't be cached.
+ */
+int nvmf_ndp_cache_lookup(struct spdk_bdev *bdev, struct spdk_nvmf_request *req,
+			  const struct nvmf_ndp_desc *target, struct nvmf_ndp_cache_entry **fill);
+
+/* Cache the first len bytes of the data buffer of req as the result of fill. */
+void nvmf_ndp_cache_fill(struct nvmf_ndp_cache_entry *fill, struct spdk_nvmf_request *req,
+			 uint32_t len);
+void nvmf_ndp_cache_abort(struct nvmf_ndp_cache_entry *fill);
+
+/* Drop the results computed from blocks in [offset_blocks, offset_blocks + num_blocks). */
+void nvmf_ndp_cache_invalidate(struct spdk_bdev *bdev, uint64_t offset_blocks,
+			       uint64_t num_blocks);
+
+/*
+ * Extent gather / scatter
+ *
+ * Read a list of extents into a buffer (gather) or write a buffer out to them
+ * (scatter).  The extents are laid out back to back in the buffer, which may
+ * be split over several iovecs.  I/Os are split at the optimal I/O boundary
+ * of the bdev and at NVMF_NDP_IO_MAX_SIZE, up to NVMF_NDP_IO_MAX_OUTSTANDING
+ * of them are kept in flight, and -ENOMEM from the bdev layer is retried once
+ * bdev_ios are available again.
+ */
+
+#define NVMF_NDP_IO_MAX_OUTSTANDING	32
+#define NVMF_NDP_IO_MAX_SIZE		(1024 * 1024)
+#define NVMF_NDP_IO_MAX_IOVS		8
+
+/*
+ * Called once when all I/Os have completed, i.e. the buffer is no longer in
+ * use.  status is 0 on success or the first error.
+ */
+typedef void (*nvmf_ndp_io_done_fn)(void *cb_arg, int status);
+
+/*
+ * Returns 0 if the I/O was started, in which case done_fn will be called
+ * exactly once.  Otherwise nothing was started and done_fn won't be called:
+ * -EINVAL if the buffer is smaller than the extents, -ERANGE if an extent
+ * lies outside of the bdev, or the error of the first submission.
+ */
+int nvmf_ndp_gather(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		    const struct nvmf_ndp_extent *extents, uint32_t num_extents,
+		    struct iovec *iov, int iovcnt, nvmf_ndp_io_done_fn done_fn, void *cb_arg);
+int nvmf_ndp_scatter(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		     const struct nvmf_ndp_extent *extents, uint32_t num_extents,
+		     struct iovec *iov, int iovcnt, nvmf_ndp_io_done_fn done_fn, void *cb_arg);
+
+/*
+ * Offload executor
+ *
+ * Runs the computation of an operator on one of the NDP offload threads
+ * (see spdk_nvmf_ndp_offload_start()) and hands the result back to the
+ * calling thread.
+ */
+
+/* Called on an offload thread.  Returns the status passed to the done function. */
+typedef int (*nvmf_ndp_offload_work_fn)(void *ctx);
+
+/* Called on the thread that submitted the job, with the status of work_fn. */
+typedef void (*nvmf_ndp_offload_done_fn)(void *ctx, int status);
+
+/*
+ * Submit a job.  Returns 0 if it was submitted, in which case done_fn will be
+ * called exactly once.  Returns -ENODEV if there are no offload threads, or
+ * -ENOMEM; the caller then runs the computation itself.
+ */
+int nvmf_ndp_offload(nvmf_ndp_offload_work_fn work_fn, nvmf_ndp_offload_done_fn done_fn,
+		     void *ctx);
+
+/*
+ * Streaming executor
+ *
+ * Reads a list of extents in fixed size chunks and hands them to an operator
+ * in order, while the following chunks are still being read.  Only `depth`
+ * chunk buffers are ever allocated for a job, so the amount of memory used
+ * does not depend on the size of the input.
+ */
+
+#define NVMF_NDP_STREAM_CHUNK_SIZE	(128 * 1024)
+#define NVMF_NDP_STREAM_DEPTH		3
+#define NVMF_NDP_STREAM_MAX_DEPTH	8
+#define NVMF_NDP_STREAM_MAX_RECORD_LEN	(64 * 1024)
+
+enum nvmf_ndp_stream_mode {
+	/* Chunks are delivered as they were read. */
+	NVMF_NDP_STREAM_MODE_RAW,
+
+	/*
+	 * Only whole newline terminated records are delivered.  A record that
+	 * crosses a chunk (or extent) boundary is carried over and delivered
+	 * with the next chunk.  Records longer than max_record_len are split.
+	 * The last record of the stream may miss its terminating newline.
+	 */
+	NVMF_NDP_STREAM_MODE_LINES,
+};
+
+struct nvmf_ndp_stream_opts {
+	/*
+	 * Bytes read per chunk.  Rounded down to a multiple of the block size,
+	 * or of the bdev's optimal I/O boundary if it has one (see
+	 * nvmf_ndp_stream_start()).
+	 */
+	uint32_t			chunk_size;
+
+	/* Number of chunks in flight (2 = double buffering, 3 = triple buffering). */
+	uint32_t			depth;
+
+	enum nvmf_ndp_stream_mode	mode;
+
+	/* Size of the carry buffer used in NVMF_NDP_STREAM_MODE_LINES. */
+	uint32_t			max_record_len;
+
+	/*
+	 * Number of bytes of the extents that hold valid data, 0 for all of them.
+	 * Used to skip the padding at the end of the last block of a file.
+	 */
+	uint64_t			length;
+
+	/*
+	 * Number of bytes of the extents to skip, e.g. to resume an operator
+	 * where a previous command stopped.  Must be smaller than the length.
+	 */
+	uint64_t			offset;
+
+	/*
+	 * Read the chunks in place from the bdev's own buffers (bdev zcopy) when
+	 * the bdev supports it, instead of copying them into chunk buffers.  The
+	 * operator must not modify the data then.
+	 */
+	bool				zcopy;
+
+	/*
+	 * Call data_fn on the NDP offload threads, if any, rather than on the
+	 * poll group thread.  Chunks are still delivered one at a time and in
+	 * order.
+	 */
+	bool				offload;
+
+	/*
+	 * Job of a command that runs several streams, e.g. a batch, checked
+	 * before every chunk.  NULL for the stream to track req as a job of
+	 * its own.
+	 */
+	struct nvmf_ndp_job		*job;
+};
+
+/*
+ * Called once per chunk, in stream order.  The iovecs are only valid for the
+ * duration of the call and must be treated as read only.  Return 0 to
+ * continue, a positive value to stop the stream successfully (e.g. the result
+ * buffer is full), or a negated errno to abort it.
+ */
+typedef int (*nvmf_ndp_stream_data_fn)(void *cb_arg, struct iovec *iov, int iovcnt);
+
+/*
+ * Called once when the stream is finished and all of its I/O has completed.
+ * status is 0 on success or a negated errno.
+ */
+typedef void (*nvmf_ndp_stream_done_fn)(void *cb_arg, int status);
+
+void nvmf_ndp_stream_opts_init(struct nvmf_ndp_stream_opts *opts);
+
+/*
+ * Start streaming the extents of req's namespace through data_fn.
+ *
+ * Returns 0 if the stream was started, in which case done_fn will be called
+ * exactly once, with the status of nvmf_ndp_job_check() if the job stopped
+ * the stream.  Otherwise nothing was started and done_fn won't be called:
+ * -EINVAL for invalid options or an empty range, -ERANGE if an extent lies
+ * outside of the bdev, -ENOMEM on allocation failure.
+ */
+int nvmf_ndp_stream_start(struct spdk_nvmf_request *req, struct spdk_bdev_desc *desc,
+			  struct spdk_io_channel *ch, const struct nvmf_ndp_extent *extents,
+			  uint32_t num_extents, const struct nvmf_ndp_stream_opts *opts,
+			  nvmf_ndp_stream_data_fn data_fn, nvmf_ndp_stream_done_fn done_fn,
+			  void *cb_arg);
+
+/*
+ * iobuf channel of the transport poll group of req, or NULL if the transport
+ * doesn't use the iobuf pool.  Buffers must be taken and returned on the
+ * thread of the poll group.
+ */
+struct spdk_iobuf_channel *nvmf_ndp_req_get_iobuf(struct spdk_nvmf_request *req);
+
+/*
+ * Grep engine
+ *
+ * Matches a set of fixed string keywords against newline separated text in a
+ * single pass (Aho-Corasick automaton), scanning the input in place.  Runs of
+ * bytes that cannot start a match are skipped 32 (AVX2) or 16 (SSE4.2) bytes
+ * at a time.  The engine keeps its state between calls, so lines and
+ * keywords may cross iovec and chunk boundaries freely.
+ */
+
+/* Upper limit for the sum of the keyword lengths (bounds the automaton size). */
+#define NVMF_NDP_GREP_MAX_PATTERN_LEN	4096
+
+struct nvmf_ndp_grep;
+
+/*
+ * Called for every matching line.  The line, including its terminating
+ * newline if any, may be split over several iovecs, which are only valid for
+ * the duration of the call.  Return values as for nvmf_ndp_stream_data_fn.
+ */
+typedef int (*nvmf_ndp_grep_match_fn)(void *cb_arg, struct iovec *iov, int iovcnt);
+
+/*
+ * Compile newline separated keywords.  Empty keywords are ignored.
+ *
+ * max_line_len limits how much of a line crossing a call boundary is kept;
+ * longer lines are still matched as a whole but reported truncated.
+ *
+ * Returns NULL if there is no keyword, the keywords are too long, or on
+ * allocation failure.
+ */
+struct nvmf_ndp_grep *nvmf_ndp_grep_create(const char *patterns, size_t len,
+		uint32_t max_line_len);
+void nvmf_ndp_grep_free(struct nvmf_ndp_grep *grep);
+
+/* Number of keywords compiled into grep. */
+uint32_t nvmf_ndp_grep_num_patterns(const struct nvmf_ndp_grep *grep);
+
+/*
+ * Offset just past the line being reported, counted in bytes of input since
+ * the engine was created or last finished.  Only valid within match_fn.
+ */
+uint64_t nvmf_ndp_grep_line_end(const struct nvmf_ndp_grep *grep);
+
+/*
+ * Scan the next part of the input.  match_fn is called for every line
+ * completed by this input that contains at least one of the keywords.
+ * Returns 0, or the first non-zero value returned by match_fn.
+ */
+int nvmf_ndp_grep_scan(struct nvmf_ndp_grep *grep, struct iovec *iov, int iovcnt,
+		       nvmf_ndp_grep_match_fn match_fn, void *cb_arg);
+
+/*
+ * End of input: report the last line if it misses its terminating newline
+ * and matches, then reset the engine for new input.
+ */
+int nvmf_ndp_grep_finish(struct nvmf_ndp_grep *grep, nvmf_ndp_grep_match_fn match_fn,
+			 void *cb_arg);
+
+/*
+ * Filter engine
+ *
+ * Evaluates a predicate over delimited records (CSV, TSV, ...) and reports
+ * the matching ones, either whole or reduced to a list of columns.  The
+ * predicate is compiled by the host into a program, all fields little endian:
+ *
+ *   struct nvmf_ndp_filter_hdr
+ *   num_columns 16 bit indices of the columns to return (none: the whole
+ *               record), padded to 8 bytes
+ *   num_insns   instructions, each a struct nvmf_ndp_filter_insn followed by
+ *               its constant padded to 8 bytes
+ *
+ * Instructions are evaluated in postfix order on a stack of booleans: a
+ * comparison pushes the result of comparing a column with its constant, AND,
+ * OR and NOT combine the top of the stack.  A program without instructions
+ * matches every record.  Columns are counted from 0.  A
+ * comparison on a missing column, or a numeric comparison on a column that
+ * doesn't hold a number, is false.  Quotes are not interpreted, a quoted
+ * delimiter still separates two columns.
+ */
+
+#define NVMF_NDP_FILTER_MAGIC		0x4650444e	/* "NDPF" */
+#define NVMF_NDP_FILTER_MAX_INSNS	256
+#define NVMF_NDP_FILTER_MAX_DEPTH	64
+#define NVMF_NDP_FILTER_MAX_COLUMNS	64
+#define NVMF_NDP_FILTER_MAX_COLUMN	1023
+
+struct nvmf_ndp_filter_hdr {
+	uint32_t	magic;
+	uint8_t		delimiter;
+	uint8_t		reserved;
+	uint16_t	num_columns;
+	uint16_t	num_insns;
+	uint8_t		reserved2[6];
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_filter_hdr) == 16, "Incorrect size");
+
+enum nvmf_ndp_filter_op {
+	NVMF_NDP_FILTER_OP_EQ		= 1,
+	NVMF_NDP_FILTER_OP_NE		= 2,
+	NVMF_NDP_FILTER_OP_LT		= 3,
+	NVMF_NDP_FILTER_OP_LE		= 4,
+	NVMF_NDP_FILTER_OP_GT		= 5,
+	NVMF_NDP_FILTER_OP_GE		= 6,
+	/* The column contains the constant, strings only */
+	NVMF_NDP_FILTER_OP_CONTAINS	= 7,
+	NVMF_NDP_FILTER_OP_AND		= 8,
+	NVMF_NDP_FILTER_OP_OR		= 9,
+	NVMF_NDP_FILTER_OP_NOT		= 10,
+};
+
+enum nvmf_ndp_filter_type {
+	/* Byte wise, as memcmp() */
+	NVMF_NDP_FILTER_TYPE_STRING	= 0,
+	/* 64 bit signed integer constant */
+	NVMF_NDP_FILTER_TYPE_INT	= 1,
+	/* IEEE 754 double constant */
+	NVMF_NDP_FILTER_TYPE_FLOAT	= 2,
+};
+
+struct nvmf_ndp_filter_insn {
+	uint8_t		op;
+	uint8_t		type;
+	uint16_t	column;
+
+	/* Length of the constant, 0 for AND, OR and NOT */
+	uint32_t	len;
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_filter_insn) == 8, "Incorrect size");
+
+struct nvmf_ndp_filter;
+
+/*
+ * Called for every matching record, with the record or its selected columns
+ * (separated by the delimiter) followed by a newline.  The iovecs are only
+ * valid for the duration of the call.  Return values as for
+ * nvmf_ndp_stream_data_fn.
+ */
+typedef int (*nvmf_ndp_filter_match_fn)(void *cb_arg, struct iovec *iov, int iovcnt);
+
+/*
+ * Compile a program.  Bytes following the last instruction are ignored.
+ * Returns NULL if the program is malformed or on allocation failure.
+ */
+struct nvmf_ndp_filter *nvmf_ndp_filter_create(const void *prog, size_t len);
+void nvmf_ndp_filter_free(struct nvmf_ndp_filter *filter);
+
+/*
+ * Filter the next part of the input.  Every iovec must hold whole newline
+ * terminated records, except for the last record of the input, as delivered
+ * by NVMF_NDP_STREAM_MODE_LINES.  Returns 0, or the first non-zero value
+ * returned by match_fn.
+ */
+int nvmf_ndp_filter_scan(struct nvmf_ndp_filter *filter, struct iovec *iov, int iovcnt,
+			 nvmf_ndp_filter_match_fn match_fn, void *cb_arg);
+
+/*
+ * Offset just past the record being reported, counted in bytes of input
+ * since the filter was created.  Only valid within match_fn.
+ */
+uint64_t nvmf_ndp_filter_record_end(const struct nvmf_ndp_filter *filter);
+
+uint16_t nvmf_ndp_filter_num_columns(const struct nvmf_ndp_filter *filter);
+
+/*
+ * Selected column i of the record being reported, and its length in len.
+ * Returns NULL if the record has no such column.  Only valid within match_fn.
+ */
+const char *nvmf_ndp_filter_column(const struct nvmf_ndp_filter *filter, uint16_t i,
+				   uint32_t *len);
+
+/*
+ * Also split column of every record, whether or not the program refers to
+ * it, so that nvmf_ndp_filter_field() can return it.  Returns 0, -EINVAL for
+ * a column above NVMF_NDP_FILTER_MAX_COLUMN, or -ENOMEM.
+ */
+int nvmf_ndp_filter_split_column(struct nvmf_ndp_filter *filter, uint16_t column);
+
+/*
+ * Column of the record being reported, counted from 0 in the record rather
+ * than in the selection, and its length in len.  Returns NULL if the record
+ * has no such column or it wasn't split.  Only valid within match_fn.
+ */
+const char *nvmf_ndp_filter_field(const struct nvmf_ndp_filter *filter, uint16_t column,
+				  uint32_t *len);
+
+/*
+ * Parse a column as the filter compares it: a decimal number, optionally
+ * signed and surrounded by whitespace.  Floats also take exponents and
+ * infinities, but not NaN.  Return false if the column is not a number.
+ */
+bool nvmf_ndp_parse_int(const char *p, uint32_t len, int64_t *val);
+bool nvmf_ndp_parse_float(const char *p, uint32_t len, double *val);
+
+/*
+ * Aggregate engine
+ *
+ * Folds a numeric column of the records matching a filter program into a
+ * count, sum, minimum and maximum, and optionally a histogram.  The arguments
+ * are a struct nvmf_ndp_agg_hdr followed by a filter program selecting
+ * exactly one column, the one aggregated.  Records where that column is
+ * missing or not a number are counted as records, but not aggregated.
+ *
+ * The result is a struct nvmf_ndp_agg_result, followed for a histogram by
+ * its SPDK_HISTOGRAM_NUM_BUCKETS() 64 bit counters, in the layout of struct
+ * spdk_histogram_data.  Values are truncated to integers for the histogram,
+ * negative values are only counted.  All fields are little endian.
+ */
+
+#define NVMF_NDP_AGG_MAGIC		0x4150444e	/* "NDPA" */
+#define NVMF_NDP_AGG_MAX_BUCKET_SHIFT	7
+
+/* Request a histogram with bucket_shift */
+#define NVMF_NDP_AGG_FLAG_HISTOGRAM	(1u << 0)
+/* The integer sum overflowed and is not valid */
+#define NVMF_NDP_AGG_FLAG_OVERFLOW	(1u << 1)
+
+struct nvmf_ndp_agg_hdr {
+	uint32_t	magic;
+	/* NVMF_NDP_FILTER_TYPE_INT or NVMF_NDP_FILTER_TYPE_FLOAT */
+	uint8_t		type;
+	uint8_t		flags;
+	uint8_t		bucket_shift;
+	uint8_t		reserved[9];
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_agg_hdr) == 16, "Incorrect size");
+
+struct nvmf_ndp_agg_result {
+	/* Records matching the predicate, and those holding a number */
+	uint64_t	records;
+	uint64_t	count;
+
+	/* int64_t or double as requested, 0 if count is 0 */
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+
+	/* Numbers left out of the histogram for being negative */
+	uint64_t	negative;
+
+	uint8_t		type;
+	uint8_t		flags;
+	uint8_t		bucket_shift;
+	uint8_t		reserved;
+	/* Histogram counters following the result */
+	uint32_t	num_buckets;
+	uint8_t		reserved2[8];
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_agg_result) == 64, "Incorrect size");
+
+struct nvmf_ndp_agg;
+
+/* Returns NULL if the arguments are malformed or on allocation failure. */
+struct nvmf_ndp_agg *nvmf_ndp_agg_create(const void *args, size_t len);
+void nvmf_ndp_agg_free(struct nvmf_ndp_agg *agg);
+
+/* Aggregate the next part of the input, delivered as for nvmf_ndp_filter_scan(). */
+void nvmf_ndp_agg_scan(struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt);
+
+/* Size of the result, including the histogram. */
+size_t nvmf_ndp_agg_result_size(const struct nvmf_ndp_agg *agg);
+
+/* Write the result to iov.  Returns the number of bytes written. */
+size_t nvmf_ndp_agg_get_result(const struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt);
+
+/*
+ * Regex engine
+ *
+ * Runs a DFA compiled by the host over newline separated lines and reports
+ * those it accepts.  Compiling on the host keeps regular expression parsing
+ * off the target, which only validates and runs a table: a constant cost per
+ * byte and no allocation while scanning.  The program, all fields little
+ * endian:
+ *
+ *   struct nvmf_ndp_regex_hdr
+ *   classes     256 bytes mapping every input byte to its class
+ *   transitions num_states * num_classes 16 bit next states, row by row
+ *
+ * State 0 is dead: no line reaching it can be accepted any more.  State 1
+ * accepts the line.  Neither is left once reached, their rows are ignored.
+ * The last class is not the class of any byte, it is followed at the end of
+ * a line, which lets the host implement "$".  Each line is run from start,
+ * without its trailing "\r\n" or "\n".
+ */
+
+#define NVMF_NDP_REGEX_MAGIC		0x5250444e	/* "NDPR" */
+#define NVMF_NDP_REGEX_MAX_STATES	4096
+#define NVMF_NDP_REGEX_DEAD		0
+#define NVMF_NDP_REGEX_MATCH		1
+
+struct nvmf_ndp_regex_hdr {
+	uint32_t	magic;
+	uint16_t	num_states;
+	/* Byte classes, plus the end of line class */
+	uint16_t	num_classes;
+	uint16_t	start;
+	uint8_t		reserved[6];
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_regex_hdr) == 16, "Incorrect size");
+
+struct nvmf_ndp_regex;
+
+/*
+ * Called for every accepted line, including its newline (one is added to
+ * the last line if it misses it).  Return values as for
+ * nvmf_ndp_stream_data_fn.
+ */
+typedef int (*nvmf_ndp_regex_match_fn)(void *cb_arg, struct iovec *iov, int iovcnt);
+
+/*
+ * Load a program.  Bytes following the transitions are ignored.  Returns
+ * NULL if the program is malformed or on allocation failure.
+ */
+struct nvmf_ndp_regex *nvmf_ndp_regex_create(const void *prog, size_t len);
+void nvmf_ndp_regex_free(struct nvmf_ndp_regex *regex);
+
+/*
+ * Match the next part of the input, delivered as for nvmf_ndp_filter_scan().
+ * Returns 0, or the first non-zero value returned by match_fn.
+ */
+int nvmf_ndp_regex_scan(struct nvmf_ndp_regex *regex, struct iovec *iov, int iovcnt,
+			nvmf_ndp_regex_match_fn match_fn, void *cb_arg);
+
+/* As nvmf_ndp_filter_record_end(), for the line being reported. */
+uint64_t nvmf_ndp_regex_line_end(const struct nvmf_ndp_regex *regex);
+
+/*
+ * Top-K and sampling engine
+ *
+ * Keeps a bounded set of the records matching a filter program: either the K
+ * records with the largest (or smallest) numeric key, or a uniform random
+ * sample of K of them.  The arguments are a struct nvmf_ndp_topk_hdr followed
+ * by a filter program, which also chooses what is kept of a record: the whole
+ * record or its selected columns.
+ *
+ * The records kept, with their newline, are copied into a fixed size heap
+ * taken from a mempool when the engine is created, and the result never
+ * exceeds the size given then.  Once the records that rank best no longer fit
+ * in it, the following ones are dropped: the result is then the longest run
+ * of best ranking records that fits, fewer than K.  Sampled records that
+ * don't fit in place of the one they would replace are skipped.  Records are
+ * truncated to the result size.
+ *
+ * Top-K results are sorted, the best first; equal keys keep the input order.
+ * Samples are in input order.  Records whose key is missing or not a number
+ * are skipped by top-K.
+ */
+
+#define NVMF_NDP_TOPK_MAGIC		0x4b50444e	/* "NDPK" */
+#define NVMF_NDP_TOPK_MAX_K		4096
+
+/* Keep the smallest keys instead of the largest */
+#define NVMF_NDP_TOPK_FLAG_ASCENDING	(1u << 0)
+
+struct nvmf_ndp_topk_hdr {
+	uint32_t	magic;
+	/* NVMF_NDP_FILTER_TYPE_INT or NVMF_NDP_FILTER_TYPE_FLOAT, 0 for a sample */
+	uint8_t		type;
+	uint8_t		flags;
+	/* Column of the key, counted in the record, 0 for a sample */
+	uint16_t	key_column;
+	uint32_t	k;
+	/* Seed of the sampling, which is repeatable for a given seed */
+	uint32_t	seed;
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_topk_hdr) == 16, "Incorrect size");
+
+struct nvmf_ndp_topk;
+
+/*
+ * \param sample Draw a sample rather than keeping the top K.
+ * \param result_size Size limit of the result.
+ * \param _topk The engine created.
+ *
+ * \return 0 on success, -EINVAL if the arguments are malformed, -ENOMEM on
+ * allocation failure or -EAGAIN if no heap is left in the mempool until a
+ * running command completes.
+ */
+int nvmf_ndp_topk_create(const void *args, size_t len, bool sample, uint32_t result_size,
+			 struct nvmf_ndp_topk **_topk);
+void nvmf_ndp_topk_free(struct nvmf_ndp_topk *topk);
+
+/* Scan the next part of the input, whole records as for nvmf_ndp_filter_scan(). */
+void nvmf_ndp_topk_scan(struct nvmf_ndp_topk *topk, struct iovec *iov, int iovcnt);
+
+/*
+ * Write the records kept, each newline terminated, into iov.  Returns the
+ * number of bytes written.  Can only be called once, it orders the heap.
+ */
+size_t nvmf_ndp_topk_get_result(struct nvmf_ndp_topk *topk, struct iovec *iov, int iovcnt);
+
+/*
+ * True if the result is short of what a larger result size would have kept:
+ * a record was dropped, skipped or truncated for lack of space.
+ */
+bool nvmf_ndp_topk_truncated(const struct nvmf_ndp_topk *topk);
+
+/*
+ * Packed ciphertexts
+ *
+ * A ciphertext laid out so that the HEaaN operators use it in place from
+ * the buffer its extents were read into, rather than deserializing it into
+ * big integers and serializing the result back.  A struct nvmf_ndp_he_ct
+ * is followed by num_polys polynomials (a and b, then a third one for the
+ * product of a multiplication), each of 2^log_n coefficients.  A
+ * coefficient is its value modulo 2^log_q in num_words 64 bit words, the
+ * least significant first.  The header being 64 bytes, the coefficients of
+ * an aligned buffer are aligned for vector loads.  All fields are little
+ * endian.
+ *
+ * With NVMF_NDP_HE_CT_F_RNS, the modulus is instead the product of
+ * num_words NTT friendly primes (below 2^62, 1 modulo 2^(log_n + 1)),
+ * listed after the header and padded to 64 bytes.  Every polynomial is then
+ * stored as its residues modulo each prime in turn, 2^log_n words each, so
+ * that every residue polynomial is contiguous and independent of the
+ * others.  NVMF_NDP_HE_CT_F_NTT marks residues in evaluation (NTT) form.
+ *
+ * Addition and subtraction are computed coefficient by coefficient, modulo
+ * 2^log_q as libHEAAN does, or modulo each prime, straight into the output
+ * buffer.  RNS ciphertexts are also multiplied: the product of (a1, b1) and
+ * (a2, b2) is the three polynomials (a1 a2, a1 b2 + a2 b1, b1 b2), left
+ * for the host to relinearize or decrypt with s^2, its scale being the
+ * product of the scales.
+ */
+
+#define NVMF_NDP_HE_CT_MAGIC		0x4350444e	/* "NDPC" */
+#define NVMF_NDP_HE_CT_VERSION		1
+#define NVMF_NDP_HE_CT_MAX_LOG_N	17
+#define NVMF_NDP_HE_CT_MAX_LOG_Q	4096
+#define NVMF_NDP_HE_CT_MAX_POLYS	3
+#define NVMF_NDP_HE_CT_MAX_PRIMES	64
+
+/* Residues modulo the primes following the header rather than multiword integers */
+#define NVMF_NDP_HE_CT_F_RNS		(1u << 0)
+/* RNS residues in evaluation form */
+#define NVMF_NDP_HE_CT_F_NTT		(1u << 1)
+
+struct nvmf_ndp_he_ct {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	flags;
+	uint8_t		log_n;
+	/* 2, or 3 for a product; 0 is taken as 2 */
+	uint8_t		num_polys;
+	uint8_t		reserved[2];
+	uint32_t	log_q;
+	/* Scale and message slots, carried over to the result */
+	uint32_t	log_p;
+	uint32_t	log_slots;
+	/* (log_q + 63) / 64, or the number of primes */
+	uint32_t	num_words;
+	uint8_t		reserved2[36];
+};
+SPDK_STATIC_ASSERT(sizeof(struct nvmf_ndp_he_ct) == 64, "Incorrect size");
+
+/* Bytes taken by a packed ciphertext, header included. */
+size_t nvmf_ndp_he_ct_size(const struct nvmf_ndp_he_ct *ct);
+
+/*
+ * Check that buf starts with a packed ciphertext held in len bytes.  Returns
+ * -ENOENT if buf doesn't start with one, so that it is taken as serialized
+ * by the library, and -EINVAL if it is malformed or not 8 byte aligned.
+ */
+int nvmf_ndp_he_ct_check(const void *buf, size_t len);
+
+/*
+ * Check the packed ciphertext at offset in a file of size bytes read into
+ * buf, as nvmf_ndp_he_ct_check() does, and return it in *ct.  Returns
+ * -EINVAL if offset is past the end of the file.
+ */
+int nvmf_ndp_he_ct_get(void *buf, uint64_t size, uint64_t offset, struct nvmf_ndp_he_ct **ct);
+
+/*
+ * out = a + b or a - b.  Returns -EINVAL if the parameters of a and b differ,
+ * -ENOSPC if the result doesn't fit in out_len bytes.  out may be a or b.
+ */
+int nvmf_ndp_he_ct_add(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		       void *out, size_t out_len);
+int nvmf_ndp_he_ct_sub(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+		       void *out, size_t out_len);
+
+/*
+ * Multiplication of RNS ciphertexts, split by prime so that the primes can
+ * be worked on by different threads.  nvmf_ndp_he_ct_mul_prepare() checks
+ * a and b, writes the header and primes of the product to out and returns
+ * the number of primes.  nvmf_ndp_he_ct_mul_primes() then computes the
+ * residues of the product modulo count primes from first, using a and b,
+ * which must be distinct from each other and from out, as scratch: their
+ * residues modulo those primes are left in evaluation form.
+ */
+int nvmf_ndp_he_ct_mul_prepare(const struct nvmf_ndp_he_ct *a, const struct nvmf_ndp_he_ct *b,
+			       void *out, size_t out_len);
+int nvmf_ndp_he_ct_mul_primes(struct nvmf_ndp_he_ct *a, struct nvmf_ndp_he_ct *b, void *out,
+			      uint32_t first, uint32_t count);
+
+/* out = a * b, as the two calls above on all primes */
+int nvmf_ndp_he_ct_mul(struct nvmf_ndp_he_ct *a, struct nvmf_ndp_he_ct *b, void *out,
+		       size_t out_len);
+
+/*
+ * Number theoretic transform
+ *
+ * Negacyclic NTT over Z_q[X]/(X^N + 1), with the twiddle factors in bit
+ * reversed order and multiplied by Shoup's precomputed quotients, so that
+ * every butterfly is two multiplications and no division.  Values are kept
+ * below 4q between the stages (Harvey's lazy reduction), hence the bound of
+ * 2^62 on q.  Coefficients are reduced below q on output.
+ */
+
+#define NVMF_NDP_HE_NTT_MAX_PRIME_BITS	62
+
+struct nvmf_ndp_he_ntt;
+
+/*
+ * Tables of the NTT modulo q of ring dimension 2^log_n, computed on first
+ * use and kept for the life of the process.  Returns NULL if q is not an NTT
+ * friendly prime for that dimension or on allocation failure.
+ */
+const struct nvmf_ndp_he_ntt *nvmf_ndp_he_ntt_get(uint64_t q, uint32_t log_n);
+
+/* In place transforms of 2^log_n coefficients below q. */
+void nvmf_ndp_he_ntt_forward(const struct nvmf_ndp_he_ntt *ntt, uint64_t *a);
+void nvmf_ndp_he_ntt_inverse(const struct nvmf_ndp_he_ntt *ntt, uint64_t *a);
+
+/* x * y mod q for x, y below q. */
+uint64_t nvmf_ndp_he_ntt_mulmod(const struct nvmf_ndp_he_ntt *ntt, uint64_t x, uint64_t y);
+
+/*
+ * Pointwise product of two ciphertexts in evaluation form, residues modulo
+ * the prime of ntt: c0 = a1 a2, c1 = a1 b2 + a2 b1, c2 = b1 b2.
+ */
+void nvmf_ndp_he_ntt_tensor(const struct nvmf_ndp_he_ntt *ntt, const uint64_t *a1,
+			    const uint64_t *b1, const uint64_t *a2, const uint64_t *b2,
+			    uint64_t *c0, uint64_t *c1, uint64_t *c2);
+
+#endif /* SPDK_NVMF_NDP_INTERNAL_H */
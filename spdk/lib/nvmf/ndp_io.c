@@ -0,0 +1,353 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Extent gather / scatter: move a list of extents between the namespace and
+ * a memory buffer with as many I/Os in flight as possible, and a single
+ * completion callback once all of them are done.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/bdev.h"
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+struct nvmf_ndp_io;
+
+struct nvmf_ndp_io_task {
+	struct nvmf_ndp_io		*io;
+	bool				busy;
+	struct iovec			iov[NVMF_NDP_IO_MAX_IOVS];
+	int				iovcnt;
+};
+
+struct nvmf_ndp_io {
+	struct spdk_bdev		*bdev;
+	struct spdk_bdev_desc		*desc;
+	struct spdk_io_channel		*ch;
+	bool				write;
+	uint32_t			block_size;
+	uint32_t			boundary;
+	uint64_t			max_io_blocks;
+
+	nvmf_ndp_io_done_fn		done_fn;
+	void				*cb_arg;
+
+	/* Cursor in the extent list */
+	uint32_t			ext_idx;
+	uint64_t			ext_offset_blocks;
+
+	/* Cursor in the buffer */
+	int				iov_idx;
+	size_t				iov_offset;
+
+	uint32_t			outstanding;
+	bool				waiting;
+	int				status;
+
+	struct spdk_bdev_io_wait_entry	bdev_io_wait;
+	struct nvmf_ndp_io_task		tasks[NVMF_NDP_IO_MAX_OUTSTANDING];
+
+	struct iovec			*iov;
+	int				iovcnt;
+	uint32_t			num_extents;
+	struct nvmf_ndp_extent		extents[];
+};
+
+static void nvmf_ndp_io_submit(struct nvmf_ndp_io *io);
+
+static void
+nvmf_ndp_io_free(struct nvmf_ndp_io *io)
+{
+	free(io->iov);
+	free(io);
+}
+
+static void
+nvmf_ndp_io_check_done(struct nvmf_ndp_io *io)
+{
+	if (io->outstanding != 0 || io->waiting) {
+		return;
+	}
+
+	if (io->status == 0 && io->ext_idx < io->num_extents) {
+		return;
+	}
+
+	io->done_fn(io->cb_arg, io->status);
+	nvmf_ndp_io_free(io);
+}
+
+static void
+nvmf_ndp_io_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+	struct nvmf_ndp_io_task *task = cb_arg;
+	struct nvmf_ndp_io *io = task->io;
+
+	spdk_bdev_free_io(bdev_io);
+
+	task->busy = false;
+	io->outstanding--;
+	if (!success && io->status == 0) {
+		SPDK_ERRLOG("NDP extent %s failed\n", io->write ? "write" : "read");
+		io->status = -EIO;
+	}
+
+	nvmf_ndp_io_submit(io);
+	nvmf_ndp_io_check_done(io);
+}
+
+static void
+nvmf_ndp_io_resume(void *cb_arg)
+{
+	struct nvmf_ndp_io *io = cb_arg;
+
+	io->waiting = false;
+	nvmf_ndp_io_submit(io);
+	nvmf_ndp_io_check_done(io);
+}
+
+/*
+ * Map len bytes of the buffer, starting at the cursor, into at most
+ * NVMF_NDP_IO_MAX_IOVS iovecs.  Returns the number of bytes mapped and leaves
+ * the position following them in iov_idx/iov_offset.
+ */
+static uint64_t
+nvmf_ndp_io_map(struct nvmf_ndp_io *io, uint64_t len, struct iovec *iov, int *iovcnt,
+		int *iov_idx, size_t *iov_offset)
+{
+	uint64_t mapped = 0;
+	size_t seg;
+	char *base;
+
+	*iovcnt = 0;
+	while (mapped < len && *iov_idx < io->iovcnt && *iovcnt < NVMF_NDP_IO_MAX_IOVS) {
+		seg = spdk_min(io->iov[*iov_idx].iov_len - *iov_offset, len - mapped);
+		if (seg > 0) {
+			if (iov != NULL) {
+				base = io->iov[*iov_idx].iov_base;
+				iov[*iovcnt].iov_base = base + *iov_offset;
+				iov[*iovcnt].iov_len = seg;
+			}
+			(*iovcnt)++;
+			mapped += seg;
+			*iov_offset += seg;
+		}
+		if (*iov_offset == io->iov[*iov_idx].iov_len) {
+			(*iov_idx)++;
+			*iov_offset = 0;
+		}
+	}
+
+	return mapped;
+}
+
+/*
+ * Prepare the next I/O at the cursor.  Returns its number of blocks, 0 if the
+ * buffer is too fragmented to hold a single block.
+ */
+static uint64_t
+nvmf_ndp_io_prep(struct nvmf_ndp_io *io, struct nvmf_ndp_io_task *task, int *iov_idx,
+		 size_t *iov_offset)
+{
+	struct nvmf_ndp_extent *ext = &io->extents[io->ext_idx];
+	uint64_t offset_blocks = ext->offset_blocks + io->ext_offset_blocks;
+	uint64_t num_blocks = ext->num_blocks - io->ext_offset_blocks;
+	uint64_t mapped;
+
+	/* Don't cross the optimal I/O boundary, the bdev would split the I/O anyway */
+	if (io->boundary != 0) {
+		num_blocks = spdk_min(num_blocks, io->boundary - offset_blocks % io->boundary);
+	}
+	num_blocks = spdk_min(num_blocks, io->max_io_blocks);
+
+	/* Cut the I/O at the last whole block that fits in the task's iovecs */
+	*iov_idx = io->iov_idx;
+	*iov_offset = io->iov_offset;
+	mapped = nvmf_ndp_io_map(io, num_blocks * io->block_size, NULL, &task->iovcnt,
+				 iov_idx, iov_offset);
+	num_blocks = mapped / io->block_size;
+	if (num_blocks == 0) {
+		return 0;
+	}
+
+	*iov_idx = io->iov_idx;
+	*iov_offset = io->iov_offset;
+	nvmf_ndp_io_map(io, num_blocks * io->block_size, task->iov, &task->iovcnt,
+			iov_idx, iov_offset);
+
+	return num_blocks;
+}
+
+static void
+nvmf_ndp_io_submit(struct nvmf_ndp_io *io)
+{
+	struct nvmf_ndp_io_task *task;
+	struct nvmf_ndp_extent *ext;
+	uint64_t offset_blocks, num_blocks;
+	size_t iov_offset;
+	int i, iov_idx, rc;
+
+	while (io->status == 0 && !io->waiting && io->ext_idx < io->num_extents) {
+		task = NULL;
+		for (i = 0; i < NVMF_NDP_IO_MAX_OUTSTANDING; i++) {
+			if (!io->tasks[i].busy) {
+				task = &io->tasks[i];
+				break;
+			}
+		}
+		if (task == NULL) {
+			return;
+		}
+
+		ext = &io->extents[io->ext_idx];
+		offset_blocks = ext->offset_blocks + io->ext_offset_blocks;
+		num_blocks = nvmf_ndp_io_prep(io, task, &iov_idx, &iov_offset);
+		if (num_blocks == 0) {
+			SPDK_ERRLOG("NDP buffer too fragmented for a single block\n");
+			io->status = -EINVAL;
+			return;
+		}
+
+		if (io->write) {
+			rc = spdk_bdev_writev_blocks(io->desc, io->ch, task->iov, task->iovcnt,
+						     offset_blocks, num_blocks,
+						     nvmf_ndp_io_complete, task);
+		} else {
+			rc = spdk_bdev_readv_blocks(io->desc, io->ch, task->iov, task->iovcnt,
+						    offset_blocks, num_blocks,
+						    nvmf_ndp_io_complete, task);
+		}
+
+		if (rc == -ENOMEM) {
+			/* Out of bdev_ios, retry once some are released */
+			io->bdev_io_wait.bdev = io->bdev;
+			io->bdev_io_wait.cb_fn = nvmf_ndp_io_resume;
+			io->bdev_io_wait.cb_arg = io;
+			rc = spdk_bdev_queue_io_wait(io->bdev, io->ch, &io->bdev_io_wait);
+			if (rc == 0) {
+				io->waiting = true;
+				return;
+			}
+		}
+
+		if (rc != 0) {
+			SPDK_ERRLOG("Failed to submit NDP extent %s: %d\n",
+				    io->write ? "write" : "read", rc);
+			io->status = rc;
+			return;
+		}
+
+		task->busy = true;
+		io->outstanding++;
+
+		io->iov_idx = iov_idx;
+		io->iov_offset = iov_offset;
+		io->ext_offset_blocks += num_blocks;
+		if (io->ext_offset_blocks == ext->num_blocks) {
+			io->ext_idx++;
+			io->ext_offset_blocks = 0;
+		}
+	}
+}
+
+static int
+nvmf_ndp_io_start(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch, bool write,
+		  const struct nvmf_ndp_extent *extents, uint32_t num_extents,
+		  struct iovec *iov, int iovcnt, nvmf_ndp_io_done_fn done_fn, void *cb_arg)
+{
+	struct spdk_bdev *bdev = spdk_bdev_desc_get_bdev(desc);
+	uint64_t bdev_num_blocks = spdk_bdev_get_num_blocks(bdev);
+	uint32_t block_size = spdk_bdev_get_block_size(bdev);
+	uint64_t total = 0, buf_len = 0;
+	struct nvmf_ndp_io *io;
+	uint32_t i;
+	int rc;
+
+	if (num_extents == 0 || iovcnt <= 0) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num_extents; i++) {
+		if (extents[i].num_blocks == 0 ||
+		    extents[i].offset_blocks + extents[i].num_blocks > bdev_num_blocks ||
+		    extents[i].offset_blocks + extents[i].num_blocks < extents[i].offset_blocks) {
+			SPDK_ERRLOG("NDP extent %u (%" PRIu64 "+%" PRIu64 ") is out of range\n",
+				    i, extents[i].offset_blocks, extents[i].num_blocks);
+			return -ERANGE;
+		}
+		total += extents[i].num_blocks * block_size;
+	}
+
+	for (i = 0; i < (uint32_t)iovcnt; i++) {
+		buf_len += iov[i].iov_len;
+	}
+	if (buf_len < total) {
+		SPDK_ERRLOG("NDP buffer of %" PRIu64 " bytes is too small for %" PRIu64
+			    " bytes of extents\n", buf_len, total);
+		return -EINVAL;
+	}
+
+	io = calloc(1, sizeof(*io) + num_extents * sizeof(*extents));
+	if (io == NULL) {
+		return -ENOMEM;
+	}
+
+	io->iov = calloc(iovcnt, sizeof(*iov));
+	if (io->iov == NULL) {
+		free(io);
+		return -ENOMEM;
+	}
+	memcpy(io->iov, iov, iovcnt * sizeof(*iov));
+	io->iovcnt = iovcnt;
+
+	io->bdev = bdev;
+	io->desc = desc;
+	io->ch = ch;
+	io->write = write;
+	io->block_size = block_size;
+	io->boundary = spdk_bdev_get_optimal_io_boundary(bdev);
+	io->max_io_blocks = spdk_max(NVMF_NDP_IO_MAX_SIZE / block_size, 1);
+	io->done_fn = done_fn;
+	io->cb_arg = cb_arg;
+	io->num_extents = num_extents;
+	memcpy(io->extents, extents, num_extents * sizeof(*extents));
+
+	for (i = 0; i < NVMF_NDP_IO_MAX_OUTSTANDING; i++) {
+		io->tasks[i].io = io;
+	}
+
+	nvmf_ndp_io_submit(io);
+
+	if (io->outstanding == 0 && !io->waiting) {
+		/* Nothing could be submitted */
+		rc = io->status;
+		assert(rc != 0);
+		nvmf_ndp_io_free(io);
+		return rc;
+	}
+
+	return 0;
+}
+
+int
+nvmf_ndp_gather(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		const struct nvmf_ndp_extent *extents, uint32_t num_extents,
+		struct iovec *iov, int iovcnt, nvmf_ndp_io_done_fn done_fn, void *cb_arg)
+{
+	return nvmf_ndp_io_start(desc, ch, false, extents, num_extents, iov, iovcnt,
+				 done_fn, cb_arg);
+}
+
+int
+nvmf_ndp_scatter(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		 const struct nvmf_ndp_extent *extents, uint32_t num_extents,
+		 struct iovec *iov, int iovcnt, nvmf_ndp_io_done_fn done_fn, void *cb_arg)
+{
+	return nvmf_ndp_io_start(desc, ch, true, extents, num_extents, iov, iovcnt,
+				 done_fn, cb_arg);
+}
@@ -0,0 +1,230 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * NDP offload executor: a pool of SPDK threads, normally placed on cores
+ * that run no poll group, on which the computation of NDP operators runs so
+ * that it doesn't stall the queue pairs of the poll group that received the
+ * command.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/cpuset.h"
+#include "spdk/log.h"
+#include "spdk/nvmf_ndp.h"
+#include "spdk/string.h"
+#include "spdk/thread.h"
+
+struct nvmf_ndp_offload_job {
+	nvmf_ndp_offload_work_fn	work_fn;
+	nvmf_ndp_offload_done_fn	done_fn;
+	void				*ctx;
+	int				status;
+
+	/* Thread that submitted the job, done_fn runs there */
+	struct spdk_thread		*origin;
+};
+
+struct nvmf_ndp_offload {
+	struct spdk_thread		**threads;
+	uint32_t			num_threads;
+
+	/* Round robin cursor, shared by all poll groups */
+	uint32_t			next;
+
+	/* Stop in progress */
+	uint32_t			num_exiting;
+	spdk_nvmf_ndp_offload_stop_cb	stop_cb;
+	void				*stop_cb_arg;
+	struct spdk_thread		*stop_thread;
+};
+
+/*
+ * Only modified by start/stop, which run while no poll group exists, so poll
+ * groups can read it without locking.
+ */
+static struct nvmf_ndp_offload g_nvmf_ndp_offload;
+
+int
+spdk_nvmf_ndp_offload_start(const struct spdk_cpuset *cpumask, uint32_t num_threads)
+{
+	struct nvmf_ndp_offload *offload = &g_nvmf_ndp_offload;
+	char thread_name[32];
+	uint32_t i;
+
+	if (offload->threads != NULL) {
+		SPDK_ERRLOG("NDP offload threads already started\n");
+		return -EEXIST;
+	}
+
+	if (cpumask == NULL && num_threads == 0) {
+		/* Operators run on the poll group threads */
+		return 0;
+	}
+
+	if (num_threads == 0) {
+		/* One thread per core of the mask */
+		num_threads = spdk_cpuset_count(cpumask);
+		if (num_threads == 0) {
+			SPDK_ERRLOG("Empty NDP offload cpumask\n");
+			return -EINVAL;
+		}
+	}
+
+	offload->threads = calloc(num_threads, sizeof(*offload->threads));
+	if (offload->threads == NULL) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		snprintf(thread_name, sizeof(thread_name), "nvmf_ndp_offload_%03u", i);
+		offload->threads[i] = spdk_thread_create(thread_name, cpumask);
+		if (offload->threads[i] == NULL) {
+			SPDK_ERRLOG("Unable to create NDP offload thread %s\n", thread_name);
+			break;
+		}
+	}
+
+	if (i == 0) {
+		free(offload->threads);
+		offload->threads = NULL;
+		return -ENOMEM;
+	}
+	offload->num_threads = i;
+
+	SPDK_NOTICELOG("Started %u of %u NDP offload threads\n", i, num_threads);
+
+	return 0;
+}
+
+static void
+nvmf_ndp_offload_stop_done(void *ctx)
+{
+	struct nvmf_ndp_offload *offload = &g_nvmf_ndp_offload;
+	spdk_nvmf_ndp_offload_stop_cb cb_fn;
+	void *cb_arg;
+
+	assert(offload->num_exiting > 0);
+	if (--offload->num_exiting > 0) {
+		return;
+	}
+
+	cb_fn = offload->stop_cb;
+	cb_arg = offload->stop_cb_arg;
+
+	free(offload->threads);
+	memset(offload, 0, sizeof(*offload));
+
+	if (cb_fn != NULL) {
+		cb_fn(cb_arg);
+	}
+}
+
+static void
+nvmf_ndp_offload_thread_exit(void *ctx)
+{
+	struct nvmf_ndp_offload *offload = &g_nvmf_ndp_offload;
+
+	/* Messages are processed in order, so all jobs queued before are done */
+	spdk_thread_exit(spdk_get_thread());
+	spdk_thread_send_msg(offload->stop_thread, nvmf_ndp_offload_stop_done, NULL);
+}
+
+void
+spdk_nvmf_ndp_offload_stop(spdk_nvmf_ndp_offload_stop_cb cb_fn, void *cb_arg)
+{
+	struct nvmf_ndp_offload *offload = &g_nvmf_ndp_offload;
+	uint32_t i;
+
+	if (offload->num_threads == 0) {
+		free(offload->threads);
+		memset(offload, 0, sizeof(*offload));
+		if (cb_fn != NULL) {
+			cb_fn(cb_arg);
+		}
+		return;
+	}
+
+	offload->stop_cb = cb_fn;
+	offload->stop_cb_arg = cb_arg;
+	offload->stop_thread = spdk_get_thread();
+	offload->num_exiting = offload->num_threads;
+	assert(offload->stop_thread != NULL);
+
+	for (i = 0; i < offload->num_threads; i++) {
+		spdk_thread_send_msg(offload->threads[i], nvmf_ndp_offload_thread_exit, NULL);
+	}
+}
+
+uint32_t
+spdk_nvmf_ndp_offload_get_num_threads(void)
+{
+	return g_nvmf_ndp_offload.num_threads;
+}
+
+static void
+nvmf_ndp_offload_job_done(void *arg)
+{
+	struct nvmf_ndp_offload_job *job = arg;
+
+	job->done_fn(job->ctx, job->status);
+	free(job);
+}
+
+static void
+nvmf_ndp_offload_job_run(void *arg)
+{
+	struct nvmf_ndp_offload_job *job = arg;
+	int rc;
+
+	job->status = job->work_fn(job->ctx);
+
+	rc = spdk_thread_send_msg(job->origin, nvmf_ndp_offload_job_done, job);
+	if (spdk_unlikely(rc != 0)) {
+		/* The job can't be dropped, its request would never complete */
+		SPDK_ERRLOG("Unable to send NDP offload job back to %s: %s\n",
+			    spdk_thread_get_name(job->origin), spdk_strerror(-rc));
+		assert(false);
+	}
+}
+
+int
+nvmf_ndp_offload(nvmf_ndp_offload_work_fn work_fn, nvmf_ndp_offload_done_fn done_fn, void *ctx)
+{
+	struct nvmf_ndp_offload *offload = &g_nvmf_ndp_offload;
+	struct nvmf_ndp_offload_job *job;
+	struct spdk_thread *thread;
+	uint32_t idx;
+	int rc;
+
+	if (offload->num_threads == 0 || offload->num_exiting != 0) {
+		return -ENODEV;
+	}
+
+	job = malloc(sizeof(*job));
+	if (job == NULL) {
+		return -ENOMEM;
+	}
+
+	job->work_fn = work_fn;
+	job->done_fn = done_fn;
+	job->ctx = ctx;
+	job->status = 0;
+	job->origin = spdk_get_thread();
+	assert(job->origin != NULL);
+
+	idx = __atomic_fetch_add(&offload->next, 1, __ATOMIC_RELAXED) % offload->num_threads;
+	thread = offload->threads[idx];
+
+	rc = spdk_thread_send_msg(thread, nvmf_ndp_offload_job_run, job);
+	if (rc != 0) {
+		free(job);
+		return rc;
+	}
+
+	return 0;
+}
@@ -0,0 +1,804 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Built-in NDP operators running on top of the streaming executor.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/log.h"
+#include "spdk/nvme_spec.h"
+#include "spdk/nvmf_ndp.h"
+#include "spdk/util.h"
+
+/*
+ * Echo
+ *
+ * Returns the content of the file described by the target descriptor in the
+ * data buffer (CDW11: number of extents).  The request is turned into a
+ * controller to host transfer on completion; a file larger than the buffer
+ * is returned in several parts through a result cursor.
+ */
+
+struct nvmf_ndp_echo_ctx {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct spdk_iov_xfer		ix;
+	uint32_t			len;
+	uint64_t			total;
+};
+
+static int
+nvmf_ndp_echo_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_echo_ctx *ctx = cb_arg;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		ctx->len += spdk_iov_xfer_from_buf(&ctx->ix, iov[i].iov_base, iov[i].iov_len);
+	}
+
+	/* Stop reading once the host buffer is full */
+	return ctx->len == ctx->req->length ? 1 : 0;
+}
+
+static void
+nvmf_ndp_echo_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_echo_ctx *ctx = cb_arg;
+	struct nvmf_ndp_cursor *cursor = ctx->cursor;
+	uint64_t end = cursor->offset + ctx->len;
+
+	SPDK_DEBUGLOG(nvmf, "NDP echo returned %u bytes at %" PRIu64 ", status %d\n", ctx->len,
+		      cursor->offset, status);
+
+	nvmf_ndp_cursor_complete(cursor, ctx->req, status, ctx->len, end < ctx->total, end);
+	free(ctx);
+}
+
+static int
+nvmf_ndp_echo_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		  struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		  struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_echo_ctx *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return -ENOMEM;
+	}
+	ctx->req = req;
+	ctx->cursor = cursor;
+	ctx->total = nvmf_ndp_desc_get_length(&cursor->target, spdk_bdev_get_block_size(bdev));
+
+	nvmf_ndp_result_init(req, &ctx->ix);
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.length = cursor->target.length;
+	opts.offset = cursor->offset;
+	rc = nvmf_ndp_stream_start(req, desc, ch, cursor->target.extents,
+				   cursor->target.num_extents, &opts, nvmf_ndp_echo_data,
+				   nvmf_ndp_echo_done, ctx);
+	if (rc != 0) {
+		free(ctx);
+	}
+
+	return rc;
+}
+
+/*
+ * Parse the target descriptor of req and answer it from the result cache, or
+ * into a new cursor and run the operator from the start of the file.
+ */
+static int
+nvmf_ndp_cursor_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		     struct spdk_io_channel *ch, struct spdk_nvmf_request *req,
+		     uint32_t args_len, nvmf_ndp_cursor_run_fn run_fn)
+{
+	struct nvmf_ndp_cache_entry *fill;
+	struct nvmf_ndp_cursor *cursor;
+	struct nvmf_ndp_desc target;
+	int rc;
+
+	rc = nvmf_ndp_desc_parse(req, bdev, args_len, &target);
+	if (rc != 0) {
+		nvmf_ndp_set_status(req, rc);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	rc = nvmf_ndp_cache_lookup(bdev, req, &target, &fill);
+	if (rc >= 0) {
+		nvmf_ndp_desc_free(&target);
+		nvmf_ndp_set_result(req, rc);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	cursor = nvmf_ndp_cursor_create(req, &target, run_fn);
+	if (cursor == NULL) {
+		if (fill != NULL) {
+			nvmf_ndp_cache_abort(fill);
+		}
+		nvmf_ndp_desc_free(&target);
+		nvmf_ndp_set_status(req, -ENOMEM);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+	cursor->cache_fill = fill;
+
+	rc = run_fn(cursor, bdev, desc, ch, req);
+	if (rc != 0) {
+		nvmf_ndp_cursor_free(cursor);
+		nvmf_ndp_set_status(req, rc);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
+}
+
+/*
+ * nvmf_ndp_cursor_exec() for an operator whose arguments follow the target
+ * descriptor (CDW11: number of extents), their length in the low 16 bits of
+ * CDW10 (0 for the rest of the buffer).
+ */
+static int
+nvmf_ndp_args_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		   struct spdk_io_channel *ch, struct spdk_nvmf_request *req,
+		   nvmf_ndp_cursor_run_fn run_fn)
+{
+	struct spdk_nvme_cmd *cmd = &req->cmd->nvme_cmd;
+	uint32_t args_len = cmd->cdw10 & 0xFFFF;
+	uint64_t desc_size = NVMF_NDP_DESC_SIZE(cmd->cdw11);
+
+	if (req->iovcnt == 0 || desc_size >= req->length) {
+		nvmf_ndp_set_status(req, -EINVAL);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	if (args_len == 0) {
+		args_len = req->length - desc_size;
+	}
+
+	return nvmf_ndp_cursor_exec(bdev, desc, ch, req, args_len, run_fn);
+}
+
+static int
+nvmf_ndp_echo_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		   struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	if (req->iovcnt == 0 || req->length == 0) {
+		nvmf_ndp_set_status(req, -EINVAL);
+		return SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE;
+	}
+
+	return nvmf_ndp_cursor_exec(bdev, desc, ch, req, 0, nvmf_ndp_echo_run);
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_echo_op = {
+	.name = "echo",
+	.opc = SPDK_NVME_OPC_CUSTOM_ECHO,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_echo_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(echo, &g_nvmf_ndp_echo_op);
+
+/*
+ * Grep
+ *
+ * The data buffer holds the target descriptor (CDW11: number of extents)
+ * followed by the keywords, one per line (their length in the low 16 bits of
+ * CDW10, 0 for the rest of the buffer).  The lines containing any of the
+ * keywords are written back into the data buffer and the request is turned
+ * into a controller to host transfer on completion.  Lines are never split
+ * between two parts of the result, unless a single line exceeds the buffer.
+ */
+
+struct nvmf_ndp_grep_ctx {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct nvmf_ndp_grep		*grep;
+	struct spdk_iov_xfer		ix;
+	uint32_t			len;
+	uint32_t			matches;
+
+	/* The buffer is full, the next part of the result starts at resume */
+	bool				more;
+	uint64_t			resume;
+};
+
+static int
+nvmf_ndp_grep_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_grep_ctx *ctx = cb_arg;
+	struct iovec *last = &iov[iovcnt - 1];
+	bool newline = ((char *)last->iov_base)[last->iov_len - 1] == '\n';
+	uint32_t line_len = newline ? 0 : 1;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		line_len += iov[i].iov_len;
+	}
+
+	if (ctx->len > 0 && line_len > ctx->req->length - ctx->len) {
+		/* Left for the next part, from the end of the last line returned */
+		ctx->more = true;
+		return 1;
+	}
+
+	/* A line longer than the whole buffer is truncated */
+	ctx->matches++;
+	for (i = 0; i < iovcnt; i++) {
+		ctx->len += spdk_iov_xfer_from_buf(&ctx->ix, iov[i].iov_base, iov[i].iov_len);
+	}
+	if (!newline) {
+		ctx->len += spdk_iov_xfer_from_buf(&ctx->ix, "\n", 1);
+	}
+	ctx->resume = ctx->cursor->offset + nvmf_ndp_grep_line_end(ctx->grep);
+
+	return 0;
+}
+
+static int
+nvmf_ndp_grep_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_grep_ctx *ctx = cb_arg;
+
+	/* Chunks are scanned in place, lines crossing them are handled by the engine */
+	return nvmf_ndp_grep_scan(ctx->grep, iov, iovcnt, nvmf_ndp_grep_match, ctx);
+}
+
+static void
+nvmf_ndp_grep_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_grep_ctx *ctx = cb_arg;
+
+	if (status == 0 && !ctx->more) {
+		/* The last line may miss its newline */
+		nvmf_ndp_grep_finish(ctx->grep, nvmf_ndp_grep_match, ctx);
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP grep found %u matching lines (%u bytes)%s, status %d\n",
+		      ctx->matches, ctx->len, ctx->more ? ", more to come" : "", status);
+
+	nvmf_ndp_cursor_complete(ctx->cursor, ctx->req, status, ctx->len, ctx->more, ctx->resume);
+	nvmf_ndp_grep_free(ctx->grep);
+	free(ctx);
+}
+
+static int
+nvmf_ndp_grep_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		  struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		  struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_desc *target = &cursor->target;
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_grep_ctx *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return -ENOMEM;
+	}
+	ctx->req = req;
+	ctx->cursor = cursor;
+	ctx->resume = cursor->offset;
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.length = target->length;
+	opts.offset = cursor->offset;
+
+	ctx->grep = nvmf_ndp_grep_create(target->args, strnlen(target->args, target->args_len),
+					 opts.max_record_len);
+	if (ctx->grep == NULL) {
+		free(ctx);
+		return -EINVAL;
+	}
+
+	nvmf_ndp_result_init(req, &ctx->ix);
+
+	rc = nvmf_ndp_stream_start(req, desc, ch, target->extents, target->num_extents, &opts,
+				   nvmf_ndp_grep_data, nvmf_ndp_grep_done, ctx);
+	if (rc != 0) {
+		nvmf_ndp_grep_free(ctx->grep);
+		free(ctx);
+	}
+
+	return rc;
+}
+
+static int
+nvmf_ndp_grep_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		   struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	return nvmf_ndp_args_exec(bdev, desc, ch, req, nvmf_ndp_grep_run);
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_grep_op = {
+	.name = "grep",
+	.opc = SPDK_NVME_OPC_CUSTOM_GREP,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_grep_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(grep, &g_nvmf_ndp_grep_op);
+
+/*
+ * Filter
+ *
+ * The data buffer holds the target descriptor (CDW11: number of extents)
+ * followed by a filter program (see ndp_internal.h; its length in the low 16
+ * bits of CDW10, 0 for the rest of the buffer).  The records of the file that
+ * match the predicate, whole or reduced to the selected columns, are written
+ * back into the data buffer.  As for grep, records are never split between
+ * two parts of the result, unless a single record exceeds the buffer.
+ */
+
+struct nvmf_ndp_filter_ctx {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct nvmf_ndp_filter		*filter;
+	struct spdk_iov_xfer		ix;
+	uint32_t			len;
+	uint32_t			matches;
+
+	/* The buffer is full, the next part of the result starts at resume */
+	bool				more;
+	uint64_t			resume;
+};
+
+static int
+nvmf_ndp_filter_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_filter_ctx *ctx = cb_arg;
+	uint32_t row_len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		row_len += iov[i].iov_len;
+	}
+
+	if (ctx->len > 0 && row_len > ctx->req->length - ctx->len) {
+		/* Left for the next part, from the end of the last record returned */
+		ctx->more = true;
+		return 1;
+	}
+
+	/* A record longer than the whole buffer is truncated */
+	ctx->matches++;
+	for (i = 0; i < iovcnt; i++) {
+		ctx->len += spdk_iov_xfer_from_buf(&ctx->ix, iov[i].iov_base, iov[i].iov_len);
+	}
+	ctx->resume = ctx->cursor->offset + nvmf_ndp_filter_record_end(ctx->filter);
+
+	return 0;
+}
+
+static int
+nvmf_ndp_filter_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_filter_ctx *ctx = cb_arg;
+
+	return nvmf_ndp_filter_scan(ctx->filter, iov, iovcnt, nvmf_ndp_filter_match, ctx);
+}
+
+static void
+nvmf_ndp_filter_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_filter_ctx *ctx = cb_arg;
+
+	SPDK_DEBUGLOG(nvmf, "NDP filter returned %u records (%u bytes)%s, status %d\n",
+		      ctx->matches, ctx->len, ctx->more ? ", more to come" : "", status);
+
+	nvmf_ndp_cursor_complete(ctx->cursor, ctx->req, status, ctx->len, ctx->more, ctx->resume);
+	nvmf_ndp_filter_free(ctx->filter);
+	free(ctx);
+}
+
+static int
+nvmf_ndp_filter_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		    struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		    struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_desc *target = &cursor->target;
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_filter_ctx *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return -ENOMEM;
+	}
+	ctx->req = req;
+	ctx->cursor = cursor;
+	ctx->resume = cursor->offset;
+
+	ctx->filter = nvmf_ndp_filter_create(target->args, target->args_len);
+	if (ctx->filter == NULL) {
+		free(ctx);
+		return -EINVAL;
+	}
+
+	nvmf_ndp_result_init(req, &ctx->ix);
+
+	/* The stream hands over whole records, the engine never has to carry one */
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	opts.length = target->length;
+	opts.offset = cursor->offset;
+
+	rc = nvmf_ndp_stream_start(req, desc, ch, target->extents, target->num_extents, &opts,
+				   nvmf_ndp_filter_data, nvmf_ndp_filter_done, ctx);
+	if (rc != 0) {
+		nvmf_ndp_filter_free(ctx->filter);
+		free(ctx);
+	}
+
+	return rc;
+}
+
+static int
+nvmf_ndp_filter_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		     struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	return nvmf_ndp_args_exec(bdev, desc, ch, req, nvmf_ndp_filter_run);
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_filter_op = {
+	.name = "filter",
+	.opc = SPDK_NVME_OPC_CUSTOM_FILTER,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_filter_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(filter, &g_nvmf_ndp_filter_op);
+
+/*
+ * Aggregate
+ *
+ * The data buffer holds the target descriptor (CDW11: number of extents)
+ * followed by the aggregate arguments (see ndp_internal.h; their length in
+ * the low 16 bits of CDW10, 0 for the rest of the buffer).  The whole file is
+ * read and a fixed size result, whose size only depends on the histogram
+ * requested, is written back into the data buffer.
+ */
+
+struct nvmf_ndp_agg_ctx {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct nvmf_ndp_agg		*agg;
+};
+
+static int
+nvmf_ndp_agg_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_agg_ctx *ctx = cb_arg;
+
+	nvmf_ndp_agg_scan(ctx->agg, iov, iovcnt);
+	return 0;
+}
+
+static void
+nvmf_ndp_agg_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_agg_ctx *ctx = cb_arg;
+	struct spdk_nvmf_request *req = ctx->req;
+	uint32_t len = 0;
+
+	if (status == 0) {
+		len = nvmf_ndp_agg_get_result(ctx->agg, req->iov, req->iovcnt);
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP aggregate returned %u bytes, status %d\n", len, status);
+
+	nvmf_ndp_cursor_complete(ctx->cursor, req, status, len, false, 0);
+	nvmf_ndp_agg_free(ctx->agg);
+	free(ctx);
+}
+
+static int
+nvmf_ndp_agg_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		 struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		 struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_desc *target = &cursor->target;
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_agg_ctx *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return -ENOMEM;
+	}
+	ctx->req = req;
+	ctx->cursor = cursor;
+
+	ctx->agg = nvmf_ndp_agg_create(target->args, target->args_len);
+	if (ctx->agg == NULL) {
+		free(ctx);
+		return -EINVAL;
+	}
+
+	/* The result is never split, so it must fit in the buffer at once */
+	if (nvmf_ndp_agg_result_size(ctx->agg) > req->length) {
+		SPDK_ERRLOG("Aggregate result of %zu bytes exceeds the %u bytes buffer\n",
+			    nvmf_ndp_agg_result_size(ctx->agg), req->length);
+		nvmf_ndp_agg_free(ctx->agg);
+		free(ctx);
+		return -EINVAL;
+	}
+
+	nvmf_ndp_result_init(req, NULL);
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	opts.length = target->length;
+	opts.offset = cursor->offset;
+
+	rc = nvmf_ndp_stream_start(req, desc, ch, target->extents, target->num_extents, &opts,
+				   nvmf_ndp_agg_data, nvmf_ndp_agg_done, ctx);
+	if (rc != 0) {
+		nvmf_ndp_agg_free(ctx->agg);
+		free(ctx);
+	}
+
+	return rc;
+}
+
+static int
+nvmf_ndp_agg_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		  struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	return nvmf_ndp_args_exec(bdev, desc, ch, req, nvmf_ndp_agg_run);
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_agg_op = {
+	.name = "aggregate",
+	.opc = SPDK_NVME_OPC_CUSTOM_AGGREGATE,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_agg_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(aggregate, &g_nvmf_ndp_agg_op);
+
+/*
+ * Regex
+ *
+ * The data buffer holds the target descriptor (CDW11: number of extents)
+ * followed by a DFA compiled by the host (see ndp_internal.h; its length in
+ * the low 16 bits of CDW10, 0 for the rest of the buffer).  The lines the DFA
+ * accepts are written back into the data buffer.  As for grep, lines are
+ * never split between two parts of the result, unless a single line exceeds
+ * the buffer.
+ */
+
+struct nvmf_ndp_regex_ctx {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct nvmf_ndp_regex		*regex;
+	struct spdk_iov_xfer		ix;
+	uint32_t			len;
+	uint32_t			matches;
+
+	/* The buffer is full, the next part of the result starts at resume */
+	bool				more;
+	uint64_t			resume;
+};
+
+static int
+nvmf_ndp_regex_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_regex_ctx *ctx = cb_arg;
+	uint32_t line_len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		line_len += iov[i].iov_len;
+	}
+
+	if (ctx->len > 0 && line_len > ctx->req->length - ctx->len) {
+		/* Left for the next part, from the end of the last line returned */
+		ctx->more = true;
+		return 1;
+	}
+
+	/* A line longer than the whole buffer is truncated */
+	ctx->matches++;
+	for (i = 0; i < iovcnt; i++) {
+		ctx->len += spdk_iov_xfer_from_buf(&ctx->ix, iov[i].iov_base, iov[i].iov_len);
+	}
+	ctx->resume = ctx->cursor->offset + nvmf_ndp_regex_line_end(ctx->regex);
+
+	return 0;
+}
+
+static int
+nvmf_ndp_regex_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_regex_ctx *ctx = cb_arg;
+
+	return nvmf_ndp_regex_scan(ctx->regex, iov, iovcnt, nvmf_ndp_regex_match, ctx);
+}
+
+static void
+nvmf_ndp_regex_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_regex_ctx *ctx = cb_arg;
+
+	SPDK_DEBUGLOG(nvmf, "NDP regex returned %u lines (%u bytes)%s, status %d\n",
+		      ctx->matches, ctx->len, ctx->more ? ", more to come" : "", status);
+
+	nvmf_ndp_cursor_complete(ctx->cursor, ctx->req, status, ctx->len, ctx->more, ctx->resume);
+	nvmf_ndp_regex_free(ctx->regex);
+	free(ctx);
+}
+
+static int
+nvmf_ndp_regex_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		   struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		   struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_desc *target = &cursor->target;
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_regex_ctx *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return -ENOMEM;
+	}
+	ctx->req = req;
+	ctx->cursor = cursor;
+	ctx->resume = cursor->offset;
+
+	ctx->regex = nvmf_ndp_regex_create(target->args, target->args_len);
+	if (ctx->regex == NULL) {
+		free(ctx);
+		return -EINVAL;
+	}
+
+	nvmf_ndp_result_init(req, &ctx->ix);
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	opts.length = target->length;
+	opts.offset = cursor->offset;
+
+	rc = nvmf_ndp_stream_start(req, desc, ch, target->extents, target->num_extents, &opts,
+				   nvmf_ndp_regex_data, nvmf_ndp_regex_done, ctx);
+	if (rc != 0) {
+		nvmf_ndp_regex_free(ctx->regex);
+		free(ctx);
+	}
+
+	return rc;
+}
+
+static int
+nvmf_ndp_regex_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		    struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	/* A DFA quickly outgrows 64KiB, it usually takes the rest of the buffer */
+	return nvmf_ndp_args_exec(bdev, desc, ch, req, nvmf_ndp_regex_run);
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_regex_op = {
+	.name = "regex",
+	.opc = SPDK_NVME_OPC_CUSTOM_REGEX,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_regex_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(regex, &g_nvmf_ndp_regex_op);
+
+/*
+ * Top-K and sample
+ *
+ * The data buffer holds the target descriptor (CDW11: number of extents)
+ * followed by the top-K arguments (see ndp_internal.h; their length in the
+ * low 16 bits of CDW10, 0 for the rest of the buffer).  The whole file is
+ * read and the records kept, at most a buffer of them, are written back into
+ * the data buffer.  Both opcodes share the code, they only differ in how the
+ * records are chosen.
+ */
+
+struct nvmf_ndp_topk_ctx {
+	struct spdk_nvmf_request	*req;
+	struct nvmf_ndp_cursor		*cursor;
+	struct nvmf_ndp_topk		*topk;
+};
+
+static int
+nvmf_ndp_topk_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_topk_ctx *ctx = cb_arg;
+
+	nvmf_ndp_topk_scan(ctx->topk, iov, iovcnt);
+	return 0;
+}
+
+static void
+nvmf_ndp_topk_done(void *cb_arg, int status)
+{
+	struct nvmf_ndp_topk_ctx *ctx = cb_arg;
+	struct spdk_nvmf_request *req = ctx->req;
+	uint32_t len = 0;
+
+	if (status == 0) {
+		len = nvmf_ndp_topk_get_result(ctx->topk, req->iov, req->iovcnt);
+		if (nvmf_ndp_topk_truncated(ctx->topk)) {
+			nvmf_ndp_cursor_skip_cache(ctx->cursor);
+		}
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP top-K returned %u bytes, status %d\n", len, status);
+
+	nvmf_ndp_cursor_complete(ctx->cursor, req, status, len, false, 0);
+	nvmf_ndp_topk_free(ctx->topk);
+	free(ctx);
+}
+
+static int
+nvmf_ndp_topk_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev,
+		  struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		  struct spdk_nvmf_request *req)
+{
+	struct nvmf_ndp_desc *target = &cursor->target;
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_topk_ctx *ctx;
+	bool sample;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return -ENOMEM;
+	}
+	ctx->req = req;
+	ctx->cursor = cursor;
+
+	sample = req->cmd->nvme_cmd.opc == SPDK_NVME_OPC_CUSTOM_SAMPLE;
+	rc = nvmf_ndp_topk_create(target->args, target->args_len, sample, req->length, &ctx->topk);
+	if (rc != 0) {
+		free(ctx);
+		return rc;
+	}
+
+	nvmf_ndp_result_init(req, NULL);
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	opts.length = target->length;
+	opts.offset = cursor->offset;
+
+	rc = nvmf_ndp_stream_start(req, desc, ch, target->extents, target->num_extents, &opts,
+				   nvmf_ndp_topk_data, nvmf_ndp_topk_done, ctx);
+	if (rc != 0) {
+		nvmf_ndp_topk_free(ctx->topk);
+		free(ctx);
+	}
+
+	return rc;
+}
+
+static int
+nvmf_ndp_topk_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+		   struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	return nvmf_ndp_args_exec(bdev, desc, ch, req, nvmf_ndp_topk_run);
+}
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_topk_op = {
+	.name = "topk",
+	.opc = SPDK_NVME_OPC_CUSTOM_TOPK,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_topk_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(topk, &g_nvmf_ndp_topk_op);
+
+static struct spdk_nvmf_ndp_op g_nvmf_ndp_sample_op = {
+	.name = "sample",
+	.opc = SPDK_NVME_OPC_CUSTOM_SAMPLE,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.exec = nvmf_ndp_topk_exec,
+};
+SPDK_NVMF_NDP_OP_REGISTER(sample, &g_nvmf_ndp_sample_op);
@@ -0,0 +1,249 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * DFA matcher for the NDP regex operator.
+ *
+ * The transitions are kept as 32 bit offsets into a table whose rows are
+ * padded to a power of two, so a step is one load indexed by the current
+ * offset plus the class of the byte, with no multiplication on the
+ * dependency chain.  The dead and the accepting states are the first two
+ * rows, which makes "is this line decided" a single comparison per byte.
+ * A state left by only one byte value, typically the state waiting for the
+ * first character of a literal, is skipped through with memchr().
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/endian.h"
+#include "spdk/likely.h"
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+struct nvmf_ndp_regex {
+	uint8_t			classes[256];
+	uint32_t		eol_class;
+	uint32_t		start;
+
+	/* log2 of the row size, and the rows */
+	uint32_t		shift;
+	uint32_t		*table;
+
+	/* Per state, the only byte leaving it, see regex_escape() */
+	int16_t			*escape;
+
+	/* Input seen by previous calls, and the end of the line being reported */
+	uint64_t		input_off;
+	uint64_t		line_end;
+};
+
+static const char g_newline = '\n';
+
+/* No byte leaves the state, only the end of the line does */
+#define REGEX_ESCAPE_NONE	256
+
+void
+nvmf_ndp_regex_free(struct nvmf_ndp_regex *regex)
+{
+	if (regex == NULL) {
+		return;
+	}
+
+	free(regex->table);
+	free(regex->escape);
+	free(regex);
+}
+
+/* The single byte value leaving state, REGEX_ESCAPE_NONE if none does, -1 if several do */
+static int16_t
+regex_escape(const struct nvmf_ndp_regex *regex, uint32_t state)
+{
+	const uint32_t *row = &regex->table[state << regex->shift];
+	uint32_t self = state << regex->shift;
+	int16_t escape = -1;
+	int b;
+
+	for (b = 0; b < 256; b++) {
+		if (row[regex->classes[b]] == self) {
+			continue;
+		}
+		if (escape >= 0) {
+			return -1;
+		}
+		escape = b;
+	}
+
+	return escape >= 0 ? escape : REGEX_ESCAPE_NONE;
+}
+
+struct nvmf_ndp_regex *
+nvmf_ndp_regex_create(const void *prog, size_t len)
+{
+	const uint8_t *classes, *transitions;
+	struct nvmf_ndp_regex_hdr hdr;
+	struct nvmf_ndp_regex *regex;
+	uint32_t num_states, num_classes, s, c, next;
+
+	if (len < sizeof(hdr) + sizeof(regex->classes)) {
+		SPDK_ERRLOG("Regex program too short: %zu bytes\n", len);
+		return NULL;
+	}
+
+	memcpy(&hdr, prog, sizeof(hdr));
+	num_states = from_le16(&hdr.num_states);
+	num_classes = from_le16(&hdr.num_classes);
+	if (from_le32(&hdr.magic) != NVMF_NDP_REGEX_MAGIC || num_states < 2 ||
+	    num_states > NVMF_NDP_REGEX_MAX_STATES || num_classes < 2 ||
+	    num_classes > sizeof(regex->classes) || from_le16(&hdr.start) >= num_states) {
+		SPDK_ERRLOG("Invalid regex program header: %u states, %u classes\n", num_states,
+			    num_classes);
+		return NULL;
+	}
+	if ((len - sizeof(hdr) - sizeof(regex->classes)) / sizeof(uint16_t) <
+	    (size_t)num_states * num_classes) {
+		SPDK_ERRLOG("Regex program truncated\n");
+		return NULL;
+	}
+
+	regex = calloc(1, sizeof(*regex));
+	if (regex == NULL) {
+		return NULL;
+	}
+
+	classes = (const uint8_t *)prog + sizeof(hdr);
+	transitions = classes + sizeof(regex->classes);
+	memcpy(regex->classes, classes, sizeof(regex->classes));
+	regex->eol_class = num_classes - 1;
+	regex->shift = spdk_u32log2(spdk_align32pow2(num_classes));
+	regex->start = (uint32_t)from_le16(&hdr.start) << regex->shift;
+
+	for (c = 0; c < sizeof(regex->classes); c++) {
+		if (regex->classes[c] >= regex->eol_class) {
+			SPDK_ERRLOG("Invalid class %u of byte 0x%02x\n", regex->classes[c], c);
+			goto err;
+		}
+	}
+
+	regex->table = calloc((size_t)num_states << regex->shift, sizeof(*regex->table));
+	regex->escape = calloc(num_states, sizeof(*regex->escape));
+	if (regex->table == NULL || regex->escape == NULL) {
+		goto err;
+	}
+
+	for (s = 0; s < num_states; s++) {
+		for (c = 0; c < num_classes; c++) {
+			next = from_le16(transitions + ((size_t)s * num_classes + c) * sizeof(uint16_t));
+			if (next >= num_states) {
+				SPDK_ERRLOG("Invalid transition from %u to %u\n", s, next);
+				goto err;
+			}
+			/* The dead and accepting states are never left */
+			if (s == NVMF_NDP_REGEX_DEAD || s == NVMF_NDP_REGEX_MATCH) {
+				next = s;
+			}
+			regex->table[(s << regex->shift) + c] = next << regex->shift;
+		}
+	}
+
+	for (s = 0; s < num_states; s++) {
+		regex->escape[s] = s > NVMF_NDP_REGEX_MATCH ? regex_escape(regex, s) : -1;
+	}
+
+	SPDK_DEBUGLOG(nvmf, "Loaded regex with %u states and %u classes\n", num_states, num_classes);
+
+	return regex;
+
+err:
+	nvmf_ndp_regex_free(regex);
+	return NULL;
+}
+
+/* Run the DFA over a line, without its newline.  Returns true if it is accepted. */
+static bool
+regex_match(const struct nvmf_ndp_regex *regex, const uint8_t *p, size_t len)
+{
+	const uint32_t *table = regex->table;
+	const uint8_t *classes = regex->classes;
+	const uint32_t decided = NVMF_NDP_REGEX_MATCH << regex->shift;
+	uint32_t s = regex->start, next;
+	const uint8_t *q;
+	int16_t escape;
+	size_t i = 0;
+
+	while (i < len && s > decided) {
+		next = table[s + classes[p[i]]];
+		i++;
+		if (spdk_likely(next != s)) {
+			s = next;
+			continue;
+		}
+
+		escape = regex->escape[s >> regex->shift];
+		if (escape == REGEX_ESCAPE_NONE) {
+			i = len;
+		} else if (escape >= 0) {
+			/* Nothing but this byte leaves the state */
+			q = memchr(p + i, escape, len - i);
+			i = q != NULL ? (size_t)(q - p) : len;
+		}
+	}
+
+	if (s > decided) {
+		s = table[s + regex->eol_class];
+	}
+
+	return s == decided;
+}
+
+int
+nvmf_ndp_regex_scan(struct nvmf_ndp_regex *regex, struct iovec *iov, int iovcnt,
+		    nvmf_ndp_regex_match_fn match_fn, void *cb_arg)
+{
+	struct iovec line[2];
+	const uint8_t *p, *nl;
+	size_t off, end, next, len, run;
+	int i, rc;
+
+	for (i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+
+		for (off = 0; off < len; off = next) {
+			nl = memchr(p + off, '\n', len - off);
+			end = nl != NULL ? (size_t)(nl - p) : len;
+			next = nl != NULL ? end + 1 : len;
+
+			/* Lines from DOS text end with "\r\n", "$" matches before both */
+			run = end - off;
+			if (run > 0 && p[end - 1] == '\r') {
+				run--;
+			}
+			if (!regex_match(regex, p + off, run)) {
+				continue;
+			}
+
+			regex->line_end = regex->input_off + next;
+			line[0].iov_base = (void *)(p + off);
+			line[0].iov_len = next - off;
+			line[1].iov_base = (void *)&g_newline;
+			line[1].iov_len = 1;
+			rc = match_fn(cb_arg, line, nl != NULL ? 1 : 2);
+			if (rc != 0) {
+				regex->input_off += next;
+				return rc;
+			}
+		}
+		regex->input_off += len;
+	}
+
+	return 0;
+}
+
+uint64_t
+nvmf_ndp_regex_line_end(const struct nvmf_ndp_regex *regex)
+{
+	return regex->line_end;
+}
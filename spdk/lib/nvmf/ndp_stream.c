@@ -0,0 +1,825 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "nvmf_internal.h"
+#include "ndp_internal.h"
+
+#include "spdk/env.h"
+#include "spdk/likely.h"
+#include "spdk/log.h"
+#include "spdk/memory.h"
+#include "spdk/string.h"
+#include "spdk/thread.h"
+#include "spdk/util.h"
+
+enum nvmf_ndp_stream_slot_state {
+	NVMF_NDP_STREAM_SLOT_FREE,
+	NVMF_NDP_STREAM_SLOT_WAIT_BUF,
+	NVMF_NDP_STREAM_SLOT_READING,
+	NVMF_NDP_STREAM_SLOT_READY,
+	/* Handed to the operator on an offload thread */
+	NVMF_NDP_STREAM_SLOT_DELIVERING,
+	/* Zero copy buffer being handed back to the bdev */
+	NVMF_NDP_STREAM_SLOT_RELEASING,
+};
+
+struct nvmf_ndp_stream;
+
+struct nvmf_ndp_stream_slot {
+	struct nvmf_ndp_stream			*stream;
+	enum nvmf_ndp_stream_slot_state		state;
+	void					*buf;
+
+	/* Zero copy: buffer lent by the bdev until spdk_bdev_zcopy_end() */
+	struct spdk_bdev_io			*zcopy_io;
+	struct iovec				zcopy_iov;
+
+	/* Position of the chunk in the stream */
+	uint64_t				seq;
+	uint64_t				offset_blocks;
+	uint64_t				num_blocks;
+	/* Bytes at the start of the chunk that precede opts.offset */
+	uint32_t				skip;
+	uint32_t				len;
+	bool					last;
+
+	struct spdk_iobuf_entry			iobuf_entry;
+	struct spdk_bdev_io_wait_entry		bdev_io_wait;
+};
+
+struct nvmf_ndp_stream {
+	struct spdk_nvmf_request		*req;
+	struct spdk_bdev			*bdev;
+	struct spdk_bdev_desc			*desc;
+	struct spdk_io_channel			*ch;
+
+	/* NULL if the transport doesn't use the iobuf pool */
+	struct spdk_iobuf_channel		*iobuf;
+
+	/* Chunks are read in place from the bdev's own buffers */
+	bool					zcopy;
+
+	struct nvmf_ndp_stream_opts		opts;
+	uint32_t				block_size;
+	uint32_t				chunk_blocks;
+	/* Reads are cut at multiples of the bdev's optimal I/O boundary, 0 if none */
+	uint32_t				boundary_blocks;
+	uint32_t				buf_align;
+
+	nvmf_ndp_stream_data_fn			data_fn;
+	nvmf_ndp_stream_done_fn			done_fn;
+	void					*cb_arg;
+
+	/* Checked before every chunk, opts.job or own_job */
+	struct nvmf_ndp_job			*job;
+	struct nvmf_ndp_job			own_job;
+
+	/* Read cursor */
+	uint32_t				ext_idx;
+	uint64_t				ext_offset_blocks;
+	uint32_t				skip;
+	uint64_t				remaining;
+	uint64_t				next_read_seq;
+
+	uint64_t				next_deliver_seq;
+	uint32_t				outstanding;
+	bool					stopped;
+	bool					finished;
+	/* A chunk is being processed on an offload thread */
+	bool					delivering;
+	int					status;
+
+	/* Partial record carried over between chunks in NVMF_NDP_STREAM_MODE_LINES */
+	char					*carry;
+	uint32_t				carry_len;
+
+	struct nvmf_ndp_stream_slot		slots[NVMF_NDP_STREAM_MAX_DEPTH];
+
+	uint32_t				num_extents;
+	struct nvmf_ndp_extent			extents[];
+};
+
+/*
+ * Chunk buffers of the streams that don't use the iobuf pool, kept by the
+ * thread of each poll group once freed rather than allocated for every job.
+ */
+#define NVMF_NDP_STREAM_BUF_CACHE_SIZE	(2 * NVMF_NDP_STREAM_MAX_DEPTH)
+
+struct nvmf_ndp_stream_buf_cache {
+	void		*bufs[NVMF_NDP_STREAM_BUF_CACHE_SIZE];
+	uint32_t	sizes[NVMF_NDP_STREAM_BUF_CACHE_SIZE];
+	uint32_t	aligns[NVMF_NDP_STREAM_BUF_CACHE_SIZE];
+	uint32_t	num_bufs;
+};
+
+static __thread struct nvmf_ndp_stream_buf_cache t_nvmf_ndp_stream_buf_cache;
+
+static void nvmf_ndp_stream_fill_slot(struct nvmf_ndp_stream_slot *slot);
+static bool nvmf_ndp_stream_release_slot(struct nvmf_ndp_stream_slot *slot);
+
+static void *
+nvmf_ndp_stream_buf_get(uint32_t size, uint32_t align)
+{
+	struct nvmf_ndp_stream_buf_cache *cache = &t_nvmf_ndp_stream_buf_cache;
+	void *buf;
+	uint32_t i;
+
+	for (i = 0; i < cache->num_bufs; i++) {
+		if (cache->sizes[i] == size && cache->aligns[i] == align) {
+			buf = cache->bufs[i];
+			cache->num_bufs--;
+			cache->bufs[i] = cache->bufs[cache->num_bufs];
+			cache->sizes[i] = cache->sizes[cache->num_bufs];
+			cache->aligns[i] = cache->aligns[cache->num_bufs];
+			return buf;
+		}
+	}
+
+	return spdk_dma_malloc(size, align, NULL);
+}
+
+static void
+nvmf_ndp_stream_buf_put(void *buf, uint32_t size, uint32_t align)
+{
+	struct nvmf_ndp_stream_buf_cache *cache = &t_nvmf_ndp_stream_buf_cache;
+
+	if (cache->num_bufs == NVMF_NDP_STREAM_BUF_CACHE_SIZE) {
+		spdk_dma_free(buf);
+		return;
+	}
+
+	cache->bufs[cache->num_bufs] = buf;
+	cache->sizes[cache->num_bufs] = size;
+	cache->aligns[cache->num_bufs] = align;
+	cache->num_bufs++;
+}
+
+void
+nvmf_ndp_stream_buf_cache_free(void)
+{
+	struct nvmf_ndp_stream_buf_cache *cache = &t_nvmf_ndp_stream_buf_cache;
+
+	while (cache->num_bufs > 0) {
+		spdk_dma_free(cache->bufs[--cache->num_bufs]);
+	}
+}
+
+void
+nvmf_ndp_stream_opts_init(struct nvmf_ndp_stream_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->chunk_size = NVMF_NDP_STREAM_CHUNK_SIZE;
+	opts->depth = NVMF_NDP_STREAM_DEPTH;
+	opts->mode = NVMF_NDP_STREAM_MODE_RAW;
+	opts->max_record_len = NVMF_NDP_STREAM_MAX_RECORD_LEN;
+	opts->zcopy = true;
+	opts->offload = true;
+}
+
+static void
+nvmf_ndp_stream_stop(struct nvmf_ndp_stream *stream, int status)
+{
+	struct nvmf_ndp_stream_slot *slot;
+	uint32_t i;
+
+	if (stream->status == 0) {
+		stream->status = status;
+	}
+
+	if (stream->stopped) {
+		return;
+	}
+	stream->stopped = true;
+
+	/* Chunks still waiting for a buffer will never be read */
+	for (i = 0; i < stream->opts.depth; i++) {
+		slot = &stream->slots[i];
+		if (slot->state == NVMF_NDP_STREAM_SLOT_WAIT_BUF) {
+			spdk_iobuf_entry_abort(stream->iobuf, &slot->iobuf_entry, stream->opts.chunk_size);
+			slot->state = NVMF_NDP_STREAM_SLOT_FREE;
+			stream->outstanding--;
+		} else if (slot->state == NVMF_NDP_STREAM_SLOT_READY) {
+			/* Chunks read ahead will never be delivered */
+			nvmf_ndp_stream_release_slot(slot);
+		}
+	}
+}
+
+static void
+nvmf_ndp_stream_free(struct nvmf_ndp_stream *stream)
+{
+	struct nvmf_ndp_stream_slot *slot;
+	uint32_t i;
+
+	if (stream->job == &stream->own_job) {
+		nvmf_ndp_job_end(stream->job);
+	}
+
+	for (i = 0; i < stream->opts.depth; i++) {
+		slot = &stream->slots[i];
+		if (slot->buf == NULL) {
+			continue;
+		}
+
+		if (stream->iobuf != NULL) {
+			spdk_iobuf_put(stream->iobuf, slot->buf, stream->opts.chunk_size);
+		} else {
+			nvmf_ndp_stream_buf_put(slot->buf, stream->opts.chunk_size, stream->buf_align);
+		}
+	}
+
+	free(stream->carry);
+	free(stream);
+}
+
+static void
+nvmf_ndp_stream_check_done(struct nvmf_ndp_stream *stream)
+{
+	nvmf_ndp_stream_done_fn done_fn;
+	void *cb_arg;
+	int status;
+
+	if (stream->outstanding != 0 || stream->finished) {
+		return;
+	}
+
+	if (!stream->stopped && stream->remaining != 0) {
+		return;
+	}
+
+	stream->finished = true;
+	done_fn = stream->done_fn;
+	cb_arg = stream->cb_arg;
+	status = stream->status;
+
+	nvmf_ndp_stream_free(stream);
+	done_fn(cb_arg, status);
+}
+
+static int
+nvmf_ndp_stream_deliver(struct nvmf_ndp_stream *stream, char *buf, uint32_t len)
+{
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = len,
+	};
+
+	return stream->data_fn(stream->cb_arg, &iov, 1);
+}
+
+/* Append data to the carry buffer, delivering it whenever it gets full. */
+static int
+nvmf_ndp_stream_carry(struct nvmf_ndp_stream *stream, const char *data, uint32_t len)
+{
+	uint32_t n;
+	int rc;
+
+	while (len > 0) {
+		n = spdk_min(len, stream->opts.max_record_len - stream->carry_len);
+		memcpy(stream->carry + stream->carry_len, data, n);
+		stream->carry_len += n;
+		data += n;
+		len -= n;
+
+		if (stream->carry_len == stream->opts.max_record_len) {
+			rc = nvmf_ndp_stream_deliver(stream, stream->carry, stream->carry_len);
+			stream->carry_len = 0;
+			if (rc != 0) {
+				return rc;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+nvmf_ndp_stream_deliver_lines(struct nvmf_ndp_stream *stream, char *buf, uint32_t len, bool last)
+{
+	struct iovec iov[2];
+	int iovcnt = 0;
+	char *nl, *tail;
+	uint32_t head_len, tail_len;
+	int rc;
+
+	nl = memchr(buf, '\n', len);
+	if (nl == NULL) {
+		/* The whole chunk is a part of a single record */
+		rc = nvmf_ndp_stream_carry(stream, buf, len);
+		goto out;
+	}
+
+	if (stream->carry_len > 0) {
+		/* Complete the record started in a previous chunk */
+		head_len = nl - buf + 1;
+		rc = nvmf_ndp_stream_carry(stream, buf, head_len);
+		if (rc != 0) {
+			return rc;
+		}
+		buf += head_len;
+		len -= head_len;
+
+		if (stream->carry_len > 0) {
+			iov[iovcnt].iov_base = stream->carry;
+			iov[iovcnt].iov_len = stream->carry_len;
+			iovcnt++;
+		}
+	}
+
+	tail = len > 0 ? memrchr(buf, '\n', len) : NULL;
+	tail = tail != NULL ? tail + 1 : buf;
+	tail_len = len - (tail - buf);
+
+	if (tail > buf) {
+		iov[iovcnt].iov_base = buf;
+		iov[iovcnt].iov_len = tail - buf;
+		iovcnt++;
+	}
+
+	if (iovcnt > 0) {
+		rc = stream->data_fn(stream->cb_arg, iov, iovcnt);
+		stream->carry_len = 0;
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+	rc = nvmf_ndp_stream_carry(stream, tail, tail_len);
+out:
+	if (rc == 0 && last && stream->carry_len > 0) {
+		rc = nvmf_ndp_stream_deliver(stream, stream->carry, stream->carry_len);
+		stream->carry_len = 0;
+	}
+
+	return rc;
+}
+
+/* Hand a chunk to the operator.  Runs on an offload thread if there are any. */
+static int
+nvmf_ndp_stream_deliver_slot(void *arg)
+{
+	struct nvmf_ndp_stream_slot *slot = arg;
+	struct nvmf_ndp_stream *stream = slot->stream;
+	char *buf;
+
+	buf = slot->zcopy_io != NULL ? slot->zcopy_iov.iov_base : slot->buf;
+	buf += slot->skip;
+	if (stream->opts.mode == NVMF_NDP_STREAM_MODE_LINES) {
+		return nvmf_ndp_stream_deliver_lines(stream, buf, slot->len, slot->last);
+	}
+
+	return nvmf_ndp_stream_deliver(stream, buf, slot->len);
+}
+
+/* Returns true if no further chunk should be delivered for now. */
+static bool
+nvmf_ndp_stream_slot_delivered(struct nvmf_ndp_stream_slot *slot, int rc)
+{
+	struct nvmf_ndp_stream *stream = slot->stream;
+	bool last = slot->last, releasing;
+
+	stream->next_deliver_seq++;
+
+	/* A zero copy slot is refilled once the bdev got its buffer back */
+	releasing = nvmf_ndp_stream_release_slot(slot);
+
+	if (rc != 0) {
+		nvmf_ndp_stream_stop(stream, rc < 0 ? rc : 0);
+		return true;
+	}
+
+	if (last) {
+		assert(stream->remaining == 0);
+		return true;
+	}
+
+	if (!releasing) {
+		nvmf_ndp_stream_fill_slot(slot);
+	}
+
+	return false;
+}
+
+static void nvmf_ndp_stream_process(struct nvmf_ndp_stream *stream);
+
+static void
+nvmf_ndp_stream_deliver_slot_done(void *arg, int rc)
+{
+	struct nvmf_ndp_stream_slot *slot = arg;
+	struct nvmf_ndp_stream *stream = slot->stream;
+
+	assert(stream->delivering);
+	stream->delivering = false;
+	stream->outstanding--;
+
+	nvmf_ndp_stream_slot_delivered(slot, rc);
+	nvmf_ndp_stream_process(stream);
+}
+
+static void
+nvmf_ndp_stream_process(struct nvmf_ndp_stream *stream)
+{
+	struct nvmf_ndp_stream_slot *slot;
+	uint32_t i;
+	int rc;
+
+	while (!stream->stopped && !stream->delivering) {
+		slot = NULL;
+		for (i = 0; i < stream->opts.depth; i++) {
+			if (stream->slots[i].state == NVMF_NDP_STREAM_SLOT_READY &&
+			    stream->slots[i].seq == stream->next_deliver_seq) {
+				slot = &stream->slots[i];
+				break;
+			}
+		}
+
+		if (slot == NULL) {
+			break;
+		}
+
+		rc = nvmf_ndp_job_check(stream->job);
+		if (rc != 0) {
+			nvmf_ndp_stream_stop(stream, rc);
+			break;
+		}
+
+		if (stream->opts.offload) {
+			/*
+			 * One chunk at a time keeps them in order and leaves the carry
+			 * buffer to a single thread; the reads go on meanwhile.
+			 */
+			slot->state = NVMF_NDP_STREAM_SLOT_DELIVERING;
+			stream->delivering = true;
+			stream->outstanding++;
+			rc = nvmf_ndp_offload(nvmf_ndp_stream_deliver_slot,
+					      nvmf_ndp_stream_deliver_slot_done, slot);
+			if (rc == 0) {
+				break;
+			}
+			slot->state = NVMF_NDP_STREAM_SLOT_READY;
+			stream->delivering = false;
+			stream->outstanding--;
+		}
+
+		rc = nvmf_ndp_stream_deliver_slot(slot);
+		if (nvmf_ndp_stream_slot_delivered(slot, rc)) {
+			break;
+		}
+	}
+
+	nvmf_ndp_stream_check_done(stream);
+}
+
+static void
+nvmf_ndp_stream_zcopy_end_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+	struct nvmf_ndp_stream_slot *slot = cb_arg;
+	struct nvmf_ndp_stream *stream = slot->stream;
+
+	spdk_bdev_free_io(bdev_io);
+
+	assert(stream->outstanding > 0);
+	stream->outstanding--;
+	slot->state = NVMF_NDP_STREAM_SLOT_FREE;
+
+	nvmf_ndp_stream_fill_slot(slot);
+	nvmf_ndp_stream_process(stream);
+}
+
+/*
+ * Mark a delivered (or never to be delivered) slot free.  Zero copy buffers
+ * are handed back to the bdev first; returns true in that case, the slot is
+ * then refilled from nvmf_ndp_stream_zcopy_end_done().
+ */
+static bool
+nvmf_ndp_stream_release_slot(struct nvmf_ndp_stream_slot *slot)
+{
+	struct nvmf_ndp_stream *stream = slot->stream;
+	struct spdk_bdev_io *bdev_io = slot->zcopy_io;
+	int rc;
+
+	slot->state = NVMF_NDP_STREAM_SLOT_FREE;
+	if (bdev_io == NULL) {
+		return false;
+	}
+
+	slot->zcopy_io = NULL;
+	slot->state = NVMF_NDP_STREAM_SLOT_RELEASING;
+	stream->outstanding++;
+
+	/* The data was only read, nothing to commit */
+	rc = spdk_bdev_zcopy_end(bdev_io, false, nvmf_ndp_stream_zcopy_end_done, slot);
+	if (spdk_unlikely(rc != 0)) {
+		/* Only fails for a bdev_io that isn't a zcopy one */
+		SPDK_ERRLOG("Unable to release NDP stream zcopy buffer: %s\n", spdk_strerror(-rc));
+		spdk_bdev_free_io(bdev_io);
+		slot->state = NVMF_NDP_STREAM_SLOT_FREE;
+		stream->outstanding--;
+		return false;
+	}
+
+	return true;
+}
+
+static void
+nvmf_ndp_stream_read_done(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+	struct nvmf_ndp_stream_slot *slot = cb_arg;
+	struct nvmf_ndp_stream *stream = slot->stream;
+
+	if (stream->zcopy && success) {
+		/* The bdev filled slot->zcopy_iov, keep the buffer until the chunk is delivered */
+		slot->zcopy_io = bdev_io;
+	} else {
+		spdk_bdev_free_io(bdev_io);
+	}
+
+	assert(stream->outstanding > 0);
+	stream->outstanding--;
+	slot->state = NVMF_NDP_STREAM_SLOT_READY;
+
+	if (spdk_unlikely(!success)) {
+		SPDK_ERRLOG("NDP stream read of %" PRIu64 " blocks at %" PRIu64 " failed\n",
+			    slot->num_blocks, slot->offset_blocks);
+		nvmf_ndp_stream_stop(stream, -EIO);
+	} else if (stream->stopped) {
+		nvmf_ndp_stream_release_slot(slot);
+	}
+
+	nvmf_ndp_stream_process(stream);
+}
+
+static void
+nvmf_ndp_stream_submit_read(void *arg)
+{
+	struct nvmf_ndp_stream_slot *slot = arg;
+	struct nvmf_ndp_stream *stream = slot->stream;
+	int rc;
+
+	slot->state = NVMF_NDP_STREAM_SLOT_READING;
+
+	if (stream->zcopy) {
+		/* Let the bdev point zcopy_iov at its own copy of the blocks */
+		slot->zcopy_iov.iov_base = NULL;
+		slot->zcopy_iov.iov_len = slot->num_blocks * stream->block_size;
+		rc = spdk_bdev_zcopy_start(stream->desc, stream->ch, &slot->zcopy_iov, 1,
+					   slot->offset_blocks, slot->num_blocks, true,
+					   nvmf_ndp_stream_read_done, slot);
+	} else {
+		rc = spdk_bdev_read_blocks(stream->desc, stream->ch, slot->buf, slot->offset_blocks,
+					   slot->num_blocks, nvmf_ndp_stream_read_done, slot);
+	}
+	if (spdk_likely(rc == 0)) {
+		return;
+	}
+
+	if (rc == -ENOMEM) {
+		slot->bdev_io_wait.bdev = stream->bdev;
+		slot->bdev_io_wait.cb_fn = nvmf_ndp_stream_submit_read;
+		slot->bdev_io_wait.cb_arg = slot;
+		rc = spdk_bdev_queue_io_wait(stream->bdev, stream->ch, &slot->bdev_io_wait);
+		if (rc == 0) {
+			return;
+		}
+	}
+
+	SPDK_ERRLOG("Unable to submit NDP stream read: %s\n", spdk_strerror(-rc));
+	slot->state = NVMF_NDP_STREAM_SLOT_FREE;
+	stream->outstanding--;
+	nvmf_ndp_stream_stop(stream, rc);
+}
+
+static void
+nvmf_ndp_stream_iobuf_get_cb(struct spdk_iobuf_entry *entry, void *buf)
+{
+	struct nvmf_ndp_stream_slot *slot = SPDK_CONTAINEROF(entry, struct nvmf_ndp_stream_slot,
+					    iobuf_entry);
+	struct nvmf_ndp_stream *stream = slot->stream;
+
+	slot->buf = buf;
+	nvmf_ndp_stream_submit_read(slot);
+	nvmf_ndp_stream_check_done(stream);
+}
+
+static void
+nvmf_ndp_stream_fill_slot(struct nvmf_ndp_stream_slot *slot)
+{
+	struct nvmf_ndp_stream *stream = slot->stream;
+	struct nvmf_ndp_extent *ext;
+	uint64_t num_blocks;
+
+	assert(slot->state == NVMF_NDP_STREAM_SLOT_FREE);
+
+	if (stream->stopped || stream->remaining == 0) {
+		return;
+	}
+
+	ext = &stream->extents[stream->ext_idx];
+	num_blocks = stream->chunk_blocks;
+	if (stream->boundary_blocks != 0) {
+		/* Up to a boundary, in case the extent doesn't start at one */
+		num_blocks -= (ext->offset_blocks + stream->ext_offset_blocks) % stream->boundary_blocks;
+	}
+	num_blocks = spdk_min(num_blocks, ext->num_blocks - stream->ext_offset_blocks);
+
+	slot->seq = stream->next_read_seq++;
+	slot->offset_blocks = ext->offset_blocks + stream->ext_offset_blocks;
+	slot->num_blocks = num_blocks;
+	slot->skip = stream->skip;
+	slot->len = spdk_min(num_blocks * stream->block_size - slot->skip, stream->remaining);
+	stream->skip = 0;
+	stream->remaining -= slot->len;
+	slot->last = stream->remaining == 0;
+
+	/* Chunks never cross extents */
+	stream->ext_offset_blocks += num_blocks;
+	if (stream->ext_offset_blocks == ext->num_blocks) {
+		stream->ext_idx++;
+		stream->ext_offset_blocks = 0;
+	}
+
+	stream->outstanding++;
+
+	if (slot->buf == NULL && !stream->zcopy) {
+		if (stream->iobuf != NULL) {
+			slot->buf = spdk_iobuf_get(stream->iobuf, stream->opts.chunk_size,
+						   &slot->iobuf_entry, nvmf_ndp_stream_iobuf_get_cb);
+			if (slot->buf == NULL) {
+				/* Queued, nvmf_ndp_stream_iobuf_get_cb() submits the read */
+				slot->state = NVMF_NDP_STREAM_SLOT_WAIT_BUF;
+				return;
+			}
+		} else {
+			slot->buf = nvmf_ndp_stream_buf_get(stream->opts.chunk_size, stream->buf_align);
+			if (slot->buf == NULL) {
+				stream->outstanding--;
+				nvmf_ndp_stream_stop(stream, -ENOMEM);
+				return;
+			}
+		}
+	}
+
+	nvmf_ndp_stream_submit_read(slot);
+}
+
+struct spdk_iobuf_channel *
+nvmf_ndp_req_get_iobuf(struct spdk_nvmf_request *req)
+{
+	struct spdk_nvmf_qpair *qpair = req->qpair;
+	struct spdk_nvmf_transport_poll_group *tgroup;
+
+	if (qpair->group == NULL) {
+		return NULL;
+	}
+
+	tgroup = nvmf_get_transport_poll_group(qpair->group, qpair->transport);
+
+	return tgroup != NULL ? tgroup->buf_cache : NULL;
+}
+
+int
+nvmf_ndp_stream_start(struct spdk_nvmf_request *req, struct spdk_bdev_desc *desc,
+		      struct spdk_io_channel *ch, const struct nvmf_ndp_extent *extents,
+		      uint32_t num_extents, const struct nvmf_ndp_stream_opts *opts,
+		      nvmf_ndp_stream_data_fn data_fn, nvmf_ndp_stream_done_fn done_fn,
+		      void *cb_arg)
+{
+	struct spdk_bdev *bdev = spdk_bdev_desc_get_bdev(desc);
+	struct nvmf_ndp_extent *ext;
+	uint64_t bdev_num_blocks = spdk_bdev_get_num_blocks(bdev);
+	uint32_t block_size = spdk_bdev_get_block_size(bdev);
+	uint32_t boundary = spdk_bdev_get_optimal_io_boundary(bdev);
+	struct spdk_iobuf_opts iobuf_opts = {};
+	struct nvmf_ndp_stream *stream;
+	uint64_t total = 0, skip_blocks;
+	uint32_t chunk_size, i, back;
+	int rc;
+
+	if (opts->depth == 0 || opts->depth > NVMF_NDP_STREAM_MAX_DEPTH ||
+	    (opts->mode == NVMF_NDP_STREAM_MODE_LINES && opts->max_record_len == 0)) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num_extents; i++) {
+		if (extents[i].num_blocks == 0 ||
+		    extents[i].offset_blocks + extents[i].num_blocks > bdev_num_blocks ||
+		    extents[i].offset_blocks + extents[i].num_blocks < extents[i].offset_blocks) {
+			SPDK_ERRLOG("NDP extent %u (%" PRIu64 "+%" PRIu64 ") is out of range\n",
+				    i, extents[i].offset_blocks, extents[i].num_blocks);
+			return -ERANGE;
+		}
+		total += extents[i].num_blocks * block_size;
+	}
+
+	if (opts->length != 0) {
+		total = spdk_min(total, opts->length);
+	}
+
+	if (opts->offset >= total) {
+		return -EINVAL;
+	}
+
+	stream = calloc(1, sizeof(*stream) + num_extents * sizeof(*extents));
+	if (stream == NULL) {
+		return -ENOMEM;
+	}
+
+	stream->req = req;
+	stream->bdev = bdev;
+	stream->desc = desc;
+	stream->ch = ch;
+	stream->iobuf = nvmf_ndp_req_get_iobuf(req);
+	stream->zcopy = opts->zcopy && nvmf_bdev_zcopy_enabled(bdev);
+	stream->opts = *opts;
+	stream->block_size = block_size;
+	stream->data_fn = data_fn;
+	stream->done_fn = done_fn;
+	stream->cb_arg = cb_arg;
+	stream->remaining = total - opts->offset;
+	stream->num_extents = num_extents;
+	memcpy(stream->extents, extents, num_extents * sizeof(*extents));
+
+	/* Start reading at the block holding opts->offset */
+	skip_blocks = opts->offset / block_size;
+	while (skip_blocks >= stream->extents[stream->ext_idx].num_blocks) {
+		skip_blocks -= stream->extents[stream->ext_idx].num_blocks;
+		stream->ext_idx++;
+	}
+	stream->ext_offset_blocks = skip_blocks;
+	stream->skip = opts->offset % block_size;
+	stream->buf_align = block_size;
+
+	/*
+	 * Some bdevs (compressed volumes) only fill the buffer directly with a
+	 * read of whole boundary units: they go through a scratch buffer of
+	 * their own for anything else, or when a unit of the buffer crosses a
+	 * huge page.  Reads are then cut at the boundary, into chunk buffers
+	 * aligned to it, rather than from the iobuf pool whose buffers aren't.
+	 * Reading starts at the unit holding opts->offset, which is read as a
+	 * whole anyway.  Other bdevs with a boundary (NVMe NOIOB, RAID strips)
+	 * split their I/O on their own and keep the pool.
+	 */
+	if (boundary != 0 && !stream->zcopy && boundary <= VALUE_2MB / block_size &&
+	    spdk_u32_is_pow2(boundary * block_size) && spdk_bdev_reads_whole_units(bdev)) {
+		stream->boundary_blocks = boundary;
+		stream->buf_align = boundary * block_size;
+		stream->iobuf = NULL;
+
+		ext = &stream->extents[stream->ext_idx];
+		back = (ext->offset_blocks + stream->ext_offset_blocks) % boundary;
+		back = spdk_min(back, stream->ext_offset_blocks);
+		stream->ext_offset_blocks -= back;
+		stream->skip += back * block_size;
+	}
+
+	chunk_size = opts->chunk_size;
+	if (stream->iobuf != NULL && !stream->zcopy) {
+		spdk_iobuf_get_opts(&iobuf_opts, sizeof(iobuf_opts));
+		chunk_size = spdk_min(chunk_size, iobuf_opts.large_bufsize);
+	}
+	stream->chunk_blocks = chunk_size / block_size;
+	if (stream->boundary_blocks != 0) {
+		stream->chunk_blocks = spdk_max(stream->chunk_blocks / boundary, 1) * boundary;
+	}
+	if (stream->chunk_blocks == 0) {
+		free(stream);
+		return -EINVAL;
+	}
+	stream->opts.chunk_size = stream->chunk_blocks * block_size;
+
+	if (opts->mode == NVMF_NDP_STREAM_MODE_LINES) {
+		stream->carry = malloc(opts->max_record_len);
+		if (stream->carry == NULL) {
+			free(stream);
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < stream->opts.depth; i++) {
+		stream->slots[i].stream = stream;
+		stream->slots[i].state = NVMF_NDP_STREAM_SLOT_FREE;
+	}
+
+	stream->job = opts->job;
+	if (stream->job == NULL) {
+		stream->job = &stream->own_job;
+		nvmf_ndp_job_begin(stream->job, req);
+	}
+
+	for (i = 0; i < stream->opts.depth; i++) {
+		nvmf_ndp_stream_fill_slot(&stream->slots[i]);
+	}
+
+	if (stream->outstanding == 0) {
+		/* Nothing could be submitted */
+		rc = stream->status;
+		assert(rc != 0);
+		nvmf_ndp_stream_free(stream);
+		return rc;
+	}
+
+	return 0;
+}
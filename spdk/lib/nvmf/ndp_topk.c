@@ -0,0 +1,534 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+/*
+ * Top-K and sampling engine for the NDP topk and sample operators.
+ *
+ * Matching records are selected and reduced by the filter engine.  Their keys
+ * are kept in a binary heap with the worst ranking record at the root, so a
+ * record that doesn't make it into the top K costs one comparison.  Samples
+ * are drawn with Algorithm L (Li, 1994), which computes how many records to
+ * skip instead of drawing a random number for each one.
+ *
+ * The records themselves are packed into an arena at least twice the size of
+ * the result.  Dropping a record only leaves a hole, the arena is compacted
+ * once a record doesn't fit at its end; by then holes make up about half of
+ * it, so the copies are amortized over as many bytes of records kept.  The
+ * entries and the arena are one mempool element, taken once per command.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "ndp_internal.h"
+
+#include "spdk/endian.h"
+#include "spdk/env.h"
+#include "spdk/log.h"
+#include "spdk/util.h"
+
+/*
+ * Heaps in the mempool: a batch command takes one per file in flight, so
+ * this lets four of them run at full depth, or as many single file commands.
+ */
+#define NVMF_NDP_TOPK_POOL_SIZE		(4 * NVMF_NDP_BATCH_MAX_DEPTH)
+#define NVMF_NDP_TOPK_HEAP_SIZE		(512 * 1024)
+
+struct nvmf_ndp_topk_entry {
+	union {
+		int64_t		ival;
+		double		fval;
+	} key;
+
+	/* Index of the record among the matching ones */
+	uint64_t		seq;
+
+	/* The record in the arena */
+	uint32_t		off;
+	uint32_t		len;
+};
+
+#define NVMF_NDP_TOPK_ARENA_SIZE \
+	(NVMF_NDP_TOPK_HEAP_SIZE - NVMF_NDP_TOPK_MAX_K * sizeof(struct nvmf_ndp_topk_entry))
+
+struct nvmf_ndp_topk {
+	struct nvmf_ndp_filter		*filter;
+	bool				sample;
+	uint8_t				type;
+	bool				ascending;
+	uint16_t			key_column;
+	uint32_t			k;
+
+	/* Mempool element: NVMF_NDP_TOPK_MAX_K entries, then the arena */
+	void				*heap;
+	struct nvmf_ndp_topk_entry	*entries;
+	uint32_t			num_entries;
+	char				*arena;
+
+	/* Bytes of records kept, limited to the result size, and the end of the last one */
+	uint32_t			used;
+	uint32_t			budget;
+	uint32_t			arena_end;
+
+	/* Records matching the predicate so far */
+	uint64_t			matches;
+
+	/* A record was dropped, skipped or cut for lack of space */
+	bool				truncated;
+
+	/* Top-K: a record was dropped for lack of space, worse ones can't make it any more */
+	bool				dropped;
+	struct nvmf_ndp_topk_entry	floor;
+
+	/* Sample: xorshift state, Algorithm L weight and next record to take */
+	uint64_t			rand;
+	double				w;
+	uint64_t			next;
+};
+
+static struct spdk_mempool *g_nvmf_ndp_topk_pool;
+static pthread_mutex_t g_nvmf_ndp_topk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Created on first use, the pool then lives as long as the process */
+static struct spdk_mempool *
+topk_get_pool(void)
+{
+	struct spdk_mempool *pool;
+
+	pthread_mutex_lock(&g_nvmf_ndp_topk_lock);
+	if (g_nvmf_ndp_topk_pool == NULL) {
+		g_nvmf_ndp_topk_pool = spdk_mempool_create("nvmf_ndp_topk", NVMF_NDP_TOPK_POOL_SIZE,
+				       NVMF_NDP_TOPK_HEAP_SIZE, 0, SPDK_ENV_SOCKET_ID_ANY);
+		if (g_nvmf_ndp_topk_pool == NULL) {
+			SPDK_ERRLOG("Unable to create the NDP top-K mempool\n");
+		}
+	}
+	pool = g_nvmf_ndp_topk_pool;
+	pthread_mutex_unlock(&g_nvmf_ndp_topk_lock);
+
+	return pool;
+}
+
+void
+nvmf_ndp_topk_free(struct nvmf_ndp_topk *topk)
+{
+	if (topk == NULL) {
+		return;
+	}
+
+	if (topk->heap != NULL) {
+		spdk_mempool_put(g_nvmf_ndp_topk_pool, topk->heap);
+	}
+	nvmf_ndp_filter_free(topk->filter);
+	free(topk);
+}
+
+/*
+ * Scramble the seed with the splitmix64 finalizer: close seeds would otherwise
+ * start xorshift on correlated draws.  The state of xorshift must not be 0.
+ */
+static uint64_t
+topk_seed(uint32_t seed)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+
+	return z != 0 ? z : 0x9e3779b97f4a7c15ull;
+}
+
+/* xorshift64*, uniform in (0, 1) */
+static double
+topk_random(struct nvmf_ndp_topk *topk)
+{
+	topk->rand ^= topk->rand >> 12;
+	topk->rand ^= topk->rand << 25;
+	topk->rand ^= topk->rand >> 27;
+
+	return (((topk->rand * 0x2545f4914f6cdd1dull) >> 11) + 0.5) * 0x1p-53;
+}
+
+/* Algorithm L: the index of the next record to take into the sample */
+static void
+topk_sample_skip(struct nvmf_ndp_topk *topk)
+{
+	double skip;
+
+	topk->w *= exp(log(topk_random(topk)) / topk->k);
+	skip = floor(log(topk_random(topk)) / log1p(-topk->w));
+	topk->next = skip < 0x1p62 ? topk->next + (uint64_t)skip + 1 : UINT64_MAX;
+}
+
+int
+nvmf_ndp_topk_create(const void *args, size_t len, bool sample, uint32_t result_size,
+		     struct nvmf_ndp_topk **_topk)
+{
+	struct nvmf_ndp_topk_hdr hdr;
+	struct nvmf_ndp_topk *topk;
+	struct spdk_mempool *pool;
+	uint32_t k;
+	int rc = -EINVAL;
+
+	if (len < sizeof(hdr)) {
+		SPDK_ERRLOG("Top-K arguments too short: %zu bytes\n", len);
+		return -EINVAL;
+	}
+
+	memcpy(&hdr, args, sizeof(hdr));
+	k = from_le32(&hdr.k);
+	if (from_le32(&hdr.magic) != NVMF_NDP_TOPK_MAGIC || k == 0 || k > NVMF_NDP_TOPK_MAX_K ||
+	    (sample && (hdr.type != 0 || hdr.flags != 0 || hdr.key_column != 0)) ||
+	    (!sample && hdr.type != NVMF_NDP_FILTER_TYPE_INT &&
+	     hdr.type != NVMF_NDP_FILTER_TYPE_FLOAT) ||
+	    (hdr.flags & ~NVMF_NDP_TOPK_FLAG_ASCENDING) != 0) {
+		SPDK_ERRLOG("Invalid top-K header: k %u type %u flags 0x%x\n", k, hdr.type, hdr.flags);
+		return -EINVAL;
+	}
+
+	pool = topk_get_pool();
+	if (pool == NULL) {
+		return -ENOMEM;
+	}
+
+	topk = calloc(1, sizeof(*topk));
+	if (topk == NULL) {
+		return -ENOMEM;
+	}
+	topk->sample = sample;
+	topk->type = hdr.type;
+	topk->ascending = !!(hdr.flags & NVMF_NDP_TOPK_FLAG_ASCENDING);
+	topk->key_column = from_le16(&hdr.key_column);
+	topk->k = k;
+	topk->budget = spdk_min(result_size, NVMF_NDP_TOPK_ARENA_SIZE / 2);
+
+	topk->filter = nvmf_ndp_filter_create((const char *)args + sizeof(hdr), len - sizeof(hdr));
+	if (topk->filter == NULL) {
+		goto err;
+	}
+	if (!sample && nvmf_ndp_filter_split_column(topk->filter, topk->key_column) != 0) {
+		SPDK_ERRLOG("Invalid top-K key column %u\n", topk->key_column);
+		goto err;
+	}
+
+	topk->heap = spdk_mempool_get(pool);
+	if (topk->heap == NULL) {
+		/* Freed as the running commands complete */
+		SPDK_NOTICELOG("No NDP top-K heap left\n");
+		rc = -EAGAIN;
+		goto err;
+	}
+	topk->entries = topk->heap;
+	topk->arena = (char *)topk->heap + NVMF_NDP_TOPK_MAX_K * sizeof(*topk->entries);
+
+	topk->rand = topk_seed(from_le32(&hdr.seed));
+	topk->w = 1.0;
+	topk->next = k - 1;
+	if (sample) {
+		topk_sample_skip(topk);
+	}
+
+	*_topk = topk;
+	return 0;
+
+err:
+	nvmf_ndp_topk_free(topk);
+	return rc;
+}
+
+/* True if a ranks before b */
+static bool
+topk_better(const struct nvmf_ndp_topk *topk, const struct nvmf_ndp_topk_entry *a,
+	    const struct nvmf_ndp_topk_entry *b)
+{
+	int cmp;
+
+	if (topk->type == NVMF_NDP_FILTER_TYPE_INT) {
+		cmp = (a->key.ival > b->key.ival) - (a->key.ival < b->key.ival);
+	} else {
+		cmp = (a->key.fval > b->key.fval) - (a->key.fval < b->key.fval);
+	}
+	if (topk->ascending) {
+		cmp = -cmp;
+	}
+
+	/* Equal keys: the earlier record first */
+	return cmp != 0 ? cmp > 0 : a->seq < b->seq;
+}
+
+static void
+topk_sift_up(struct nvmf_ndp_topk *topk, uint32_t i)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries, tmp;
+	uint32_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!topk_better(topk, &e[parent], &e[i])) {
+			break;
+		}
+		tmp = e[parent];
+		e[parent] = e[i];
+		e[i] = tmp;
+		i = parent;
+	}
+}
+
+/* Restore the heap below i among the first n entries, the worst at the root */
+static void
+topk_sift_down(struct nvmf_ndp_topk *topk, uint32_t i, uint32_t n)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries, tmp;
+	uint32_t worst, c;
+
+	for (;;) {
+		worst = i;
+		for (c = 2 * i + 1; c <= 2 * i + 2 && c < n; c++) {
+			if (topk_better(topk, &e[worst], &e[c])) {
+				worst = c;
+			}
+		}
+		if (worst == i) {
+			return;
+		}
+		tmp = e[worst];
+		e[worst] = e[i];
+		e[i] = tmp;
+		i = worst;
+	}
+}
+
+static int
+topk_cmp_off(const void *a, const void *b)
+{
+	const struct nvmf_ndp_topk_entry *ea = a, *eb = b;
+
+	return (ea->off > eb->off) - (ea->off < eb->off);
+}
+
+static int
+topk_cmp_seq(const void *a, const void *b)
+{
+	const struct nvmf_ndp_topk_entry *ea = a, *eb = b;
+
+	return (ea->seq > eb->seq) - (ea->seq < eb->seq);
+}
+
+/* Move the records kept to the start of the arena */
+static void
+topk_compact(struct nvmf_ndp_topk *topk)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries;
+	uint32_t i, off = 0;
+
+	qsort(e, topk->num_entries, sizeof(*e), topk_cmp_off);
+	for (i = 0; i < topk->num_entries; i++) {
+		memmove(topk->arena + off, topk->arena + e[i].off, e[i].len);
+		e[i].off = off;
+		off += e[i].len;
+	}
+	topk->arena_end = off;
+
+	if (!topk->sample) {
+		for (i = topk->num_entries / 2; i > 0; i--) {
+			topk_sift_down(topk, i - 1, topk->num_entries);
+		}
+	}
+}
+
+/* Copy the record into the arena, the caller made room for len more bytes */
+static void
+topk_store(struct nvmf_ndp_topk *topk, struct nvmf_ndp_topk_entry *entry, struct iovec *iov,
+	   int iovcnt, uint32_t len)
+{
+	uint32_t n;
+	int i;
+
+	if (topk->arena_end + len > NVMF_NDP_TOPK_ARENA_SIZE) {
+		topk_compact(topk);
+	}
+
+	entry->off = topk->arena_end;
+	entry->len = len;
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		n = spdk_min(len, iov[i].iov_len);
+		memcpy(topk->arena + topk->arena_end, iov[i].iov_base, n);
+		topk->arena_end += n;
+		len -= n;
+	}
+	topk->used += entry->len;
+}
+
+/* Drop the worst record, at the root */
+static void
+topk_pop(struct nvmf_ndp_topk *topk)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries;
+
+	topk->used -= e[0].len;
+	e[0] = e[--topk->num_entries];
+	topk_sift_down(topk, 0, topk->num_entries);
+}
+
+/* Remember that nothing ranking after entry can be kept any more */
+static void
+topk_drop(struct nvmf_ndp_topk *topk, const struct nvmf_ndp_topk_entry *entry)
+{
+	if (!topk->dropped || topk_better(topk, entry, &topk->floor)) {
+		topk->floor = *entry;
+		topk->dropped = true;
+	}
+	topk->truncated = true;
+}
+
+static void
+topk_offer(struct nvmf_ndp_topk *topk, struct nvmf_ndp_topk_entry *entry, struct iovec *iov,
+	   int iovcnt, uint32_t len)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries;
+
+	if (topk->dropped && !topk_better(topk, entry, &topk->floor)) {
+		return;
+	}
+	if (topk->num_entries == topk->k && !topk_better(topk, entry, &e[0])) {
+		return;
+	}
+
+	while (topk->used + len > topk->budget) {
+		if (topk->num_entries == 0 || !topk_better(topk, entry, &e[0])) {
+			topk_drop(topk, entry);
+			return;
+		}
+		topk_drop(topk, &e[0]);
+		topk_pop(topk);
+	}
+	if (topk->num_entries == topk->k) {
+		topk_pop(topk);
+	}
+
+	topk_store(topk, entry, iov, iovcnt, len);
+	e[topk->num_entries] = *entry;
+	topk_sift_up(topk, topk->num_entries++);
+}
+
+static void
+topk_sample(struct nvmf_ndp_topk *topk, struct nvmf_ndp_topk_entry *entry, struct iovec *iov,
+	    int iovcnt, uint32_t len)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries;
+	uint32_t slot;
+
+	if (topk->num_entries < topk->k) {
+		/* Filling the reservoir */
+		if (topk->used + len <= topk->budget) {
+			topk_store(topk, entry, iov, iovcnt, len);
+			e[topk->num_entries++] = *entry;
+		} else {
+			topk->truncated = true;
+		}
+		return;
+	}
+
+	if (entry->seq < topk->next) {
+		return;
+	}
+	topk_sample_skip(topk);
+
+	/* Not inside spdk_min(), which would draw twice */
+	slot = (uint32_t)(topk_random(topk) * topk->k);
+	slot = spdk_min(slot, topk->k - 1);
+	if (topk->used - e[slot].len + len > topk->budget) {
+		topk->truncated = true;
+		return;
+	}
+
+	/* Compacting reorders the entries, the one replaced goes first */
+	topk->used -= e[slot].len;
+	e[slot] = e[--topk->num_entries];
+	topk_store(topk, entry, iov, iovcnt, len);
+	e[topk->num_entries++] = *entry;
+}
+
+static int
+topk_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_topk *topk = cb_arg;
+	struct nvmf_ndp_topk_entry entry = { .seq = topk->matches++ };
+	uint64_t len = 0;
+	const char *p;
+	uint32_t key_len;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+	/* Truncated as a line longer than the whole buffer is by grep */
+	if (len > topk->budget) {
+		len = topk->budget;
+		topk->truncated = true;
+	}
+
+	if (topk->sample) {
+		topk_sample(topk, &entry, iov, iovcnt, len);
+		return 0;
+	}
+
+	p = nvmf_ndp_filter_field(topk->filter, topk->key_column, &key_len);
+	if (p == NULL) {
+		return 0;
+	}
+	if (topk->type == NVMF_NDP_FILTER_TYPE_INT) {
+		if (!nvmf_ndp_parse_int(p, key_len, &entry.key.ival)) {
+			return 0;
+		}
+	} else if (!nvmf_ndp_parse_float(p, key_len, &entry.key.fval)) {
+		return 0;
+	}
+
+	topk_offer(topk, &entry, iov, iovcnt, len);
+	return 0;
+}
+
+void
+nvmf_ndp_topk_scan(struct nvmf_ndp_topk *topk, struct iovec *iov, int iovcnt)
+{
+	nvmf_ndp_filter_scan(topk->filter, iov, iovcnt, topk_match, topk);
+}
+
+size_t
+nvmf_ndp_topk_get_result(struct nvmf_ndp_topk *topk, struct iovec *iov, int iovcnt)
+{
+	struct nvmf_ndp_topk_entry *e = topk->entries, tmp;
+	struct spdk_iov_xfer ix;
+	size_t len = 0;
+	uint32_t i, n;
+
+	if (topk->sample) {
+		qsort(e, topk->num_entries, sizeof(*e), topk_cmp_seq);
+	} else {
+		/* Heap sort: the worst goes last, the best ends up first */
+		for (n = topk->num_entries; n > 1; n--) {
+			tmp = e[0];
+			e[0] = e[n - 1];
+			e[n - 1] = tmp;
+			topk_sift_down(topk, 0, n - 1);
+		}
+	}
+
+	SPDK_DEBUGLOG(nvmf, "NDP %s kept %u of %" PRIu64 " records\n",
+		      topk->sample ? "sample" : "top-K", topk->num_entries, topk->matches);
+
+	spdk_iov_xfer_init(&ix, iov, iovcnt);
+	for (i = 0; i < topk->num_entries; i++) {
+		len += spdk_iov_xfer_from_buf(&ix, topk->arena + e[i].off, e[i].len);
+	}
+
+	return len;
+}
+
+bool
+nvmf_ndp_topk_truncated(const struct nvmf_ndp_topk *topk)
+{
+	return topk->truncated;
+}
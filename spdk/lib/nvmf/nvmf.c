@@ -197,6 +197,9 @@ nvmf_tgt_cleanup_poll_group(struct spdk_nvmf_poll_group *group)
 
 	free(group->sgroups);
 
+	/* The qpairs are gone, so are their NDP streams */
+	nvmf_ndp_stream_buf_cache_free();
+
 	spdk_poller_unregister(&group->poller);
 
 	if (group->destroy_cb_fn) {
@@ -287,6 +290,7 @@ nvmf_tgt_create_poll_group(void *io_device, void *ctx_buf)
 
 	for (i = 0; i < tgt->max_subsystems; i++) {
 		TAILQ_INIT(&group->sgroups[i].queued);
+		TAILQ_INIT(&group->sgroups[i].ndp_jobs);
 	}
 
 	for (subsystem = spdk_nvmf_subsystem_get_first(tgt);
@@ -1434,6 +1438,7 @@ spdk_nvmf_qpair_disconnect(struct spdk_nvmf_qpair *qpair)
 		qpair->state_cb = _nvmf_qpair_destroy;
 		qpair->state_cb_arg = qpair_ctx;
 		nvmf_qpair_abort_pending_zcopy_reqs(qpair);
+		nvmf_ndp_qpair_abort(qpair);
 		nvmf_qpair_free_aer(qpair);
 		return 0;
 	}
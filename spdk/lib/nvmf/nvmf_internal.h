@@ -13,6 +13,7 @@
 #include "spdk/likely.h"
 #include "spdk/nvmf.h"
 #include "spdk/nvmf_cmd.h"
+#include "spdk/nvmf_ndp.h"
 #include "spdk/nvmf_transport.h"
 #include "spdk/nvmf_spec.h"
 #include "spdk/assert.h"
@@ -145,6 +146,9 @@ struct spdk_nvmf_subsystem_poll_group {
 	void					*cb_arg;
 
 	TAILQ_HEAD(, spdk_nvmf_request)		queued;
+
+	/* NDP commands of the subsystem being executed, see nvmf_ndp_job_begin() */
+	TAILQ_HEAD(, nvmf_ndp_job)		ndp_jobs;
 };
 
 struct spdk_nvmf_registrant {
@@ -390,12 +394,6 @@ int nvmf_bdev_ctrlr_read_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc
 			     struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
 int nvmf_bdev_ctrlr_write_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
 			      struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
-int nvmf_bdev_ctrlr_custom_echo_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
-                                struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
-int nvmf_bdev_ctrlr_custom_grep_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
-                                struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
-int nvmf_bdev_ctrlr_custom_heaan_cipadd_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
-                                struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
 int nvmf_bdev_ctrlr_compare_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
 				struct spdk_io_channel *ch, struct spdk_nvmf_request *req);
 int nvmf_bdev_ctrlr_compare_and_write_cmd(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
@@ -571,6 +569,73 @@ int nvmf_bdev_ctrlr_zcopy_start(struct spdk_bdev *bdev,
  */
 void nvmf_bdev_ctrlr_zcopy_end(struct spdk_nvmf_request *req, bool commit);
 
+/**
+ * Mark every registered NDP operator as supported in the Commands Supported
+ * and Effects log page.
+ *
+ * \param log_page The log page to update
+ */
+void nvmf_ndp_fill_cmds_and_effects(struct spdk_nvme_cmds_and_effect_log_page *log_page);
+
+/**
+ * Executes an I/O command claimed by an NDP operator
+ *
+ * \param op The operator registered for the command's opcode
+ * \param bdev The bdev backing the namespace
+ * \param desc The bdev descriptor
+ * \param ch The bdev I/O channel
+ * \param req The NVMe-oF request
+ *
+ * \return \ref spdk_nvmf_request_exec_status
+ */
+int nvmf_ndp_exec(const struct spdk_nvmf_ndp_op *op, struct spdk_bdev *bdev,
+		  struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		  struct spdk_nvmf_request *req);
+
+/**
+ * Aborts an NDP command being executed
+ *
+ * The command stops at its next cancellation point, e.g. before its next
+ * chunk, and completes with SPDK_NVME_SC_ABORTED_BY_REQUEST.  One past its
+ * last cancellation point completes as it would have, so the Abort command
+ * can't report it as aborted.
+ *
+ * \param req The NVMe-oF request to abort
+ *
+ * \return true if req is an NDP command being executed, false otherwise.
+ */
+bool nvmf_ndp_abort_request(struct spdk_nvmf_request *req);
+
+/**
+ * Aborts all NDP commands being executed on a queue pair being disconnected
+ *
+ * They complete with SPDK_NVME_SC_ABORTED_SQ_DELETION.
+ *
+ * \param qpair The queue pair
+ */
+void nvmf_ndp_qpair_abort(struct spdk_nvmf_qpair *qpair);
+
+/**
+ * Drops the cached NDP results computed from blocks an I/O command modifies
+ *
+ * Called both when the command is submitted and when it completes.
+ *
+ * \param req The NVMe-oF request
+ */
+void nvmf_ndp_cache_invalidate_io(struct spdk_nvmf_request *req);
+
+/**
+ * Drops all cached NDP results of a bdev
+ *
+ * \param bdev The bdev, e.g. of a namespace being removed
+ */
+void nvmf_ndp_cache_invalidate_bdev(struct spdk_bdev *bdev);
+
+/**
+ * Frees the NDP stream chunk buffers kept by the calling poll group thread
+ */
+void nvmf_ndp_stream_buf_cache_free(void);
+
 /**
  * Publishes the mDNS PRR (Pull Registration Request) for the NVMe-oF target.
  *
@@ -1718,6 +1718,7 @@ spdk_nvmf_subsystem_remove_ns(struct spdk_nvmf_subsystem *subsystem, uint32_t ns
 
 	free(ns->ptpl_file);
 	nvmf_ns_reservation_clear_all_registrants(ns);
+	nvmf_ndp_cache_invalidate_bdev(ns->bdev);
 	spdk_bdev_module_release_bdev(ns->bdev);
 	spdk_bdev_close(ns->desc);
 	free(ns);
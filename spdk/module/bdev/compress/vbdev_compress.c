@@ -950,6 +950,8 @@ vbdev_compress_claim(struct vbdev_compress *comp_bdev)
 		comp_bdev->params.chunk_size / comp_bdev->params.logical_block_size;
 
 	comp_bdev->comp_bdev.split_on_optimal_io_boundary = true;
+	/* Other reads are decompressed into a scratch buffer and copied out */
+	comp_bdev->comp_bdev.read_whole_units = true;
 
 	comp_bdev->comp_bdev.blocklen = comp_bdev->params.logical_block_size;
 	comp_bdev->comp_bdev.blockcnt = comp_bdev->params.vol_size / comp_bdev->comp_bdev.blocklen;
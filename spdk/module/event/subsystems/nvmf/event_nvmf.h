@@ -10,6 +10,7 @@
 #include "spdk/stdinc.h"
 
 #include "spdk/nvmf.h"
+#include "spdk/nvmf_ndp.h"
 #include "spdk/queue.h"
 
 #include "spdk_internal/init.h"
@@ -22,6 +23,9 @@ struct spdk_nvmf_admin_passthru_conf {
 struct spdk_nvmf_tgt_conf {
 	struct spdk_nvmf_target_opts opts;
 	struct spdk_nvmf_admin_passthru_conf admin_passthru;
+	uint32_t ndp_offload_threads;
+	uint64_t ndp_cache_size;
+	struct spdk_nvmf_ndp_he_opts ndp_he;
 };
 
 extern struct spdk_nvmf_tgt_conf g_spdk_nvmf_tgt_conf;
@@ -30,4 +34,6 @@ extern struct spdk_nvmf_tgt *g_spdk_nvmf_tgt;
 
 extern struct spdk_cpuset *g_poll_groups_mask;
 
+extern struct spdk_cpuset *g_ndp_offload_mask;
+
 #endif
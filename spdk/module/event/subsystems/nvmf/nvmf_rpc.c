@@ -9,6 +9,7 @@
 #include "spdk/rpc.h"
 #include "spdk/util.h"
 #include "spdk/cpuset.h"
+#include "spdk/nvmf_ndp.h"
 
 static const struct spdk_json_object_decoder nvmf_rpc_subsystem_tgt_opts_decoder[] = {
 	{"max_subsystems", 0, spdk_json_decode_uint32, true}
@@ -159,6 +160,43 @@ nvmf_decode_poll_groups_mask(const struct spdk_json_val *val, void *out)
 	return -1;
 }
 
+static int
+nvmf_decode_ndp_offload_mask(const struct spdk_json_val *val, void *out)
+{
+	char *mask = spdk_json_strdup(val);
+	int ret;
+
+	if (mask == NULL) {
+		return -1;
+	}
+
+	spdk_cpuset_free(g_ndp_offload_mask);
+	g_ndp_offload_mask = spdk_cpuset_alloc();
+	if (g_ndp_offload_mask == NULL) {
+		SPDK_ERRLOG("Unable to allocate the NDP offload mask.\n");
+		free(mask);
+		return -1;
+	}
+
+	ret = spdk_cpuset_parse(g_ndp_offload_mask, mask);
+	free(mask);
+	if (ret == 0) {
+		if (spdk_cpuset_count(g_ndp_offload_mask) != 0 &&
+		    nvmf_is_subset_of_env_core_mask(g_ndp_offload_mask) == 0) {
+			return 0;
+		} else {
+			SPDK_ERRLOG("NDP offload cpumask 0x%s is out of range\n",
+				    spdk_cpuset_fmt(g_ndp_offload_mask));
+		}
+	} else {
+		SPDK_ERRLOG("Invalid cpumask\n");
+	}
+
+	spdk_cpuset_free(g_ndp_offload_mask);
+	g_ndp_offload_mask = NULL;
+	return -1;
+}
+
 static int
 decode_digest(const struct spdk_json_val *val, void *out)
 {
@@ -225,12 +263,47 @@ decode_dhgroup_array(const struct spdk_json_val *val, void *out)
 	return spdk_json_decode_array(val, decode_dhgroup, out, 32, &count, 0);
 }
 
+static const struct spdk_json_object_decoder ndp_he_decoder[] = {
+	{"log_q", offsetof(struct spdk_nvmf_ndp_he_opts, log_q), spdk_json_decode_uint32, true},
+	{"log_p", offsetof(struct spdk_nvmf_ndp_he_opts, log_p), spdk_json_decode_uint32, true},
+	{"log_slots", offsetof(struct spdk_nvmf_ndp_he_opts, log_slots), spdk_json_decode_uint32, true},
+	{"log_t", offsetof(struct spdk_nvmf_ndp_he_opts, log_t), spdk_json_decode_uint32, true},
+	{"log_key_q", offsetof(struct spdk_nvmf_ndp_he_opts, log_key_q), spdk_json_decode_uint32, true},
+	{"key_file", offsetof(struct spdk_nvmf_ndp_he_opts, key_file), spdk_json_decode_string, true},
+	{"log_n", offsetof(struct spdk_nvmf_ndp_he_opts, log_n), spdk_json_decode_uint32, true},
+	{"num_bufs", offsetof(struct spdk_nvmf_ndp_he_opts, num_bufs), spdk_json_decode_uint32, true},
+	{"eval_threads", offsetof(struct spdk_nvmf_ndp_he_opts, eval_threads), spdk_json_decode_uint32, true},
+};
+
+static int
+decode_ndp_he(const struct spdk_json_val *val, void *out)
+{
+	struct spdk_nvmf_ndp_he_opts *opts = out;
+
+	if (spdk_json_decode_object(val, ndp_he_decoder, SPDK_COUNTOF(ndp_he_decoder), opts)) {
+		SPDK_ERRLOG("spdk_json_decode_object failed\n");
+		return -1;
+	}
+
+	if (opts->log_slots == 0 || opts->log_slots >= opts->log_q) {
+		SPDK_ERRLOG("Invalid HEaaN parameters: log_slots %u, log_q %u\n",
+			    opts->log_slots, opts->log_q);
+		return -1;
+	}
+
+	return 0;
+}
+
 static const struct spdk_json_object_decoder nvmf_rpc_subsystem_tgt_conf_decoder[] = {
 	{"admin_cmd_passthru", offsetof(struct spdk_nvmf_tgt_conf, admin_passthru), decode_admin_passthru, true},
 	{"poll_groups_mask", 0, nvmf_decode_poll_groups_mask, true},
 	{"discovery_filter", offsetof(struct spdk_nvmf_tgt_conf, opts.discovery_filter), decode_discovery_filter, true},
 	{"dhchap_digests", offsetof(struct spdk_nvmf_tgt_conf, opts.dhchap_digests), decode_digest_array, true},
 	{"dhchap_dhgroups", offsetof(struct spdk_nvmf_tgt_conf, opts.dhchap_dhgroups), decode_dhgroup_array, true},
+	{"ndp_offload_mask", 0, nvmf_decode_ndp_offload_mask, true},
+	{"ndp_offload_threads", offsetof(struct spdk_nvmf_tgt_conf, ndp_offload_threads), spdk_json_decode_uint32, true},
+	{"ndp_cache_size", offsetof(struct spdk_nvmf_tgt_conf, ndp_cache_size), spdk_json_decode_uint64, true},
+	{"ndp_he", offsetof(struct spdk_nvmf_tgt_conf, ndp_he), decode_ndp_he, true},
 };
 
 static void
@@ -240,6 +313,14 @@ rpc_nvmf_set_config(struct spdk_jsonrpc_request *request,
 	struct spdk_nvmf_tgt_conf conf;
 
 	memcpy(&conf, &g_spdk_nvmf_tgt_conf, sizeof(conf));
+	/* Decoding a string frees the previous one, keep the current config intact until it succeeds */
+	if (conf.ndp_he.key_file != NULL) {
+		conf.ndp_he.key_file = strdup(conf.ndp_he.key_file);
+		if (conf.ndp_he.key_file == NULL) {
+			spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INTERNAL_ERROR, "Out of memory");
+			return;
+		}
+	}
 
 	if (params != NULL) {
 		if (spdk_json_decode_object(params, nvmf_rpc_subsystem_tgt_conf_decoder,
@@ -247,10 +328,12 @@ rpc_nvmf_set_config(struct spdk_jsonrpc_request *request,
 			SPDK_ERRLOG("spdk_json_decode_object() failed\n");
 			spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
 							 "Invalid parameters");
+			free(conf.ndp_he.key_file);
 			return;
 		}
 	}
 
+	free(g_spdk_nvmf_tgt_conf.ndp_he.key_file);
 	memcpy(&g_spdk_nvmf_tgt_conf, &conf, sizeof(conf));
 
 	spdk_jsonrpc_send_bool_response(request, true);
@@ -296,3 +379,186 @@ rpc_nvmf_set_crdt(struct spdk_jsonrpc_request *request,
 	spdk_jsonrpc_send_bool_response(request, true);
 }
 SPDK_RPC_REGISTER("nvmf_set_crdt", rpc_nvmf_set_crdt, SPDK_RPC_STARTUP)
+
+static void
+rpc_nvmf_get_ndp_cache_stats(struct spdk_jsonrpc_request *request,
+			     const struct spdk_json_val *params)
+{
+	struct spdk_nvmf_ndp_cache_stats stats;
+	struct spdk_json_write_ctx *w;
+
+	if (params != NULL) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "nvmf_get_ndp_cache_stats requires no parameters");
+		return;
+	}
+
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+
+	w = spdk_jsonrpc_begin_result(request);
+	spdk_json_write_object_begin(w);
+	spdk_json_write_named_uint64(w, "capacity", stats.capacity);
+	spdk_json_write_named_uint64(w, "size", stats.size);
+	spdk_json_write_named_uint64(w, "num_entries", stats.num_entries);
+	spdk_json_write_named_uint64(w, "hits", stats.hits);
+	spdk_json_write_named_uint64(w, "misses", stats.misses);
+	spdk_json_write_named_uint64(w, "insertions", stats.insertions);
+	spdk_json_write_named_uint64(w, "evictions", stats.evictions);
+	spdk_json_write_named_uint64(w, "invalidations", stats.invalidations);
+	spdk_json_write_object_end(w);
+	spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("nvmf_get_ndp_cache_stats", rpc_nvmf_get_ndp_cache_stats, SPDK_RPC_RUNTIME)
+
+struct nvmf_rpc_set_ndp_timeout {
+	char		*op;
+	uint32_t	timeout_ms;
+};
+
+static const struct spdk_json_object_decoder rpc_set_ndp_timeout_decoders[] = {
+	{"op", offsetof(struct nvmf_rpc_set_ndp_timeout, op), spdk_json_decode_string},
+	{"timeout_ms", offsetof(struct nvmf_rpc_set_ndp_timeout, timeout_ms), spdk_json_decode_uint32},
+};
+
+static const struct spdk_nvmf_ndp_op *
+nvmf_rpc_find_ndp_op(const char *name)
+{
+	const struct spdk_nvmf_ndp_op *op;
+	uint32_t opc;
+
+	for (opc = SPDK_NVMF_NDP_OPC_MIN; opc <= SPDK_NVME_MAX_OPC; opc++) {
+		op = spdk_nvmf_ndp_get_op(opc);
+		if (op != NULL && strcmp(op->name, name) == 0) {
+			return op;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+rpc_nvmf_set_ndp_timeout(struct spdk_jsonrpc_request *request,
+			 const struct spdk_json_val *params)
+{
+	struct nvmf_rpc_set_ndp_timeout req = {};
+	const struct spdk_nvmf_ndp_op *op;
+
+	if (spdk_json_decode_object(params, rpc_set_ndp_timeout_decoders,
+				    SPDK_COUNTOF(rpc_set_ndp_timeout_decoders), &req)) {
+		SPDK_ERRLOG("spdk_json_decode_object() failed\n");
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "Invalid parameters");
+		goto out;
+	}
+
+	op = nvmf_rpc_find_ndp_op(req.op);
+	if (op == NULL) {
+		spdk_jsonrpc_send_error_response_fmt(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						     "Unknown NDP operator %s", req.op);
+		goto out;
+	}
+
+	spdk_nvmf_ndp_set_timeout(op->opc, req.timeout_ms);
+	spdk_jsonrpc_send_bool_response(request, true);
+
+out:
+	free(req.op);
+}
+SPDK_RPC_REGISTER("nvmf_set_ndp_timeout", rpc_nvmf_set_ndp_timeout,
+		  SPDK_RPC_STARTUP | SPDK_RPC_RUNTIME)
+
+static void
+rpc_nvmf_get_ndp_timeouts(struct spdk_jsonrpc_request *request,
+			  const struct spdk_json_val *params)
+{
+	const struct spdk_nvmf_ndp_op *op;
+	struct spdk_json_write_ctx *w;
+	uint32_t opc;
+
+	if (params != NULL) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "nvmf_get_ndp_timeouts requires no parameters");
+		return;
+	}
+
+	w = spdk_jsonrpc_begin_result(request);
+	spdk_json_write_array_begin(w);
+	for (opc = SPDK_NVMF_NDP_OPC_MIN; opc <= SPDK_NVME_MAX_OPC; opc++) {
+		op = spdk_nvmf_ndp_get_op(opc);
+		if (op == NULL) {
+			continue;
+		}
+		spdk_json_write_object_begin(w);
+		spdk_json_write_named_string(w, "op", op->name);
+		spdk_json_write_named_uint32(w, "opc", opc);
+		spdk_json_write_named_uint32(w, "timeout_ms", spdk_nvmf_ndp_get_timeout(opc));
+		spdk_json_write_object_end(w);
+	}
+	spdk_json_write_array_end(w);
+	spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("nvmf_get_ndp_timeouts", rpc_nvmf_get_ndp_timeouts, SPDK_RPC_RUNTIME)
+
+static void
+rpc_nvmf_get_ndp_he_status(struct spdk_jsonrpc_request *request,
+			   const struct spdk_json_val *params)
+{
+	struct spdk_nvmf_ndp_he_opts *opts = &g_spdk_nvmf_tgt_conf.ndp_he;
+	struct spdk_nvmf_ndp_he_status status;
+	struct spdk_json_write_ctx *w;
+
+	if (params != NULL) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "nvmf_get_ndp_he_status requires no parameters");
+		return;
+	}
+
+	spdk_nvmf_ndp_he_get_status(&status);
+
+	w = spdk_jsonrpc_begin_result(request);
+	spdk_json_write_object_begin(w);
+	spdk_json_write_named_string(w, "state", spdk_nvmf_ndp_he_state_str(status.state));
+	spdk_json_write_named_uint32(w, "log_q", opts->log_q);
+	spdk_json_write_named_uint32(w, "log_p", opts->log_p);
+	spdk_json_write_named_uint32(w, "log_slots", opts->log_slots);
+	spdk_json_write_named_uint32(w, "log_t", opts->log_t);
+	spdk_json_write_named_uint32(w, "log_key_q", opts->log_key_q);
+	if (opts->key_file) {
+		spdk_json_write_named_string(w, "key_file", opts->key_file);
+	}
+	spdk_json_write_named_bool(w, "from_key_file", status.from_key_file);
+	spdk_json_write_named_uint64(w, "init_time_ms", status.init_time_ms);
+	spdk_json_write_object_end(w);
+	spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("nvmf_get_ndp_he_status", rpc_nvmf_get_ndp_he_status, SPDK_RPC_RUNTIME)
+
+static void
+rpc_nvmf_get_ndp_he_pool_stats(struct spdk_jsonrpc_request *request,
+			       const struct spdk_json_val *params)
+{
+	struct spdk_nvmf_ndp_he_pool_stats stats;
+	struct spdk_json_write_ctx *w;
+
+	if (params != NULL) {
+		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_INVALID_PARAMS,
+						 "nvmf_get_ndp_he_pool_stats requires no parameters");
+		return;
+	}
+
+	spdk_nvmf_ndp_he_get_pool_stats(&stats);
+
+	w = spdk_jsonrpc_begin_result(request);
+	spdk_json_write_object_begin(w);
+	spdk_json_write_named_uint64(w, "buf_size", stats.buf_size);
+	spdk_json_write_named_uint32(w, "num_bufs", stats.num_bufs);
+	spdk_json_write_named_uint32(w, "bufs_in_use", stats.bufs_in_use);
+	spdk_json_write_named_uint32(w, "bufs_high_water", stats.bufs_high_water);
+	spdk_json_write_named_uint64(w, "buf_gets", stats.buf_gets);
+	spdk_json_write_named_uint64(w, "buf_fallbacks", stats.buf_fallbacks);
+	spdk_json_write_named_uint64(w, "ct_created", stats.ct_created);
+	spdk_json_write_named_uint64(w, "ct_reused", stats.ct_reused);
+	spdk_json_write_object_end(w);
+	spdk_jsonrpc_end_result(request, w);
+}
+SPDK_RPC_REGISTER("nvmf_get_ndp_he_pool_stats", rpc_nvmf_get_ndp_he_pool_stats, SPDK_RPC_RUNTIME)
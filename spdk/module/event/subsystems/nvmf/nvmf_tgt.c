@@ -11,6 +11,7 @@
 #include "spdk/log.h"
 #include "spdk/nvme.h"
 #include "spdk/nvmf_cmd.h"
+#include "spdk/nvmf_ndp.h"
 #include "spdk_internal/usdt.h"
 
 enum nvmf_tgt_state {
@@ -44,10 +45,21 @@ struct spdk_nvmf_tgt_conf g_spdk_nvmf_tgt_conf = {
 		.dhchap_digests = UINT32_MAX,
 		.dhchap_dhgroups = UINT32_MAX,
 	},
-	.admin_passthru.identify_ctrlr = false
+	.admin_passthru.identify_ctrlr = false,
+	.ndp_cache_size = SPDK_NVMF_NDP_CACHE_DEFAULT_SIZE,
+	.ndp_he = {
+		.log_q = SPDK_NVMF_NDP_HE_DEFAULT_LOG_Q,
+		.log_p = SPDK_NVMF_NDP_HE_DEFAULT_LOG_P,
+		.log_slots = SPDK_NVMF_NDP_HE_DEFAULT_LOG_SLOTS,
+		.log_t = SPDK_NVMF_NDP_HE_DEFAULT_LOG_T,
+		.log_key_q = SPDK_NVMF_NDP_HE_DEFAULT_LOG_KEY_Q,
+		.log_n = SPDK_NVMF_NDP_HE_DEFAULT_LOG_N,
+		.num_bufs = SPDK_NVMF_NDP_HE_DEFAULT_NUM_BUFS,
+	},
 };
 
 struct spdk_cpuset *g_poll_groups_mask = NULL;
+struct spdk_cpuset *g_ndp_offload_mask = NULL;
 struct spdk_nvmf_tgt *g_spdk_nvmf_tgt = NULL;
 
 static enum nvmf_tgt_state g_tgt_state;
@@ -316,6 +328,12 @@ nvmf_tgt_destroy_done(void *ctx, int status)
 	nvmf_tgt_advance_state();
 }
 
+static void
+nvmf_tgt_ndp_offload_stopped(void *ctx)
+{
+	spdk_nvmf_tgt_destroy(g_spdk_nvmf_tgt, nvmf_tgt_destroy_done, NULL);
+}
+
 static int
 nvmf_add_discovery_subsystem(void)
 {
@@ -451,6 +469,22 @@ nvmf_tgt_advance_state(void)
 				SPDK_NOTICELOG("Custom identify ctrlr handler enabled\n");
 				spdk_nvmf_set_custom_admin_cmd_hdlr(SPDK_NVME_OPC_IDENTIFY, nvmf_custom_identify_hdlr);
 			}
+			/* NDP operators hand their computation to these threads */
+			ret = spdk_nvmf_ndp_offload_start(g_ndp_offload_mask,
+							  g_spdk_nvmf_tgt_conf.ndp_offload_threads);
+			if (ret != 0) {
+				SPDK_ERRLOG("Unable to start the NDP offload threads: %d\n", ret);
+				g_tgt_state = NVMF_TGT_ERROR;
+				break;
+			}
+			spdk_nvmf_ndp_cache_set_capacity(g_spdk_nvmf_tgt_conf.ndp_cache_size);
+			/* Only started here, HEaaN commands complete with Namespace Not Ready until it is built */
+			ret = spdk_nvmf_ndp_he_start(&g_spdk_nvmf_tgt_conf.ndp_he);
+			if (ret != 0 && ret != -ENOTSUP) {
+				SPDK_ERRLOG("Unable to start building the HEaaN context: %d\n", ret);
+				g_tgt_state = NVMF_TGT_ERROR;
+				break;
+			}
 			/* Create poll group threads, and send a message to each thread
 			 * and create a poll group.
 			 */
@@ -503,7 +537,8 @@ nvmf_tgt_advance_state(void)
 			nvmf_tgt_destroy_poll_groups();
 			break;
 		case NVMF_TGT_FINI_DESTROY_TARGET:
-			spdk_nvmf_tgt_destroy(g_spdk_nvmf_tgt, nvmf_tgt_destroy_done, NULL);
+			/* No poll group is left to submit NDP jobs */
+			spdk_nvmf_ndp_offload_stop(nvmf_tgt_ndp_offload_stopped, NULL);
 			break;
 		case NVMF_TGT_STOPPED:
 			spdk_subsystem_fini_next();
@@ -549,6 +584,29 @@ nvmf_subsystem_dump_discover_filter(struct spdk_json_write_ctx *w)
 				     answers[g_spdk_nvmf_tgt_conf.opts.discovery_filter]);
 }
 
+static void
+nvmf_subsystem_write_ndp_timeouts(struct spdk_json_write_ctx *w)
+{
+	const struct spdk_nvmf_ndp_op *op;
+	uint32_t opc, timeout_ms;
+
+	for (opc = SPDK_NVMF_NDP_OPC_MIN; opc <= SPDK_NVME_MAX_OPC; opc++) {
+		op = spdk_nvmf_ndp_get_op(opc);
+		timeout_ms = spdk_nvmf_ndp_get_timeout(opc);
+		if (op == NULL || timeout_ms == 0) {
+			continue;
+		}
+
+		spdk_json_write_object_begin(w);
+		spdk_json_write_named_string(w, "method", "nvmf_set_ndp_timeout");
+		spdk_json_write_named_object_begin(w, "params");
+		spdk_json_write_named_string(w, "op", op->name);
+		spdk_json_write_named_uint32(w, "timeout_ms", timeout_ms);
+		spdk_json_write_object_end(w);
+		spdk_json_write_object_end(w);
+	}
+}
+
 static void
 nvmf_subsystem_write_config_json(struct spdk_json_write_ctx *w)
 {
@@ -566,8 +624,31 @@ nvmf_subsystem_write_config_json(struct spdk_json_write_ctx *w)
 	if (g_poll_groups_mask) {
 		spdk_json_write_named_string(w, "poll_groups_mask", spdk_cpuset_fmt(g_poll_groups_mask));
 	}
+	if (g_ndp_offload_mask) {
+		spdk_json_write_named_string(w, "ndp_offload_mask", spdk_cpuset_fmt(g_ndp_offload_mask));
+	}
+	if (g_spdk_nvmf_tgt_conf.ndp_offload_threads) {
+		spdk_json_write_named_uint32(w, "ndp_offload_threads",
+					     g_spdk_nvmf_tgt_conf.ndp_offload_threads);
+	}
+	spdk_json_write_named_uint64(w, "ndp_cache_size", g_spdk_nvmf_tgt_conf.ndp_cache_size);
+	spdk_json_write_named_object_begin(w, "ndp_he");
+	spdk_json_write_named_uint32(w, "log_q", g_spdk_nvmf_tgt_conf.ndp_he.log_q);
+	spdk_json_write_named_uint32(w, "log_p", g_spdk_nvmf_tgt_conf.ndp_he.log_p);
+	spdk_json_write_named_uint32(w, "log_slots", g_spdk_nvmf_tgt_conf.ndp_he.log_slots);
+	spdk_json_write_named_uint32(w, "log_t", g_spdk_nvmf_tgt_conf.ndp_he.log_t);
+	spdk_json_write_named_uint32(w, "log_key_q", g_spdk_nvmf_tgt_conf.ndp_he.log_key_q);
+	if (g_spdk_nvmf_tgt_conf.ndp_he.key_file) {
+		spdk_json_write_named_string(w, "key_file", g_spdk_nvmf_tgt_conf.ndp_he.key_file);
+	}
+	spdk_json_write_named_uint32(w, "log_n", g_spdk_nvmf_tgt_conf.ndp_he.log_n);
+	spdk_json_write_named_uint32(w, "num_bufs", g_spdk_nvmf_tgt_conf.ndp_he.num_bufs);
+	spdk_json_write_named_uint32(w, "eval_threads", g_spdk_nvmf_tgt_conf.ndp_he.eval_threads);
 	spdk_json_write_object_end(w);
 	spdk_json_write_object_end(w);
+	spdk_json_write_object_end(w);
+
+	nvmf_subsystem_write_ndp_timeouts(w);
 
 	spdk_nvmf_tgt_write_config_json(w, g_spdk_nvmf_tgt);
 	spdk_json_write_array_end(w);
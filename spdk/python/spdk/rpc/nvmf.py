@@ -24,7 +24,10 @@ def nvmf_set_max_subsystems(client,
 def nvmf_set_config(client,
                     passthru_identify_ctrlr=None,
                     poll_groups_mask=None,
-                    discovery_filter=None, dhchap_digests=None, dhchap_dhgroups=None):
+                    discovery_filter=None, dhchap_digests=None, dhchap_dhgroups=None,
+                    ndp_offload_mask=None, ndp_offload_threads=None, ndp_cache_size=None,
+                    ndp_he_params=None, ndp_he_key_file=None, ndp_he_log_n=None,
+                    ndp_he_num_bufs=None, ndp_he_eval_threads=None):
     """Set NVMe-oF target subsystem configuration.
 
     Args:
@@ -32,6 +35,14 @@ def nvmf_set_config(client,
          comma separated values: `transport`, `address`, `svcid`
         dhchap_digests: List of allowed DH-HMAC-CHAP digests. (optional)
         dhchap_dhgroups: List of allowed DH-HMAC-CHAP DH groups. (optional)
+        ndp_offload_mask: Cpumask for the NDP offload threads (optional)
+        ndp_offload_threads: Number of NDP offload threads, default one per core of ndp_offload_mask (optional)
+        ndp_cache_size: Size of the NDP result cache in bytes, 0 to disable it (optional)
+        ndp_he_params: HEaaN context parameters [log_q, log_p, log_slots, log_t, log_key_q] (optional)
+        ndp_he_key_file: File the HEaaN keys are saved to and loaded from (optional)
+        ndp_he_log_n: Log2 of the ring dimension the HEaaN buffers are sized for (optional)
+        ndp_he_num_bufs: Number of pooled HEaaN buffers, 0 to disable the pool (optional)
+        ndp_he_eval_threads: Offload threads a packed HEaaN multiplication is split over, 0 for all (optional)
     Returns:
         True or False
     """
@@ -49,6 +60,29 @@ def nvmf_set_config(client,
         params['dhchap_digests'] = dhchap_digests
     if dhchap_dhgroups is not None:
         params['dhchap_dhgroups'] = dhchap_dhgroups
+    if ndp_offload_mask:
+        params['ndp_offload_mask'] = ndp_offload_mask
+    if ndp_offload_threads is not None:
+        params['ndp_offload_threads'] = ndp_offload_threads
+    if ndp_cache_size is not None:
+        params['ndp_cache_size'] = ndp_cache_size
+    if ndp_he_params is not None or ndp_he_key_file or ndp_he_log_n is not None or \
+            ndp_he_num_bufs is not None or ndp_he_eval_threads is not None:
+        ndp_he = {}
+        if ndp_he_params is not None:
+            names = ['log_q', 'log_p', 'log_slots', 'log_t', 'log_key_q']
+            if len(ndp_he_params) != len(names):
+                raise ValueError('ndp_he_params needs %d values' % len(names))
+            ndp_he.update(zip(names, ndp_he_params))
+        if ndp_he_key_file:
+            ndp_he['key_file'] = ndp_he_key_file
+        if ndp_he_log_n is not None:
+            ndp_he['log_n'] = ndp_he_log_n
+        if ndp_he_num_bufs is not None:
+            ndp_he['num_bufs'] = ndp_he_num_bufs
+        if ndp_he_eval_threads is not None:
+            ndp_he['eval_threads'] = ndp_he_eval_threads
+        params['ndp_he'] = ndp_he
 
     return client.call('nvmf_set_config', params)
 
@@ -689,6 +723,56 @@ def nvmf_get_stats(client, tgt_name=None):
     return client.call('nvmf_get_stats', params)
 
 
+def nvmf_get_ndp_cache_stats(client):
+    """Query NDP result cache statistics.
+
+    Returns:
+        Current NDP result cache statistics.
+    """
+    return client.call('nvmf_get_ndp_cache_stats')
+
+
+def nvmf_set_ndp_timeout(client, op, timeout_ms):
+    """Set the timeout of the commands of an NDP operator.
+
+    Args:
+        op: Name of the NDP operator, e.g. grep or heaan_mul
+        timeout_ms: Timeout in milliseconds, 0 for none
+
+    Returns:
+        True or False
+    """
+    params = {'op': op, 'timeout_ms': timeout_ms}
+    return client.call('nvmf_set_ndp_timeout', params)
+
+
+def nvmf_get_ndp_timeouts(client):
+    """Query the timeouts of the NDP operators.
+
+    Returns:
+        List of NDP operators with their opcode and timeout.
+    """
+    return client.call('nvmf_get_ndp_timeouts')
+
+
+def nvmf_get_ndp_he_status(client):
+    """Query the state of the HEaaN context.
+
+    Returns:
+        HEaaN context state and parameters.
+    """
+    return client.call('nvmf_get_ndp_he_status')
+
+
+def nvmf_get_ndp_he_pool_stats(client):
+    """Query HEaaN buffer pool statistics.
+
+    Returns:
+        Current HEaaN buffer pool and ciphertext object statistics.
+    """
+    return client.call('nvmf_get_ndp_he_pool_stats')
+
+
 def nvmf_set_crdt(client, crdt1=None, crdt2=None, crdt3=None):
     """Set the 3 crdt (Command Retry Delay Time) values
 
@@ -2537,7 +2537,15 @@ Format: 'user:u1 secret:s1 muser:mu1 msecret:ms1,user:u2 secret:s2 muser:mu2 mse
                                  poll_groups_mask=args.poll_groups_mask,
                                  discovery_filter=args.discovery_filter,
                                  dhchap_digests=args.dhchap_digests,
-                                 dhchap_dhgroups=args.dhchap_dhgroups)
+                                 dhchap_dhgroups=args.dhchap_dhgroups,
+                                 ndp_offload_mask=args.ndp_offload_mask,
+                                 ndp_offload_threads=args.ndp_offload_threads,
+                                 ndp_cache_size=args.ndp_cache_size,
+                                 ndp_he_params=args.ndp_he_params,
+                                 ndp_he_key_file=args.ndp_he_key_file,
+                                 ndp_he_log_n=args.ndp_he_log_n,
+                                 ndp_he_num_bufs=args.ndp_he_num_bufs,
+                                 ndp_he_eval_threads=args.ndp_he_eval_threads)
 
     p = subparsers.add_parser('nvmf_set_config', help='Set NVMf target config')
     p.add_argument('-i', '--passthru-identify-ctrlr', help="""Passthrough fields like serial number and model number
@@ -2549,6 +2557,21 @@ Format: 'user:u1 secret:s1 muser:mu1 msecret:ms1,user:u2 secret:s2 muser:mu2 mse
                    type=lambda d: d.split(','))
     p.add_argument('--dhchap-dhgroups', help='Comma-separated list of allowed DH-HMAC-CHAP DH groups',
                    type=lambda d: d.split(','))
+    p.add_argument('--ndp-offload-mask', help='Set cpumask for the NDP offload threads (optional)', type=str)
+    p.add_argument('--ndp-offload-threads', help="""Number of NDP offload threads (optional), default one per
+    core of --ndp-offload-mask""", type=int)
+    p.add_argument('--ndp-cache-size', help='Size of the NDP result cache in bytes, 0 to disable it (optional)',
+                   type=int)
+    p.add_argument('--ndp-he-params', help="""HEaaN context parameters log_q,log_p,log_slots,log_t,log_key_q
+    (optional), default 300,30,10,8,1024""", type=lambda p: [int(v) for v in p.split(',')])
+    p.add_argument('--ndp-he-key-file', help="""File the HEaaN keys are saved to once generated and loaded
+    from on the next start (optional)""", type=str)
+    p.add_argument('--ndp-he-log-n', help="""Log2 of the ring dimension the pooled HEaaN buffers are sized for
+    (optional), default 16""", type=int)
+    p.add_argument('--ndp-he-num-bufs', help='Number of pooled HEaaN buffers, 0 to disable the pool (optional)',
+                   type=int)
+    p.add_argument('--ndp-he-eval-threads', help="""Offload threads a multiplication of RNS packed HEaaN
+    ciphertexts is split over (optional), default 0 for all of them""", type=int)
     p.set_defaults(func=nvmf_set_config)
 
     def nvmf_create_transport(args):
@@ -2890,6 +2913,43 @@ Format: 'user:u1 secret:s1 muser:mu1 msecret:ms1,user:u2 secret:s2 muser:mu2 mse
     p.add_argument('-t', '--tgt-name', help='The name of the parent NVMe-oF target (optional)', type=str)
     p.set_defaults(func=nvmf_get_stats)
 
+    def nvmf_get_ndp_cache_stats(args):
+        print_dict(rpc.nvmf.nvmf_get_ndp_cache_stats(args.client))
+
+    p = subparsers.add_parser(
+        'nvmf_get_ndp_cache_stats', help='Display NDP result cache statistics')
+    p.set_defaults(func=nvmf_get_ndp_cache_stats)
+
+    def nvmf_set_ndp_timeout(args):
+        print_dict(rpc.nvmf.nvmf_set_ndp_timeout(args.client, op=args.op, timeout_ms=args.timeout_ms))
+
+    p = subparsers.add_parser(
+        'nvmf_set_ndp_timeout', help='Set the timeout of the commands of an NDP operator')
+    p.add_argument('op', help='Name of the NDP operator, e.g. grep or heaan_mul')
+    p.add_argument('timeout_ms', help='Timeout in milliseconds, 0 for none', type=int)
+    p.set_defaults(func=nvmf_set_ndp_timeout)
+
+    def nvmf_get_ndp_timeouts(args):
+        print_dict(rpc.nvmf.nvmf_get_ndp_timeouts(args.client))
+
+    p = subparsers.add_parser(
+        'nvmf_get_ndp_timeouts', help='Display the timeouts of the NDP operators')
+    p.set_defaults(func=nvmf_get_ndp_timeouts)
+
+    def nvmf_get_ndp_he_status(args):
+        print_dict(rpc.nvmf.nvmf_get_ndp_he_status(args.client))
+
+    p = subparsers.add_parser(
+        'nvmf_get_ndp_he_status', help='Display the state of the HEaaN context')
+    p.set_defaults(func=nvmf_get_ndp_he_status)
+
+    def nvmf_get_ndp_he_pool_stats(args):
+        print_dict(rpc.nvmf.nvmf_get_ndp_he_pool_stats(args.client))
+
+    p = subparsers.add_parser(
+        'nvmf_get_ndp_he_pool_stats', help='Display HEaaN buffer pool statistics')
+    p.set_defaults(func=nvmf_get_ndp_he_pool_stats)
+
     def nvmf_set_crdt(args):
         print_dict(rpc.nvmf.nvmf_set_crdt(args.client, args.crdt1, args.crdt2, args.crdt3))
 
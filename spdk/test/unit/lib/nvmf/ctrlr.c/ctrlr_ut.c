@@ -122,25 +122,18 @@ DEFINE_STUB(nvmf_bdev_ctrlr_write_cmd,
 	     struct spdk_nvmf_request *req),
 	    0);
 
-DEFINE_STUB(nvmf_bdev_ctrlr_custom_echo_cmd,
-	    int,
-	    (struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
-	     struct spdk_nvmf_request *req),
-	    0);
+DEFINE_STUB(spdk_nvmf_ndp_get_op, const struct spdk_nvmf_ndp_op *, (uint8_t opc), NULL);
 
-DEFINE_STUB(nvmf_bdev_ctrlr_custom_grep_cmd,
+DEFINE_STUB(nvmf_ndp_exec,
 	    int,
-	    (struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
-	     struct spdk_nvmf_request *req),
+	    (const struct spdk_nvmf_ndp_op *op, struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+	     struct spdk_io_channel *ch, struct spdk_nvmf_request *req),
 	    0);
 
-#ifdef HEAAN_LIB
-DEFINE_STUB(nvmf_bdev_ctrlr_custom_heaan_cipadd_cmd,
-	    int,
-	    (struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
-	     struct spdk_nvmf_request *req),
-	    0);
-#endif
+DEFINE_STUB_V(nvmf_ndp_fill_cmds_and_effects,
+	      (struct spdk_nvme_cmds_and_effect_log_page *log_page));
+DEFINE_STUB_V(nvmf_ndp_cache_invalidate_io, (struct spdk_nvmf_request *req));
+DEFINE_STUB(nvmf_ndp_abort_request, bool, (struct spdk_nvmf_request *req), false);
 
 DEFINE_STUB(nvmf_bdev_ctrlr_compare_cmd,
 	    int,
@@ -3384,6 +3377,24 @@ test_nvmf_check_qpair_active(void)
 	}
 }
 
+static void
+test_nvmf_ctrlr_abort_ndp(void)
+{
+	struct spdk_nvmf_qpair qpair = { .qid = 1 };
+	struct spdk_nvmf_request req = {}, req_to_abort = { .qpair = &qpair };
+	union nvmf_c2h_msg rsp = {};
+
+	req.rsp = &rsp;
+	req.req_to_abort = &req_to_abort;
+
+	/* An NDP command may still succeed, the Abort doesn't report it aborted */
+	rsp.nvme_cpl.cdw0 = 1U;
+	MOCK_SET(nvmf_ndp_abort_request, true);
+	CU_ASSERT(nvmf_ctrlr_abort_request(&req) == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(rsp.nvme_cpl.cdw0 & 1U);
+	MOCK_CLEAR(nvmf_ndp_abort_request);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -3425,6 +3436,7 @@ main(int argc, char **argv)
 	CU_ADD_TEST(suite, test_nvmf_ctrlr_set_features_host_behavior_support);
 	CU_ADD_TEST(suite, test_nvmf_ctrlr_ns_attachment);
 	CU_ADD_TEST(suite, test_nvmf_check_qpair_active);
+	CU_ADD_TEST(suite, test_nvmf_ctrlr_abort_ndp);
 
 	allocate_threads(1);
 	set_thread(0);
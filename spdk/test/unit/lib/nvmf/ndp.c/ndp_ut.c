@@ -0,0 +1,276 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "common/lib/test_env.c"
+#include "nvmf/ndp.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+static int g_exec_called;
+
+static int
+ut_ndp_exec(struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+	    struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	g_exec_called++;
+	return SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS;
+}
+
+static struct spdk_nvmf_ndp_op g_ut_read_op = {
+	.name = "ut_read",
+	.opc = 0xd4,
+	.xfer = SPDK_NVME_DATA_CONTROLLER_TO_HOST,
+	.exec = ut_ndp_exec,
+};
+
+static struct spdk_nvmf_ndp_op g_ut_write_op = {
+	.name = "ut_write",
+	.opc = 0xd5,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.flags = SPDK_NVMF_NDP_OP_F_WRITES_MEDIA,
+	.exec = ut_ndp_exec,
+};
+
+static void
+test_ndp_register_op(void)
+{
+	struct spdk_nvmf_ndp_op dup = g_ut_read_op;
+	struct spdk_nvmf_ndp_op bad = g_ut_read_op;
+	int rc;
+
+	rc = spdk_nvmf_ndp_register_op(&g_ut_read_op);
+	CU_ASSERT(rc == 0);
+	rc = spdk_nvmf_ndp_register_op(&g_ut_write_op);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(spdk_nvmf_ndp_get_op(0xd4) == &g_ut_read_op);
+	CU_ASSERT(spdk_nvmf_ndp_get_op(0xd5) == &g_ut_write_op);
+	CU_ASSERT(spdk_nvmf_ndp_get_op(0xd6) == NULL);
+
+	/* The opcode is already taken */
+	dup.name = "ut_dup";
+	rc = spdk_nvmf_ndp_register_op(&dup);
+	CU_ASSERT(rc == -EEXIST);
+	CU_ASSERT(spdk_nvmf_ndp_get_op(0xd4) == &g_ut_read_op);
+
+	/* Standard NVM opcodes cannot be overridden */
+	bad.opc = SPDK_NVME_OPC_READ;
+	rc = spdk_nvmf_ndp_register_op(&bad);
+	CU_ASSERT(rc == -EINVAL);
+	CU_ASSERT(spdk_nvmf_ndp_get_op(SPDK_NVME_OPC_READ) == NULL);
+
+	bad.opc = 0xd8;
+	bad.xfer = SPDK_NVME_DATA_BIDIRECTIONAL;
+	rc = spdk_nvmf_ndp_register_op(&bad);
+	CU_ASSERT(rc == -EINVAL);
+
+	bad.xfer = SPDK_NVME_DATA_NONE;
+	bad.exec = NULL;
+	rc = spdk_nvmf_ndp_register_op(&bad);
+	CU_ASSERT(rc == -EINVAL);
+	CU_ASSERT(spdk_nvmf_ndp_get_op(0xd8) == NULL);
+}
+
+static void
+test_ndp_get_xfer(void)
+{
+	enum spdk_nvme_data_transfer xfer = SPDK_NVME_DATA_NONE;
+
+	CU_ASSERT(spdk_nvmf_ndp_get_xfer(0xd4, &xfer));
+	CU_ASSERT(xfer == SPDK_NVME_DATA_CONTROLLER_TO_HOST);
+	CU_ASSERT(spdk_nvmf_ndp_get_xfer(0xd5, &xfer));
+	CU_ASSERT(xfer == SPDK_NVME_DATA_HOST_TO_CONTROLLER);
+
+	xfer = SPDK_NVME_DATA_NONE;
+	CU_ASSERT(!spdk_nvmf_ndp_get_xfer(0xd6, &xfer));
+	CU_ASSERT(xfer == SPDK_NVME_DATA_NONE);
+}
+
+static void
+test_ndp_cmds_and_effects(void)
+{
+	struct spdk_nvme_cmds_and_effect_log_page log_page = {};
+
+	nvmf_ndp_fill_cmds_and_effects(&log_page);
+
+	CU_ASSERT(log_page.io_cmds_supported[0xd4].csupp == 1);
+	CU_ASSERT(log_page.io_cmds_supported[0xd4].lbcc == 0);
+	CU_ASSERT(log_page.io_cmds_supported[0xd5].csupp == 1);
+	CU_ASSERT(log_page.io_cmds_supported[0xd5].lbcc == 1);
+	CU_ASSERT(log_page.io_cmds_supported[0xd6].csupp == 0);
+	CU_ASSERT(log_page.io_cmds_supported[SPDK_NVME_OPC_READ].csupp == 0);
+}
+
+static void
+test_ndp_exec(void)
+{
+	struct spdk_nvme_cpl cpl = {};
+	union nvmf_h2c_msg cmd = {};
+	union nvmf_c2h_msg rsp = {};
+	struct spdk_nvmf_request req = {};
+	int rc;
+
+	req.cmd = &cmd;
+	req.rsp = &rsp;
+	cmd.nvme_cmd.opc = 0xd4;
+
+	g_exec_called = 0;
+	rc = nvmf_ndp_exec(spdk_nvmf_ndp_get_op(cmd.nvme_cmd.opc), NULL, NULL, NULL, &req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_exec_called == 1);
+	CU_ASSERT(memcmp(&rsp.nvme_cpl, &cpl, sizeof(cpl)) == 0);
+}
+
+static void
+test_ndp_timeout(void)
+{
+	CU_ASSERT(spdk_nvmf_ndp_get_timeout(0xd4) == 0);
+	CU_ASSERT(spdk_nvmf_ndp_set_timeout(0xd4, 1500) == 0);
+	CU_ASSERT(spdk_nvmf_ndp_get_timeout(0xd4) == 1500);
+	CU_ASSERT(spdk_nvmf_ndp_get_timeout(0xd5) == 0);
+
+	/* Only registered operators have a timeout */
+	CU_ASSERT(spdk_nvmf_ndp_set_timeout(0xd6, 1500) == -ENOENT);
+	CU_ASSERT(spdk_nvmf_ndp_get_timeout(0xd6) == 0);
+
+	CU_ASSERT(spdk_nvmf_ndp_set_timeout(0xd4, 0) == 0);
+	CU_ASSERT(spdk_nvmf_ndp_get_timeout(0xd4) == 0);
+}
+
+struct ut_cmd {
+	union nvmf_h2c_msg		cmd;
+	union nvmf_c2h_msg		rsp;
+	struct spdk_nvmf_request	req;
+	struct nvmf_ndp_job		job;
+};
+
+static void
+ut_cmd_init(struct ut_cmd *c, struct spdk_nvmf_qpair *qpair, uint8_t opc, uint16_t cid)
+{
+	memset(c, 0, sizeof(*c));
+	c->req.cmd = &c->cmd;
+	c->req.rsp = &c->rsp;
+	c->req.qpair = qpair;
+	c->cmd.nvme_cmd.opc = opc;
+	c->cmd.nvme_cmd.cid = cid;
+}
+
+static void
+test_ndp_job(void)
+{
+	struct spdk_nvmf_subsystem subsystem = { .id = 1 };
+	struct spdk_nvmf_ctrlr ctrlr = { .subsys = &subsystem };
+	struct spdk_nvmf_subsystem_poll_group sgroups[2] = {};
+	struct spdk_nvmf_poll_group group = { .sgroups = sgroups, .num_sgroups = 2 };
+	struct spdk_nvmf_qpair qpair = { .group = &group, .ctrlr = &ctrlr, .qid = 1 };
+	struct spdk_nvmf_qpair other = { .group = &group, .ctrlr = &ctrlr, .qid = 2 };
+	struct ut_cmd a, b, c;
+
+	TAILQ_INIT(&sgroups[1].ndp_jobs);
+	ut_cmd_init(&a, &qpair, 0xd4, 1);
+	ut_cmd_init(&b, &qpair, 0xd5, 2);
+
+	/* 0xd4 times out after 10 ms, 0xd5 never does */
+	CU_ASSERT(spdk_nvmf_ndp_set_timeout(0xd4, 10) == 0);
+	nvmf_ndp_job_begin(&a.job, &a.req);
+	nvmf_ndp_job_begin(&b.job, &b.req);
+	CU_ASSERT(a.job.deadline_tsc == spdk_get_ticks() + 10000);
+	CU_ASSERT(b.job.deadline_tsc == 0);
+	CU_ASSERT(TAILQ_FIRST(&sgroups[1].ndp_jobs) == &a.job);
+
+	spdk_delay_us(9999);
+	CU_ASSERT(nvmf_ndp_job_check(&a.job) == 0);
+	spdk_delay_us(1);
+	CU_ASSERT(nvmf_ndp_job_check(&a.job) == -ETIMEDOUT);
+	CU_ASSERT(nvmf_ndp_job_check(&b.job) == 0);
+
+	/* Aborting keeps the status of a job that timed out */
+	CU_ASSERT(nvmf_ndp_abort_request(&a.req));
+	CU_ASSERT(nvmf_ndp_job_check(&a.job) == -ETIMEDOUT);
+	CU_ASSERT(nvmf_ndp_abort_request(&b.req));
+	CU_ASSERT(nvmf_ndp_job_check(&b.job) == -ECANCELED);
+
+	nvmf_ndp_job_end(&a.job);
+	CU_ASSERT(TAILQ_FIRST(&sgroups[1].ndp_jobs) == &b.job);
+	CU_ASSERT(!nvmf_ndp_abort_request(&a.req));
+	nvmf_ndp_job_end(&b.job);
+	CU_ASSERT(TAILQ_EMPTY(&sgroups[1].ndp_jobs));
+
+	/* Disconnecting the queue pair stops all of its jobs, and only those */
+	ut_cmd_init(&a, &qpair, 0xd4, 1);
+	ut_cmd_init(&b, &qpair, 0xd5, 2);
+	ut_cmd_init(&c, &other, 0xd5, 1);
+	nvmf_ndp_job_begin(&a.job, &a.req);
+	nvmf_ndp_job_begin(&c.job, &c.req);
+	nvmf_ndp_job_begin(&b.job, &b.req);
+	CU_ASSERT(nvmf_ndp_abort_request(&b.req));
+	nvmf_ndp_qpair_abort(&qpair);
+	CU_ASSERT(nvmf_ndp_job_check(&a.job) == -ENOTCONN);
+	CU_ASSERT(nvmf_ndp_job_check(&b.job) == -ECANCELED);
+	CU_ASSERT(nvmf_ndp_job_check(&c.job) == 0);
+	nvmf_ndp_job_end(&b.job);
+	nvmf_ndp_job_end(&a.job);
+	nvmf_ndp_job_end(&c.job);
+	CU_ASSERT(TAILQ_EMPTY(&sgroups[1].ndp_jobs));
+
+	/* Nor does a queue pair not associated with a controller */
+	other.ctrlr = NULL;
+	nvmf_ndp_qpair_abort(&other);
+	CU_ASSERT(!nvmf_ndp_abort_request(&c.req));
+
+	CU_ASSERT(spdk_nvmf_ndp_set_timeout(0xd4, 0) == 0);
+}
+
+static void
+test_ndp_set_status(void)
+{
+	struct spdk_nvmf_qpair qpair = {};
+	struct spdk_nvme_status *status;
+	struct ut_cmd c;
+
+	ut_cmd_init(&c, &qpair, 0xd4, 1);
+	status = &c.rsp.nvme_cpl.status;
+
+	nvmf_ndp_set_status(&c.req, -ECANCELED);
+	CU_ASSERT(status->sct == SPDK_NVME_SCT_GENERIC);
+	CU_ASSERT(status->sc == SPDK_NVME_SC_ABORTED_BY_REQUEST);
+	CU_ASSERT(status->dnr == 0);
+
+	ut_cmd_init(&c, &qpair, 0xd4, 1);
+	nvmf_ndp_set_status(&c.req, -ETIMEDOUT);
+	CU_ASSERT(status->sc == SPDK_NVME_SC_ABORTED_BY_REQUEST);
+	CU_ASSERT(status->dnr == 1);
+
+	ut_cmd_init(&c, &qpair, 0xd4, 1);
+	nvmf_ndp_set_status(&c.req, -ENOTCONN);
+	CU_ASSERT(status->sc == SPDK_NVME_SC_ABORTED_SQ_DELETION);
+	CU_ASSERT(status->dnr == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_ndp_register_op);
+	CU_ADD_TEST(suite, test_ndp_get_xfer);
+	CU_ADD_TEST(suite, test_ndp_cmds_and_effects);
+	CU_ADD_TEST(suite, test_ndp_exec);
+	CU_ADD_TEST(suite, test_ndp_timeout);
+	CU_ADD_TEST(suite, test_ndp_job);
+	CU_ADD_TEST(suite, test_ndp_set_status);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,325 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_filter.c"
+#include "nvmf/ndp_agg.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_ARGS_SIZE	1024
+
+struct ut_args {
+	char		buf[UT_ARGS_SIZE];
+	size_t		len;
+};
+
+static const char *g_csv =
+	"GET,200,512,0.25\n"
+	"POST,401,64,1.5\n"
+	"GET,200,20480,0.75\n"
+	"PUT,500,-3,12.125\n"
+	"GET,404,n/a\n"
+	"GET\n"
+	"\n"
+	"DELETE,204,0,-0.5";
+
+/* Aggregate column over the records matching $0 == method, all if method is NULL */
+static void
+ut_args_init(struct ut_args *args, uint8_t type, uint8_t flags, uint8_t bucket_shift,
+	     uint16_t column, const char *method)
+{
+	struct nvmf_ndp_agg_hdr *agg = (struct nvmf_ndp_agg_hdr *)args->buf;
+	struct nvmf_ndp_filter_hdr *hdr;
+	struct nvmf_ndp_filter_insn insn = {
+		.op = NVMF_NDP_FILTER_OP_EQ,
+		.type = NVMF_NDP_FILTER_TYPE_STRING,
+	};
+
+	memset(args, 0, sizeof(*args));
+	to_le32(&agg->magic, NVMF_NDP_AGG_MAGIC);
+	agg->type = type;
+	agg->flags = flags;
+	agg->bucket_shift = bucket_shift;
+
+	hdr = (struct nvmf_ndp_filter_hdr *)(args->buf + sizeof(*agg));
+	to_le32(&hdr->magic, NVMF_NDP_FILTER_MAGIC);
+	hdr->delimiter = ',';
+	to_le16(&hdr->num_columns, 1);
+	to_le16(args->buf + sizeof(*agg) + sizeof(*hdr), column);
+	args->len = sizeof(*agg) + sizeof(*hdr) + 8;
+
+	if (method != NULL) {
+		to_le32(&insn.len, strlen(method));
+		memcpy(args->buf + args->len, &insn, sizeof(insn));
+		memcpy(args->buf + args->len + sizeof(insn), method, strlen(method));
+		args->len += sizeof(insn) + SPDK_ALIGN_CEIL(strlen(method), 8);
+		to_le16(&hdr->num_insns, 1);
+	}
+}
+
+/* Feed text record by record, each a separate part of the input, or all at once */
+static void
+ut_scan(struct nvmf_ndp_agg *agg, const char *text, bool per_record)
+{
+	struct iovec iov;
+	const char *nl;
+
+	if (!per_record) {
+		iov.iov_base = (char *)text;
+		iov.iov_len = strlen(text);
+		nvmf_ndp_agg_scan(agg, &iov, 1);
+		return;
+	}
+
+	while (*text != '\0') {
+		nl = strchr(text, '\n');
+		iov.iov_base = (char *)text;
+		iov.iov_len = nl != NULL ? (size_t)(nl - text) + 1 : strlen(text);
+		nvmf_ndp_agg_scan(agg, &iov, 1);
+		text += iov.iov_len;
+	}
+}
+
+static struct nvmf_ndp_agg *
+ut_agg(const struct ut_args *args, const char *text, bool per_record,
+       struct nvmf_ndp_agg_result *result)
+{
+	struct nvmf_ndp_agg *agg;
+	struct iovec iov = {
+		.iov_base = result,
+		.iov_len = sizeof(*result),
+	};
+
+	agg = nvmf_ndp_agg_create(args->buf, args->len);
+	SPDK_CU_ASSERT_FATAL(agg != NULL);
+	ut_scan(agg, text, per_record);
+
+	/* Truncated to the fixed part */
+	CU_ASSERT(nvmf_ndp_agg_get_result(agg, &iov, 1) == sizeof(*result));
+
+	return agg;
+}
+
+static double
+ut_double(const uint64_t *le)
+{
+	uint64_t bits = from_le64(le);
+	double val;
+
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+static void
+test_agg_create(void)
+{
+	struct nvmf_ndp_agg *agg;
+	struct ut_args args;
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 2, "GET");
+	agg = nvmf_ndp_agg_create(args.buf, args.len);
+	SPDK_CU_ASSERT_FATAL(agg != NULL);
+	CU_ASSERT(agg->histogram == NULL);
+	CU_ASSERT(nvmf_ndp_agg_result_size(agg) == sizeof(struct nvmf_ndp_agg_result));
+	nvmf_ndp_agg_free(agg);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_FLOAT, NVMF_NDP_AGG_FLAG_HISTOGRAM, 2, 3, NULL);
+	agg = nvmf_ndp_agg_create(args.buf, args.len);
+	SPDK_CU_ASSERT_FATAL(agg != NULL);
+	CU_ASSERT(agg->histogram != NULL);
+	CU_ASSERT(nvmf_ndp_agg_result_size(agg) == sizeof(struct nvmf_ndp_agg_result) +
+		  4 * 63 * sizeof(uint64_t));
+	nvmf_ndp_agg_free(agg);
+
+	/* Truncated, bad magic, type, flags and bucket shift */
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, sizeof(struct nvmf_ndp_agg_hdr) - 1) == NULL);
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, sizeof(struct nvmf_ndp_agg_hdr)) == NULL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 2, NULL);
+	args.buf[0] ^= 0xff;
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, args.len) == NULL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_STRING, 0, 0, 2, NULL);
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, args.len) == NULL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, NVMF_NDP_AGG_FLAG_OVERFLOW, 0, 2, NULL);
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, args.len) == NULL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, NVMF_NDP_AGG_FLAG_HISTOGRAM,
+		     NVMF_NDP_AGG_MAX_BUCKET_SHIFT + 1, 2, NULL);
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, args.len) == NULL);
+
+	/* Exactly one column must be selected */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 2, NULL);
+	args.buf[sizeof(struct nvmf_ndp_agg_hdr) + 6] = 0;
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, args.len) == NULL);
+	args.buf[sizeof(struct nvmf_ndp_agg_hdr) + 6] = 2;
+	CU_ASSERT(nvmf_ndp_agg_create(args.buf, args.len) == NULL);
+}
+
+static void
+test_agg_int(void)
+{
+	struct nvmf_ndp_agg_result result;
+	struct ut_args args;
+	bool per_record;
+
+	for (per_record = false; ; per_record = true) {
+		/* Sizes of every request, "n/a" and the missing ones are not numbers */
+		ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 2, NULL);
+		nvmf_ndp_agg_free(ut_agg(&args, g_csv, per_record, &result));
+		CU_ASSERT(from_le64(&result.records) == 8);
+		CU_ASSERT(from_le64(&result.count) == 5);
+		CU_ASSERT((int64_t)from_le64(&result.sum) == 512 + 64 + 20480 - 3);
+		CU_ASSERT((int64_t)from_le64(&result.min) == -3);
+		CU_ASSERT((int64_t)from_le64(&result.max) == 20480);
+		CU_ASSERT(result.type == NVMF_NDP_FILTER_TYPE_INT);
+		CU_ASSERT(result.flags == 0);
+
+		/* Of the GET requests only */
+		ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 2, "GET");
+		nvmf_ndp_agg_free(ut_agg(&args, g_csv, per_record, &result));
+		CU_ASSERT(from_le64(&result.records) == 4);
+		CU_ASSERT(from_le64(&result.count) == 2);
+		CU_ASSERT(from_le64(&result.sum) == 512 + 20480);
+		CU_ASSERT(from_le64(&result.min) == 512);
+		CU_ASSERT(from_le64(&result.max) == 20480);
+
+		/* Floats don't count as integers */
+		ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 3, NULL);
+		nvmf_ndp_agg_free(ut_agg(&args, g_csv, per_record, &result));
+		CU_ASSERT(from_le64(&result.count) == 0);
+		CU_ASSERT(from_le64(&result.sum) == 0);
+		CU_ASSERT(from_le64(&result.min) == 0);
+		CU_ASSERT(from_le64(&result.max) == 0);
+
+		if (per_record) {
+			break;
+		}
+	}
+
+	/* Overflow is reported, whether it happens within a part or when merging */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 0, NULL);
+	nvmf_ndp_agg_free(ut_agg(&args, "9223372036854775807\n1\n", false, &result));
+	CU_ASSERT(result.flags == NVMF_NDP_AGG_FLAG_OVERFLOW);
+	nvmf_ndp_agg_free(ut_agg(&args, "9223372036854775807\n1\n", true, &result));
+	CU_ASSERT(result.flags == NVMF_NDP_AGG_FLAG_OVERFLOW);
+	nvmf_ndp_agg_free(ut_agg(&args, "9223372036854775807\n-1\n1\n", false, &result));
+	CU_ASSERT(result.flags == 0);
+	CU_ASSERT(from_le64(&result.sum) == INT64_MAX);
+}
+
+static void
+test_agg_float(void)
+{
+	struct nvmf_ndp_agg_result result;
+	struct ut_args args;
+
+	/* Integers are numbers too */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_FLOAT, 0, 0, 3, NULL);
+	nvmf_ndp_agg_free(ut_agg(&args, g_csv, true, &result));
+	CU_ASSERT(from_le64(&result.records) == 8);
+	CU_ASSERT(from_le64(&result.count) == 5);
+	CU_ASSERT(ut_double(&result.sum) == 0.25 + 1.5 + 0.75 + 12.125 - 0.5);
+	CU_ASSERT(ut_double(&result.min) == -0.5);
+	CU_ASSERT(ut_double(&result.max) == 12.125);
+	CU_ASSERT(result.type == NVMF_NDP_FILTER_TYPE_FLOAT);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_FLOAT, 0, 0, 2, "GET");
+	nvmf_ndp_agg_free(ut_agg(&args, g_csv, false, &result));
+	CU_ASSERT(from_le64(&result.count) == 2);
+	CU_ASSERT(ut_double(&result.sum) == 20992.0);
+}
+
+static void
+test_agg_histogram(void)
+{
+	struct nvmf_ndp_agg_result *result;
+	struct spdk_histogram_data h = {};
+	struct nvmf_ndp_agg *agg;
+	struct ut_args args;
+	struct iovec iov[3];
+	uint64_t *buckets, range;
+	size_t size;
+	char *buf;
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, NVMF_NDP_AGG_FLAG_HISTOGRAM, 1, 2, NULL);
+	agg = nvmf_ndp_agg_create(args.buf, args.len);
+	SPDK_CU_ASSERT_FATAL(agg != NULL);
+	ut_scan(agg, g_csv, true);
+	ut_scan(agg, ",,1\n,,1\n,,1\n,,2\n,,3\n", false);
+
+	size = nvmf_ndp_agg_result_size(agg);
+	CU_ASSERT(size == sizeof(*result) + 2 * 64 * sizeof(uint64_t));
+	buf = calloc(1, size);
+	SPDK_CU_ASSERT_FATAL(buf != NULL);
+
+	/* Across iovecs */
+	iov[0].iov_base = buf;
+	iov[0].iov_len = 10;
+	iov[1].iov_base = buf + 10;
+	iov[1].iov_len = 100;
+	iov[2].iov_base = buf + 110;
+	iov[2].iov_len = size - 110;
+	CU_ASSERT(nvmf_ndp_agg_get_result(agg, iov, 3) == size);
+
+	result = (struct nvmf_ndp_agg_result *)buf;
+	buckets = (uint64_t *)(buf + sizeof(*result));
+	CU_ASSERT(result->flags == NVMF_NDP_AGG_FLAG_HISTOGRAM);
+	CU_ASSERT(result->bucket_shift == 1);
+	CU_ASSERT(from_le32(&result->num_buckets) == 128);
+	CU_ASSERT(from_le64(&result->count) == 10);
+	CU_ASSERT(from_le64(&result->negative) == 1);
+
+	/* The buckets are those of a spdk_histogram_data with the same shift */
+	h.bucket_shift = 1;
+	range = __spdk_histogram_data_get_bucket_range(&h, 1);
+	CU_ASSERT(from_le64(&buckets[(range << 1) +
+					 __spdk_histogram_data_get_bucket_index(&h, 1, range)]) == 3);
+	range = __spdk_histogram_data_get_bucket_range(&h, 0);
+	CU_ASSERT(from_le64(&buckets[(range << 1) +
+					 __spdk_histogram_data_get_bucket_index(&h, 0, range)]) == 1);
+	range = __spdk_histogram_data_get_bucket_range(&h, 20480);
+	CU_ASSERT(from_le64(&buckets[(range << 1) +
+					 __spdk_histogram_data_get_bucket_index(&h, 20480, range)]) == 1);
+
+	free(buf);
+	nvmf_ndp_agg_free(agg);
+
+	/* Floats are truncated, huge ones land in the last bucket */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_FLOAT, NVMF_NDP_AGG_FLAG_HISTOGRAM, 0, 0, NULL);
+	agg = nvmf_ndp_agg_create(args.buf, args.len);
+	SPDK_CU_ASSERT_FATAL(agg != NULL);
+	ut_scan(agg, "0.5\n1.99\n-0.25\n1e30\n", false);
+	CU_ASSERT(agg->histogram->bucket[0] == 1);
+	CU_ASSERT(agg->histogram->bucket[1] == 1);
+	CU_ASSERT(agg->histogram->bucket[64] == 1);
+	CU_ASSERT(agg->total.negative == 1);
+	nvmf_ndp_agg_free(agg);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_agg", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_agg_create);
+	CU_ADD_TEST(suite, test_agg_int);
+	CU_ADD_TEST(suite, test_agg_float);
+	CU_ADD_TEST(suite, test_agg_histogram);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,710 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_desc.c"
+#include "nvmf/ndp_batch.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_BLOCK_SIZE	512
+
+DEFINE_STUB(spdk_bdev_get_block_size, uint32_t, (const struct spdk_bdev *bdev), UT_BLOCK_SIZE);
+DEFINE_STUB(spdk_bdev_get_num_blocks, uint64_t, (const struct spdk_bdev *bdev), 1ULL << 20);
+
+DEFINE_STUB(nvmf_ndp_filter_create, struct nvmf_ndp_filter *, (const void *prog, size_t len),
+	    NULL);
+DEFINE_STUB_V(nvmf_ndp_filter_free, (struct nvmf_ndp_filter *filter));
+DEFINE_STUB(nvmf_ndp_filter_scan, int, (struct nvmf_ndp_filter *filter, struct iovec *iov,
+					int iovcnt, nvmf_ndp_filter_match_fn match_fn, void *cb_arg), 0);
+DEFINE_STUB(nvmf_ndp_regex_create, struct nvmf_ndp_regex *, (const void *prog, size_t len),
+	    NULL);
+DEFINE_STUB_V(nvmf_ndp_regex_free, (struct nvmf_ndp_regex *regex));
+DEFINE_STUB(nvmf_ndp_regex_scan, int, (struct nvmf_ndp_regex *regex, struct iovec *iov,
+				       int iovcnt, nvmf_ndp_regex_match_fn match_fn, void *cb_arg), 0);
+DEFINE_STUB(nvmf_ndp_topk_create, int, (const void *args, size_t len, bool sample,
+		uint32_t result_size, struct nvmf_ndp_topk **_topk), -EINVAL);
+DEFINE_STUB_V(nvmf_ndp_topk_free, (struct nvmf_ndp_topk *topk));
+DEFINE_STUB_V(nvmf_ndp_topk_scan, (struct nvmf_ndp_topk *topk, struct iovec *iov, int iovcnt));
+DEFINE_STUB(nvmf_ndp_topk_get_result, size_t, (struct nvmf_ndp_topk *topk, struct iovec *iov,
+		int iovcnt), 0);
+DEFINE_STUB(nvmf_ndp_topk_truncated, bool, (const struct nvmf_ndp_topk *topk), false);
+DEFINE_STUB_V(nvmf_ndp_cursor_skip_cache, (struct nvmf_ndp_cursor *cursor));
+
+/* iobuf pool, NULL to allocate the slot buffers */
+static struct spdk_iobuf_channel *g_iobuf;
+static uint32_t g_iobuf_large_bufsize = 132 * 1024;
+static int g_iobuf_avail;
+static int g_iobuf_count;
+static struct spdk_iobuf_entry *g_iobuf_entry;
+static spdk_iobuf_get_cb g_iobuf_cb;
+
+struct spdk_iobuf_channel *
+nvmf_ndp_req_get_iobuf(struct spdk_nvmf_request *req)
+{
+	return g_iobuf;
+}
+
+void
+spdk_iobuf_get_opts(struct spdk_iobuf_opts *opts, size_t opts_size)
+{
+	opts->large_bufsize = g_iobuf_large_bufsize;
+}
+
+/* Queued once g_iobuf_avail buffers were taken */
+void *
+spdk_iobuf_get(struct spdk_iobuf_channel *ch, uint64_t len, struct spdk_iobuf_entry *entry,
+	       spdk_iobuf_get_cb cb_fn)
+{
+	CU_ASSERT(ch == g_iobuf);
+	if (g_iobuf_avail == 0) {
+		CU_ASSERT(g_iobuf_entry == NULL);
+		g_iobuf_entry = entry;
+		g_iobuf_cb = cb_fn;
+		return NULL;
+	}
+	g_iobuf_avail--;
+	g_iobuf_count++;
+	return malloc(len);
+}
+
+void
+spdk_iobuf_put(struct spdk_iobuf_channel *ch, void *buf, uint64_t len)
+{
+	CU_ASSERT(ch == g_iobuf);
+	g_iobuf_count--;
+	free(buf);
+}
+
+static struct spdk_nvmf_ndp_op *g_batch_op;
+static int g_status;
+static int g_completions;
+
+/* Completion of the last part of the result */
+static struct nvmf_ndp_cursor *g_cursor;
+static uint32_t g_len;
+static bool g_more;
+static uint64_t g_offset;
+
+int
+spdk_nvmf_ndp_register_op(struct spdk_nvmf_ndp_op *op)
+{
+	g_batch_op = op;
+	return 0;
+}
+
+void
+nvmf_ndp_set_status(struct spdk_nvmf_request *req, int status)
+{
+	g_status = status;
+}
+
+struct nvmf_ndp_cursor *
+nvmf_ndp_cursor_create(struct spdk_nvmf_request *req, struct nvmf_ndp_desc *target,
+		       nvmf_ndp_cursor_run_fn run_fn)
+{
+	struct nvmf_ndp_cursor *cursor;
+
+	cursor = calloc(1, sizeof(*cursor));
+	SPDK_CU_ASSERT_FATAL(cursor != NULL);
+	cursor->run_fn = run_fn;
+	cursor->target = *target;
+	memset(target, 0, sizeof(*target));
+
+	return cursor;
+}
+
+void
+nvmf_ndp_cursor_free(struct nvmf_ndp_cursor *cursor)
+{
+	nvmf_ndp_desc_free(&cursor->target);
+	free(cursor);
+}
+
+void
+nvmf_ndp_result_init(struct spdk_nvmf_request *req, struct spdk_iov_xfer *ix)
+{
+	spdk_iov_memset(req->iov, req->iovcnt, 0);
+	spdk_iov_xfer_init(ix, req->iov, req->iovcnt);
+}
+
+/* The cursor is kept for the test to run the next part, as a fetch would */
+void
+nvmf_ndp_cursor_complete(struct nvmf_ndp_cursor *cursor, struct spdk_nvmf_request *req,
+			 int status, uint32_t len, bool more, uint64_t offset)
+{
+	g_completions++;
+	g_status = status;
+	g_len = len;
+	g_more = more;
+	g_offset = offset;
+	cursor->offset = offset;
+	g_cursor = cursor;
+}
+
+/* Job of the running batch, stopped by the test */
+static struct nvmf_ndp_job *g_job;
+static int g_job_status;
+
+void
+nvmf_ndp_job_begin(struct nvmf_ndp_job *job, struct spdk_nvmf_request *req)
+{
+	CU_ASSERT(g_job == NULL);
+	job->req = req;
+	g_job = job;
+}
+
+int
+nvmf_ndp_job_check(struct nvmf_ndp_job *job)
+{
+	CU_ASSERT(job == g_job);
+	return g_job_status;
+}
+
+void
+nvmf_ndp_job_end(struct nvmf_ndp_job *job)
+{
+	CU_ASSERT(job == g_job);
+	g_job = NULL;
+}
+
+/* Streams started, completed by the test */
+struct ut_stream {
+	struct nvmf_ndp_extent		extent;
+	struct nvmf_ndp_stream_opts	opts;
+	nvmf_ndp_stream_data_fn		data_fn;
+	nvmf_ndp_stream_done_fn		done_fn;
+	void				*cb_arg;
+};
+
+static struct ut_stream g_streams[16];
+static uint32_t g_num_streams;
+static int g_stream_rc;
+
+void
+nvmf_ndp_stream_opts_init(struct nvmf_ndp_stream_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->mode = NVMF_NDP_STREAM_MODE_RAW;
+}
+
+int
+nvmf_ndp_stream_start(struct spdk_nvmf_request *req, struct spdk_bdev_desc *desc,
+		      struct spdk_io_channel *ch, const struct nvmf_ndp_extent *extents,
+		      uint32_t num_extents, const struct nvmf_ndp_stream_opts *opts,
+		      nvmf_ndp_stream_data_fn data_fn, nvmf_ndp_stream_done_fn done_fn,
+		      void *cb_arg)
+{
+	struct ut_stream *stream;
+
+	if (g_stream_rc != 0) {
+		return g_stream_rc;
+	}
+
+	SPDK_CU_ASSERT_FATAL(g_num_streams < SPDK_COUNTOF(g_streams));
+	CU_ASSERT(num_extents == 1);
+	stream = &g_streams[g_num_streams++];
+	stream->extent = extents[0];
+	stream->opts = *opts;
+	stream->data_fn = data_fn;
+	stream->done_fn = done_fn;
+	stream->cb_arg = cb_arg;
+
+	return 0;
+}
+
+/* Feed data to the stream of the file starting at LBA lba and finish it */
+static void
+ut_stream_finish(uint64_t lba, const char *data, int status)
+{
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = data ? strlen(data) : 0 };
+	struct ut_stream stream;
+	uint32_t i;
+
+	for (i = 0; i < g_num_streams; i++) {
+		if (g_streams[i].extent.offset_blocks == lba) {
+			break;
+		}
+	}
+	SPDK_CU_ASSERT_FATAL(i < g_num_streams);
+	stream = g_streams[i];
+	memmove(&g_streams[i], &g_streams[i + 1], (g_num_streams - i - 1) * sizeof(stream));
+	g_num_streams--;
+
+	if (status == 0 && iov.iov_len > 0) {
+		stream.data_fn(stream.cb_arg, &iov, 1);
+	}
+	stream.done_fn(stream.cb_arg, status);
+}
+
+/* Grep engine: every chunk is a matching line */
+static int g_grep_count;
+
+struct nvmf_ndp_grep *
+nvmf_ndp_grep_create(const char *patterns, size_t len, uint32_t max_line_len)
+{
+	if (len == 0) {
+		return NULL;
+	}
+	g_grep_count++;
+	return (struct nvmf_ndp_grep *)0x1;
+}
+
+void
+nvmf_ndp_grep_free(struct nvmf_ndp_grep *grep)
+{
+	g_grep_count--;
+}
+
+int
+nvmf_ndp_grep_scan(struct nvmf_ndp_grep *grep, struct iovec *iov, int iovcnt,
+		   nvmf_ndp_grep_match_fn match_fn, void *cb_arg)
+{
+	return match_fn(cb_arg, iov, iovcnt);
+}
+
+int
+nvmf_ndp_grep_finish(struct nvmf_ndp_grep *grep, nvmf_ndp_grep_match_fn match_fn,
+		     void *cb_arg)
+{
+	return 0;
+}
+
+/* Aggregate engine: returns the number of bytes scanned */
+static int g_agg_count;
+
+struct ut_agg {
+	uint64_t	bytes;
+};
+
+struct nvmf_ndp_agg *
+nvmf_ndp_agg_create(const void *args, size_t len)
+{
+	g_agg_count++;
+	return (struct nvmf_ndp_agg *)calloc(1, sizeof(struct ut_agg));
+}
+
+void
+nvmf_ndp_agg_free(struct nvmf_ndp_agg *agg)
+{
+	if (agg != NULL) {
+		g_agg_count--;
+	}
+	free(agg);
+}
+
+void
+nvmf_ndp_agg_scan(struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		((struct ut_agg *)agg)->bytes += iov[i].iov_len;
+	}
+}
+
+size_t
+nvmf_ndp_agg_result_size(const struct nvmf_ndp_agg *agg)
+{
+	return sizeof(uint64_t);
+}
+
+size_t
+nvmf_ndp_agg_get_result(const struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt)
+{
+	memcpy(iov[0].iov_base, &((const struct ut_agg *)agg)->bytes, sizeof(uint64_t));
+	return sizeof(uint64_t);
+}
+
+struct ut_req {
+	union nvmf_h2c_msg		cmd;
+	union nvmf_c2h_msg		rsp;
+	struct spdk_nvmf_request	req;
+	uint64_t			buf[64];
+};
+
+/* One extent of one block per file, at LBA 100 * (i + 1), file ids 1000 + i */
+static void
+ut_req_init(struct ut_req *r, uint8_t opc, uint32_t num_files, const char *args,
+	    uint32_t depth)
+{
+	uint32_t i, w = 0;
+
+	memset(r, 0, sizeof(*r));
+	r->req.cmd = &r->cmd;
+	r->req.rsp = &r->rsp;
+	r->cmd.nvme_cmd.opc = SPDK_NVME_OPC_CUSTOM_BATCH;
+	r->cmd.nvme_cmd.cdw10 = (uint32_t)opc << 16 | (args ? strlen(args) : 0);
+	r->cmd.nvme_cmd.cdw11 = num_files;
+	r->cmd.nvme_cmd.cdw12 = num_files;
+	r->cmd.nvme_cmd.cdw13 = depth;
+
+	for (i = 0; i < num_files; i++) {
+		r->buf[w++] = htole64(1000 + i);
+		r->buf[w++] = 0;
+		r->buf[w++] = htole64(1);
+		r->buf[w++] = htole64(100 * (i + 1));
+		r->buf[w++] = htole64(1);
+	}
+	if (args != NULL) {
+		memcpy(&r->buf[w], args, strlen(args));
+	}
+
+	r->req.length = sizeof(r->buf);
+	r->req.iovcnt = 1;
+	r->req.iov[0].iov_base = r->buf;
+	r->req.iov[0].iov_len = sizeof(r->buf);
+
+	g_status = -1;
+	g_completions = 0;
+	g_cursor = NULL;
+	g_num_streams = 0;
+	g_stream_rc = 0;
+	g_job_status = 0;
+}
+
+/* Check the entry at *pos and move past it */
+static void
+ut_check_entry(struct ut_req *r, uint32_t *pos, uint64_t id, const char *data, uint16_t status,
+	       uint16_t flags)
+{
+	struct nvmf_ndp_batch_entry *entry = (void *)((char *)r->buf + *pos);
+	uint32_t len = data ? strlen(data) : 0;
+
+	CU_ASSERT(from_le64(&entry->id) == id);
+	CU_ASSERT(from_le32(&entry->len) == len);
+	CU_ASSERT(from_le16(&entry->status) == status);
+	CU_ASSERT(from_le16(&entry->flags) == flags);
+	CU_ASSERT(len == 0 || memcmp(entry + 1, data, len) == 0);
+	*pos += sizeof(*entry) + SPDK_ALIGN_CEIL(len, 8);
+}
+
+static void
+test_batch_echo(void)
+{
+	struct ut_req r;
+	uint32_t pos = 0;
+	int rc;
+
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 3, NULL, 2);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+
+	/* Only two files run at once */
+	CU_ASSERT(g_num_streams == 2);
+	CU_ASSERT(g_streams[0].extent.offset_blocks == 100);
+	CU_ASSERT(g_streams[1].extent.offset_blocks == 200);
+	CU_ASSERT(g_streams[0].opts.mode == NVMF_NDP_STREAM_MODE_RAW);
+
+	/* The second file waits for the first one to be written back, holding its slot */
+	ut_stream_finish(200, "bbbbbbbbb", 0);
+	CU_ASSERT(g_num_streams == 1);
+	ut_stream_finish(100, "aa", 0);
+	CU_ASSERT(g_num_streams == 1);
+	CU_ASSERT(g_streams[0].extent.offset_blocks == 300);
+	CU_ASSERT(g_completions == 0);
+	ut_stream_finish(300, "", 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(!g_more);
+
+	ut_check_entry(&r, &pos, 1000, "aa", 0, 0);
+	ut_check_entry(&r, &pos, 1001, "bbbbbbbbb", 0, 0);
+	ut_check_entry(&r, &pos, 1002, NULL, 0, 0);
+	CU_ASSERT(g_len == pos);
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_batch_more(void)
+{
+	char big[300];
+	struct ut_req r;
+	uint32_t pos = 0;
+	int rc;
+
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 4, NULL, 0);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_num_streams == NVMF_NDP_BATCH_DEPTH);
+
+	/* The entry of file 2 doesn't fit, file 3 is dropped and run again */
+	ut_stream_finish(100, big, 0);
+	ut_stream_finish(200, "b", 0);
+	ut_stream_finish(300, big, 0);
+	CU_ASSERT(g_completions == 0);
+	ut_stream_finish(400, "d", 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_more);
+	CU_ASSERT(g_offset == 2);
+	ut_check_entry(&r, &pos, 1000, big, 0, 0);
+	ut_check_entry(&r, &pos, 1001, "b", 0, 0);
+	CU_ASSERT(g_len == pos);
+
+	/* Next part, as a fetch */
+	rc = g_cursor->run_fn(g_cursor, NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_streams == 2);
+	ut_stream_finish(300, big, 0);
+	ut_stream_finish(400, "d", 0);
+	CU_ASSERT(g_completions == 2);
+	CU_ASSERT(!g_more);
+	pos = 0;
+	ut_check_entry(&r, &pos, 1002, big, 0, 0);
+	ut_check_entry(&r, &pos, 1003, "d", 0, 0);
+	CU_ASSERT(g_len == pos);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	/* A result longer than the buffer is truncated */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 1, NULL, 0);
+	r.req.length = 64;
+	pos = 0;
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	ut_stream_finish(100, big, 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(!g_more);
+	CU_ASSERT(g_len == 64);
+	big[64 - sizeof(struct nvmf_ndp_batch_entry)] = '\0';
+	ut_check_entry(&r, &pos, 1000, big, 0, NVMF_NDP_BATCH_F_TRUNCATED);
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_batch_errors(void)
+{
+	struct ut_req r;
+	uint32_t pos = 0;
+	int rc;
+
+	/* Unsupported operator */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_FETCH, 1, NULL, 0);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+
+	/* Malformed arguments fail the whole command */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_GREP, 2, "", 0);
+	r.cmd.nvme_cmd.cdw10 |= 1;
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_grep_count == 0);
+
+	/* A file failing to read is reported in its entry */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 2, NULL, 0);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	ut_stream_finish(100, "a", -EIO);
+	ut_stream_finish(200, "b", 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == 0);
+	ut_check_entry(&r, &pos, 1000, NULL, EIO, 0);
+	ut_check_entry(&r, &pos, 1001, "b", 0, 0);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	/* And so is one that can't be started */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 2, NULL, 0);
+	g_stream_rc = -ERANGE;
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_completions == 1);
+	pos = 0;
+	ut_check_entry(&r, &pos, 1000, NULL, ERANGE, 0);
+	ut_check_entry(&r, &pos, 1001, NULL, ERANGE, 0);
+	CU_ASSERT(g_len == pos);
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_batch_abort(void)
+{
+	struct ut_req r;
+	int rc;
+
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 3, NULL, 2);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	SPDK_CU_ASSERT_FATAL(g_job != NULL);
+	CU_ASSERT(g_job->req == &r.req);
+	CU_ASSERT(g_num_streams == 2);
+	CU_ASSERT(g_streams[0].opts.job == g_job);
+	CU_ASSERT(g_streams[1].opts.job == g_job);
+
+	/* The streams stop at their next chunk, no other file is started */
+	g_job_status = -ECANCELED;
+	ut_stream_finish(100, NULL, -ECANCELED);
+	CU_ASSERT(g_num_streams == 1);
+	CU_ASSERT(g_completions == 0);
+	ut_stream_finish(200, "b", 0);
+	CU_ASSERT(g_num_streams == 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == -ECANCELED);
+	CU_ASSERT(g_job == NULL);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	/* A timeout seen once the files are done still fails the command */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 1, NULL, 0);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	g_job_status = -ETIMEDOUT;
+	ut_stream_finish(100, "a", 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == -ETIMEDOUT);
+	CU_ASSERT(g_job == NULL);
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_batch_engines(void)
+{
+	struct ut_req r;
+	uint32_t pos = 0;
+	uint64_t bytes;
+	int rc;
+
+	/* Grep engines are kept per slot, a missing newline is added */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_GREP, 3, "foo", 2);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_grep_count == 2);
+	ut_stream_finish(100, "foo\n", 0);
+	ut_stream_finish(200, "xfoo", 0);
+	ut_stream_finish(300, "foox\n", 0);
+	CU_ASSERT(g_grep_count == 0);
+	CU_ASSERT(g_completions == 1);
+	ut_check_entry(&r, &pos, 1000, "foo\n", 0, 0);
+	ut_check_entry(&r, &pos, 1001, "xfoo\n", 0, 0);
+	ut_check_entry(&r, &pos, 1002, "foox\n", 0, 0);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	/* Aggregates are created per file, over whole records */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_AGGREGATE, 2, "args", 0);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_agg_count == 2);
+	CU_ASSERT(g_streams[0].opts.mode == NVMF_NDP_STREAM_MODE_LINES);
+	ut_stream_finish(200, "1\n2\n", 0);
+	CU_ASSERT(g_agg_count == 1);
+	ut_stream_finish(100, "10\n", 0);
+	CU_ASSERT(g_agg_count == 0);
+	CU_ASSERT(g_completions == 1);
+	bytes = 3;
+	CU_ASSERT(from_le64(&r.buf[0]) == 1000);
+	CU_ASSERT(from_le32(&r.buf[1]) == sizeof(bytes));
+	CU_ASSERT(r.buf[2] == bytes);
+	bytes = 4;
+	CU_ASSERT(from_le64(&r.buf[3]) == 1001);
+	CU_ASSERT(r.buf[5] == bytes);
+	CU_ASSERT(g_len == 6 * sizeof(uint64_t));
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_batch_room(void)
+{
+	char big[461];
+	struct ut_req r;
+	uint32_t pos = 0;
+	int rc;
+
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+
+	/* No file is started once the entries before it leave no room for its own */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 3, NULL, 2);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_num_streams == 2);
+	ut_stream_finish(200, big, 0);
+	CU_ASSERT(g_num_streams == 1);
+	ut_stream_finish(100, "a", 0);
+	CU_ASSERT(g_num_streams == 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_more);
+	CU_ASSERT(g_offset == 2);
+	ut_check_entry(&r, &pos, 1000, "a", 0, 0);
+	ut_check_entry(&r, &pos, 1001, big, 0, 0);
+	CU_ASSERT(g_len == pos);
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_batch_iobuf(void)
+{
+	struct ut_req r;
+	uint32_t pos = 0;
+	void *buf;
+	int rc;
+
+	g_iobuf = (struct spdk_iobuf_channel *)0x1;
+	g_iobuf_large_bufsize = 16;
+	g_iobuf_avail = 1;
+	g_iobuf_entry = NULL;
+
+	/* Slot buffers are taken from the pool as the files start */
+	ut_req_init(&r, SPDK_NVME_OPC_CUSTOM_ECHO, 3, NULL, 2);
+	rc = g_batch_op->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_iobuf_count == 1);
+	CU_ASSERT(g_num_streams == 1);
+	SPDK_CU_ASSERT_FATAL(g_iobuf_entry != NULL);
+
+	/* The second file starts once a buffer is available */
+	buf = malloc(16);
+	SPDK_CU_ASSERT_FATAL(buf != NULL);
+	g_iobuf_count++;
+	g_iobuf_cb(g_iobuf_entry, buf);
+	g_iobuf_entry = NULL;
+	CU_ASSERT(g_num_streams == 2);
+	CU_ASSERT(g_streams[1].extent.offset_blocks == 200);
+
+	/* A result is bounded by the size of the buffers, which are kept for the next file */
+	ut_stream_finish(100, "aaaaaaaaaaaaaaaaaaaa", 0);
+	CU_ASSERT(g_num_streams == 2);
+	CU_ASSERT(g_iobuf_count == 2);
+	ut_stream_finish(200, "b", 0);
+	ut_stream_finish(300, "c", 0);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_iobuf_count == 0);
+	CU_ASSERT(g_iobuf_entry == NULL);
+	ut_check_entry(&r, &pos, 1000, "aaaaaaaaaaaaaaaa", 0, NVMF_NDP_BATCH_F_TRUNCATED);
+	ut_check_entry(&r, &pos, 1001, "b", 0, 0);
+	ut_check_entry(&r, &pos, 1002, "c", 0, 0);
+	CU_ASSERT(g_len == pos);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	g_iobuf = NULL;
+	g_iobuf_large_bufsize = 132 * 1024;
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_batch", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_batch_echo);
+	CU_ADD_TEST(suite, test_batch_more);
+	CU_ADD_TEST(suite, test_batch_errors);
+	CU_ADD_TEST(suite, test_batch_abort);
+	CU_ADD_TEST(suite, test_batch_engines);
+	CU_ADD_TEST(suite, test_batch_room);
+	CU_ADD_TEST(suite, test_batch_iobuf);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
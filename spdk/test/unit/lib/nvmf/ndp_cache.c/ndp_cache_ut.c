@@ -0,0 +1,465 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "common/lib/test_env.c"
+#include "nvmf/ndp_cache.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_OPC_GREP	0xd4
+#define UT_OPC_WRITE	0xd5
+
+static int g_bdev_a, g_bdev_b;
+#define UT_BDEV_A	((struct spdk_bdev *)&g_bdev_a)
+#define UT_BDEV_B	((struct spdk_bdev *)&g_bdev_b)
+
+static struct spdk_nvmf_ndp_op g_ut_write_op = {
+	.name = "ut_write",
+	.opc = UT_OPC_WRITE,
+	.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER,
+	.flags = SPDK_NVMF_NDP_OP_F_WRITES_MEDIA,
+};
+
+const struct spdk_nvmf_ndp_op *
+spdk_nvmf_ndp_get_op(uint8_t opc)
+{
+	return opc == UT_OPC_WRITE ? &g_ut_write_op : NULL;
+}
+
+/* Namespace 1 is bdev A */
+struct ut_req {
+	struct spdk_nvmf_subsystem	subsystem;
+	struct spdk_nvmf_ns		ns;
+	struct spdk_nvmf_ns		*ns_list[1];
+	struct spdk_nvmf_ctrlr		ctrlr;
+	struct spdk_nvmf_qpair		qpair;
+	union nvmf_h2c_msg		cmd;
+	union nvmf_c2h_msg		rsp;
+	struct spdk_nvmf_request	req;
+	char				buf[4096];
+};
+
+static void
+ut_req_init(struct ut_req *r, uint8_t opc, uint32_t length)
+{
+	memset(r, 0, sizeof(*r));
+	r->ns.bdev = UT_BDEV_A;
+	r->ns_list[0] = &r->ns;
+	r->subsystem.ns = r->ns_list;
+	r->subsystem.max_nsid = 1;
+	r->ctrlr.subsys = &r->subsystem;
+	r->ctrlr.visible_ns = spdk_bit_array_create(1);
+	SPDK_CU_ASSERT_FATAL(r->ctrlr.visible_ns != NULL);
+	spdk_bit_array_set(r->ctrlr.visible_ns, 0);
+	r->qpair.ctrlr = &r->ctrlr;
+	r->cmd.nvme_cmd.opc = opc;
+	r->cmd.nvme_cmd.nsid = 1;
+	r->req.qpair = &r->qpair;
+	r->req.cmd = &r->cmd;
+	r->req.rsp = &r->rsp;
+	r->req.iov[0].iov_base = r->buf;
+	r->req.iov[0].iov_len = length;
+	r->req.iovcnt = 1;
+	r->req.length = length;
+}
+
+static void
+ut_req_fini(struct ut_req *r)
+{
+	spdk_bit_array_free(&r->ctrlr.visible_ns);
+}
+
+/* Target over extents, with args as the operator arguments */
+static void
+ut_target_init(struct nvmf_ndp_desc *target, struct nvmf_ndp_extent *extents,
+	       uint32_t num_extents, const char *args)
+{
+	target->length = 0;
+	target->num_extents = num_extents;
+	target->extents = extents;
+	target->args = (char *)args;
+	target->args_len = strlen(args);
+}
+
+/* Run a command for target that produces result, through the cache */
+static int
+ut_run(struct spdk_bdev *bdev, const struct nvmf_ndp_desc *target, const char *result,
+       bool *filled)
+{
+	struct nvmf_ndp_cache_entry *fill;
+	struct ut_req r;
+	int rc;
+
+	ut_req_init(&r, UT_OPC_GREP, sizeof(r.buf));
+	*filled = false;
+
+	rc = nvmf_ndp_cache_lookup(bdev, &r.req, target, &fill);
+	if (rc >= 0) {
+		CU_ASSERT(fill == NULL);
+		CU_ASSERT((size_t)rc == strlen(result));
+		CU_ASSERT(memcmp(r.buf, result, rc) == 0);
+	} else if (fill != NULL) {
+		CU_ASSERT(rc == -ENOENT);
+		memcpy(r.buf, result, strlen(result));
+		nvmf_ndp_cache_fill(fill, &r.req, strlen(result));
+		*filled = true;
+	}
+
+	ut_req_fini(&r);
+	return rc;
+}
+
+static void
+ut_cache_reset(void)
+{
+	struct nvmf_ndp_cache *cache = &g_nvmf_ndp_cache;
+
+	spdk_nvmf_ndp_cache_set_capacity(0);
+	spdk_nvmf_ndp_cache_set_capacity(SPDK_NVMF_NDP_CACHE_DEFAULT_SIZE);
+	CU_ASSERT(TAILQ_EMPTY(&cache->lru));
+	CU_ASSERT(TAILQ_EMPTY(&cache->pending));
+	CU_ASSERT(cache->num_active == 0);
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	cache->stats.capacity = SPDK_NVMF_NDP_CACHE_DEFAULT_SIZE;
+}
+
+static void
+test_cache_lookup(void)
+{
+	struct nvmf_ndp_extent extents[2] = { { 100, 8 }, { 300, 8 } };
+	struct spdk_nvmf_ndp_cache_stats stats;
+	struct nvmf_ndp_cache_entry *fill;
+	struct nvmf_ndp_desc target;
+	struct ut_req r;
+	bool filled;
+	int rc;
+
+	ut_cache_reset();
+	ut_target_init(&target, extents, 2, "error\n");
+
+	/* The first command scans, the second one is answered from the cache */
+	rc = ut_run(UT_BDEV_A, &target, "error: 1\n", &filled);
+	CU_ASSERT(rc == -ENOENT);
+	CU_ASSERT(filled);
+	rc = ut_run(UT_BDEV_A, &target, "error: 1\n", &filled);
+	CU_ASSERT(rc == 9);
+	CU_ASSERT(!filled);
+
+	/* Any difference in the key is a different result */
+	rc = ut_run(UT_BDEV_B, &target, "b", &filled);
+	CU_ASSERT(rc == -ENOENT);
+	target.args = "warning\n";
+	target.args_len = 8;
+	rc = ut_run(UT_BDEV_A, &target, "w", &filled);
+	CU_ASSERT(rc == -ENOENT);
+	target.args = "error\n";
+	target.args_len = 6;
+	target.length = 4096;
+	rc = ut_run(UT_BDEV_A, &target, "l", &filled);
+	CU_ASSERT(rc == -ENOENT);
+	target.length = 0;
+	extents[1].num_blocks = 9;
+	rc = ut_run(UT_BDEV_A, &target, "e", &filled);
+	CU_ASSERT(rc == -ENOENT);
+	extents[1].num_blocks = 8;
+
+	ut_req_init(&r, UT_OPC_GREP + 0x10, sizeof(r.buf));
+	rc = nvmf_ndp_cache_lookup(UT_BDEV_A, &r.req, &target, &fill);
+	CU_ASSERT(rc == -ENOENT);
+	SPDK_CU_ASSERT_FATAL(fill != NULL);
+	nvmf_ndp_cache_abort(fill);
+
+	/* A cached result that doesn't fit is returned in parts by the operator */
+	r.cmd.nvme_cmd.opc = UT_OPC_GREP;
+	r.req.length = 4;
+	rc = nvmf_ndp_cache_lookup(UT_BDEV_A, &r.req, &target, &fill);
+	CU_ASSERT(rc == -ENOENT);
+	CU_ASSERT(fill == NULL);
+
+	/* Empty results are results as well */
+	r.req.length = sizeof(r.buf);
+	target.args = "none\n";
+	target.args_len = 5;
+	rc = ut_run(UT_BDEV_A, &target, "", &filled);
+	CU_ASSERT(filled);
+	rc = ut_run(UT_BDEV_A, &target, "", &filled);
+	CU_ASSERT(rc == 0);
+	ut_req_fini(&r);
+
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	CU_ASSERT(stats.hits == 2);
+	CU_ASSERT(stats.misses == 8);
+	CU_ASSERT(stats.insertions == 6);
+	CU_ASSERT(stats.num_entries == 6);
+	CU_ASSERT(stats.size > 0);
+	CU_ASSERT(stats.evictions == 0);
+
+	/* Concurrent fills of the same key keep the first one */
+	target.args = "twice\n";
+	target.args_len = 6;
+	ut_req_init(&r, UT_OPC_GREP, sizeof(r.buf));
+	rc = nvmf_ndp_cache_lookup(UT_BDEV_A, &r.req, &target, &fill);
+	CU_ASSERT(rc == -ENOENT);
+	rc = ut_run(UT_BDEV_A, &target, "first", &filled);
+	CU_ASSERT(filled);
+	memcpy(r.buf, "second", 6);
+	nvmf_ndp_cache_fill(fill, &r.req, 6);
+	ut_req_fini(&r);
+	rc = ut_run(UT_BDEV_A, &target, "first", &filled);
+	CU_ASSERT(rc == 5);
+}
+
+static void
+ut_write(uint8_t opc, uint64_t slba, uint32_t nlb)
+{
+	struct ut_req r;
+
+	ut_req_init(&r, opc, 0);
+	r.cmd.nvme_cmd.cdw10 = (uint32_t)slba;
+	r.cmd.nvme_cmd.cdw11 = (uint32_t)(slba >> 32);
+	r.cmd.nvme_cmd.cdw12 = nlb - 1;
+	nvmf_ndp_cache_invalidate_io(&r.req);
+	ut_req_fini(&r);
+}
+
+static bool
+ut_cached(const struct nvmf_ndp_desc *target)
+{
+	bool filled;
+
+	return ut_run(UT_BDEV_A, target, "x", &filled) >= 0;
+}
+
+static void
+test_cache_invalidate(void)
+{
+	struct nvmf_ndp_extent extents[2] = { { 100, 8 }, { 300, 8 } };
+	struct spdk_nvme_scc_source_range copy_ranges[2] = {};
+	struct spdk_nvme_dsm_range dsm_ranges[2] = {};
+	struct spdk_nvmf_ndp_cache_stats stats;
+	struct nvmf_ndp_cache_entry *fill;
+	struct nvmf_ndp_desc target;
+	struct ut_req r;
+	bool filled;
+
+	ut_cache_reset();
+	ut_target_init(&target, extents, 2, "error\n");
+
+	/* Writes next to the extents, or reads, change nothing */
+	ut_run(UT_BDEV_A, &target, "x", &filled);
+	CU_ASSERT(filled);
+	ut_write(SPDK_NVME_OPC_WRITE, 92, 8);
+	ut_write(SPDK_NVME_OPC_WRITE, 108, 192);
+	ut_write(SPDK_NVME_OPC_READ, 100, 8);
+	ut_write(SPDK_NVME_OPC_COMPARE, 100, 8);
+	CU_ASSERT(ut_cached(&target));
+
+	/* Overlapping writes drop the result */
+	ut_write(SPDK_NVME_OPC_WRITE, 307, 1);
+	CU_ASSERT(!ut_cached(&target));
+	CU_ASSERT(ut_cached(&target));
+	ut_write(SPDK_NVME_OPC_WRITE_ZEROES, 90, 11);
+	CU_ASSERT(!ut_cached(&target));
+
+	/* Writes to another namespace don't */
+	ut_cached(&target);
+	ut_req_init(&r, SPDK_NVME_OPC_WRITE, 0);
+	r.ns.bdev = UT_BDEV_B;
+	r.cmd.nvme_cmd.cdw10 = 100;
+	nvmf_ndp_cache_invalidate_io(&r.req);
+	ut_req_fini(&r);
+	CU_ASSERT(ut_cached(&target));
+
+	/* Deallocate, one range of several overlaps */
+	dsm_ranges[0].starting_lba = 0;
+	dsm_ranges[0].length = 100;
+	dsm_ranges[1].starting_lba = 304;
+	dsm_ranges[1].length = 100;
+	ut_req_init(&r, SPDK_NVME_OPC_DATASET_MANAGEMENT, sizeof(dsm_ranges));
+	memcpy(r.buf, dsm_ranges, sizeof(dsm_ranges));
+	r.cmd.nvme_cmd.cdw10_bits.dsm.nr = 1;
+	nvmf_ndp_cache_invalidate_io(&r.req);
+	CU_ASSERT(ut_cached(&target));
+	r.cmd.nvme_cmd.cdw11_bits.dsm.ad = 1;
+	nvmf_ndp_cache_invalidate_io(&r.req);
+	ut_req_fini(&r);
+	CU_ASSERT(!ut_cached(&target));
+
+	/* Copy, the destination is as long as the source ranges together */
+	ut_cached(&target);
+	copy_ranges[0].slba = 0;
+	copy_ranges[0].nlb = 9;
+	copy_ranges[1].slba = 1000;
+	copy_ranges[1].nlb = 9;
+	ut_req_init(&r, SPDK_NVME_OPC_COPY, sizeof(copy_ranges));
+	memcpy(r.buf, copy_ranges, sizeof(copy_ranges));
+	r.cmd.nvme_cmd.cdw10 = 80;
+	r.cmd.nvme_cmd.cdw12_bits.copy.nr = 1;
+	nvmf_ndp_cache_invalidate_io(&r.req);
+	CU_ASSERT(ut_cached(&target));
+	r.cmd.nvme_cmd.cdw10 = 81;
+	nvmf_ndp_cache_invalidate_io(&r.req);
+	ut_req_fini(&r);
+	CU_ASSERT(!ut_cached(&target));
+
+	/* NDP operators writing to the media drop everything of the namespace */
+	ut_cached(&target);
+	ut_write(UT_OPC_WRITE, 0, 1);
+	CU_ASSERT(!ut_cached(&target));
+
+	/* A result computed while a write was outstanding isn't cached */
+	ut_write(SPDK_NVME_OPC_WRITE, 100, 1);
+	ut_req_init(&r, UT_OPC_GREP, sizeof(r.buf));
+	nvmf_ndp_cache_lookup(UT_BDEV_A, &r.req, &target, &fill);
+	SPDK_CU_ASSERT_FATAL(fill != NULL);
+	ut_write(SPDK_NVME_OPC_WRITE, 100, 1);
+	nvmf_ndp_cache_fill(fill, &r.req, 1);
+	ut_req_fini(&r);
+	CU_ASSERT(!ut_cached(&target));
+	CU_ASSERT(ut_cached(&target));
+
+	/* Removing the namespace */
+	nvmf_ndp_cache_invalidate_bdev(UT_BDEV_A);
+	CU_ASSERT(!ut_cached(&target));
+
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	CU_ASSERT(stats.invalidations == 7);
+	CU_ASSERT(stats.num_entries == 1);
+}
+
+static void
+test_cache_index(void)
+{
+	struct nvmf_ndp_extent sparse[2] = { { 0, 1 }, { 1000, 8 } };
+	struct nvmf_ndp_extent near[1] = { { 500, 8 } };
+	struct nvmf_ndp_desc sparse_target, near_target;
+	struct nvmf_ndp_cache_slot *slot = nvmf_ndp_cache_slot(UT_BDEV_A);
+	bool filled;
+
+	ut_cache_reset();
+	ut_target_init(&sparse_target, sparse, 2, "error\n");
+	ut_target_init(&near_target, near, 1, "error\n");
+	CU_ASSERT(slot->num_entries == 0);
+
+	ut_run(UT_BDEV_A, &sparse_target, "x", &filled);
+	ut_run(UT_BDEV_A, &near_target, "x", &filled);
+	CU_ASSERT(slot->num_entries == 2);
+	CU_ASSERT(slot->lo == 0);
+	CU_ASSERT(slot->hi == 1008);
+	CU_ASSERT(slot->max_span == 1008);
+
+	/* An entry starting long before the write is found through its span */
+	ut_write(SPDK_NVME_OPC_WRITE, 1004, 1);
+	CU_ASSERT(!ut_cached(&sparse_target));
+	CU_ASSERT(ut_cached(&near_target));
+
+	/* Between the extents of an entry, or past all entries */
+	ut_write(SPDK_NVME_OPC_WRITE, 1, 499);
+	ut_write(SPDK_NVME_OPC_WRITE, 2000, 8);
+	CU_ASSERT(ut_cached(&sparse_target));
+	CU_ASSERT(ut_cached(&near_target));
+
+	ut_write(SPDK_NVME_OPC_WRITE, 507, 1);
+	CU_ASSERT(!ut_cached(&near_target));
+	CU_ASSERT(ut_cached(&sparse_target));
+
+	/* The bounds of the slot are reset once it is empty */
+	nvmf_ndp_cache_invalidate_bdev(UT_BDEV_A);
+	CU_ASSERT(slot->num_entries == 0);
+	CU_ASSERT(slot->lo == UINT64_MAX);
+	CU_ASSERT(slot->hi == 0);
+	CU_ASSERT(slot->max_span == 0);
+	CU_ASSERT(RB_EMPTY(&slot->tree));
+
+	ut_cache_reset();
+}
+
+static void
+test_cache_capacity(void)
+{
+	struct nvmf_ndp_extent extents[1] = { { 0, 1 } };
+	struct spdk_nvmf_ndp_cache_stats stats;
+	struct nvmf_ndp_cache_entry *fill;
+	struct nvmf_ndp_desc target;
+	struct ut_req r;
+	uint64_t entry_size, i;
+	bool filled;
+
+	ut_cache_reset();
+	ut_target_init(&target, extents, 1, "a\n");
+	ut_run(UT_BDEV_A, &target, "0123456789", &filled);
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	entry_size = stats.size;
+
+	/* Room for eight results, the least recently used one goes first */
+	spdk_nvmf_ndp_cache_set_capacity(entry_size * 8);
+	for (i = 1; i < 8; i++) {
+		extents[0].offset_blocks = i;
+		ut_run(UT_BDEV_A, &target, "0123456789", &filled);
+	}
+	extents[0].offset_blocks = 0;
+	CU_ASSERT(ut_run(UT_BDEV_A, &target, "0123456789", &filled) >= 0);
+	extents[0].offset_blocks = 8;
+	ut_run(UT_BDEV_A, &target, "0123456789", &filled);
+
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	CU_ASSERT(stats.num_entries == 8);
+	CU_ASSERT(stats.evictions == 1);
+	CU_ASSERT(stats.size == entry_size * 8);
+	extents[0].offset_blocks = 0;
+	CU_ASSERT(ut_run(UT_BDEV_A, &target, "0123456789", &filled) >= 0);
+	extents[0].offset_blocks = 1;
+	CU_ASSERT(ut_run(UT_BDEV_A, &target, "0123456789", &filled) == -ENOENT);
+
+	/* A result larger than 1/8 of the capacity isn't cached */
+	spdk_nvmf_ndp_cache_set_capacity(entry_size * 8 - 1);
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	CU_ASSERT(stats.num_entries == 7);
+	extents[0].offset_blocks = 10;
+	ut_run(UT_BDEV_A, &target, "0123456789", &filled);
+	CU_ASSERT(filled);
+	CU_ASSERT(ut_run(UT_BDEV_A, &target, "0123456789", &filled) == -ENOENT);
+
+	/* Shrinking evicts, 0 disables */
+	spdk_nvmf_ndp_cache_set_capacity(entry_size);
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	CU_ASSERT(stats.num_entries == 1);
+	spdk_nvmf_ndp_cache_set_capacity(0);
+	spdk_nvmf_ndp_cache_get_stats(&stats);
+	CU_ASSERT(stats.num_entries == 0);
+	CU_ASSERT(stats.size == 0);
+	CU_ASSERT(g_nvmf_ndp_cache.num_active == 0);
+
+	ut_req_init(&r, UT_OPC_GREP, sizeof(r.buf));
+	CU_ASSERT(nvmf_ndp_cache_lookup(UT_BDEV_A, &r.req, &target, &fill) == -ENOENT);
+	CU_ASSERT(fill == NULL);
+	ut_req_fini(&r);
+
+	ut_cache_reset();
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_cache", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_cache_lookup);
+	CU_ADD_TEST(suite, test_cache_invalidate);
+	CU_ADD_TEST(suite, test_cache_index);
+	CU_ADD_TEST(suite, test_cache_capacity);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
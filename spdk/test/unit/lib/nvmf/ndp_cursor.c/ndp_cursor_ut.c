@@ -0,0 +1,384 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "common/lib/test_env.c"
+#include "nvmf/ndp_cursor.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+static struct spdk_nvmf_ndp_op *g_fetch_op;
+static int g_status;
+static int g_completions;
+
+/* Arguments of the last run_fn call */
+static struct nvmf_ndp_cursor *g_run_cursor;
+static uint64_t g_run_offset;
+static int g_run_rc;
+
+/* Result cache calls */
+static struct nvmf_ndp_cache_entry *g_filled;
+static uint32_t g_filled_len;
+static struct nvmf_ndp_cache_entry *g_aborted;
+
+int
+spdk_nvmf_ndp_register_op(struct spdk_nvmf_ndp_op *op)
+{
+	g_fetch_op = op;
+	return 0;
+}
+
+void
+nvmf_ndp_desc_free(struct nvmf_ndp_desc *desc)
+{
+	free(desc->extents);
+	free(desc->args);
+	memset(desc, 0, sizeof(*desc));
+}
+
+void
+nvmf_ndp_set_status(struct spdk_nvmf_request *req, int status)
+{
+	g_status = status;
+}
+
+void
+nvmf_ndp_cache_fill(struct nvmf_ndp_cache_entry *fill, struct spdk_nvmf_request *req,
+		    uint32_t len)
+{
+	g_filled = fill;
+	g_filled_len = len;
+}
+
+void
+nvmf_ndp_cache_abort(struct nvmf_ndp_cache_entry *fill)
+{
+	g_aborted = fill;
+}
+
+int
+spdk_nvmf_request_complete(struct spdk_nvmf_request *req)
+{
+	g_completions++;
+	return 0;
+}
+
+static int
+ut_run(struct nvmf_ndp_cursor *cursor, struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+       struct spdk_io_channel *ch, struct spdk_nvmf_request *req)
+{
+	g_run_cursor = cursor;
+	g_run_offset = cursor->offset;
+	return g_run_rc;
+}
+
+struct ut_req {
+	struct spdk_nvmf_subsystem	subsystem;
+	struct spdk_nvmf_ctrlr		ctrlr;
+	struct spdk_nvmf_qpair		qpair;
+	union nvmf_h2c_msg		cmd;
+	union nvmf_c2h_msg		rsp;
+	struct spdk_nvmf_request	req;
+	char				buf[4096];
+};
+
+static void
+ut_req_init(struct ut_req *r, uint16_t cntlid, uint32_t nsid)
+{
+	memset(&r->cmd, 0, sizeof(r->cmd));
+	memset(&r->rsp, 0, sizeof(r->rsp));
+	memset(&r->req, 0, sizeof(r->req));
+	r->ctrlr.subsys = &r->subsystem;
+	r->ctrlr.cntlid = cntlid;
+	r->qpair.ctrlr = &r->ctrlr;
+	r->cmd.nvme_cmd.nsid = nsid;
+	r->req.qpair = &r->qpair;
+	r->req.cmd = &r->cmd;
+	r->req.rsp = &r->rsp;
+	r->req.iov[0].iov_base = r->buf;
+	r->req.iov[0].iov_len = sizeof(r->buf);
+	r->req.iovcnt = 1;
+	r->req.length = sizeof(r->buf);
+	r->req.xfer = SPDK_NVME_DATA_HOST_TO_CONTROLLER;
+	g_completions = 0;
+	g_status = -1;
+	g_run_cursor = NULL;
+	g_run_rc = 0;
+	g_filled = NULL;
+	g_filled_len = 0;
+	g_aborted = NULL;
+}
+
+static struct nvmf_ndp_cursor *
+ut_cursor_create(struct ut_req *r)
+{
+	struct nvmf_ndp_desc target = {};
+	struct nvmf_ndp_cursor *cursor;
+
+	target.num_extents = 1;
+	target.extents = calloc(1, sizeof(*target.extents));
+	SPDK_CU_ASSERT_FATAL(target.extents != NULL);
+
+	cursor = nvmf_ndp_cursor_create(&r->req, &target, ut_run);
+	SPDK_CU_ASSERT_FATAL(cursor != NULL);
+	CU_ASSERT(target.extents == NULL);
+	CU_ASSERT(cursor->target.num_extents == 1);
+
+	return cursor;
+}
+
+static int
+ut_fetch(struct ut_req *r, uint32_t id, uint32_t flags)
+{
+	r->cmd.nvme_cmd.opc = SPDK_NVME_OPC_CUSTOM_FETCH;
+	r->cmd.nvme_cmd.cdw10 = id;
+	r->cmd.nvme_cmd.cdw11 = flags;
+	r->req.xfer = SPDK_NVME_DATA_CONTROLLER_TO_HOST;
+
+	return g_fetch_op->exec(NULL, NULL, NULL, &r->req);
+}
+
+static void
+test_cursor_fetch(void)
+{
+	struct ut_req r, other;
+	struct nvmf_ndp_cursor *cursor;
+	uint32_t id;
+	int rc;
+
+	SPDK_CU_ASSERT_FATAL(g_fetch_op != NULL);
+	CU_ASSERT(g_fetch_op->opc == SPDK_NVME_OPC_CUSTOM_FETCH);
+	CU_ASSERT(g_fetch_op->xfer == SPDK_NVME_DATA_CONTROLLER_TO_HOST);
+
+	/* The first part of the result, more to come */
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 1000, true, 12345);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(r.rsp.nvme_cpl.cdw0 == (1000 | NVMF_NDP_RESULT_MORE));
+	id = r.rsp.nvme_cpl.cdw1;
+	CU_ASSERT(id != 0);
+	CU_ASSERT(r.req.length == 1000);
+	CU_ASSERT(r.req.xfer == SPDK_NVME_DATA_CONTROLLER_TO_HOST);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 1);
+
+	/* Only the controller and namespace that created it may use it */
+	ut_req_init(&other, 2, 1);
+	other.ctrlr.subsys = &r.subsystem;
+	rc = ut_fetch(&other, id, 0);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_run_cursor == NULL);
+
+	ut_req_init(&other, 1, 2);
+	other.ctrlr.subsys = &r.subsystem;
+	rc = ut_fetch(&other, id, 0);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 1);
+
+	/* The operator continues where it stopped */
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, id, 0);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_run_cursor == cursor);
+	CU_ASSERT(g_run_offset == 12345);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+
+	/* Not fetchable while in use */
+	ut_req_init(&other, 1, 1);
+	other.ctrlr.subsys = &r.subsystem;
+	rc = ut_fetch(&other, id, 0);
+	CU_ASSERT(g_status == -EINVAL);
+
+	/* Same cursor for the next part */
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 4096, true, 20000);
+	CU_ASSERT(r.rsp.nvme_cpl.cdw0 == (4096 | NVMF_NDP_RESULT_MORE));
+	CU_ASSERT(r.rsp.nvme_cpl.cdw1 == id);
+
+	/* Last part: the cursor goes away, nothing left to transfer */
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, id, 0);
+	CU_ASSERT(g_run_offset == 20000);
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 0, false, 0);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(r.rsp.nvme_cpl.cdw0 == 0);
+	CU_ASSERT(r.req.xfer == SPDK_NVME_DATA_NONE);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, id, 0);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+}
+
+static void
+test_cursor_errors(void)
+{
+	struct nvmf_ndp_cursor *cursor;
+	struct ut_req r;
+	uint32_t id;
+	int rc;
+
+	/* An error frees the cursor */
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	nvmf_ndp_cursor_complete(cursor, &r.req, -EIO, 100, true, 100);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == -EIO);
+	CU_ASSERT(r.rsp.nvme_cpl.cdw0 == 0);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+
+	/* A result that fits completes without cursor */
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 100, false, 100);
+	CU_ASSERT(r.rsp.nvme_cpl.cdw0 == 100);
+	CU_ASSERT(r.rsp.nvme_cpl.cdw1 == 0);
+	CU_ASSERT(r.req.length == 100);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 100, true, 100);
+	id = r.rsp.nvme_cpl.cdw1;
+
+	/* A cursor that couldn't be run stays usable */
+	ut_req_init(&r, 1, 1);
+	g_run_rc = -ENOMEM;
+	rc = ut_fetch(&r, id, 0);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -ENOMEM);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 1);
+
+	ut_req_init(&r, 1, 1);
+	r.req.length = 0;
+	r.req.iovcnt = 0;
+	rc = ut_fetch(&r, id, 0);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_run_cursor == NULL);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 1);
+
+	/* The host may drop the rest of a result */
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, id, NVMF_NDP_FETCH_RELEASE);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(g_run_cursor == NULL);
+	CU_ASSERT(r.req.xfer == SPDK_NVME_DATA_NONE);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+}
+
+static void
+test_cursor_expire(void)
+{
+	struct nvmf_ndp_cursor *cursor;
+	struct ut_req r;
+	uint32_t first, id;
+	int i, rc;
+
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 100, true, 100);
+	id = r.rsp.nvme_cpl.cdw1;
+
+	spdk_delay_us(NVMF_NDP_CURSOR_TIMEOUT_SEC * SPDK_SEC_TO_USEC + 1);
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, id, 0);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+
+	/* The least recently used cursor makes room for a new one */
+	for (i = 0; i <= NVMF_NDP_CURSOR_MAX; i++) {
+		ut_req_init(&r, 1, 1);
+		cursor = ut_cursor_create(&r);
+		nvmf_ndp_cursor_complete(cursor, &r.req, 0, 100, true, 100);
+		if (i == 0) {
+			first = r.rsp.nvme_cpl.cdw1;
+		}
+		CU_ASSERT(g_nvmf_ndp_num_cursors == spdk_min(i + 1, NVMF_NDP_CURSOR_MAX));
+	}
+
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, first, NVMF_NDP_FETCH_RELEASE);
+	CU_ASSERT(g_status == -EINVAL);
+	ut_req_init(&r, 1, 1);
+	rc = ut_fetch(&r, first + 1, NVMF_NDP_FETCH_RELEASE);
+	CU_ASSERT(g_status == 0);
+
+	/* Clean up */
+	spdk_delay_us(NVMF_NDP_CURSOR_TIMEOUT_SEC * SPDK_SEC_TO_USEC + 1);
+	ut_req_init(&r, 1, 1);
+	ut_fetch(&r, 0, 0);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+}
+
+static void
+test_cursor_cache_fill(void)
+{
+	struct nvmf_ndp_cache_entry *fill = (struct nvmf_ndp_cache_entry *)0xDEADBEEF;
+	struct nvmf_ndp_cursor *cursor;
+	struct ut_req r;
+	uint32_t id;
+
+	/* A complete result is cached */
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	cursor->cache_fill = fill;
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 100, false, 100);
+	CU_ASSERT(g_filled == fill);
+	CU_ASSERT(g_filled_len == 100);
+	CU_ASSERT(g_aborted == NULL);
+
+	/* A result in parts isn't */
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	cursor->cache_fill = fill;
+	nvmf_ndp_cursor_complete(cursor, &r.req, 0, 100, true, 100);
+	CU_ASSERT(g_filled == NULL);
+	CU_ASSERT(g_aborted == fill);
+	CU_ASSERT(cursor->cache_fill == NULL);
+	id = r.rsp.nvme_cpl.cdw1;
+
+	/* Neither is a failed one */
+	ut_req_init(&r, 1, 1);
+	cursor = ut_cursor_create(&r);
+	cursor->cache_fill = fill;
+	nvmf_ndp_cursor_complete(cursor, &r.req, -EIO, 0, false, 0);
+	CU_ASSERT(g_filled == NULL);
+	CU_ASSERT(g_aborted == fill);
+
+	/* Clean up */
+	ut_req_init(&r, 1, 1);
+	ut_fetch(&r, id, NVMF_NDP_FETCH_RELEASE);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(g_aborted == NULL);
+	CU_ASSERT(g_nvmf_ndp_num_cursors == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_cursor", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_cursor_fetch);
+	CU_ADD_TEST(suite, test_cursor_errors);
+	CU_ADD_TEST(suite, test_cursor_expire);
+	CU_ADD_TEST(suite, test_cursor_cache_fill);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,266 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_desc.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_BLOCK_SIZE	512
+#define UT_NUM_BLOCKS	(1ULL << 33)
+
+DEFINE_STUB(spdk_bdev_get_block_size, uint32_t, (const struct spdk_bdev *bdev), UT_BLOCK_SIZE);
+DEFINE_STUB(spdk_bdev_get_num_blocks, uint64_t, (const struct spdk_bdev *bdev), UT_NUM_BLOCKS);
+
+struct ut_req {
+	union nvmf_h2c_msg	cmd;
+	union nvmf_c2h_msg	rsp;
+	struct spdk_nvmf_request req;
+	uint64_t		buf[64];
+};
+
+/* Build a request with the descriptor split over two iovecs in the middle of a word */
+static void
+ut_req_init(struct ut_req *r, uint64_t length, const uint64_t *extents, uint32_t num_extents,
+	    const char *args)
+{
+	uint32_t i;
+
+	memset(r, 0, sizeof(*r));
+	r->req.cmd = &r->cmd;
+	r->req.rsp = &r->rsp;
+	r->cmd.nvme_cmd.cdw11 = num_extents;
+
+	r->buf[0] = htole64(length);
+	for (i = 0; i < 2 * num_extents; i++) {
+		r->buf[1 + i] = htole64(extents[i]);
+	}
+	if (args != NULL) {
+		memcpy(&r->buf[1 + 2 * num_extents], args, strlen(args));
+	}
+
+	r->req.length = sizeof(r->buf);
+	r->req.iovcnt = 2;
+	r->req.iov[0].iov_base = r->buf;
+	r->req.iov[0].iov_len = 12;
+	r->req.iov[1].iov_base = (char *)r->buf + 12;
+	r->req.iov[1].iov_len = sizeof(r->buf) - 12;
+}
+
+static void
+test_desc_parse(void)
+{
+	const uint64_t extents[] = { 100, 8, 0x100000000ULL, 2, 900, 124 };
+	struct nvmf_ndp_desc desc;
+	struct ut_req r;
+	int rc;
+
+	ut_req_init(&r, 5000, extents, 3, "foo\nbar");
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 7, &desc);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(desc.length == 5000);
+	CU_ASSERT(desc.num_extents == 3);
+	CU_ASSERT(desc.extents[0].offset_blocks == 100);
+	CU_ASSERT(desc.extents[0].num_blocks == 8);
+	/* LBAs beyond 32 bits */
+	CU_ASSERT(desc.extents[1].offset_blocks == 0x100000000ULL);
+	CU_ASSERT(desc.extents[1].num_blocks == 2);
+	CU_ASSERT(desc.extents[2].offset_blocks == 900);
+	CU_ASSERT(desc.extents[2].num_blocks == 124);
+	CU_ASSERT(desc.args_len == 7);
+	CU_ASSERT(strcmp(desc.args, "foo\nbar") == 0);
+	CU_ASSERT(nvmf_ndp_desc_get_length(&desc, 512) == 5000);
+	nvmf_ndp_desc_free(&desc);
+	CU_ASSERT(desc.extents == NULL);
+	CU_ASSERT(desc.args == NULL);
+
+	/* No arguments, length 0 stands for all of the extents */
+	ut_req_init(&r, 0, extents, 1, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(desc.length == 0);
+	CU_ASSERT(desc.num_extents == 1);
+	CU_ASSERT(desc.args == NULL);
+	CU_ASSERT(nvmf_ndp_desc_get_length(&desc, 512) == 8 * 512);
+	nvmf_ndp_desc_free(&desc);
+}
+
+static void
+test_desc_parse_invalid(void)
+{
+	uint64_t extents[] = { 0, 8, 16, 8 };
+	struct nvmf_ndp_desc desc;
+	struct ut_req r;
+	int rc;
+
+	/* No extent */
+	ut_req_init(&r, 0, extents, 0, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -EINVAL);
+
+	/* Too many extents */
+	ut_req_init(&r, 0, extents, 2, NULL);
+	r.cmd.nvme_cmd.cdw11 = NVMF_NDP_DESC_MAX_EXTENTS + 1;
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -EINVAL);
+
+	/* More extents or arguments than fit in the buffer */
+	r.cmd.nvme_cmd.cdw11 = 32;
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	r.cmd.nvme_cmd.cdw11 = 2;
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, sizeof(r.buf) - NVMF_NDP_DESC_SIZE(2) + 1, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, sizeof(r.buf) - NVMF_NDP_DESC_SIZE(2), &desc);
+	CU_ASSERT(rc == 0);
+	nvmf_ndp_desc_free(&desc);
+
+	/* Length beyond the extents */
+	ut_req_init(&r, 16 * UT_BLOCK_SIZE + 1, extents, 2, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	ut_req_init(&r, 16 * UT_BLOCK_SIZE, extents, 2, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == 0);
+	nvmf_ndp_desc_free(&desc);
+
+	/* Empty extent */
+	extents[3] = 0;
+	ut_req_init(&r, 0, extents, 2, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -ERANGE);
+
+	/* Extent past the end of the namespace, and one wrapping around */
+	extents[2] = UT_NUM_BLOCKS - 4;
+	extents[3] = 5;
+	ut_req_init(&r, 0, extents, 2, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -ERANGE);
+
+	extents[2] = UINT64_MAX - 1;
+	extents[3] = 4;
+	ut_req_init(&r, 0, extents, 2, NULL);
+	rc = nvmf_ndp_desc_parse(&r.req, NULL, 0, &desc);
+	CU_ASSERT(rc == -ERANGE);
+	CU_ASSERT(desc.extents == NULL);
+}
+
+static void
+test_desc_parse_batch(void)
+{
+	struct nvmf_ndp_desc desc;
+	struct ut_req r;
+	uint64_t *w;
+	int rc;
+
+	/* File 7 with two extents and file 9 with one, then the arguments */
+	memset(&r, 0, sizeof(r));
+	r.req.cmd = &r.cmd;
+	r.req.rsp = &r.rsp;
+	r.cmd.nvme_cmd.cdw10 = SPDK_NVME_OPC_CUSTOM_GREP << 16 | 3;
+	r.cmd.nvme_cmd.cdw11 = 2;
+	r.cmd.nvme_cmd.cdw12 = 3;
+	w = r.buf;
+	*w++ = htole64(7);
+	*w++ = htole64(1000);
+	*w++ = htole64(2);
+	*w++ = htole64(10);
+	*w++ = htole64(1);
+	*w++ = htole64(0x100000000ULL);
+	*w++ = htole64(1);
+	*w++ = htole64(9);
+	*w++ = 0;
+	*w++ = htole64(1);
+	*w++ = htole64(50);
+	*w++ = htole64(4);
+	memcpy(w, "foo", 3);
+	r.req.length = sizeof(r.buf);
+	r.req.iovcnt = 1;
+	r.req.iov[0].iov_base = r.buf;
+	r.req.iov[0].iov_len = sizeof(r.buf);
+
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(desc.opc == SPDK_NVME_OPC_CUSTOM_GREP);
+	CU_ASSERT(desc.depth == NVMF_NDP_BATCH_DEPTH);
+	CU_ASSERT(desc.num_files == 2);
+	CU_ASSERT(desc.num_extents == 3);
+	CU_ASSERT(desc.files[0].id == 7);
+	CU_ASSERT(desc.files[0].length == 1000);
+	CU_ASSERT(desc.files[0].first_extent == 0);
+	CU_ASSERT(desc.files[0].num_extents == 2);
+	CU_ASSERT(desc.files[1].id == 9);
+	CU_ASSERT(desc.files[1].length == 0);
+	CU_ASSERT(desc.files[1].first_extent == 2);
+	CU_ASSERT(desc.files[1].num_extents == 1);
+	CU_ASSERT(desc.extents[1].offset_blocks == 0x100000000ULL);
+	CU_ASSERT(desc.extents[2].offset_blocks == 50);
+	CU_ASSERT(desc.extents[2].num_blocks == 4);
+	CU_ASSERT(strcmp(desc.args, "foo") == 0);
+	nvmf_ndp_desc_free(&desc);
+	CU_ASSERT(desc.files == NULL);
+
+	/* Files in flight are capped */
+	r.cmd.nvme_cmd.cdw13 = 0xFF;
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(desc.depth == NVMF_NDP_BATCH_MAX_DEPTH);
+	nvmf_ndp_desc_free(&desc);
+
+	/* Extents of the files not adding up to CDW12, either way */
+	r.cmd.nvme_cmd.cdw12 = 4;
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	r.cmd.nvme_cmd.cdw12 = 2;
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	r.cmd.nvme_cmd.cdw12 = 3;
+
+	/* No files, or more than the buffer holds */
+	r.cmd.nvme_cmd.cdw11 = 0;
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	r.cmd.nvme_cmd.cdw11 = 20;
+	r.cmd.nvme_cmd.cdw12 = 20;
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	r.cmd.nvme_cmd.cdw11 = 2;
+	r.cmd.nvme_cmd.cdw12 = 3;
+
+	/* Length of file 9 beyond its blocks */
+	r.buf[8] = htole64(4 * UT_BLOCK_SIZE + 1);
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == -EINVAL);
+	r.buf[8] = 0;
+
+	/* Extent past the end of the namespace */
+	r.buf[10] = htole64(UT_NUM_BLOCKS - 1);
+	rc = nvmf_ndp_desc_parse_batch(&r.req, NULL, 3, &desc);
+	CU_ASSERT(rc == -ERANGE);
+	CU_ASSERT(desc.files == NULL);
+	CU_ASSERT(desc.extents == NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_desc", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_desc_parse);
+	CU_ADD_TEST(suite, test_desc_parse_invalid);
+	CU_ADD_TEST(suite, test_desc_parse_batch);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
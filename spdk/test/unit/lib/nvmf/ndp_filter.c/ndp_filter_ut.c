@@ -0,0 +1,552 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_filter.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_OUT_SIZE	(64 * 1024)
+#define UT_PROG_SIZE	1024
+
+struct ut_sink {
+	char		buf[UT_OUT_SIZE];
+	size_t		len;
+	uint32_t	rows;
+	uint32_t	stop_after;
+	uint64_t	record_end;
+};
+
+/* Program under construction */
+struct ut_prog {
+	char		buf[UT_PROG_SIZE];
+	size_t		len;
+	uint16_t	num_insns;
+};
+
+static int
+ut_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct ut_sink *sink = cb_arg;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		SPDK_CU_ASSERT_FATAL(iov[i].iov_len > 0);
+		SPDK_CU_ASSERT_FATAL(sink->len + iov[i].iov_len < sizeof(sink->buf));
+		memcpy(sink->buf + sink->len, iov[i].iov_base, iov[i].iov_len);
+		sink->len += iov[i].iov_len;
+	}
+	CU_ASSERT(sink->buf[sink->len - 1] == '\n');
+	sink->buf[sink->len] = '\0';
+	sink->rows++;
+
+	return sink->stop_after != 0 && sink->rows == sink->stop_after ? 1 : 0;
+}
+
+static void
+ut_prog_init(struct ut_prog *prog, char delimiter, const uint16_t *columns, uint16_t num_columns)
+{
+	struct nvmf_ndp_filter_hdr *hdr = (struct nvmf_ndp_filter_hdr *)prog->buf;
+	uint16_t i;
+
+	memset(prog, 0, sizeof(*prog));
+	to_le32(&hdr->magic, NVMF_NDP_FILTER_MAGIC);
+	hdr->delimiter = delimiter;
+	to_le16(&hdr->num_columns, num_columns);
+	prog->len = sizeof(*hdr);
+
+	for (i = 0; i < num_columns; i++) {
+		to_le16(prog->buf + prog->len + i * sizeof(uint16_t), columns[i]);
+	}
+	prog->len += SPDK_ALIGN_CEIL(num_columns * sizeof(uint16_t), 8);
+}
+
+static void
+ut_prog_insn(struct ut_prog *prog, uint8_t op, uint8_t type, uint16_t column, const void *value,
+	     uint32_t len)
+{
+	struct nvmf_ndp_filter_hdr *hdr = (struct nvmf_ndp_filter_hdr *)prog->buf;
+	struct nvmf_ndp_filter_insn insn = {
+		.op = op,
+		.type = type,
+	};
+
+	to_le16(&insn.column, column);
+	to_le32(&insn.len, len);
+	SPDK_CU_ASSERT_FATAL(prog->len + sizeof(insn) + SPDK_ALIGN_CEIL(len, 8) <= UT_PROG_SIZE);
+	memcpy(prog->buf + prog->len, &insn, sizeof(insn));
+	prog->len += sizeof(insn);
+	if (len > 0) {
+		memcpy(prog->buf + prog->len, value, len);
+		prog->len += SPDK_ALIGN_CEIL(len, 8);
+	}
+	to_le16(&hdr->num_insns, ++prog->num_insns);
+}
+
+static void
+ut_prog_str(struct ut_prog *prog, uint8_t op, uint16_t column, const char *str)
+{
+	ut_prog_insn(prog, op, NVMF_NDP_FILTER_TYPE_STRING, column, str, strlen(str));
+}
+
+static void
+ut_prog_int(struct ut_prog *prog, uint8_t op, uint16_t column, int64_t val)
+{
+	uint64_t le;
+
+	to_le64(&le, (uint64_t)val);
+	ut_prog_insn(prog, op, NVMF_NDP_FILTER_TYPE_INT, column, &le, sizeof(le));
+}
+
+static void
+ut_prog_float(struct ut_prog *prog, uint8_t op, uint16_t column, double val)
+{
+	uint64_t bits, le;
+
+	memcpy(&bits, &val, sizeof(bits));
+	to_le64(&le, bits);
+	ut_prog_insn(prog, op, NVMF_NDP_FILTER_TYPE_FLOAT, column, &le, sizeof(le));
+}
+
+static void
+ut_prog_op(struct ut_prog *prog, uint8_t op)
+{
+	ut_prog_insn(prog, op, 0, 0, NULL, 0);
+}
+
+/* Feed text to the filter, split at record boundaries into iovecs of about iov_size bytes. */
+static int
+ut_filter(struct nvmf_ndp_filter *filter, const char *text, size_t iov_size,
+	  struct ut_sink *sink)
+{
+	struct iovec iov[4];
+	size_t off = 0, len = strlen(text), n;
+	const char *nl;
+	int iovcnt, rc;
+
+	while (off < len) {
+		for (iovcnt = 0; iovcnt < 4 && off < len; iovcnt++) {
+			n = spdk_min(iov_size, len - off);
+			/* Extend to the end of the record */
+			nl = memchr(text + off + n - 1, '\n', len - off - n + 1);
+			n = nl != NULL ? (size_t)(nl - text) + 1 - off : len - off;
+			iov[iovcnt].iov_base = (char *)text + off;
+			iov[iovcnt].iov_len = n;
+			off += n;
+		}
+		rc = nvmf_ndp_filter_scan(filter, iov, iovcnt, ut_match, sink);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static const char *g_csv =
+	"2024-01-01,GET,/index.html,200,512,0.25\n"
+	"2024-01-01,POST,/login,401,64,1.5\n"
+	"2024-01-02,GET,/images/logo.png,200,20480,0.75\n"
+	"2024-01-02,PUT,/upload,500,0,12.125\n"
+	"2024-01-03,GET,/missing\n"
+	"\n"
+	"2024-01-03,DELETE,/item/7,204,0,-0.5";
+
+static void
+ut_run(const struct ut_prog *prog, const char *text, const char *expected)
+{
+	struct nvmf_ndp_filter *filter;
+	struct ut_sink *sink;
+	size_t iov_size;
+
+	/* The result must not depend on how the records are grouped into iovecs */
+	for (iov_size = 1; iov_size <= 256; iov_size *= 4) {
+		sink = calloc(1, sizeof(*sink));
+		SPDK_CU_ASSERT_FATAL(sink != NULL);
+		filter = nvmf_ndp_filter_create(prog->buf, prog->len);
+		SPDK_CU_ASSERT_FATAL(filter != NULL);
+
+		CU_ASSERT(ut_filter(filter, text, iov_size, sink) == 0);
+		CU_ASSERT_STRING_EQUAL(sink->buf, expected);
+
+		nvmf_ndp_filter_free(filter);
+		free(sink);
+	}
+}
+
+static void
+test_filter_create(void)
+{
+	struct nvmf_ndp_filter *filter;
+	struct ut_prog prog;
+	uint16_t column = 3;
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	filter = nvmf_ndp_filter_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(filter != NULL);
+	CU_ASSERT(filter->num_fields == 2);
+	CU_ASSERT(filter->num_insns == 1);
+	nvmf_ndp_filter_free(filter);
+
+	/* Trailing bytes, e.g. the rest of the data buffer, are ignored */
+	filter = nvmf_ndp_filter_create(prog.buf, prog.len + 100);
+	CU_ASSERT(filter != NULL);
+	nvmf_ndp_filter_free(filter);
+
+	/* Selected columns are split too */
+	ut_prog_init(&prog, ',', &column, 1);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	filter = nvmf_ndp_filter_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(filter != NULL);
+	CU_ASSERT(filter->num_fields == 4);
+	nvmf_ndp_filter_free(filter);
+
+	/* Truncated */
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, sizeof(struct nvmf_ndp_filter_hdr) - 1) == NULL);
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len - 6) == NULL);
+
+	/* Bad magic */
+	prog.buf[0] ^= 0xff;
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	/* No instruction, everything matches */
+	ut_prog_init(&prog, ',', NULL, 0);
+	filter = nvmf_ndp_filter_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(filter != NULL);
+	CU_ASSERT(filter->num_fields == 0);
+	nvmf_ndp_filter_free(filter);
+
+	/* Newline delimiter */
+	ut_prog_init(&prog, '\n', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	/* Unbalanced stacks */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "PUT");
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_OR);
+	filter = nvmf_ndp_filter_create(prog.buf, prog.len);
+	CU_ASSERT(filter != NULL);
+	nvmf_ndp_filter_free(filter);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_AND);
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_NOT);
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	/* Bad operations, types and constants */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, 0, 1, "GET");
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_insn(&prog, NVMF_NDP_FILTER_OP_EQ, 3, 1, "GET", 3);
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_insn(&prog, NVMF_NDP_FILTER_OP_EQ, NVMF_NDP_FILTER_TYPE_INT, 1, "GET", 3);
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_CONTAINS, 1, 7);
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_CONTAINS, 1, "");
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, NVMF_NDP_FILTER_MAX_COLUMN + 1, "GET");
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+
+	column = NVMF_NDP_FILTER_MAX_COLUMN + 1;
+	ut_prog_init(&prog, ',', &column, 1);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	CU_ASSERT(nvmf_ndp_filter_create(prog.buf, prog.len) == NULL);
+}
+
+static void
+test_filter_compare(void)
+{
+	struct ut_prog prog;
+
+	/* Strings */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	ut_run(&prog, g_csv,
+	       "2024-01-01,GET,/index.html,200,512,0.25\n"
+	       "2024-01-02,GET,/images/logo.png,200,20480,0.75\n"
+	       "2024-01-03,GET,/missing\n");
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_GT, 1, "GET");
+	ut_run(&prog, g_csv,
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "2024-01-02,PUT,/upload,500,0,12.125\n");
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_CONTAINS, 2, "/i");
+	ut_run(&prog, g_csv,
+	       "2024-01-01,GET,/index.html,200,512,0.25\n"
+	       "2024-01-02,GET,/images/logo.png,200,20480,0.75\n"
+	       "2024-01-03,DELETE,/item/7,204,0,-0.5\n");
+
+	/* Prefixes are smaller */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_LT, 0, "2024-01-02");
+	ut_run(&prog, g_csv,
+	       "2024-01-01,GET,/index.html,200,512,0.25\n"
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "\n");
+
+	/* Integers; a missing or non numeric column never matches */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_GE, 3, 400);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "2024-01-02,PUT,/upload,500,0,12.125\n");
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_NE, 3, 200);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "2024-01-02,PUT,/upload,500,0,12.125\n"
+	       "2024-01-03,DELETE,/item/7,204,0,-0.5\n");
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_LT, 1, 1000);
+	ut_run(&prog, g_csv, "");
+
+	/* Floats */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_float(&prog, NVMF_NDP_FILTER_OP_GT, 5, 1.0);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "2024-01-02,PUT,/upload,500,0,12.125\n");
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_float(&prog, NVMF_NDP_FILTER_OP_LE, 5, 0.25);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,GET,/index.html,200,512,0.25\n"
+	       "2024-01-03,DELETE,/item/7,204,0,-0.5\n");
+}
+
+static void
+test_filter_numbers(void)
+{
+	int64_t val;
+	double fval;
+
+	CU_ASSERT(nvmf_ndp_parse_int("42", 2, &val) && val == 42);
+	CU_ASSERT(nvmf_ndp_parse_int(" -17 ", 5, &val) && val == -17);
+	CU_ASSERT(nvmf_ndp_parse_int("+3", 2, &val) && val == 3);
+	CU_ASSERT(nvmf_ndp_parse_int("9223372036854775807", 19, &val) && val == INT64_MAX);
+	CU_ASSERT(nvmf_ndp_parse_int("-9223372036854775808", 20, &val) && val == INT64_MIN);
+	CU_ASSERT(!nvmf_ndp_parse_int("9223372036854775808", 19, &val));
+	CU_ASSERT(!nvmf_ndp_parse_int("", 0, &val));
+	CU_ASSERT(!nvmf_ndp_parse_int("-", 1, &val));
+	CU_ASSERT(!nvmf_ndp_parse_int("12a", 3, &val));
+	CU_ASSERT(!nvmf_ndp_parse_int("1.5", 3, &val));
+	/* Eight digits at a time, with leading zeros and a scalar tail */
+	CU_ASSERT(nvmf_ndp_parse_int("12345678", 8, &val) && val == 12345678);
+	CU_ASSERT(nvmf_ndp_parse_int("1234567890123", 13, &val) && val == 1234567890123);
+	CU_ASSERT(nvmf_ndp_parse_int("-000000000000000000000042", 25, &val) && val == -42);
+	CU_ASSERT(nvmf_ndp_parse_int("0000000000", 10, &val) && val == 0);
+	CU_ASSERT(!nvmf_ndp_parse_int("1234567/", 8, &val));
+	CU_ASSERT(!nvmf_ndp_parse_int("123456:8", 8, &val));
+	CU_ASSERT(!nvmf_ndp_parse_int("12345678901234567890", 20, &val));
+
+	CU_ASSERT(nvmf_ndp_parse_float("1.5", 3, &fval) && fval == 1.5);
+	CU_ASSERT(nvmf_ndp_parse_float(" -2e3", 5, &fval) && fval == -2000.0);
+	/* Only the column is parsed, not what follows it */
+	CU_ASSERT(nvmf_ndp_parse_float("7,8", 1, &fval) && fval == 7.0);
+	CU_ASSERT(!nvmf_ndp_parse_float("", 0, &fval));
+	CU_ASSERT(!nvmf_ndp_parse_float("x1", 2, &fval));
+	CU_ASSERT(!nvmf_ndp_parse_float("nan", 3, &fval));
+	CU_ASSERT(!nvmf_ndp_parse_float(".", 1, &fval));
+	CU_ASSERT(!nvmf_ndp_parse_float("-", 1, &fval));
+	CU_ASSERT(!nvmf_ndp_parse_float("1.2.3", 5, &fval));
+	CU_ASSERT(nvmf_ndp_parse_float("42", 2, &fval) && fval == 42.0);
+	CU_ASSERT(nvmf_ndp_parse_float("-.5", 3, &fval) && fval == -0.5);
+	CU_ASSERT(nvmf_ndp_parse_float("3.", 2, &fval) && fval == 3.0);
+	CU_ASSERT(nvmf_ndp_parse_float("0.1", 3, &fval) && fval == 0.1);
+	CU_ASSERT(nvmf_ndp_parse_float("0.000123", 8, &fval) && fval == 0.000123);
+	CU_ASSERT(nvmf_ndp_parse_float("12345678.1234567", 16, &fval) && fval == 12345678.1234567);
+	/* Past 15 digits, and exponents, are left to strtod() */
+	CU_ASSERT(nvmf_ndp_parse_float("1234567890.123456789", 20, &fval) &&
+		  fval == 1234567890.123456789);
+	CU_ASSERT(nvmf_ndp_parse_float("1e-3", 4, &fval) && fval == 1e-3);
+}
+
+static void
+test_filter_logic(void)
+{
+	struct ut_prog prog;
+
+	/* $1 == GET and ($3 == 200 or $4 > 10000) */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_EQ, 3, 200);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_GT, 4, 10000);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_OR);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_AND);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,GET,/index.html,200,512,0.25\n"
+	       "2024-01-02,GET,/images/logo.png,200,20480,0.75\n");
+
+	/* not ($1 == GET) and $3 >= 400 */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_NOT);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_GE, 3, 400);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_AND);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "2024-01-02,PUT,/upload,500,0,12.125\n");
+
+	/* $1 == PUT or $1 == DELETE or $2 contains login, with the or on the left */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "PUT");
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "DELETE");
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_OR);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_CONTAINS, 2, "login");
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_OR);
+	ut_run(&prog, g_csv,
+	       "2024-01-01,POST,/login,401,64,1.5\n"
+	       "2024-01-02,PUT,/upload,500,0,12.125\n"
+	       "2024-01-03,DELETE,/item/7,204,0,-0.5\n");
+
+	/* A missing column is false, its negation true */
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_GE, 3, 0);
+	ut_prog_op(&prog, NVMF_NDP_FILTER_OP_NOT);
+	ut_run(&prog, g_csv, "2024-01-03,GET,/missing\n\n");
+}
+
+static void
+test_filter_project(void)
+{
+	const uint16_t columns[] = { 2, 3, 7 };
+	const uint16_t reorder[] = { 3, 1 };
+	struct ut_prog prog;
+
+	/* Missing columns are returned empty */
+	ut_prog_init(&prog, ',', columns, SPDK_COUNTOF(columns));
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	ut_run(&prog, g_csv,
+	       "/index.html,200,\n"
+	       "/images/logo.png,200,\n"
+	       "/missing,,\n");
+
+	ut_prog_init(&prog, ',', reorder, SPDK_COUNTOF(reorder));
+	ut_prog_int(&prog, NVMF_NDP_FILTER_OP_LT, 4, 100);
+	ut_run(&prog, g_csv,
+	       "401,POST\n"
+	       "500,PUT\n"
+	       "204,DELETE\n");
+
+	/* Without a predicate, every record is projected */
+	ut_prog_init(&prog, ',', columns, 1);
+	ut_run(&prog, g_csv,
+	       "/index.html\n/login\n/images/logo.png\n/upload\n/missing\n\n/item/7\n");
+
+	/* Tabs, and DOS line endings */
+	ut_prog_init(&prog, '\t', reorder, SPDK_COUNTOF(reorder));
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_NE, 3, "x");
+	ut_run(&prog, "a\tb\tc\td\r\ne\tf\tg\tx\r\ni\tj\tk\tl", "d\tb\nl\tj\n");
+}
+
+static void
+test_filter_wide(void)
+{
+	const uint16_t columns[] = { 40, 99 };
+	struct ut_prog prog;
+	char *text, *expected;
+	size_t len = 0, elen = 0;
+	int r, c;
+
+	/* Rows wide enough to take the vector path, with columns crossing vectors */
+	text = calloc(1, 64 * 1024);
+	expected = calloc(1, 64 * 1024);
+	SPDK_CU_ASSERT_FATAL(text != NULL && expected != NULL);
+	for (r = 0; r < 50; r++) {
+		for (c = 0; c < 100; c++) {
+			len += sprintf(text + len, "%s%d", c > 0 ? "|" : "", r * 1000 + c * (c % 7));
+		}
+		text[len++] = '\n';
+		if (r % 3 == 0) {
+			elen += sprintf(expected + elen, "%d|%d\n", r * 1000 + 40 * (40 % 7),
+					r * 1000 + 99 * (99 % 7));
+		}
+	}
+
+	/* $13 % 3 == 0, written as a list of ors */
+	ut_prog_init(&prog, '|', columns, SPDK_COUNTOF(columns));
+	for (r = 0; r < 50; r += 3) {
+		ut_prog_int(&prog, NVMF_NDP_FILTER_OP_EQ, 13, r * 1000 + 13 * (13 % 7));
+		if (r > 0) {
+			ut_prog_op(&prog, NVMF_NDP_FILTER_OP_OR);
+		}
+	}
+	ut_run(&prog, text, expected);
+
+	free(text);
+	free(expected);
+}
+
+static void
+test_filter_stop(void)
+{
+	struct nvmf_ndp_filter *filter;
+	struct ut_sink sink = {};
+	struct ut_prog prog;
+	struct iovec iov;
+	size_t first;
+
+	ut_prog_init(&prog, ',', NULL, 0);
+	ut_prog_str(&prog, NVMF_NDP_FILTER_OP_EQ, 1, "GET");
+	filter = nvmf_ndp_filter_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(filter != NULL);
+
+	/* The second match stops the scan, record_end points past it */
+	sink.stop_after = 2;
+	iov.iov_base = (char *)g_csv;
+	iov.iov_len = strlen(g_csv);
+	CU_ASSERT(nvmf_ndp_filter_scan(filter, &iov, 1, ut_match, &sink) == 1);
+	CU_ASSERT(sink.rows == 2);
+	first = strstr(g_csv, "2024-01-02,PUT") - g_csv;
+	CU_ASSERT(nvmf_ndp_filter_record_end(filter) == first);
+	nvmf_ndp_filter_free(filter);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_filter", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_filter_create);
+	CU_ADD_TEST(suite, test_filter_compare);
+	CU_ADD_TEST(suite, test_filter_numbers);
+	CU_ADD_TEST(suite, test_filter_logic);
+	CU_ADD_TEST(suite, test_filter_project);
+	CU_ADD_TEST(suite, test_filter_wide);
+	CU_ADD_TEST(suite, test_filter_stop);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
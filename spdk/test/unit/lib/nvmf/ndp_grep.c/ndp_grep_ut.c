@@ -0,0 +1,379 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_grep.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_OUT_SIZE	(64 * 1024)
+
+struct ut_sink {
+	char		buf[UT_OUT_SIZE];
+	size_t		len;
+	uint32_t	lines;
+	uint32_t	stop_after;
+};
+
+static int
+ut_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct ut_sink *sink = cb_arg;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		SPDK_CU_ASSERT_FATAL(iov[i].iov_len > 0);
+		SPDK_CU_ASSERT_FATAL(sink->len + iov[i].iov_len < sizeof(sink->buf));
+		memcpy(sink->buf + sink->len, iov[i].iov_base, iov[i].iov_len);
+		sink->len += iov[i].iov_len;
+	}
+	if (sink->buf[sink->len - 1] != '\n') {
+		sink->buf[sink->len++] = '\n';
+	}
+	sink->buf[sink->len] = '\0';
+	sink->lines++;
+
+	return sink->stop_after != 0 && sink->lines == sink->stop_after ? 1 : 0;
+}
+
+/* Feed text to grep as iovecs of iov_size bytes, call_iovs of them per scan call. */
+static int
+ut_grep(struct nvmf_ndp_grep *grep, const char *text, size_t len, size_t iov_size,
+	int call_iovs, struct ut_sink *sink)
+{
+	struct iovec iov[16];
+	size_t off = 0;
+	int n, rc;
+
+	SPDK_CU_ASSERT_FATAL(call_iovs <= 16);
+	while (off < len) {
+		for (n = 0; n < call_iovs && off < len; n++) {
+			iov[n].iov_base = (char *)text + off;
+			iov[n].iov_len = spdk_min(iov_size, len - off);
+			off += iov[n].iov_len;
+		}
+		rc = nvmf_ndp_grep_scan(grep, iov, n, ut_match, sink);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+	return nvmf_ndp_grep_finish(grep, ut_match, sink);
+}
+
+/* Straightforward reference: split into lines, memmem() every keyword. */
+static void
+ut_naive_grep(const char *patterns, size_t patterns_len, const char *text, size_t len,
+	      struct ut_sink *sink)
+{
+	const char *line = text, *end = text + len, *nl, *p, *pend, *pnl;
+	size_t line_len;
+	bool match;
+
+	while (line < end) {
+		nl = memchr(line, '\n', end - line);
+		line_len = nl != NULL ? (size_t)(nl - line + 1) : (size_t)(end - line);
+
+		match = false;
+		pend = patterns + patterns_len;
+		for (p = patterns; p < pend && !match; p = pnl + 1) {
+			pnl = memchr(p, '\n', pend - p);
+			if (pnl == NULL) {
+				pnl = pend;
+			}
+			if (pnl > p && memmem(line, line_len, p, pnl - p) != NULL) {
+				match = true;
+			}
+		}
+
+		if (match) {
+			memcpy(sink->buf + sink->len, line, line_len);
+			sink->len += line_len;
+			if (line[line_len - 1] != '\n') {
+				sink->buf[sink->len++] = '\n';
+			}
+			sink->buf[sink->len] = '\0';
+			sink->lines++;
+		}
+		line += line_len;
+	}
+}
+
+static void
+test_grep_create(void)
+{
+	struct nvmf_ndp_grep *grep;
+	char *big;
+
+	grep = nvmf_ndp_grep_create("foo", 3, 0);
+	SPDK_CU_ASSERT_FATAL(grep != NULL);
+	CU_ASSERT(nvmf_ndp_grep_num_patterns(grep) == 1);
+	CU_ASSERT(grep->max_line_len == NVMF_NDP_STREAM_MAX_RECORD_LEN);
+	nvmf_ndp_grep_free(grep);
+
+	/* Empty lines and duplicates are ignored */
+	grep = nvmf_ndp_grep_create("foo\n\nbar\nfoo\n", 13, 0);
+	SPDK_CU_ASSERT_FATAL(grep != NULL);
+	CU_ASSERT(nvmf_ndp_grep_num_patterns(grep) == 2);
+	nvmf_ndp_grep_free(grep);
+
+	CU_ASSERT(nvmf_ndp_grep_create("", 0, 0) == NULL);
+	CU_ASSERT(nvmf_ndp_grep_create("\n\n", 2, 0) == NULL);
+
+	big = malloc(NVMF_NDP_GREP_MAX_PATTERN_LEN + 1);
+	SPDK_CU_ASSERT_FATAL(big != NULL);
+	memset(big, 'a', NVMF_NDP_GREP_MAX_PATTERN_LEN + 1);
+	CU_ASSERT(nvmf_ndp_grep_create(big, NVMF_NDP_GREP_MAX_PATTERN_LEN + 1, 0) == NULL);
+	grep = nvmf_ndp_grep_create(big, NVMF_NDP_GREP_MAX_PATTERN_LEN, 0);
+	CU_ASSERT(grep != NULL);
+	nvmf_ndp_grep_free(grep);
+	free(big);
+}
+
+static void
+test_grep_multi_pattern(void)
+{
+	const char *text = "ushers\nhis\nthe\nnothing\nhe\nshe sells\nxhisx";
+	struct nvmf_ndp_grep *grep;
+	struct ut_sink sink = {};
+	int rc;
+
+	/* Overlapping keywords exercise the failure links */
+	grep = nvmf_ndp_grep_create("he\nshe\nhis\nhers", 15, 0);
+	SPDK_CU_ASSERT_FATAL(grep != NULL);
+	CU_ASSERT(nvmf_ndp_grep_num_patterns(grep) == 4);
+
+	rc = ut_grep(grep, text, strlen(text), strlen(text), 1, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(sink.lines == 6);
+	CU_ASSERT(strcmp(sink.buf, "ushers\nhis\nthe\nhe\nshe sells\nxhisx\n") == 0);
+
+	/* The engine is reset for new input after finish */
+	memset(&sink, 0, sizeof(sink));
+	rc = ut_grep(grep, "nope\nshe", 8, 8, 1, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(strcmp(sink.buf, "she\n") == 0);
+
+	nvmf_ndp_grep_free(grep);
+}
+
+static void
+test_grep_boundaries(void)
+{
+	const char *text = "first line\nsecond keyword line\nthird\nkeyword\nlast keyword";
+	const char *expected = "second keyword line\nkeyword\nlast keyword\n";
+	struct nvmf_ndp_grep *grep;
+	struct ut_sink sink;
+	size_t iov_size;
+	int call_iovs, rc;
+
+	grep = nvmf_ndp_grep_create("keyword\n", 8, 0);
+	SPDK_CU_ASSERT_FATAL(grep != NULL);
+
+	/* Lines and keywords split at every possible place, within and across calls */
+	for (iov_size = 1; iov_size <= strlen(text); iov_size++) {
+		for (call_iovs = 1; call_iovs <= 3; call_iovs++) {
+			memset(&sink, 0, sizeof(sink));
+			rc = ut_grep(grep, text, strlen(text), iov_size, call_iovs, &sink);
+			CU_ASSERT(rc == 0);
+			CU_ASSERT(sink.lines == 3);
+			CU_ASSERT(strcmp(sink.buf, expected) == 0);
+		}
+	}
+
+	nvmf_ndp_grep_free(grep);
+}
+
+static void
+test_grep_long_line(void)
+{
+	char text[256];
+	struct nvmf_ndp_grep *grep;
+	struct ut_sink sink = {};
+	int rc;
+
+	/* Line of 100 bytes with the keyword at its end, max_line_len of 16 */
+	memset(text, 'x', 100);
+	memcpy(text + 96, "key\n", 4);
+	memcpy(text + 100, "key short\n", 10);
+
+	grep = nvmf_ndp_grep_create("key", 3, 16);
+	SPDK_CU_ASSERT_FATAL(grep != NULL);
+
+	/* Within a single call the whole line is reported */
+	rc = ut_grep(grep, text, 110, 110, 1, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(sink.lines == 2);
+	CU_ASSERT(sink.len == 110);
+
+	/* Across calls only the first max_line_len bytes are kept */
+	memset(&sink, 0, sizeof(sink));
+	rc = ut_grep(grep, text, 110, 10, 1, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(sink.lines == 2);
+	CU_ASSERT(sink.len == 17 + 10);
+	CU_ASSERT(memcmp(sink.buf, "xxxxxxxxxxxxxxxx\nkey short\n", 27) == 0);
+
+	nvmf_ndp_grep_free(grep);
+}
+
+static void
+test_grep_stop(void)
+{
+	const char *text = "a1\na2\nb\na3\n";
+	struct nvmf_ndp_grep *grep;
+	struct ut_sink sink = { .stop_after = 2 };
+	struct iovec iov = { .iov_base = (void *)text, .iov_len = strlen(text) };
+	int rc;
+
+	grep = nvmf_ndp_grep_create("a", 1, 0);
+	SPDK_CU_ASSERT_FATAL(grep != NULL);
+
+	rc = nvmf_ndp_grep_scan(grep, &iov, 1, ut_match, &sink);
+	CU_ASSERT(rc == 1);
+	CU_ASSERT(sink.lines == 2);
+	CU_ASSERT(strcmp(sink.buf, "a1\na2\n") == 0);
+
+	nvmf_ndp_grep_free(grep);
+}
+
+struct ut_line_ends {
+	struct nvmf_ndp_grep	*grep;
+	uint64_t		ends[8];
+	int			num;
+};
+
+static int
+ut_match_end(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct ut_line_ends *e = cb_arg;
+
+	SPDK_CU_ASSERT_FATAL(e->num < 8);
+	e->ends[e->num++] = nvmf_ndp_grep_line_end(e->grep);
+
+	return 0;
+}
+
+static void
+test_grep_line_end(void)
+{
+	const char *text = "xa\nb\nc\nab\nbbbbbbbbb\nlast a";
+	struct ut_line_ends e = {};
+	struct iovec iov[3];
+	int rc;
+
+	e.grep = nvmf_ndp_grep_create("a", 1, 4);
+	SPDK_CU_ASSERT_FATAL(e.grep != NULL);
+
+	/* Offsets count across calls and iovecs, also for truncated lines */
+	iov[0].iov_base = (void *)text;
+	iov[0].iov_len = 5;
+	iov[1].iov_base = (void *)(text + 5);
+	iov[1].iov_len = 4;
+	rc = nvmf_ndp_grep_scan(e.grep, iov, 2, ut_match_end, &e);
+	CU_ASSERT(rc == 0);
+	iov[2].iov_base = (void *)(text + 9);
+	iov[2].iov_len = strlen(text) - 9;
+	rc = nvmf_ndp_grep_scan(e.grep, &iov[2], 1, ut_match_end, &e);
+	CU_ASSERT(rc == 0);
+	rc = nvmf_ndp_grep_finish(e.grep, ut_match_end, &e);
+	CU_ASSERT(rc == 0);
+
+	SPDK_CU_ASSERT_FATAL(e.num == 3);
+	CU_ASSERT(e.ends[0] == 3);
+	CU_ASSERT(e.ends[1] == 10);
+	CU_ASSERT(e.ends[2] == strlen(text));
+
+	/* Finishing starts new input */
+	e.num = 0;
+	iov[0].iov_base = (void *)text;
+	iov[0].iov_len = 3;
+	rc = nvmf_ndp_grep_scan(e.grep, iov, 1, ut_match_end, &e);
+	CU_ASSERT(e.num == 1);
+	CU_ASSERT(e.ends[0] == 3);
+
+	nvmf_ndp_grep_free(e.grep);
+}
+
+static void
+test_grep_random(void)
+{
+	/* Includes bytes with more than 8 different high nibbles */
+	const char alphabet[] = "abcab\n\n\x81\x92\xa3\xb4\xc5\xd6\xe7\xf8 ";
+	char text[4096], patterns[64];
+	struct nvmf_ndp_grep *grep;
+	struct ut_sink *sink, *ref;
+	size_t patterns_len, iov_size, i, k;
+	unsigned int seed = 0x5eed;
+	int iter, call_iovs, rc;
+	char c;
+
+	sink = calloc(1, sizeof(*sink));
+	ref = calloc(1, sizeof(*ref));
+	SPDK_CU_ASSERT_FATAL(sink != NULL && ref != NULL);
+
+	for (iter = 0; iter < 200; iter++) {
+		for (i = 0; i < sizeof(text); i++) {
+			text[i] = alphabet[rand_r(&seed) % (sizeof(alphabet) - 1)];
+		}
+
+		/* 1 to 4 keywords of 1 to 6 bytes */
+		patterns_len = 0;
+		for (k = 1 + rand_r(&seed) % 4; k > 0; k--) {
+			for (i = 1 + rand_r(&seed) % 6; i > 0; i--) {
+				do {
+					c = alphabet[rand_r(&seed) % (sizeof(alphabet) - 1)];
+				} while (c == '\n');
+				patterns[patterns_len++] = c;
+			}
+			patterns[patterns_len++] = '\n';
+		}
+
+		grep = nvmf_ndp_grep_create(patterns, patterns_len, 0);
+		SPDK_CU_ASSERT_FATAL(grep != NULL);
+
+		memset(sink, 0, sizeof(*sink));
+		memset(ref, 0, sizeof(*ref));
+		ut_naive_grep(patterns, patterns_len, text, sizeof(text), ref);
+		iov_size = 1 + rand_r(&seed) % 700;
+		call_iovs = 1 + rand_r(&seed) % 4;
+		rc = ut_grep(grep, text, sizeof(text), iov_size, call_iovs, sink);
+		CU_ASSERT(rc == 0);
+		CU_ASSERT(sink->lines == ref->lines);
+		CU_ASSERT(sink->len == ref->len);
+		CU_ASSERT(memcmp(sink->buf, ref->buf, ref->len) == 0);
+
+		nvmf_ndp_grep_free(grep);
+	}
+
+	free(sink);
+	free(ref);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_grep", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_grep_create);
+	CU_ADD_TEST(suite, test_grep_multi_pattern);
+	CU_ADD_TEST(suite, test_grep_boundaries);
+	CU_ADD_TEST(suite, test_grep_long_line);
+	CU_ADD_TEST(suite, test_grep_stop);
+	CU_ADD_TEST(suite, test_grep_line_end);
+	CU_ADD_TEST(suite, test_grep_random);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,373 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_he_ct.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+DEFINE_STUB(nvmf_ndp_he_ntt_get, const struct nvmf_ndp_he_ntt *, (uint64_t q, uint32_t log_n),
+	    NULL);
+DEFINE_STUB_V(nvmf_ndp_he_ntt_forward, (const struct nvmf_ndp_he_ntt *ntt, uint64_t *a));
+DEFINE_STUB_V(nvmf_ndp_he_ntt_inverse, (const struct nvmf_ndp_he_ntt *ntt, uint64_t *a));
+DEFINE_STUB_V(nvmf_ndp_he_ntt_tensor, (const struct nvmf_ndp_he_ntt *ntt, const uint64_t *a1,
+				       const uint64_t *b1, const uint64_t *a2, const uint64_t *b2,
+				       uint64_t *c0, uint64_t *c1, uint64_t *c2));
+
+#define UT_LOG_N	3
+#define UT_MAX_WORDS	3
+#define UT_CT_SIZE	(sizeof(struct nvmf_ndp_he_ct) + \
+			 (2 << UT_LOG_N) * UT_MAX_WORDS * sizeof(uint64_t))
+
+struct ut_ct {
+	struct nvmf_ndp_he_ct	hdr;
+	uint64_t		words[(2 << UT_LOG_N) * UT_MAX_WORDS];
+};
+
+/* 1 modulo 2N, not all of them prime, which add and sub don't need */
+static const uint64_t g_ut_primes[UT_MAX_WORDS] = { 17, 97, (1ull << 61) - 15 };
+
+struct ut_rns_ct {
+	struct nvmf_ndp_he_ct	hdr;
+	uint64_t		primes[8];
+	uint64_t		words[(3 << UT_LOG_N) * UT_MAX_WORDS];
+};
+
+static void
+ut_ct_init(struct ut_ct *ct, uint32_t log_q, uint64_t seed)
+{
+	uint32_t i, num_words = SPDK_CEIL_DIV(log_q, 64);
+	uint64_t mask = log_q % 64 ? (1ull << (log_q % 64)) - 1 : UINT64_MAX;
+
+	memset(ct, 0, sizeof(*ct));
+	ct->hdr.magic = NVMF_NDP_HE_CT_MAGIC;
+	ct->hdr.version = NVMF_NDP_HE_CT_VERSION;
+	ct->hdr.log_n = UT_LOG_N;
+	ct->hdr.log_q = log_q;
+	ct->hdr.log_p = 30;
+	ct->hdr.log_slots = 2;
+	ct->hdr.num_words = num_words;
+
+	for (i = 0; i < (2u << UT_LOG_N) * num_words; i++) {
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		ct->words[i] = seed;
+		if (i % num_words == num_words - 1) {
+			ct->words[i] &= mask;
+		}
+	}
+}
+
+static void
+ut_rns_ct_init(struct ut_rns_ct *ct, uint32_t num_primes, uint64_t seed)
+{
+	uint32_t i, prime;
+
+	memset(ct, 0, sizeof(*ct));
+	ct->hdr.magic = NVMF_NDP_HE_CT_MAGIC;
+	ct->hdr.version = NVMF_NDP_HE_CT_VERSION;
+	ct->hdr.flags = NVMF_NDP_HE_CT_F_RNS;
+	ct->hdr.log_n = UT_LOG_N;
+	ct->hdr.log_q = 70;
+	ct->hdr.log_p = 30;
+	ct->hdr.log_slots = 2;
+	ct->hdr.num_words = num_primes;
+	memcpy(ct->primes, g_ut_primes, num_primes * sizeof(uint64_t));
+
+	/* Polynomial major, then prime major */
+	for (i = 0; i < (2u << UT_LOG_N) * num_primes; i++) {
+		prime = (i >> UT_LOG_N) % num_primes;
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		ct->words[i] = seed % g_ut_primes[prime];
+	}
+}
+
+static void
+test_he_ct_check(void)
+{
+	struct ut_ct ct;
+	size_t size;
+
+	ut_ct_init(&ct, 100, 1);
+	size = nvmf_ndp_he_ct_size(&ct.hdr);
+	CU_ASSERT(size == sizeof(ct.hdr) + 16 * 2 * sizeof(uint64_t));
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == 0);
+
+	/* Truncated */
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size - 1) == -EINVAL);
+
+	/* Not packed: taken as serialized by the library */
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct.hdr) - 1) == -ENOENT);
+	ct.hdr.magic = 0;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == -ENOENT);
+	ct.hdr.magic = NVMF_NDP_HE_CT_MAGIC;
+
+	ct.hdr.version = 2;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == -EINVAL);
+	ct.hdr.version = NVMF_NDP_HE_CT_VERSION;
+
+	/* Word count not matching log q */
+	ct.hdr.num_words = 1;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == -EINVAL);
+	ct.hdr.num_words = 2;
+
+	ct.hdr.log_n = NVMF_NDP_HE_CT_MAX_LOG_N + 1;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == -EINVAL);
+	ct.hdr.log_n = UT_LOG_N;
+
+	ct.hdr.log_slots = UT_LOG_N;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == -EINVAL);
+	ct.hdr.log_slots = 2;
+
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == 0);
+
+	/* Products have a third polynomial */
+	ct.hdr.num_polys = 3;
+	CU_ASSERT(nvmf_ndp_he_ct_size(&ct.hdr) == size + 8 * 2 * sizeof(uint64_t));
+	ct.hdr.num_polys = 1;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == -EINVAL);
+	ct.hdr.num_polys = 0;
+
+	/* Evaluation form only exists for RNS */
+	ct.hdr.flags = NVMF_NDP_HE_CT_F_NTT;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == -EINVAL);
+	ct.hdr.flags = 1u << 2;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct)) == -EINVAL);
+}
+
+static void
+test_he_ct_get(void)
+{
+	struct ut_ct cts[2];
+	struct nvmf_ndp_he_ct *ct = NULL;
+	size_t size;
+
+	ut_ct_init(&cts[1], 100, 1);
+	size = nvmf_ndp_he_ct_size(&cts[1].hdr);
+	memset(&cts[0], 0, sizeof(cts[0]));
+
+	/* At an offset in the file */
+	CU_ASSERT(nvmf_ndp_he_ct_get(cts, sizeof(cts[0]) + size, sizeof(cts[0]), &ct) == 0);
+	CU_ASSERT(ct == &cts[1].hdr);
+	CU_ASSERT(nvmf_ndp_he_ct_get(cts, sizeof(cts[0]) + size - 1, sizeof(cts[0]),
+				     &ct) == -EINVAL);
+	CU_ASSERT(nvmf_ndp_he_ct_get(cts, sizeof(cts), 0, &ct) == -ENOENT);
+
+	/* Offsets at or past the end of the file, which the length left would wrap */
+	ct = NULL;
+	CU_ASSERT(nvmf_ndp_he_ct_get(cts, sizeof(cts), sizeof(cts), &ct) == -EINVAL);
+	CU_ASSERT(nvmf_ndp_he_ct_get(cts, sizeof(cts), sizeof(cts) + 8, &ct) == -EINVAL);
+	CU_ASSERT(nvmf_ndp_he_ct_get(cts, sizeof(cts), UINT64_MAX, &ct) == -EINVAL);
+	CU_ASSERT(ct == NULL);
+}
+
+static void
+test_he_ct_check_rns(void)
+{
+	struct ut_rns_ct ct;
+	size_t size;
+
+	ut_rns_ct_init(&ct, 3, 1);
+	size = nvmf_ndp_he_ct_size(&ct.hdr);
+	/* Primes padded to 64 bytes */
+	CU_ASSERT(size == sizeof(ct.hdr) + 64 + 2 * 3 * 8 * sizeof(uint64_t));
+	CU_ASSERT((uint8_t *)nvmf_ndp_he_ct_words(&ct.hdr) == (uint8_t *)ct.words);
+	CU_ASSERT(nvmf_ndp_he_ct_residues(&ct.hdr, 1, 2) == &ct.words[5 * 8]);
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size - 1) == -EINVAL);
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, sizeof(ct.hdr) + 8) == -EINVAL);
+
+	ct.hdr.flags |= NVMF_NDP_HE_CT_F_NTT;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == 0);
+
+	/* Not 1 modulo 2N, or too wide for lazy reduction */
+	ct.primes[1] = 33;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == 0);
+	ct.primes[1] = 35;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == -EINVAL);
+	ct.primes[1] = (1ull << 62) + 1;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == -EINVAL);
+	ct.primes[1] = g_ut_primes[1];
+
+	ct.hdr.num_words = 0;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == -EINVAL);
+	ct.hdr.num_words = NVMF_NDP_HE_CT_MAX_PRIMES + 1;
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, SIZE_MAX) == -EINVAL);
+	ct.hdr.num_words = 3;
+
+	CU_ASSERT(nvmf_ndp_he_ct_check(&ct, size) == 0);
+}
+
+/* Compare against 128 bit arithmetic, for log q up to 128 */
+static void
+ut_he_ct_arith(uint32_t log_q, bool sub)
+{
+	struct ut_ct a, b, out;
+	uint32_t i, num_words = SPDK_CEIL_DIV(log_q, 64);
+	unsigned __int128 x, y, z, mask;
+	int rc;
+
+	mask = log_q == 128 ? ~(unsigned __int128)0 : ((unsigned __int128)1 << log_q) - 1;
+	ut_ct_init(&a, log_q, 1);
+	ut_ct_init(&b, log_q, 2);
+	memset(&out, 0xff, sizeof(out));
+
+	rc = sub ? nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &out, sizeof(out)) :
+	     nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &out, sizeof(out));
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(memcmp(&out.hdr, &a.hdr, sizeof(a.hdr)) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_check(&out, sizeof(out)) == 0);
+
+	for (i = 0; i < (2u << UT_LOG_N); i++) {
+		x = a.words[i * num_words];
+		y = b.words[i * num_words];
+		z = out.words[i * num_words];
+		if (num_words == 2) {
+			x |= (unsigned __int128)a.words[i * num_words + 1] << 64;
+			y |= (unsigned __int128)b.words[i * num_words + 1] << 64;
+			z |= (unsigned __int128)out.words[i * num_words + 1] << 64;
+		}
+		CU_ASSERT(z == ((sub ? x - y : x + y) & mask));
+	}
+
+	/* In place, the result replacing the first input */
+	rc = sub ? nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &a, sizeof(a)) :
+	     nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &a, sizeof(a));
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(memcmp(&a, &out, nvmf_ndp_he_ct_size(&out.hdr)) == 0);
+}
+
+static void
+test_he_ct_add(void)
+{
+	struct ut_ct a, b;
+	uint8_t out[UT_CT_SIZE];
+
+	ut_he_ct_arith(30, false);
+	ut_he_ct_arith(64, false);
+	ut_he_ct_arith(100, false);
+	ut_he_ct_arith(128, false);
+
+	/* Carry across all words, wrapping to 0 */
+	ut_ct_init(&a, 128, 1);
+	ut_ct_init(&b, 128, 1);
+	a.words[0] = a.words[1] = UINT64_MAX;
+	b.words[0] = 1;
+	b.words[1] = 0;
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &a, sizeof(a)) == 0);
+	CU_ASSERT(a.words[0] == 0 && a.words[1] == 0);
+
+	/* Parameters differ */
+	ut_ct_init(&a, 100, 1);
+	ut_ct_init(&b, 100, 2);
+	b.hdr.log_p = 20;
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, out, sizeof(out)) == -EINVAL);
+	ut_ct_init(&b, 120, 2);
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, out, sizeof(out)) == -EINVAL);
+
+	/* Output too small */
+	ut_ct_init(&b, 100, 2);
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, out,
+				     nvmf_ndp_he_ct_size(&a.hdr) - 1) == -ENOSPC);
+}
+
+static void
+test_he_ct_sub(void)
+{
+	struct ut_ct a, b;
+
+	ut_he_ct_arith(30, true);
+	ut_he_ct_arith(64, true);
+	ut_he_ct_arith(100, true);
+	ut_he_ct_arith(128, true);
+
+	/* Borrow across all words, wrapping around 2^log q */
+	ut_ct_init(&a, 100, 1);
+	ut_ct_init(&b, 100, 1);
+	a.words[0] = a.words[1] = 0;
+	b.words[0] = 1;
+	b.words[1] = 0;
+	CU_ASSERT(nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &a, sizeof(a)) == 0);
+	CU_ASSERT(a.words[0] == UINT64_MAX && a.words[1] == (1ull << 36) - 1);
+
+	/* Subtracting from itself */
+	ut_ct_init(&a, 100, 3);
+	CU_ASSERT(nvmf_ndp_he_ct_sub(&a.hdr, &a.hdr, &a, sizeof(a)) == 0);
+	CU_ASSERT(spdk_mem_all_zero(a.words, (2 << UT_LOG_N) * 2 * sizeof(uint64_t)));
+}
+
+static void
+test_he_ct_arith_rns(void)
+{
+	struct ut_rns_ct a, b, sum, diff;
+	uint64_t q, x, y;
+	uint32_t i, prime;
+
+	ut_rns_ct_init(&a, 3, 1);
+	ut_rns_ct_init(&b, 3, 2);
+	/* Both ends of the range */
+	a.words[0] = g_ut_primes[0] - 1;
+	b.words[0] = g_ut_primes[0] - 1;
+	a.words[1] = 0;
+	b.words[1] = g_ut_primes[0] - 1;
+
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &sum, sizeof(sum)) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &diff, sizeof(diff)) == 0);
+	CU_ASSERT(memcmp(&sum, &a, sizeof(a.hdr) + sizeof(a.primes)) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_check(&sum, sizeof(sum)) == 0);
+
+	for (i = 0; i < (2u << UT_LOG_N) * 3; i++) {
+		prime = (i >> UT_LOG_N) % 3;
+		q = g_ut_primes[prime];
+		x = a.words[i];
+		y = b.words[i];
+		CU_ASSERT(sum.words[i] == (uint64_t)(((unsigned __int128)x + y) % q));
+		CU_ASSERT(diff.words[i] == (uint64_t)(((unsigned __int128)x + q - y) % q));
+	}
+
+	/* In place */
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &a, sizeof(a)) == 0);
+	CU_ASSERT(memcmp(&a, &sum, nvmf_ndp_he_ct_size(&sum.hdr)) == 0);
+
+	/* Primes, form or polynomial count differing */
+	ut_rns_ct_init(&a, 3, 1);
+	b.primes[2] = 113;
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &sum, sizeof(sum)) == -EINVAL);
+	ut_rns_ct_init(&b, 2, 2);
+	CU_ASSERT(nvmf_ndp_he_ct_add(&a.hdr, &b.hdr, &sum, sizeof(sum)) == -EINVAL);
+	ut_rns_ct_init(&b, 3, 2);
+	b.hdr.flags |= NVMF_NDP_HE_CT_F_NTT;
+	CU_ASSERT(nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &sum, sizeof(sum)) == -EINVAL);
+	b.hdr.flags = NVMF_NDP_HE_CT_F_RNS;
+	b.hdr.num_polys = 3;
+	CU_ASSERT(nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &sum, sizeof(sum)) == -EINVAL);
+	b.hdr.num_polys = 2;
+	CU_ASSERT(nvmf_ndp_he_ct_sub(&a.hdr, &b.hdr, &sum, sizeof(sum)) == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_he_ct", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_he_ct_check);
+	CU_ADD_TEST(suite, test_he_ct_get);
+	CU_ADD_TEST(suite, test_he_ct_check_rns);
+	CU_ADD_TEST(suite, test_he_ct_add);
+	CU_ADD_TEST(suite, test_he_ct_sub);
+	CU_ADD_TEST(suite, test_he_ct_arith_rns);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,327 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_he_ntt.c"
+#include "nvmf/ndp_he_ct.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_LOG_N	4
+#define UT_N		(1u << UT_LOG_N)
+#define UT_NUM_PRIMES	3
+
+/* 1 modulo 2^12, of 62, 50 and 30 bits */
+static const uint64_t g_ut_primes[UT_NUM_PRIMES] = {
+	4611686018427322369ull, 1125899906826241ull, 1073692673ull
+};
+
+struct ut_rns_ct {
+	struct nvmf_ndp_he_ct	hdr;
+	uint64_t		primes[8];
+	uint64_t		words[3 * UT_NUM_PRIMES * UT_N];
+};
+
+static uint64_t
+ut_rand(uint64_t *seed)
+{
+	*seed = *seed * 6364136223846793005ull + 1442695040888963407ull;
+	return *seed ^ (*seed >> 29);
+}
+
+/* Negacyclic product modulo X^n + 1 and q, the textbook way */
+static void
+ut_negacyclic(const uint64_t *x, const uint64_t *y, uint64_t *z, uint64_t n, uint64_t q)
+{
+	uint64_t i, j, p;
+
+	memset(z, 0, n * sizeof(*z));
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			p = (uint64_t)((unsigned __int128)x[i] * y[j] % q);
+			if (i + j < n) {
+				z[i + j] = (uint64_t)(((unsigned __int128)z[i + j] + p) % q);
+			} else {
+				z[i + j - n] = (uint64_t)(((unsigned __int128)z[i + j - n] + q - p) % q);
+			}
+		}
+	}
+}
+
+static void
+ut_rns_ct_init(struct ut_rns_ct *ct, uint64_t seed)
+{
+	uint32_t i;
+
+	memset(ct, 0, sizeof(*ct));
+	ct->hdr.magic = NVMF_NDP_HE_CT_MAGIC;
+	ct->hdr.version = NVMF_NDP_HE_CT_VERSION;
+	ct->hdr.flags = NVMF_NDP_HE_CT_F_RNS;
+	ct->hdr.log_n = UT_LOG_N;
+	ct->hdr.log_q = 142;
+	ct->hdr.log_p = 30;
+	ct->hdr.log_slots = 2;
+	ct->hdr.num_words = UT_NUM_PRIMES;
+	memcpy(ct->primes, g_ut_primes, sizeof(g_ut_primes));
+
+	for (i = 0; i < 2 * UT_NUM_PRIMES * UT_N; i++) {
+		ct->words[i] = ut_rand(&seed) % g_ut_primes[(i / UT_N) % UT_NUM_PRIMES];
+	}
+}
+
+static uint64_t *
+ut_residues(struct ut_rns_ct *ct, uint32_t poly, uint32_t prime)
+{
+	return &ct->words[(poly * UT_NUM_PRIMES + prime) * UT_N];
+}
+
+static void
+test_he_ntt_get(void)
+{
+	const struct nvmf_ndp_he_ntt *ntt;
+
+	ntt = nvmf_ndp_he_ntt_get(g_ut_primes[0], UT_LOG_N);
+	SPDK_CU_ASSERT_FATAL(ntt != NULL);
+	CU_ASSERT(ntt->q == g_ut_primes[0]);
+	CU_ASSERT(ntt->roots[0] == 1);
+	/* psi, at bitrev(1), and psi^N = -1 */
+	CU_ASSERT(ntt->roots[1] == ntt_powmod(ntt->roots[UT_N / 2], UT_N / 2, ntt->q));
+	CU_ASSERT(ntt_powmod(ntt->roots[UT_N / 2], UT_N, ntt->q) == ntt->q - 1);
+
+	/* Cached */
+	CU_ASSERT(nvmf_ndp_he_ntt_get(g_ut_primes[0], UT_LOG_N) == ntt);
+	CU_ASSERT(nvmf_ndp_he_ntt_get(g_ut_primes[0], UT_LOG_N + 1) != ntt);
+
+	/* Composite, 1 modulo 2N: 17 * 97 */
+	CU_ASSERT(nvmf_ndp_he_ntt_get(1649, 3) == NULL);
+	/* Prime, not 1 modulo 2N */
+	CU_ASSERT(nvmf_ndp_he_ntt_get(g_ut_primes[2], 14) == NULL);
+	/* Too wide for lazy reduction */
+	CU_ASSERT(nvmf_ndp_he_ntt_get(0x4000000000000001ull + 4096 * 3, 4) == NULL);
+	CU_ASSERT(nvmf_ndp_he_ntt_get(17, 0) == NULL);
+}
+
+static void
+test_he_ntt_mulmod(void)
+{
+	const struct nvmf_ndp_he_ntt *ntt;
+	uint64_t seed = 1, x, y, q;
+	uint32_t i, j;
+
+	for (i = 0; i < UT_NUM_PRIMES; i++) {
+		q = g_ut_primes[i];
+		ntt = nvmf_ndp_he_ntt_get(q, UT_LOG_N);
+		SPDK_CU_ASSERT_FATAL(ntt != NULL);
+
+		CU_ASSERT(nvmf_ndp_he_ntt_mulmod(ntt, q - 1, q - 1) == 1);
+		CU_ASSERT(nvmf_ndp_he_ntt_mulmod(ntt, 0, q - 1) == 0);
+		for (j = 0; j < 10000; j++) {
+			x = ut_rand(&seed) % q;
+			y = ut_rand(&seed) % q;
+			CU_ASSERT(nvmf_ndp_he_ntt_mulmod(ntt, x, y) ==
+				  (uint64_t)((unsigned __int128)x * y % q));
+		}
+	}
+}
+
+static void
+test_he_ntt_roundtrip(void)
+{
+	const struct nvmf_ndp_he_ntt *ntt;
+	uint32_t log_n = 11, n = 1u << log_n, i, j;
+	uint64_t *a, *b, seed = 2, q;
+
+	a = calloc(n, sizeof(*a));
+	b = calloc(n, sizeof(*b));
+	SPDK_CU_ASSERT_FATAL(a != NULL && b != NULL);
+
+	for (i = 0; i < UT_NUM_PRIMES; i++) {
+		q = g_ut_primes[i];
+		ntt = nvmf_ndp_he_ntt_get(q, log_n);
+		SPDK_CU_ASSERT_FATAL(ntt != NULL);
+
+		for (j = 0; j < n; j++) {
+			a[j] = ut_rand(&seed) % q;
+		}
+		a[0] = q - 1;
+		memcpy(b, a, n * sizeof(*a));
+
+		nvmf_ndp_he_ntt_forward(ntt, b);
+		for (j = 0; j < n; j++) {
+			CU_ASSERT(b[j] < q);
+		}
+		nvmf_ndp_he_ntt_inverse(ntt, b);
+		CU_ASSERT(memcmp(a, b, n * sizeof(*a)) == 0);
+	}
+
+	/* 1 is 1 at every point */
+	ntt = nvmf_ndp_he_ntt_get(g_ut_primes[0], log_n);
+	memset(a, 0, n * sizeof(*a));
+	a[0] = 1;
+	nvmf_ndp_he_ntt_forward(ntt, a);
+	for (j = 0; j < n; j++) {
+		CU_ASSERT(a[j] == 1);
+	}
+
+	free(a);
+	free(b);
+}
+
+static void
+test_he_ntt_negacyclic(void)
+{
+	const struct nvmf_ndp_he_ntt *ntt;
+	uint64_t x[UT_N], y[UT_N], ref[UT_N], zero[UT_N] = {}, c[3][UT_N], seed = 3, q;
+	uint32_t i, j;
+
+	for (i = 0; i < UT_NUM_PRIMES; i++) {
+		q = g_ut_primes[i];
+		ntt = nvmf_ndp_he_ntt_get(q, UT_LOG_N);
+		SPDK_CU_ASSERT_FATAL(ntt != NULL);
+
+		for (j = 0; j < UT_N; j++) {
+			x[j] = ut_rand(&seed) % q;
+			y[j] = ut_rand(&seed) % q;
+		}
+		/* X^(N-1) X = -1 */
+		x[UT_N - 1] = y[1] = q - 1;
+		ut_negacyclic(x, y, ref, UT_N, q);
+
+		nvmf_ndp_he_ntt_forward(ntt, x);
+		nvmf_ndp_he_ntt_forward(ntt, y);
+		nvmf_ndp_he_ntt_tensor(ntt, x, zero, y, zero, c[0], c[1], c[2]);
+		nvmf_ndp_he_ntt_inverse(ntt, c[0]);
+		CU_ASSERT(memcmp(c[0], ref, sizeof(ref)) == 0);
+		CU_ASSERT(spdk_mem_all_zero(c[1], sizeof(c[1])));
+		CU_ASSERT(spdk_mem_all_zero(c[2], sizeof(c[2])));
+	}
+}
+
+/* (a1, b1) (a2, b2) = (a1 a2, a1 b2 + a2 b1, b1 b2), residue by residue */
+static void
+ut_he_ct_mul_check(struct ut_rns_ct *a, struct ut_rns_ct *b, struct ut_rns_ct *out)
+{
+	uint64_t t1[UT_N], t2[UT_N], ref[UT_N], q;
+	uint32_t prime, j;
+
+	for (prime = 0; prime < UT_NUM_PRIMES; prime++) {
+		q = g_ut_primes[prime];
+
+		ut_negacyclic(ut_residues(a, 0, prime), ut_residues(b, 0, prime), ref, UT_N, q);
+		CU_ASSERT(memcmp(ut_residues(out, 0, prime), ref, sizeof(ref)) == 0);
+
+		ut_negacyclic(ut_residues(a, 0, prime), ut_residues(b, 1, prime), t1, UT_N, q);
+		ut_negacyclic(ut_residues(b, 0, prime), ut_residues(a, 1, prime), t2, UT_N, q);
+		for (j = 0; j < UT_N; j++) {
+			ref[j] = (t1[j] + t2[j]) % q;
+		}
+		CU_ASSERT(memcmp(ut_residues(out, 1, prime), ref, sizeof(ref)) == 0);
+
+		ut_negacyclic(ut_residues(a, 1, prime), ut_residues(b, 1, prime), ref, UT_N, q);
+		CU_ASSERT(memcmp(ut_residues(out, 2, prime), ref, sizeof(ref)) == 0);
+	}
+}
+
+static void
+test_he_ct_mul(void)
+{
+	struct ut_rns_ct a, b, a_copy, b_copy, out, out2;
+	const struct nvmf_ndp_he_ntt *ntt;
+	uint32_t prime, poly;
+
+	ut_rns_ct_init(&a, 1);
+	ut_rns_ct_init(&b, 2);
+	b.hdr.log_p = 20;
+	a_copy = a;
+	b_copy = b;
+
+	memset(&out, 0xff, sizeof(out));
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out, sizeof(out)) == 0);
+	CU_ASSERT(out.hdr.num_polys == 3);
+	CU_ASSERT(out.hdr.log_p == 50);
+	CU_ASSERT(out.hdr.flags == NVMF_NDP_HE_CT_F_RNS);
+	CU_ASSERT(memcmp(out.primes, g_ut_primes, sizeof(g_ut_primes)) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_size(&out.hdr) == sizeof(out));
+	CU_ASSERT(nvmf_ndp_he_ct_check(&out, sizeof(out)) == 0);
+	ut_he_ct_mul_check(&a_copy, &b_copy, &out);
+
+	/* Prime by prime, as split over threads */
+	a = a_copy;
+	b = b_copy;
+	memset(&out2, 0, sizeof(out2));
+	CU_ASSERT(nvmf_ndp_he_ct_mul_prepare(&a.hdr, &b.hdr, &out2, sizeof(out2)) == UT_NUM_PRIMES);
+	CU_ASSERT(nvmf_ndp_he_ct_mul_primes(&a.hdr, &b.hdr, &out2, 2, 1) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_mul_primes(&a.hdr, &b.hdr, &out2, 0, 2) == 0);
+	CU_ASSERT(memcmp(&out, &out2, sizeof(out)) == 0);
+
+	/* In evaluation form, the product stays in it */
+	a = a_copy;
+	b = b_copy;
+	for (prime = 0; prime < UT_NUM_PRIMES; prime++) {
+		ntt = nvmf_ndp_he_ntt_get(g_ut_primes[prime], UT_LOG_N);
+		for (poly = 0; poly < 2; poly++) {
+			nvmf_ndp_he_ntt_forward(ntt, ut_residues(&a, poly, prime));
+			nvmf_ndp_he_ntt_forward(ntt, ut_residues(&b, poly, prime));
+		}
+	}
+	a.hdr.flags |= NVMF_NDP_HE_CT_F_NTT;
+	b.hdr.flags |= NVMF_NDP_HE_CT_F_NTT;
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out2, sizeof(out2)) == 0);
+	CU_ASSERT(out2.hdr.flags == (NVMF_NDP_HE_CT_F_RNS | NVMF_NDP_HE_CT_F_NTT));
+	for (prime = 0; prime < UT_NUM_PRIMES; prime++) {
+		ntt = nvmf_ndp_he_ntt_get(g_ut_primes[prime], UT_LOG_N);
+		for (poly = 0; poly < 3; poly++) {
+			nvmf_ndp_he_ntt_inverse(ntt, ut_residues(&out2, poly, prime));
+		}
+	}
+	out2.hdr.flags = NVMF_NDP_HE_CT_F_RNS;
+	CU_ASSERT(memcmp(&out, &out2, sizeof(out)) == 0);
+
+	/* Output too small */
+	ut_rns_ct_init(&a, 1);
+	ut_rns_ct_init(&b, 2);
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out, sizeof(out) - 1) == -ENOSPC);
+
+	/* Forms differ, a product multiplied again, not RNS, in place */
+	b.hdr.flags |= NVMF_NDP_HE_CT_F_NTT;
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out, sizeof(out)) == -EINVAL);
+	b.hdr.flags = NVMF_NDP_HE_CT_F_RNS;
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out, sizeof(out)) == 0);
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&out.hdr, &b.hdr, &out2, sizeof(out2)) == -EINVAL);
+	a.hdr.flags = 0;
+	b.hdr.flags = 0;
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out, sizeof(out)) == -EINVAL);
+	ut_rns_ct_init(&a, 1);
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &a, sizeof(a)) == -EINVAL);
+
+	/* A prime the NTT rejects: 17 * 97 */
+	a.primes[0] = b.primes[0] = 1649;
+	a.hdr.log_n = b.hdr.log_n = 3;
+	CU_ASSERT(nvmf_ndp_he_ct_mul(&a.hdr, &b.hdr, &out, sizeof(out)) == -EINVAL);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_he_ntt", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_he_ntt_get);
+	CU_ADD_TEST(suite, test_he_ntt_mulmod);
+	CU_ADD_TEST(suite, test_he_ntt_roundtrip);
+	CU_ADD_TEST(suite, test_he_ntt_negacyclic);
+	CU_ADD_TEST(suite, test_he_ct_mul);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,431 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_io.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_BLOCK_SIZE	512
+#define UT_NUM_BLOCKS	64
+#define UT_MAX_IOS	64
+
+DEFINE_STUB(spdk_bdev_get_block_size, uint32_t, (const struct spdk_bdev *bdev), UT_BLOCK_SIZE);
+DEFINE_STUB(spdk_bdev_get_num_blocks, uint64_t, (const struct spdk_bdev *bdev), UT_NUM_BLOCKS);
+DEFINE_STUB(spdk_bdev_get_optimal_io_boundary, uint32_t, (const struct spdk_bdev *bdev), 0);
+DEFINE_STUB(spdk_bdev_desc_get_bdev, struct spdk_bdev *, (struct spdk_bdev_desc *desc),
+	    (struct spdk_bdev *)0xbdef);
+DEFINE_STUB_V(spdk_bdev_free_io, (struct spdk_bdev_io *bdev_io));
+
+struct ut_io {
+	bool				write;
+	struct iovec			iov[NVMF_NDP_IO_MAX_IOVS];
+	int				iovcnt;
+	uint64_t			offset_blocks;
+	uint64_t			num_blocks;
+	spdk_bdev_io_completion_cb	cb;
+	void				*cb_arg;
+};
+
+static char g_disk[UT_NUM_BLOCKS * UT_BLOCK_SIZE];
+static struct ut_io g_ios[UT_MAX_IOS];
+static int g_num_ios;
+/* Fail the next submission with this error */
+static int g_submit_rc;
+static struct spdk_bdev_io_wait_entry *g_io_wait;
+
+static int
+ut_submit(bool write, struct iovec *iov, int iovcnt, uint64_t offset_blocks,
+	  uint64_t num_blocks, spdk_bdev_io_completion_cb cb, void *cb_arg)
+{
+	struct ut_io *io;
+	uint64_t len = 0;
+	int i, rc;
+
+	if (g_submit_rc != 0) {
+		rc = g_submit_rc;
+		g_submit_rc = 0;
+		return rc;
+	}
+
+	SPDK_CU_ASSERT_FATAL(g_num_ios < UT_MAX_IOS);
+	SPDK_CU_ASSERT_FATAL(iovcnt > 0 && iovcnt <= NVMF_NDP_IO_MAX_IOVS);
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+	CU_ASSERT(len == num_blocks * UT_BLOCK_SIZE);
+
+	io = &g_ios[g_num_ios++];
+	io->write = write;
+	memcpy(io->iov, iov, iovcnt * sizeof(*iov));
+	io->iovcnt = iovcnt;
+	io->offset_blocks = offset_blocks;
+	io->num_blocks = num_blocks;
+	io->cb = cb;
+	io->cb_arg = cb_arg;
+
+	return 0;
+}
+
+int
+spdk_bdev_readv_blocks(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		       struct iovec *iov, int iovcnt, uint64_t offset_blocks, uint64_t num_blocks,
+		       spdk_bdev_io_completion_cb cb, void *cb_arg)
+{
+	return ut_submit(false, iov, iovcnt, offset_blocks, num_blocks, cb, cb_arg);
+}
+
+int
+spdk_bdev_writev_blocks(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+			struct iovec *iov, int iovcnt, uint64_t offset_blocks, uint64_t num_blocks,
+			spdk_bdev_io_completion_cb cb, void *cb_arg)
+{
+	return ut_submit(true, iov, iovcnt, offset_blocks, num_blocks, cb, cb_arg);
+}
+
+int
+spdk_bdev_queue_io_wait(struct spdk_bdev *bdev, struct spdk_io_channel *ch,
+			struct spdk_bdev_io_wait_entry *entry)
+{
+	g_io_wait = entry;
+	return 0;
+}
+
+/* Complete the idx-th outstanding I/O */
+static void
+ut_complete_io(int idx, bool success)
+{
+	struct ut_io io;
+	char *disk;
+	int i;
+
+	SPDK_CU_ASSERT_FATAL(idx < g_num_ios);
+	io = g_ios[idx];
+	memmove(&g_ios[idx], &g_ios[idx + 1], (g_num_ios - idx - 1) * sizeof(io));
+	g_num_ios--;
+
+	disk = &g_disk[io.offset_blocks * UT_BLOCK_SIZE];
+	for (i = 0; i < io.iovcnt && success; i++) {
+		if (io.write) {
+			memcpy(disk, io.iov[i].iov_base, io.iov[i].iov_len);
+		} else {
+			memcpy(io.iov[i].iov_base, disk, io.iov[i].iov_len);
+		}
+		disk += io.iov[i].iov_len;
+	}
+	io.cb((struct spdk_bdev_io *)0x1, success, io.cb_arg);
+}
+
+static void
+ut_complete_all(void)
+{
+	while (g_num_ios > 0) {
+		ut_complete_io(0, true);
+	}
+}
+
+struct ut_done {
+	int	calls;
+	int	status;
+};
+
+static void
+ut_done(void *cb_arg, int status)
+{
+	struct ut_done *done = cb_arg;
+
+	done->calls++;
+	done->status = status;
+}
+
+static void
+ut_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(g_disk); i++) {
+		g_disk[i] = (char)(i * 7 + i / UT_BLOCK_SIZE);
+	}
+	memset(g_ios, 0, sizeof(g_ios));
+	g_num_ios = 0;
+	g_submit_rc = 0;
+	g_io_wait = NULL;
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 0);
+}
+
+/* Split buf into iovecs of iov_size bytes */
+static int
+ut_split(char *buf, size_t len, size_t iov_size, struct iovec *iov)
+{
+	int iovcnt = 0;
+	size_t off;
+
+	for (off = 0; off < len; off += iov_size) {
+		iov[iovcnt].iov_base = buf + off;
+		iov[iovcnt].iov_len = spdk_min(iov_size, len - off);
+		iovcnt++;
+	}
+
+	return iovcnt;
+}
+
+static void
+test_gather(void)
+{
+	const struct nvmf_ndp_extent extents[] = { { 4, 3 }, { 20, 10 } };
+	char buf[13 * UT_BLOCK_SIZE];
+	struct ut_done done = {};
+	struct iovec iov[3];
+	int rc;
+
+	ut_reset();
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 8);
+	memset(buf, 0, sizeof(buf));
+
+	/* Buffer split in the middle of blocks */
+	iov[0].iov_base = buf;
+	iov[0].iov_len = 1000;
+	iov[1].iov_base = buf + 1000;
+	iov[1].iov_len = 3000;
+	iov[2].iov_base = buf + 4000;
+	iov[2].iov_len = sizeof(buf) - 4000;
+
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, iov, 3, ut_done, &done);
+	CU_ASSERT(rc == 0);
+
+	/* The second extent crosses the boundary at block 24 */
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 3);
+	CU_ASSERT(!g_ios[0].write);
+	CU_ASSERT(g_ios[0].offset_blocks == 4 && g_ios[0].num_blocks == 3);
+	CU_ASSERT(g_ios[0].iovcnt == 2);
+	CU_ASSERT(g_ios[1].offset_blocks == 20 && g_ios[1].num_blocks == 4);
+	CU_ASSERT(g_ios[2].offset_blocks == 24 && g_ios[2].num_blocks == 6);
+	CU_ASSERT(g_ios[2].iovcnt == 2);
+
+	/* Completed out of order, the callback only comes with the last one */
+	ut_complete_io(1, true);
+	ut_complete_io(0, true);
+	CU_ASSERT(done.calls == 0);
+	ut_complete_io(0, true);
+	CU_ASSERT(done.calls == 1);
+	CU_ASSERT(done.status == 0);
+
+	CU_ASSERT(memcmp(buf, &g_disk[4 * UT_BLOCK_SIZE], 3 * UT_BLOCK_SIZE) == 0);
+	CU_ASSERT(memcmp(buf + 3 * UT_BLOCK_SIZE, &g_disk[20 * UT_BLOCK_SIZE],
+			 10 * UT_BLOCK_SIZE) == 0);
+}
+
+static void
+test_scatter(void)
+{
+	const struct nvmf_ndp_extent extents[] = { { 40, 16 }, { 2, 4 } };
+	char buf[20 * UT_BLOCK_SIZE];
+	struct ut_done done = {};
+	struct iovec iov[64];
+	int iovcnt, rc, i;
+
+	ut_reset();
+	for (i = 0; i < (int)sizeof(buf); i++) {
+		buf[i] = (char)(i * 13);
+	}
+
+	/* 256 byte iovecs: each I/O is limited to the blocks fitting in 8 of them */
+	iovcnt = ut_split(buf, sizeof(buf), 256, iov);
+	rc = nvmf_ndp_scatter(NULL, NULL, extents, 2, iov, iovcnt, ut_done, &done);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 5);
+	for (i = 0; i < g_num_ios; i++) {
+		CU_ASSERT(g_ios[i].write);
+		CU_ASSERT(g_ios[i].num_blocks == 4);
+		CU_ASSERT(g_ios[i].iovcnt == 8);
+	}
+	CU_ASSERT(g_ios[3].offset_blocks == 52);
+	CU_ASSERT(g_ios[4].offset_blocks == 2);
+
+	ut_complete_all();
+	CU_ASSERT(done.calls == 1);
+	CU_ASSERT(done.status == 0);
+	CU_ASSERT(memcmp(&g_disk[40 * UT_BLOCK_SIZE], buf, 16 * UT_BLOCK_SIZE) == 0);
+	CU_ASSERT(memcmp(&g_disk[2 * UT_BLOCK_SIZE], buf + 16 * UT_BLOCK_SIZE,
+			 4 * UT_BLOCK_SIZE) == 0);
+}
+
+static void
+test_queue_depth(void)
+{
+	const struct nvmf_ndp_extent extent = { 0, UT_NUM_BLOCKS };
+	char buf[UT_NUM_BLOCKS * UT_BLOCK_SIZE];
+	struct ut_done done = {};
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	int rc;
+
+	ut_reset();
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 1);
+
+	/* One I/O per block, no more than NVMF_NDP_IO_MAX_OUTSTANDING at a time */
+	rc = nvmf_ndp_gather(NULL, NULL, &extent, 1, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_ios == NVMF_NDP_IO_MAX_OUTSTANDING);
+
+	ut_complete_io(0, true);
+	CU_ASSERT(g_num_ios == NVMF_NDP_IO_MAX_OUTSTANDING);
+	CU_ASSERT(g_ios[g_num_ios - 1].offset_blocks == NVMF_NDP_IO_MAX_OUTSTANDING);
+
+	ut_complete_all();
+	CU_ASSERT(done.calls == 1);
+	CU_ASSERT(done.status == 0);
+	CU_ASSERT(memcmp(buf, g_disk, sizeof(buf)) == 0);
+}
+
+static void
+test_nomem(void)
+{
+	const struct nvmf_ndp_extent extents[] = { { 0, 2 }, { 8, 2 } };
+	char buf[4 * UT_BLOCK_SIZE];
+	struct ut_done done = {};
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	int rc;
+
+	ut_reset();
+
+	/* Out of bdev_ios on the first submission: wait, nothing fails */
+	g_submit_rc = -ENOMEM;
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_ios == 0);
+	SPDK_CU_ASSERT_FATAL(g_io_wait != NULL);
+
+	g_io_wait->cb_fn(g_io_wait->cb_arg);
+	CU_ASSERT(g_num_ios == 2);
+	CU_ASSERT(g_ios[0].offset_blocks == 0);
+	CU_ASSERT(g_ios[1].offset_blocks == 8);
+
+	ut_complete_all();
+	CU_ASSERT(done.calls == 1);
+	CU_ASSERT(done.status == 0);
+	CU_ASSERT(memcmp(buf, g_disk, 2 * UT_BLOCK_SIZE) == 0);
+	CU_ASSERT(memcmp(buf + 2 * UT_BLOCK_SIZE, &g_disk[8 * UT_BLOCK_SIZE],
+			 2 * UT_BLOCK_SIZE) == 0);
+}
+
+static void
+test_io_error(void)
+{
+	const struct nvmf_ndp_extent extent = { 0, UT_NUM_BLOCKS };
+	char buf[UT_NUM_BLOCKS * UT_BLOCK_SIZE];
+	struct ut_done done = {};
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	int rc;
+
+	ut_reset();
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 16);
+
+	rc = nvmf_ndp_gather(NULL, NULL, &extent, 1, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_ios == 4);
+
+	/* The buffer is in use until the other I/Os are done, nothing new is submitted */
+	ut_complete_io(1, false);
+	CU_ASSERT(done.calls == 0);
+	CU_ASSERT(g_num_ios == 3);
+	ut_complete_io(0, true);
+	ut_complete_io(0, false);
+	CU_ASSERT(done.calls == 0);
+	ut_complete_io(0, true);
+	CU_ASSERT(done.calls == 1);
+	CU_ASSERT(done.status == -EIO);
+
+	/* Submission failure after some I/Os were started */
+	memset(&done, 0, sizeof(done));
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 1);
+	rc = nvmf_ndp_gather(NULL, NULL, &extent, 1, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_ios == NVMF_NDP_IO_MAX_OUTSTANDING);
+	g_submit_rc = -EIO;
+	ut_complete_io(0, true);
+	CU_ASSERT(g_num_ios == NVMF_NDP_IO_MAX_OUTSTANDING - 1);
+	ut_complete_all();
+	CU_ASSERT(done.calls == 1);
+	CU_ASSERT(done.status == -EIO);
+}
+
+static void
+test_sync_errors(void)
+{
+	struct nvmf_ndp_extent extents[] = { { 0, 4 }, { 60, 4 } };
+	const struct nvmf_ndp_extent block = { 0, 1 };
+	char buf[8 * UT_BLOCK_SIZE];
+	struct ut_done done = {};
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct iovec small[NVMF_NDP_IO_MAX_IOVS + 1];
+	int iovcnt, rc;
+
+	ut_reset();
+
+	/* No extent, no buffer */
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 0, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == -EINVAL);
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, &iov, 0, ut_done, &done);
+	CU_ASSERT(rc == -EINVAL);
+
+	/* Buffer too small */
+	iov.iov_len = sizeof(buf) - 1;
+	rc = nvmf_ndp_scatter(NULL, NULL, extents, 2, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == -EINVAL);
+	iov.iov_len = sizeof(buf);
+
+	/* Past the end of the namespace, empty and wrapping around */
+	extents[1].offset_blocks = 61;
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == -ERANGE);
+	extents[1].offset_blocks = 60;
+	extents[1].num_blocks = 0;
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == -ERANGE);
+	extents[1].offset_blocks = UINT64_MAX - 1;
+	extents[1].num_blocks = 4;
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == -ERANGE);
+	extents[1].offset_blocks = 60;
+
+	/* First submission fails */
+	g_submit_rc = -EIO;
+	rc = nvmf_ndp_gather(NULL, NULL, extents, 2, &iov, 1, ut_done, &done);
+	CU_ASSERT(rc == -EIO);
+
+	/* A single block doesn't fit in NVMF_NDP_IO_MAX_IOVS iovecs */
+	iovcnt = ut_split(buf, UT_BLOCK_SIZE, UT_BLOCK_SIZE / NVMF_NDP_IO_MAX_IOVS - 1, small);
+	SPDK_CU_ASSERT_FATAL(iovcnt == NVMF_NDP_IO_MAX_IOVS + 1);
+	rc = nvmf_ndp_gather(NULL, NULL, &block, 1, small, iovcnt, ut_done, &done);
+	CU_ASSERT(rc == -EINVAL);
+	CU_ASSERT(g_num_ios == 0);
+
+	CU_ASSERT(done.calls == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_io", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_gather);
+	CU_ADD_TEST(suite, test_scatter);
+	CU_ADD_TEST(suite, test_queue_depth);
+	CU_ADD_TEST(suite, test_nomem);
+	CU_ADD_TEST(suite, test_io_error);
+	CU_ADD_TEST(suite, test_sync_errors);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,193 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "common/lib/ut_multithread.c"
+
+#include "nvmf/ndp_offload.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_NUM_JOBS	3
+
+struct ut_job {
+	int			id;
+	struct spdk_thread	*work_thread;
+	struct spdk_thread	*done_thread;
+	int			status;
+	bool			done;
+};
+
+static struct spdk_thread *g_offload_threads[4];
+static uint32_t g_num_offload_threads;
+static bool g_stopped;
+
+static int
+ut_work(void *ctx)
+{
+	struct ut_job *job = ctx;
+
+	job->work_thread = spdk_get_thread();
+	return job->id;
+}
+
+static void
+ut_work_done(void *ctx, int status)
+{
+	struct ut_job *job = ctx;
+
+	CU_ASSERT(!job->done);
+	job->done = true;
+	job->done_thread = spdk_get_thread();
+	job->status = status;
+}
+
+static void
+ut_stopped(void *ctx)
+{
+	g_stopped = true;
+}
+
+/* The offload threads aren't known to ut_multithread, poll them here */
+static void
+ut_poll_offload_threads(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_num_offload_threads; i++) {
+		spdk_set_thread(g_offload_threads[i]);
+		spdk_thread_poll(g_offload_threads[i], 0, 0);
+	}
+	set_thread(0);
+}
+
+static void
+ut_destroy_offload_threads(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_num_offload_threads; i++) {
+		CU_ASSERT(spdk_thread_is_exited(g_offload_threads[i]));
+		spdk_set_thread(g_offload_threads[i]);
+		spdk_thread_destroy(g_offload_threads[i]);
+	}
+	g_num_offload_threads = 0;
+	set_thread(0);
+}
+
+static void
+test_offload_disabled(void)
+{
+	struct ut_job job = { .id = 1 };
+	struct spdk_cpuset mask;
+	int rc;
+
+	set_thread(0);
+
+	/* No threads: the caller has to run the job itself */
+	rc = spdk_nvmf_ndp_offload_start(NULL, 0);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(spdk_nvmf_ndp_offload_get_num_threads() == 0);
+	rc = nvmf_ndp_offload(ut_work, ut_work_done, &job);
+	CU_ASSERT(rc == -ENODEV);
+	CU_ASSERT(job.work_thread == NULL);
+
+	spdk_cpuset_zero(&mask);
+	rc = spdk_nvmf_ndp_offload_start(&mask, 0);
+	CU_ASSERT(rc == -EINVAL);
+
+	g_stopped = false;
+	spdk_nvmf_ndp_offload_stop(ut_stopped, NULL);
+	CU_ASSERT(g_stopped);
+}
+
+static void
+test_offload_jobs(void)
+{
+	struct ut_job jobs[UT_NUM_JOBS];
+	struct spdk_thread *origin;
+	int rc, i;
+
+	set_thread(0);
+	origin = spdk_get_thread();
+
+	rc = spdk_nvmf_ndp_offload_start(NULL, 2);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(spdk_nvmf_ndp_offload_get_num_threads() == 2);
+	g_num_offload_threads = 2;
+	g_offload_threads[0] = g_nvmf_ndp_offload.threads[0];
+	g_offload_threads[1] = g_nvmf_ndp_offload.threads[1];
+	CU_ASSERT(g_offload_threads[0] != origin && g_offload_threads[1] != origin);
+
+	rc = spdk_nvmf_ndp_offload_start(NULL, 2);
+	CU_ASSERT(rc == -EEXIST);
+
+	memset(jobs, 0, sizeof(jobs));
+	for (i = 0; i < UT_NUM_JOBS; i++) {
+		jobs[i].id = i + 10;
+		rc = nvmf_ndp_offload(ut_work, ut_work_done, &jobs[i]);
+		CU_ASSERT(rc == 0);
+	}
+
+	/* Nothing runs on the submitting thread */
+	poll_threads();
+	CU_ASSERT(jobs[0].work_thread == NULL);
+
+	/* Jobs are spread over the threads, the results come back to the origin */
+	ut_poll_offload_threads();
+	CU_ASSERT(jobs[0].work_thread == g_offload_threads[0]);
+	CU_ASSERT(jobs[1].work_thread == g_offload_threads[1]);
+	CU_ASSERT(jobs[2].work_thread == g_offload_threads[0]);
+	CU_ASSERT(!jobs[0].done);
+
+	poll_threads();
+	for (i = 0; i < UT_NUM_JOBS; i++) {
+		CU_ASSERT(jobs[i].done);
+		CU_ASSERT(jobs[i].done_thread == origin);
+		CU_ASSERT(jobs[i].status == i + 10);
+	}
+
+	/* Jobs queued before the stop still run */
+	memset(&jobs[0], 0, sizeof(jobs[0]));
+	rc = nvmf_ndp_offload(ut_work, ut_work_done, &jobs[0]);
+	CU_ASSERT(rc == 0);
+
+	g_stopped = false;
+	spdk_nvmf_ndp_offload_stop(ut_stopped, NULL);
+	CU_ASSERT(!g_stopped);
+	rc = nvmf_ndp_offload(ut_work, ut_work_done, &jobs[1]);
+	CU_ASSERT(rc == -ENODEV);
+
+	ut_poll_offload_threads();
+	ut_poll_offload_threads();
+	poll_threads();
+	CU_ASSERT(jobs[0].done);
+	CU_ASSERT(g_stopped);
+	CU_ASSERT(spdk_nvmf_ndp_offload_get_num_threads() == 0);
+
+	ut_destroy_offload_threads();
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_offload", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_offload_disabled);
+	CU_ADD_TEST(suite, test_offload_jobs);
+
+	allocate_threads(1);
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	free_threads();
+
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,485 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_desc.c"
+#include "nvmf/ndp_ops.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_BLOCK_SIZE	512
+
+DEFINE_STUB(spdk_bdev_get_block_size, uint32_t, (const struct spdk_bdev *bdev), UT_BLOCK_SIZE);
+DEFINE_STUB(spdk_bdev_get_num_blocks, uint64_t, (const struct spdk_bdev *bdev), 1ULL << 20);
+
+DEFINE_STUB(nvmf_ndp_grep_create, struct nvmf_ndp_grep *, (const char *patterns, size_t len,
+		uint32_t max_line_len), NULL);
+DEFINE_STUB_V(nvmf_ndp_grep_free, (struct nvmf_ndp_grep *grep));
+DEFINE_STUB(nvmf_ndp_grep_scan, int, (struct nvmf_ndp_grep *grep, struct iovec *iov, int iovcnt,
+				      nvmf_ndp_grep_match_fn match_fn, void *cb_arg), 0);
+DEFINE_STUB(nvmf_ndp_grep_finish, int, (struct nvmf_ndp_grep *grep,
+					nvmf_ndp_grep_match_fn match_fn, void *cb_arg), 0);
+DEFINE_STUB(nvmf_ndp_grep_line_end, uint64_t, (const struct nvmf_ndp_grep *grep), 0);
+DEFINE_STUB(nvmf_ndp_agg_create, struct nvmf_ndp_agg *, (const void *args, size_t len), NULL);
+DEFINE_STUB_V(nvmf_ndp_agg_free, (struct nvmf_ndp_agg *agg));
+DEFINE_STUB_V(nvmf_ndp_agg_scan, (struct nvmf_ndp_agg *agg, struct iovec *iov, int iovcnt));
+DEFINE_STUB(nvmf_ndp_agg_result_size, size_t, (const struct nvmf_ndp_agg *agg), 0);
+DEFINE_STUB(nvmf_ndp_agg_get_result, size_t, (const struct nvmf_ndp_agg *agg, struct iovec *iov,
+		int iovcnt), 0);
+DEFINE_STUB(nvmf_ndp_topk_create, int, (const void *args, size_t len, bool sample,
+		uint32_t result_size, struct nvmf_ndp_topk **_topk), -EINVAL);
+DEFINE_STUB_V(nvmf_ndp_topk_free, (struct nvmf_ndp_topk *topk));
+DEFINE_STUB_V(nvmf_ndp_topk_scan, (struct nvmf_ndp_topk *topk, struct iovec *iov, int iovcnt));
+DEFINE_STUB(nvmf_ndp_topk_get_result, size_t, (struct nvmf_ndp_topk *topk, struct iovec *iov,
+		int iovcnt), 0);
+DEFINE_STUB(nvmf_ndp_topk_truncated, bool, (const struct nvmf_ndp_topk *topk), false);
+DEFINE_STUB_V(nvmf_ndp_cursor_skip_cache, (struct nvmf_ndp_cursor *cursor));
+DEFINE_STUB_V(nvmf_ndp_cache_abort, (struct nvmf_ndp_cache_entry *fill));
+DEFINE_STUB_V(nvmf_ndp_set_result, (struct spdk_nvmf_request *req, uint32_t len));
+
+static struct spdk_nvmf_ndp_op *g_ops[256];
+static int g_status;
+static int g_completions;
+
+/* Completion of the last part of the result */
+static struct nvmf_ndp_cursor *g_cursor;
+static uint32_t g_len;
+static bool g_more;
+static uint64_t g_offset;
+
+int
+spdk_nvmf_ndp_register_op(struct spdk_nvmf_ndp_op *op)
+{
+	g_ops[op->opc] = op;
+	return 0;
+}
+
+void
+nvmf_ndp_set_status(struct spdk_nvmf_request *req, int status)
+{
+	g_status = status;
+}
+
+int
+nvmf_ndp_cache_lookup(struct spdk_bdev *bdev, struct spdk_nvmf_request *req,
+		      const struct nvmf_ndp_desc *target, struct nvmf_ndp_cache_entry **fill)
+{
+	*fill = NULL;
+	return -ENOENT;
+}
+
+struct nvmf_ndp_cursor *
+nvmf_ndp_cursor_create(struct spdk_nvmf_request *req, struct nvmf_ndp_desc *target,
+		       nvmf_ndp_cursor_run_fn run_fn)
+{
+	struct nvmf_ndp_cursor *cursor;
+
+	cursor = calloc(1, sizeof(*cursor));
+	SPDK_CU_ASSERT_FATAL(cursor != NULL);
+	cursor->run_fn = run_fn;
+	cursor->target = *target;
+	memset(target, 0, sizeof(*target));
+
+	return cursor;
+}
+
+void
+nvmf_ndp_cursor_free(struct nvmf_ndp_cursor *cursor)
+{
+	nvmf_ndp_desc_free(&cursor->target);
+	free(cursor);
+}
+
+void
+nvmf_ndp_result_init(struct spdk_nvmf_request *req, struct spdk_iov_xfer *ix)
+{
+	spdk_iov_memset(req->iov, req->iovcnt, 0);
+	if (ix != NULL) {
+		spdk_iov_xfer_init(ix, req->iov, req->iovcnt);
+	}
+}
+
+/* The cursor is kept for the test to run the next part, as a fetch would */
+void
+nvmf_ndp_cursor_complete(struct nvmf_ndp_cursor *cursor, struct spdk_nvmf_request *req,
+			 int status, uint32_t len, bool more, uint64_t offset)
+{
+	g_completions++;
+	g_status = status;
+	g_len = len;
+	g_more = more;
+	g_offset = offset;
+	cursor->offset = offset;
+	g_cursor = cursor;
+}
+
+/* The stream started last, fed by the test */
+static struct nvmf_ndp_stream_opts g_stream_opts;
+static nvmf_ndp_stream_data_fn g_stream_data_fn;
+static nvmf_ndp_stream_done_fn g_stream_done_fn;
+static void *g_stream_cb_arg;
+static int g_num_streams;
+
+void
+nvmf_ndp_stream_opts_init(struct nvmf_ndp_stream_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->mode = NVMF_NDP_STREAM_MODE_RAW;
+}
+
+int
+nvmf_ndp_stream_start(struct spdk_nvmf_request *req, struct spdk_bdev_desc *desc,
+		      struct spdk_io_channel *ch, const struct nvmf_ndp_extent *extents,
+		      uint32_t num_extents, const struct nvmf_ndp_stream_opts *opts,
+		      nvmf_ndp_stream_data_fn data_fn, nvmf_ndp_stream_done_fn done_fn,
+		      void *cb_arg)
+{
+	g_num_streams++;
+	g_stream_opts = *opts;
+	g_stream_data_fn = data_fn;
+	g_stream_done_fn = done_fn;
+	g_stream_cb_arg = cb_arg;
+
+	return 0;
+}
+
+/* Feed the file from the offset of the stream, until the operator stops it */
+static void
+ut_stream_finish(const char *file)
+{
+	struct iovec iov = {
+		.iov_base = (void *)(file + g_stream_opts.offset),
+		.iov_len = strlen(file) - g_stream_opts.offset,
+	};
+
+	SPDK_CU_ASSERT_FATAL(g_num_streams == 1);
+	g_num_streams--;
+	g_stream_data_fn(g_stream_cb_arg, &iov, 1);
+	g_stream_done_fn(g_stream_cb_arg, 0);
+}
+
+/*
+ * Filter and regex engines: the lines starting with the first byte of their
+ * arguments match, line ends are relative to the start of the stream.
+ */
+struct ut_engine {
+	char		key;
+	uint64_t	line_end;
+};
+
+static size_t g_engine_args_len;
+static int g_engine_count;
+
+static struct ut_engine *
+ut_engine_create(const void *args, size_t len)
+{
+	struct ut_engine *engine;
+
+	g_engine_args_len = len;
+	if (len == 0 || ((const char *)args)[0] == '!') {
+		return NULL;
+	}
+
+	engine = calloc(1, sizeof(*engine));
+	SPDK_CU_ASSERT_FATAL(engine != NULL);
+	engine->key = ((const char *)args)[0];
+	g_engine_count++;
+
+	return engine;
+}
+
+static void
+ut_engine_free(struct ut_engine *engine)
+{
+	if (engine != NULL) {
+		g_engine_count--;
+	}
+	free(engine);
+}
+
+static int
+ut_engine_scan(struct ut_engine *engine, struct iovec *iov, int iovcnt,
+	       int (*match_fn)(void *cb_arg, struct iovec *iov, int iovcnt), void *cb_arg)
+{
+	struct iovec line;
+	char *p, *end, *nl;
+	int rc;
+
+	CU_ASSERT(iovcnt == 1);
+	p = iov[0].iov_base;
+	end = p + iov[0].iov_len;
+	while (p < end) {
+		nl = memchr(p, '\n', end - p);
+		line.iov_base = p;
+		line.iov_len = nl != NULL ? (size_t)(nl - p + 1) : (size_t)(end - p);
+		p += line.iov_len;
+		engine->line_end += line.iov_len;
+		if (*(char *)line.iov_base == engine->key) {
+			rc = match_fn(cb_arg, &line, 1);
+			if (rc != 0) {
+				return rc;
+			}
+		}
+	}
+
+	return 0;
+}
+
+struct nvmf_ndp_filter *
+nvmf_ndp_filter_create(const void *prog, size_t len)
+{
+	return (struct nvmf_ndp_filter *)ut_engine_create(prog, len);
+}
+
+void
+nvmf_ndp_filter_free(struct nvmf_ndp_filter *filter)
+{
+	ut_engine_free((struct ut_engine *)filter);
+}
+
+int
+nvmf_ndp_filter_scan(struct nvmf_ndp_filter *filter, struct iovec *iov, int iovcnt,
+		     nvmf_ndp_filter_match_fn match_fn, void *cb_arg)
+{
+	return ut_engine_scan((struct ut_engine *)filter, iov, iovcnt, match_fn, cb_arg);
+}
+
+uint64_t
+nvmf_ndp_filter_record_end(const struct nvmf_ndp_filter *filter)
+{
+	return ((const struct ut_engine *)filter)->line_end;
+}
+
+struct nvmf_ndp_regex *
+nvmf_ndp_regex_create(const void *prog, size_t len)
+{
+	return (struct nvmf_ndp_regex *)ut_engine_create(prog, len);
+}
+
+void
+nvmf_ndp_regex_free(struct nvmf_ndp_regex *regex)
+{
+	ut_engine_free((struct ut_engine *)regex);
+}
+
+int
+nvmf_ndp_regex_scan(struct nvmf_ndp_regex *regex, struct iovec *iov, int iovcnt,
+		    nvmf_ndp_regex_match_fn match_fn, void *cb_arg)
+{
+	return ut_engine_scan((struct ut_engine *)regex, iov, iovcnt, match_fn, cb_arg);
+}
+
+uint64_t
+nvmf_ndp_regex_line_end(const struct nvmf_ndp_regex *regex)
+{
+	return ((const struct ut_engine *)regex)->line_end;
+}
+
+struct ut_req {
+	union nvmf_h2c_msg		cmd;
+	union nvmf_c2h_msg		rsp;
+	struct spdk_nvmf_request	req;
+	uint64_t			buf[16];
+};
+
+/* A file of len bytes at LBA 100, followed by args */
+static void
+ut_req_init(struct ut_req *r, uint8_t opc, uint64_t len, const char *args, uint16_t args_len)
+{
+	memset(r, 0, sizeof(*r));
+	r->req.cmd = &r->cmd;
+	r->req.rsp = &r->rsp;
+	r->cmd.nvme_cmd.opc = opc;
+	r->cmd.nvme_cmd.cdw10 = args_len;
+	r->cmd.nvme_cmd.cdw11 = 1;
+
+	r->buf[0] = htole64(len);
+	r->buf[1] = htole64(100);
+	r->buf[2] = htole64(1);
+	memcpy(&r->buf[3], args, strlen(args));
+
+	r->req.length = sizeof(r->buf);
+	r->req.iovcnt = 1;
+	r->req.iov[0].iov_base = r->buf;
+	r->req.iov[0].iov_len = sizeof(r->buf);
+
+	g_status = -1;
+	g_completions = 0;
+	g_cursor = NULL;
+	g_num_streams = 0;
+	g_engine_args_len = 0;
+}
+
+static void
+ut_req_set_length(struct ut_req *r, uint32_t length)
+{
+	r->req.length = length;
+	r->req.iov[0].iov_len = length;
+}
+
+static void
+ut_args_len(uint8_t opc)
+{
+	struct ut_req r;
+	int rc;
+
+	/* The length in CDW10 is taken as is */
+	ut_req_init(&r, opc, 8, "mat", 3);
+	rc = g_ops[opc]->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_engine_args_len == 3);
+	CU_ASSERT(g_num_streams == 1);
+	CU_ASSERT(g_stream_opts.mode == NVMF_NDP_STREAM_MODE_LINES);
+	CU_ASSERT(g_stream_opts.length == 8);
+	CU_ASSERT(g_stream_opts.offset == 0);
+
+	/* The arguments are copied, the buffer is cleared for the result */
+	CU_ASSERT(r.buf[0] == 0 && r.buf[3] == 0);
+	ut_stream_finish("m\nx\nm\nx\n");
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(g_len == 4);
+	CU_ASSERT(memcmp(r.buf, "m\nm\n", 4) == 0);
+	CU_ASSERT(g_engine_count == 0);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	/* 0 for the rest of the buffer after the descriptor */
+	ut_req_init(&r, opc, 8, "mat", 0);
+	rc = g_ops[opc]->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	CU_ASSERT(g_engine_args_len == sizeof(r.buf) - NVMF_NDP_DESC_SIZE(1));
+	ut_stream_finish("x\n");
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_len == 0);
+	nvmf_ndp_cursor_free(g_cursor);
+
+	/* Arguments past the end of the buffer */
+	ut_req_init(&r, opc, 8, "mat", sizeof(r.buf) - NVMF_NDP_DESC_SIZE(1) + 1);
+	rc = g_ops[opc]->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_num_streams == 0);
+
+	/* No room left for the arguments */
+	ut_req_init(&r, opc, 8, "mat", 0);
+	ut_req_set_length(&r, NVMF_NDP_DESC_SIZE(1));
+	rc = g_ops[opc]->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+
+	/* Malformed arguments */
+	ut_req_init(&r, opc, 8, "!", 1);
+	rc = g_ops[opc]->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_COMPLETE);
+	CU_ASSERT(g_status == -EINVAL);
+	CU_ASSERT(g_num_streams == 0);
+	CU_ASSERT(g_engine_count == 0);
+}
+
+static void
+ut_resume(uint8_t opc)
+{
+	/* Matching lines of 40 and 60 bytes, at 0, 45 and 110 */
+	char file[200];
+	struct ut_req r;
+	int rc;
+
+	memset(file, '.', sizeof(file));
+	memcpy(&file[0], "m", 1);
+	file[39] = '\n';
+	file[44] = '\n';
+	memcpy(&file[45], "m", 1);
+	file[104] = '\n';
+	file[109] = '\n';
+	memcpy(&file[110], "m", 1);
+	file[169] = '\n';
+	file[170] = '\0';
+
+	/* The second line doesn't fit, the next part starts right after the first */
+	ut_req_init(&r, opc, 170, "m", 1);
+	ut_req_set_length(&r, 64);
+	rc = g_ops[opc]->exec(NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == SPDK_NVMF_REQUEST_EXEC_STATUS_ASYNCHRONOUS);
+	ut_stream_finish(file);
+	CU_ASSERT(g_completions == 1);
+	CU_ASSERT(g_status == 0);
+	CU_ASSERT(g_more);
+	CU_ASSERT(g_len == 40);
+	CU_ASSERT(g_offset == 40);
+	CU_ASSERT(memcmp(r.buf, file, 40) == 0);
+
+	/* Resumed there, as a fetch: a line longer than the buffer is truncated */
+	ut_req_set_length(&r, 32);
+	rc = g_cursor->run_fn(g_cursor, NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_stream_opts.offset == 40);
+	ut_stream_finish(file);
+	CU_ASSERT(g_completions == 2);
+	CU_ASSERT(g_more);
+	CU_ASSERT(g_len == 32);
+	CU_ASSERT(g_offset == 105);
+	CU_ASSERT(memcmp(r.buf, &file[45], 32) == 0);
+
+	/* The last part */
+	ut_req_set_length(&r, 64);
+	rc = g_cursor->run_fn(g_cursor, NULL, NULL, NULL, &r.req);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_stream_opts.offset == 105);
+	ut_stream_finish(file);
+	CU_ASSERT(g_completions == 3);
+	CU_ASSERT(!g_more);
+	CU_ASSERT(g_len == 60);
+	CU_ASSERT(g_offset == 170);
+	CU_ASSERT(memcmp(r.buf, &file[110], 60) == 0);
+	CU_ASSERT(g_engine_count == 0);
+	nvmf_ndp_cursor_free(g_cursor);
+}
+
+static void
+test_filter_args(void)
+{
+	ut_args_len(SPDK_NVME_OPC_CUSTOM_FILTER);
+}
+
+static void
+test_filter_resume(void)
+{
+	ut_resume(SPDK_NVME_OPC_CUSTOM_FILTER);
+}
+
+static void
+test_regex_args(void)
+{
+	ut_args_len(SPDK_NVME_OPC_CUSTOM_REGEX);
+}
+
+static void
+test_regex_resume(void)
+{
+	ut_resume(SPDK_NVME_OPC_CUSTOM_REGEX);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_ops", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_filter_args);
+	CU_ADD_TEST(suite, test_filter_resume);
+	CU_ADD_TEST(suite, test_regex_args);
+	CU_ADD_TEST(suite, test_regex_resume);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
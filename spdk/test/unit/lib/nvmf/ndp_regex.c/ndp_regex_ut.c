@@ -0,0 +1,337 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "nvmf/ndp_regex.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_LIT_MAX	16
+#define UT_PROG_SIZE	(sizeof(struct nvmf_ndp_regex_hdr) + 256 + \
+			 (UT_LIT_MAX + 3) * (UT_LIT_MAX + 2) * sizeof(uint16_t))
+
+struct ut_prog {
+	uint8_t		buf[UT_PROG_SIZE];
+	size_t		len;
+	uint16_t	num_states;
+	uint16_t	num_classes;
+};
+
+static void
+ut_prog_init(struct ut_prog *prog, uint16_t num_states, uint16_t num_classes, uint16_t start)
+{
+	struct nvmf_ndp_regex_hdr *hdr = (struct nvmf_ndp_regex_hdr *)prog->buf;
+
+	memset(prog, 0, sizeof(*prog));
+	to_le32(&hdr->magic, NVMF_NDP_REGEX_MAGIC);
+	to_le16(&hdr->num_states, num_states);
+	to_le16(&hdr->num_classes, num_classes);
+	to_le16(&hdr->start, start);
+	prog->num_states = num_states;
+	prog->num_classes = num_classes;
+	prog->len = sizeof(*hdr) + 256 + (size_t)num_states * num_classes * sizeof(uint16_t);
+	SPDK_CU_ASSERT_FATAL(prog->len <= sizeof(prog->buf));
+}
+
+static void
+ut_prog_set(struct ut_prog *prog, uint16_t state, uint16_t cls, uint16_t next)
+{
+	to_le16(prog->buf + sizeof(struct nvmf_ndp_regex_hdr) + 256 +
+		((size_t)state * prog->num_classes + cls) * sizeof(uint16_t), next);
+}
+
+/*
+ * Build the DFA of a literal, optionally anchored with "^" and "$".  State
+ * 2 + j means the first j characters of the literal were just seen.  Each
+ * character of the literal has its own class, class 0 is every other byte.
+ */
+static void
+ut_prog_literal(struct ut_prog *prog, const char *lit, bool bol, bool eol)
+{
+	uint8_t *classes = prog->buf + sizeof(struct nvmf_ndp_regex_hdr);
+	size_t m = strlen(lit), j, k, num_classes = 1;
+	uint8_t cls_byte[UT_LIT_MAX + 1] = {};
+	char seen[UT_LIT_MAX + 1];
+	uint16_t next, c;
+
+	SPDK_CU_ASSERT_FATAL(m > 0 && m <= UT_LIT_MAX);
+	for (j = 0; j < m; j++) {
+		if (memchr(lit, lit[j], j) == NULL) {
+			cls_byte[num_classes++] = lit[j];
+		}
+	}
+
+	/* Without "$", seeing the whole literal is a match, no state for it */
+	ut_prog_init(prog, 2 + m + eol, num_classes + 1, 2);
+	for (c = 1; c < num_classes; c++) {
+		classes[cls_byte[c]] = c;
+	}
+
+	for (j = 0; j < m + eol; j++) {
+		for (c = 0; c < num_classes; c++) {
+			/* The longest suffix of what was seen that starts the literal */
+			memcpy(seen, lit, j);
+			seen[j] = c == 0 ? '\0' : cls_byte[c];
+			for (k = spdk_min(j + 1, m); k > 0; k--) {
+				if (memcmp(seen + j + 1 - k, lit, k) == 0) {
+					break;
+				}
+			}
+			if (k == m && !eol) {
+				next = NVMF_NDP_REGEX_MATCH;
+			} else if (bol && k != j + 1) {
+				next = NVMF_NDP_REGEX_DEAD;
+			} else {
+				next = 2 + k;
+			}
+			ut_prog_set(prog, 2 + j, c, next);
+		}
+		ut_prog_set(prog, 2 + j, num_classes, eol && j == m ? NVMF_NDP_REGEX_MATCH :
+			    NVMF_NDP_REGEX_DEAD);
+	}
+}
+
+struct ut_matches {
+	char		buf[256];
+	size_t		len;
+	int		count;
+	int		stop_after;
+	int		last_iovcnt;
+};
+
+static int
+ut_match(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct ut_matches *matches = cb_arg;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		SPDK_CU_ASSERT_FATAL(matches->len + iov[i].iov_len <= sizeof(matches->buf));
+		memcpy(matches->buf + matches->len, iov[i].iov_base, iov[i].iov_len);
+		matches->len += iov[i].iov_len;
+	}
+	matches->last_iovcnt = iovcnt;
+
+	return ++matches->count == matches->stop_after;
+}
+
+static const char *
+ut_grep(const char *lit, bool bol, bool eol, const char *text, struct ut_matches *matches)
+{
+	struct nvmf_ndp_regex *regex;
+	struct ut_prog prog;
+	struct iovec iov = {
+		.iov_base = (char *)text,
+		.iov_len = strlen(text),
+	};
+
+	ut_prog_literal(&prog, lit, bol, eol);
+	regex = nvmf_ndp_regex_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(regex != NULL);
+
+	memset(matches, 0, sizeof(*matches));
+	CU_ASSERT(nvmf_ndp_regex_scan(regex, &iov, 1, ut_match, matches) == 0);
+	nvmf_ndp_regex_free(regex);
+	matches->buf[matches->len] = '\0';
+
+	return matches->buf;
+}
+
+static void
+test_regex_create(void)
+{
+	struct nvmf_ndp_regex *regex;
+	struct ut_prog prog;
+
+	ut_prog_literal(&prog, "abca", false, false);
+	regex = nvmf_ndp_regex_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(regex != NULL);
+	/* 'a', 'b', 'c', every other byte and the end of line: rows of 8 */
+	CU_ASSERT(regex->shift == 3);
+	CU_ASSERT(regex->eol_class == 4);
+	CU_ASSERT(regex->start == 2 << 3);
+	nvmf_ndp_regex_free(regex);
+
+	/* Truncated, bad magic, state and class counts, start state */
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len - 1) == NULL);
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, sizeof(struct nvmf_ndp_regex_hdr) + 255) == NULL);
+
+	prog.buf[0] ^= 0xff;
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len) == NULL);
+
+	ut_prog_init(&prog, 1, 2, 0);
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len) == NULL);
+	ut_prog_init(&prog, 2, 1, 0);
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len) == NULL);
+	ut_prog_init(&prog, 2, 2, 0);
+	to_le16(&((struct nvmf_ndp_regex_hdr *)prog.buf)->num_classes, 257);
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, sizeof(prog.buf)) == NULL);
+	ut_prog_init(&prog, 3, 2, 3);
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len) == NULL);
+
+	/* Bytes can't be in the end of line class */
+	ut_prog_init(&prog, 3, 2, 2);
+	regex = nvmf_ndp_regex_create(prog.buf, prog.len);
+	CU_ASSERT(regex != NULL);
+	nvmf_ndp_regex_free(regex);
+	prog.buf[sizeof(struct nvmf_ndp_regex_hdr) + 'x'] = 1;
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len) == NULL);
+
+	/* Transitions out of the table */
+	ut_prog_init(&prog, 3, 2, 2);
+	ut_prog_set(&prog, 2, 1, 3);
+	CU_ASSERT(nvmf_ndp_regex_create(prog.buf, prog.len) == NULL);
+}
+
+static void
+test_regex_literal(void)
+{
+	struct ut_matches m;
+
+	CU_ASSERT_STRING_EQUAL(ut_grep("error", false, false,
+					"ok\nan error here\nerro\nerrror\nerrorerror\n", &m),
+			       "an error here\nerrorerror\n");
+	CU_ASSERT(m.count == 2);
+
+	/* Failing in the middle of a partial match */
+	CU_ASSERT_STRING_EQUAL(ut_grep("abab", false, false, "abaabab\nababa\nabaab\n", &m),
+			       "abaabab\nababa\n");
+
+	/* Anchored at either end */
+	CU_ASSERT_STRING_EQUAL(ut_grep("ab", true, false, "ab\ncab\nabc\n", &m), "ab\nabc\n");
+	CU_ASSERT_STRING_EQUAL(ut_grep("ab", false, true, "ab\nabc\ncab\naab\n", &m),
+			       "ab\ncab\naab\n");
+	CU_ASSERT_STRING_EQUAL(ut_grep("ab", true, true, "ab\nabab\nab\n", &m), "ab\nab\n");
+
+	/* Empty lines are only matched by nothing */
+	CU_ASSERT_STRING_EQUAL(ut_grep("a", false, false, "\n\na\n\n", &m), "a\n");
+}
+
+static void
+test_regex_line_end(void)
+{
+	struct ut_matches m;
+
+	/* "$" matches before "\r\n", the line is returned as it is */
+	CU_ASSERT_STRING_EQUAL(ut_grep("ab", false, true, "ab\r\nab\rc\r\n\r\n", &m), "ab\r\n");
+
+	/* A last line without newline gets one */
+	CU_ASSERT_STRING_EQUAL(ut_grep("ab", false, true, "x\nab", &m), "ab\n");
+	CU_ASSERT(m.last_iovcnt == 2);
+	CU_ASSERT_STRING_EQUAL(ut_grep("ab", false, false, "ab\n", &m), "ab\n");
+	CU_ASSERT(m.last_iovcnt == 1);
+}
+
+static void
+test_regex_escape(void)
+{
+	struct nvmf_ndp_regex *regex;
+	struct ut_matches m;
+	struct ut_prog prog;
+	char line[200];
+	struct iovec iov = {
+		.iov_base = line,
+		.iov_len = sizeof(line),
+	};
+
+	/* Only 'x' leaves the start state, several bytes leave the state after it */
+	ut_prog_literal(&prog, "xy", false, false);
+	regex = nvmf_ndp_regex_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(regex != NULL);
+	CU_ASSERT(regex->escape[NVMF_NDP_REGEX_DEAD] == -1);
+	CU_ASSERT(regex->escape[NVMF_NDP_REGEX_MATCH] == -1);
+	CU_ASSERT(regex->escape[2] == 'x');
+	CU_ASSERT(regex->escape[3] == -1);
+
+	/* Skipped through, up to the newline and across it */
+	memset(line, 'a', sizeof(line));
+	line[50] = '\n';
+	line[150] = 'x';
+	line[151] = 'y';
+	line[199] = '\n';
+	memset(&m, 0, sizeof(m));
+	CU_ASSERT(nvmf_ndp_regex_scan(regex, &iov, 1, ut_match, &m) == 0);
+	CU_ASSERT(m.count == 1);
+	CU_ASSERT(m.len == 149);
+	CU_ASSERT(nvmf_ndp_regex_line_end(regex) == 200);
+
+	/* The 'x' at the end of the line doesn't match */
+	line[151] = '\n';
+	memset(&m, 0, sizeof(m));
+	CU_ASSERT(nvmf_ndp_regex_scan(regex, &iov, 1, ut_match, &m) == 0);
+	CU_ASSERT(m.count == 0);
+	nvmf_ndp_regex_free(regex);
+
+	/* Nothing but the end of line leaves the state: every line matches */
+	ut_prog_init(&prog, 3, 2, 2);
+	ut_prog_set(&prog, 2, 0, 2);
+	ut_prog_set(&prog, 2, 1, NVMF_NDP_REGEX_MATCH);
+	regex = nvmf_ndp_regex_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(regex != NULL);
+	CU_ASSERT(regex->escape[2] == REGEX_ESCAPE_NONE);
+	memset(&m, 0, sizeof(m));
+	CU_ASSERT(nvmf_ndp_regex_scan(regex, &iov, 1, ut_match, &m) == 0);
+	CU_ASSERT(m.count == 3);
+	nvmf_ndp_regex_free(regex);
+}
+
+static void
+test_regex_stop(void)
+{
+	struct nvmf_ndp_regex *regex;
+	struct ut_matches m = { .stop_after = 2 };
+	struct ut_prog prog;
+	const char *text[] = { "a\nb\na1\n", "a2\nc\na3\na4\n" };
+	struct iovec iov[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		iov[i].iov_base = (char *)text[i];
+		iov[i].iov_len = strlen(text[i]);
+	}
+
+	ut_prog_literal(&prog, "a", false, false);
+	regex = nvmf_ndp_regex_create(prog.buf, prog.len);
+	SPDK_CU_ASSERT_FATAL(regex != NULL);
+
+	/* Stopped on the second match, the input resumes after its line */
+	CU_ASSERT(nvmf_ndp_regex_scan(regex, iov, 2, ut_match, &m) == 1);
+	CU_ASSERT(m.count == 2);
+	CU_ASSERT(m.len == 5);
+	CU_ASSERT(memcmp(m.buf, "a\na1\n", 5) == 0);
+	CU_ASSERT(nvmf_ndp_regex_line_end(regex) == 7);
+
+	/* Offsets are counted across the calls */
+	m.stop_after = 0;
+	CU_ASSERT(nvmf_ndp_regex_scan(regex, &iov[1], 1, ut_match, &m) == 0);
+	CU_ASSERT(m.count == 5);
+	CU_ASSERT(nvmf_ndp_regex_line_end(regex) == 7 + 11);
+
+	nvmf_ndp_regex_free(regex);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_regex", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_regex_create);
+	CU_ADD_TEST(suite, test_regex_literal);
+	CU_ADD_TEST(suite, test_regex_line_end);
+	CU_ADD_TEST(suite, test_regex_escape);
+	CU_ADD_TEST(suite, test_regex_stop);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
@@ -0,0 +1,858 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "common/lib/test_env.c"
+#include "nvmf/ndp_stream.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_BLOCK_SIZE	512
+#define UT_NUM_BLOCKS	64
+#define UT_MAX_IOS	16
+
+DEFINE_STUB(spdk_bdev_get_block_size, uint32_t, (const struct spdk_bdev *bdev), UT_BLOCK_SIZE);
+DEFINE_STUB(spdk_bdev_get_num_blocks, uint64_t, (const struct spdk_bdev *bdev), UT_NUM_BLOCKS);
+DEFINE_STUB(spdk_bdev_get_optimal_io_boundary, uint32_t, (const struct spdk_bdev *bdev), 0);
+DEFINE_STUB(spdk_bdev_reads_whole_units, bool, (const struct spdk_bdev *bdev), false);
+DEFINE_STUB(spdk_bdev_desc_get_bdev, struct spdk_bdev *, (struct spdk_bdev_desc *desc),
+	    (struct spdk_bdev *)0xbdef);
+DEFINE_STUB_V(spdk_bdev_free_io, (struct spdk_bdev_io *bdev_io));
+DEFINE_STUB_V(spdk_iobuf_get_opts, (struct spdk_iobuf_opts *opts, size_t opts_size));
+DEFINE_STUB(spdk_iobuf_get, void *, (struct spdk_iobuf_channel *ch, uint64_t len,
+				     struct spdk_iobuf_entry *entry, spdk_iobuf_get_cb cb_fn), NULL);
+DEFINE_STUB_V(spdk_iobuf_put, (struct spdk_iobuf_channel *ch, void *buf, uint64_t len));
+DEFINE_STUB(nvmf_bdev_zcopy_enabled, bool, (struct spdk_bdev *bdev), false);
+DEFINE_STUB_V(spdk_iobuf_entry_abort, (struct spdk_iobuf_channel *ch,
+				       struct spdk_iobuf_entry *entry, uint64_t len));
+
+struct ut_io {
+	void			*buf;
+	/* Zero copy read, the bdev points it at its own buffer */
+	struct iovec		*zcopy_iov;
+	uint64_t		offset_blocks;
+	uint64_t		num_blocks;
+	spdk_bdev_io_completion_cb	cb;
+	void			*cb_arg;
+};
+
+static char g_disk[UT_NUM_BLOCKS * UT_BLOCK_SIZE];
+static struct ut_io g_ios[UT_MAX_IOS];
+static int g_num_ios;
+static int g_read_rc;
+static struct spdk_bdev_io_wait_entry *g_io_wait;
+/* Pending spdk_bdev_zcopy_end() completions */
+static struct ut_io g_ends[UT_MAX_IOS];
+static int g_num_ends;
+/* Offload job handed to nvmf_ndp_offload(), run by ut_complete_offload() */
+static bool g_offload_enabled;
+static nvmf_ndp_offload_work_fn g_offload_work_fn;
+static nvmf_ndp_offload_done_fn g_offload_done_fn;
+static void *g_offload_ctx;
+/* Jobs begun and not ended yet, and the status nvmf_ndp_job_check() returns */
+static int g_num_jobs;
+static int g_job_status;
+
+int
+spdk_bdev_read_blocks(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch, void *buf,
+		      uint64_t offset_blocks, uint64_t num_blocks,
+		      spdk_bdev_io_completion_cb cb, void *cb_arg)
+{
+	if (g_read_rc != 0) {
+		return g_read_rc;
+	}
+
+	SPDK_CU_ASSERT_FATAL(g_num_ios < UT_MAX_IOS);
+	g_ios[g_num_ios].buf = buf;
+	g_ios[g_num_ios].zcopy_iov = NULL;
+	g_ios[g_num_ios].offset_blocks = offset_blocks;
+	g_ios[g_num_ios].num_blocks = num_blocks;
+	g_ios[g_num_ios].cb = cb;
+	g_ios[g_num_ios].cb_arg = cb_arg;
+	g_num_ios++;
+
+	return 0;
+}
+
+int
+spdk_bdev_zcopy_start(struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
+		      struct iovec *iov, int iovcnt, uint64_t offset_blocks, uint64_t num_blocks,
+		      bool populate, spdk_bdev_io_completion_cb cb, void *cb_arg)
+{
+	int rc;
+
+	CU_ASSERT(iovcnt == 1);
+	CU_ASSERT(populate);
+	rc = spdk_bdev_read_blocks(desc, ch, NULL, offset_blocks, num_blocks, cb, cb_arg);
+	if (rc == 0) {
+		g_ios[g_num_ios - 1].zcopy_iov = iov;
+	}
+
+	return rc;
+}
+
+int
+spdk_bdev_zcopy_end(struct spdk_bdev_io *bdev_io, bool commit,
+		    spdk_bdev_io_completion_cb cb, void *cb_arg)
+{
+	CU_ASSERT(!commit);
+	SPDK_CU_ASSERT_FATAL(g_num_ends < UT_MAX_IOS);
+	g_ends[g_num_ends].cb = cb;
+	g_ends[g_num_ends].cb_arg = cb_arg;
+	g_num_ends++;
+
+	return 0;
+}
+
+int
+nvmf_ndp_offload(nvmf_ndp_offload_work_fn work_fn, nvmf_ndp_offload_done_fn done_fn, void *ctx)
+{
+	if (!g_offload_enabled) {
+		return -ENODEV;
+	}
+
+	/* The stream never has more than one chunk out */
+	CU_ASSERT(g_offload_ctx == NULL);
+	g_offload_work_fn = work_fn;
+	g_offload_done_fn = done_fn;
+	g_offload_ctx = ctx;
+
+	return 0;
+}
+
+void
+nvmf_ndp_job_begin(struct nvmf_ndp_job *job, struct spdk_nvmf_request *req)
+{
+	job->req = req;
+	g_num_jobs++;
+}
+
+int
+nvmf_ndp_job_check(struct nvmf_ndp_job *job)
+{
+	return g_job_status;
+}
+
+void
+nvmf_ndp_job_end(struct nvmf_ndp_job *job)
+{
+	CU_ASSERT(g_num_jobs > 0);
+	g_num_jobs--;
+}
+
+int
+spdk_bdev_queue_io_wait(struct spdk_bdev *bdev, struct spdk_io_channel *ch,
+			struct spdk_bdev_io_wait_entry *entry)
+{
+	g_io_wait = entry;
+	return 0;
+}
+
+/* Complete the idx-th outstanding read */
+static void
+ut_complete_io(int idx, bool success)
+{
+	struct ut_io io;
+
+	SPDK_CU_ASSERT_FATAL(idx < g_num_ios);
+	io = g_ios[idx];
+	memmove(&g_ios[idx], &g_ios[idx + 1], (g_num_ios - idx - 1) * sizeof(io));
+	g_num_ios--;
+
+	if (io.zcopy_iov != NULL) {
+		io.zcopy_iov->iov_base = &g_disk[io.offset_blocks * UT_BLOCK_SIZE];
+		io.zcopy_iov->iov_len = io.num_blocks * UT_BLOCK_SIZE;
+	} else {
+		memcpy(io.buf, &g_disk[io.offset_blocks * UT_BLOCK_SIZE],
+		       io.num_blocks * UT_BLOCK_SIZE);
+	}
+	io.cb((struct spdk_bdev_io *)0x1, success, io.cb_arg);
+}
+
+/* Hand the oldest zero copy buffer back */
+static void
+ut_complete_end(void)
+{
+	struct ut_io end;
+
+	SPDK_CU_ASSERT_FATAL(g_num_ends > 0);
+	end = g_ends[0];
+	memmove(&g_ends[0], &g_ends[1], (g_num_ends - 1) * sizeof(end));
+	g_num_ends--;
+
+	end.cb((struct spdk_bdev_io *)0x1, true, end.cb_arg);
+}
+
+static void
+ut_complete_offload(void)
+{
+	void *ctx = g_offload_ctx;
+
+	SPDK_CU_ASSERT_FATAL(ctx != NULL);
+	g_offload_ctx = NULL;
+	g_offload_done_fn(ctx, g_offload_work_fn(ctx));
+}
+
+static void
+ut_complete_all(void)
+{
+	while (g_num_ios > 0) {
+		ut_complete_io(0, true);
+	}
+}
+
+struct ut_sink {
+	char	data[sizeof(g_disk)];
+	size_t	len;
+	int	calls;
+	int	stop_after;
+	int	status;
+	bool	done;
+	/* Check that every iovec ends with a newline, except at the end of the stream */
+	bool	whole_lines;
+	size_t	total;
+};
+
+static int
+ut_data(void *cb_arg, struct iovec *iov, int iovcnt)
+{
+	struct ut_sink *sink = cb_arg;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		SPDK_CU_ASSERT_FATAL(sink->len + iov[i].iov_len <= sizeof(sink->data));
+		memcpy(&sink->data[sink->len], iov[i].iov_base, iov[i].iov_len);
+		sink->len += iov[i].iov_len;
+		if (sink->whole_lines && sink->len < sink->total) {
+			CU_ASSERT(((char *)iov[i].iov_base)[iov[i].iov_len - 1] == '\n');
+		}
+	}
+
+	sink->calls++;
+	if (sink->stop_after != 0 && sink->calls == sink->stop_after) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+ut_done(void *cb_arg, int status)
+{
+	struct ut_sink *sink = cb_arg;
+
+	CU_ASSERT(!sink->done);
+	sink->done = true;
+	sink->status = status;
+}
+
+static struct spdk_nvmf_qpair g_qpair;
+static struct spdk_nvmf_request g_req = { .qpair = &g_qpair };
+
+static void
+ut_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(g_disk); i++) {
+		g_disk[i] = 'a' + i % 26;
+	}
+	g_num_ios = 0;
+	g_num_ends = 0;
+	g_read_rc = 0;
+	g_io_wait = NULL;
+	g_offload_enabled = false;
+	g_offload_ctx = NULL;
+	g_num_jobs = 0;
+	g_job_status = 0;
+	MOCK_SET(nvmf_bdev_zcopy_enabled, false);
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 0);
+}
+
+static void
+test_stream_raw_in_order(void)
+{
+	struct nvmf_ndp_extent extents[] = {
+		{ .offset_blocks = 8, .num_blocks = 5 },
+		{ .offset_blocks = 0, .num_blocks = 3 },
+	};
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = 2 * UT_BLOCK_SIZE;
+	opts.depth = 3;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, extents, 2, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+
+	/* Only depth chunks are in flight */
+	CU_ASSERT(g_num_ios == 3);
+	CU_ASSERT(g_ios[0].offset_blocks == 8 && g_ios[0].num_blocks == 2);
+	CU_ASSERT(g_ios[1].offset_blocks == 10 && g_ios[1].num_blocks == 2);
+	/* Chunks don't cross extents */
+	CU_ASSERT(g_ios[2].offset_blocks == 12 && g_ios[2].num_blocks == 1);
+
+	/* Completing out of order doesn't deliver anything */
+	ut_complete_io(2, true);
+	ut_complete_io(1, true);
+	CU_ASSERT(sink.calls == 0);
+	CU_ASSERT(g_num_ios == 1);
+
+	/* The first chunk releases all three, and two new reads are issued */
+	ut_complete_io(0, true);
+	CU_ASSERT(sink.calls == 3);
+	CU_ASSERT(g_num_ios == 2);
+	CU_ASSERT(g_ios[0].offset_blocks == 0 && g_ios[0].num_blocks == 2);
+	CU_ASSERT(g_ios[1].offset_blocks == 2 && g_ios[1].num_blocks == 1);
+	CU_ASSERT(!sink.done);
+
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.calls == 5);
+	CU_ASSERT(sink.len == 8 * UT_BLOCK_SIZE);
+	CU_ASSERT(memcmp(sink.data, &g_disk[8 * UT_BLOCK_SIZE], 5 * UT_BLOCK_SIZE) == 0);
+	CU_ASSERT(memcmp(&sink.data[5 * UT_BLOCK_SIZE], g_disk, 3 * UT_BLOCK_SIZE) == 0);
+}
+
+static void
+test_stream_length(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 4 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = 2 * UT_BLOCK_SIZE + 100;
+	opts.length = 3 * UT_BLOCK_SIZE + 10;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_ios == 2);
+
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.len == 3 * UT_BLOCK_SIZE + 10);
+	CU_ASSERT(memcmp(sink.data, g_disk, sink.len) == 0);
+}
+
+static void
+test_stream_offset(void)
+{
+	struct nvmf_ndp_extent extents[] = {
+		{ .offset_blocks = 8, .num_blocks = 2 },
+		{ .offset_blocks = 0, .num_blocks = 4 },
+	};
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = 2 * UT_BLOCK_SIZE;
+	opts.length = 5 * UT_BLOCK_SIZE + 10;
+	/* Resume in the middle of the first block of the second extent */
+	opts.offset = 2 * UT_BLOCK_SIZE + 100;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, extents, 2, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 2);
+	CU_ASSERT(g_ios[0].offset_blocks == 0 && g_ios[0].num_blocks == 2);
+	CU_ASSERT(g_ios[1].offset_blocks == 2 && g_ios[1].num_blocks == 2);
+
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.len == 3 * UT_BLOCK_SIZE + 10 - 100);
+	CU_ASSERT(memcmp(sink.data, &g_disk[100], sink.len) == 0);
+
+	/* Nothing left after the offset */
+	opts.offset = opts.length;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, extents, 2, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == -EINVAL);
+	CU_ASSERT(g_num_ios == 0);
+}
+
+static void
+test_stream_boundary(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 2, .num_blocks = 14 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	void *bufs[4];
+	int rc, i, j, reused;
+
+	/* Units of 4 blocks, as a compressed volume with 2KiB chunks would have */
+	ut_init();
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 4);
+	MOCK_SET(spdk_bdev_reads_whole_units, true);
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = 6 * UT_BLOCK_SIZE;
+	opts.depth = 4;
+
+	/* The extent starts in the middle of a unit, the first read ends at the next */
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 4);
+	CU_ASSERT(g_ios[0].offset_blocks == 2 && g_ios[0].num_blocks == 2);
+	CU_ASSERT(g_ios[1].offset_blocks == 4 && g_ios[1].num_blocks == 4);
+	CU_ASSERT(g_ios[2].offset_blocks == 8 && g_ios[2].num_blocks == 4);
+	CU_ASSERT(g_ios[3].offset_blocks == 12 && g_ios[3].num_blocks == 4);
+	for (i = 0; i < g_num_ios; i++) {
+		CU_ASSERT((uintptr_t)g_ios[i].buf % (4 * UT_BLOCK_SIZE) == 0);
+		bufs[i] = g_ios[i].buf;
+	}
+
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.len == 14 * UT_BLOCK_SIZE);
+	CU_ASSERT(memcmp(sink.data, &g_disk[2 * UT_BLOCK_SIZE], sink.len) == 0);
+
+	/* Resuming in the middle of a unit reads it from its start */
+	memset(&sink, 0, sizeof(sink));
+	opts.offset = 7 * UT_BLOCK_SIZE + 10;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 2);
+	CU_ASSERT(g_ios[0].offset_blocks == 8 && g_ios[0].num_blocks == 4);
+	CU_ASSERT(g_ios[1].offset_blocks == 12 && g_ios[1].num_blocks == 4);
+
+	/* With the buffers the previous stream freed */
+	for (i = 0, reused = 0; i < g_num_ios; i++) {
+		for (j = 0; j < 4; j++) {
+			reused += g_ios[i].buf == bufs[j];
+		}
+	}
+	CU_ASSERT(reused == 2);
+
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.len == 7 * UT_BLOCK_SIZE - 10);
+	CU_ASSERT(memcmp(sink.data, &g_disk[9 * UT_BLOCK_SIZE + 10], sink.len) == 0);
+
+	/* Units that can't be aligned to are ignored */
+	memset(&sink, 0, sizeof(sink));
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 3);
+	opts.offset = 0;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 3);
+	CU_ASSERT(g_ios[0].offset_blocks == 2 && g_ios[0].num_blocks == 6);
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.len == 14 * UT_BLOCK_SIZE);
+
+	/* So are those of other bdevs, which split I/O on their own */
+	memset(&sink, 0, sizeof(sink));
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 4);
+	MOCK_SET(spdk_bdev_reads_whole_units, false);
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 3);
+	CU_ASSERT(g_ios[0].offset_blocks == 2 && g_ios[0].num_blocks == 6);
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.len == 14 * UT_BLOCK_SIZE);
+
+	MOCK_SET(spdk_bdev_get_optimal_io_boundary, 0);
+	nvmf_ndp_stream_buf_cache_free();
+	CU_ASSERT(t_nvmf_ndp_stream_buf_cache.num_bufs == 0);
+}
+
+static void
+test_stream_lines(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 16 };
+	struct nvmf_ndp_stream_opts opts;
+	size_t i, len = 16 * UT_BLOCK_SIZE - 7;
+	struct ut_sink sink = { .whole_lines = true, .total = len };
+	int rc;
+
+	ut_init();
+	/* Lines of various length, some longer than a chunk; no newline at the end */
+	for (i = 0; i < len; i++) {
+		if (i % 97 == 96 && (i < 3000 || i > 4500)) {
+			g_disk[i] = '\n';
+		}
+	}
+	g_disk[len - 1] = 'z';
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	opts.chunk_size = UT_BLOCK_SIZE;
+	opts.length = len;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+
+	while (g_num_ios > 0) {
+		ut_complete_io(g_num_ios - 1, true);
+	}
+
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.len == len);
+	CU_ASSERT(memcmp(sink.data, g_disk, len) == 0);
+}
+
+static void
+test_stream_lines_long_record(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 4 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	g_disk[10] = '\n';
+
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.mode = NVMF_NDP_STREAM_MODE_LINES;
+	opts.chunk_size = UT_BLOCK_SIZE;
+	opts.max_record_len = 1000;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	ut_complete_all();
+
+	/* "...\n", then the rest is split in pieces of max_record_len */
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.calls == 4);
+	CU_ASSERT(sink.len == 4 * UT_BLOCK_SIZE);
+	CU_ASSERT(memcmp(sink.data, g_disk, sink.len) == 0);
+}
+
+static void
+test_stream_early_stop(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 32 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = { .stop_after = 2 };
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = UT_BLOCK_SIZE;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+
+	ut_complete_io(0, true);
+	ut_complete_io(0, true);
+	CU_ASSERT(sink.calls == 2);
+	/* The stream waits for the reads still in flight */
+	CU_ASSERT(g_num_ios == 2);
+	CU_ASSERT(!sink.done);
+
+	ut_complete_all();
+	CU_ASSERT(sink.calls == 2);
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+}
+
+static void
+test_stream_read_error(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 32 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = UT_BLOCK_SIZE;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+
+	ut_complete_io(1, false);
+	CU_ASSERT(!sink.done);
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == -EIO);
+	CU_ASSERT(sink.calls == 0);
+	CU_ASSERT(g_num_ios == 0);
+}
+
+static void
+test_stream_abort(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 32 };
+	struct nvmf_ndp_stream_opts opts;
+	struct nvmf_ndp_job job = {};
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = UT_BLOCK_SIZE;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_jobs == 1);
+
+	ut_complete_io(0, true);
+	CU_ASSERT(sink.calls == 1);
+
+	/* The next chunk isn't delivered, nor is anything read any more */
+	g_job_status = -ECANCELED;
+	ut_complete_io(0, true);
+	CU_ASSERT(sink.calls == 1);
+	CU_ASSERT(!sink.done);
+	ut_complete_all();
+	CU_ASSERT(sink.calls == 1);
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == -ECANCELED);
+	CU_ASSERT(g_num_ios == 0);
+	CU_ASSERT(g_num_jobs == 0);
+
+	/* A stream run under the job of its command doesn't track one of its own */
+	ut_init();
+	memset(&sink, 0, sizeof(sink));
+	opts.job = &job;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_jobs == 0);
+	g_job_status = -ETIMEDOUT;
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == -ETIMEDOUT);
+	CU_ASSERT(sink.calls == 0);
+}
+
+static void
+test_stream_nomem(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 0, .num_blocks = 2 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = UT_BLOCK_SIZE;
+	opts.depth = 1;
+
+	g_read_rc = -ENOMEM;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	CU_ASSERT(g_num_ios == 0);
+	SPDK_CU_ASSERT_FATAL(g_io_wait != NULL);
+
+	/* The read is resubmitted once the bdev has resources again */
+	g_read_rc = 0;
+	g_io_wait->cb_fn(g_io_wait->cb_arg);
+	CU_ASSERT(g_num_ios == 1);
+
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.len == 2 * UT_BLOCK_SIZE);
+}
+
+static void
+test_stream_invalid(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = UT_NUM_BLOCKS - 1, .num_blocks = 2 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	nvmf_ndp_stream_opts_init(&opts);
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == -ERANGE);
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, NULL, 0, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == -EINVAL);
+
+	extent.offset_blocks = 0;
+	g_read_rc = -EIO;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == -EIO);
+
+	CU_ASSERT(!sink.done);
+	CU_ASSERT(g_num_ios == 0);
+}
+
+static void
+test_stream_zcopy(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 4, .num_blocks = 6 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	MOCK_SET(nvmf_bdev_zcopy_enabled, true);
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = 2 * UT_BLOCK_SIZE;
+	opts.depth = 2;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 2);
+	CU_ASSERT(g_ios[0].zcopy_iov != NULL);
+	CU_ASSERT(g_ios[0].offset_blocks == 4 && g_ios[0].num_blocks == 2);
+
+	/* The chunk is delivered from the bdev's buffer, then handed back */
+	ut_complete_io(0, true);
+	CU_ASSERT(sink.calls == 1);
+	CU_ASSERT(g_num_ends == 1);
+	CU_ASSERT(g_num_ios == 1);
+
+	/* The slot is only refilled once the buffer is released */
+	ut_complete_end();
+	CU_ASSERT(g_num_ios == 2);
+	CU_ASSERT(g_ios[1].offset_blocks == 8);
+
+	while (g_num_ios > 0 || g_num_ends > 0) {
+		CU_ASSERT(!sink.done);
+		if (g_num_ios > 0) {
+			ut_complete_io(0, true);
+		} else {
+			ut_complete_end();
+		}
+	}
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.calls == 3);
+	CU_ASSERT(sink.len == 6 * UT_BLOCK_SIZE);
+	CU_ASSERT(memcmp(sink.data, &g_disk[4 * UT_BLOCK_SIZE], sink.len) == 0);
+
+	/* Stopping releases the chunks read ahead */
+	memset(&sink, 0, sizeof(sink));
+	sink.stop_after = 1;
+	opts.depth = 3;
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	ut_complete_io(2, true);
+	ut_complete_io(1, true);
+	ut_complete_io(0, true);
+	CU_ASSERT(sink.calls == 1);
+	CU_ASSERT(g_num_ios == 0);
+	CU_ASSERT(g_num_ends == 3);
+	CU_ASSERT(!sink.done);
+
+	while (g_num_ends > 0) {
+		ut_complete_end();
+	}
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(g_num_ios == 0);
+}
+
+static void
+test_stream_offload(void)
+{
+	struct nvmf_ndp_extent extent = { .offset_blocks = 2, .num_blocks = 8 };
+	struct nvmf_ndp_stream_opts opts;
+	struct ut_sink sink = {};
+	int rc;
+
+	ut_init();
+	g_offload_enabled = true;
+	nvmf_ndp_stream_opts_init(&opts);
+	opts.chunk_size = 2 * UT_BLOCK_SIZE;
+	opts.depth = 3;
+
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	SPDK_CU_ASSERT_FATAL(g_num_ios == 3);
+
+	/* Only one chunk is handed out at a time, the next one waits for it */
+	ut_complete_io(0, true);
+	ut_complete_io(0, true);
+	CU_ASSERT(g_offload_ctx != NULL);
+	CU_ASSERT(sink.calls == 0);
+	CU_ASSERT(g_num_ios == 1);
+
+	ut_complete_offload();
+	CU_ASSERT(sink.calls == 1);
+	CU_ASSERT(g_num_ios == 2);
+	CU_ASSERT(g_offload_ctx != NULL);
+
+	while (g_num_ios > 0 || g_offload_ctx != NULL) {
+		CU_ASSERT(!sink.done);
+		if (g_offload_ctx != NULL) {
+			ut_complete_offload();
+		} else {
+			ut_complete_io(0, true);
+		}
+	}
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.calls == 4);
+	CU_ASSERT(sink.len == 8 * UT_BLOCK_SIZE);
+	CU_ASSERT(memcmp(sink.data, &g_disk[2 * UT_BLOCK_SIZE], sink.len) == 0);
+
+	/* A read error while a chunk is out waits for the chunk to come back */
+	memset(&sink, 0, sizeof(sink));
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	ut_complete_io(0, true);
+	CU_ASSERT(g_offload_ctx != NULL);
+	ut_complete_io(0, false);
+	ut_complete_io(0, true);
+	CU_ASSERT(!sink.done);
+
+	ut_complete_offload();
+	CU_ASSERT(sink.calls == 1);
+	CU_ASSERT(g_offload_ctx == NULL);
+	CU_ASSERT(g_num_ios == 0);
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == -EIO);
+
+	/* Without offload threads the chunks are delivered inline */
+	g_offload_enabled = false;
+	memset(&sink, 0, sizeof(sink));
+	rc = nvmf_ndp_stream_start(&g_req, NULL, NULL, &extent, 1, &opts, ut_data, ut_done, &sink);
+	CU_ASSERT(rc == 0);
+	ut_complete_all();
+	CU_ASSERT(sink.done);
+	CU_ASSERT(sink.status == 0);
+	CU_ASSERT(sink.calls == 4);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_stream", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_stream_raw_in_order);
+	CU_ADD_TEST(suite, test_stream_length);
+	CU_ADD_TEST(suite, test_stream_offset);
+	CU_ADD_TEST(suite, test_stream_boundary);
+	CU_ADD_TEST(suite, test_stream_lines);
+	CU_ADD_TEST(suite, test_stream_lines_long_record);
+	CU_ADD_TEST(suite, test_stream_early_stop);
+	CU_ADD_TEST(suite, test_stream_read_error);
+	CU_ADD_TEST(suite, test_stream_abort);
+	CU_ADD_TEST(suite, test_stream_nomem);
+	CU_ADD_TEST(suite, test_stream_invalid);
+	CU_ADD_TEST(suite, test_stream_zcopy);
+	CU_ADD_TEST(suite, test_stream_offload);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
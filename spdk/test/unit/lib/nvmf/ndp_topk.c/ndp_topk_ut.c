@@ -0,0 +1,331 @@
+/*   SPDX-License-Identifier: BSD-3-Clause
+ *   All rights reserved.
+ */
+
+#include "spdk/stdinc.h"
+
+#include "spdk_internal/cunit.h"
+#include "spdk_internal/mock.h"
+
+#include "common/lib/test_env.c"
+#include "nvmf/ndp_filter.c"
+#include "nvmf/ndp_topk.c"
+
+SPDK_LOG_REGISTER_COMPONENT(nvmf)
+
+#define UT_ARGS_SIZE	256
+#define UT_RESULT_SIZE	4096
+
+struct ut_args {
+	char		buf[UT_ARGS_SIZE];
+	size_t		len;
+};
+
+static const char *g_csv =
+	"GET,200,512\n"
+	"POST,401,64\n"
+	"GET,200,20480\n"
+	"PUT,500,-3\n"
+	"GET,404,n/a\n"
+	"GET\n"
+	"GET,200,512\n"
+	"DELETE,204,0.5";
+
+/*
+ * Top K records by key_column, or a sample if type is 0.  Returns column 0 if
+ * select is set, the whole record otherwise.
+ */
+static void
+ut_args_init(struct ut_args *args, uint8_t type, uint8_t flags, uint16_t key_column,
+	     uint32_t k, uint32_t seed, bool select)
+{
+	struct nvmf_ndp_topk_hdr *topk = (struct nvmf_ndp_topk_hdr *)args->buf;
+	struct nvmf_ndp_filter_hdr *hdr;
+
+	memset(args, 0, sizeof(*args));
+	to_le32(&topk->magic, NVMF_NDP_TOPK_MAGIC);
+	topk->type = type;
+	topk->flags = flags;
+	to_le16(&topk->key_column, key_column);
+	to_le32(&topk->k, k);
+	to_le32(&topk->seed, seed);
+
+	hdr = (struct nvmf_ndp_filter_hdr *)(args->buf + sizeof(*topk));
+	to_le32(&hdr->magic, NVMF_NDP_FILTER_MAGIC);
+	hdr->delimiter = ',';
+	to_le16(&hdr->num_columns, select ? 1 : 0);
+	args->len = sizeof(*topk) + sizeof(*hdr) + (select ? 8 : 0);
+}
+
+/* Whether the last result of ut_topk() was cut short for lack of space */
+static bool g_truncated;
+
+/* Run the engine over text, split in parts of part_len bytes cut after a newline */
+static size_t
+ut_topk(const struct ut_args *args, bool sample, uint32_t result_size, const char *text,
+	char *result)
+{
+	struct nvmf_ndp_topk *topk;
+	struct iovec iov;
+	const char *end;
+	size_t len;
+
+	SPDK_CU_ASSERT_FATAL(nvmf_ndp_topk_create(args->buf, args->len, sample, result_size,
+			     &topk) == 0);
+
+	/* One record at a time */
+	while (*text != '\0') {
+		end = strchr(text, '\n');
+		iov.iov_base = (char *)text;
+		iov.iov_len = end != NULL ? (size_t)(end - text) + 1 : strlen(text);
+		nvmf_ndp_topk_scan(topk, &iov, 1);
+		text += iov.iov_len;
+	}
+
+	iov.iov_base = result;
+	iov.iov_len = UT_RESULT_SIZE;
+	len = nvmf_ndp_topk_get_result(topk, &iov, 1);
+	result[len] = '\0';
+	g_truncated = nvmf_ndp_topk_truncated(topk);
+	nvmf_ndp_topk_free(topk);
+
+	CU_ASSERT(len <= result_size);
+	return len;
+}
+
+static void
+test_topk_create(void)
+{
+	struct nvmf_ndp_topk *topk;
+	struct ut_args args;
+	int rc;
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 2, 10, 0, false);
+	rc = nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE, &topk);
+	SPDK_CU_ASSERT_FATAL(rc == 0);
+	CU_ASSERT(topk->budget == UT_RESULT_SIZE);
+	nvmf_ndp_topk_free(topk);
+
+	/* The result is capped to half of the arena */
+	rc = nvmf_ndp_topk_create(args.buf, args.len, false, UINT32_MAX, &topk);
+	SPDK_CU_ASSERT_FATAL(rc == 0);
+	CU_ASSERT(topk->budget == NVMF_NDP_TOPK_ARENA_SIZE / 2);
+	nvmf_ndp_topk_free(topk);
+
+	/* A top K needs a numeric key, a sample none */
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, true, UT_RESULT_SIZE, &topk) == -EINVAL);
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_STRING, 0, 2, 10, 0, false);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EINVAL);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, true, UT_RESULT_SIZE, &topk) == -EINVAL);
+	ut_args_init(&args, 0, 0, 0, 10, 1, false);
+	rc = nvmf_ndp_topk_create(args.buf, args.len, true, UT_RESULT_SIZE, &topk);
+	SPDK_CU_ASSERT_FATAL(rc == 0);
+	nvmf_ndp_topk_free(topk);
+
+	/* Truncated, bad magic, k, flags and key column */
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, sizeof(struct nvmf_ndp_topk_hdr) - 1, true,
+				       UT_RESULT_SIZE, &topk) == -EINVAL);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, sizeof(struct nvmf_ndp_topk_hdr), true,
+				       UT_RESULT_SIZE, &topk) == -EINVAL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 2, 10, 0, false);
+	args.buf[0] ^= 0xff;
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EINVAL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 2, 0, 0, false);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EINVAL);
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 2, NVMF_NDP_TOPK_MAX_K + 1, 0, false);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EINVAL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0x2, 2, 10, 0, false);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EINVAL);
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, NVMF_NDP_FILTER_MAX_COLUMN + 1, 10, 0,
+		     false);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EINVAL);
+
+	/* No heap left in the mempool */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 2, 10, 0, false);
+	MOCK_SET(spdk_mempool_get, NULL);
+	CU_ASSERT(nvmf_ndp_topk_create(args.buf, args.len, false, UT_RESULT_SIZE,
+				       &topk) == -EAGAIN);
+	MOCK_CLEAR(spdk_mempool_get);
+}
+
+static void
+test_topk_order(void)
+{
+	char result[UT_RESULT_SIZE + 1];
+	struct ut_args args;
+
+	/* The largest sizes, the equal ones in input order; "n/a" and missing keys are skipped */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 2, 3, 0, false);
+	ut_topk(&args, false, UT_RESULT_SIZE, g_csv, result);
+	CU_ASSERT_STRING_EQUAL(result, "GET,200,20480\nGET,200,512\nGET,200,512\n");
+	CU_ASSERT(!g_truncated);
+
+	/* The smallest, "0.5" is not an integer */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, NVMF_NDP_TOPK_FLAG_ASCENDING, 2, 2, 0, false);
+	ut_topk(&args, false, UT_RESULT_SIZE, g_csv, result);
+	CU_ASSERT_STRING_EQUAL(result, "PUT,500,-3\nPOST,401,64\n");
+
+	/* As floats, returning the selected column only, the last record gets its newline */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_FLOAT, NVMF_NDP_TOPK_FLAG_ASCENDING, 2, 3, 0, true);
+	ut_topk(&args, false, UT_RESULT_SIZE, g_csv, result);
+	CU_ASSERT_STRING_EQUAL(result, "PUT\nDELETE\nPOST\n");
+
+	/* Fewer records than K */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 1, 100, 0, true);
+	ut_topk(&args, false, UT_RESULT_SIZE, g_csv, result);
+	CU_ASSERT_STRING_EQUAL(result, "PUT\nGET\nPOST\nDELETE\nGET\nGET\nGET\n");
+}
+
+static int
+ut_cmp_desc(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t *)a, ib = *(const int64_t *)b;
+
+	return (ia < ib) - (ia > ib);
+}
+
+static void
+test_topk_budget(void)
+{
+	char result[UT_RESULT_SIZE + 1], line[64], *text, *p;
+	int64_t keys[20000], expected;
+	struct ut_args args;
+	uint32_t n, i, j;
+	size_t len;
+
+	/* Each line "<key>,xxxx...\n" is 24 bytes, 6 fit in 150 */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 10, 0, false);
+	len = ut_topk(&args, false, 150,
+		      "1,xxxxxxxxxxxxxxxxxxxxx\n9,xxxxxxxxxxxxxxxxxxxxx\n3,xxxxxxxxxxxxxxxxxxxxx\n"
+		      "7,xxxxxxxxxxxxxxxxxxxxx\n5,xxxxxxxxxxxxxxxxxxxxx\n8,xxxxxxxxxxxxxxxxxxxxx\n"
+		      "2,xxxxxxxxxxxxxxxxxxxxx\n6,xxxxxxxxxxxxxxxxxxxxx\n4,xxxxxxxxxxxxxxxxxxxxx\n"
+		      "0,x\n", result);
+	CU_ASSERT(len == 6 * 24);
+	CU_ASSERT(g_truncated);
+	CU_ASSERT(strncmp(result, "9,", 2) == 0);
+	CU_ASSERT(strncmp(result + 5 * 24, "4,", 2) == 0);
+
+	/* Once a record was dropped, shorter but lower ones don't take its place */
+	len = ut_topk(&args, false, 150,
+		      "9,xxxxxxxxxxxxxxxxxxxxx\n8,xxxxxxxxxxxxxxxxxxxxx\n7,xxxxxxxxxxxxxxxxxxxxx\n"
+		      "6,xxxxxxxxxxxxxxxxxxxxx\n5,xxxxxxxxxxxxxxxxxxxxx\n4,xxxxxxxxxxxxxxxxxxxxx\n"
+		      "3,xxxxxxxxxxxxxxxxxxxxx\n2,x\n", result);
+	CU_ASSERT(len == 6 * 24);
+	CU_ASSERT(strstr(result, "2,x\n") == NULL);
+
+	/* A record longer than the result is truncated */
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 1, 0, false);
+	len = ut_topk(&args, false, 8, "1,abcdefghijkl\n", result);
+	CU_ASSERT(len == 8);
+	CU_ASSERT(g_truncated);
+	CU_ASSERT(memcmp(result, "1,abcdef", 8) == 0);
+
+	/*
+	 * Enough records going through the heap to compact the arena many times:
+	 * keys mostly rising so that nearly every record replaces the worst.
+	 */
+	n = SPDK_COUNTOF(keys);
+	text = malloc(n * sizeof(line));
+	SPDK_CU_ASSERT_FATAL(text != NULL);
+	p = text;
+	for (i = 0; i < n; i++) {
+		keys[i] = (int64_t)i * 7 - (int64_t)(i % 13) * 1000;
+		p += sprintf(p, "%" PRId64 ",%0*u\n", keys[i], (int)(i % 40), i);
+	}
+
+	ut_args_init(&args, NVMF_NDP_FILTER_TYPE_INT, 0, 0, 50, 0, false);
+	len = ut_topk(&args, false, UT_RESULT_SIZE, text, result);
+	qsort(keys, n, sizeof(keys[0]), ut_cmp_desc);
+	p = result;
+	for (j = 0; j < 50 && p < result + len; j++) {
+		expected = strtoll(p, &p, 10);
+		CU_ASSERT(expected == keys[j]);
+		p = strchr(p, '\n') + 1;
+	}
+	CU_ASSERT(j == 50);
+	CU_ASSERT(p == result + len);
+
+	free(text);
+}
+
+static void
+test_topk_sample(void)
+{
+	char result[UT_RESULT_SIZE + 1], result2[UT_RESULT_SIZE + 1], text[100 * 4 + 1];
+	uint32_t counts[100] = {}, seed, i, n;
+	struct ut_args args;
+	unsigned long v, last;
+	char *p;
+
+	for (i = 0; i < 100; i++) {
+		sprintf(text + i * 4, "%03u\n", i);
+	}
+
+	/* Everything fits, in input order */
+	ut_args_init(&args, 0, 0, 0, 100, 1, false);
+	ut_topk(&args, true, UT_RESULT_SIZE, text, result);
+	CU_ASSERT_STRING_EQUAL(result, text);
+	CU_ASSERT(!g_truncated);
+
+	/* Repeatable for a seed */
+	ut_args_init(&args, 0, 0, 0, 10, 7, false);
+	ut_topk(&args, true, UT_RESULT_SIZE, text, result);
+	ut_topk(&args, true, UT_RESULT_SIZE, text, result2);
+	CU_ASSERT_STRING_EQUAL(result, result2);
+
+	/* K distinct records in input order, every record equally likely */
+	for (seed = 1; seed <= 2000; seed++) {
+		ut_args_init(&args, 0, 0, 0, 10, seed, false);
+		CU_ASSERT(ut_topk(&args, true, UT_RESULT_SIZE, text, result) == 10 * 4);
+
+		p = result;
+		for (n = 0; *p != '\0'; n++) {
+			v = strtoul(p, &p, 10);
+			SPDK_CU_ASSERT_FATAL(v < 100 && *p == '\n');
+			CU_ASSERT(n == 0 || v > last);
+			counts[v]++;
+			last = v;
+			p++;
+		}
+		CU_ASSERT(n == 10);
+	}
+	for (i = 0; i < 100; i++) {
+		/* 200 expected, standard deviation about 13.4 */
+		CU_ASSERT(counts[i] > 140 && counts[i] < 260);
+	}
+
+	/* Only what fits is kept */
+	ut_args_init(&args, 0, 0, 0, 10, 3, false);
+	CU_ASSERT(ut_topk(&args, true, 20, text, result) == 20);
+	CU_ASSERT(g_truncated);
+}
+
+int
+main(int argc, char **argv)
+{
+	CU_pSuite	suite = NULL;
+	unsigned int	num_failures;
+
+	CU_initialize_registry();
+
+	suite = CU_add_suite("nvmf_ndp_topk", NULL, NULL);
+
+	CU_ADD_TEST(suite, test_topk_create);
+	CU_ADD_TEST(suite, test_topk_order);
+	CU_ADD_TEST(suite, test_topk_budget);
+	CU_ADD_TEST(suite, test_topk_sample);
+
+	num_failures = spdk_ut_run_tests(argc, argv, NULL);
+	CU_cleanup_registry();
+	return num_failures;
+}
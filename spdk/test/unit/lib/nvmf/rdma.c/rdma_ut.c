@@ -38,6 +38,8 @@ DEFINE_STUB_V(spdk_mem_map_free, (struct spdk_mem_map **pmap));
 
 DEFINE_STUB_V(spdk_nvmf_request_exec, (struct spdk_nvmf_request *req));
 DEFINE_STUB(spdk_nvmf_request_complete, int, (struct spdk_nvmf_request *req), 0);
+DEFINE_STUB(spdk_nvmf_ndp_get_xfer, bool, (uint8_t opc, enum spdk_nvme_data_transfer *xfer),
+	    false);
 DEFINE_STUB(spdk_nvme_transport_id_compare, int, (const struct spdk_nvme_transport_id *trid1,
 		const struct spdk_nvme_transport_id *trid2), 0);
 DEFINE_STUB_V(spdk_nvmf_ctrlr_abort_aer, (struct spdk_nvmf_ctrlr *ctrlr));
@@ -120,25 +120,21 @@ DEFINE_STUB(nvmf_bdev_ctrlr_write_cmd,
 	     struct spdk_nvmf_request *req),
 	    0);
 
-DEFINE_STUB(nvmf_bdev_ctrlr_custom_echo_cmd,
-	    int,
-	    (struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
-	     struct spdk_nvmf_request *req),
-	    0);
+DEFINE_STUB(spdk_nvmf_ndp_get_op, const struct spdk_nvmf_ndp_op *, (uint8_t opc), NULL);
 
-DEFINE_STUB(nvmf_bdev_ctrlr_custom_grep_cmd,
+DEFINE_STUB(nvmf_ndp_exec,
 	    int,
-	    (struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
-	     struct spdk_nvmf_request *req),
+	    (const struct spdk_nvmf_ndp_op *op, struct spdk_bdev *bdev, struct spdk_bdev_desc *desc,
+	     struct spdk_io_channel *ch, struct spdk_nvmf_request *req),
 	    0);
 
-#ifdef HEAAN_LIB
-DEFINE_STUB(nvmf_bdev_ctrlr_custom_heaan_cipadd_cmd,
-	    int,
-	    (struct spdk_bdev *bdev, struct spdk_bdev_desc *desc, struct spdk_io_channel *ch,
-	     struct spdk_nvmf_request *req),
-	    0);
-#endif
+DEFINE_STUB_V(nvmf_ndp_fill_cmds_and_effects,
+	      (struct spdk_nvme_cmds_and_effect_log_page *log_page));
+DEFINE_STUB_V(nvmf_ndp_cache_invalidate_io, (struct spdk_nvmf_request *req));
+DEFINE_STUB(nvmf_ndp_abort_request, bool, (struct spdk_nvmf_request *req), false);
+
+DEFINE_STUB(spdk_nvmf_ndp_get_xfer, bool,
+	    (uint8_t opc, enum spdk_nvme_data_transfer *xfer), false);
 
 DEFINE_STUB(nvmf_bdev_ctrlr_compare_cmd,
 	    int,
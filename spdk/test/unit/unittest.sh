@@ -111,6 +111,22 @@ function unittest_nvmf() {
 	$valgrind $testdir/lib/nvmf/subsystem.c/subsystem_ut
 	$valgrind $testdir/lib/nvmf/tcp.c/tcp_ut
 	$valgrind $testdir/lib/nvmf/nvmf.c/nvmf_ut
+	$valgrind $testdir/lib/nvmf/ndp.c/ndp_ut
+	$valgrind $testdir/lib/nvmf/ndp_stream.c/ndp_stream_ut
+	$valgrind $testdir/lib/nvmf/ndp_grep.c/ndp_grep_ut
+	$valgrind $testdir/lib/nvmf/ndp_desc.c/ndp_desc_ut
+	$valgrind $testdir/lib/nvmf/ndp_io.c/ndp_io_ut
+	$valgrind $testdir/lib/nvmf/ndp_offload.c/ndp_offload_ut
+	$valgrind $testdir/lib/nvmf/ndp_cursor.c/ndp_cursor_ut
+	$valgrind $testdir/lib/nvmf/ndp_cache.c/ndp_cache_ut
+	$valgrind $testdir/lib/nvmf/ndp_filter.c/ndp_filter_ut
+	$valgrind $testdir/lib/nvmf/ndp_agg.c/ndp_agg_ut
+	$valgrind $testdir/lib/nvmf/ndp_regex.c/ndp_regex_ut
+	$valgrind $testdir/lib/nvmf/ndp_topk.c/ndp_topk_ut
+	$valgrind $testdir/lib/nvmf/ndp_batch.c/ndp_batch_ut
+	$valgrind $testdir/lib/nvmf/ndp_ops.c/ndp_ops_ut
+	$valgrind $testdir/lib/nvmf/ndp_he_ct.c/ndp_he_ct_ut
+	$valgrind $testdir/lib/nvmf/ndp_he_ntt.c/ndp_he_ntt_ut
 }
 
 function unittest_scsi() {